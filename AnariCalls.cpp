@@ -0,0 +1,222 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "AnariCalls.h"
+// std
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace anari_calls {
+
+namespace {
+
+const char *g_names[NumCalls] = {
+    "anari::setParameter",
+    "anari::commitParameters",
+    "anari::render",
+    "anari::map",
+};
+const char *g_shortNames[NumCalls] = {"setParameter", "commit", "render", "map"};
+
+std::atomic<uint64_t> g_calls[NumCalls];
+std::atomic<uint64_t> g_timed[NumCalls];
+std::atomic<uint64_t> g_nanoseconds[NumCalls];
+std::atomic<uint64_t> g_skipped[NumCalls];
+
+// per UI frame, from endFrame()
+std::mutex g_frameMutex;
+Counts g_previousTotals;
+Counts g_lastFrame;
+Counts g_peak;
+uint64_t g_numFrames{0};
+
+Counts readTotals()
+{
+  Counts counts;
+  for (int c = 0; c < NumCalls; ++c) {
+    const uint64_t calls = g_calls[c].load(std::memory_order_relaxed);
+    const uint64_t timed = g_timed[c].load(std::memory_order_relaxed);
+    const uint64_t ns = g_nanoseconds[c].load(std::memory_order_relaxed);
+    counts.calls[c] = calls;
+    counts.skipped[c] = g_skipped[c].load(std::memory_order_relaxed);
+    counts.ms[c] = timed ? 1e-6 * ns * calls / timed : 0.0;
+  }
+  return counts;
+}
+
+} // namespace
+
+bool count(Call call)
+{
+  g_calls[call].fetch_add(1, std::memory_order_relaxed);
+  thread_local unsigned calls[NumCalls]{};
+  const unsigned every = g_sampleEvery.load(std::memory_order_relaxed);
+  return every != 0 && calls[call]++ % every == 0;
+}
+
+void record(Call call, trace::Clock::time_point begin)
+{
+  const auto end = trace::Clock::now();
+  const auto ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
+  g_timed[call].fetch_add(1, std::memory_order_relaxed);
+  g_nanoseconds[call].fetch_add(
+      uint64_t(ns.count()), std::memory_order_relaxed);
+  if (trace::enabled())
+    trace::record(g_names[call], "anari", begin, end);
+}
+
+void skipped(Call call)
+{
+  g_skipped[call].fetch_add(1, std::memory_order_relaxed);
+}
+
+Counts totals()
+{
+  return readTotals();
+}
+
+Counts endFrame()
+{
+  const Counts now = readTotals();
+  std::lock_guard<std::mutex> lock(g_frameMutex);
+  for (int c = 0; c < NumCalls; ++c) {
+    g_lastFrame.calls[c] = now.calls[c] - g_previousTotals.calls[c];
+    g_lastFrame.skipped[c] = now.skipped[c] - g_previousTotals.skipped[c];
+    g_lastFrame.ms[c] = std::max(now.ms[c] - g_previousTotals.ms[c], 0.0);
+    g_peak.calls[c] = std::max(g_peak.calls[c], g_lastFrame.calls[c]);
+    g_peak.ms[c] = std::max(g_peak.ms[c], g_lastFrame.ms[c]);
+  }
+  g_previousTotals = now;
+  ++g_numFrames;
+  return g_lastFrame;
+}
+
+Counts lastFrame()
+{
+  std::lock_guard<std::mutex> lock(g_frameMutex);
+  return g_lastFrame;
+}
+
+Counts peak()
+{
+  std::lock_guard<std::mutex> lock(g_frameMutex);
+  return g_peak;
+}
+
+std::string summary()
+{
+  const Counts counts = readTotals();
+  const Counts most = peak();
+  uint64_t frames = 0;
+  {
+    std::lock_guard<std::mutex> lock(g_frameMutex);
+    frames = g_numFrames;
+  }
+  std::string result;
+  char line[160];
+  for (int c = 0; c < NumCalls; ++c) {
+    if (frames > 0) {
+      std::snprintf(line,
+          sizeof(line),
+          "%14s: %llu calls (%.1f/frame, peak %llu), %.2fms",
+          g_shortNames[c],
+          (unsigned long long)counts.calls[c],
+          double(counts.calls[c]) / frames,
+          (unsigned long long)most.calls[c],
+          counts.ms[c]);
+    } else {
+      std::snprintf(line,
+          sizeof(line),
+          "%14s: %llu calls, %.2fms",
+          g_shortNames[c],
+          (unsigned long long)counts.calls[c],
+          counts.ms[c]);
+    }
+    result += line;
+    if (counts.skipped[c] > 0) {
+      std::snprintf(line,
+          sizeof(line),
+          ", %llu unchanged skipped",
+          (unsigned long long)counts.skipped[c]);
+      result += line;
+    }
+    result += '\n';
+  }
+  return result;
+}
+
+void ParameterCache::set(anari::Device d,
+    anari::Object o,
+    const char *name,
+    anari::DataType type,
+    const void *value,
+    size_t bytes)
+{
+  if (changed(o, name, value, bytes))
+    setParameter(d, o, name, type, value);
+}
+
+void ParameterCache::unset(anari::Device d, anari::Object o, const char *name)
+{
+  if (changed(o, name, nullptr, 0))
+    anari::unsetParameter(d, o, name);
+}
+
+void ParameterCache::commit(anari::Device d, anari::Object o)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto &parameters = m_objects[o];
+    if (!parameters.dirty) {
+      skipped(Commit);
+      return;
+    }
+    parameters.dirty = false;
+  }
+  commitParameters(d, o);
+}
+
+void ParameterCache::forget(anari::Object o)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_objects.erase(o);
+}
+
+bool ParameterCache::changed(
+    anari::Object o, const char *name, const void *value, size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto &parameters = m_objects[o];
+  auto found = parameters.values.find(name);
+  // an unknown parameter may have been set by the device's defaults
+  const bool known = found != parameters.values.end();
+  auto &stored = known ? found->second : parameters.values[name];
+  if (known && stored.size() == bytes
+      && (bytes == 0 || std::memcmp(stored.data(), value, bytes) == 0)) {
+    skipped(SetParameter);
+    return false;
+  }
+  const auto *begin = static_cast<const uint8_t *>(value);
+  stored.assign(begin, begin + bytes);
+  parameters.dirty = true;
+  return true;
+}
+
+Session::Session(unsigned sampleEvery) : m_sampleEvery(sampleEvery)
+{
+  g_sampleEvery = sampleEvery;
+}
+
+Session::~Session()
+{
+  if (m_sampleEvery == 0)
+    return;
+  g_sampleEvery = 0;
+  std::printf("ANARI calls (1 in %u timed):\n%s",
+      m_sampleEvery,
+      summary().c_str());
+}
+
+} // namespace anari_calls
@@ -0,0 +1,195 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// anari
+#include <anari/anari_cpp.hpp>
+// std
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+// ours
+#include "Trace.h"
+
+// Counting the ANARI calls the viewer makes /////////////////////////////////
+//
+// Thin wrappers around anari::setParameter(), commitParameters(), render()
+// and map() that count every call and time every Nth one (per thread), for
+// sessions where the debug device (--debug, --trace) is far too slow: a
+// disabled counter costs one relaxed atomic load, an enabled one an atomic
+// increment, plus two clock reads for the sampled calls. Per-UI-frame
+// counts show commit storms in the viewport's stats; a summary is printed
+// when the session ends. Sampled calls also go to the --profile trace.
+// ParameterCache skips the sets and commits that would change nothing; it
+// counts those whether or not the calls are.
+namespace anari_calls {
+
+enum Call
+{
+  SetParameter,
+  Commit,
+  Render,
+  Map,
+  NumCalls
+};
+
+struct Counts
+{
+  uint64_t calls[NumCalls]{};
+  // left out by ParameterCache (SetParameter and Commit)
+  uint64_t skipped[NumCalls]{};
+  // estimated from the sampled calls: their mean times the calls
+  double ms[NumCalls]{};
+};
+
+inline std::atomic<unsigned> g_sampleEvery{0}; // 0: off
+
+inline bool enabled()
+{
+  return g_sampleEvery.load(std::memory_order_relaxed) != 0;
+}
+
+// Counts a call; true if it is one to time (every Nth of this thread)
+bool count(Call call);
+// A timed call that started at begin and just returned
+void record(Call call, trace::Clock::time_point begin);
+// A call ParameterCache found nothing to do for
+void skipped(Call call);
+
+// Since the session started
+Counts totals();
+// The calls since the previous endFrame(), called once per UI frame; the
+// most calls of each kind in one frame are kept for peak()
+Counts endFrame();
+Counts lastFrame();
+Counts peak();
+
+// Counts from construction on, timing every sampleEvery-th call, and
+// prints the totals when destroyed; 0 leaves counting off
+class Session
+{
+ public:
+  explicit Session(unsigned sampleEvery);
+  ~Session();
+
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+
+ private:
+  unsigned m_sampleEvery{0};
+};
+
+class Scope
+{
+ public:
+  explicit Scope(Call call) : m_call(call), m_timed(enabled() && count(call))
+  {
+    if (m_timed)
+      m_begin = trace::Clock::now();
+  }
+
+  ~Scope()
+  {
+    if (m_timed)
+      record(m_call, m_begin);
+  }
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+ private:
+  Call m_call;
+  bool m_timed;
+  trace::Clock::time_point m_begin;
+};
+
+template <typename... Args>
+void setParameter(anari::Device d, Args &&...args)
+{
+  Scope scope(SetParameter);
+  anari::setParameter(d, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+void setAndReleaseParameter(anari::Device d, Args &&...args)
+{
+  Scope scope(SetParameter);
+  anari::setAndReleaseParameter(d, std::forward<Args>(args)...);
+}
+
+template <typename T>
+void commitParameters(anari::Device d, T object)
+{
+  Scope scope(Commit);
+  anari::commitParameters(d, object);
+}
+
+inline void render(anari::Device d, anari::Frame frame)
+{
+  Scope scope(Render);
+  anari::render(d, frame);
+}
+
+template <typename T>
+anari::MappedFrameData<T> map(
+    anari::Device d, anari::Frame frame, const char *channel)
+{
+  Scope scope(Map);
+  return anari::map<T>(d, frame, channel);
+}
+
+// The values last set through it, per object: set() and commit() only call
+// ANARI for values that changed, as some devices restart accumulation or
+// rebuild internal state on any commit. All sets of an object's parameters
+// have to go through the same cache, and released objects be forget()-ed
+// (their handles are reused). Thread-safe.
+class ParameterCache
+{
+ public:
+  template <typename T>
+  void set(anari::Device d, anari::Object o, const char *name, const T &value)
+  {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (changed(o, name, &value, sizeof(T)))
+      setParameter(d, o, name, value);
+  }
+
+  // bytes at value, of type (e.g. ANARI_FLOAT32_BOX2 and four floats)
+  void set(anari::Device d,
+      anari::Object o,
+      const char *name,
+      anari::DataType type,
+      const void *value,
+      size_t bytes);
+  void unset(anari::Device d, anari::Object o, const char *name);
+
+  // Commits o if a parameter changed since its last commit
+  void commit(anari::Device d, anari::Object o);
+
+  void forget(anari::Object o);
+
+ private:
+  struct Parameters
+  {
+    std::unordered_map<std::string, std::vector<uint8_t>> values;
+    bool dirty{false};
+  };
+
+  // Records the value (nullptr: unset); false if o already had it
+  bool changed(
+      anari::Object o, const char *name, const void *value, size_t bytes);
+
+  std::mutex m_mutex;
+  std::unordered_map<anari::Object, Parameters> m_objects;
+};
+
+// e.g. "commit: 1234 calls (2.1/frame, peak 57), 3.20ms"
+std::string summary();
+
+} // namespace anari_calls
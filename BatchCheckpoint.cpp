@@ -0,0 +1,160 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "BatchCheckpoint.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// std
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+// posix
+#include <fcntl.h>
+#include <unistd.h>
+
+bool BatchCheckpoint::open(const std::string &outputDir,
+    const std::string &job,
+    size_t count,
+    bool resume,
+    std::chrono::seconds interval)
+{
+  std::error_code ec;
+  std::filesystem::create_directories(outputDir, ec);
+  if (ec) {
+    std::cerr << "Could not create " << outputDir << ": " << ec.message()
+              << "\n";
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_file = (std::filesystem::path(outputDir) / "checkpoint.json").string();
+  m_job = job;
+  m_interval = interval;
+  m_lastSave = std::chrono::steady_clock::now();
+  m_done.assign(count, 0);
+  m_numDone = 0;
+  if (!resume || !std::filesystem::exists(m_file))
+    return true;
+
+  std::ifstream in(m_file);
+  try {
+    const auto data = nlohmann::json::parse(in);
+    if (data.at("job").get<std::string>() != job
+        || data.at("count").get<size_t>() != count) {
+      std::cerr << "Checkpoint " << m_file
+                << " is of another job, remove it to start over\n";
+      return false;
+    }
+    for (const auto &range : data.at("done")) {
+      const size_t begin = range.at(0).get<size_t>();
+      const size_t end = std::min(range.at(1).get<size_t>(), count);
+      for (size_t i = begin; i < end; ++i) {
+        m_numDone += !m_done[i];
+        m_done[i] = 1;
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Could not parse checkpoint " << m_file << ": " << e.what()
+              << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool BatchCheckpoint::done(size_t index) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return index < m_done.size() && m_done[index];
+}
+
+bool BatchCheckpoint::done(size_t begin, size_t end) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (size_t i = begin; i < end; ++i) {
+    if (i >= m_done.size() || !m_done[i])
+      return false;
+  }
+  return true;
+}
+
+size_t BatchCheckpoint::numDone() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_numDone;
+}
+
+void BatchCheckpoint::written(size_t index)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (index >= m_done.size() || m_done[index])
+    return;
+  m_done[index] = 1;
+  ++m_numDone;
+  if (std::chrono::steady_clock::now() - m_lastSave >= m_interval)
+    saveLocked();
+}
+
+bool BatchCheckpoint::save()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return saveLocked();
+}
+
+const std::string &BatchCheckpoint::file() const
+{
+  return m_file;
+}
+
+bool BatchCheckpoint::saveLocked()
+{
+  m_lastSave = std::chrono::steady_clock::now();
+  if (m_file.empty())
+    return false;
+
+  nlohmann::json ranges = nlohmann::json::array();
+  for (size_t i = 0; i < m_done.size();) {
+    if (!m_done[i]) {
+      ++i;
+      continue;
+    }
+    const size_t begin = i;
+    while (i < m_done.size() && m_done[i])
+      ++i;
+    ranges.push_back({begin, i});
+  }
+  const std::string text =
+      nlohmann::json{{"job", m_job}, {"count", m_done.size()}, {"done", ranges}}
+          .dump()
+      + "\n";
+
+  // the outputs reported so far reach the disk before the checkpoint
+  // naming them does
+  const auto dir = std::filesystem::path(m_file).parent_path();
+  const int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dirFd >= 0) {
+    ::syncfs(dirFd);
+    ::close(dirFd);
+  }
+
+  // synced before the rename, so after a crash the file is the old
+  // checkpoint or the new one, never a torn one
+  const std::string temp = m_file + ".tmp";
+  const int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0;
+  for (size_t written = 0; ok && written < text.size();) {
+    const ssize_t n = ::write(fd, text.data() + written, text.size() - written);
+    ok = n > 0;
+    written += ok ? size_t(n) : 0;
+  }
+  ok = ok && ::fsync(fd) == 0;
+  if (fd >= 0)
+    ok = ::close(fd) == 0 && ok;
+  std::error_code ec;
+  if (ok)
+    std::filesystem::rename(temp, m_file, ec);
+  if (!ok || ec) {
+    std::cerr << "Could not write checkpoint " << m_file << "\n";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,68 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Progress of a long batch job ///////////////////////////////////////////////
+//
+// Which of a job's `count` outputs are on disk, kept as
+// <outputDir>/checkpoint.json so a job killed part way (a preempted node)
+// is resumed (--resume) instead of started over:
+//
+//   {"job": "<inputs and settings>", "count": 100000,
+//    "done": [[0, 41200], [41216, 41984]]}
+//
+// `done` are half-open index ranges. The writers report an output once it
+// is written (ImageWriter, ShardWriter; TarShardWriter once its shard is
+// complete), and the output directory's file system is synced before each
+// save, so the checkpoint never names an output a crash could have cut
+// short. The file is replaced atomically (written, synced, renamed) at
+// most every `interval` and when the job ends. A checkpoint of another
+// job (other volume, poses or output settings) is not resumed.
+
+class BatchCheckpoint
+{
+ public:
+  static constexpr std::chrono::seconds defaultInterval{30};
+
+  // Starts tracking `count` outputs in outputDir; with `resume` those an
+  // earlier run of the same job recorded count as done. False, with a
+  // message, if the checkpoint to resume is of another job or unreadable.
+  bool open(const std::string &outputDir,
+      const std::string &job,
+      size_t count,
+      bool resume,
+      std::chrono::seconds interval = defaultInterval);
+
+  bool done(size_t index) const;
+  // Whether all of [begin, end) are done
+  bool done(size_t begin, size_t end) const;
+  size_t numDone() const;
+
+  // Thread-safe; output `index` is on disk. Saves the checkpoint if the
+  // interval has passed since the last save.
+  void written(size_t index);
+  // Saves now; false, with a message, if the file cannot be written
+  bool save();
+
+  const std::string &file() const;
+
+ private:
+  bool saveLocked();
+
+  std::string m_file;
+  std::string m_job;
+  std::chrono::seconds m_interval{defaultInterval};
+  std::chrono::steady_clock::time_point m_lastSave;
+  std::vector<uint8_t> m_done; // per output
+  size_t m_numDone{0};
+  mutable std::mutex m_mutex;
+};
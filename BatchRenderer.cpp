@@ -0,0 +1,856 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "BatchRenderer.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+// ours
+#include "AnariCalls.h"
+#include "BatchCheckpoint.h"
+#include "TarShardWriter.h"
+#include "Trace.h"
+
+BatchRenderer::BatchRenderer(anari::Device device,
+    anari::World world,
+    const BatchRenderSettings &settings,
+    const StructuredField *hostField)
+    : m_device(device), m_settings(settings)
+{
+  anari::retain(m_device, m_device);
+
+  m_slots.resize(std::max(m_settings.framesInFlight, 1));
+  m_readback.resize(m_slots.size());
+  if (m_settings.renderer == "builtin") {
+    // no ANARI objects: submit() integrates the frame on the host
+    m_hostField = hostField;
+    m_settings.march.linear = floatFrames();
+    if (!m_hostField)
+      std::cerr << "The builtin renderer needs the host volume\n";
+    return;
+  }
+
+  m_renderer =
+      anari::newObject<anari::Renderer>(m_device, m_settings.renderer.c_str());
+  if (m_settings.photonEnergy > 0.f) {
+    anari_calls::setParameter(m_device,
+        m_renderer,
+        "photonEnergy",
+        m_settings.photonEnergy * 1000.f);
+  }
+  anari_calls::commitParameters(m_device, m_renderer);
+
+  // the world is committed once by the caller and shared by every frame
+  for (auto &slot : m_slots) {
+    slot.camera = anari::newObject<anari::Camera>(m_device, "perspective");
+    anari_calls::setParameter(m_device,
+        slot.camera,
+        "aspect",
+        m_settings.width / float(m_settings.height));
+    anari_calls::setParameter(m_device, slot.camera, "fovy", m_settings.fovy);
+
+    slot.frame = anari::newObject<anari::Frame>(m_device);
+    anari_calls::setParameter(m_device,
+        slot.frame,
+        "size",
+        anari::math::uint2(m_settings.width, m_settings.height));
+    anari_calls::setParameter(m_device,
+        slot.frame,
+        "channel.color",
+        floatFrames() ? ANARI_FLOAT32 : ANARI_UFIXED8_RGBA_SRGB);
+    if (m_settings.writeOrigin) {
+      anari_calls::setParameter(
+          m_device, slot.frame, "channel.origin", ANARI_FLOAT32_VEC3);
+    }
+    anari_calls::setParameter(m_device, slot.frame, "accumulation", true);
+    anari_calls::setParameter(m_device, slot.frame, "world", world);
+    anari_calls::setParameter(m_device, slot.frame, "camera", slot.camera);
+    anari_calls::setParameter(m_device, slot.frame, "renderer", m_renderer);
+    anari_calls::commitParameters(m_device, slot.frame);
+  }
+}
+
+BatchRenderer::~BatchRenderer()
+{
+  waitAll();
+  for (auto &slot : m_slots) {
+    if (slot.frame)
+      anari::release(m_device, slot.frame);
+    if (slot.camera)
+      anari::release(m_device, slot.camera);
+  }
+  if (m_renderer)
+    anari::release(m_device, m_renderer);
+  anari::release(m_device, m_device);
+}
+
+const BatchRenderSettings &BatchRenderer::settings() const
+{
+  return m_settings;
+}
+
+void BatchRenderer::setPhotonEnergy(float photonEnergy)
+{
+  if (photonEnergy == m_settings.photonEnergy)
+    return;
+  waitAll();
+  m_settings.photonEnergy = photonEnergy;
+  // the builtin renderer integrates the attenuation of the LUT's energy
+  if (!m_renderer)
+    return;
+  // the renderer takes eV, as the viewport's energy slider
+  anari_calls::setParameter(
+      m_device, m_renderer, "photonEnergy", photonEnergy * 1000.f);
+  anari_calls::commitParameters(m_device, m_renderer);
+}
+
+void BatchRenderer::waitAll()
+{
+  for (auto &slot : m_slots) {
+    if (slot.frame)
+      anari::wait(m_device, slot.frame);
+  }
+}
+
+size_t BatchRenderer::numSlots() const
+{
+  return m_slots.size();
+}
+
+void BatchRenderer::submit(size_t slot,
+    const prediction &pose,
+    float fovy,
+    const ImageRegion *region)
+{
+  auto &s = m_slots[slot];
+  if (!m_renderer) {
+    submitHost(s, pose, fovy, region);
+    return;
+  }
+  anari::wait(m_device, s.frame);
+
+  const auto dir = anari::math::normalize(pose.center - pose.eye);
+  anari_calls::setParameter(m_device, s.camera, "position", pose.eye);
+  anari_calls::setParameter(m_device, s.camera, "direction", dir);
+  anari_calls::setParameter(m_device, s.camera, "up", pose.up);
+  anari_calls::setParameter(
+      m_device, s.camera, "fovy", fovy > 0.f ? fovy : m_settings.fovy);
+  const ImageRegion full{
+      {0.f, 0.f}, {1.f, 1.f}, m_settings.width / float(m_settings.height)};
+  if (!region)
+    region = &full;
+  anari_calls::setParameter(m_device, s.camera, "aspect", region->aspect);
+  const float box[4] = {
+      region->lower[0], region->lower[1], region->upper[0], region->upper[1]};
+  anari_calls::setParameter(
+      m_device, s.camera, "imageRegion", ANARI_FLOAT32_BOX2, box);
+  anari_calls::commitParameters(m_device, s.camera);
+
+  s.submitted = std::chrono::steady_clock::now();
+  TRACE_SCOPE("anari", "render");
+  anari_calls::render(m_device, s.frame);
+}
+
+RayCamera BatchRenderer::rayCamera(
+    const prediction &pose, float fovy, const ImageRegion *region) const
+{
+  const ImageRegion full{
+      {0.f, 0.f}, {1.f, 1.f}, m_settings.width / float(m_settings.height)};
+  if (!region)
+    region = &full;
+  const auto dir = anari::math::normalize(pose.center - pose.eye);
+  RayCamera camera{{pose.eye.x, pose.eye.y, pose.eye.z},
+      {dir.x, dir.y, dir.z},
+      {pose.up.x, pose.up.y, pose.up.z}};
+  camera.fovy = fovy > 0.f ? fovy : m_settings.fovy;
+  camera.aspect = region->aspect;
+  camera.region[0] = region->lower[0];
+  camera.region[1] = region->lower[1];
+  camera.region[2] = region->upper[0];
+  camera.region[3] = region->upper[1];
+  camera.width = size_t(m_settings.width);
+  camera.height = size_t(m_settings.height);
+  return camera;
+}
+
+void BatchRenderer::submitHost(Slot &s,
+    const prediction &pose,
+    float fovy,
+    const ImageRegion *region)
+{
+  const RayCamera camera = rayCamera(pose, fovy, region);
+  const size_t numPixels = camera.width * camera.height;
+  s.hostColor.resize(numPixels * 4);
+  s.hostOrigin.resize(m_settings.writeOrigin ? numPixels * 3 : 0);
+  s.submitted = std::chrono::steady_clock::now();
+  s.hostRendered = m_hostField
+      && renderDrr(*m_hostField,
+          camera,
+          s.hostColor.data(),
+          m_settings.writeOrigin ? s.hostOrigin.data() : nullptr,
+          m_settings.march);
+  s.hostDuration = std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - s.submitted)
+                       .count();
+}
+
+bool BatchRenderer::renderChannels(const prediction &pose,
+    const uint8_t *labels,
+    int numChannels,
+    std::vector<float> &integrals) const
+{
+  if (!m_hostField)
+    return false;
+  const RayCamera camera = rayCamera(pose, 0.f, nullptr);
+  integrals.resize(camera.width * camera.height * size_t(numChannels));
+  return renderDrrChannels(*m_hostField,
+      labels,
+      camera,
+      numChannels,
+      integrals.data(),
+      m_settings.march);
+}
+
+bool BatchRenderer::collect(size_t slot,
+    std::vector<uint8_t> &color,
+    std::vector<float> &origin,
+    FrameTiming *timing)
+{
+  const auto start = std::chrono::steady_clock::now();
+  MappedFrame frame;
+  const bool mapped = map(slot, frame, false, timing);
+  TRACE_SCOPE("anari", "copy");
+  origin.clear();
+  if (mapped) {
+    const size_t numPixels = size_t(frame.width) * frame.height;
+    color.assign(frame.color, frame.color + numPixels * 4);
+    if (frame.origin)
+      origin.assign(frame.origin, frame.origin + numPixels * 3);
+  }
+  unmap(slot);
+  if (mapped && !m_settings.scatter.empty() && !m_settings.linear)
+    scatterColor(color.data(), frame.width, frame.height);
+
+  if (timing) {
+    timing->map = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - start)
+                      .count()
+        - timing->wait;
+  }
+  return mapped;
+}
+
+bool BatchRenderer::floatFrames() const
+{
+  return m_settings.linear || !m_settings.scatter.empty();
+}
+
+void BatchRenderer::scatterColor(uint8_t *color, int width, int height) const
+{
+  TRACE_SCOPE("batch", "scatter");
+  ExportImage image;
+  image.width = width;
+  image.height = height;
+  const auto *integral = reinterpret_cast<const float *>(color);
+  image.values.resize(size_t(width) * height);
+  for (size_t p = 0; p < image.values.size(); ++p)
+    image.values[p] = std::exp(-integral[p]);
+  addScatter(image.values.data(), width, height, m_settings.scatter);
+  encodeValues(image);
+  std::copy(image.rgba.begin(), image.rgba.end(), color);
+}
+
+bool BatchRenderer::map(
+    size_t slot, MappedFrame &frame, bool devicePointers, FrameTiming *timing)
+{
+  using clock = std::chrono::steady_clock;
+  auto ms = [](clock::time_point a, clock::time_point b) {
+    return std::chrono::duration<float, std::milli>(b - a).count();
+  };
+
+  auto &s = m_slots[slot];
+  if (!m_renderer) {
+    frame = MappedFrame();
+    if (!s.hostRendered)
+      return false;
+    frame.color = s.hostColor.data();
+    frame.origin = m_settings.writeOrigin ? s.hostOrigin.data() : nullptr;
+    frame.width = m_settings.width;
+    frame.height = m_settings.height;
+    if (timing) {
+      timing->wait = 0.f;
+      timing->latency = s.hostDuration;
+      timing->duration = s.hostDuration;
+      timing->map = 0.f;
+    }
+    return true;
+  }
+  const auto waitStart = clock::now();
+  {
+    TRACE_SCOPE("anari", "wait");
+    anari::wait(m_device, s.frame);
+  }
+  const auto waitEnd = clock::now();
+  TRACE_SCOPE("anari", "map");
+  if (timing) {
+    timing->wait = ms(waitStart, waitEnd);
+    timing->latency = ms(s.submitted, waitEnd);
+    float duration = 0.f;
+    anari::getProperty(m_device, s.frame, "duration", duration);
+    timing->duration = duration * 1000.f;
+  }
+
+  frame = MappedFrame();
+  // device channels are optional: a device without them maps null
+  auto mapChannel = [&](const char *hostName,
+                        const char *deviceName,
+                        const char *&mappedName,
+                        bool &onDevice) -> const void * {
+    if (devicePointers) {
+      auto fb = anari_calls::map<void>(m_device, s.frame, deviceName);
+      if (fb.data) {
+        mappedName = deviceName;
+        onDevice = true;
+        frame.width = int(fb.width);
+        frame.height = int(fb.height);
+        return fb.data;
+      }
+      anari::unmap(m_device, s.frame, deviceName);
+    }
+    auto fb = anari_calls::map<void>(m_device, s.frame, hostName);
+    mappedName = hostName;
+    frame.width = int(fb.width);
+    frame.height = int(fb.height);
+    return fb.data;
+  };
+
+  frame.color = static_cast<const uint8_t *>(mapChannel("channel.color",
+      "channel.colorGPU",
+      s.colorChannel,
+      frame.colorOnDevice));
+  if (!frame.color) {
+    fprintf(stderr,
+        "mapped bad frame: %p | %i x %i\n",
+        (const void *)frame.color,
+        frame.width,
+        frame.height);
+    return false;
+  }
+  if (m_settings.writeOrigin) {
+    const int width = frame.width, height = frame.height;
+    frame.origin = static_cast<const float *>(mapChannel("channel.origin",
+        "channel.originGPU",
+        s.originChannel,
+        frame.originOnDevice));
+    frame.width = width;
+    frame.height = height;
+  }
+
+  if (timing)
+    timing->map = ms(waitEnd, clock::now());
+  return true;
+}
+
+void BatchRenderer::unmap(size_t slot)
+{
+  auto &s = m_slots[slot];
+  for (auto **channel : {&s.colorChannel, &s.originChannel}) {
+    if (*channel)
+      anari::unmap(m_device, s.frame, *channel);
+    *channel = nullptr;
+  }
+}
+
+const BatchRenderer::Readback *BatchRenderer::readback(
+    size_t slot, FrameTiming *timing)
+{
+  const auto start = std::chrono::steady_clock::now();
+#ifdef HAVE_CUDA
+  const bool devicePointers = true;
+#else
+  const bool devicePointers = false;
+#endif
+  MappedFrame frame;
+  bool ok = map(slot, frame, devicePointers, timing);
+  auto &r = m_readback[slot];
+  if (ok) {
+    TRACE_SCOPE("anari", "readback");
+    const size_t numPixels = size_t(frame.width) * frame.height;
+    r.width = frame.width;
+    r.height = frame.height;
+    r.color.resize(numPixels * 4);
+    ok = copyToHost(
+        r.color.data(), frame.color, r.color.size(), frame.colorOnDevice);
+    r.origin.resize(frame.origin ? numPixels * 3 : 0);
+    if (ok && frame.origin) {
+      ok = copyToHost(r.origin.data(),
+          frame.origin,
+          r.origin.size() * sizeof(float),
+          frame.originOnDevice);
+    }
+    if (!ok)
+      fprintf(stderr, "readback of frame channels failed\n");
+  }
+  unmap(slot);
+  if (ok && !m_settings.scatter.empty() && !m_settings.linear)
+    scatterColor(r.color.data(), r.width, r.height);
+
+  if (timing) {
+    timing->map = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - start)
+                      .count()
+        - timing->wait;
+  }
+  return ok ? &r : nullptr;
+}
+
+bool BatchRenderer::renderPose(const prediction &pose,
+    std::vector<uint8_t> &color,
+    std::vector<float> &origin)
+{
+  submit(0, pose);
+  return collect(0, color, origin);
+}
+
+bool BatchRenderer::renderPoses(const std::vector<prediction> &poses,
+    std::vector<std::vector<uint8_t>> &colors,
+    std::vector<std::vector<float>> &origins)
+{
+  colors.resize(poses.size());
+  origins.resize(poses.size());
+
+  // keep every slot busy: pose i renders in slot i % numSlots and is
+  // collected just before that slot is reused
+  const size_t numSlots = m_slots.size();
+  bool success = true;
+  for (size_t i = 0; i < poses.size() + numSlots; ++i) {
+    if (i >= numSlots) {
+      const size_t done = i - numSlots;
+      if (done < poses.size())
+        success &= collect(done % numSlots, colors[done], origins[done]);
+    }
+    if (i < poses.size())
+      submit(i % numSlots, poses[i]);
+  }
+  return success;
+}
+
+std::string BatchRenderer::baseName(size_t index)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "drr_%06zu", index);
+  return name;
+}
+
+ExportImage BatchRenderer::exportImage(size_t index, const uint8_t *color) const
+{
+  const size_t numPixels = size_t(m_settings.width) * m_settings.height;
+  if (m_settings.linear) {
+    // line integrals: the detector sees the float intensities
+    const auto *integral = reinterpret_cast<const float *>(color);
+    std::vector<float> intensity(numPixels);
+    for (size_t p = 0; p < numPixels; ++p)
+      intensity[p] = std::exp(-integral[p]);
+    return exportImage(m_settings, index, std::move(intensity));
+  }
+
+  ExportImage image;
+  image.width = m_settings.width;
+  image.height = m_settings.height;
+  image.rgba.assign(color, color + numPixels * 4);
+  if (m_settings.detector.enabled()) {
+    image.values = channelValues(image);
+    simulateDetector(image.values.data(),
+        image.width,
+        image.height,
+        m_settings.detector,
+        index);
+    encodeValues(image);
+  }
+  return image;
+}
+
+ExportImage BatchRenderer::exportImage(const BatchRenderSettings &settings,
+    size_t index,
+    std::vector<float> values)
+{
+  ExportImage image;
+  image.width = settings.width;
+  image.height = settings.height;
+  image.values = std::move(values);
+  if (settings.detector.enabled()) {
+    simulateDetector(image.values.data(),
+        image.width,
+        image.height,
+        settings.detector,
+        index);
+  }
+  encodeValues(image);
+  return image;
+}
+
+bool BatchRenderer::writeOutputs(size_t index,
+    const uint8_t *color,
+    const float *origin,
+    ImageWriter *writer,
+    std::function<void()> written) const
+{
+  return writeOutputs(m_settings,
+      index,
+      exportImage(index, color),
+      origin,
+      writer,
+      std::move(written));
+}
+
+bool BatchRenderer::writeOutputs(const BatchRenderSettings &settings,
+    size_t index,
+    ExportImage image,
+    const float *origin,
+    ImageWriter *writer,
+    std::function<void()> written)
+{
+  const auto base = std::filesystem::path(settings.outputDir) / baseName(index);
+
+  // the origin first, so the image's writer reports the pose complete
+  if (origin) {
+    const auto raw = base.string() + ".origin";
+    std::ofstream out(raw, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(origin),
+        size_t(settings.width) * settings.height * 3 * sizeof(float));
+    if (!out) {
+      std::cerr << "Could not write " << raw << "\n";
+      return false;
+    }
+  }
+
+  const auto file = base.string() + imageExtension(settings.format);
+  if (writer) {
+    writer->write(file, settings.format, std::move(image), std::move(written));
+  } else {
+    if (!ImageWriter::writeNow(file, settings.format, image))
+      return false;
+    if (written)
+      written();
+  }
+  return true;
+}
+
+bool BatchRenderer::renderAll(const std::vector<BatchRenderer *> &renderers,
+    const std::vector<prediction> &poses,
+    BatchCheckpoint *checkpoint)
+{
+  if (renderers.empty())
+    return false;
+
+  const auto &settings = renderers.front()->settings();
+
+  std::error_code ec;
+  std::filesystem::create_directories(settings.outputDir, ec);
+  if (ec) {
+    std::cerr << "Could not create " << settings.outputDir << ": "
+              << ec.message() << "\n";
+    return false;
+  }
+
+  // entries are filled by index, so workers never touch the same element;
+  // those of poses a resumed job has come first
+  std::vector<nlohmann::json> entries(poses.size());
+  size_t numDone = 0;
+  for (size_t i = 0; checkpoint && i < poses.size(); ++i) {
+    if (!checkpoint->done(i))
+      continue;
+    entries[i] = manifestEntry(
+        i, poses[i], imageExtension(settings.format), settings.writeOrigin);
+    if (settings.shardSize > 0)
+      entries[i]["shard"] = TarShardWriter::shardName(i / settings.shardSize);
+    ++numDone;
+  }
+  // encoding (PNG compression mostly) overlaps the rendering; a couple of
+  // images per frame in flight may queue before the render loops wait
+  const size_t numThreads =
+      std::max(2u, std::thread::hardware_concurrency() / 2);
+  const size_t maxPending = 2 * renderers.size() * renderers.front()->numSlots();
+  ImageWriter writer(numThreads, maxPending);
+  // with shards the writer above stays idle
+  std::unique_ptr<TarShardWriter> shards;
+  if (settings.shardSize > 0) {
+    shards = std::make_unique<TarShardWriter>(numThreads, maxPending);
+    if (!shards->open(settings.outputDir, poses.size(), settings.shardSize))
+      return false;
+    if (checkpoint)
+      shards->setWrittenCallback(
+          [checkpoint](size_t index) { checkpoint->written(index); });
+  }
+  std::atomic<size_t> numRendered{numDone};
+  std::atomic<bool> failed{false};
+  std::mutex outputMutex;
+
+  PoseScheduler scheduler(poses.size(), renderers.size());
+  // per worker, for the summary
+  std::vector<size_t> numPosesOf(renderers.size(), 0);
+  std::vector<float> poseTimeOf(renderers.size(), 0.f);
+
+  auto work = [&](size_t worker) {
+    auto *renderer = renderers[worker];
+
+    // poses in flight per slot, oldest first
+    const size_t numSlots = renderer->numSlots();
+    std::vector<size_t> inFlight;
+    size_t slot = 0;
+    bool more = true;
+    auto finished = std::chrono::steady_clock::now();
+    while (!failed && (more || !inFlight.empty())) {
+      size_t next = 0;
+      do
+        more = more && scheduler.next(worker, next);
+      while (more && checkpoint && checkpoint->done(next));
+      if (more) {
+        renderer->submit((slot + inFlight.size()) % numSlots, poses[next]);
+        inFlight.push_back(next);
+        if (inFlight.size() < numSlots)
+          continue;
+      }
+
+      const size_t i = inFlight.front();
+      inFlight.erase(inFlight.begin());
+      const auto &pose = poses[i];
+      const auto *r = renderer->readback(slot);
+      // poses this worker finishes per second, pipelined, steer the
+      // scheduler's stealing between devices of different speed
+      const auto now = std::chrono::steady_clock::now();
+      const float poseTime =
+          std::chrono::duration<float>(now - finished).count();
+      finished = now;
+      scheduler.record(worker, poseTime);
+      ++numPosesOf[worker];
+      poseTimeOf[worker] += poseTime;
+      const bool withOrigin = r && !r->origin.empty();
+      entries[i] = manifestEntry(
+          i, pose, imageExtension(settings.format), withOrigin);
+      entries[i]["device"] = worker;
+      bool ok = r;
+      if (ok && shards) {
+        entries[i]["shard"] =
+            TarShardWriter::shardName(i / settings.shardSize);
+        std::vector<float> origin;
+        if (withOrigin)
+          origin.assign(r->origin.begin(), r->origin.end());
+        shards->write(i,
+            baseName(i),
+            settings.format,
+            renderer->exportImage(i, r->color.data()),
+            std::move(origin),
+            entries[i].dump());
+      } else if (ok) {
+        std::function<void()> written;
+        if (checkpoint)
+          written = [checkpoint, i]() { checkpoint->written(i); };
+        ok = renderer->writeOutputs(i,
+            r->color.data(),
+            withOrigin ? r->origin.data() : nullptr,
+            &writer,
+            std::move(written));
+      }
+      slot = (slot + 1) % numSlots;
+      if (!ok) {
+        failed = true;
+        return;
+      }
+
+      size_t n = ++numRendered;
+      std::lock_guard<std::mutex> lock(outputMutex);
+      std::cout << "\rrendered " << n << "/" << poses.size() << std::flush;
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  if (renderers.size() == 1) {
+    work(0);
+  } else {
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < renderers.size(); ++w)
+      threads.emplace_back(work, w);
+    for (auto &t : threads)
+      t.join();
+  }
+  if (shards && !shards->wait())
+    failed = true;
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "\n";
+
+  // the images the manifest names are written before it
+  if (!writer.wait())
+    failed = true;
+  // what got written also when the job failed, for the next --resume
+  if (checkpoint && !checkpoint->save())
+    failed = true;
+  if (failed)
+    return false;
+
+  const size_t numPoses = poses.size() - numDone;
+  float seconds = std::chrono::duration<float>(end - start).count();
+  std::cout << "Rendered " << numPoses << " poses on "
+            << renderers.size() << " device(s) in " << seconds << "s ("
+            << (seconds > 0.f ? numPoses / seconds : 0.f) << " poses/s)\n";
+  for (size_t w = 0; renderers.size() > 1 && w < renderers.size(); ++w) {
+    std::cout << "  device " << w << ": " << numPosesOf[w] << " poses";
+    if (numPosesOf[w] > 0)
+      std::cout << ", " << 1000.f * poseTimeOf[w] / numPosesOf[w] << " ms/pose";
+    std::cout << "\n";
+  }
+
+  return writeManifest(settings.outputDir,
+      settings.width,
+      settings.height,
+      settings.fovy,
+      std::move(entries));
+}
+
+nlohmann::json BatchRenderer::manifestEntry(size_t index,
+    const prediction &pose,
+    const std::string &extension,
+    bool withOrigin)
+{
+  auto toJson = [](const anari::math::float3 &v) {
+    return nlohmann::json{{"x", v.x}, {"y", v.y}, {"z", v.z}};
+  };
+  nlohmann::json entry;
+  entry["image"] = baseName(index) + extension;
+  if (withOrigin)
+    entry["origin"] = baseName(index) + ".origin";
+  entry["reference"] = pose.filename;
+  entry["eye"] = toJson(pose.eye);
+  entry["center"] = toJson(pose.center);
+  entry["up"] = toJson(pose.up);
+  return entry;
+}
+
+bool BatchRenderer::writeManifest(const std::string &outputDir,
+    int width,
+    int height,
+    float fovy,
+    std::vector<nlohmann::json> entries)
+{
+  nlohmann::json manifest;
+  manifest["width"] = width;
+  manifest["height"] = height;
+  manifest["fov_y_rad"] = fovy;
+  manifest["renders"] = std::move(entries);
+
+  const auto manifestFile = std::filesystem::path(outputDir) / "manifest.json";
+  std::ofstream out(manifestFile);
+  out << manifest.dump(2) << "\n";
+  if (!out) {
+    std::cerr << "Could not write " << manifestFile << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+// PoseScheduler definitions //////////////////////////////////////////////////
+
+PoseScheduler::PoseScheduler(size_t numPoses, size_t numWorkers)
+{
+  numWorkers = std::max<size_t>(numWorkers, 1);
+  for (size_t w = 0; w < numWorkers; ++w) {
+    auto range = std::make_unique<Range>();
+    range->begin = numPoses * w / numWorkers;
+    range->end = numPoses * (w + 1) / numWorkers;
+    m_ranges.push_back(std::move(range));
+  }
+}
+
+bool PoseScheduler::next(size_t worker, size_t &index)
+{
+  auto &own = *m_ranges[worker];
+  do {
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (own.begin < own.end) {
+      index = own.begin++;
+      return true;
+    }
+  } while (steal(worker));
+
+  return false;
+}
+
+void PoseScheduler::record(size_t worker, float seconds)
+{
+  auto &own = *m_ranges[worker];
+  std::lock_guard<std::mutex> lock(own.mutex);
+  own.poseTime = own.poseTime > 0.f
+      ? 0.75f * own.poseTime + 0.25f * seconds
+      : seconds;
+}
+
+bool PoseScheduler::steal(size_t worker)
+{
+  float poseTime = 0.f;
+  {
+    auto &own = *m_ranges[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    poseTime = own.poseTime;
+  }
+
+  // Never holds two locks at once: the victim's share is cut first, then
+  // handed to the (empty) thief, which only its owner ever refills
+  for (;;) {
+    size_t victim = worker;
+    float largest = 0.f;
+    for (size_t w = 0; w < m_ranges.size(); ++w) {
+      if (w == worker)
+        continue;
+      std::lock_guard<std::mutex> lock(m_ranges[w]->mutex);
+      const size_t remaining = m_ranges[w]->end - m_ranges[w]->begin;
+      // unmeasured shares count a pose as a unit of time
+      const float time = remaining
+          * (poseTime > 0.f && m_ranges[w]->poseTime > 0.f
+                  ? m_ranges[w]->poseTime
+                  : 1.f);
+      if (time > largest) {
+        largest = time;
+        victim = w;
+      }
+    }
+
+    if (victim == worker)
+      return false;
+
+    size_t begin = 0, end = 0;
+    {
+      auto &v = *m_ranges[victim];
+      std::lock_guard<std::mutex> lock(v.mutex);
+      size_t remaining = v.end - v.begin;
+      if (remaining == 0)
+        continue; // drained meanwhile, look again
+      size_t share = remaining - remaining / 2;
+      if (poseTime > 0.f && v.poseTime > 0.f) {
+        // both finish their part at about the same time
+        share = size_t(
+            remaining * v.poseTime / (poseTime + v.poseTime) + 0.5f);
+        if (share == 0)
+          return false;
+      }
+      end = v.end;
+      begin = v.end - share;
+      v.end = begin;
+    }
+
+    auto &own = *m_ranges[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.begin = begin;
+    own.end = end;
+    return true;
+  }
+}
@@ -0,0 +1,287 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// anari
+#include <anari/anari_cpp/ext/linalg.h>
+#include <anari/anari_cpp.hpp>
+// nlohmann
+#include <nlohmann/json.hpp>
+// std
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+// ours
+#include "DetectorNoise.h"
+#include "FirstHit.h"
+#include "ImageWriter.h"
+#include "PinnedMemory.h"
+#include "prediction.h"
+
+class BatchCheckpoint;
+
+struct BatchRenderSettings
+{
+  int width{1024};
+  int height{1024};
+  float fovy{0.7854f}; // radians
+  float photonEnergy{0.f}; // keV, 0 keeps the renderer default
+  // "builtin" integrates the host field given to BatchRenderer on all
+  // cores (renderDrr()) instead of rendering ANARI frames
+  std::string renderer{"default"};
+  FirstHitSettings march; // "builtin": step, and where origins are
+  std::string outputDir{"."};
+  bool writeOrigin{true};
+  // color as one float32 line integral per pixel rather than sRGB RGBA8
+  // (the same 4 bytes per pixel), for partial integrals to be summed and
+  // for the detector to see float intensities; writeOutputs() exports it
+  // as exp(-integral)
+  bool linear{false};
+  ImageFormat format{ImageFormat::Png}; // of the images renderAll() writes
+  int framesInFlight{3}; // frames (each with its own camera) per renderer
+  // applied to the images writeOutputs() writes, seeded by the pose index
+  DetectorSettings detector;
+  // scatter added to the frames collect() and readback() copy out
+  // (matching, metrics), spread over float intensities: the frames render
+  // linear and come out as RGBA8 with it; none for linear output
+  std::vector<ScatterGaussian> scatter;
+  // > 0: renderAll() packs that many poses per tar shard (TarShardWriter)
+  // instead of writing a file per image
+  size_t shardSize{0};
+};
+
+// Part of a larger image, for tiled rendering: the camera keeps the full
+// image's aspect and renders only [lower, upper] of it (0..1, y up) into
+// the frame
+struct ImageRegion
+{
+  float lower[2]{0.f, 0.f};
+  float upper[2]{1.f, 1.f};
+  float aspect{1.f}; // of the full image
+};
+
+// Where the time of one collected frame went
+struct FrameTiming
+{
+  float duration{0.f}; // ms, the frame's "duration" property
+  float latency{0.f}; // ms, submit() until the frame was done
+  float wait{0.f}; // ms spent blocking in collect()
+  float map{0.f}; // ms to map, copy out and unmap the channels
+};
+
+// Offscreen DRR rendering without a window or GL context: frames, cameras
+// and renderer set up like DRRViewport's, re-aimed for every pose while the
+// world (and the volume in it) stays resident on the device. Several frames,
+// each with its own camera, let the device render the next poses while
+// finished ones are read back. The "builtin" renderer integrates the host
+// field instead, with no ANARI frames or cameras to set per pose.
+class BatchRenderer
+{
+ public:
+  // hostField: the attenuation the "builtin" renderer integrates, which
+  // must outlive the renderer; the world is not rendered then
+  BatchRenderer(anari::Device device,
+      anari::World world,
+      const BatchRenderSettings &settings,
+      const StructuredField *hostField = nullptr);
+  ~BatchRenderer();
+
+  BatchRenderer(const BatchRenderer &) = delete;
+  BatchRenderer &operator=(const BatchRenderer &) = delete;
+
+  // Renders one pose to completion and copies the RGBA8 color and the
+  // float3 ray-origin channels (width * height [* 3]) out of the frame
+  bool renderPose(const prediction &pose,
+      std::vector<uint8_t> &color,
+      std::vector<float> &origin);
+
+  // Renders N poses as one batch through all frames in flight; colors[i]
+  // (and origins[i] if writeOrigin) receive pose i. Vectors are reused.
+  bool renderPoses(const std::vector<prediction> &poses,
+      std::vector<std::vector<uint8_t>> &colors,
+      std::vector<std::vector<float>> &origins);
+
+  // Low-level pipelining: aim slot's camera at pose and start rendering;
+  // collect() waits for that slot and copies its channels out. fovy > 0
+  // (radians) replaces the settings' field of view for this frame, region
+  // renders only that part of the image. The settings' scatter is added
+  // to the color copied out, also by readback().
+  size_t numSlots() const;
+  void submit(size_t slot,
+      const prediction &pose,
+      float fovy = 0.f,
+      const ImageRegion *region = nullptr);
+  bool collect(size_t slot,
+      std::vector<uint8_t> &color,
+      std::vector<float> &origin,
+      FrameTiming *timing = nullptr);
+
+  // Zero-copy alternative to collect(): waits for the slot and maps its
+  // channels; the pointers stay valid until unmap(slot), which must come
+  // (also after a failed map) before the slot is submitted again. With
+  // devicePointers the channels are mapped as device memory where the
+  // device offers it (the "channel.colorGPU" convention); the flags tell
+  // which one was mapped.
+  struct MappedFrame
+  {
+    // RGBA8, bottom row first; float line integrals if the settings are
+    // linear or have scatter (map() adds none)
+    const uint8_t *color{nullptr};
+    const float *origin{nullptr}; // xyz per pixel, null without writeOrigin
+    int width{0}, height{0};
+    bool colorOnDevice{false}, originOnDevice{false};
+  };
+  bool map(size_t slot,
+      MappedFrame &frame,
+      bool devicePointers = false,
+      FrameTiming *timing = nullptr);
+  void unmap(size_t slot);
+
+  // collect() into buffers owned by the renderer, one per slot, valid until
+  // the slot is read back again: page-locked memory, filled from device
+  // pointers where the device maps them (CUDA builds), so the copy runs at
+  // full PCIe bandwidth and no vector is reallocated. Null on failure.
+  struct Readback
+  {
+    PinnedVector<uint8_t> color;
+    PinnedVector<float> origin; // empty without writeOrigin
+    int width{0}, height{0};
+  };
+  const Readback *readback(size_t slot, FrameTiming *timing = nullptr);
+
+  // Renders all poses to <outputDir>/drr_<index>.png (or the settings'
+  // format; plus .origin, raw float32 xyz per pixel) and writes a
+  // manifest.json listing them. With several renderers (one per device)
+  // the poses are rendered in parallel, one thread per renderer; all must
+  // share the same settings. Images are encoded on an ImageWriter's
+  // threads while the next poses render. With a checkpoint, the poses it
+  // has done are skipped and those written are reported to it.
+  static bool renderAll(const std::vector<BatchRenderer *> &renderers,
+      const std::vector<prediction> &poses,
+      BatchCheckpoint *checkpoint = nullptr);
+
+  static std::string baseName(size_t index);
+  // manifest.json in outputDir, one entry per pose. It is written last,
+  // once every image it names is on disk (after ImageWriter::wait()), so
+  // a manifest never lists a file still being written.
+  static nlohmann::json manifestEntry(size_t index,
+      const prediction &pose,
+      const std::string &extension,
+      bool withOrigin);
+  static bool writeManifest(const std::string &outputDir,
+      int width,
+      int height,
+      float fovy,
+      std::vector<nlohmann::json> entries);
+  // The image writeOutputs() writes: the color (line integrals if
+  // linear), with the detector applied
+  ExportImage exportImage(size_t index, const uint8_t *color) const;
+  // The same from linear intensities (1: the unattenuated beam), for images
+  // made without a renderer of these settings (e.g. summed slabs)
+  static ExportImage exportImage(const BatchRenderSettings &settings,
+      size_t index,
+      std::vector<float> values);
+  // origin null: no .origin file. With a writer the image is copied and
+  // encoded there; its failures show in writer->wait(). `written` is
+  // called once all files of the pose are.
+  bool writeOutputs(size_t index,
+      const uint8_t *color,
+      const float *origin,
+      ImageWriter *writer = nullptr,
+      std::function<void()> written = nullptr) const;
+  // The same for an image exported already, written as it is
+  static bool writeOutputs(const BatchRenderSettings &settings,
+      size_t index,
+      ExportImage image,
+      const float *origin,
+      ImageWriter *writer = nullptr,
+      std::function<void()> written = nullptr);
+
+  // "builtin" only: the pose's line integrals per label in one traversal
+  // (renderDrrChannels()), numChannels floats per pixel; labels on the
+  // host field's grid. False for other renderers.
+  bool renderChannels(const prediction &pose,
+      const uint8_t *labels,
+      int numChannels,
+      std::vector<float> &integrals) const;
+
+  const BatchRenderSettings &settings() const;
+  // keV; waits for frames in flight, applies to the next submit()
+  void setPhotonEnergy(float photonEnergy);
+
+ private:
+  struct Slot
+  {
+    anari::Frame frame{nullptr};
+    anari::Camera camera{nullptr};
+    std::chrono::steady_clock::time_point submitted;
+    // channels mapped by map(), unmapped by unmap()
+    const char *colorChannel{nullptr};
+    const char *originChannel{nullptr};
+    // "builtin": the frame integrated by submit()
+    std::vector<uint8_t> hostColor;
+    std::vector<float> hostOrigin;
+    float hostDuration{0.f}; // ms
+    bool hostRendered{false};
+  };
+
+  void waitAll();
+  // Frames render float line integrals: for linear output, or for the
+  // scatter to spread float intensities
+  bool floatFrames() const;
+  // color: the float line integrals of a frame, replaced in place by the
+  // RGBA8 of their intensities (the same 4 bytes per pixel) with the
+  // settings' scatter added
+  void scatterColor(uint8_t *color, int width, int height) const;
+  // The ANARI camera of a pose as the builtin renderer's rays
+  RayCamera rayCamera(
+      const prediction &pose, float fovy, const ImageRegion *region) const;
+  // "builtin": integrates the slot's frame right away
+  void submitHost(Slot &s,
+      const prediction &pose,
+      float fovy,
+      const ImageRegion *region);
+
+  anari::Device m_device{nullptr};
+  std::vector<Slot> m_slots;
+  std::vector<Readback> m_readback; // per slot
+  anari::Renderer m_renderer{nullptr};
+  BatchRenderSettings m_settings;
+  const StructuredField *m_hostField{nullptr}; // "builtin" renderer only
+};
+
+// Hands out pose indices to worker threads. Each worker starts on its own
+// contiguous share; once that runs dry it steals the upper half of the
+// largest remaining share, so fast devices keep busy until the end. Workers
+// that record() their time per pose steal by it instead: from the share
+// that would take longest to finish, as much as they finish in the time
+// its owner needs for the rest, and nothing the owner finishes sooner (a
+// CPU device does not take the last pose off a GPU).
+class PoseScheduler
+{
+ public:
+  PoseScheduler(size_t numPoses, size_t numWorkers);
+
+  bool next(size_t worker, size_t &index);
+  // Seconds the worker took for its last pose (the time between poses it
+  // finished, for pipelined renderers), averaged over the recent ones
+  void record(size_t worker, float seconds);
+
+ private:
+  struct Range
+  {
+    std::mutex mutex;
+    size_t begin{0};
+    size_t end{0};
+    float poseTime{0.f}; // s, 0 until recorded
+  };
+
+  bool steal(size_t worker);
+
+  std::vector<std::unique_ptr<Range>> m_ranges;
+};
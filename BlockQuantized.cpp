@@ -0,0 +1,124 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "BlockQuantized.h"
+// std
+#include <algorithm>
+#include <cmath>
+// ours
+#include "Half.h"
+#include "Parallel.h"
+
+namespace {
+
+// Calls func(blockIndex, x0, y0, z0) for the blocks of slab rows
+// [begin, end) (one row: the blocks of one z and y block coordinate)
+template <typename Func>
+void forBlocks(const int dims[3], size_t begin, size_t end, Func &&func)
+{
+  const size_t bx = size_t(dims[0] + 3) / 4, by = size_t(dims[1] + 3) / 4;
+  for (size_t row = begin; row < end; ++row) {
+    const int y0 = int(row % by) * 4, z0 = int(row / by) * 4;
+    for (size_t b = 0; b < bx; ++b)
+      func(row * bx + b, int(b) * 4, y0, z0);
+  }
+}
+
+size_t numRows(const int dims[3])
+{
+  return size_t(dims[1] + 3) / 4 * size_t(dims[2] + 3) / 4;
+}
+
+} // namespace
+
+QuantizedVolume quantizeField(const StructuredField &field, int bits)
+{
+  QuantizedVolume volume;
+  if (field.empty() || (field.bytesPerCell != 4 && !field.isHalf))
+    return volume;
+  volume.dims[0] = field.dimX;
+  volume.dims[1] = field.dimY;
+  volume.dims[2] = field.dimZ;
+  volume.bits = bits == 4 ? 4 : 8;
+  const size_t blockBytes = quantizedBlockBytes(volume.bits);
+  const size_t rows = numRows(volume.dims);
+  volume.blocks.assign(
+      rows * size_t(field.dimX + 3) / 4 * blockBytes, uint8_t(0));
+
+  const size_t sx = size_t(field.dimX), sxy = sx * size_t(field.dimY);
+  auto value = [&](size_t i) {
+    return field.isHalf
+        ? halfToFloat(static_cast<const uint16_t *>(field.data())[i])
+        : static_cast<const float *>(field.data())[i];
+  };
+  const int *dims = volume.dims;
+  const float levels = float((1 << volume.bits) - 1);
+  parallelFor(
+      0,
+      rows,
+      [&](size_t begin, size_t end) {
+        forBlocks(dims, begin, end, [&](size_t b, int x0, int y0, int z0) {
+          const int x1 = std::min(x0 + 4, dims[0]);
+          const int y1 = std::min(y0 + 4, dims[1]);
+          const int z1 = std::min(z0 + 4, dims[2]);
+          float v[64]{};
+          float lo = INFINITY, hi = -INFINITY;
+          for (int z = z0; z < z1; ++z)
+            for (int y = y0; y < y1; ++y)
+              for (int x = x0; x < x1; ++x) {
+                const float f = value(z * sxy + y * sx + size_t(x));
+                v[((z - z0) * 4 + (y - y0)) * 4 + (x - x0)] = f;
+                lo = std::min(lo, f);
+                hi = std::max(hi, f);
+              }
+          uint8_t *block = volume.blocks.data() + b * blockBytes;
+          std::memcpy(block, &lo, sizeof(float));
+          std::memcpy(block + sizeof(float), &hi, sizeof(float));
+          if (!(hi > lo))
+            return; // one value: all codes 0
+          uint8_t *codes = block + 2 * sizeof(float);
+          const float scale = levels / (hi - lo);
+          for (int z = z0; z < z1; ++z)
+            for (int y = y0; y < y1; ++y)
+              for (int x = x0; x < x1; ++x) {
+                const int i = ((z - z0) * 4 + (y - y0)) * 4 + (x - x0);
+                const unsigned code =
+                    unsigned(std::lround((v[i] - lo) * scale));
+                if (volume.bits == 8)
+                  codes[i] = uint8_t(code);
+                else
+                  codes[i >> 1] |= uint8_t(code << ((i & 1) * 4));
+              }
+        });
+      },
+      1);
+  return volume;
+}
+
+void dequantizeField(const QuantizedVolume &volume, void *dst, bool half)
+{
+  const int *dims = volume.dims;
+  const size_t sx = size_t(dims[0]), sxy = sx * size_t(dims[1]);
+  parallelFor(
+      0,
+      numRows(dims),
+      [&](size_t begin, size_t end) {
+        forBlocks(dims, begin, end, [&](size_t, int x0, int y0, int z0) {
+          const int x1 = std::min(x0 + 4, dims[0]);
+          const int y1 = std::min(y0 + 4, dims[1]);
+          const int z1 = std::min(z0 + 4, dims[2]);
+          for (int z = z0; z < z1; ++z)
+            for (int y = y0; y < y1; ++y)
+              for (int x = x0; x < x1; ++x) {
+                const float f = quantizedVoxel(
+                    volume.blocks.data(), dims, volume.bits, x, y, z);
+                const size_t i = z * sxy + y * sx + size_t(x);
+                if (half)
+                  static_cast<uint16_t *>(dst)[i] = floatToHalf(f);
+                else
+                  static_cast<float *>(dst)[i] = f;
+              }
+        });
+      },
+      1);
+}
@@ -0,0 +1,68 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+// ours
+#include "FieldTypes.h"
+
+// Block-quantized attenuation volumes ///////////////////////////////////////
+//
+// Fixed-rate lossy compression for volumes kept around but not rendered:
+// 4^3 blocks, each with its minimum and maximum as floats followed by one
+// code of `bits` (8 or 4) per voxel, x fastest, spreading the block's range
+// evenly. That is 1.125 or 0.625 bytes per voxel, 3.6x or 6.4x less than
+// float32; a voxel is off by at most half a step of its block's range, and
+// blocks of one value (air) are exact. Every block has the same size, so a
+// voxel decodes with one lookup and no neighbours: quantizedVoxel() is plain
+// inline code over the raw buffer, as a sampling kernel would use it.
+struct QuantizedVolume
+{
+  std::vector<uint8_t> blocks;
+  int dims[3]{0, 0, 0};
+  int bits{8};
+
+  bool empty() const
+  {
+    return blocks.empty();
+  }
+
+  size_t bytes() const
+  {
+    return blocks.size();
+  }
+};
+
+// Bytes of a block: min, max and 64 codes
+inline size_t quantizedBlockBytes(int bits)
+{
+  return 2 * sizeof(float) + size_t(64 * bits / 8);
+}
+
+// Voxel (x, y, z) of a quantized volume of the given dims
+inline float quantizedVoxel(
+    const uint8_t *blocks, const int dims[3], int bits, int x, int y, int z)
+{
+  const size_t bx = size_t(dims[0] + 3) / 4, by = size_t(dims[1] + 3) / 4;
+  const uint8_t *block = blocks
+      + ((size_t(z >> 2) * by + size_t(y >> 2)) * bx + size_t(x >> 2))
+          * quantizedBlockBytes(bits);
+  float lo, hi;
+  std::memcpy(&lo, block, sizeof(float));
+  std::memcpy(&hi, block + sizeof(float), sizeof(float));
+  const int i = ((z & 3) * 4 + (y & 3)) * 4 + (x & 3);
+  const uint8_t *codes = block + 2 * sizeof(float);
+  const unsigned code =
+      bits == 8 ? codes[i] : (codes[i >> 1] >> ((i & 1) * 4)) & 0xf;
+  return lo + (hi - lo) * float(code) / float((1 << bits) - 1);
+}
+
+// Quantizes a float32 or float16 (isHalf) field on all cores; bits is 8 or 4
+QuantizedVolume quantizeField(const StructuredField &field, int bits = 8);
+// Decodes into dst, float16 cells if half else float32, on all cores
+void dequantizeField(const QuantizedVolume &volume, void *dst, bool half);
@@ -0,0 +1,431 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "BrickStream.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+// ours
+#include "Decompress.h"
+#include "Parallel.h"
+#include "TaskScheduler.h"
+#include "Trace.h"
+
+static constexpr size_t g_numLoaders = 4;
+
+BrickStream::~BrickStream()
+{
+  stop();
+}
+
+bool BrickStream::open(const char *fileName,
+    int dimX,
+    int dimY,
+    int dimZ,
+    unsigned bytesPerCell,
+    int brickSize,
+    size_t cacheBytes)
+{
+  stop();
+
+  if (detectCompression(fileName) != Compression::None) {
+    std::cerr << "cannot stream compressed file: " << fileName << '\n';
+    return false;
+  }
+  m_fd = ::open(fileName, O_RDONLY);
+  if (m_fd < 0) {
+    std::cerr << "cannot open file: " << fileName << '\n';
+    return false;
+  }
+
+  m_fileName = fileName;
+  m_dims[0] = dimX;
+  m_dims[1] = dimY;
+  m_dims[2] = dimZ;
+  m_bytesPerCell = bytesPerCell;
+  m_brickSize = std::max(brickSize, 1);
+  for (int a = 0; a < 3; ++a)
+    m_numBricks[a] = (m_dims[a] + m_brickSize - 1) / m_brickSize;
+
+  struct stat st;
+  const size_t volumeBytes = size_t(dimX) * dimY * dimZ * bytesPerCell;
+  if (fstat(m_fd, &st) != 0 || size_t(st.st_size) < volumeBytes) {
+    std::cerr << "cannot stream file: " << fileName << " (file too small)\n";
+    stop();
+    return false;
+  }
+
+  // smallest power-of-two reduction whose coarse level fits a quarter of
+  // the budget
+  m_lodFactor = 1;
+  auto coarseBytes = [&](int f) {
+    size_t n = bytesPerCell;
+    for (int a = 0; a < 3; ++a)
+      n *= (m_dims[a] + f - 1) / f;
+    return n;
+  };
+  while (coarseBytes(m_lodFactor) > cacheBytes / 4
+      && m_lodFactor < std::max({dimX, dimY, dimZ}))
+    m_lodFactor *= 2;
+
+  if (!readCoarse()) {
+    std::cerr << "cannot read file: " << fileName << '\n';
+    stop();
+    return false;
+  }
+
+  const size_t brickBytes =
+      size_t(m_brickSize) * m_brickSize * m_brickSize * bytesPerCell;
+  const size_t fineBudget = cacheBytes - std::min(cacheBytes, coarseBytes(m_lodFactor));
+  m_maxResident = m_lodFactor > 1 ? std::max<size_t>(1, fineBudget / brickBytes) : 0;
+  m_cache.setBudget(fineBudget);
+
+  std::cout << "Streaming " << m_numBricks[0] * size_t(m_numBricks[1])
+                * m_numBricks[2]
+            << " bricks of " << m_brickSize << "^3 over a 1/" << m_lodFactor
+            << " coarse level, up to " << m_maxResident << " resident\n";
+
+  m_stop = false;
+  return true;
+}
+
+bool BrickStream::isOpen() const
+{
+  return m_fd >= 0;
+}
+
+const StructuredField &BrickStream::coarseField() const
+{
+  return m_coarse;
+}
+
+int BrickStream::lodFactor() const
+{
+  return m_lodFactor;
+}
+
+int BrickStream::brickSize() const
+{
+  return m_brickSize;
+}
+
+unsigned BrickStream::bytesPerCell() const
+{
+  return m_bytesPerCell;
+}
+
+std::vector<size_t> BrickStream::visibleBricks(const float eye[3],
+    const float center[3],
+    const float up[3],
+    float fovy,
+    float aspect) const
+{
+  auto sub = [](const float *a, const float *b, float *r) {
+    for (int i = 0; i < 3; ++i)
+      r[i] = a[i] - b[i];
+  };
+  auto dot = [](const float *a, const float *b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+  };
+  auto cross = [](const float *a, const float *b, float *r) {
+    r[0] = a[1] * b[2] - a[2] * b[1];
+    r[1] = a[2] * b[0] - a[0] * b[2];
+    r[2] = a[0] * b[1] - a[1] * b[0];
+  };
+  auto normalize = [&](float *v) {
+    const float len = std::sqrt(dot(v, v));
+    for (int i = 0; len > 0.f && i < 3; ++i)
+      v[i] /= len;
+  };
+
+  float forward[3], right[3], upOrtho[3];
+  sub(center, eye, forward);
+  normalize(forward);
+  cross(forward, up, right);
+  normalize(right);
+  cross(right, forward, upOrtho);
+
+  // inward normals of the four side planes and the near plane, all through
+  // the eye
+  const float tanY = std::tan(fovy / 2.f);
+  const float tanX = tanY * aspect;
+  float planes[5][3];
+  for (int i = 0; i < 3; ++i) {
+    planes[0][i] = forward[i];
+    planes[1][i] = forward[i] * tanX + right[i]; // left
+    planes[2][i] = forward[i] * tanX - right[i]; // right
+    planes[3][i] = forward[i] * tanY + upOrtho[i]; // bottom
+    planes[4][i] = forward[i] * tanY - upOrtho[i]; // top
+  }
+
+  struct Candidate
+  {
+    size_t index;
+    float distance;
+  };
+  std::vector<Candidate> visible;
+  const size_t numBricks =
+      size_t(m_numBricks[0]) * m_numBricks[1] * m_numBricks[2];
+  for (size_t i = 0; i < numBricks; ++i) {
+    int origin[3], dims[3];
+    brickBounds(i, origin, dims);
+    float lower[3], upper[3];
+    for (int a = 0; a < 3; ++a) {
+      lower[a] = float(origin[a]) - eye[a];
+      upper[a] = float(origin[a] + dims[a]) - eye[a];
+    }
+
+    bool inside = true;
+    for (auto &n : planes) {
+      // corner farthest along the normal
+      const float p[3] = {n[0] > 0.f ? upper[0] : lower[0],
+          n[1] > 0.f ? upper[1] : lower[1],
+          n[2] > 0.f ? upper[2] : lower[2]};
+      if (dot(n, p) < 0.f) {
+        inside = false;
+        break;
+      }
+    }
+    if (!inside)
+      continue;
+
+    float c[3];
+    for (int a = 0; a < 3; ++a)
+      c[a] = (lower[a] + upper[a]) / 2.f;
+    visible.push_back({i, dot(c, c)});
+  }
+
+  std::sort(visible.begin(), visible.end(), [](auto &a, auto &b) {
+    return a.distance < b.distance;
+  });
+  std::vector<size_t> result(visible.size());
+  for (size_t i = 0; i < visible.size(); ++i)
+    result[i] = visible[i].index;
+  return result;
+}
+
+void BrickStream::request(const std::vector<size_t> &bricks)
+{
+  size_t numStarted = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requested.assign(
+        bricks.begin(), bricks.begin() + std::min(bricks.size(), m_maxResident));
+    m_queue.clear();
+    for (size_t index : m_requested) {
+      if (!m_cache.get(index) && !m_loading.count(index))
+        m_queue.push_back(index);
+    }
+    // up to g_numLoaders work the queue at once
+    const size_t wanted = std::min(g_numLoaders, m_queue.size());
+    if (!m_stop && wanted > m_numLoaders) {
+      numStarted = wanted - m_numLoaders;
+      m_numLoaders = wanted;
+    }
+  }
+  startLoaders(numStarted);
+}
+
+std::vector<BrickStream::Brick> BrickStream::residentBricks()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::vector<Brick> result;
+  for (size_t index : m_requested) {
+    auto *data = m_cache.get(index);
+    if (!data)
+      continue;
+    Brick b;
+    b.index = index;
+    brickBounds(index, b.origin, b.dims);
+    b.data = *data;
+    result.push_back(std::move(b));
+  }
+  return result;
+}
+
+uint64_t BrickStream::version() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_version;
+}
+
+size_t BrickStream::cacheBytes() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_cache.bytes();
+}
+
+size_t BrickStream::numCachedBricks() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_cache.size();
+}
+
+void BrickStream::brickBounds(size_t index, int origin[3], int dims[3]) const
+{
+  const size_t bi[3] = {index % m_numBricks[0],
+      (index / m_numBricks[0]) % m_numBricks[1],
+      index / (size_t(m_numBricks[0]) * m_numBricks[1])};
+  for (int a = 0; a < 3; ++a) {
+    origin[a] = int(bi[a]) * m_brickSize;
+    dims[a] = std::min(m_brickSize, m_dims[a] - origin[a]);
+  }
+}
+
+// Reads every lodFactor-th row of every lodFactor-th slice, i.e. 1/f^2 of
+// the file, and keeps every lodFactor-th cell of those rows
+bool BrickStream::readCoarse()
+{
+  TRACE_SCOPE("volume", "read coarse level");
+  const int f = m_lodFactor;
+  m_coarse = StructuredField();
+  m_coarse.dimX = (m_dims[0] + f - 1) / f;
+  m_coarse.dimY = (m_dims[1] + f - 1) / f;
+  m_coarse.dimZ = (m_dims[2] + f - 1) / f;
+  m_coarse.bytesPerCell = m_bytesPerCell;
+  m_coarse.dataRange = {0.f, 1.f};
+  for (int a = 0; a < 3; ++a)
+    m_coarse.spacing[a] = float(f);
+
+  const size_t numCells =
+      size_t(m_coarse.dimX) * m_coarse.dimY * m_coarse.dimZ;
+  auto *dst = static_cast<uint8_t *>(m_coarse.allocate(numCells));
+  if (!dst)
+    return false;
+  const unsigned bpc = m_bytesPerCell;
+  const size_t rowBytes = size_t(m_dims[0]) * bpc;
+  std::atomic<bool> ok{true};
+  parallelFor(
+      0,
+      m_coarse.dimZ,
+      [&](size_t begin, size_t end) {
+        std::vector<uint8_t> row(rowBytes);
+        for (size_t cz = begin; cz < end && ok; ++cz)
+          for (int cy = 0; cy < m_coarse.dimY; ++cy) {
+            const size_t offset =
+                (cz * f * m_dims[1] + size_t(cy) * f) * rowBytes;
+            if (pread(m_fd, row.data(), rowBytes, offset) != ssize_t(rowBytes)) {
+              ok = false;
+              return;
+            }
+            uint8_t *out =
+                dst + (cz * m_coarse.dimY + cy) * m_coarse.dimX * bpc;
+            for (int cx = 0; cx < m_coarse.dimX; ++cx)
+              std::memcpy(out + cx * bpc, row.data() + size_t(cx) * f * bpc, bpc);
+          }
+      },
+      1);
+  return ok;
+}
+
+std::shared_ptr<const std::vector<uint8_t>> BrickStream::readBrick(
+    size_t index) const
+{
+  TRACE_SCOPE("volume", "read brick");
+  int origin[3], dims[3];
+  brickBounds(index, origin, dims);
+  const unsigned bpc = m_bytesPerCell;
+  const size_t rowBytes = size_t(dims[0]) * bpc;
+  auto data = std::make_shared<std::vector<uint8_t>>(
+      rowBytes * dims[1] * dims[2]);
+  uint8_t *dst = data->data();
+  for (int z = 0; z < dims[2]; ++z)
+    for (int y = 0; y < dims[1]; ++y) {
+      const size_t offset =
+          ((size_t(origin[2] + z) * m_dims[1] + origin[1] + y) * m_dims[0]
+              + origin[0])
+          * bpc;
+      if (pread(m_fd, dst, rowBytes, offset) != ssize_t(rowBytes))
+        return nullptr;
+      dst += rowBytes;
+    }
+  return data;
+}
+
+// Submits count loader tasks, already counted in m_numLoaders; called
+// without m_mutex, as a stopping scheduler drops tasks right away
+void BrickStream::startLoaders(size_t count)
+{
+  TaskScheduler *scheduler = TaskScheduler::shared();
+  for (size_t i = 0; i < count; ++i) {
+    // counts a loader out that never ran, dropped by a stopping scheduler;
+    // one that ran does so itself
+    std::shared_ptr<bool> ran(new bool(false), [this](bool *ran) {
+      if (!*ran) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_numLoaders;
+        m_cv.notify_all();
+      }
+      delete ran;
+    });
+    auto task = [this, ran]() {
+      *ran = true;
+      loadQueued();
+    };
+    if (scheduler) {
+      scheduler->submit(TaskPriority::Prefetch, std::move(task));
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_pool)
+      m_pool = std::make_unique<ThreadPool>(g_numLoaders);
+    m_pool->enqueue(std::move(task));
+  }
+}
+
+// Reads queued bricks until none are left; the check and counting the
+// loader out are one step, so request() starts another for bricks queued
+// after it
+void BrickStream::loadQueued()
+{
+  for (;;) {
+    size_t index;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_stop || m_queue.empty()) {
+        --m_numLoaders;
+        m_cv.notify_all();
+        return;
+      }
+      index = m_queue.front();
+      m_queue.pop_front();
+      m_loading.insert(index);
+    }
+
+    auto data = readBrick(index);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_loading.erase(index);
+    if (!data) {
+      std::cerr << "cannot read brick " << index << " of " << m_fileName
+                << '\n';
+      continue;
+    }
+    const size_t bytes = data->size();
+    m_cache.put(index, std::move(data), bytes);
+    ++m_version;
+  }
+}
+
+void BrickStream::stop()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_stop = true;
+  m_queue.clear();
+  // the loaders see the empty queue after their current brick
+  m_cv.wait(lock, [this]() { return m_numLoaders == 0; });
+
+  m_cache.clear();
+  m_requested.clear();
+  m_loading.clear();
+  if (m_fd >= 0)
+    ::close(m_fd);
+  m_fd = -1;
+}
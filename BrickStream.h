@@ -0,0 +1,116 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+// ours
+#include "FieldTypes.h"
+#include "LruCache.h"
+#include "ThreadPool.h"
+
+// Out-of-core RAW volume ////////////////////////////////////////////////////
+//
+// For volumes larger than host memory: the file is never read as a whole.
+// open() reads a coarse level (every lodFactor()-th voxel along each axis)
+// so the whole volume can be shown right away; fine bricks are read on
+// demand by loader tasks into an LRU cache with a byte budget, on the shared
+// TaskScheduler in a session. The
+// viewer requests the bricks in the view frustum, nearest first, and
+// rebuilds its field from the resident ones whenever version() changes.
+
+class BrickStream
+{
+ public:
+  struct Brick
+  {
+    size_t index{0};
+    int origin[3]{0, 0, 0}; // first voxel
+    int dims[3]{0, 0, 0};
+    std::shared_ptr<const std::vector<uint8_t>> data; // x-fastest voxels
+  };
+
+  BrickStream() = default;
+  ~BrickStream();
+
+  BrickStream(const BrickStream &) = delete;
+  BrickStream &operator=(const BrickStream &) = delete;
+
+  // Uncompressed files only, bricks are read with pread. The coarse level
+  // gets up to a quarter of cacheBytes, the fine bricks the rest.
+  bool open(const char *fileName,
+      int dimX,
+      int dimY,
+      int dimZ,
+      unsigned bytesPerCell,
+      int brickSize,
+      size_t cacheBytes);
+  bool isOpen() const;
+
+  // Coarse voxel i samples fine voxel i * lodFactor(); spacing is
+  // lodFactor() so it covers the fine volume's box
+  const StructuredField &coarseField() const;
+  int lodFactor() const;
+  int brickSize() const;
+  unsigned bytesPerCell() const;
+
+  // Bricks whose box intersects the perspective view frustum, nearest
+  // first; volume and camera share one space (voxel units, origin 0)
+  std::vector<size_t> visibleBricks(const float eye[3],
+      const float center[3],
+      const float up[3],
+      float fovy,
+      float aspect) const;
+
+  // Replaces the bricks wanted (the first ones that fit the budget); the
+  // missing ones are queued for the loader tasks
+  void request(const std::vector<size_t> &bricks);
+
+  // Requested bricks that are in the cache
+  std::vector<Brick> residentBricks();
+
+  // Incremented whenever a requested brick arrived
+  uint64_t version() const;
+
+  size_t cacheBytes() const;
+  size_t numCachedBricks() const;
+
+ private:
+  void brickBounds(size_t index, int origin[3], int dims[3]) const;
+  bool readCoarse();
+  std::shared_ptr<const std::vector<uint8_t>> readBrick(size_t index) const;
+  void startLoaders(size_t count);
+  void loadQueued();
+  void stop();
+
+  int m_fd{-1};
+  std::string m_fileName;
+  int m_dims[3]{0, 0, 0};
+  unsigned m_bytesPerCell{0};
+  int m_brickSize{64};
+  int m_numBricks[3]{0, 0, 0};
+  int m_lodFactor{1};
+  size_t m_maxResident{0}; // full bricks in the fine budget
+  StructuredField m_coarse;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cv;
+  LruCache<size_t, std::shared_ptr<const std::vector<uint8_t>>> m_cache;
+  std::vector<size_t> m_requested;
+  std::deque<size_t> m_queue;
+  std::unordered_set<size_t> m_loading;
+  uint64_t m_version{0};
+  bool m_stop{false};
+  size_t m_numLoaders{0}; // loader tasks queued or running
+  // loaders without a shared scheduler; last, so it joins before the state
+  // above goes
+  std::unique_ptr<ThreadPool> m_pool;
+};
@@ -0,0 +1,119 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "BrickedField.h"
+// std
+#include <algorithm>
+#include <cstring>
+// ours
+#include "Parallel.h"
+#include "Trace.h"
+#include "VoxelTypes.h"
+
+BrickedField makeBrickedField(
+    const StructuredField &field, int brickSize, int ghost, float emptyValue)
+{
+  TRACE_SCOPE("field", "make bricks");
+
+  BrickedField result;
+  if (field.empty() || brickSize <= 0)
+    return result;
+
+  result.dimX = field.dimX;
+  result.dimY = field.dimY;
+  result.dimZ = field.dimZ;
+  result.brickSize = brickSize;
+  result.ghost = std::max(ghost, 0);
+  result.bytesPerCell = field.bytesPerCell;
+  result.isHalf = field.isHalf;
+  result.dataRange.x = field.dataRange.x;
+  result.dataRange.y = field.dataRange.y;
+  std::copy_n(field.origin, 3, result.origin);
+  std::copy_n(field.spacing, 3, result.spacing);
+
+  const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+  for (int a = 0; a < 3; ++a)
+    result.numBricks[a] = (dims[a] + brickSize - 1) / brickSize;
+
+  const size_t numBricks =
+      size_t(result.numBricks[0]) * result.numBricks[1] * result.numBricks[2];
+  result.bricks.resize(numBricks);
+
+  const auto *src = static_cast<const uint8_t *>(field.data());
+  const unsigned bpc = field.bytesPerCell;
+  const int g = result.ghost;
+
+  // Voxel index of a brick-local position, clamped to the volume so ghosts
+  // at the outer faces count the border voxels
+  auto sourceIndex = [&](const BrickedField::Brick &b, int x, int y, int z) {
+    const int sx = std::clamp(b.origin[0] + x, 0, dims[0] - 1);
+    const int sy = std::clamp(b.origin[1] + y, 0, dims[1] - 1);
+    const int sz = std::clamp(b.origin[2] + z, 0, dims[2] - 1);
+    return (size_t(sz) * dims[1] + sy) * dims[0] + sx;
+  };
+
+  // Pass 1: brick extents and value ranges, typed per cell type
+  dispatchVoxelType(field, [&](auto voxel) {
+    using Voxel = decltype(voxel);
+    const auto *voxels = voxelData<Voxel>(field);
+    parallelFor(
+        0,
+        numBricks,
+        [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end; ++i) {
+            auto &b = result.bricks[i];
+            const size_t bx = i % result.numBricks[0];
+            const size_t by = (i / result.numBricks[0]) % result.numBricks[1];
+            const size_t bz =
+                i / (size_t(result.numBricks[0]) * result.numBricks[1]);
+            const size_t bi[3] = {bx, by, bz};
+            for (int a = 0; a < 3; ++a) {
+              b.origin[a] = int(bi[a]) * brickSize;
+              b.dims[a] = std::min(brickSize, dims[a] - b.origin[a]);
+            }
+            b.minValue = std::numeric_limits<float>::max();
+            b.maxValue = -std::numeric_limits<float>::max();
+            for (int z = -g; z < b.dims[2] + g; ++z)
+              for (int y = -g; y < b.dims[1] + g; ++y)
+                for (int x = -g; x < b.dims[0] + g; ++x) {
+                  const float v =
+                      Voxel::value(voxels[sourceIndex(b, x, y, z)]);
+                  b.minValue = std::min(b.minValue, v);
+                  b.maxValue = std::max(b.maxValue, v);
+                }
+          }
+        },
+        1);
+  });
+
+  size_t bytes = 0;
+  for (auto &b : result.bricks) {
+    if (b.maxValue <= emptyValue)
+      continue;
+    b.offset = bytes;
+    bytes += result.storedCells(b) * bpc;
+  }
+  result.storage.resize(bytes);
+
+  // Pass 2: copy the interiors of the non-empty bricks, row by row
+  parallelFor(
+      0,
+      numBricks,
+      [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          auto &b = result.bricks[i];
+          if (b.offset == BrickedField::Empty)
+            continue;
+          uint8_t *dst = result.storage.data() + b.offset;
+          const size_t rowBytes = size_t(b.dims[0]) * bpc;
+          for (int z = 0; z < b.dims[2]; ++z)
+            for (int y = 0; y < b.dims[1]; ++y) {
+              std::memcpy(dst, src + sourceIndex(b, 0, y, z) * bpc, rowBytes);
+              dst += rowBytes;
+            }
+        }
+      },
+      1);
+
+  return result;
+}
@@ -0,0 +1,84 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+// ours
+#include "FieldTypes.h"
+
+// Bricked field layout ///////////////////////////////////////////////////////
+//
+// The field split into cubic bricks (32^3 by default), each stored
+// contiguously (x-fastest), so a brick can be uploaded and paged on its own.
+// A brick's value range also covers `ghost` voxels of its neighbours on
+// every side, so bricks next to non-empty ones are kept for interpolation
+// across their faces. Bricks whose values are all at or below the empty
+// value (air) hold no storage at all.
+struct BrickedField
+{
+  static constexpr size_t Empty = std::numeric_limits<size_t>::max();
+
+  struct Brick
+  {
+    int origin[3]; // first interior voxel
+    int dims[3]; // interior voxels, smaller at the volume's far faces
+    float minValue; // over interior and ghost voxels
+    float maxValue;
+    size_t offset{Empty}; // into storage, in bytes
+  };
+
+  int dimX{0};
+  int dimY{0};
+  int dimZ{0};
+  int brickSize{32};
+  int ghost{1}; // voxels around a brick its value range covers
+  int numBricks[3]{0, 0, 0};
+  unsigned bytesPerCell{0};
+  bool isHalf{false};
+  struct
+  {
+    float x, y;
+  } dataRange;
+  float origin[3]{0.f, 0.f, 0.f};
+  float spacing[3]{1.f, 1.f, 1.f};
+
+  std::vector<Brick> bricks; // x-fastest over numBricks
+  std::vector<uint8_t> storage;
+
+  bool empty() const
+  {
+    return bricks.empty();
+  }
+
+  size_t storedCells(const Brick &brick) const
+  {
+    return size_t(brick.dims[0]) * brick.dims[1] * brick.dims[2];
+  }
+
+  // Null for empty bricks
+  const void *brickData(const Brick &brick) const
+  {
+    return brick.offset == Empty ? nullptr : storage.data() + brick.offset;
+  }
+
+  size_t numStoredBricks() const
+  {
+    size_t n = 0;
+    for (auto &b : bricks)
+      n += b.offset != Empty;
+    return n;
+  }
+};
+
+// Values are compared as the device sees them: normalized for 8/16-bit
+// fixed point cells, as-is for half and float cells. The default empty
+// value keeps every brick.
+BrickedField makeBrickedField(const StructuredField &field,
+    int brickSize = 32,
+    int ghost = 1,
+    float emptyValue = -std::numeric_limits<float>::infinity());
@@ -0,0 +1,61 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "CameraPath.h"
+// std
+#include <fstream>
+#include <iostream>
+// nlohmann
+#include <nlohmann/json.hpp>
+
+bool readCameraPath(const std::string &file, std::vector<CameraPathFrame> &path)
+{
+  std::ifstream in(file);
+  if (!in) {
+    std::cerr << "Cannot open camera path " << file << '\n';
+    return false;
+  }
+
+  try {
+    nlohmann::json json = nlohmann::json::parse(in);
+    std::vector<CameraPathFrame> result;
+    for (auto &f : json.at("frames")) {
+      CameraPathFrame frame;
+      frame.time = f.value("time", 0.f);
+      for (int a = 0; a < 3; ++a) {
+        frame.eye[a] = f.at("eye").at(a).get<float>();
+        frame.center[a] = f.at("center").at(a).get<float>();
+        frame.up[a] = f.at("up").at(a).get<float>();
+      }
+      frame.fovy = f.value("fovy", 0.f);
+      result.push_back(frame);
+    }
+    path = std::move(result);
+  } catch (const nlohmann::json::exception &e) {
+    std::cerr << "Cannot parse camera path " << file << ": " << e.what()
+              << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool writeCameraPath(
+    const std::string &file, const std::vector<CameraPathFrame> &path)
+{
+  nlohmann::json frames = nlohmann::json::array();
+  for (auto &f : path) {
+    frames.push_back({{"time", f.time},
+        {"eye", {f.eye[0], f.eye[1], f.eye[2]}},
+        {"center", {f.center[0], f.center[1], f.center[2]}},
+        {"up", {f.up[0], f.up[1], f.up[2]}},
+        {"fovy", f.fovy}});
+  }
+
+  std::ofstream out(file);
+  out << nlohmann::json{{"frames", frames}}.dump() << '\n';
+  if (!out) {
+    std::cerr << "Cannot write camera path " << file << '\n';
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,29 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+
+// Recorded camera path ///////////////////////////////////////////////////////
+//
+// The camera of an interactive session, one state per frame the view changed
+// in, so the same interaction can be replayed against another build: in the
+// viewer (--replay-camera, one rendered frame per state) or headless through
+// the render benchmark. Stored as JSON: {"frames": [{"time", "eye",
+// "center", "up", "fovy"}, ...]}.
+
+struct CameraPathFrame
+{
+  float time{0.f}; // seconds since the recording started
+  float eye[3]{0.f, 0.f, 0.f};
+  float center[3]{0.f, 0.f, 0.f};
+  float up[3]{0.f, 1.f, 0.f};
+  float fovy{0.f}; // radians
+};
+
+bool readCameraPath(const std::string &file, std::vector<CameraPathFrame> &path);
+bool writeCameraPath(
+    const std::string &file, const std::vector<CameraPathFrame> &path);
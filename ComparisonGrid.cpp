@@ -0,0 +1,398 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ComparisonGrid.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+// ours
+#include "Trace.h"
+
+namespace {
+
+constexpr int g_pageSize = 2048; // atlas texture width and height
+constexpr int g_cellsPerRow =
+    g_pageSize / anari_viewer::windows::ComparisonGrid::cellSize;
+constexpr size_t g_cellsPerPage = size_t(g_cellsPerRow) * g_cellsPerRow;
+constexpr int g_framesInFlight = 4; // also the cells rendered per UI frame
+
+uint8_t luminance(const uint8_t *rgba)
+{
+  return uint8_t((rgba[0] + rgba[1] + rgba[2]) / 3);
+}
+
+// Box filter of an RGBA image to width x height, rows kept in order
+std::shared_ptr<const Image> downscale(const Image &src, int width, int height)
+{
+  auto dst = std::make_shared<Image>();
+  dst->width = size_t(width);
+  dst->height = size_t(height);
+  dst->bpp = 4;
+  dst->data.resize(dst->width * dst->height * 4);
+  for (int y = 0; y < height; ++y) {
+    const size_t y0 = size_t(y) * src.height / height;
+    const size_t y1 = std::max(y0 + 1, size_t(y + 1) * src.height / height);
+    for (int x = 0; x < width; ++x) {
+      const size_t x0 = size_t(x) * src.width / width;
+      const size_t x1 = std::max(x0 + 1, size_t(x + 1) * src.width / width);
+      uint32_t sum[4]{0, 0, 0, 0};
+      for (size_t sy = y0; sy < y1; ++sy) {
+        const uint8_t *row = src.data.data() + sy * src.width * 4;
+        for (size_t sx = x0; sx < x1; ++sx) {
+          for (int c = 0; c < 4; ++c)
+            sum[c] += row[sx * 4 + c];
+        }
+      }
+      const uint32_t n = uint32_t((y1 - y0) * (x1 - x0));
+      uint8_t *out = dst->data.data() + (size_t(y) * width + x) * 4;
+      for (int c = 0; c < 4; ++c)
+        out[c] = uint8_t(sum[c] / n);
+    }
+  }
+  return dst;
+}
+
+} // namespace
+
+namespace anari_viewer::windows {
+
+ComparisonGrid::ComparisonGrid(anari::Device device,
+    anari::World world,
+    const BatchRenderSettings &settings,
+    const prediction_container &predictions,
+    ImageStore &images,
+    const char *name)
+    : Window(name, true), m_device(device), m_world(world),
+      m_predictions(predictions), m_images(images), m_settings(settings)
+{
+  // cells in the sensor's aspect, the longer side cellSize
+  const float aspect = predictions.fovy > 0.f
+      ? std::tan(0.5f * predictions.fovx) / std::tan(0.5f * predictions.fovy)
+      : 1.f;
+  m_settings.width =
+      aspect >= 1.f ? cellSize : std::max(1, int(cellSize * aspect));
+  m_settings.height =
+      aspect >= 1.f ? std::max(1, int(cellSize / aspect)) : cellSize;
+  m_settings.writeOrigin = false;
+  m_settings.framesInFlight = g_framesInFlight;
+}
+
+ComparisonGrid::~ComparisonGrid()
+{
+  m_renderer.reset();
+  for (auto texture : m_pages) {
+    if (texture)
+      glDeleteTextures(1, &texture);
+  }
+}
+
+void ComparisonGrid::setWorldVersionCallback(WorldVersionCallback cb)
+{
+  m_worldVersion = std::move(cb);
+}
+
+void ComparisonGrid::setSelectCallback(SelectPredictionCallback cb)
+{
+  m_select = std::move(cb);
+}
+
+void ComparisonGrid::setDrrSource(DrrSourceCallback cb)
+{
+  m_drrSource = std::move(cb);
+}
+
+void ComparisonGrid::setDeviceArbiter(DeviceArbiter *arbiter)
+{
+  m_arbiter = arbiter;
+}
+
+void ComparisonGrid::setPhotonEnergy(float photonEnergy)
+{
+  if (photonEnergy == m_settings.photonEnergy)
+    return;
+  m_settings.photonEnergy = photonEnergy;
+  if (m_renderer)
+    m_renderer->setPhotonEnergy(photonEnergy);
+  ++m_generation;
+}
+
+void ComparisonGrid::resetPredictions()
+{
+  resize();
+}
+
+void ComparisonGrid::buildUI()
+{
+  const auto &predictions = m_predictions.predictions;
+  if (predictions.empty()) {
+    ImGui::Text("no predictions loaded");
+    return;
+  }
+  if (m_cells.size() < predictions.size()) {
+    // appended (a live feed): the cells so far stay
+    m_cells.resize(predictions.size(), Cell());
+    m_references.resize(predictions.size(), nullptr);
+  } else if (m_cells.size() != predictions.size())
+    resize();
+  if (!m_renderer) {
+    m_renderer =
+        std::make_unique<BatchRenderer>(m_device, m_world, m_settings);
+  }
+
+  if (ImGui::Combo("mode", &m_mode, "DRR\0overlay\0difference\0\0"))
+    ++m_generation;
+  if (m_mode == ModeDifference) {
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(8.f * ImGui::GetFontSize());
+    if (ImGui::SliderFloat("gain", &m_gain, 1.f, 16.f, "%.1f"))
+      ++m_generation;
+  }
+
+  const float spacing = ImGui::GetStyle().ItemSpacing.x;
+  const float textHeight = ImGui::GetTextLineHeightWithSpacing();
+  const ImVec2 cellExtent(float(m_settings.width), float(m_settings.height));
+  const ImVec2 available = ImGui::GetContentRegionAvail();
+  const size_t columns = std::max<size_t>(
+      1, size_t((available.x + spacing) / (cellExtent.x + spacing)));
+  const size_t rows = (predictions.size() + columns - 1) / columns;
+
+  // stale cells in view, rendered once the grid is drawn
+  std::vector<size_t> render;
+  ImGui::BeginChild("cells");
+  ImGuiListClipper clipper;
+  clipper.Begin(int(rows), cellExtent.y + textHeight + spacing);
+  while (clipper.Step()) {
+    for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+      for (size_t column = 0; column < columns; ++column) {
+        const size_t i = size_t(row) * columns + column;
+        if (i >= predictions.size())
+          break;
+        if (column > 0)
+          ImGui::SameLine();
+
+        ImGui::BeginGroup();
+        const auto &cell = m_cells[i];
+        if (cell.drawn) {
+          ImVec2 uv0, uv1;
+          cellUV(i, uv0, uv1);
+          ImGui::Image((void *)(intptr_t)m_pages[i / g_cellsPerPage],
+              cellExtent,
+              uv0,
+              uv1);
+        } else {
+          ImGui::Dummy(cellExtent);
+        }
+        if (ImGui::IsItemClicked() && m_select)
+          m_select(i);
+        if (ImGui::IsItemHovered())
+          ImGui::SetTooltip("%s", predictions[i].filename.c_str());
+        if (cell.difference >= 0.f)
+          ImGui::Text("%zu  %.3f", i, cell.difference);
+        else
+          ImGui::Text("%zu", i);
+        ImGui::EndGroup();
+
+        if (stale(i) && render.size() < m_renderer->numSlots()) {
+          render.push_back(i);
+          m_images.prefetch(i);
+        }
+      }
+    }
+  }
+  ImGui::EndChild();
+
+  if (!render.empty())
+    renderCells(render);
+}
+
+bool ComparisonGrid::stale(size_t index) const
+{
+  const auto &cell = m_cells[index];
+  const auto &pose = m_predictions.predictions[index];
+  auto same = [](const anari::math::float3 &a, const anari::math::float3 &b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+  };
+  return !cell.drawn || cell.generation != m_generation
+      || (m_worldVersion && cell.worldVersion != m_worldVersion())
+      || !same(cell.eye, pose.eye) || !same(cell.center, pose.center)
+      || !same(cell.up, pose.up);
+}
+
+void ComparisonGrid::resize()
+{
+  // new predictions: references of the old ones no longer apply
+  m_cells.assign(m_predictions.predictions.size(), Cell());
+  m_references.assign(m_predictions.predictions.size(), nullptr);
+}
+
+void ComparisonGrid::renderCells(const std::vector<size_t> &indices)
+{
+  TRACE_SCOPE("grid", "render cells");
+  const uint64_t worldVersion = m_worldVersion ? m_worldVersion() : 0;
+
+  // cells with a DRR elsewhere are scaled from it, the others rendered
+  RayCamera camera;
+  camera.fovy = m_settings.fovy;
+  camera.aspect = m_settings.width / float(m_settings.height);
+  std::vector<size_t> render;
+  for (size_t i : indices) {
+    auto drr = m_drrSource ? m_drrSource(i, camera) : nullptr;
+    if (!drr || drr->bpp != 4) {
+      render.push_back(i);
+      continue;
+    }
+    const auto scaled = downscale(*drr, m_settings.width, m_settings.height);
+    composite(i, scaled->data.data());
+    upload(i, m_pixels.data());
+    drawn(i, worldVersion);
+  }
+  // stale cells stay stale and are tried again next UI frame
+  if (!render.empty() && m_arbiter && m_arbiter->interactive()) {
+    m_arbiter->yielded();
+    return;
+  }
+
+  for (size_t k = 0; k < render.size(); ++k)
+    m_renderer->submit(k, m_predictions.predictions[render[k]]);
+
+  for (size_t k = 0; k < render.size(); ++k) {
+    const size_t i = render[k];
+    const auto *r = m_renderer->readback(k);
+    if (!r)
+      continue;
+    composite(i, r->color.data());
+    upload(i, m_pixels.data());
+    drawn(i, worldVersion);
+  }
+}
+
+void ComparisonGrid::drawn(size_t index, uint64_t worldVersion)
+{
+  const auto &pose = m_predictions.predictions[index];
+  auto &cell = m_cells[index];
+  cell.drawn = true;
+  cell.worldVersion = worldVersion;
+  cell.generation = m_generation;
+  cell.eye = pose.eye;
+  cell.center = pose.center;
+  cell.up = pose.up;
+}
+
+void ComparisonGrid::composite(size_t index, const uint8_t *drr)
+{
+  const size_t numPixels = size_t(m_settings.width) * m_settings.height;
+  m_pixels.resize(numPixels * 4);
+  const Image *ref = reference(index);
+  auto &cell = m_cells[index];
+  if (!ref) {
+    std::copy(drr, drr + numPixels * 4, m_pixels.begin());
+    cell.difference = -1.f;
+    return;
+  }
+
+  // both are bottom row first
+  uint64_t sum = 0;
+  for (size_t p = 0; p < numPixels; ++p) {
+    const uint8_t d = luminance(drr + p * 4);
+    const uint8_t r = luminance(ref->data.data() + p * 4);
+    const int diff = std::abs(int(d) - int(r));
+    sum += uint64_t(diff);
+    uint8_t *out = m_pixels.data() + p * 4;
+    switch (m_mode) {
+    case ModeOverlay:
+      out[0] = d;
+      out[1] = r;
+      out[2] = d;
+      break;
+    case ModeDifference: {
+      const auto v = uint8_t(std::min(255.f, diff * m_gain));
+      out[0] = out[1] = out[2] = v;
+      break;
+    }
+    default:
+      std::copy(drr + p * 4, drr + p * 4 + 3, out);
+      break;
+    }
+    out[3] = 255;
+  }
+  cell.difference = float(sum) / (255.f * float(numPixels));
+}
+
+const Image *ComparisonGrid::reference(size_t index)
+{
+  auto &ref = m_references[index];
+  if (!ref) {
+    auto image = rgbaImage(m_images.get(index));
+    if (image && image->bpp == 4 && image->width && image->height)
+      ref = downscale(*image, m_settings.width, m_settings.height);
+    else
+      ref = std::make_shared<Image>(); // not tried again
+  }
+  return ref->data.empty() ? nullptr : ref.get();
+}
+
+void ComparisonGrid::upload(size_t index, const uint8_t *pixels)
+{
+  const size_t page = index / g_cellsPerPage;
+  const size_t slot = index % g_cellsPerPage;
+  if (m_pages.size() <= page)
+    m_pages.resize(page + 1, 0);
+  if (!m_pages[page]) {
+    glGenTextures(1, &m_pages[page]);
+    glBindTexture(GL_TEXTURE_2D, m_pages[page]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D,
+        0,
+        GL_RGBA8,
+        g_pageSize,
+        g_pageSize,
+        0,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        nullptr);
+  }
+
+  const int x = int(slot % g_cellsPerRow) * cellSize;
+  const int y = int(slot / g_cellsPerRow) * cellSize;
+  glBindTexture(GL_TEXTURE_2D, m_pages[page]);
+  glTexSubImage2D(GL_TEXTURE_2D,
+      0,
+      x,
+      y,
+      m_settings.width,
+      m_settings.height,
+      GL_RGBA,
+      GL_UNSIGNED_BYTE,
+      pixels);
+}
+
+void ComparisonGrid::cellUV(size_t index, ImVec2 &uv0, ImVec2 &uv1) const
+{
+  // flipped, cells are bottom row first
+  const size_t slot = index % g_cellsPerPage;
+  const int x = int(slot % g_cellsPerRow) * cellSize;
+  const int y = int(slot / g_cellsPerRow) * cellSize;
+  uv0 = ImVec2(
+      float(x) / g_pageSize, float(y + m_settings.height) / g_pageSize);
+  uv1 = ImVec2(
+      float(x + m_settings.width) / g_pageSize, float(y) / g_pageSize);
+}
+
+void ComparisonGrid::reportMemory(MemoryReport &report) const
+{
+  const size_t pages =
+      std::count_if(m_pages.begin(), m_pages.end(), [](GLuint t) { return t; });
+  report.add(MemoryReport::GL,
+      "comparison grid (" + std::to_string(pages) + " pages)",
+      pages * g_pageSize * g_pageSize * 4);
+  size_t referenceBytes = 0;
+  for (const auto &ref : m_references)
+    referenceBytes += ref ? ref->data.size() : 0;
+  report.add(MemoryReport::Host, "comparison grid references", referenceBytes);
+}
+
+} // namespace anari_viewer::windows
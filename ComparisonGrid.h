@@ -0,0 +1,121 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// glad
+#include "glad/glad.h"
+// anari
+#include <anari/anari_cpp.hpp>
+#include "anari_viewer/windows/Window.h"
+// std
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+// ours
+#include "BatchRenderer.h"
+#include "DeviceArbiter.h"
+#include "FirstHit.h"
+#include "Image.h"
+#include "ImageStore.h"
+#include "MemoryReport.h"
+#include "prediction.h"
+
+namespace anari_viewer::windows {
+
+using WorldVersionCallback = std::function<uint64_t()>;
+using SelectPredictionCallback = std::function<void(size_t)>;
+// A DRR of prediction `index` rendered elsewhere in the camera's geometry,
+// at any size, or null
+using DrrSourceCallback = std::function<std::shared_ptr<const Image>(
+    size_t index, const RayCamera &camera)>;
+
+// QA view of many predictions at once: per prediction a small DRR at the
+// predicted pose next to its reference, overlaid (DRR magenta, reference
+// green, aligned structures gray) or as their absolute difference. Cells
+// are rendered offscreen by a BatchRenderer at cell resolution, several
+// poses in flight against the viewer's world, and composited into fixed
+// cells of a few atlas textures like ThumbnailAtlas. Only visible cells
+// whose pose (or the world) changed since they were drawn are rendered
+// again, a few per UI frame, so moving one prediction redraws one cell.
+class ComparisonGrid : public anari_viewer::windows::Window
+{
+ public:
+  static constexpr int cellSize = 128; // longer side of a cell
+
+  // settings: renderer and field of view of the cells; size, origin
+  // channel and frames in flight are the grid's own
+  ComparisonGrid(anari::Device device,
+      anari::World world,
+      const BatchRenderSettings &settings,
+      const prediction_container &predictions,
+      ImageStore &images,
+      const char *name = "Comparison Grid");
+  ~ComparisonGrid(); // needs the GL context
+
+  void buildUI() override;
+
+  // World changes (LUT, window, volume) redraw every cell
+  void setWorldVersionCallback(WorldVersionCallback cb);
+  // Clicking a cell selects its prediction
+  void setSelectCallback(SelectPredictionCallback cb);
+  // Cells scale a DRR from here down instead of rendering, where it has one
+  void setDrrSource(DrrSourceCallback cb);
+  // Cells not scaled from a DRR wait for a UI frame without interactive
+  // frames in flight (nullptr: rendered right away)
+  void setDeviceArbiter(DeviceArbiter *arbiter);
+  void setPhotonEnergy(float photonEnergy); // keV, 0: the renderer's default
+  // The predictions were replaced (another case), maybe by as many
+  void resetPredictions();
+  void reportMemory(MemoryReport &report) const;
+
+ private:
+  enum Mode : int
+  {
+    ModeDrr,
+    ModeOverlay,
+    ModeDifference
+  };
+
+  struct Cell
+  {
+    bool drawn{false};
+    uint64_t worldVersion{0};
+    uint32_t generation{0}; // of the grid's settings it was drawn with
+    anari::math::float3 eye, center, up; // pose it was drawn at
+    float difference{-1.f}; // mean absolute, 0..1; < 0 without reference
+  };
+
+  bool stale(size_t index) const;
+  void resize();
+  void renderCells(const std::vector<size_t> &indices);
+  void drawn(size_t index, uint64_t worldVersion);
+  void composite(size_t index, const uint8_t *drr);
+  const Image *reference(size_t index);
+  void upload(size_t index, const uint8_t *pixels);
+  void cellUV(size_t index, ImVec2 &uv0, ImVec2 &uv1) const;
+
+  anari::Device m_device{nullptr};
+  anari::World m_world{nullptr};
+  const prediction_container &m_predictions;
+  ImageStore &m_images;
+  BatchRenderSettings m_settings;
+  std::unique_ptr<BatchRenderer> m_renderer; // once the window is shown
+
+  WorldVersionCallback m_worldVersion;
+  SelectPredictionCallback m_select;
+  DrrSourceCallback m_drrSource;
+  DeviceArbiter *m_arbiter{nullptr};
+
+  int m_mode{ModeOverlay};
+  float m_gain{4.f}; // of the difference image
+  uint32_t m_generation{1}; // mode, gain or photon energy changes
+  std::vector<Cell> m_cells;
+  // references at cell resolution, RGBA; built on first use
+  std::vector<std::shared_ptr<const Image>> m_references;
+  std::vector<uint8_t> m_pixels; // composited cell
+  std::vector<GLuint> m_pages;
+};
+
+} // namespace anari_viewer::windows
@@ -0,0 +1,125 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// Convergence of progressively accumulated frames: successive frames are
+// compared per tile of tileSize^2 pixels (every sampleStep-th pixel on every
+// sampleStep-th row, RGB or the linear value). The image has converged once
+// no tile's mean change exceeded the tolerance for stableFrames frames in a
+// row.
+class ConvergenceCheck
+{
+ public:
+  static constexpr int tileSize = 32;
+  static constexpr int sampleStep = 4;
+
+  float tolerance{0.5f}; // mean change per channel, 8-bit units
+  int stableFrames{4};
+
+  void reset()
+  {
+    m_previous.clear();
+    m_stable = 0;
+    m_frames = 0;
+    m_maxChange = 0.f;
+  }
+
+  // RGBA8 pixels, x-fastest; true once converged
+  bool push(const uint32_t *rgba, int width, int height)
+  {
+    return pushSamples(width, height, 3, [&](size_t i, int c) {
+      return float((rgba[i] >> (8 * c)) & 0xff);
+    });
+  }
+
+  // Linear single-channel frames; `scale` takes values to 8-bit units
+  // (255 over the display window) so the tolerance means the same
+  bool push(const float *values, int width, int height, float scale)
+  {
+    return pushSamples(width, height, 1, [&](size_t i, int) {
+      return std::isfinite(values[i]) ? values[i] * scale : 0.f;
+    });
+  }
+
+  bool converged() const
+  {
+    return m_stable >= stableFrames;
+  }
+
+  int frames() const // since reset()
+  {
+    return m_frames;
+  }
+
+  float maxTileChange() const // of the last comparison
+  {
+    return m_maxChange;
+  }
+
+ private:
+  // sample(pixel, channel) in 8-bit units
+  template <typename Sample>
+  bool pushSamples(int width, int height, int channels, Sample sample)
+  {
+    const int sx = (width + sampleStep - 1) / sampleStep;
+    const int sy = (height + sampleStep - 1) / sampleStep;
+    const size_t numSamples = size_t(sx) * sy * channels;
+    const bool first = m_previous.size() != numSamples || m_width != width
+        || m_height != height;
+    if (first) {
+      m_previous.assign(numSamples, 0.f);
+      m_width = width;
+      m_height = height;
+      m_stable = 0;
+    }
+
+    const int tilesX = (width + tileSize - 1) / tileSize;
+    const int tilesY = (height + tileSize - 1) / tileSize;
+    m_tileChange.assign(size_t(tilesX) * tilesY, 0.f);
+    m_tileCount.assign(m_tileChange.size(), 0);
+    for (int y = 0; y < sy; ++y) {
+      const size_t row = size_t(y) * sampleStep * width;
+      const size_t tileRow = size_t(y * sampleStep / tileSize) * tilesX;
+      for (int x = 0; x < sx; ++x) {
+        float *prev = &m_previous[(size_t(y) * sx + x) * channels];
+        float change = 0.f;
+        for (int c = 0; c < channels; ++c) {
+          const float v = sample(row + size_t(x) * sampleStep, c);
+          change += std::abs(v - prev[c]);
+          prev[c] = v;
+        }
+        const size_t tile = tileRow + x * sampleStep / tileSize;
+        m_tileChange[tile] += change / channels;
+        ++m_tileCount[tile];
+      }
+    }
+
+    ++m_frames;
+    if (first)
+      return false;
+    m_maxChange = 0.f;
+    for (size_t t = 0; t < m_tileChange.size(); ++t) {
+      if (m_tileCount[t] > 0)
+        m_maxChange = std::max(m_maxChange, m_tileChange[t] / m_tileCount[t]);
+    }
+    m_stable = m_maxChange <= tolerance ? m_stable + 1 : 0;
+    return converged();
+  }
+
+  std::vector<float> m_previous; // channels of the samples
+  std::vector<float> m_tileChange;
+  std::vector<int> m_tileCount;
+  int m_width{0};
+  int m_height{0};
+  int m_stable{0};
+  int m_frames{0};
+  float m_maxChange{0.f};
+};
@@ -0,0 +1,100 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Crop.h"
+// std
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+namespace {
+
+// Slices z0..z1 sharing the voxels of `field`, as SlabRender's slabField()
+StructuredField sliceField(const StructuredField &field, int z0, int z1)
+{
+  StructuredField slices;
+  slices.bytesPerCell = field.bytesPerCell;
+  slices.isHalf = field.isHalf;
+  slices.dataRange = field.dataRange;
+  slices.dimX = field.dimX;
+  slices.dimY = field.dimY;
+  slices.dimZ = z1 - z0 + 1;
+  std::copy_n(field.spacing, 3, slices.spacing);
+  std::copy_n(field.origin, 3, slices.origin);
+  slices.origin[2] += z0 * field.spacing[2];
+  const size_t sliceBytes =
+      size_t(field.dimX) * field.dimY * field.bytesPerCell;
+  const auto *first =
+      static_cast<const uint8_t *>(field.data()) + z0 * sliceBytes;
+  // aliases the whole buffer, which stays alive while the slices do
+  slices.voxels = std::shared_ptr<const void>(field.voxels, first);
+  return slices;
+}
+
+} // namespace
+
+CropBox clipBox(
+    const StructuredField &field, const float lower[3], const float upper[3])
+{
+  CropBox box;
+  const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+  for (int a = 0; a < 3; ++a) {
+    const float last = float(dims[a] - 1);
+    float i0 = (lower[a] - field.origin[a]) / field.spacing[a];
+    float i1 = (upper[a] - field.origin[a]) / field.spacing[a];
+    if (i0 > i1)
+      std::swap(i0, i1); // negative spacing
+    box.lower[a] = int(std::ceil(std::clamp(i0, 0.f, last + 1.f)));
+    box.upper[a] = int(std::floor(std::clamp(i1, -1.f, last)));
+  }
+  return box;
+}
+
+StructuredField boxField(const StructuredField &field, const CropBox &box)
+{
+  const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+  if (box.empty() || field.empty())
+    return {};
+  if (box.covers(dims))
+    return field;
+  if (box.lower[0] == 0 && box.lower[1] == 0 && box.upper[0] == dims[0] - 1
+      && box.upper[1] == dims[1] - 1)
+    return sliceField(field, box.lower[2], box.upper[2]);
+
+  StructuredField result;
+  result.bytesPerCell = field.bytesPerCell;
+  result.isHalf = field.isHalf;
+  result.dataRange = field.dataRange;
+  result.dimX = box.dim(0);
+  result.dimY = box.dim(1);
+  result.dimZ = box.dim(2);
+  for (int a = 0; a < 3; ++a) {
+    result.spacing[a] = field.spacing[a];
+    result.origin[a] = field.origin[a] + box.lower[a] * field.spacing[a];
+  }
+  void *dst = result.allocate(result.numCells());
+  auto copy = [&](auto cell) {
+    using T = decltype(cell);
+    copyCropBox(static_cast<const T *>(field.data()),
+        dims,
+        box,
+        static_cast<T *>(dst));
+  };
+  switch (field.bytesPerCell) {
+  case 1:
+    copy(uint8_t());
+    break;
+  case 2:
+    copy(uint16_t());
+    break;
+  case 4:
+    copy(uint32_t());
+    break;
+  case 8:
+    copy(uint64_t());
+    break;
+  default:
+    return {};
+  }
+  return result;
+}
@@ -0,0 +1,130 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <mutex>
+// ours
+#include "FieldTypes.h"
+#include "Parallel.h"
+
+// Voxel box, bounds inclusive; lower > upper when no voxel was found
+struct CropBox
+{
+  int lower[3]{0, 0, 0};
+  int upper[3]{-1, -1, -1};
+
+  bool empty() const
+  {
+    return upper[0] < lower[0] || upper[1] < lower[1] || upper[2] < lower[2];
+  }
+
+  int dim(int axis) const
+  {
+    return empty() ? 0 : upper[axis] - lower[axis] + 1;
+  }
+
+  bool covers(const int dims[3]) const
+  {
+    return lower[0] == 0 && lower[1] == 0 && lower[2] == 0
+        && upper[0] == dims[0] - 1 && upper[1] == dims[1] - 1
+        && upper[2] == dims[2] - 1;
+  }
+};
+
+// Threshold clamped to what a T voxel can hold
+template <typename T>
+inline T cropThreshold(float threshold)
+{
+  return T(std::clamp<double>(threshold,
+      double(std::numeric_limits<T>::lowest()),
+      double(std::numeric_limits<T>::max())));
+}
+
+// Bounding box of the voxels above threshold, in one pass over the slices
+template <typename T>
+inline CropBox findCropBox(const T *data, const int dims[3], T threshold)
+{
+  CropBox box;
+  for (int a = 0; a < 3; ++a) {
+    box.lower[a] = dims[a];
+    box.upper[a] = -1;
+  }
+
+  std::mutex mutex;
+  const size_t sliceVoxels = size_t(dims[0]) * dims[1];
+  parallelFor(
+      0,
+      dims[2],
+      [&](size_t zBegin, size_t zEnd) {
+        CropBox local;
+        for (int a = 0; a < 3; ++a)
+          local.lower[a] = dims[a];
+        for (size_t z = zBegin; z < zEnd; ++z) {
+          const T *slice = data + z * sliceVoxels;
+          for (int y = 0; y < dims[1]; ++y) {
+            const T *row = slice + size_t(y) * dims[0];
+            int x0 = 0;
+            while (x0 < dims[0] && !(row[x0] > threshold))
+              ++x0;
+            if (x0 == dims[0])
+              continue;
+            int x1 = dims[0] - 1;
+            while (!(row[x1] > threshold))
+              --x1;
+            local.lower[0] = std::min(local.lower[0], x0);
+            local.upper[0] = std::max(local.upper[0], x1);
+            local.lower[1] = std::min(local.lower[1], y);
+            local.upper[1] = std::max(local.upper[1], y);
+            local.lower[2] = std::min(local.lower[2], int(z));
+            local.upper[2] = std::max(local.upper[2], int(z));
+          }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int a = 0; a < 3; ++a) {
+          box.lower[a] = std::min(box.lower[a], local.lower[a]);
+          box.upper[a] = std::max(box.upper[a], local.upper[a]);
+        }
+      },
+      1);
+  return box;
+}
+
+// Copies the box out of a dims-sized volume into dst (box.dim() sized)
+template <typename T>
+inline void copyCropBox(
+    const T *src, const int dims[3], const CropBox &box, T *dst)
+{
+  const size_t rowVoxels = box.dim(0);
+  parallelFor(
+      0,
+      box.dim(2),
+      [&](size_t zBegin, size_t zEnd) {
+        for (size_t z = zBegin; z < zEnd; ++z) {
+          for (int y = 0; y < box.dim(1); ++y) {
+            const size_t from =
+                (size_t(box.lower[2] + z) * dims[1] + box.lower[1] + y)
+                    * dims[0]
+                + box.lower[0];
+            const size_t to = (z * box.dim(1) + y) * rowVoxels;
+            std::memcpy(dst + to, src + from, rowVoxels * sizeof(T));
+          }
+        }
+      },
+      1);
+}
+
+// The voxels of `field` whose centers lie in the object-space box
+// [lower, upper]; empty if none do (Crop.cpp)
+CropBox clipBox(
+    const StructuredField &field, const float lower[3], const float upper[3]);
+
+// The box's voxels as a field of their own, with the origin moved to its
+// first voxel: shared like SlabRender's slabField() when the box spans
+// whole slices, else copied. The data range is kept, macrocells and
+// histogram are dropped.
+StructuredField boxField(const StructuredField &field, const CropBox &box);
@@ -0,0 +1,412 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Decompress.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// std
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+// compression
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+// ours
+#include "Trace.h"
+
+namespace {
+
+// Read-only mapping of a whole file; the page cache does the reading
+struct MappedFile
+{
+  MappedFile(const char *fileName)
+  {
+    int fd = ::open(fileName, O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *ptr =
+          mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        data = static_cast<const uint8_t *>(ptr);
+        size = size_t(st.st_size);
+        madvise(ptr, size, MADV_SEQUENTIAL);
+      }
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile()
+  {
+    if (data)
+      munmap(const_cast<uint8_t *>(data), size);
+  }
+
+  const uint8_t *data{nullptr};
+  size_t size{0};
+};
+
+// Independently decodable piece of a compressed file
+struct Chunk
+{
+  size_t srcOffset;
+  size_t srcSize;
+  size_t dstOffset; // in the decompressed stream
+  size_t dstSize;
+};
+
+// The wanted window [skip, skip + size) of the decompressed stream
+struct Window
+{
+  uint8_t *dst;
+  size_t skip;
+  size_t size;
+};
+
+// Decodes chunks on all cores in file order, each straight into the window
+// when it lies inside it or through a scratch buffer when it straddles an
+// edge; chunks outside the window are not decoded. The progress follows the
+// completed prefix.
+template <typename DecodeChunk>
+bool decodeChunks(const std::vector<Chunk> &chunks,
+    const Window &window,
+    DecodeProgress *progress,
+    DecodeChunk &&decodeChunk)
+{
+  const size_t end = window.skip + window.size;
+  std::atomic<size_t> next{0};
+  std::atomic<bool> ok{true};
+  std::mutex mutex;
+  std::vector<bool> done(chunks.size(), false);
+  size_t prefix = 0; // chunks completed in order
+
+  auto worker = [&]() {
+    std::vector<uint8_t> scratch;
+    for (size_t i = next++; i < chunks.size() && ok; i = next++) {
+      const auto &c = chunks[i];
+      const size_t from = std::max(c.dstOffset, window.skip);
+      const size_t to = std::min(c.dstOffset + c.dstSize, end);
+      if (from < to) {
+        uint8_t *out = nullptr;
+        if (from == c.dstOffset && to == c.dstOffset + c.dstSize) {
+          out = window.dst + (from - window.skip);
+        } else {
+          scratch.resize(c.dstSize);
+          out = scratch.data();
+        }
+        if (!decodeChunk(c, out)) {
+          ok = false;
+          break;
+        }
+        if (out == scratch.data()) {
+          std::memcpy(window.dst + (from - window.skip),
+              scratch.data() + (from - c.dstOffset),
+              to - from);
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      done[i] = true;
+      while (prefix < chunks.size() && done[prefix])
+        ++prefix;
+      if (progress && prefix > 0) {
+        const auto &last = chunks[prefix - 1];
+        const size_t decoded = last.dstOffset + last.dstSize;
+        progress->advance(
+            decoded > window.skip ? std::min(decoded, end) - window.skip : 0);
+      }
+    }
+  };
+
+  const size_t numThreads = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()), chunks.size());
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < numThreads; ++t)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &t : threads)
+    t.join();
+
+  if (!ok)
+    return false;
+  const auto &last = chunks.back();
+  return last.dstOffset + last.dstSize >= end;
+}
+
+// Serial decoding: `produce(out, n)` writes up to n decompressed bytes and
+// returns how many (0 at the end of the stream, -1 on errors). Bytes before
+// the window go to a scratch buffer, the rest straight into the window.
+template <typename Produce>
+bool decodeStream(
+    const Window &window, DecodeProgress *progress, Produce &&produce)
+{
+  constexpr size_t chunkSize = size_t(4) << 20;
+  std::vector<uint8_t> scratch(std::min(window.skip, chunkSize));
+  size_t skipped = 0;
+  while (skipped < window.skip) {
+    const long n =
+        produce(scratch.data(), std::min(scratch.size(), window.skip - skipped));
+    if (n <= 0)
+      return false;
+    skipped += size_t(n);
+  }
+
+  size_t written = 0;
+  while (written < window.size) {
+    const long n = produce(window.dst + written,
+        std::min(chunkSize, window.size - written));
+    if (n <= 0)
+      return false;
+    written += size_t(n);
+    if (progress)
+      progress->advance(written);
+  }
+  return true;
+}
+
+#ifdef HAVE_ZLIB
+// BGZF: gzip members whose FEXTRA "BC" subfield holds the member size and
+// whose trailer holds the decompressed size, so all members can be found
+// without inflating anything
+bool findBgzfBlocks(const MappedFile &file, std::vector<Chunk> &chunks)
+{
+  size_t offset = 0, decoded = 0;
+  while (offset < file.size) {
+    const uint8_t *p = file.data + offset;
+    const size_t remaining = file.size - offset;
+    if (remaining < 18 || p[0] != 0x1f || p[1] != 0x8b || !(p[3] & 0x04))
+      return false;
+    const size_t xlen = p[10] | (p[11] << 8);
+    if (xlen < 6 || p[12] != 'B' || p[13] != 'C' || p[14] != 2 || p[15] != 0)
+      return false;
+    const size_t blockSize = (p[16] | (p[17] << 8)) + 1;
+    if (blockSize > remaining || blockSize < 18 + 8)
+      return false;
+    const uint8_t *trailer = p + blockSize - 4;
+    const size_t isize = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16)
+        | (size_t(trailer[3]) << 24);
+    chunks.push_back({offset, blockSize, decoded, isize});
+    offset += blockSize;
+    decoded += isize;
+  }
+  return !chunks.empty();
+}
+
+bool inflateGzip(const MappedFile &file, const Window &window, DecodeProgress *progress)
+{
+  std::vector<Chunk> chunks;
+  if (findBgzfBlocks(file, chunks)) {
+    return decodeChunks(chunks, window, progress, [&](const Chunk &c, uint8_t *out) {
+      z_stream zs{};
+      if (inflateInit2(&zs, 15 + 16) != Z_OK)
+        return false;
+      zs.next_in = const_cast<Bytef *>(file.data + c.srcOffset);
+      zs.avail_in = uInt(c.srcSize);
+      zs.next_out = out;
+      zs.avail_out = uInt(c.dstSize);
+      const int res = inflate(&zs, Z_FINISH);
+      inflateEnd(&zs);
+      return res == Z_STREAM_END && zs.total_out == c.dstSize;
+    });
+  }
+
+  // one stream (possibly several concatenated members): inflate serially
+  z_stream zs{};
+  if (inflateInit2(&zs, 15 + 32) != Z_OK)
+    return false;
+  zs.next_in = const_cast<Bytef *>(file.data);
+  zs.avail_in = uInt(std::min<size_t>(file.size, UINT32_MAX));
+  size_t consumed = 0;
+  const bool ok = decodeStream(window, progress, [&](uint8_t *out, size_t n) -> long {
+    zs.next_out = out;
+    zs.avail_out = uInt(n);
+    while (zs.avail_out > 0) {
+      if (zs.avail_in == 0) {
+        consumed = size_t(zs.next_in - file.data);
+        if (consumed >= file.size)
+          break;
+        zs.avail_in = uInt(std::min<size_t>(file.size - consumed, UINT32_MAX));
+      }
+      const int res = inflate(&zs, Z_NO_FLUSH);
+      if (res == Z_STREAM_END) {
+        if (zs.avail_in == 0 && size_t(zs.next_in - file.data) >= file.size)
+          break;
+        inflateReset(&zs); // next member
+      } else if (res != Z_OK) {
+        return -1;
+      }
+    }
+    return long(n - zs.avail_out);
+  });
+  inflateEnd(&zs);
+  return ok;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+bool decompressZstd(const MappedFile &file, const Window &window, DecodeProgress *progress)
+{
+  // frames with their decompressed sizes recorded can be decoded in parallel
+  std::vector<Chunk> chunks;
+  bool sized = true;
+  size_t offset = 0, decoded = 0;
+  while (offset < file.size && sized) {
+    const size_t frameSize =
+        ZSTD_findFrameCompressedSize(file.data + offset, file.size - offset);
+    if (ZSTD_isError(frameSize))
+      return false;
+    const unsigned long long contentSize =
+        ZSTD_getFrameContentSize(file.data + offset, file.size - offset);
+    if (contentSize == ZSTD_CONTENTSIZE_UNKNOWN
+        || contentSize == ZSTD_CONTENTSIZE_ERROR) {
+      sized = false;
+      break;
+    }
+    chunks.push_back({offset, frameSize, decoded, size_t(contentSize)});
+    offset += frameSize;
+    decoded += size_t(contentSize);
+  }
+
+  if (sized && chunks.size() > 1) {
+    return decodeChunks(chunks, window, progress, [&](const Chunk &c, uint8_t *out) {
+      thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> dctx(
+          ZSTD_createDCtx(), ZSTD_freeDCtx);
+      const size_t res = ZSTD_decompressDCtx(
+          dctx.get(), out, c.dstSize, file.data + c.srcOffset, c.srcSize);
+      return !ZSTD_isError(res) && res == c.dstSize;
+    });
+  }
+
+  std::unique_ptr<ZSTD_DStream, size_t (*)(ZSTD_DStream *)> stream(
+      ZSTD_createDStream(), ZSTD_freeDStream);
+  ZSTD_inBuffer in{file.data, file.size, 0};
+  return decodeStream(window, progress, [&](uint8_t *out, size_t n) -> long {
+    ZSTD_outBuffer outBuf{out, n, 0};
+    while (outBuf.pos < outBuf.size && in.pos < in.size) {
+      const size_t res = ZSTD_decompressStream(stream.get(), &outBuf, &in);
+      if (ZSTD_isError(res))
+        return -1;
+    }
+    return long(outBuf.pos);
+  });
+}
+#endif
+
+} // namespace
+
+Compression detectCompression(const char *fileName)
+{
+  FILE *f = fopen(fileName, "rb");
+  if (!f)
+    return Compression::None;
+  uint8_t magic[4] = {};
+  const size_t n = fread(magic, 1, sizeof(magic), f);
+  fclose(f);
+  if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    return Compression::Gzip;
+  if (n == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f
+      && magic[3] == 0xfd)
+    return Compression::Zstd;
+  return Compression::None;
+}
+
+bool canDecompress(Compression compression)
+{
+#ifdef HAVE_ZLIB
+  if (compression == Compression::Gzip)
+    return true;
+#endif
+#ifdef HAVE_ZSTD
+  if (compression == Compression::Zstd)
+    return true;
+#endif
+  return compression == Compression::None;
+}
+
+bool decompressFile(const char *fileName,
+    size_t skip,
+    void *dst,
+    size_t size,
+    DecodeProgress *progress)
+{
+  TRACE_SCOPE("volume", "decompress");
+  bool ok = false;
+
+  const auto compression = detectCompression(fileName);
+  MappedFile file(fileName);
+  if (!file.data) {
+    std::cerr << "cannot open file: " << fileName << '\n';
+  } else if (compression == Compression::None || !canDecompress(compression)) {
+    std::cerr << "cannot decompress file: " << fileName
+              << " (format not supported by this build)\n";
+  } else {
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+    const Window window{static_cast<uint8_t *>(dst), skip, size};
+#else
+    (void)dst;
+    (void)skip;
+    (void)size;
+#endif
+#ifdef HAVE_ZLIB
+    if (compression == Compression::Gzip)
+      ok = inflateGzip(file, window, progress);
+#endif
+#ifdef HAVE_ZSTD
+    if (compression == Compression::Zstd)
+      ok = decompressZstd(file, window, progress);
+#endif
+    if (!ok)
+      std::cerr << "error decompressing file: " << fileName << '\n';
+  }
+
+  if (progress)
+    progress->finish(ok);
+  return ok;
+}
+
+bool decompressBuffer(Compression compression,
+    const void *src,
+    size_t srcSize,
+    void *dst,
+    size_t size)
+{
+#ifdef HAVE_ZLIB
+  if (compression == Compression::Gzip) {
+    // zlib or gzip headers, detected by inflate
+    z_stream zs{};
+    if (inflateInit2(&zs, 15 + 32) != Z_OK)
+      return false;
+    zs.next_in = const_cast<Bytef *>(static_cast<const Bytef *>(src));
+    zs.avail_in = uInt(srcSize);
+    zs.next_out = static_cast<Bytef *>(dst);
+    zs.avail_out = uInt(size);
+    const int res = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    return res == Z_STREAM_END && zs.total_out == size;
+  }
+#endif
+#ifdef HAVE_ZSTD
+  if (compression == Compression::Zstd) {
+    const size_t res = ZSTD_decompress(dst, size, src, srcSize);
+    return !ZSTD_isError(res) && res == size;
+  }
+#endif
+  if (compression == Compression::None && srcSize == size) {
+    std::memcpy(dst, src, size);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,92 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+enum class Compression
+{
+  None,
+  Gzip,
+  Zstd
+};
+
+// From the file's magic bytes, not its name
+Compression detectCompression(const char *fileName);
+
+// Whether this build can decompress the format (zlib/zstd found by CMake)
+bool canDecompress(Compression compression);
+
+// Decoded prefix of a buffer being filled by decompressFile(), so consumers
+// can start on the first bytes while the rest is still being inflated
+class DecodeProgress
+{
+ public:
+  void advance(size_t readyBytes)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_ready = std::max(m_ready, readyBytes);
+    }
+    m_cv.notify_all();
+  }
+
+  void finish(bool ok)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_done = true;
+      m_ok = ok;
+    }
+    m_cv.notify_all();
+  }
+
+  // Blocks until [0, bytes) is decoded; false if decoding ended first
+  bool waitFor(size_t bytes) const
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&]() { return m_ready >= bytes || m_done; });
+    return m_ready >= bytes;
+  }
+
+  // Blocks until decoding ended; whether it succeeded
+  bool wait() const
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&]() { return m_done; });
+    return m_ok;
+  }
+
+ private:
+  mutable std::mutex m_mutex;
+  mutable std::condition_variable m_cv;
+  size_t m_ready{0};
+  bool m_done{false};
+  bool m_ok{true};
+};
+
+// Decompresses bytes [skip, skip + size) of a gzip or zstd file into dst.
+// Files made of independent chunks -- multi-frame zstd (pzstd) or BGZF
+// gzip (bgzip) -- are inflated on all cores, directly into dst;
+// single-stream files on one thread.
+// `progress`, if given, is advanced as the decoded prefix grows and
+// finished on return.
+bool decompressFile(const char *fileName,
+    size_t skip,
+    void *dst,
+    size_t size,
+    DecodeProgress *progress = nullptr);
+
+// Decompresses a whole in-memory zlib, gzip or zstd stream (e.g. a chunk of
+// a chunked volume) into dst, on the calling thread; false unless it
+// decodes to exactly `size` bytes
+bool decompressBuffer(Compression compression,
+    const void *src,
+    size_t srcSize,
+    void *dst,
+    size_t size);
@@ -0,0 +1,147 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Deformation.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// std
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+DeformationGrid DeformationGrid::over(
+    const StructuredField &field, float spacing)
+{
+  DeformationGrid grid;
+  const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+  spacing = std::max(spacing, 1e-6f);
+  for (int a = 0; a < 3; ++a) {
+    const float extent = std::abs(field.spacing[a]) * float(dims[a] - 1);
+    const float lower = std::min(field.origin[a],
+        field.origin[a] + field.spacing[a] * float(dims[a] - 1));
+    grid.dims[a] = int(std::ceil(extent / spacing)) + 3;
+    grid.origin[a] = lower - spacing;
+    grid.spacing[a] = spacing;
+  }
+  return grid;
+}
+
+size_t DeformationGrid::numPoints() const
+{
+  return size_t(std::max(dims[0], 0)) * std::max(dims[1], 0)
+      * std::max(dims[2], 0);
+}
+
+bool DeformationGrid::empty() const
+{
+  return !coefficients || numPoints() == 0;
+}
+
+void DeformationGrid::displacement(
+    const float x[3], float u[3], float *jacobian) const
+{
+  // the four control points around x per axis, from base[a], with the
+  // cubic B-spline weights and their derivatives per object-space unit
+  int base[3];
+  float w[3][4], dw[3][4];
+  u[0] = u[1] = u[2] = 0.f;
+  if (jacobian)
+    std::fill_n(jacobian, 9, 0.f);
+  for (int a = 0; a < 3; ++a) {
+    const float c = (x[a] - origin[a]) / spacing[a];
+    if (!(c > -2.f && c < float(dims[a] + 1)))
+      return; // no control point in reach (or NaN)
+    const float cell = std::floor(c);
+    const float f = c - cell, g = 1.f - f;
+    base[a] = int(cell) - 1;
+    w[a][0] = g * g * g / 6.f;
+    w[a][1] = (3.f * f * f * f - 6.f * f * f + 4.f) / 6.f;
+    w[a][2] = (-3.f * f * f * f + 3.f * f * f + 3.f * f + 1.f) / 6.f;
+    w[a][3] = f * f * f / 6.f;
+    dw[a][0] = -0.5f * g * g / spacing[a];
+    dw[a][1] = (1.5f * f * f - 2.f * f) / spacing[a];
+    dw[a][2] = (-1.5f * f * f + f + 0.5f) / spacing[a];
+    dw[a][3] = 0.5f * f * f / spacing[a];
+  }
+
+  for (int k = 0; k < 4; ++k) {
+    const int z = base[2] + k;
+    if (z < 0 || z >= dims[2])
+      continue;
+    for (int j = 0; j < 4; ++j) {
+      const int y = base[1] + j;
+      if (y < 0 || y >= dims[1])
+        continue;
+      for (int i = 0; i < 4; ++i) {
+        const int x0 = base[0] + i;
+        if (x0 < 0 || x0 >= dims[0])
+          continue;
+        const float *c = coefficients
+            + 3 * (size_t(x0) + size_t(dims[0]) * (y + size_t(dims[1]) * z));
+        const float weight = w[0][i] * w[1][j] * w[2][k];
+        for (int a = 0; a < 3; ++a)
+          u[a] += weight * c[a];
+        if (!jacobian)
+          continue;
+        const float dweight[3] = {dw[0][i] * w[1][j] * w[2][k],
+            w[0][i] * dw[1][j] * w[2][k],
+            w[0][i] * w[1][j] * dw[2][k]};
+        for (int a = 0; a < 3; ++a) {
+          for (int b = 0; b < 3; ++b)
+            jacobian[3 * a + b] += c[a] * dweight[b];
+        }
+      }
+    }
+  }
+}
+
+void DeformationGrid::maxDisplacement(float bound[3]) const
+{
+  bound[0] = bound[1] = bound[2] = 0.f;
+  if (empty())
+    return;
+  for (size_t i = 0; i < numPoints(); ++i) {
+    for (int a = 0; a < 3; ++a)
+      bound[a] = std::max(bound[a], std::abs(coefficients[i * 3 + a]));
+  }
+}
+
+bool readDeformationGrid(const std::string &file,
+    DeformationGrid &grid,
+    std::vector<float> &coefficients)
+{
+  std::ifstream in(file);
+  if (!in) {
+    std::cerr << "Could not open deformation " << file << "\n";
+    return false;
+  }
+  try {
+    const auto data = nlohmann::json::parse(in);
+    for (int a = 0; a < 3; ++a) {
+      grid.dims[a] = data.at("dims").at(a).get<int>();
+      grid.origin[a] = data.at("origin").at(a).get<float>();
+      grid.spacing[a] = data.at("spacing").at(a).get<float>();
+    }
+    coefficients = data.at("coefficients").get<std::vector<float>>();
+  } catch (const std::exception &e) {
+    std::cerr << "Could not parse deformation " << file << ": " << e.what()
+              << "\n";
+    return false;
+  }
+  for (int a = 0; a < 3; ++a) {
+    if (grid.dims[a] <= 0 || !(grid.spacing[a] > 0.f)) {
+      std::cerr << "Deformation " << file
+                << " needs positive dims and spacing\n";
+      return false;
+    }
+  }
+  if (coefficients.size() != grid.numPoints() * 3) {
+    std::cerr << "Deformation " << file << " has " << coefficients.size()
+              << " coefficients, its grid needs " << grid.numPoints() * 3
+              << "\n";
+    return false;
+  }
+  grid.coefficients = coefficients.data();
+  return true;
+}
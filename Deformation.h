@@ -0,0 +1,52 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <string>
+#include <vector>
+// ours
+#include "FieldTypes.h"
+
+// Deformation of a field for deformable 2D/3D registration, applied as the
+// host DRR (FirstHit.h) samples it rather than by resampling the volume: a
+// displacement field
+// given by cubic B-spline coefficients on a coarse control grid, control
+// point (i, j, k) at origin + (i, j, k) * spacing, three object-space floats
+// each, x fastest; coefficients beyond the grid are zero. A sample at x
+// along a ray reads the field at x + u(x), and the volume counts as empty
+// outside its grid. A candidate deformation thus only changes the few
+// thousand coefficients, never the volume.
+struct DeformationGrid
+{
+  int dims[3]{0, 0, 0};
+  float origin[3]{0.f, 0.f, 0.f};
+  float spacing[3]{1.f, 1.f, 1.f};
+  const float *coefficients{nullptr}; // numPoints() * 3, not owned
+
+  // Control points `spacing` apart over the field's bounds, with the extra
+  // point on each side a cubic B-spline needs to reach the edges
+  static DeformationGrid over(const StructuredField &field, float spacing);
+  size_t numPoints() const;
+  bool empty() const;
+
+  // u(x) at object-space point x; with `jacobian`, also du/dx (row-major,
+  // jacobian[3 * i + j] = du_i / dx_j)
+  void displacement(
+      const float x[3], float u[3], float *jacobian = nullptr) const;
+  // Bound of |u_a| anywhere: the largest |coefficient| of axis a
+  void maxDisplacement(float bound[3]) const;
+};
+
+// Reads a control grid from JSON (--deformation):
+//
+//   {"dims": [8, 8, 10], "origin": [-140, -140, -180], "spacing": [40, 40, 40],
+//    "coefficients": [ux, uy, uz, ...]}
+//
+// coefficients receives the values and grid points to them. False, with a
+// message, if the file cannot be read or the counts do not match.
+bool readDeformationGrid(const std::string &file,
+    DeformationGrid &grid,
+    std::vector<float> &coefficients);
@@ -0,0 +1,84 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <cmath>
+
+// Pinhole model of an X-ray detector: a fixed pixel grid with focal lengths
+// and principal point in pixels, the principal point measured from the top
+// left corner as in OpenCV intrinsics
+struct DetectorGeometry
+{
+  int width{0}, height{0};
+  float fx{0.f}, fy{0.f};
+  float cx{0.f}, cy{0.f};
+
+  bool valid() const
+  {
+    return width > 0 && height > 0 && fx > 0.f && fy > 0.f;
+  }
+
+  // Centered principal point
+  static DetectorGeometry fromFov(
+      int width, int height, float fovx, float fovy)
+  {
+    DetectorGeometry d;
+    d.width = width;
+    d.height = height;
+    d.fx = width / (2.f * std::tan(0.5f * fovx));
+    d.fy = height / (2.f * std::tan(0.5f * fovy));
+    d.cx = 0.5f * width;
+    d.cy = 0.5f * height;
+    return d;
+  }
+
+  // The same field of view over another pixel grid, e.g. the reference's
+  DetectorGeometry resized(int newWidth, int newHeight) const
+  {
+    DetectorGeometry d = *this;
+    const float sx = float(newWidth) / width;
+    const float sy = float(newHeight) / height;
+    d.width = newWidth;
+    d.height = newHeight;
+    d.fx *= sx;
+    d.cx *= sx;
+    d.fy *= sy;
+    d.cy *= sy;
+    return d;
+  }
+
+  // Field of view and aspect of the detector itself, as matchers are
+  // calibrated (they assume a centered principal point)
+  float fovy() const
+  {
+    return 2.f * std::atan(0.5f * height / fy);
+  }
+  float aspect() const
+  {
+    return (width / fx) / (height / fy);
+  }
+
+  // Perspective camera rendering the detector: a symmetric frustum around
+  // the principal point, large enough to hold the detector, of which the
+  // detector is the imageRegion (lower left origin). Without an offset the
+  // region is the whole image.
+  void perspective(float &fovyOut, float &aspectOut, float region[4]) const
+  {
+    // tangents from the principal point to the edges; rows run up
+    const float left = cx / fx;
+    const float right = (width - cx) / fx;
+    const float bottom = (height - cy) / fy;
+    const float top = cy / fy;
+    const float halfX = std::max(left, right);
+    const float halfY = std::max(bottom, top);
+    fovyOut = 2.f * std::atan(halfY);
+    aspectOut = halfX / halfY;
+    region[0] = 0.5f * (1.f - left / halfX);
+    region[1] = 0.5f * (1.f - bottom / halfY);
+    region[2] = 0.5f * (1.f + right / halfX);
+    region[3] = 0.5f * (1.f + top / halfY);
+  }
+};
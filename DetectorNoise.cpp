@@ -0,0 +1,390 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "DetectorNoise.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+// ours
+#include "Parallel.h"
+#include "Trace.h"
+
+namespace {
+
+uint64_t splitmix64(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// Random numbers of one pixel, a function of (seed, image, pixel) only
+struct PixelRandom
+{
+  uint64_t state;
+
+  PixelRandom(uint64_t seed, uint64_t image, uint64_t pixel)
+      : state(splitmix64(seed ^ splitmix64(image ^ splitmix64(pixel))))
+  {}
+
+  // (0, 1]
+  float uniform()
+  {
+    state = splitmix64(state);
+    return float((state >> 40) + 1) * 0x1p-24f;
+  }
+
+  float normal()
+  {
+    const float r = std::sqrt(-2.f * std::log(uniform()));
+    return r * std::cos(6.2831853f * uniform());
+  }
+
+  float poisson(float mean)
+  {
+    if (mean <= 0.f)
+      return 0.f;
+    if (mean > 64.f) // close enough to a normal distribution
+      return std::max(0.f, std::round(mean + std::sqrt(mean) * normal()));
+    // Knuth: count uniforms until their product drops below e^-mean
+    const float limit = std::exp(-mean);
+    float product = uniform();
+    int count = 0;
+    while (product > limit) {
+      product *= uniform();
+      ++count;
+    }
+    return float(count);
+  }
+};
+
+// Sigmas above this blur with three box passes instead of a kernel
+constexpr float g_boxSigma = 3.f;
+
+// Box filter of radius r along rows (running sums, clamped at the borders)
+void boxRows(std::vector<float> &plane, size_t width, size_t height, int r)
+{
+  const ptrdiff_t last = ptrdiff_t(width) - 1;
+  const float scale = 1.f / float(2 * r + 1);
+  parallelFor(
+      0,
+      height,
+      [&](size_t begin, size_t end) {
+        std::vector<float> row(width);
+        for (size_t y = begin; y < end; ++y) {
+          float *line = plane.data() + y * width;
+          std::copy_n(line, width, row.data());
+          auto at = [&](ptrdiff_t x) {
+            return row[std::clamp<ptrdiff_t>(x, 0, last)];
+          };
+          float sum = 0.f;
+          for (ptrdiff_t k = -r; k <= r; ++k)
+            sum += at(k);
+          for (ptrdiff_t x = 0; x <= last; ++x) {
+            line[x] = sum * scale;
+            sum += at(x + r + 1) - at(x - r);
+          }
+        }
+      },
+      16);
+}
+
+// The same along columns, strips of columns per thread so rows stay in
+// cache lines
+void boxColumns(std::vector<float> &plane, size_t width, size_t height, int r)
+{
+  constexpr size_t strip = 64;
+  const ptrdiff_t last = ptrdiff_t(height) - 1;
+  const float scale = 1.f / float(2 * r + 1);
+  parallelFor(
+      0,
+      (width + strip - 1) / strip,
+      [&](size_t begin, size_t end) {
+        std::vector<float> column(height * strip), sum(strip);
+        for (size_t s = begin; s < end; ++s) {
+          const size_t x0 = s * strip, n = std::min(strip, width - x0);
+          for (size_t y = 0; y < height; ++y)
+            std::copy_n(plane.data() + y * width + x0, n, &column[y * strip]);
+          auto at = [&](ptrdiff_t y) {
+            return &column[size_t(std::clamp<ptrdiff_t>(y, 0, last)) * strip];
+          };
+          std::fill(sum.begin(), sum.end(), 0.f);
+          for (ptrdiff_t k = -r; k <= r; ++k) {
+            const float *in = at(k);
+            for (size_t x = 0; x < n; ++x)
+              sum[x] += in[x];
+          }
+          for (ptrdiff_t y = 0; y <= last; ++y) {
+            float *out = plane.data() + size_t(y) * width + x0;
+            const float *add = at(y + r + 1), *sub = at(y - r);
+            for (size_t x = 0; x < n; ++x) {
+              out[x] = sum[x] * scale;
+              sum[x] += add[x] - sub[x];
+            }
+          }
+        }
+      },
+      1);
+}
+
+// Three box passes approximating a Gaussian of sigma: the widths whose
+// variances add up to sigma^2 (W. Jarosz, Fast Image Convolutions)
+void boxBlur(
+    std::vector<float> &plane, size_t width, size_t height, float sigma)
+{
+  constexpr int n = 3;
+  const float variance = 12.f * sigma * sigma;
+  int lower = int(std::floor(std::sqrt(variance / n + 1.f)));
+  if (lower % 2 == 0)
+    --lower;
+  const int m = int(std::lround(
+      (variance - n * lower * lower - 4 * n * lower - 3 * n)
+      / (-4.f * lower - 4.f)));
+  for (int i = 0; i < n; ++i) {
+    const int r = ((i < m ? lower : lower + 2) - 1) / 2;
+    boxRows(plane, width, height, r);
+    boxColumns(plane, width, height, r);
+  }
+}
+
+// Separable, clamped at the borders, on one float per pixel
+void blur(std::vector<float> &plane, size_t width, size_t height, float sigma)
+{
+  if (sigma > g_boxSigma) {
+    boxBlur(plane, width, height, sigma);
+    return;
+  }
+
+  const int radius = std::max(1, int(std::ceil(3.f * sigma)));
+  std::vector<float> kernel(2 * radius + 1);
+  float sum = 0.f;
+  for (int k = -radius; k <= radius; ++k) {
+    kernel[k + radius] = std::exp(-0.5f * float(k * k) / (sigma * sigma));
+    sum += kernel[k + radius];
+  }
+  for (auto &w : kernel)
+    w /= sum;
+
+  std::vector<float> rows(plane.size());
+  parallelFor(
+      0,
+      height,
+      [&](size_t begin, size_t end) {
+        std::vector<float> padded(width + 2 * radius);
+        for (size_t y = begin; y < end; ++y) {
+          const float *src = plane.data() + y * width;
+          for (size_t x = 0; x < padded.size(); ++x) {
+            padded[x] = src[std::clamp<ptrdiff_t>(
+                ptrdiff_t(x) - radius, 0, ptrdiff_t(width) - 1)];
+          }
+          float *out = rows.data() + y * width;
+          std::fill(out, out + width, 0.f);
+          for (int k = 0; k <= 2 * radius; ++k) {
+            const float w = kernel[k];
+            const float *in = padded.data() + k;
+            for (size_t x = 0; x < width; ++x)
+              out[x] += w * in[x];
+          }
+        }
+      },
+      16);
+
+  parallelFor(
+      0,
+      height,
+      [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+          float *out = plane.data() + y * width;
+          std::fill(out, out + width, 0.f);
+          for (int k = -radius; k <= radius; ++k) {
+            const size_t sy = size_t(std::clamp<ptrdiff_t>(
+                ptrdiff_t(y) + k, 0, ptrdiff_t(height) - 1));
+            const float w = kernel[k + radius];
+            const float *in = rows.data() + sy * width;
+            for (size_t x = 0; x < width; ++x)
+              out[x] += w * in[x];
+          }
+        }
+      },
+      16);
+}
+
+} // namespace
+
+bool DetectorSettings::enabled() const
+{
+  return !scatter.empty() || blurSigma > 0.f || photons > 0.f
+      || readNoise > 0.f;
+}
+
+bool DetectorSettings::parse(const std::string &text, DetectorSettings &settings)
+{
+  DetectorSettings result;
+  std::stringstream list(text);
+  std::string model;
+  while (std::getline(list, model, ',')) {
+    std::vector<std::string> fields;
+    std::stringstream parts(model);
+    std::string field;
+    while (std::getline(parts, field, ':'))
+      fields.push_back(field);
+    if (fields.size() < 2)
+      return false;
+    std::vector<double> v;
+    for (size_t i = 1; i < fields.size(); ++i) {
+      char *end = nullptr;
+      v.push_back(std::strtod(fields[i].c_str(), &end));
+      if (end == fields[i].c_str() || *end != '\0' || v.back() < 0.0)
+        return false;
+    }
+    const std::string &name = fields[0];
+    if (name == "scatter" && v.size() == 2) {
+      if (v[0] > 0.0 && v[1] > 0.0)
+        result.scatter.push_back({float(v[0]), float(v[1])});
+    } else if (name == "blur" && v.size() == 1) {
+      result.blurSigma = float(v[0]);
+    } else if (name == "poisson" && v.size() == 1) {
+      result.photons = float(v[0]);
+    } else if (name == "gauss" && v.size() == 1) {
+      result.readNoise = float(v[0]);
+    } else if (name == "seed" && v.size() == 1) {
+      result.seed = uint64_t(v[0]);
+    } else {
+      return false;
+    }
+  }
+  float total = 0.f;
+  for (auto &g : result.scatter)
+    total += g.fraction;
+  if (total > 1.f) {
+    for (auto &g : result.scatter)
+      g.fraction /= total;
+  }
+  settings = result;
+  return true;
+}
+
+void simulateDetector(float *values,
+    int width,
+    int height,
+    const DetectorSettings &settings,
+    uint64_t image)
+{
+  TRACE_SCOPE("batch", "detector");
+  const size_t numPixels = size_t(std::max(width, 0)) * std::max(height, 0);
+  if (numPixels == 0 || !settings.enabled())
+    return;
+
+  addScatter(values, width, height, settings.scatter);
+  std::vector<float> plane(values, values + numPixels);
+  if (settings.blurSigma > 0.f)
+    blur(plane, width, height, settings.blurSigma);
+
+  parallelFor(0, numPixels, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      float v = std::max(plane[i], 0.f);
+      if (settings.photons > 0.f || settings.readNoise > 0.f) {
+        PixelRandom random(settings.seed, image, i);
+        if (settings.photons > 0.f)
+          v = random.poisson(v * settings.photons) / settings.photons;
+        if (settings.readNoise > 0.f)
+          v += settings.readNoise * random.normal();
+      }
+      values[i] = std::max(v, 0.f);
+    }
+  });
+}
+
+void addScatter(float *values,
+    int width,
+    int height,
+    const std::vector<ScatterGaussian> &scatter)
+{
+  const size_t numPixels = size_t(std::max(width, 0)) * std::max(height, 0);
+  if (numPixels == 0 || scatter.empty())
+    return;
+
+  TRACE_SCOPE("batch", "scatter");
+  // every Gaussian spreads its fraction of the primary intensity
+  const std::vector<float> primary(values, values + numPixels);
+  float kept = 1.f;
+  std::vector<float> spread(numPixels, 0.f), plane;
+  for (const auto &g : scatter) {
+    if (g.fraction <= 0.f || g.sigma <= 0.f)
+      continue;
+    plane = primary;
+    blur(plane, width, height, g.sigma);
+    for (size_t i = 0; i < numPixels; ++i)
+      spread[i] += g.fraction * plane[i];
+    kept -= g.fraction;
+  }
+  kept = std::max(kept, 0.f);
+  for (size_t i = 0; i < numPixels; ++i)
+    values[i] = kept * primary[i] + spread[i];
+}
+
+std::vector<ScatterGaussian> ScatterTable::at(float keV) const
+{
+  if (energies.empty())
+    return {};
+  const auto upper = std::lower_bound(energies.begin(), energies.end(), keV);
+  if (upper == energies.begin())
+    return kernels.front();
+  if (upper == energies.end())
+    return kernels.back();
+  const size_t i = size_t(upper - energies.begin());
+  const float t = (keV - energies[i - 1]) / (energies[i] - energies[i - 1]);
+  const auto &a = kernels[i - 1], &b = kernels[i];
+  auto result = t < 0.5f ? a : b;
+  for (size_t k = 0; k < std::min(a.size(), b.size()); ++k) {
+    result[k].fraction = a[k].fraction + t * (b[k].fraction - a[k].fraction);
+    result[k].sigma = a[k].sigma + t * (b[k].sigma - a[k].sigma);
+  }
+  return result;
+}
+
+bool ScatterTable::read(const std::string &fileName, ScatterTable &table)
+{
+  std::ifstream in(fileName);
+  if (!in) {
+    std::cerr << "Could not read scatter table " << fileName << "\n";
+    return false;
+  }
+  ScatterTable result;
+  std::string line;
+  for (int number = 1; std::getline(in, line); ++number) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    float keV = 0.f;
+    if (!(fields >> keV))
+      continue; // blank or comment
+    std::vector<float> v;
+    for (float x = 0.f; fields >> x;)
+      v.push_back(x);
+    std::vector<ScatterGaussian> kernel;
+    for (size_t k = 0; k + 1 < v.size(); k += 2)
+      kernel.push_back({v[k], v[k + 1]});
+    const bool ascending =
+        result.energies.empty() || keV > result.energies.back();
+    if (!fields.eof() || v.empty() || v.size() % 2 || !ascending) {
+      std::cerr << fileName << ":" << number
+                << ": expected <keV> <fraction> <sigma> [...], energies "
+                   "ascending\n";
+      return false;
+    }
+    result.energies.push_back(keV);
+    result.kernels.push_back(std::move(kernel));
+  }
+  if (result.empty()) {
+    std::cerr << "Scatter table " << fileName << " has no kernels\n";
+    return false;
+  }
+  table = std::move(result);
+  return true;
+}
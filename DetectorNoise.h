@@ -0,0 +1,88 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Detector simulation for synthetic training DRRs ///////////////////////////
+//
+// Applied to the linear intensity of a rendered DRR (1: the unattenuated
+// beam), in this order: scatter, the detector's point spread, quantum
+// (Poisson) noise and electronic (Gaussian) read noise. The random numbers
+// are hashed from (seed, image, pixel) rather than drawn from a stream, so
+// an image comes out the same whichever thread, device or batch order
+// renders it.
+//
+// Scatter is approximated by convolving the intensity with a kernel of a
+// few Gaussians (a narrow and a wide one, say), each spreading its fraction
+// of the intensity; wide Gaussians run as three box passes, so the cost
+// does not grow with sigma. A fraction of Monte Carlo scatter's cost for
+// DRRs closer to real radiographs.
+
+// One Gaussian of a scatter kernel
+struct ScatterGaussian
+{
+  float fraction{0.f}; // of the intensity
+  float sigma{0.f}; // pixels
+};
+
+struct DetectorSettings
+{
+  // the Gaussians of the scatter kernel; their fractions add up to the
+  // scatter-to-total ratio (at most 1)
+  std::vector<ScatterGaussian> scatter;
+  float blurSigma{0.f}; // point spread, pixels
+  float photons{0.f}; // per pixel of the unattenuated beam; 0: no noise
+  float readNoise{0.f}; // sigma, in intensity
+  uint64_t seed{0};
+
+  bool enabled() const;
+
+  // Comma-separated models: "scatter:<fraction>:<sigma>" (once per
+  // Gaussian of the kernel), "blur:<sigma>", "poisson:<photons>",
+  // "gauss:<sigma>" and "seed:<n>". False, leaving the settings untouched,
+  // on anything else.
+  static bool parse(const std::string &text, DetectorSettings &settings);
+};
+
+// width * height intensities, rows in any order, changed in place; `image`
+// tells the images of one seed apart (the pose index in batches)
+void simulateDetector(float *values,
+    int width,
+    int height,
+    const DetectorSettings &settings,
+    uint64_t image);
+
+// Only the scatter of simulateDetector(), on width * height intensities
+void addScatter(float *values,
+    int width,
+    int height,
+    const std::vector<ScatterGaussian> &scatter);
+
+// Scatter kernels by photon energy, as the kernels of a scanner are fitted
+// to Monte Carlo or measured scatter: text lines of
+//
+//   <keV> <fraction> <sigma> [<fraction> <sigma> ...]
+//
+// one per energy, '#' starting comments
+struct ScatterTable
+{
+  std::vector<float> energies; // keV, ascending
+  std::vector<std::vector<ScatterGaussian>> kernels;
+
+  bool empty() const
+  {
+    return energies.empty();
+  }
+
+  // The kernel at keV, interpolated between the rows around it (Gaussian by
+  // Gaussian, where both rows have it) and clamped to the first and last
+  std::vector<ScatterGaussian> at(float keV) const;
+
+  // False, with a message, on unreadable files and malformed lines
+  static bool read(const std::string &fileName, ScatterTable &table);
+};
@@ -0,0 +1,65 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "DeviceArbiter.h"
+// std
+#include <algorithm>
+
+DeviceArbiter::DeviceArbiter(std::chrono::milliseconds grace) : m_grace(grace)
+{}
+
+void DeviceArbiter::setInteractive(bool busy)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (busy == m_busy)
+    return;
+  m_busy = busy;
+  // the grace period starts when the last interactive frame is done
+  m_lastBusy = Clock::now();
+  if (!busy)
+    m_idle.notify_all();
+}
+
+bool DeviceArbiter::interactive() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return interactive(Clock::now());
+}
+
+bool DeviceArbiter::waitTurn(const CancelToken &token)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  bool waited = false;
+  for (;;) {
+    if (token.cancelled())
+      return false;
+    const auto now = Clock::now();
+    if (!interactive(now))
+      break;
+    waited = true;
+    // woken when the viewport goes idle, then the grace period is slept
+    // off; in steps, so cancellation is noticed
+    auto until = now + std::chrono::milliseconds(20);
+    if (!m_busy)
+      until = std::min(until, m_lastBusy + m_grace);
+    m_idle.wait_until(lock, until);
+  }
+  if (waited)
+    m_yields.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void DeviceArbiter::yielded()
+{
+  m_yields.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t DeviceArbiter::yields() const
+{
+  return m_yields.load(std::memory_order_relaxed);
+}
+
+bool DeviceArbiter::interactive(Clock::time_point now) const
+{
+  return m_busy || now - m_lastBusy < m_grace;
+}
@@ -0,0 +1,55 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+// ours
+#include "TaskScheduler.h"
+
+// Priorities on one ANARI device: the viewport's frames over batch work
+// sharing the device with them (DRRs rendered ahead, comparison grid
+// cells). A device runs the frames it was given in order, so a frame the
+// user waits for would queue behind a long batch render; batch work is
+// therefore cut into small pieces (strips, cells) and asks for its turn
+// before each one. Interactive frames take the device at the next piece's
+// boundary, and batch work stays off for a grace period after the last of
+// them, so the frames of a drag don't alternate with batch pieces.
+class DeviceArbiter
+{
+ public:
+  explicit DeviceArbiter(
+      std::chrono::milliseconds grace = std::chrono::milliseconds(150));
+
+  // UI thread, whenever the viewport's state changes: frames rendering or
+  // queued, or the user interacting
+  void setInteractive(bool busy);
+  // Busy, or within the grace period since
+  bool interactive() const;
+
+  // Batch work, before each piece: waits until not interactive(); false,
+  // at once, if token is cancelled meanwhile
+  bool waitTurn(const CancelToken &token);
+  // A piece left for later without waiting (the UI thread's batch work)
+  void yielded();
+
+  // Times batch work waited or left a piece for later
+  uint64_t yields() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  bool interactive(Clock::time_point now) const; // m_mutex held
+
+  const std::chrono::milliseconds m_grace;
+  mutable std::mutex m_mutex;
+  std::condition_variable m_idle;
+  bool m_busy{false};
+  Clock::time_point m_lastBusy{};
+  std::atomic<uint64_t> m_yields{0};
+};
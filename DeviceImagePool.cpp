@@ -0,0 +1,145 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "DeviceImagePool.h"
+// std
+#include <cstdio>
+#include <cstring>
+// ours
+#include "Trace.h"
+
+#ifdef HAVE_CUDA
+static size_t rowBytes(const matcher_image_view &view)
+{
+  return view.width * matcher_pixel_size(view.pixel_type);
+}
+#endif
+
+DeviceImagePool::DeviceImagePool(size_t budgetBytes) : m_images(budgetBytes)
+{}
+
+DeviceImagePool::~DeviceImagePool() = default;
+
+bool DeviceImagePool::available()
+{
+#ifdef HAVE_CUDA
+  static const bool hasDevice = [] {
+    int count = 0;
+    if (cudaGetDeviceCount(&count) != cudaSuccess) {
+      cudaGetLastError();
+      return false;
+    }
+    return count > 0;
+  }();
+  return hasDevice;
+#else
+  return false;
+#endif
+}
+
+std::shared_ptr<const void> DeviceImagePool::acquire(const std::string &key,
+    const matcher_image_view &host,
+    matcher_image_view &device)
+{
+  if (!available() || host.memory_space != MATCHER_MEMORY_HOST || !host.data)
+    return nullptr;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!key.empty()) {
+    if (auto *entry = m_images.get(key)) {
+      device = entry->view;
+      device.flags = host.flags;
+      return entry->memory;
+    }
+  }
+  auto memory = upload(host, device);
+  if (memory && !key.empty())
+    m_images.put(key, {memory, device}, device.row_stride * device.height);
+  return memory;
+}
+
+std::shared_ptr<const void> DeviceImagePool::upload(
+    const matcher_image_view &host, matcher_image_view &device)
+{
+#ifdef HAVE_CUDA
+  TRACE_SCOPE("matcher", "upload reference");
+  const size_t bytesPerRow = rowBytes(host);
+  void *data = nullptr;
+  size_t pitch = 0;
+  if (cudaMallocPitch(&data, &pitch, bytesPerRow, host.height) != cudaSuccess) {
+    cudaGetLastError();
+    fprintf(stderr,
+        "Could not allocate %zu x %zu reference image on the device\n",
+        host.width,
+        host.height);
+    return nullptr;
+  }
+  std::shared_ptr<const void> memory(
+      data, [](const void *p) { cudaFree(const_cast<void *>(p)); });
+
+  // staged through pinned memory, so the copy is a DMA transfer rather
+  // than one the driver stages through a buffer of its own
+  m_staging.resize(bytesPerRow * host.height);
+  for (size_t y = 0; y < host.height; ++y) {
+    std::memcpy(m_staging.data() + y * bytesPerRow,
+        static_cast<const uint8_t *>(host.data) + y * host.row_stride,
+        bytesPerRow);
+  }
+  if (cudaMemcpy2D(data,
+          pitch,
+          m_staging.data(),
+          bytesPerRow,
+          bytesPerRow,
+          host.height,
+          cudaMemcpyHostToDevice)
+      != cudaSuccess) {
+    cudaGetLastError();
+    fprintf(stderr, "Could not upload reference image to the device\n");
+    return nullptr;
+  }
+  ++m_numUploads;
+
+  int ordinal = 0;
+  cudaGetDevice(&ordinal);
+  device = host;
+  device.data = data;
+  device.row_stride = pitch;
+  device.memory_space = MATCHER_MEMORY_CUDA;
+  device.device = ordinal;
+  return memory;
+#else
+  (void)host;
+  (void)device;
+  return nullptr;
+#endif
+}
+
+void DeviceImagePool::setBudget(size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_images.setBudget(bytes);
+}
+
+void DeviceImagePool::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_images.clear();
+}
+
+size_t DeviceImagePool::bytes() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_images.bytes();
+}
+
+size_t DeviceImagePool::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_images.size();
+}
+
+size_t DeviceImagePool::numUploads() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_numUploads;
+}
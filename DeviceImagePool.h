@@ -0,0 +1,66 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+// ours
+#include "LruCache.h"
+#include "MatcherABI.h"
+#include "PinnedMemory.h"
+
+// Reference images in device memory for matchers that take it
+// (MATCHER_CAP_DEVICE_MEMORY): each image is uploaded once, through a pinned
+// staging buffer, and kept under a byte budget, so selecting it again or
+// matching a batch against many references does not upload it again. The
+// memory of an image lives as long as the pool or a holder of its handle
+// keeps it, so matchers can retain the view after the pool evicted it.
+// Without CUDA (HAVE_CUDA) nothing is uploaded and references stay on the
+// host.
+class DeviceImagePool
+{
+ public:
+  explicit DeviceImagePool(size_t budgetBytes = 256ull << 20);
+  ~DeviceImagePool();
+
+  DeviceImagePool(const DeviceImagePool &) = delete;
+  DeviceImagePool &operator=(const DeviceImagePool &) = delete;
+
+  // Whether uploads are possible: a CUDA build with a device
+  static bool available();
+
+  // Device copy of the host view, uploaded on the first call for key (an
+  // empty key uploads without keeping the copy in the pool). Fills `device`
+  // with a CUDA view keeping the host view's flags; nullptr, leaving device
+  // untouched, if the image could not be uploaded.
+  std::shared_ptr<const void> acquire(const std::string &key,
+      const matcher_image_view &host,
+      matcher_image_view &device);
+
+  void setBudget(size_t bytes);
+  // Drops every image; holders keep theirs
+  void clear();
+  size_t bytes() const;
+  size_t size() const;
+  // Host-to-device copies made, for reports
+  size_t numUploads() const;
+
+ private:
+  struct Entry
+  {
+    std::shared_ptr<const void> memory;
+    matcher_image_view view;
+  };
+
+  std::shared_ptr<const void> upload(
+      const matcher_image_view &host, matcher_image_view &device);
+
+  LruCache<std::string, Entry> m_images;
+  PinnedVector<uint8_t> m_staging;
+  size_t m_numUploads{0};
+  mutable std::mutex m_mutex;
+};
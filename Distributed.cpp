@@ -0,0 +1,947 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Distributed.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// posix
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <tuple>
+// stb_image
+#include "stb_image_write.h"
+// ours
+#include "ServerMetrics.h"
+#include "SocketIO.h"
+
+enum class MessageType : uint32_t
+{
+  Settings = 1,
+  RequestJobs = 2,
+  Jobs = 3,
+  Done = 4,
+  Result = 5,
+  RenderBatch = 6,
+  RenderResult = 7,
+  BatchDone = 8,
+  Shutdown = 9
+};
+
+struct MessageHeader
+{
+  MessageType type;
+  uint32_t reserved{0};
+  uint64_t size{0}; // payload bytes following the header
+};
+
+static bool sendMessage(
+    int socket, MessageType type, const void *payload = nullptr, size_t size = 0)
+{
+  MessageHeader header{type, 0, size};
+  return sendAll(socket, &header, sizeof(header))
+      && (size == 0 || sendAll(socket, payload, size));
+}
+
+// Connected TCP socket with TCP_NODELAY, -1 on failure
+static int connectTo(const std::string &host, int port)
+{
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo *result = nullptr;
+  const auto service = std::to_string(port);
+  if (getaddrinfo(host.c_str(), service.c_str(), &hints, &result) != 0) {
+    std::cerr << "Could not resolve " << host << "\n";
+    return -1;
+  }
+
+  int socket = -1;
+  for (auto *ai = result; ai; ai = ai->ai_next) {
+    int s = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (s < 0)
+      continue;
+    if (::connect(s, ai->ai_addr, ai->ai_addrlen) == 0) {
+      socket = s;
+      break;
+    }
+    close(s);
+  }
+  freeaddrinfo(result);
+
+  if (socket < 0) {
+    std::cerr << "Could not connect to " << host << ":" << port << "\n";
+    return -1;
+  }
+
+  int noDelay = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  return socket;
+}
+
+// Listening socket on all interfaces, -1 on failure
+static int listenOn(int port)
+{
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0) {
+    perror("socket");
+    return -1;
+  }
+  int yes = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0
+      || listen(listener, 64) < 0) {
+    perror("bind/listen");
+    close(listener);
+    return -1;
+  }
+  return listener;
+}
+
+static bool recvMessage(int socket,
+    MessageType &type,
+    std::vector<uint8_t> &payload,
+    uint64_t maxSize = UINT64_MAX)
+{
+  MessageHeader header;
+  if (!recvAll(socket, &header, sizeof(header)) || header.size > maxSize)
+    return false;
+  type = header.type;
+  payload.resize(header.size);
+  return header.size == 0 || recvAll(socket, payload.data(), header.size);
+}
+
+prediction SweepJob::toPrediction() const
+{
+  return prediction("",
+      eye[0],
+      eye[1],
+      eye[2],
+      center[0],
+      center[1],
+      center[2],
+      up[0],
+      up[1],
+      up[2]);
+}
+
+prediction RenderPose::toPrediction() const
+{
+  return prediction("",
+      eye[0],
+      eye[1],
+      eye[2],
+      center[0],
+      center[1],
+      center[2],
+      up[0],
+      up[1],
+      up[2]);
+}
+
+std::vector<SweepJob> makeSweepJobs(const std::vector<prediction> &poses,
+    const std::vector<uint32_t> &luts,
+    const std::vector<float> &photonEnergies)
+{
+  const std::vector<uint32_t> lutList =
+      luts.empty() ? std::vector<uint32_t>{0} : luts;
+  const std::vector<float> energyList =
+      photonEnergies.empty() ? std::vector<float>{0.f} : photonEnergies;
+
+  std::vector<SweepJob> jobs;
+  jobs.reserve(poses.size() * lutList.size() * energyList.size());
+  for (uint32_t lut : lutList) {
+    for (float energy : energyList) {
+      for (size_t p = 0; p < poses.size(); ++p) {
+        SweepJob job;
+        job.index = jobs.size();
+        job.pose = uint32_t(p);
+        job.lut = lut;
+        job.photonEnergy = energy;
+        const auto &pose = poses[p];
+        std::memcpy(job.eye, &pose.eye, sizeof(job.eye));
+        std::memcpy(job.center, &pose.center, sizeof(job.center));
+        std::memcpy(job.up, &pose.up, sizeof(job.up));
+        jobs.push_back(job);
+      }
+    }
+  }
+  return jobs;
+}
+
+std::vector<uint8_t> encodePng(
+    const std::vector<uint8_t> &rgba, int width, int height)
+{
+  std::vector<uint8_t> png;
+  stbi_write_png_to_func(
+      [](void *context, void *data, int size) {
+        auto *out = static_cast<std::vector<uint8_t> *>(context);
+        auto *bytes = static_cast<const uint8_t *>(data);
+        out->insert(out->end(), bytes, bytes + size);
+      },
+      &png,
+      width,
+      height,
+      4,
+      rgba.data(),
+      4 * width);
+  return png;
+}
+
+// Coordinator ////////////////////////////////////////////////////////////////
+
+// Largest PNG encodePng() makes of an RGBA8 image: the filtered rows, at up
+// to 9 bits per byte under stb's fixed Huffman codes, plus chunk headers
+static uint64_t pngBound(uint64_t width, uint64_t height)
+{
+  const uint64_t raw = height * (width * 4 + 1);
+  return raw + raw / 4 + 4096;
+}
+
+namespace {
+
+// A worker renders one job between messages; one silent for longer is
+// taken to hang, and its connection is dropped
+constexpr time_t WorkerTimeoutSeconds = 60;
+
+struct CoordinatorState
+{
+  std::mutex mutex;
+  std::deque<size_t> pending; // job ids not handed out (or handed back)
+  std::vector<bool> finished;
+  std::atomic<size_t> numFinished{0};
+  std::atomic<bool> failed{false};
+};
+
+} // namespace
+
+static void serveWorker(int socket,
+    const std::string &outputDir,
+    const SweepSettings &settings,
+    const std::vector<SweepJob> &jobs,
+    size_t chunkSize,
+    CoordinatorState &state)
+{
+  std::set<size_t> inFlight;
+
+  auto handBack = [&]() {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (size_t id : inFlight) {
+      if (!state.finished[id])
+        state.pending.push_front(id);
+    }
+    inFlight.clear();
+  };
+
+  if (!sendMessage(socket, MessageType::Settings, &settings, sizeof(settings))) {
+    close(socket);
+    return;
+  }
+
+  // a result is the job id and its PNG; anything larger is a broken or
+  // hostile worker, dropped before the payload is allocated
+  const uint64_t maxResultBytes =
+      sizeof(uint64_t) + pngBound(settings.width, settings.height);
+  MessageType type;
+  std::vector<uint8_t> payload;
+  while (recvMessage(socket, type, payload, maxResultBytes)) {
+    if (type == MessageType::RequestJobs) {
+      std::vector<SweepJob> chunk;
+      bool done = false;
+      {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        while (chunk.size() < chunkSize && !state.pending.empty()) {
+          size_t id = state.pending.front();
+          state.pending.pop_front();
+          inFlight.insert(id);
+          chunk.push_back(jobs[id]);
+        }
+        done = chunk.empty() && state.numFinished == jobs.size();
+      }
+      bool sent = done ? sendMessage(socket, MessageType::Done)
+                       : sendMessage(socket,
+                           MessageType::Jobs,
+                           chunk.data(),
+                           chunk.size() * sizeof(SweepJob));
+      if (!sent || done)
+        break;
+    } else if (type == MessageType::Result && payload.size() >= 8) {
+      uint64_t id = 0;
+      std::memcpy(&id, payload.data(), sizeof(id));
+      if (id >= jobs.size() || !inFlight.count(id))
+        continue;
+
+      char name[32];
+      snprintf(name, sizeof(name), "drr_%06llu.png", (unsigned long long)id);
+      const auto file = std::filesystem::path(outputDir) / name;
+      std::ofstream out(file, std::ios::binary);
+      out.write(reinterpret_cast<const char *>(payload.data() + 8),
+          payload.size() - 8);
+      if (!out) {
+        std::cerr << "Could not write " << file << "\n";
+        state.failed = true;
+        break;
+      }
+
+      inFlight.erase(id);
+      std::lock_guard<std::mutex> lock(state.mutex);
+      if (!state.finished[id]) {
+        state.finished[id] = true;
+        size_t n = ++state.numFinished;
+        std::cout << "\rreceived " << n << "/" << jobs.size() << std::flush;
+      }
+    }
+  }
+
+  // a worker that went away returns its unfinished jobs to the queue
+  handBack();
+  close(socket);
+}
+
+bool runSweepCoordinator(int port,
+    const std::string &outputDir,
+    const SweepSettings &settings,
+    const std::vector<SweepJob> &jobs,
+    const std::vector<prediction> &poses,
+    size_t chunkSize)
+{
+  std::error_code ec;
+  std::filesystem::create_directories(outputDir, ec);
+  if (ec) {
+    std::cerr << "Could not create " << outputDir << ": " << ec.message()
+              << "\n";
+    return false;
+  }
+
+  int listener = listenOn(port);
+  if (listener < 0)
+    return false;
+
+  CoordinatorState state;
+  state.finished.resize(jobs.size(), false);
+  for (size_t i = 0; i < jobs.size(); ++i)
+    state.pending.push_back(i);
+
+  std::cout << "Coordinator listening on port " << port << " with "
+            << jobs.size() << " jobs\n";
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  while (state.numFinished < jobs.size() && !state.failed) {
+    pollfd pfd{listener, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0)
+      continue;
+    int socket = accept(listener, nullptr, nullptr);
+    if (socket < 0)
+      continue;
+    int noDelay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    timeval timeout{WorkerTimeoutSeconds, 0};
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    workers.emplace_back(serveWorker,
+        socket,
+        std::cref(outputDir),
+        std::cref(settings),
+        std::cref(jobs),
+        chunkSize,
+        std::ref(state));
+  }
+  close(listener);
+
+  // connected workers pick up their Done on the next request
+  for (auto &w : workers)
+    w.join();
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "\n";
+
+  if (state.failed)
+    return false;
+
+  float seconds = std::chrono::duration<float>(end - start).count();
+  std::cout << "Sweep of " << jobs.size() << " jobs finished in " << seconds
+            << "s\n";
+
+  auto toJson = [](const float v[3]) {
+    return nlohmann::json{{"x", v[0]}, {"y", v[1]}, {"z", v[2]}};
+  };
+
+  nlohmann::json manifest;
+  manifest["width"] = settings.width;
+  manifest["height"] = settings.height;
+  manifest["fov_y_rad"] = settings.fovy;
+  manifest["renders"] = nlohmann::json::array();
+  for (const auto &job : jobs) {
+    char name[32];
+    snprintf(
+        name, sizeof(name), "drr_%06llu.png", (unsigned long long)job.index);
+    nlohmann::json entry;
+    entry["image"] = name;
+    entry["pose"] = job.pose;
+    entry["reference"] = poses[job.pose].filename;
+    entry["lut"] = job.lut;
+    entry["photon_energy"] = job.photonEnergy;
+    entry["eye"] = toJson(job.eye);
+    entry["center"] = toJson(job.center);
+    entry["up"] = toJson(job.up);
+    manifest["renders"].push_back(entry);
+  }
+
+  const auto manifestFile = std::filesystem::path(outputDir) / "manifest.json";
+  std::ofstream out(manifestFile);
+  out << manifest.dump(2) << "\n";
+  if (!out) {
+    std::cerr << "Could not write " << manifestFile << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+// Render server //////////////////////////////////////////////////////////////
+
+namespace {
+
+constexpr uint64_t g_maxBatchBytes = uint64_t(64) << 20; // ~700k poses
+constexpr uint32_t g_maxImageSize = 16384;
+constexpr uint32_t g_statusBusy = 3; // RenderResultHeader::status
+
+using Clock = std::chrono::steady_clock;
+
+// A client's batch, from being queued until its last result went out
+struct ServerJob
+{
+  RenderBatchHeader header;
+  std::vector<RenderPose> poses;
+  const RenderEmitFunc *emit{nullptr}; // sends to the client
+  Clock::time_point queued; // or requeued, for its next chunk
+  size_t scheduled{0}; // poses handed to render()
+  size_t emitted{0};
+  bool failed{false}; // a send failed: the client is gone
+  bool done{false};
+};
+
+struct ServerState
+{
+  std::atomic<bool> shutdown{false};
+  std::mutex mutex;
+  std::set<int> clients; // sockets, woken up on shutdown
+
+  // the scheduler's, guarded by mutex; a job goes to the back of the queue
+  // after each chunk, so clients take turns
+  const RenderServerOptions *options{nullptr};
+  std::deque<ServerJob *> queue;
+  size_t queuedPoses{0};
+  bool stopScheduler{false};
+  std::condition_variable queueChanged;
+  std::condition_variable jobDone;
+};
+
+bool compatible(const RenderBatchHeader &a, const RenderBatchHeader &b)
+{
+  return a.width == b.width && a.height == b.height && a.flags == b.flags;
+}
+
+double seconds(Clock::duration d)
+{
+  return std::chrono::duration<double>(d).count();
+}
+
+} // namespace
+
+// Renders queued jobs on the calling thread until stopScheduler is set and
+// the queue is empty
+static void scheduleRenders(const RenderBatchFunc &render, ServerState &state)
+{
+  const auto &options = *state.options;
+  auto *metrics = options.metrics;
+  const size_t chunkPoses = std::max<size_t>(options.chunkPoses, 1);
+
+  struct Chunk
+  {
+    ServerJob *job;
+    size_t begin, end; // poses of the job
+  };
+  std::vector<Chunk> chunks;
+  std::vector<RenderPose> poses;
+  std::vector<ServerJob *> owners; // per pose
+
+  std::unique_lock<std::mutex> lock(state.mutex);
+  for (;;) {
+    state.queueChanged.wait(
+        lock, [&]() { return state.stopScheduler || !state.queue.empty(); });
+    if (state.queue.empty())
+      break;
+
+    // the oldest job's size and flags, joined by every job that has them
+    const RenderBatchHeader header = state.queue.front()->header;
+    const auto now = Clock::now();
+    chunks.clear();
+    for (auto it = state.queue.begin(); it != state.queue.end();) {
+      ServerJob *job = *it;
+      if (!compatible(job->header, header)) {
+        ++it;
+        continue;
+      }
+      const size_t begin = job->scheduled;
+      job->scheduled = std::min(job->poses.size(), begin + chunkPoses);
+      chunks.push_back({job, begin, job->scheduled});
+      state.queuedPoses -= job->scheduled - begin;
+      if (metrics)
+        metrics->observe(ServerMetrics::QueueWait, seconds(now - job->queued));
+      it = state.queue.erase(it);
+    }
+    if (metrics)
+      metrics->setQueued(state.queue.size(), state.queuedPoses);
+    lock.unlock();
+
+    // chunks starting on the same LUT and energy next to each other, so
+    // fewer poses wait for a switch
+    std::stable_sort(
+        chunks.begin(), chunks.end(), [](const Chunk &a, const Chunk &b) {
+          const auto &pa = a.job->poses[a.begin];
+          const auto &pb = b.job->poses[b.begin];
+          return std::tie(pa.lut, pa.photonEnergy)
+              < std::tie(pb.lut, pb.photonEnergy);
+        });
+    poses.clear();
+    owners.clear();
+    for (const auto &c : chunks) {
+      poses.insert(poses.end(),
+          c.job->poses.begin() + c.begin,
+          c.job->poses.begin() + c.end);
+      owners.insert(owners.end(), c.end - c.begin, c.job);
+    }
+    RenderBatchHeader combined = header;
+    combined.count = uint32_t(poses.size());
+    if (metrics)
+      metrics->combinedRender(chunks.size(), poses.size());
+
+    // results go to their clients; one that is gone doesn't stop the others
+    size_t next = 0;
+    RenderEmitFunc emit = [&](const RenderResultHeader &result,
+                              const uint8_t *color,
+                              const float *origin) {
+      if (next == owners.size())
+        return false;
+      ServerJob &job = *owners[next++];
+      ++job.emitted;
+      if (job.failed)
+        return true;
+      const auto start = Clock::now();
+      job.failed = !(*job.emit)(result, color, origin);
+      if (metrics)
+        metrics->observe(ServerMetrics::Send, seconds(Clock::now() - start));
+      return true;
+    };
+    const bool rendered = render(combined, poses, emit);
+
+    lock.lock();
+    for (const auto &c : chunks) {
+      ServerJob *job = c.job;
+      if (rendered && !job->failed && job->scheduled < job->poses.size()) {
+        job->queued = Clock::now();
+        state.queue.push_back(job);
+      } else {
+        state.queuedPoses -= job->poses.size() - job->scheduled;
+        job->done = true;
+      }
+    }
+    if (metrics)
+      metrics->setQueued(state.queue.size(), state.queuedPoses);
+    state.jobDone.notify_all();
+  }
+}
+
+// Queues the batch and waits until it was rendered, or answers it as busy;
+// false if the client is gone
+static bool serveBatch(ServerJob &job, ServerState &state)
+{
+  const auto &options = *state.options;
+  const size_t count = job.poses.size();
+  if (options.metrics)
+    options.metrics->batchReceived(count);
+
+  bool admitted = !options.admit || options.admit(job.header);
+  if (admitted) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    admitted = state.queuedPoses == 0
+        || state.queuedPoses + count <= options.maxQueuedPoses;
+    if (admitted) {
+      job.queued = Clock::now();
+      state.queue.push_back(&job);
+      state.queuedPoses += count;
+      if (options.metrics)
+        options.metrics->setQueued(state.queue.size(), state.queuedPoses);
+      state.queueChanged.notify_one();
+    }
+  }
+
+  size_t first = 0; // of the poses without a result
+  uint32_t status = g_statusBusy;
+  if (admitted) {
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.jobDone.wait(lock, [&]() { return job.done; });
+    if (job.failed)
+      return false;
+    first = job.emitted;
+    status = 1;
+  } else if (options.metrics) {
+    options.metrics->batchRejected(count);
+  }
+
+  for (size_t i = first; i < count; ++i) {
+    RenderResultHeader result;
+    result.id = job.poses[i].id;
+    result.status = status;
+    if (!(*job.emit)(result, nullptr, nullptr))
+      return false;
+  }
+  return true;
+}
+
+static void serveClient(int socket, ServerState &state)
+{
+  std::vector<uint8_t> message;
+  RenderEmitFunc emit = [&](const RenderResultHeader &header,
+                            const uint8_t *color,
+                            const float *origin) {
+    const size_t pixels = size_t(header.width) * header.height;
+    const size_t colorBytes = color ? pixels * 4 : 0;
+    const size_t originBytes = color && origin ? pixels * 3 * sizeof(float) : 0;
+    RenderResultHeader h = header;
+    h.flags = (originBytes ? g_renderWithOrigin : 0)
+        | (header.flags & g_renderLinear);
+    if (!color)
+      h.width = h.height = 0;
+    // one send per result, the header and pixels in one payload
+    message.resize(sizeof(h) + colorBytes + originBytes);
+    std::memcpy(message.data(), &h, sizeof(h));
+    if (colorBytes)
+      std::memcpy(message.data() + sizeof(h), color, colorBytes);
+    if (originBytes)
+      std::memcpy(message.data() + sizeof(h) + colorBytes, origin, originBytes);
+    return sendMessage(
+        socket, MessageType::RenderResult, message.data(), message.size());
+  };
+
+  MessageType type;
+  std::vector<uint8_t> payload;
+  while (!state.shutdown
+      && recvMessage(socket, type, payload, g_maxBatchBytes)) {
+    if (type == MessageType::Shutdown) {
+      state.shutdown = true;
+      // idle clients block in recv(); their batches in progress still finish
+      std::lock_guard<std::mutex> lock(state.mutex);
+      for (int s : state.clients) {
+        if (s != socket)
+          ::shutdown(s, SHUT_RD);
+      }
+      break;
+    }
+    if (type != MessageType::RenderBatch)
+      continue;
+
+    ServerJob job;
+    job.emit = &emit;
+    bool valid = payload.size() >= sizeof(job.header);
+    if (valid) {
+      std::memcpy(&job.header, payload.data(), sizeof(job.header));
+      const auto &header = job.header;
+      valid = payload.size() - sizeof(header)
+              == uint64_t(header.count) * sizeof(RenderPose)
+          && header.width > 0 && header.height > 0
+          && header.width <= g_maxImageSize && header.height <= g_maxImageSize;
+    }
+    if (valid) {
+      job.poses.resize(job.header.count);
+      std::memcpy(job.poses.data(),
+          payload.data() + sizeof(job.header),
+          job.poses.size() * sizeof(RenderPose));
+      if (!job.poses.empty() && !serveBatch(job, state))
+        break;
+    } else {
+      std::cerr << "Render server: malformed batch ignored\n";
+      RenderResultHeader result;
+      result.status = 2;
+      if (!emit(result, nullptr, nullptr))
+        break;
+    }
+    if (!sendMessage(socket, MessageType::BatchDone))
+      break;
+  }
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.clients.erase(socket);
+  }
+  close(socket);
+}
+
+// Answers every request on `listener` with the metrics until shutdown: a
+// scrape endpoint, not a web server
+static void serveMetrics(
+    int listener, const ServerMetrics &metrics, const ServerState &state)
+{
+  while (!state.shutdown) {
+    pollfd pfd{listener, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0)
+      continue;
+    int socket = accept(listener, nullptr, nullptr);
+    if (socket < 0)
+      continue;
+    timeval timeout{1, 0};
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // the request line and headers, up to the blank line
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos
+        && request.size() < 8192) {
+      ssize_t n = ::recv(socket, buffer, sizeof(buffer), 0);
+      if (n <= 0)
+        break;
+      request.append(buffer, n);
+    }
+    const bool found = request.rfind("GET /metrics", 0) == 0;
+    const std::string body = found ? metrics.text() : "not found\n";
+    const std::string response = std::string("HTTP/1.0 ")
+        + (found ? "200 OK\r\n" : "404 Not Found\r\n")
+        + "Content-Type: text/plain; version=0.0.4\r\n"
+        + "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        + "Connection: close\r\n\r\n" + body;
+    sendAll(socket, response.data(), response.size());
+    close(socket);
+  }
+}
+
+bool runRenderServer(int port,
+    const RenderBatchFunc &render,
+    const RenderServerOptions &options)
+{
+  int listener = listenOn(port);
+  if (listener < 0)
+    return false;
+  int metricsListener = -1;
+  if (options.metrics && options.metricsPort > 0) {
+    metricsListener = listenOn(options.metricsPort);
+    if (metricsListener < 0) {
+      close(listener);
+      return false;
+    }
+  }
+
+  std::cout << "Render server listening on port " << port << "\n";
+  if (metricsListener >= 0) {
+    std::cout << "Metrics on http://localhost:" << options.metricsPort
+              << "/metrics\n";
+  }
+
+  ServerState state;
+  state.options = &options;
+  std::thread scheduler(scheduleRenders, std::cref(render), std::ref(state));
+  std::thread metrics;
+  if (metricsListener >= 0) {
+    metrics = std::thread(serveMetrics,
+        metricsListener,
+        std::cref(*options.metrics),
+        std::cref(state));
+  }
+
+  // one thread per connection, reaped once the client went away
+  std::vector<std::future<void>> clients;
+  while (!state.shutdown) {
+    clients.erase(std::remove_if(clients.begin(),
+                      clients.end(),
+                      [](const std::future<void> &c) {
+                        return c.wait_for(std::chrono::seconds(0))
+                            == std::future_status::ready;
+                      }),
+        clients.end());
+    pollfd pfd{listener, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0)
+      continue;
+    int socket = accept(listener, nullptr, nullptr);
+    if (socket < 0)
+      continue;
+    int noDelay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.clients.insert(socket);
+    }
+    clients.push_back(std::async(
+        std::launch::async, serveClient, socket, std::ref(state)));
+  }
+  close(listener);
+
+  for (auto &c : clients)
+    c.wait();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.stopScheduler = true;
+  }
+  state.queueChanged.notify_one();
+  scheduler.join();
+  if (metrics.joinable()) {
+    metrics.join();
+    close(metricsListener);
+  }
+  std::cout << "Render server stopped\n";
+  return true;
+}
+
+// SweepWorkerConnection definitions //////////////////////////////////////////
+
+SweepWorkerConnection::~SweepWorkerConnection()
+{
+  if (m_socket >= 0)
+    close(m_socket);
+}
+
+bool SweepWorkerConnection::connect(const std::string &host, int port)
+{
+  m_socket = connectTo(host, port);
+  if (m_socket < 0)
+    return false;
+
+  MessageType type;
+  std::vector<uint8_t> payload;
+  if (!recvMessage(m_socket, type, payload) || type != MessageType::Settings
+      || payload.size() != sizeof(SweepSettings)) {
+    std::cerr << "Unexpected handshake from " << host << ":" << port << "\n";
+    return false;
+  }
+  std::memcpy(&m_settings, payload.data(), sizeof(m_settings));
+  return true;
+}
+
+const SweepSettings &SweepWorkerConnection::settings() const
+{
+  return m_settings;
+}
+
+bool SweepWorkerConnection::requestJobs(
+    std::vector<SweepJob> &jobs, bool &done)
+{
+  jobs.clear();
+  done = false;
+  if (!sendMessage(m_socket, MessageType::RequestJobs))
+    return false;
+
+  MessageType type;
+  std::vector<uint8_t> payload;
+  if (!recvMessage(m_socket, type, payload))
+    return false;
+
+  if (type == MessageType::Done) {
+    done = true;
+    return true;
+  }
+  if (type != MessageType::Jobs || payload.size() % sizeof(SweepJob) != 0)
+    return false;
+
+  jobs.resize(payload.size() / sizeof(SweepJob));
+  std::memcpy(jobs.data(), payload.data(), payload.size());
+  return true;
+}
+
+bool SweepWorkerConnection::sendResult(
+    uint64_t index, const std::vector<uint8_t> &png)
+{
+  std::vector<uint8_t> payload(sizeof(index) + png.size());
+  std::memcpy(payload.data(), &index, sizeof(index));
+  std::memcpy(payload.data() + sizeof(index), png.data(), png.size());
+  return sendMessage(
+      m_socket, MessageType::Result, payload.data(), payload.size());
+}
+
+// RenderClient definitions ///////////////////////////////////////////////////
+
+RenderClient::~RenderClient()
+{
+  if (m_socket >= 0)
+    close(m_socket);
+}
+
+bool RenderClient::connect(const std::string &host, int port)
+{
+  if (m_socket >= 0)
+    close(m_socket);
+  m_socket = connectTo(host, port);
+  return m_socket >= 0;
+}
+
+bool RenderClient::sendBatch(
+    const RenderBatchHeader &header, const std::vector<RenderPose> &poses)
+{
+  RenderBatchHeader h = header;
+  h.count = uint32_t(poses.size());
+  std::vector<uint8_t> payload(sizeof(h) + poses.size() * sizeof(RenderPose));
+  std::memcpy(payload.data(), &h, sizeof(h));
+  std::memcpy(payload.data() + sizeof(h),
+      poses.data(),
+      poses.size() * sizeof(RenderPose));
+  return m_socket >= 0
+      && sendMessage(
+          m_socket, MessageType::RenderBatch, payload.data(), payload.size());
+}
+
+bool RenderClient::receive(RenderResultHeader &header,
+    std::vector<uint8_t> &color,
+    std::vector<float> &origin,
+    bool &done)
+{
+  done = false;
+  MessageType type;
+  std::vector<uint8_t> payload;
+  if (m_socket < 0 || !recvMessage(m_socket, type, payload))
+    return false;
+  if (type == MessageType::BatchDone) {
+    done = true;
+    return true;
+  }
+  if (type != MessageType::RenderResult || payload.size() < sizeof(header))
+    return false;
+
+  std::memcpy(&header, payload.data(), sizeof(header));
+  const size_t pixels = size_t(header.width) * header.height;
+  const size_t colorBytes = pixels * 4;
+  const size_t originBytes =
+      header.flags & g_renderWithOrigin ? pixels * 3 * sizeof(float) : 0;
+  if (payload.size() != sizeof(header) + colorBytes + originBytes)
+    return false;
+  const uint8_t *pixelData = payload.data() + sizeof(header);
+  color.assign(pixelData, pixelData + colorBytes);
+  origin.resize(originBytes / sizeof(float));
+  std::memcpy(origin.data(), pixelData + colorBytes, originBytes);
+  return true;
+}
+
+void RenderClient::shutdownServer()
+{
+  if (m_socket >= 0)
+    sendMessage(m_socket, MessageType::Shutdown);
+}
@@ -0,0 +1,211 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+// ours
+#include "prediction.h"
+
+// Distributed parameter sweeps over plain TCP. A coordinator holds the job
+// list (poses x LAC LUTs x photon energies) and hands it out in chunks to
+// workers, one connection per worker device, which render with the batch
+// renderer and send back PNG-encoded images. Both ends are assumed to share
+// endianness and float layout.
+
+// Sent to every worker after it connects
+struct SweepSettings
+{
+  uint32_t width{1024};
+  uint32_t height{1024};
+  float fovy{0.7854f};
+  uint32_t numLuts{1};
+  uint32_t lut{0}; // of every job if numLuts is 1
+};
+
+struct SweepJob
+{
+  uint64_t index{0}; // output name and manifest slot
+  uint32_t pose{0};
+  uint32_t lut{0};
+  float photonEnergy{0.f};
+  float eye[3];
+  float center[3];
+  float up[3];
+
+  prediction toPrediction() const;
+};
+
+// Jobs for every combination, by LUT, then energy, then pose, so
+// consecutive jobs of one chunk mostly keep LUT and energy and are cheap to
+// switch between
+std::vector<SweepJob> makeSweepJobs(const std::vector<prediction> &poses,
+    const std::vector<uint32_t> &luts,
+    const std::vector<float> &photonEnergies);
+
+// Listens on `port` until every job has a result, writing them to
+// <outputDir>/drr_<index>.png plus manifest.json. Jobs of a worker that
+// disconnects, or sends nothing for a minute, are handed out again.
+bool runSweepCoordinator(int port,
+    const std::string &outputDir,
+    const SweepSettings &settings,
+    const std::vector<SweepJob> &jobs,
+    const std::vector<prediction> &poses,
+    size_t chunkSize = 16);
+
+class SweepWorkerConnection
+{
+ public:
+  SweepWorkerConnection() = default;
+  ~SweepWorkerConnection();
+
+  SweepWorkerConnection(const SweepWorkerConnection &) = delete;
+  SweepWorkerConnection &operator=(const SweepWorkerConnection &) = delete;
+
+  // Connects and receives the sweep settings
+  bool connect(const std::string &host, int port);
+  const SweepSettings &settings() const;
+
+  // Next chunk of jobs; an empty chunk with done == false means all jobs
+  // are out but not finished yet, so ask again later
+  bool requestJobs(std::vector<SweepJob> &jobs, bool &done);
+  bool sendResult(uint64_t index, const std::vector<uint8_t> &png);
+
+ private:
+  int m_socket{-1};
+  SweepSettings m_settings;
+};
+
+// Render server /////////////////////////////////////////////////////////////
+//
+// A long-lived process keeping volume, device and renderer resident for
+// remote clients (e.g. registration services in Python). Messages are
+// framed as in the sweeps: MessageType (uint32), reserved (uint32),
+// payload size (uint64), payload; all little endian, tightly packed.
+//
+//   client -> server  RenderBatch (6): RenderBatchHeader, then `count`
+//                     RenderPose
+//   server -> client  RenderResult (7) per pose, in order, each sent as
+//                     soon as it is read back: RenderResultHeader, then
+//                     width * height RGBA8 pixels (bottom row first), then,
+//                     if requested, width * height float32 xyz ray origins
+//   server -> client  BatchDone (8) after the batch's last result
+//   client -> server  Shutdown (9) stops the server after this client
+//
+// A client may keep its connection open for any number of batches.
+//
+// The batches of all clients queue for one render thread. Queued batches of
+// the same size and flags are rendered together, chunks of at most
+// chunkPoses poses per client in turns, so the device's frames in flight
+// stay busy across clients and a long batch doesn't hold up short ones
+// behind it. A batch the queue has no room for, or which admit() turns down
+// (e.g. for the device memory its frame size would take), is answered right
+// away with status 3 for every pose; such clients retry later.
+
+constexpr uint32_t g_renderWithOrigin = 1; // RenderBatchHeader::flags
+// color as one float32 line integral per pixel instead of RGBA8 (the same
+// size), e.g. partial integrals of slab servers (SlabRender.h)
+constexpr uint32_t g_renderLinear = 2;
+
+struct RenderBatchHeader
+{
+  uint32_t width{1024};
+  uint32_t height{1024};
+  uint32_t flags{0};
+  uint32_t count{0};
+};
+
+struct RenderPose
+{
+  uint64_t id{0}; // echoed in the result
+  float eye[3];
+  float center[3];
+  float up[3];
+  float fovy{0.f}; // radians, 0: the server's default
+  int32_t lut{-1}; // LAC LUT id, -1 keeps the current one
+  float photonEnergy{0.f}; // keV, 0 keeps the current one
+
+  prediction toPrediction() const;
+};
+
+struct RenderResultHeader
+{
+  uint64_t id{0};
+  uint32_t width{0};
+  uint32_t height{0};
+  // 0 ok, 1 render failed, 2 bad request, 3 busy (queue full or device
+  // memory), try again later
+  uint32_t status{0};
+  uint32_t flags{0}; // g_renderWithOrigin if origins follow
+};
+
+// Renders one batch; calls emit() for every pose as its image is ready, with
+// null pixels for failed poses. Returning false stops serving the client.
+using RenderEmitFunc = std::function<bool(const RenderResultHeader &header,
+    const uint8_t *color,
+    const float *origin)>;
+using RenderBatchFunc = std::function<bool(const RenderBatchHeader &header,
+    const std::vector<RenderPose> &poses,
+    const RenderEmitFunc &emit)>;
+
+class ServerMetrics;
+
+struct RenderServerOptions
+{
+  // poses queued across clients; a larger batch is only taken when nothing
+  // else is queued
+  size_t maxQueuedPoses{16384};
+  // per client and render() call
+  size_t chunkPoses{64};
+  // false answers the batch as busy; called from the client threads before
+  // the batch is queued
+  std::function<bool(const RenderBatchHeader &header)> admit;
+  // counts batches, queue waits and sends; text() is served in the
+  // Prometheus format on GET /metrics of metricsPort (0: not served)
+  ServerMetrics *metrics{nullptr};
+  int metricsPort{0};
+};
+
+// Serves clients on `port`, one thread each, until one sends Shutdown.
+// render() is called from one thread, with the poses of one or more
+// client batches of the same header (count aside).
+bool runRenderServer(int port,
+    const RenderBatchFunc &render,
+    const RenderServerOptions &options = {});
+
+// Client end of a render server, for programs combining several servers;
+// results arrive in order, batch after batch, so a client can send the next
+// batch before it has received the last one
+class RenderClient
+{
+ public:
+  RenderClient() = default;
+  ~RenderClient();
+
+  RenderClient(const RenderClient &) = delete;
+  RenderClient &operator=(const RenderClient &) = delete;
+
+  bool connect(const std::string &host, int port);
+  bool sendBatch(
+      const RenderBatchHeader &header, const std::vector<RenderPose> &poses);
+  // Next result of the oldest batch: color receives width * height * 4
+  // bytes (RGBA8, or float32 with g_renderLinear), origin width * height * 3
+  // floats if the server sent them. Sets done, and returns true, at the end
+  // of the batch instead; false when the connection fails.
+  bool receive(RenderResultHeader &header,
+      std::vector<uint8_t> &color,
+      std::vector<float> &origin,
+      bool &done);
+  // Asks the server to stop once its clients are done
+  void shutdownServer();
+
+ private:
+  int m_socket{-1};
+};
+
+std::vector<uint8_t> encodePng(
+    const std::vector<uint8_t> &rgba, int width, int height);
@@ -0,0 +1,99 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// C API of libanariDRR (BUILD_DRR_LIBRARY), for rendering DRRs in-process
+// from other languages; python/anari_drr.py wraps it with ctypes. A scene
+// holds one ANARI device with the volume resident on it and a BatchRenderer
+// over it. Poses are queued with drr_submit() and rendered through all
+// frames in flight; drr_next() hands out each finished DRR as a view of the
+// mapped frame, without a copy, valid until drr_release() (or the next
+// drr_next()). All calls on a scene must come from one thread at a time.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DRR_API_VERSION 1
+
+typedef struct drr_scene drr_scene;
+
+typedef struct drr_scene_desc
+{
+  const char *library; // ANARI library, "environment" by default
+  const char *volume_file; // RAW (.raw[.gz|.zst]), NIfTI or DICOM directory
+  int32_t dims[3]; // RAW layout; 0: sidecar header
+  uint32_t bytes_per_cell;
+  const char *lut_file; // LAC LUTs of CT volumes, LacLuts.json by default
+  uint32_t lut; // initial LUT id
+  uint32_t width, height;
+  float fovy; // radians
+  const char *renderer; // renderer subtype, "default" by default
+  uint32_t frames_in_flight;
+  uint32_t with_origin; // also map the ray-origin channel
+  int32_t gpu; // >= 0: pin the device to this GPU
+} drr_scene_desc;
+
+typedef struct drr_pose
+{
+  float eye[3];
+  float center[3];
+  float up[3];
+  float fovy; // radians, 0: the scene's
+} drr_pose;
+
+typedef enum drr_memory_space
+{
+  DRR_MEMORY_HOST = 0,
+  DRR_MEMORY_DEVICE = 1, // the device's own memory, e.g. a CUDA pointer
+} drr_memory_space;
+
+typedef enum drr_next_flags
+{
+  // map the channels as device memory where the ANARI device offers it
+  DRR_NEXT_DEVICE_POINTERS = 1u << 0,
+} drr_next_flags;
+
+typedef struct drr_image
+{
+  uint64_t index; // of the pose, counted over all drr_submit() calls
+  const uint8_t *color; // RGBA8, bottom row first
+  const float *origin; // xyz per pixel, null without with_origin
+  uint32_t width, height;
+  uint32_t color_memory; // drr_memory_space
+  uint32_t origin_memory;
+} drr_image;
+
+uint32_t drr_api_version(void);
+// Message of the last failed call on this thread
+const char *drr_last_error(void);
+
+void drr_default_desc(drr_scene_desc *desc);
+// Loads the volume and uploads it; null on failure
+drr_scene *drr_create(const drr_scene_desc *desc);
+void drr_destroy(drr_scene *scene);
+
+size_t drr_num_luts(const drr_scene *scene);
+const char *drr_lut_name(const drr_scene *scene, size_t lut);
+// LUT and photon energy (keV) apply to poses submitted later; both fail
+// while poses are still queued or mapped. Return 0 on failure.
+int drr_set_lut(drr_scene *scene, size_t lut);
+int drr_set_energy(drr_scene *scene, float photon_energy);
+
+// Queues poses; they start rendering as frames become free
+int drr_submit(drr_scene *scene, const drr_pose *poses, size_t count);
+// Waits for the oldest queued pose and maps its DRR into `image`. Returns
+// 1 with an image, 0 when the queue is empty, -1 on a failed frame (the
+// pose is dropped, image->index tells which).
+int drr_next(drr_scene *scene, drr_image *image, uint32_t flags);
+// Unmaps the image of the last drr_next() and starts the next pose in its
+// frame; drr_next() and drr_destroy() release it as well
+void drr_release(drr_scene *scene);
+
+#ifdef __cplusplus
+}
+#endif
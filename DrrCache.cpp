@@ -0,0 +1,280 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "DrrCache.h"
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+// ours
+#include "Trace.h"
+
+namespace {
+
+// rows per strip of a pose, the pieces background rendering yields between
+constexpr int g_stripRows = 256;
+
+bool same(const anari::math::float3 &a, const anari::math::float3 &b)
+{
+  return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// The frustum images were rendered with against the one they are shown in
+bool sameGeometry(const BatchRenderSettings &settings,
+    const ImageRegion &region,
+    const RayCamera &camera)
+{
+  auto near = [](float a, float b) { return std::abs(a - b) <= 1e-4f; };
+  return near(settings.fovy, camera.fovy)
+      && std::abs(region.aspect - camera.aspect) <= 1e-3f * camera.aspect
+      && near(region.lower[0], camera.region[0])
+      && near(region.lower[1], camera.region[1])
+      && near(region.upper[0], camera.region[2])
+      && near(region.upper[1], camera.region[3]);
+}
+
+} // namespace
+
+DrrCache::DrrCache(anari::Device device,
+    anari::World world,
+    TaskScheduler &tasks,
+    const std::string &renderer,
+    size_t budgetBytes,
+    DeviceArbiter *arbiter)
+    : m_device(device),
+      m_world(world),
+      m_tasks(tasks),
+      m_arbiter(arbiter),
+      m_cache(budgetBytes)
+{
+  m_settings.renderer = renderer;
+  m_settings.writeOrigin = false;
+  m_settings.framesInFlight = 2; // strips in flight, also poses per task
+}
+
+DrrCache::~DrrCache()
+{
+  m_token.cancelAndWait();
+  m_renderer.reset();
+}
+
+void DrrCache::setCamera(const RayCamera &camera)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_haveCamera && m_settings.width == int(camera.width)
+      && m_settings.height == int(camera.height)
+      && sameGeometry(m_settings, m_region, camera))
+    return;
+
+  m_settings.width = int(camera.width);
+  m_settings.height = int(camera.height);
+  m_settings.fovy = camera.fovy;
+  m_region.lower[0] = camera.region[0];
+  m_region.lower[1] = camera.region[1];
+  m_region.upper[0] = camera.region[2];
+  m_region.upper[1] = camera.region[3];
+  m_region.aspect = camera.aspect;
+  m_haveCamera = true;
+  ++m_generation;
+  m_cache.clear();
+}
+
+void DrrCache::setPhotonEnergy(float photonEnergy)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (photonEnergy == m_settings.photonEnergy)
+    return;
+  m_settings.photonEnergy = photonEnergy;
+  ++m_generation;
+  m_cache.clear();
+}
+
+void DrrCache::update(
+    const std::vector<prediction> &poses, uint64_t worldVersion, bool idle)
+{
+  if (m_job.valid()) {
+    if (m_job.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      return;
+    m_job.get();
+  }
+  if (!idle || poses.empty())
+    return;
+
+  std::vector<size_t> indices;
+  std::vector<prediction> batch;
+  BatchRenderSettings settings;
+  ImageRegion region;
+  uint32_t generation = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_haveCamera)
+      return;
+    const size_t imageBytes = size_t(m_settings.width) * m_settings.height * 4;
+    size_t bytes = m_cache.bytes();
+    // outward from the prediction asked for last: i, i + 1, i - 1, ...
+    const size_t start = std::min(m_lastIndex, poses.size() - 1);
+    for (size_t k = 0; k < 2 * poses.size()
+         && indices.size() < size_t(m_settings.framesInFlight);
+         ++k) {
+      const size_t offset = (k + 1) / 2;
+      if (k % 2 ? start + offset >= poses.size() : offset > start)
+        continue;
+      const size_t i = k % 2 ? start + offset : start - offset;
+      const auto &p = poses[i];
+      const Entry *entry = m_cache.peek(i);
+      if (entry && current(*entry, p.eye, p.center, p.up, worldVersion))
+        continue;
+      // stale images are replaced in place, new ones only while they fit
+      if (!entry) {
+        if (bytes + imageBytes > m_cache.budget())
+          continue;
+        bytes += imageBytes;
+      }
+      indices.push_back(i);
+      batch.push_back(p);
+    }
+    settings = m_settings;
+    region = m_region;
+    generation = m_generation;
+  }
+  if (indices.empty())
+    return;
+
+  m_job = m_tasks.submit(TaskPriority::Background,
+      m_token,
+      [this,
+          indices = std::move(indices),
+          batch = std::move(batch),
+          settings,
+          region,
+          worldVersion,
+          generation]() {
+        render(indices, batch, settings, region, worldVersion, generation);
+      });
+}
+
+std::shared_ptr<const Image> DrrCache::get(size_t index,
+    const anari::math::float3 &eye,
+    const anari::math::float3 &center,
+    const anari::math::float3 &up,
+    const RayCamera &camera,
+    uint64_t worldVersion)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_haveCamera || !sameGeometry(m_settings, m_region, camera))
+    return nullptr;
+  m_lastIndex = index;
+  Entry *entry = m_cache.get(index);
+  if (!entry || !current(*entry, eye, center, up, worldVersion))
+    return nullptr;
+  return entry->image;
+}
+
+size_t DrrCache::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_cache.size();
+}
+
+void DrrCache::reportMemory(MemoryReport &report) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  report.add(MemoryReport::Host,
+      "DRR cache (" + std::to_string(m_cache.size()) + " poses)",
+      m_cache.bytes());
+}
+
+bool DrrCache::current(const Entry &entry,
+    const anari::math::float3 &eye,
+    const anari::math::float3 &center,
+    const anari::math::float3 &up,
+    uint64_t worldVersion) const
+{
+  return entry.generation == m_generation
+      && entry.worldVersion == worldVersion && same(entry.eye, eye)
+      && same(entry.center, center) && same(entry.up, up);
+}
+
+void DrrCache::render(std::vector<size_t> indices,
+    std::vector<prediction> poses,
+    BatchRenderSettings settings,
+    ImageRegion region,
+    uint64_t worldVersion,
+    uint32_t generation)
+{
+  TRACE_SCOPE("drr cache", "render poses");
+  const int width = settings.width, height = settings.height;
+  const int stripRows = std::min(height, g_stripRows);
+  if (!m_renderer || m_renderer->settings().width != width
+      || m_renderer->settings().height != stripRows) {
+    BatchRenderSettings strip = settings;
+    strip.height = stripRows;
+    m_renderer.reset();
+    m_renderer = std::make_unique<BatchRenderer>(m_device, m_world, strip);
+  }
+  if (m_renderer->settings().photonEnergy != settings.photonEnergy)
+    m_renderer->setPhotonEnergy(settings.photonEnergy);
+
+  // strip s covers rows y0(s) to y0(s) + stripRows; the last one is moved
+  // back to end at the top and rewrites a few rows
+  const int numStrips = (height + stripRows - 1) / stripRows;
+  const size_t numSlots = m_renderer->numSlots();
+  auto y0 = [&](int s) { return std::min(s * stripRows, height - stripRows); };
+  const float regionHeight = region.upper[1] - region.lower[1];
+
+  const size_t n = std::min(poses.size(), numSlots);
+  for (size_t k = 0; k < n; ++k) {
+    auto submit = [&](int s) {
+      ImageRegion strip = region;
+      strip.lower[1] = region.lower[1] + regionHeight * y0(s) / height;
+      strip.upper[1] =
+          region.lower[1] + regionHeight * (y0(s) + stripRows) / height;
+      m_renderer->submit(s % numSlots, poses[k], settings.fovy, &strip);
+    };
+
+    std::vector<uint8_t> pixels(size_t(width) * height * 4);
+    const size_t rowBytes = size_t(width) * 4;
+    int submitted = 0;
+    bool failed = false;
+    for (int s = 0; s < numStrips; ++s) {
+      bool cancelled = false;
+      while (submitted < numStrips && submitted < s + int(numSlots)) {
+        if (m_arbiter && !m_arbiter->waitTurn(m_token)) {
+          cancelled = true;
+          break;
+        }
+        submit(submitted++);
+      }
+      const auto *r = cancelled ? nullptr : m_renderer->readback(s % numSlots);
+      failed = !r || r->color.empty() || r->width != width;
+      if (failed) {
+        // the slots are free for the next task once their strips are done
+        for (int t = cancelled ? s : s + 1; t < submitted; ++t)
+          m_renderer->readback(t % numSlots);
+        if (cancelled)
+          return;
+        break;
+      }
+      std::memcpy(pixels.data() + size_t(y0(s)) * rowBytes,
+          r->color.data(),
+          stripRows * rowBytes);
+    }
+    if (failed)
+      continue;
+    auto image = std::make_shared<const Image>(
+        size_t(width), size_t(height), 4, std::move(pixels));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (generation != m_generation)
+      return; // the geometry or energy changed meanwhile
+    Entry entry;
+    entry.eye = poses[k].eye;
+    entry.center = poses[k].center;
+    entry.up = poses[k].up;
+    entry.worldVersion = worldVersion;
+    entry.generation = generation;
+    entry.image = image;
+    m_cache.put(indices[k], std::move(entry), image->data.size());
+  }
+}
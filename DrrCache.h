@@ -0,0 +1,112 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// anari
+#include <anari/anari_cpp.hpp>
+// std
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+// ours
+#include "BatchRenderer.h"
+#include "DeviceArbiter.h"
+#include "FirstHit.h"
+#include "Image.h"
+#include "LruCache.h"
+#include "MemoryReport.h"
+#include "TaskScheduler.h"
+#include "prediction.h"
+
+// DRRs of the prediction poses rendered ahead of time while the viewport is
+// idle, so that loading a prediction's camera shows its DRR at once and the
+// comparison grid scales cells down from them instead of rendering. A
+// BatchRenderer on the viewer's world renders a few poses per background
+// task (TaskPriority::Background), one task at a time, starting next to the
+// prediction asked for last. Each pose is rendered in strips of full
+// width, and with an arbiter the task waits for its turn before each
+// strip, so interactive frames preempt it within a strip's render time.
+// Images are RGBA8 (bottom row first) in the viewport's frame geometry,
+// kept in an LRU cache under a byte budget; once the budget is full,
+// missing poses are no longer rendered, so a small budget doesn't evict and
+// re-render in turn. An image is only returned for the pose, world version,
+// geometry and photon energy it was rendered with.
+class DrrCache
+{
+ public:
+  DrrCache(anari::Device device,
+      anari::World world,
+      TaskScheduler &tasks,
+      const std::string &renderer,
+      size_t budgetBytes,
+      DeviceArbiter *arbiter = nullptr);
+  ~DrrCache(); // waits for the task running
+
+  DrrCache(const DrrCache &) = delete;
+  DrrCache &operator=(const DrrCache &) = delete;
+
+  // Frame geometry (fovy, aspect, region, width x height) of the images;
+  // the pose in it is ignored. A change drops all of them, as does a new
+  // photon energy (keV, 0: the renderer's default).
+  void setCamera(const RayCamera &camera);
+  void setPhotonEnergy(float photonEnergy);
+
+  // UI thread, every frame: collects the finished task and, if the viewport
+  // is idle, submits the next poses that are missing or stale
+  void update(const std::vector<prediction> &poses,
+      uint64_t worldVersion,
+      bool idle);
+
+  // The DRR of prediction `index` if it was rendered at this pose, for the
+  // given geometry (its size aside: the grid scales it) and world version
+  std::shared_ptr<const Image> get(size_t index,
+      const anari::math::float3 &eye,
+      const anari::math::float3 &center,
+      const anari::math::float3 &up,
+      const RayCamera &camera,
+      uint64_t worldVersion);
+
+  size_t size() const; // images cached
+  void reportMemory(MemoryReport &report) const;
+
+ private:
+  struct Entry
+  {
+    anari::math::float3 eye, center, up;
+    uint64_t worldVersion{0};
+    uint32_t generation{0};
+    std::shared_ptr<const Image> image;
+  };
+
+  bool current(const Entry &entry,
+      const anari::math::float3 &eye,
+      const anari::math::float3 &center,
+      const anari::math::float3 &up,
+      uint64_t worldVersion) const;
+  void render(std::vector<size_t> indices,
+      std::vector<prediction> poses,
+      BatchRenderSettings settings,
+      ImageRegion region,
+      uint64_t worldVersion,
+      uint32_t generation);
+
+  anari::Device m_device{nullptr};
+  anari::World m_world{nullptr};
+  TaskScheduler &m_tasks;
+  DeviceArbiter *m_arbiter{nullptr};
+  CancelToken m_token;
+  std::future<void> m_job;
+  std::unique_ptr<BatchRenderer> m_renderer; // the task's, created there
+
+  mutable std::mutex m_mutex;
+  LruCache<size_t, Entry> m_cache;
+  BatchRenderSettings m_settings;
+  ImageRegion m_region;
+  uint32_t m_generation{1}; // geometry and photon energy changes
+  size_t m_lastIndex{0}; // asked for last, rendering starts next to it
+  bool m_haveCamera{false};
+};
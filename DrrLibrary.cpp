@@ -0,0 +1,357 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "DrrAPI.h"
+// anari
+#include <anari/anari_cpp/ext/linalg.h>
+#include <anari/anari_cpp.hpp>
+// std
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+// ours
+#include "BatchRenderer.h"
+#include "VolumeScene.h"
+#include "readRAW.h"
+#ifdef HAVE_ITK
+#include "LacTransform.h"
+#include "readDicom.h"
+#include "readNifti.h"
+#endif
+
+namespace {
+
+thread_local std::string g_lastError;
+
+template <typename T>
+T fail(T result, std::string message)
+{
+  g_lastError = std::move(message);
+  return result;
+}
+
+void statusFunc(const void *,
+    ANARIDevice,
+    ANARIObject source,
+    ANARIDataType,
+    ANARIStatusSeverity severity,
+    ANARIStatusCode,
+    const char *message)
+{
+  // no exit on fatal errors here: the host process is not ours
+  if (severity == ANARI_SEVERITY_FATAL_ERROR)
+    fprintf(stderr, "[FATAL][%p] %s\n", source, message);
+  else if (severity == ANARI_SEVERITY_ERROR)
+    fprintf(stderr, "[ERROR][%p] %s\n", source, message);
+  else if (severity == ANARI_SEVERITY_WARNING)
+    fprintf(stderr, "[WARN ][%p] %s\n", source, message);
+}
+
+bool isRaw(const std::string &fileName)
+{
+  std::filesystem::path path(fileName);
+  if (path.extension() == ".gz" || path.extension() == ".zst")
+    path.replace_extension();
+  return path.extension() == ".raw";
+}
+
+#ifdef HAVE_ITK
+constexpr size_t g_lacSamples = 4096;
+#endif
+
+} // namespace
+
+struct drr_scene
+{
+  anari::Device device{nullptr};
+  std::unique_ptr<VolumeScene> volume;
+  std::unique_ptr<BatchRenderer> renderer;
+  RAWReader rawReader;
+#ifdef HAVE_ITK
+  NiftiReader niftiReader;
+  DicomReader dicomReader;
+  LacReader lacReader;
+  std::vector<std::string> lutNames;
+  bool isCt{false}; // densities; the LUT is the volume's transfer function
+#endif
+
+  struct Pose
+  {
+    uint64_t index;
+    prediction pose;
+    float fovy;
+  };
+  // pose index i renders in slot i % numSlots, in submission order
+  std::deque<Pose> queued; // waiting for a free frame
+  std::deque<uint64_t> inFlight; // rendering, oldest first
+  uint64_t numSubmitted{0};
+  bool mapped{false};
+  uint64_t mappedIndex{0};
+
+  ~drr_scene()
+  {
+    if (mapped)
+      renderer->unmap(mappedIndex % renderer->numSlots());
+    renderer.reset();
+    volume.reset();
+    if (device)
+      anari::release(device, device);
+  }
+
+  bool loadVolume(const drr_scene_desc &desc)
+  {
+    const std::string fileName = desc.volume_file ? desc.volume_file : "";
+    const StructuredField *field = nullptr; // owned by the reader
+    if (isRaw(fileName)) {
+      int dims[3] = {desc.dims[0], desc.dims[1], desc.dims[2]};
+      unsigned bytesPerCell = desc.bytes_per_cell;
+      RawHeader header;
+      if ((!dims[0] || !dims[1] || !dims[2] || !bytesPerCell)
+          && readRawHeader(fileName, header)) {
+        std::copy_n(header.dims, 3, dims);
+        bytesPerCell = header.bytesPerCell;
+      }
+      if (!rawReader.open(
+              fileName.c_str(), dims[0], dims[1], dims[2], bytesPerCell))
+        return fail(false, "cannot open RAW volume " + fileName);
+      field = &rawReader.getField(0);
+    }
+#ifdef HAVE_ITK
+    else {
+      const bool opened = DicomReader::isSeries(fileName)
+          ? dicomReader.open(fileName.c_str(), niftiReader)
+          : niftiReader.open(fileName.c_str());
+      if (!opened)
+        return fail(false, "cannot open volume " + fileName);
+      std::string lutFile = desc.lut_file ? desc.lut_file : "";
+      if (!lutFile.empty())
+        lacReader.setFilename(lutFile);
+      lacReader.read();
+      for (auto &name : lacReader.getNames())
+        lutNames.push_back(name.second);
+      // as with the viewer's --device-lut: densities on the device, LUT
+      // switches only replace the transfer function
+      field = &niftiReader.getDensityField(0);
+      isCt = true;
+    }
+#endif
+    if (!field || field->empty())
+      return fail(false, "cannot read volume " + fileName);
+
+    volume = std::make_unique<VolumeScene>(device);
+    volume->setField(*field, false);
+#ifdef HAVE_ITK
+    if (isCt && !setLut(desc.lut))
+      return false;
+#endif
+    return true;
+  }
+
+  bool setLut(size_t lut)
+  {
+#ifdef HAVE_ITK
+    if (!isCt || lut >= lacReader.m_lacLuts.size())
+      return fail(false, "no LUT " + std::to_string(lut));
+    lacReader.setActiveLut(lut);
+    float valueRange[2];
+    auto lac =
+        lacReader.sample(lut, g_lacSamples, valueRange[0], valueRange[1]);
+    auto v = volume->volume();
+    anari::setAndReleaseParameter(device,
+        v,
+        "opacity",
+        anari::newArray1D(device, lac.data(), lac.size()));
+    anariSetParameter(
+        device, v, "valueRange", ANARI_FLOAT32_BOX1, valueRange);
+    anari::commitParameters(device, v);
+    volume->markChanged();
+    return true;
+#else
+    return fail(false, "LUTs need a build with ITK");
+#endif
+  }
+
+  bool busy() const
+  {
+    return mapped || !queued.empty() || !inFlight.empty();
+  }
+
+  // Starts queued poses in the frames not rendering or mapped
+  void fill()
+  {
+    const size_t numSlots = renderer->numSlots();
+    while (!queued.empty() && inFlight.size() + (mapped ? 1 : 0) < numSlots) {
+      auto &p = queued.front();
+      renderer->submit(p.index % numSlots, p.pose, p.fovy);
+      inFlight.push_back(p.index);
+      queued.pop_front();
+    }
+  }
+};
+
+extern "C" {
+
+uint32_t drr_api_version(void)
+{
+  return DRR_API_VERSION;
+}
+
+const char *drr_last_error(void)
+{
+  return g_lastError.c_str();
+}
+
+void drr_default_desc(drr_scene_desc *desc)
+{
+  *desc = drr_scene_desc{};
+  desc->library = "environment";
+  desc->width = 1024;
+  desc->height = 1024;
+  desc->fovy = 0.7854f;
+  desc->renderer = "default";
+  desc->frames_in_flight = 3;
+  desc->with_origin = 1;
+  desc->gpu = -1;
+}
+
+drr_scene *drr_create(const drr_scene_desc *desc)
+{
+  if (!desc || !desc->volume_file || !desc->width || !desc->height)
+    return fail<drr_scene *>(nullptr, "incomplete scene description");
+
+  auto scene = std::make_unique<drr_scene>();
+  auto library = anariLoadLibrary(
+      desc->library ? desc->library : "environment", statusFunc, nullptr);
+  if (!library)
+    return fail<drr_scene *>(nullptr, "failed to load the ANARI library");
+  scene->device = anariNewDevice(library, "default");
+  anari::unloadLibrary(library);
+  if (!scene->device)
+    return fail<drr_scene *>(nullptr, "failed to create the ANARI device");
+  if (desc->gpu >= 0)
+    anari::setParameter(
+        scene->device, scene->device, "cudaDevice", desc->gpu);
+  anari::commitParameters(scene->device, scene->device);
+
+  if (!scene->loadVolume(*desc))
+    return nullptr;
+
+  BatchRenderSettings settings;
+  settings.width = int(desc->width);
+  settings.height = int(desc->height);
+  if (desc->fovy > 0.f)
+    settings.fovy = desc->fovy;
+  if (desc->renderer)
+    settings.renderer = desc->renderer;
+  settings.writeOrigin = desc->with_origin != 0;
+  settings.framesInFlight = int(std::max(desc->frames_in_flight, 1u));
+  scene->renderer = std::make_unique<BatchRenderer>(
+      scene->device, scene->volume->world(), settings);
+  return scene.release();
+}
+
+void drr_destroy(drr_scene *scene)
+{
+  delete scene;
+}
+
+size_t drr_num_luts(const drr_scene *scene)
+{
+#ifdef HAVE_ITK
+  return scene->lutNames.size();
+#else
+  return 0;
+#endif
+}
+
+const char *drr_lut_name(const drr_scene *scene, size_t lut)
+{
+#ifdef HAVE_ITK
+  if (lut < scene->lutNames.size())
+    return scene->lutNames[lut].c_str();
+#endif
+  return nullptr;
+}
+
+int drr_set_lut(drr_scene *scene, size_t lut)
+{
+  if (scene->busy())
+    return fail(0, "poses are still queued or mapped");
+  return scene->setLut(lut) ? 1 : 0;
+}
+
+int drr_set_energy(drr_scene *scene, float photonEnergy)
+{
+  if (scene->busy())
+    return fail(0, "poses are still queued or mapped");
+  scene->renderer->setPhotonEnergy(photonEnergy);
+  return 1;
+}
+
+int drr_submit(drr_scene *scene, const drr_pose *poses, size_t count)
+{
+  for (size_t i = 0; i < count; ++i) {
+    const auto &p = poses[i];
+    scene->queued.push_back({scene->numSubmitted++,
+        prediction("",
+            p.eye[0],
+            p.eye[1],
+            p.eye[2],
+            p.center[0],
+            p.center[1],
+            p.center[2],
+            p.up[0],
+            p.up[1],
+            p.up[2]),
+        p.fovy});
+  }
+  scene->fill();
+  return 1;
+}
+
+int drr_next(drr_scene *scene, drr_image *image, uint32_t flags)
+{
+  drr_release(scene);
+  if (scene->inFlight.empty())
+    return 0;
+
+  const uint64_t index = scene->inFlight.front();
+  scene->inFlight.pop_front();
+  const size_t slot = index % scene->renderer->numSlots();
+  BatchRenderer::MappedFrame frame;
+  const bool ok =
+      scene->renderer->map(slot, frame, flags & DRR_NEXT_DEVICE_POINTERS);
+  scene->mapped = true;
+  scene->mappedIndex = index;
+
+  *image = drr_image{};
+  image->index = index;
+  if (!ok) {
+    drr_release(scene);
+    return fail(-1, "frame " + std::to_string(index) + " failed to render");
+  }
+  image->color = frame.color;
+  image->origin = frame.origin;
+  image->width = uint32_t(frame.width);
+  image->height = uint32_t(frame.height);
+  image->color_memory =
+      frame.colorOnDevice ? DRR_MEMORY_DEVICE : DRR_MEMORY_HOST;
+  image->origin_memory =
+      frame.originOnDevice ? DRR_MEMORY_DEVICE : DRR_MEMORY_HOST;
+  return 1;
+}
+
+void drr_release(drr_scene *scene)
+{
+  if (!scene->mapped)
+    return;
+  scene->renderer->unmap(scene->mappedIndex % scene->renderer->numSlots());
+  scene->mapped = false;
+  scene->fill();
+}
+
+} // extern "C"
@@ -0,0 +1,181 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "DrrTuning.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::string cpuModel()
+{
+  std::ifstream in("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("model name", 0) != 0)
+      continue;
+    const size_t colon = line.find(':');
+    if (colon == std::string::npos)
+      break;
+    const size_t begin = line.find_first_not_of(" \t", colon + 1);
+    return begin == std::string::npos ? "" : line.substr(begin);
+  }
+  return "unknown CPU";
+}
+
+// Looking at the field's center along axis, from far enough out that the
+// field fills the frame's height
+RayCamera axisCamera(
+    const StructuredField &field, int axis, size_t width, size_t height)
+{
+  const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+  float center[3], diagonal = 0.f;
+  for (int a = 0; a < 3; ++a) {
+    const float extent = (dims[a] - 1) * field.spacing[a];
+    center[a] = field.origin[a] + 0.5f * extent;
+    diagonal += extent * extent;
+  }
+  diagonal = std::sqrt(diagonal);
+
+  RayCamera camera;
+  std::copy_n(center, 3, camera.eye);
+  camera.eye[axis] += 2.f * diagonal;
+  std::fill_n(camera.dir, 3, 0.f);
+  camera.dir[axis] = -1.f;
+  std::fill_n(camera.up, 3, 0.f);
+  camera.up[axis == 1 ? 2 : 1] = 1.f;
+  camera.fovy = 2.f * std::atan(0.25f);
+  camera.aspect = width / float(std::max<size_t>(height, 1));
+  camera.width = width;
+  camera.height = height;
+  return camera;
+}
+
+// Milliseconds of the faster of two frames along each of the z and x axes
+float timeLayout(const StructuredField &field,
+    size_t width,
+    size_t height,
+    FirstHitSettings settings,
+    const DrrLayout &layout)
+{
+  settings.layout = layout;
+  std::vector<uint8_t> color(width * height * 4);
+  std::vector<float> origin(width * height * 3);
+  float total = 0.f;
+  for (int axis : {2, 0}) {
+    const RayCamera camera = axisCamera(field, axis, width, height);
+    float best = std::numeric_limits<float>::max();
+    for (int run = 0; run < 2; ++run) {
+      const auto start = std::chrono::steady_clock::now();
+      renderDrr(field, camera, color.data(), origin.data(), settings);
+      best = std::min(best,
+          std::chrono::duration<float, std::milli>(
+              std::chrono::steady_clock::now() - start)
+              .count());
+    }
+    total += best;
+  }
+  return total;
+}
+
+nlohmann::json readCache(const std::string &cacheFile)
+{
+  std::ifstream in(cacheFile);
+  if (!in)
+    return nlohmann::json::object();
+  try {
+    nlohmann::json cache = nlohmann::json::parse(in);
+    if (cache.is_object())
+      return cache;
+  } catch (const nlohmann::json::exception &) {
+    // reported below
+  }
+  std::cerr << "Ignoring unreadable DRR tuning cache " << cacheFile << "\n";
+  return nlohmann::json::object();
+}
+
+} // namespace
+
+std::string drrTuningKey(const StructuredField &field,
+    size_t width,
+    size_t height,
+    const FirstHitSettings &settings)
+{
+  return cpuModel() + " x" + std::to_string(std::thread::hardware_concurrency())
+      + " | " + std::to_string(field.dimX) + "x" + std::to_string(field.dimY)
+      + "x" + std::to_string(field.dimZ) + " "
+      + std::to_string(field.bytesPerCell) + "B | " + std::to_string(width)
+      + "x" + std::to_string(height) + " | "
+      + (settings.projector == Projector::Siddon ? "siddon" : "sampled")
+      + (settings.voxels && settings.voxels->matches(field)
+              ? std::string(" ") + voxelOrderName(settings.voxels->order)
+              : std::string());
+}
+
+DrrLayout tuneDrrLayout(const StructuredField &field,
+    size_t width,
+    size_t height,
+    const FirstHitSettings &settings,
+    const std::string &cacheFile)
+{
+  // scenes of several devices tune the same key one after another
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (!field.data() || field.empty() || width == 0 || height == 0)
+    return settings.layout;
+  const std::string key = drrTuningKey(field, width, height, settings);
+  nlohmann::json cache =
+      cacheFile.empty() ? nlohmann::json::object() : readCache(cacheFile);
+  if (cache.contains(key)) {
+    try {
+      DrrLayout layout;
+      layout.packetWidth = cache[key].at("packetWidth").get<int>();
+      layout.tileSize = cache[key].at("tileSize").get<int>();
+      return layout;
+    } catch (const nlohmann::json::exception &) {
+      // timed again below
+    }
+  }
+
+  std::cout << "Tuning the builtin renderer for " << key << "...\n";
+  DrrLayout best = settings.layout;
+  float bestTime = std::numeric_limits<float>::max();
+  for (int packetWidth : {8, 4, 2}) {
+    for (int tileSize : {0, 16, 32, 64}) {
+      const DrrLayout layout{packetWidth, tileSize};
+      const float time = timeLayout(field, width, height, settings, layout);
+      if (time < bestTime) {
+        bestTime = time;
+        best = layout;
+      }
+    }
+  }
+  std::cout << "Builtin renderer: packets of " << best.packetWidth << " x "
+            << 8 / best.packetWidth << " pixels, "
+            << (best.tileSize > 0
+                       ? "tiles of " + std::to_string(best.tileSize)
+                       : std::string("whole rows"))
+            << " (" << bestTime << " ms per test frame pair)\n";
+
+  if (!cacheFile.empty()) {
+    cache[key] = {{"packetWidth", best.packetWidth},
+        {"tileSize", best.tileSize},
+        {"ms", bestTime}};
+    std::ofstream out(cacheFile);
+    out << cache.dump(2) << "\n";
+    if (!out)
+      std::cerr << "Could not write " << cacheFile << "\n";
+  }
+  return best;
+}
@@ -0,0 +1,35 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <string>
+// ours
+#include "FieldTypes.h"
+#include "FirstHit.h"
+
+// Autotuning of the builtin renderer ////////////////////////////////////////
+//
+// Which DrrLayout renderDrr() is fastest with depends on the cores and their
+// caches, the volume and the frame size. tuneDrrLayout() times every packet
+// shape and tile size on frames of width x height looking at the field
+// along two axes, and keeps the fastest in a JSON cache file under a key of
+// the CPU model, the thread count, the field's dims and cell size, the
+// frame size, the projector and a voxel order other than linear; later runs
+// with the same key use it without timing again. The layouts render the same images.
+
+// The cache key of a field and frame on this machine
+std::string drrTuningKey(const StructuredField &field,
+    size_t width,
+    size_t height,
+    const FirstHitSettings &settings);
+
+// The cached layout for the key, else the fastest one, added to the cache
+// (an empty cacheFile only times); the settings' own layout for fields
+// without host voxels
+DrrLayout tuneDrrLayout(const StructuredField &field,
+    size_t width,
+    size_t height,
+    const FirstHitSettings &settings,
+    const std::string &cacheFile);
@@ -0,0 +1,154 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "EdgeFilter.h"
+// std
+#include <algorithm>
+#include <cstdlib>
+// ours
+#include "GLProgram.h"
+#include "Trace.h"
+
+static const char *s_fragmentShader = R"(
+uniform sampler2D source;
+uniform ivec2 size; // of the region filtered, pixels
+uniform int mode; // EdgeSettings::Mode
+uniform float level;
+uniform float gain;
+out vec4 color;
+
+float luminance(ivec2 p)
+{
+  p = clamp(p, ivec2(0), size - 1);
+  return dot(texelFetch(source, p, 0).rgb, vec3(1.0 / 3.0));
+}
+
+void main()
+{
+  ivec2 p = ivec2(gl_FragCoord.xy);
+  float v = 0.0;
+  if (mode == 1) {
+    float l00 = luminance(p + ivec2(-1, -1)), l10 = luminance(p + ivec2(0, -1));
+    float l20 = luminance(p + ivec2(1, -1)), l01 = luminance(p + ivec2(-1, 0));
+    float l21 = luminance(p + ivec2(1, 0)), l02 = luminance(p + ivec2(-1, 1));
+    float l12 = luminance(p + ivec2(0, 1)), l22 = luminance(p + ivec2(1, 1));
+    float gx = (l20 + 2.0 * l21 + l22) - (l00 + 2.0 * l01 + l02);
+    float gy = (l02 + 2.0 * l12 + l22) - (l00 + 2.0 * l10 + l20);
+    v = length(vec2(gx, gy)) * gain;
+  } else if (mode == 2) {
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(source, 0));
+    float fine = dot(textureLod(source, uv, level).rgb, vec3(1.0 / 3.0));
+    float coarse = dot(textureLod(source, uv, level + 1.0).rgb, vec3(1.0 / 3.0));
+    v = 0.5 + (fine - coarse) * gain;
+  }
+  color = vec4(vec3(clamp(v, 0.0, 1.0)), 1.0);
+}
+)";
+
+bool EdgeSettings::parse(const std::string &text, EdgeSettings &settings)
+{
+  if (text == "sobel") {
+    settings.mode = Sobel;
+    return true;
+  }
+  if (text.rfind("log", 0) != 0)
+    return false;
+  settings.mode = LoG;
+  if (text.size() > 3) {
+    if (text[3] != ':')
+      return false;
+    settings.level = std::clamp(std::atoi(text.c_str() + 4), 0, 8);
+  }
+  return true;
+}
+
+EdgeFilter::~EdgeFilter()
+{
+  if (m_program)
+    glDeleteProgram(m_program);
+  if (m_vertexArray)
+    glDeleteVertexArrays(1, &m_vertexArray);
+  if (m_framebuffer)
+    glDeleteFramebuffers(1, &m_framebuffer);
+  if (m_sampler)
+    glDeleteSamplers(1, &m_sampler);
+}
+
+bool EdgeFilter::init()
+{
+  m_initialized = true;
+  m_program = buildFullscreenProgram("edge filter", s_fragmentShader);
+  if (!m_program)
+    return false;
+
+  m_sizeLocation = glGetUniformLocation(m_program, "size");
+  m_modeLocation = glGetUniformLocation(m_program, "mode");
+  m_levelLocation = glGetUniformLocation(m_program, "level");
+  m_gainLocation = glGetUniformLocation(m_program, "gain");
+  glUseProgram(m_program);
+  glUniform1i(glGetUniformLocation(m_program, "source"), 0);
+  glUseProgram(0);
+  glGenVertexArrays(1, &m_vertexArray);
+  glGenFramebuffers(1, &m_framebuffer);
+  // the source's own filter is the display's business
+  glGenSamplers(1, &m_sampler);
+  glSamplerParameteri(m_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glSamplerParameteri(m_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return true;
+}
+
+bool EdgeFilter::apply(GLuint source,
+    GLuint target,
+    int width,
+    int height,
+    const EdgeSettings &settings)
+{
+  TRACE_SCOPE("gl", "edge filter");
+  if (!m_initialized)
+    init();
+  if (!m_program)
+    return false;
+
+  GLStateGuard state;
+
+  glBindTexture(GL_TEXTURE_2D, source);
+  const bool pyramid = settings.mode == EdgeSettings::LoG;
+  if (pyramid) {
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindSampler(0, m_sampler);
+  }
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTexture2D(
+      GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+  glViewport(0, 0, width, height);
+  glUseProgram(m_program);
+  glUniform2i(m_sizeLocation, width, height);
+  glUniform1i(m_modeLocation, settings.mode);
+  glUniform1f(m_levelLocation, float(std::max(0, settings.level)));
+  glUniform1f(m_gainLocation, settings.gain);
+  glBindVertexArray(m_vertexArray);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  if (pyramid)
+    glBindSampler(0, 0);
+  return true;
+}
+
+void EdgeFilter::read(GLuint texture, int width, int height, uint8_t *rgba)
+{
+  TRACE_SCOPE("gl", "edge readback");
+  if (!m_framebuffer)
+    glGenFramebuffers(1, &m_framebuffer);
+  GLint framebuffer = 0, alignment = 4;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &framebuffer);
+  glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTexture2D(
+      GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+  glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+}
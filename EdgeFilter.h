@@ -0,0 +1,69 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// glad
+#include "glad/glad.h"
+// std
+#include <cstdint>
+#include <string>
+
+// Edge enhancement of DRRs for display and for gradient-based matchers
+struct EdgeSettings
+{
+  enum Mode : int
+  {
+    None,
+    Sobel, // gradient magnitude of the luminance
+    LoG // band of a Laplacian (difference of Gaussians) pyramid
+  };
+
+  int mode{None};
+  int level{1}; // LoG: pyramid level, the larger the coarser the edges
+  float gain{4.f};
+
+  // "sobel", "log" or "log:<level>"; false for anything else
+  static bool parse(const std::string &text, EdgeSettings &settings);
+};
+
+// Edge image of an RGBA8 texture on the GPU: a fullscreen-triangle pass,
+// like ToneMapper, writes the response as gray RGBA8 into a second
+// texture. Sobel shows the gradient magnitude times the gain; LoG takes the
+// difference of two mip levels of the source (a Laplacian pyramid band)
+// with mid gray as zero. read() hands the result to the host for matchers.
+class EdgeFilter
+{
+ public:
+  EdgeFilter() = default;
+  ~EdgeFilter();
+
+  EdgeFilter(const EdgeFilter &) = delete;
+  EdgeFilter &operator=(const EdgeFilter &) = delete;
+
+  // Must be called with the GL context current; filters the lower left
+  // width x height pixels of `source` into the same pixels of `target`.
+  // LoG regenerates the source's mipmaps. False if the shader could not be
+  // built.
+  bool apply(GLuint source,
+      GLuint target,
+      int width,
+      int height,
+      const EdgeSettings &settings);
+  // Reads the lower left width x height pixels of `texture` as RGBA8,
+  // row 0 first
+  void read(GLuint texture, int width, int height, uint8_t *rgba);
+
+ private:
+  bool init();
+
+  GLuint m_program{0};
+  GLuint m_vertexArray{0};
+  GLuint m_framebuffer{0};
+  GLuint m_sampler{0}; // trilinear, for the pyramid levels
+  GLint m_sizeLocation{-1};
+  GLint m_modeLocation{-1};
+  GLint m_levelLocation{-1};
+  GLint m_gainLocation{-1};
+  bool m_initialized{false};
+};
@@ -0,0 +1,943 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Evaluation.h"
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+// ours
+#include "ImageStore.h"
+#include "Registration.h"
+#include "ScratchArena.h"
+#include "SimilarityMatcher.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+float msSince(Clock::time_point start)
+{
+  return std::chrono::duration<float, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Similarity of a DRR to its (swizzled) reference
+void score(SimilarityMatcher &similarity,
+    const Image &reference,
+    const std::vector<uint8_t> &color,
+    size_t width,
+    size_t height,
+    PoseEvaluation &r)
+{
+  similarity.set_image(reference.data.data(),
+      reference.width,
+      reference.height,
+      feature_matcher::PIXEL_TYPE::RGBA,
+      feature_matcher::IMAGE_TYPE::REFERENCE,
+      true);
+  similarity.set_image(color.data(),
+      width,
+      height,
+      feature_matcher::PIXEL_TYPE::RGBA,
+      feature_matcher::IMAGE_TYPE::QUERY,
+      false);
+  similarity.match();
+  r.ncc = similarity.score().ncc;
+  r.gradientCorrelation = similarity.score().gradientCorrelation;
+  r.mutualInformation = similarity.score().mutualInformation;
+}
+
+// Key of prediction p's outcome; matcher also tells evaluation from
+// registration and its settings
+uint64_t cacheKey(const PoseCache &cache,
+    const prediction &p,
+    const std::string &matcher)
+{
+  return cache.key(p.filename,
+      {p.eye.x, p.eye.y, p.eye.z},
+      {p.center.x, p.center.y, p.center.z},
+      {p.up.x, p.up.y, p.up.z},
+      matcher);
+}
+
+bool fromCache(const PoseCache &cache, uint64_t key, PoseEvaluation &r)
+{
+  PoseCache::Entry e;
+  if (!cache.get(key, e))
+    return false;
+  r.haveReference = true; // only matched references are cached
+  r.cached = true;
+  r.updated = e.updated;
+  r.eye = e.eye;
+  r.center = e.center;
+  r.up = e.up;
+  r.poseDelta = e.poseDelta;
+  r.ncc = e.ncc;
+  r.gradientCorrelation = e.gradientCorrelation;
+  r.mutualInformation = e.mutualInformation;
+  r.iterations = e.iterations;
+  return true;
+}
+
+void toCache(PoseCache &cache, uint64_t key, const PoseEvaluation &r)
+{
+  PoseCache::Entry e;
+  e.updated = r.updated;
+  e.eye = r.eye;
+  e.center = r.center;
+  e.up = r.up;
+  e.poseDelta = r.poseDelta;
+  e.ncc = r.ncc;
+  e.gradientCorrelation = r.gradientCorrelation;
+  e.mutualInformation = r.mutualInformation;
+  e.iterations = uint32_t(r.iterations);
+  cache.put(key, e);
+}
+
+// The reference's red channel, sRGB-decoded to linear intensity, at the
+// centers of width x height pixels; values is reused
+void referenceIntensity(const Image &reference,
+    size_t width,
+    size_t height,
+    std::vector<float> &values)
+{
+  static const auto linear = []() {
+    std::array<float, 256> table;
+    for (int i = 0; i < 256; ++i) {
+      const float c = i / 255.f;
+      table[i] = c <= 0.04045f ? c / 12.92f
+                               : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return table;
+  }();
+  values.resize(width * height);
+  for (size_t y = 0; y < height; ++y) {
+    const size_t sy = (2 * y + 1) * reference.height / (2 * height);
+    for (size_t x = 0; x < width; ++x) {
+      const size_t sx = (2 * x + 1) * reference.width / (2 * width);
+      values[y * width + x] =
+          linear[reference.data[(sy * reference.width + sx) * 4]];
+    }
+  }
+}
+
+// One damped Gauss-Newton step of the camera twist (applyCameraTwist())
+// bringing the DRR's intensities toward the reference's. Their scales
+// differ, so the reference is compared against a * intensity + b, with a
+// and b fitted anew each step; ncc is their normalized cross-correlation.
+// False if the system is singular.
+bool gaussNewtonStep(const std::vector<float> &intensity,
+    const std::vector<float> &jacobian,
+    const std::vector<float> &reference,
+    float twist[6],
+    float &ncc)
+{
+  const size_t n = intensity.size();
+  double sumI = 0.0, sumR = 0.0, sumII = 0.0, sumIR = 0.0, sumRR = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    sumI += intensity[i];
+    sumR += reference[i];
+    sumII += double(intensity[i]) * intensity[i];
+    sumIR += double(intensity[i]) * reference[i];
+    sumRR += double(reference[i]) * reference[i];
+  }
+  const double varI = sumII - sumI * sumI / n;
+  const double varR = sumRR - sumR * sumR / n;
+  const double covIR = sumIR - sumI * sumR / n;
+  ncc = varI > 0.0 && varR > 0.0 ? float(covIR / std::sqrt(varI * varR)) : 0.f;
+  if (n == 0 || varI <= 0.0)
+    return false;
+  const double a = covIR / varI;
+  const double b = (sumR - a * sumI) / n;
+
+  // normal equations H x = -g of the residuals a I + b - R
+  double H[6][7] = {};
+  for (size_t i = 0; i < n; ++i) {
+    const double e = a * intensity[i] + b - reference[i];
+    const float *J = jacobian.data() + i * 6;
+    for (int j = 0; j < 6; ++j) {
+      for (int k = j; k < 6; ++k)
+        H[j][k] += a * a * J[j] * J[k];
+      H[j][6] -= a * J[j] * e;
+    }
+  }
+  for (int j = 0; j < 6; ++j) {
+    for (int k = 0; k < j; ++k)
+      H[j][k] = H[k][j];
+    H[j][j] *= 1.0 + 1e-3; // Levenberg-Marquardt damping
+  }
+
+  // Gaussian elimination with partial pivoting
+  for (int c = 0; c < 6; ++c) {
+    int pivot = c;
+    for (int j = c + 1; j < 6; ++j) {
+      if (std::abs(H[j][c]) > std::abs(H[pivot][c]))
+        pivot = j;
+    }
+    if (std::abs(H[pivot][c]) < 1e-30)
+      return false;
+    std::swap(H[c], H[pivot]);
+    for (int j = c + 1; j < 6; ++j) {
+      const double f = H[j][c] / H[c][c];
+      for (int k = c; k < 7; ++k)
+        H[j][k] -= f * H[c][k];
+    }
+  }
+  for (int c = 5; c >= 0; --c) {
+    double x = H[c][6];
+    for (int k = c + 1; k < 6; ++k)
+      x -= H[c][k] * twist[k];
+    twist[c] = float(x / H[c][c]);
+  }
+  return true;
+}
+
+// Registration steps on Jacobian DRRs of a host field, each a
+// gaussNewtonStep() toward the reference's intensities in target. Coarse
+// steps trace a new sample of the ROI's pixels each time, the others all
+// of its pixels (the whole frame without an ROI). The renderer is set up
+// once for all steps of all predictions.
+struct GradientStepper
+{
+  static constexpr size_t minSamples = 256;
+
+  std::unique_ptr<JacobianRenderer> renderer;
+  RayCamera camera; // size and frustum, aimed at each pose
+  float sampleFraction{0.f};
+  PixelSampling sampling{PixelSampling::Stratified};
+  ImageRoi roi;
+  bool coarse{false};
+  std::mt19937 rng; // seeded per prediction, runs repeat
+  std::vector<float> target;
+  std::vector<float> intensity, jacobian;
+  std::vector<uint32_t> indices; // of the sampled pixels in target
+  std::vector<float> pixels; // their centers
+  std::vector<float> sampleTarget;
+
+  bool samples() const
+  {
+    return sampleFraction > 0.f && sampleFraction < 1.f;
+  }
+  bool sampled() const
+  {
+    return coarse && samples();
+  }
+
+  // The pixels the next step traces, sorted so neighbours share packets
+  void drawPixels()
+  {
+    int offset[2], size[2];
+    roi.pixels(int(camera.width), int(camera.height), offset, size);
+    const size_t numRoi = size_t(size[0]) * size_t(size[1]);
+    indices.clear();
+    auto add = [&](size_t x, size_t y) {
+      indices.push_back(
+          uint32_t((offset[1] + y) * camera.width + offset[0] + x));
+    };
+    const size_t count = std::min(numRoi,
+        std::max(minSamples, size_t(sampleFraction * float(numRoi))));
+    if (!sampled() || count == numRoi) {
+      for (size_t y = 0; y < size_t(size[1]); ++y)
+        for (size_t x = 0; x < size_t(size[0]); ++x)
+          add(x, y);
+    } else if (sampling == PixelSampling::Random) {
+      std::uniform_int_distribution<size_t> pick(0, numRoi - 1);
+      for (size_t k = 0; k < count; ++k) {
+        const size_t p = pick(rng);
+        add(p % size_t(size[0]), p / size_t(size[0]));
+      }
+      std::sort(indices.begin(), indices.end());
+    } else {
+      // square cells holding about one sample each, row by row
+      std::uniform_real_distribution<float> jitter(0.f, 1.f);
+      const float cell = std::sqrt(float(numRoi) / float(count));
+      const size_t cols = size_t(std::ceil(float(size[0]) / cell));
+      const size_t rows = size_t(std::ceil(float(size[1]) / cell));
+      for (size_t cy = 0; cy < rows; ++cy) {
+        for (size_t cx = 0; cx < cols; ++cx) {
+          const size_t x = std::min(size_t(size[0]) - 1,
+              size_t((float(cx) + jitter(rng)) * cell));
+          const size_t y = std::min(size_t(size[1]) - 1,
+              size_t((float(cy) + jitter(rng)) * cell));
+          add(x, y);
+        }
+      }
+    }
+
+    pixels.resize(indices.size() * 2);
+    sampleTarget.resize(indices.size());
+    for (size_t k = 0; k < indices.size(); ++k) {
+      pixels[k * 2] = float(indices[k] % camera.width) + 0.5f;
+      pixels[k * 2 + 1] = float(indices[k] / camera.width) + 0.5f;
+      sampleTarget[k] = target[indices[k]];
+    }
+  }
+
+  // False if the DRR failed to render. moved: the pose took the step (not
+  // for a singular system); ncc scores the DRR at the pose before it.
+  bool step(prediction &pose, PoseEvaluation &r, bool &moved, float &ncc)
+  {
+    const bool subset = sampled() || !roi.full();
+    auto t = Clock::now();
+    const auto dir = anari::math::normalize(pose.center - pose.eye);
+    const float eye[3] = {pose.eye.x, pose.eye.y, pose.eye.z};
+    const float view[3] = {dir.x, dir.y, dir.z};
+    const float up[3] = {pose.up.x, pose.up.y, pose.up.z};
+    std::copy_n(eye, 3, camera.eye);
+    std::copy_n(view, 3, camera.dir);
+    std::copy_n(up, 3, camera.up);
+    if (subset) {
+      drawPixels();
+      intensity.resize(indices.size());
+      jacobian.resize(indices.size() * 6);
+      if (!renderer->renderAt(camera,
+              pixels.data(),
+              indices.size(),
+              intensity.data(),
+              jacobian.data()))
+        return false;
+    } else {
+      const size_t numPixels = camera.width * camera.height;
+      intensity.resize(numPixels);
+      jacobian.resize(numPixels * 6);
+      if (!renderer->render(camera, intensity.data(), jacobian.data()))
+        return false;
+    }
+    r.render.latency += msSince(t);
+
+    t = Clock::now();
+    float twist[6];
+    moved = gaussNewtonStep(
+        intensity, jacobian, subset ? sampleTarget : target, twist, ncc);
+    if (moved)
+      applyCameraTwist(pose.eye, pose.center, pose.up, twist);
+    r.matchMs += msSince(t);
+    return true;
+  }
+};
+
+// The better half of the starts by their scores, best first; rank and
+// kept are reused
+void keepBetterHalf(std::vector<prediction> &starts,
+    const std::vector<float> &scores,
+    std::vector<size_t> &rank,
+    std::vector<prediction> &kept)
+{
+  rank.resize(starts.size());
+  std::iota(rank.begin(), rank.end(), size_t(0));
+  std::stable_sort(rank.begin(), rank.end(), [&](size_t a, size_t b) {
+    return scores[a] > scores[b];
+  });
+  kept.clear();
+  for (size_t k = 0; k < (starts.size() + 1) / 2; ++k)
+    kept.push_back(starts[rank[k]]);
+  starts.swap(kept);
+}
+
+// Scores and matchers here take RGBA8; GRAY16 references are expanded
+ImageStore::ImagePtr decodeRgba(const std::string &file)
+{
+  return rgbaImage(ImageStore::decode(file));
+}
+
+} // namespace
+
+bool evaluatePredictions(BatchRenderer &renderer,
+    MatchersWrapper &matchers,
+    size_t matcherIndex,
+    const prediction_container &predictions,
+    std::vector<PoseEvaluation> &results,
+    PoseCache *cache)
+{
+  const auto &poses = predictions.predictions;
+  const size_t numPoses = poses.size();
+  const size_t numSlots = renderer.numSlots();
+  const auto &settings = renderer.settings();
+  const size_t width = size_t(settings.width);
+  const size_t height = size_t(settings.height);
+  const float aspect = float(width) / float(height);
+  feature_matcher *matcher = matchers.matcher(matcherIndex);
+
+  results.assign(numPoses, PoseEvaluation());
+
+  // the predictions left to run, the others come from the cache
+  const std::string identity =
+      matchers.identity(matcher ? matcherIndex : SIZE_MAX);
+  std::vector<size_t> todo;
+  std::vector<uint64_t> keys(cache ? numPoses : 0);
+  for (size_t i = 0; i < numPoses; ++i) {
+    results[i].index = i;
+    if (cache) {
+      keys[i] = cacheKey(*cache, poses[i], identity);
+      if (fromCache(*cache, keys[i], results[i]))
+        continue;
+    }
+    todo.push_back(i);
+  }
+  const size_t numTodo = todo.size();
+  if (numTodo < numPoses)
+    printf("%zu of %zu predictions cached\n", numPoses - numTodo, numPoses);
+
+  // decode stage: references up to numSlots ahead of the pose rendered
+  ThreadPool decoder(2);
+  std::vector<std::future<ImageStore::ImagePtr>> references(numTodo);
+  size_t nextDecode = 0;
+  auto decodeAhead = [&](size_t upTo) {
+    for (; nextDecode < std::min(upTo, numTodo); ++nextDecode) {
+      const std::string file = poses[todo[nextDecode]].filename;
+      references[nextDecode] =
+          decoder.enqueue([file]() { return decodeRgba(file); });
+    }
+  };
+
+  // match stage: one job at a time on its own thread, reading the DRR of
+  // buffer n % 2 while the next DRR is collected into the other one
+  std::vector<uint8_t> colors[2];
+  std::vector<float> origins[2];
+  SimilarityMatcher similarity;
+  ScratchArena scratch; // the matcher's, one match job at a time
+  std::future<void> matchJob;
+  auto match = [&](size_t n) {
+    TRACE_SCOPE("evaluation", "match");
+    const size_t i = todo[n];
+    auto &r = results[i];
+    const auto &color = colors[n % 2];
+    const auto &origin = origins[n % 2];
+
+    auto start = Clock::now();
+    auto reference = references[n].get();
+    r.decodeWaitMs = msSince(start);
+    r.haveReference = reference && reference->bpp == 4;
+
+    const auto &p = poses[i];
+    r.eye = {p.eye.x, p.eye.y, p.eye.z};
+    r.center = {p.center.x, p.center.y, p.center.z};
+    r.up = {p.up.x, p.up.y, p.up.z};
+    if (!r.haveReference)
+      return;
+
+    // stored references are swizzled, as in the viewer
+    auto view = make_image_view(reference->data.data(),
+        reference->width,
+        reference->height,
+        feature_matcher::PIXEL_TYPE::RGBA,
+        true);
+    score(similarity, *reference, color, width, height, r);
+
+    if (!matcher) {
+      if (cache)
+        toCache(*cache, keys[i], r);
+      return;
+    }
+    start = Clock::now();
+    matchers.setReference(matcherIndex, i, poses[i].filename, view);
+    r.referenceMs = msSince(start);
+
+    start = Clock::now();
+    scratch.reset();
+    {
+      matcher_scratch_scope lend(matcher, scratch.scratch());
+      matcher->set_image(origin.data(),
+          width,
+          height,
+          feature_matcher::PIXEL_TYPE::FLOAT3,
+          feature_matcher::IMAGE_TYPE::DEPTH3D,
+          false);
+      matcher->set_image(color.data(),
+          width,
+          height,
+          feature_matcher::PIXEL_TYPE::RGBA,
+          feature_matcher::IMAGE_TYPE::QUERY,
+          false);
+      matcher->calibrate(width, height, predictions.fovy, aspect);
+      matcher->match();
+      r.updated = matcher->update_camera(r.eye, r.center, r.up);
+    }
+    r.matchMs = msSince(start);
+    r.iterations = 1;
+    r.poseDelta = RegistrationLoop::poseDelta(p.eye,
+        p.center,
+        anari::math::float3{r.eye[0], r.eye[1], r.eye[2]},
+        anari::math::float3{r.center[0], r.center[1], r.center[2]});
+    if (cache)
+      toCache(*cache, keys[i], r);
+  };
+
+  // render stage: all frames in flight, refilled as DRRs are collected
+  decodeAhead(2 * numSlots);
+  for (size_t n = 0; n < std::min(numSlots, numTodo); ++n)
+    renderer.submit(n, poses[todo[n]]);
+
+  const auto start = Clock::now();
+  size_t numDone = numPoses;
+  for (size_t n = 0; n < numTodo; ++n) {
+    const size_t slot = n % numSlots;
+    const size_t i = todo[n];
+    if (!renderer.collect(
+            slot, colors[n % 2], origins[n % 2], &results[i].render)) {
+      std::cerr << "Evaluation stopped: pose " << i << " failed to render\n";
+      numDone = i;
+      break;
+    }
+    if (n + numSlots < numTodo)
+      renderer.submit(slot, poses[todo[n + numSlots]]);
+    decodeAhead(n + 2 * numSlots);
+
+    if (matchJob.valid())
+      matchJob.get();
+    matchJob = std::async(std::launch::async, match, n);
+
+    if ((n + 1) % 100 == 0 || n + 1 == numTodo) {
+      const float seconds = msSince(start) / 1000.f;
+      printf("evaluated %zu / %zu predictions (%.1f per second)\n",
+          n + 1,
+          numTodo,
+          float(n + 1) / seconds);
+    }
+  }
+  if (matchJob.valid())
+    matchJob.get();
+  // queued decodes finish with the pool
+  results.resize(numDone);
+  return numDone == numPoses;
+}
+
+bool registerPredictions(BatchRenderer &renderer,
+    MatchersWrapper &matchers,
+    size_t matcherIndex,
+    const prediction_container &predictions,
+    const RegistrationSettings &settings,
+    std::vector<PoseEvaluation> &results,
+    PoseCache *cache)
+{
+  using anari::math::float3;
+  const auto &poses = predictions.predictions;
+  const size_t numPoses = poses.size();
+  const size_t width = size_t(renderer.settings().width);
+  const size_t height = size_t(renderer.settings().height);
+  const float aspect = float(width) / float(height);
+  feature_matcher *matcher = matchers.matcher(matcherIndex);
+  if (!matcher && !settings.gradientField) {
+    std::cerr << "ERROR: registration needs a matcher (-m)\n";
+    return false;
+  }
+  const size_t numViews = settings.views ? settings.views->size() : 0;
+  if (numViews && (settings.gradientField || !matcher)) {
+    std::cerr << "ERROR: multi-view registration needs a matcher (-m)\n";
+    return false;
+  }
+
+  results.assign(numPoses, PoseEvaluation());
+  const bool warmStart = settings.warmStart != WarmStartOrder::None;
+  const auto order = registrationOrder(poses, settings.warmStart);
+  PoseKdTree tree;
+  if (warmStart)
+    tree = PoseKdTree(poses);
+  std::vector<uint8_t> solved(numPoses, 0);
+  char mode[96];
+  std::snprintf(mode,
+      sizeof(mode),
+      "|register %zu %g %d%s",
+      settings.maxIterations,
+      settings.tolerance,
+      int(settings.warmStart),
+      settings.gradientField ? " gradient" : "");
+  std::string identity =
+      (settings.gradientField ? std::string("gradient")
+                              : matchers.identity(matcherIndex))
+      + mode;
+  if (settings.starts.count > 1) {
+    const auto &st = settings.starts;
+    std::snprintf(mode,
+        sizeof(mode),
+        " starts %llu %llu %g %g %g %g",
+        (unsigned long long)st.count,
+        (unsigned long long)st.seed,
+        st.rotation,
+        st.roll,
+        st.translation,
+        st.distance);
+    identity += mode;
+  }
+  if (settings.gradientField
+      && (!settings.roi.full()
+          || (settings.sampleFraction > 0.f
+              && settings.sampleFraction < 1.f))) {
+    const auto &roi = settings.roi;
+    std::snprintf(mode,
+        sizeof(mode),
+        " samples %g %d roi %g %g %g %g",
+        settings.sampleFraction,
+        int(settings.sampling),
+        roi.lower[0],
+        roi.lower[1],
+        roi.upper[0],
+        roi.upper[1]);
+    identity += mode;
+  }
+  if (numViews)
+    identity += " views " + settings.views->file();
+
+  // references decode a few predictions ahead, in registration order,
+  // those of the further views with the primary's
+  ThreadPool decoder(2);
+  std::vector<std::future<ImageStore::ImagePtr>> references(numPoses);
+  std::vector<std::vector<std::future<ImageStore::ImagePtr>>> viewReferences(
+      numViews ? numPoses : 0);
+  size_t nextDecode = 0;
+  auto decodeAhead = [&](size_t upTo) {
+    for (; nextDecode < std::min(upTo, numPoses); ++nextDecode) {
+      const size_t i = order[nextDecode];
+      const std::string file = poses[i].filename;
+      references[i] =
+          decoder.enqueue([file]() { return decodeRgba(file); });
+      for (size_t v = 0; v < numViews; ++v) {
+        const std::string viewFile = settings.views->reference(file, v);
+        viewReferences[i].push_back(decoder.enqueue(
+            [viewFile]() { return decodeRgba(viewFile); }));
+      }
+    }
+  };
+
+  // buffers of an iteration, reused by all of them: the DRR, the views'
+  // references and cameras, the multi-start rounds and the matcher's
+  // temporaries, which it takes from the arena while lent to it
+  std::vector<uint8_t> color;
+  std::vector<float> origin;
+  std::vector<ImageStore::ImagePtr> viewReference(numViews);
+  std::vector<prediction> cameras;
+  std::vector<prediction> starts, kept;
+  std::vector<float> scores;
+  std::vector<size_t> rank;
+  ScratchArena scratch;
+  matcher_scratch_scope lend(matcher, scratch.scratch());
+  GradientStepper gradient;
+  if (settings.gradientField) {
+    gradient.renderer = std::make_unique<JacobianRenderer>(
+        *settings.gradientField, renderer.settings().march);
+  }
+  gradient.camera.fovy = renderer.settings().fovy;
+  gradient.camera.aspect = aspect;
+  gradient.camera.width = width;
+  gradient.camera.height = height;
+  gradient.sampleFraction = settings.sampleFraction;
+  gradient.sampling = settings.sampling;
+  gradient.roi = settings.roi;
+  SimilarityMatcher similarity;
+  RegistrationLoop loop;
+  size_t numRegistered = 0, numIterations = 0;
+  size_t numWarm = 0, warmIterations = 0;
+  double warmStartError = 0.0, warmPredictionError = 0.0;
+  const auto start = Clock::now();
+  for (size_t n = 0; n < numPoses; ++n) {
+    TRACE_SCOPE("evaluation", "register");
+    const size_t i = order[n];
+    decodeAhead(n + 4);
+    auto &r = results[i];
+    r.index = i;
+    const auto &p = poses[i];
+    r.eye = {p.eye.x, p.eye.y, p.eye.z};
+    r.center = {p.center.x, p.center.y, p.center.z};
+    r.up = {p.up.x, p.up.y, p.up.z};
+    const uint64_t key = cache ? cacheKey(*cache, p, identity) : 0;
+    if (cache && fromCache(*cache, key, r)) {
+      solved[i] = r.updated;
+      continue;
+    }
+
+    gradient.rng.seed(uint32_t(i));
+    auto t = Clock::now();
+    auto reference = references[i].get();
+    for (size_t v = 0; v < numViews; ++v)
+      viewReference[v] = viewReferences[i][v].get();
+    r.decodeWaitMs = msSince(t);
+    r.haveReference = reference && reference->bpp == 4;
+    for (const auto &image : viewReference)
+      r.haveReference = r.haveReference && image && image->bpp == 4;
+    if (!r.haveReference)
+      continue;
+
+    // the neighbour's correction, applied to this prediction
+    prediction pose = p;
+    if (warmStart) {
+      r.warmStartFrom = tree.nearest(PoseKdTree::point(p),
+          [&](size_t j) { return solved[j] != 0; });
+    }
+    if (r.warmStartFrom != SIZE_MAX) {
+      const auto &q = results[r.warmStartFrom];
+      const auto &pq = poses[r.warmStartFrom];
+      const float3 eye(q.eye[0], q.eye[1], q.eye[2]);
+      const float3 center(q.center[0], q.center[1], q.center[2]);
+      pose.eye = p.eye + (eye - pq.eye);
+      pose.center = p.center + (center - pq.center);
+    }
+    const float3 startEye = pose.eye, startCenter = pose.center;
+
+    t = Clock::now();
+    if (settings.gradientField) {
+      referenceIntensity(*reference, width, height, gradient.target);
+    } else {
+      matchers.setReference(matcherIndex,
+          i,
+          poses[i].filename,
+          make_image_view(reference->data.data(),
+              reference->width,
+              reference->height,
+              feature_matcher::PIXEL_TYPE::RGBA,
+              true));
+    }
+    r.referenceMs = msSince(t);
+
+    // the matcher's update of `at` from the DRR in color and origin
+    auto matchUpdate = [&](prediction &at) {
+      t = Clock::now();
+      scratch.reset();
+      matcher->set_image(origin.data(),
+          width,
+          height,
+          feature_matcher::PIXEL_TYPE::FLOAT3,
+          feature_matcher::IMAGE_TYPE::DEPTH3D,
+          false);
+      matcher->set_image(color.data(),
+          width,
+          height,
+          feature_matcher::PIXEL_TYPE::RGBA,
+          feature_matcher::IMAGE_TYPE::QUERY,
+          false);
+      matcher->calibrate(width, height, predictions.fovy, aspect);
+      matcher->match();
+      std::array<float, 3> eye{at.eye.x, at.eye.y, at.eye.z};
+      std::array<float, 3> center{at.center.x, at.center.y, at.center.z};
+      std::array<float, 3> up{at.up.x, at.up.y, at.up.z};
+      const bool updated = matcher->update_camera(eye, center, up);
+      r.matchMs += msSince(t);
+      if (updated) {
+        at.eye = float3(eye[0], eye[1], eye[2]);
+        at.center = float3(center[0], center[1], center[2]);
+        at.up = float3(up[0], up[1], up[2]);
+      }
+      return updated;
+    };
+    // all detectors' DRRs in one round of the renderer's frames, each
+    // matched against its own reference; `at` moves to the mean of the
+    // primary poses the views' updates imply
+    auto multiViewUpdate = [&](prediction &at, bool &moved) {
+      cameras.assign(1, at);
+      for (size_t v = 0; v < numViews; ++v)
+        cameras.push_back(settings.views->pose(at, v));
+      float3 eye(0.f, 0.f, 0.f), center(0.f, 0.f, 0.f), up(0.f, 0.f, 0.f);
+      size_t numUpdated = 0;
+      const size_t numSlots = renderer.numSlots();
+      for (size_t first = 0; first < cameras.size(); first += numSlots) {
+        const size_t count = std::min(numSlots, cameras.size() - first);
+        for (size_t k = 0; k < count; ++k)
+          renderer.submit(k, cameras[first + k]);
+        for (size_t k = 0; k < count; ++k) {
+          const size_t v = first + k;
+          if (!renderer.collect(k, color, origin, &r.render))
+            return false;
+          const auto &image = v == 0 ? reference : viewReference[v - 1];
+          matchers.setReference(matcherIndex,
+              i + v * numPoses,
+              v == 0 ? poses[i].filename
+                     : settings.views->reference(poses[i].filename, v - 1),
+              make_image_view(image->data.data(),
+                  image->width,
+                  image->height,
+                  feature_matcher::PIXEL_TYPE::RGBA,
+                  true));
+          prediction camera = cameras[v];
+          if (!matchUpdate(camera))
+            continue;
+          const prediction implied =
+              v == 0 ? camera : settings.views->primary(camera, v - 1);
+          eye = eye + implied.eye;
+          center = center + implied.center;
+          up = up + anari::math::normalize(implied.up);
+          ++numUpdated;
+        }
+      }
+      moved = numUpdated > 0;
+      if (moved) {
+        at.eye = eye * (1.f / numUpdated);
+        at.center = center * (1.f / numUpdated);
+        at.up = anari::math::normalize(up);
+      }
+      return true;
+    };
+    auto renderFailed = [&]() {
+      std::cerr << "Registration stopped: pose " << i
+                << " failed to render\n";
+      return false;
+    };
+
+    // multi-start: starts seeded around the pose, one step each per round
+    // and the better half by the similarity of their DRRs kept (successive
+    // halving), until one is left to converge. A round's DRRs render
+    // together in the renderer's frames.
+    if (settings.starts.count > 1) {
+      TRACE_SCOPE("evaluation", "multi-start");
+      PoseSamplerSettings seeds = settings.starts;
+      seeds.seed += i;
+      const PoseSampler sampler({pose}, seeds);
+      starts.assign(1, pose);
+      for (uint64_t k = 1; k < seeds.count; ++k)
+        starts.push_back(sampler.sample(k).pose);
+      const size_t numSlots = renderer.numSlots();
+      gradient.coarse = true;
+      while (starts.size() > 1) {
+        scores.assign(starts.size(), -1.f);
+        for (size_t first = 0; first < starts.size(); first += numSlots) {
+          const size_t count = std::min(numSlots, starts.size() - first);
+          if (!settings.gradientField) {
+            for (size_t k = 0; k < count; ++k)
+              renderer.submit(k, starts[first + k]);
+          }
+          for (size_t k = 0; k < count; ++k) {
+            auto &at = starts[first + k];
+            bool moved = false;
+            if (settings.gradientField) {
+              if (!gradient.step(at, r, moved, scores[first + k]))
+                return renderFailed();
+            } else {
+              if (!renderer.collect(k, color, origin, &r.render))
+                return renderFailed();
+              score(similarity, *reference, color, width, height, r);
+              scores[first + k] = r.ncc;
+              moved = matchUpdate(at);
+            }
+            ++r.iterations;
+            r.updated = r.updated || moved;
+          }
+        }
+        keepBetterHalf(starts, scores, rank, kept);
+      }
+      pose = starts.front();
+    }
+
+    // sampled steps are the coarse level, refined on all pixels
+    const bool sampledLevel = settings.gradientField && gradient.samples();
+    loop.start(
+        settings.maxIterations, settings.tolerance, sampledLevel ? 2 : 1);
+    bool more = true;
+    while (more) {
+      const prediction before = pose;
+      bool moved = false;
+      if (settings.gradientField) {
+        gradient.coarse = loop.level() > 0;
+        float ncc = 0.f;
+        if (!gradient.step(pose, r, moved, ncc))
+          return renderFailed();
+      } else if (numViews) {
+        if (!multiViewUpdate(pose, moved))
+          return renderFailed();
+      } else {
+        renderer.submit(0, pose);
+        if (!renderer.collect(0, color, origin, &r.render))
+          return renderFailed();
+        moved = matchUpdate(pose);
+      }
+      ++r.iterations;
+      if (!moved)
+        break;
+
+      r.updated = true;
+      more = loop.step(before.eye, before.center, pose.eye, pose.center);
+    }
+    if (settings.gradientField || numViews) {
+      // the final pose's primary DRR for the scores
+      renderer.submit(0, pose);
+      if (!renderer.collect(0, color, origin))
+        return renderFailed();
+    }
+    score(similarity, *reference, color, width, height, r);
+
+    r.eye = {pose.eye.x, pose.eye.y, pose.eye.z};
+    r.center = {pose.center.x, pose.center.y, pose.center.z};
+    r.up = {pose.up.x, pose.up.y, pose.up.z};
+    r.poseDelta =
+        RegistrationLoop::poseDelta(p.eye, p.center, pose.eye, pose.center);
+    r.startError = RegistrationLoop::poseDelta(
+        startEye, startCenter, pose.eye, pose.center);
+    solved[i] = r.updated;
+    if (cache)
+      toCache(*cache, key, r);
+    numRegistered++;
+    numIterations += r.iterations;
+    if (r.warmStartFrom != SIZE_MAX) {
+      numWarm++;
+      warmIterations += r.iterations;
+      warmStartError += r.startError;
+      warmPredictionError += r.poseDelta;
+    }
+
+    if ((n + 1) % 100 == 0 || n + 1 == numPoses) {
+      const float seconds = msSince(start) / 1000.f;
+      printf("registered %zu / %zu predictions (%.1f per second)\n",
+          n + 1,
+          numPoses,
+          float(n + 1) / seconds);
+    }
+  }
+
+  if (numRegistered) {
+    printf("%zu registrations, %zu iterations (%.2f per prediction)\n",
+        numRegistered,
+        numIterations,
+        double(numIterations) / numRegistered);
+  }
+  // what the warm start saved: how far the start was from the result,
+  // against how far the prediction was; the iteration counts without a
+  // warm start are those of a run with "--warm-start none"
+  if (numWarm) {
+    printf("%zu warm starts, %.2f iterations each: start error %.4g, "
+           "prediction error %.4g (%.0f%% closer)\n",
+        numWarm,
+        double(warmIterations) / numWarm,
+        warmStartError / numWarm,
+        warmPredictionError / numWarm,
+        warmPredictionError > 0.0
+            ? 100.0 * (1.0 - warmStartError / warmPredictionError)
+            : 0.0);
+  }
+  return true;
+}
+
+bool writeEvaluationCsv(const std::string &fileName,
+    const prediction_container &predictions,
+    const std::vector<PoseEvaluation> &results)
+{
+  std::ofstream out(fileName);
+  if (!out) {
+    std::cerr << "ERROR: Could not write " << fileName << '\n';
+    return false;
+  }
+  out << "index,file,reference,updated,eye_x,eye_y,eye_z,center_x,center_y,"
+         "center_z,up_x,up_y,up_z,pose_delta,ncc,gradient_correlation,"
+         "mutual_information,render_ms,render_wait_ms,decode_wait_ms,"
+         "reference_ms,match_ms,iterations,warm_start_from,start_error,"
+         "cached\n";
+  for (auto &r : results) {
+    out << r.index << ',' << predictions.predictions[r.index].filename << ','
+        << r.haveReference << ',' << r.updated;
+    for (auto *v : {&r.eye, &r.center, &r.up})
+      out << ',' << (*v)[0] << ',' << (*v)[1] << ',' << (*v)[2];
+    out << ',' << r.poseDelta << ',' << r.ncc << ',' << r.gradientCorrelation
+        << ',' << r.mutualInformation << ',' << r.render.duration << ','
+        << r.render.wait << ',' << r.decodeWaitMs << ',' << r.referenceMs << ','
+        << r.matchMs << ',' << r.iterations << ','
+        << (r.warmStartFrom == SIZE_MAX ? -1 : int64_t(r.warmStartFrom)) << ','
+        << r.startError << ',' << r.cached << '\n';
+  }
+  return bool(out);
+}
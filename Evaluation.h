@@ -0,0 +1,119 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <array>
+#include <string>
+#include <vector>
+// ours
+#include "BatchRenderer.h"
+#include "ImageRoi.h"
+#include "Matcher.h"
+#include "PoseCache.h"
+#include "PoseGraph.h"
+#include "PoseSampler.h"
+#include "ViewRig.h"
+#include "prediction.h"
+
+// Result of one prediction: the matcher's pose from the DRR rendered at the
+// predicted pose, and how well that DRR matched the reference image
+struct PoseEvaluation
+{
+  size_t index{0};
+  bool haveReference{false};
+  bool updated{false}; // the matcher returned a pose
+  std::array<float, 3> eye{}, center{}, up{}; // corrected (or predicted) pose
+  float poseDelta{0.f}; // world units between predicted and corrected pose
+  float ncc{0.f}, gradientCorrelation{0.f}, mutualInformation{0.f};
+  FrameTiming render;
+  float decodeWaitMs{0.f}; // matcher thread waiting for the reference
+  float referenceMs{0.f}; // setReference (or its cache hit)
+  float matchMs{0.f}; // set_image, calibrate, match, update_camera
+  // registerPredictions(): matches run, the solved prediction the start
+  // pose came from (SIZE_MAX: its own prediction) and the distance from
+  // the start pose to the final one
+  size_t iterations{0};
+  size_t warmStartFrom{SIZE_MAX};
+  float startError{0.f};
+  bool cached{false}; // taken from the PoseCache, not rendered or matched
+};
+
+// Headless accuracy run over all predictions. Three stages overlap: a pool
+// decodes the next reference images, the renderer's frames render the next
+// poses, and a worker thread matches the previous DRR, so a prediction
+// costs its slowest stage rather than the sum. References are released
+// after their match, memory stays flat however many predictions there are.
+// matcherIndex SIZE_MAX (or no matchers) only scores the similarity.
+// Predictions found in the cache are neither rendered nor matched, those
+// matched are added to it, so a run resumes where an earlier one stopped.
+bool evaluatePredictions(BatchRenderer &renderer,
+    MatchersWrapper &matchers,
+    size_t matcherIndex,
+    const prediction_container &predictions,
+    std::vector<PoseEvaluation> &results,
+    PoseCache *cache = nullptr);
+
+// How sampled gradient steps draw their pixels
+enum class PixelSampling
+{
+  Random, // uniformly over the ROI
+  Stratified // one in each cell of a grid over the ROI
+};
+
+struct RegistrationSettings
+{
+  size_t maxIterations{10};
+  float tolerance{0.1f}; // world units, see RegistrationLoop
+  WarmStartOrder warmStart{WarmStartOrder::None};
+  // not null: the pose follows Gauss-Newton steps on the DRR Jacobians of
+  // this host field (renderDrrJacobian()) instead of the matcher's updates
+  const StructuredField *gradientField{nullptr};
+  // gradient field only: in (0, 1), the steps until the pose settles trace
+  // this fraction of the ROI's pixels, drawn anew every step, and only the
+  // remaining steps all of them; the ROI limits all steps to its pixels
+  float sampleFraction{0.f};
+  PixelSampling sampling{PixelSampling::Stratified};
+  ImageRoi roi;
+  // count > 1: multi-start, starts sampled around each start pose with
+  // these perturbations (the first is the pose itself; shard, LUTs and
+  // energies do not apply)
+  PoseSamplerSettings starts;
+  // not null: multi-view registration, the rig's detectors rendered and
+  // matched with the primary every iteration (needs a matcher)
+  const ViewRig *views{nullptr};
+};
+
+// Closed-loop registration of every prediction: render, match, update
+// until the pose settles. With a warm start the predictions run in
+// registrationOrder() and each starts from its prediction moved by the
+// correction of the nearest prediction solved so far (k-d tree over eye
+// and center), instead of from the prediction itself. The similarity
+// scores are those of the last DRR. Predictions run one after the other,
+// since each may start from the one before; references still decode ahead.
+// Cached registrations count as solved, for the warm starts of the rest.
+// With a gradient field each iteration is one Jacobian DRR and a 6x6 solve
+// rather than a render and a match; no matcher is needed then. Sampled
+// steps run as the loop's coarse level and multi-start rounds, so a start
+// is scored and brought close on a fraction of the rays and polished on
+// all of them once it settles. Multi-start runs successive halving over
+// perturbed starts before the loop: every round steps all surviving starts
+// once and drops the worse half by NCC, so k starts cost about 2k steps
+// however long the survivor then takes.
+// With a view rig every iteration renders all detectors in one round of
+// the renderer's frames, matches each against its view's reference and
+// moves the pose to the mean of the primary poses their updates imply, one
+// optimizer for all views; multi-start rounds score the primary view.
+bool registerPredictions(BatchRenderer &renderer,
+    MatchersWrapper &matchers,
+    size_t matcherIndex,
+    const prediction_container &predictions,
+    const RegistrationSettings &settings,
+    std::vector<PoseEvaluation> &results,
+    PoseCache *cache = nullptr);
+
+// One row per prediction plus a header; false if the file cannot be written
+bool writeEvaluationCsv(const std::string &fileName,
+    const prediction_container &predictions,
+    const std::vector<PoseEvaluation> &results);
@@ -0,0 +1,139 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "FieldPyramid.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+// ours
+#include "Parallel.h"
+#include "Trace.h"
+#include "VoxelTypes.h"
+
+template <typename Voxel>
+static void downsample(const typename Voxel::Storage *src,
+    const int srcDims[3],
+    typename Voxel::Storage *dst,
+    const int dstDims[3])
+{
+  using T = typename Voxel::Storage;
+  parallelFor(
+      0,
+      dstDims[2],
+      [&](size_t begin, size_t end) {
+        for (size_t z = begin; z < end; ++z) {
+          const int z0 = 2 * int(z), z1 = std::min(z0 + 1, srcDims[2] - 1);
+          for (int y = 0; y < dstDims[1]; ++y) {
+            const int y0 = 2 * y, y1 = std::min(y0 + 1, srcDims[1] - 1);
+            const T *rows[4] = {
+                src + (size_t(z0) * srcDims[1] + y0) * srcDims[0],
+                src + (size_t(z0) * srcDims[1] + y1) * srcDims[0],
+                src + (size_t(z1) * srcDims[1] + y0) * srcDims[0],
+                src + (size_t(z1) * srcDims[1] + y1) * srcDims[0]};
+            T *out = dst + (z * dstDims[1] + y) * dstDims[0];
+            for (int x = 0; x < dstDims[0]; ++x) {
+              const int x0 = 2 * x, x1 = std::min(x0 + 1, srcDims[0] - 1);
+              float sum = 0.f;
+              for (auto *row : rows)
+                sum += Voxel::count(row[x0]) + Voxel::count(row[x1]);
+              out[x] = Voxel::fromCount(sum * 0.125f);
+            }
+          }
+        }
+      },
+      1);
+}
+
+StructuredField downsampleField(const StructuredField &field)
+{
+  TRACE_SCOPE("field", "downsample");
+
+  StructuredField result;
+  result.dimX = (field.dimX + 1) / 2;
+  result.dimY = (field.dimY + 1) / 2;
+  result.dimZ = (field.dimZ + 1) / 2;
+  result.bytesPerCell = field.bytesPerCell;
+  result.isHalf = field.isHalf;
+  result.dataRange = field.dataRange;
+  for (int a = 0; a < 3; ++a) {
+    result.origin[a] = field.origin[a] + 0.5f * field.spacing[a];
+    result.spacing[a] = 2.f * field.spacing[a];
+  }
+
+  const int srcDims[3] = {field.dimX, field.dimY, field.dimZ};
+  const int dstDims[3] = {result.dimX, result.dimY, result.dimZ};
+  const size_t numVoxels = size_t(result.dimX) * result.dimY * result.dimZ;
+  dispatchVoxelType(field, [&](auto voxel) {
+    using Voxel = decltype(voxel);
+    downsample<Voxel>(voxelData<Voxel>(field),
+        srcDims,
+        allocateVoxels<Voxel>(result, numVoxels),
+        dstDims);
+  });
+  return result;
+}
+
+std::vector<StructuredField> buildFieldPyramid(
+    const StructuredField &field, size_t numLevels)
+{
+  std::vector<StructuredField> levels;
+  levels.reserve(numLevels);
+  const StructuredField *src = &field;
+  for (size_t l = 0; l < numLevels && !src->empty(); ++l) {
+    if (src->dimX < 2 || src->dimY < 2 || src->dimZ < 2)
+      break;
+    levels.push_back(downsampleField(*src));
+    src = &levels.back();
+  }
+  return levels;
+}
+
+float pixelFootprint(const StructuredField &field, const RayCamera &camera)
+{
+  float dir[3];
+  const float length = std::sqrt(camera.dir[0] * camera.dir[0]
+      + camera.dir[1] * camera.dir[1] + camera.dir[2] * camera.dir[2]);
+  if (!(length > 0.f))
+    return 0.f;
+  for (int a = 0; a < 3; ++a)
+    dir[a] = camera.dir[a] / length;
+
+  // the nearest corner of the cells' bounds along the view direction
+  const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+  float nearest = std::numeric_limits<float>::max();
+  for (int corner = 0; corner < 8; ++corner) {
+    float depth = 0.f;
+    for (int a = 0; a < 3; ++a) {
+      const float p = field.origin[a]
+          + ((corner >> a) & 1 ? dims[a] - 0.5f : -0.5f) * field.spacing[a];
+      depth += (p - camera.eye[a]) * dir[a];
+    }
+    nearest = std::min(nearest, depth);
+  }
+  if (!(nearest > 0.f))
+    return 0.f;
+
+  // image plane extent at depth 1 covered by the frame, per pixel
+  const float planeY = 2.f * std::tan(0.5f * camera.fovy);
+  const float pixelY = planeY * (camera.region[3] - camera.region[1])
+      / float(std::max<size_t>(camera.height, 1));
+  const float pixelX = planeY * camera.aspect
+      * (camera.region[2] - camera.region[0])
+      / float(std::max<size_t>(camera.width, 1));
+  return nearest * std::min(pixelX, pixelY);
+}
+
+size_t footprintLevel(const std::vector<float> &spacings, float footprint)
+{
+  size_t level = 0;
+  while (level + 1 < spacings.size() && spacings[level + 1] <= footprint)
+    ++level;
+  return level;
+}
+
+float voxelSize(const StructuredField &field)
+{
+  return std::max({field.spacing[0], field.spacing[1], field.spacing[2]});
+}
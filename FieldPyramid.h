@@ -0,0 +1,34 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <vector>
+// ours
+#include "FieldTypes.h"
+#include "FirstHit.h"
+
+// Half-resolution copy of a field, each voxel the mean of a 2x2x2 block
+// (clamped at odd edges), built slice-parallel. Spacing doubles and the
+// origin moves to the block centers, so line integrals through the copy
+// approximate those through the full volume, which is all a DRR needs.
+StructuredField downsampleField(const StructuredField &field);
+
+// Levels 1..numLevels of the field's pyramid, level 0 being the field
+// itself; stops early once an axis is down to one voxel
+std::vector<StructuredField> buildFieldPyramid(
+    const StructuredField &field, size_t numLevels);
+
+// Size in object space of one pixel of `camera`'s frames at the depth where
+// the field's bounds come nearest the eye: voxels no larger than that
+// project to at most a pixel anywhere in the frame. 0 if the bounds reach
+// the eye's plane, where voxels project arbitrarily large.
+float pixelFootprint(const StructuredField &field, const RayCamera &camera);
+
+// Coarsest level whose voxels (the largest spacing of each level, finest
+// first, level 0 the field itself) are at most `footprint` across. A DRR
+// from it integrates the same sub-pixel structures as one from the full
+// field, at 1/8 of the bandwidth per level.
+size_t footprintLevel(const std::vector<float> &spacings, float footprint);
+float voxelSize(const StructuredField &field); // largest spacing
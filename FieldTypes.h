@@ -4,32 +4,124 @@
 #pragma once
 
 // std
+#include <cstdint>
+#include <memory>
 #include <vector>
+// ours
+#include "VolumeMemory.h"
+
+// Macrocell grid ////////////////////////////////////////////////////////////
+//
+// Value range of each cellSize^3 block of voxels, including the voxels shared
+// with the next cell so trilinear samples inside a cell stay in its range.
+// Renderers skip cells whose range maps to zero attenuation and clip rays to
+// the bounds of the non-empty cells.
+struct MacrocellGrid
+{
+  int cellSize{0};
+  int dims[3]{0, 0, 0}; // cells per axis
+  std::vector<float> minMax; // min, max per cell, x-fastest
+  // voxel bounds (inclusive) of the cells with max > 0; lower > upper when
+  // every cell is empty
+  int lower[3]{0, 0, 0};
+  int upper[3]{-1, -1, -1};
+
+  bool empty() const
+  {
+    return minMax.empty();
+  }
+
+  size_t bytes() const
+  {
+    return minMax.size() * sizeof(float);
+  }
+};
+
+// Value histogram ///////////////////////////////////////////////////////////
+//
+// Equal-width bins over [lower, upper], the exact value range of a field;
+// computed by the readers while converting or scanning the voxels anyway
+// and shown in the settings editor for windowing.
+struct ValueHistogram
+{
+  static constexpr int defaultBins = 4096;
+
+  float lower{0.f};
+  float upper{0.f};
+  std::vector<uint64_t> bins;
+
+  bool empty() const
+  {
+    return bins.empty();
+  }
+
+  size_t bytes() const
+  {
+    return bins.size() * sizeof(uint64_t);
+  }
+};
 
 // Structured field type //////////////////////////////////////////////////////
 struct StructuredField
 {
-  std::vector<uint8_t> dataUI8;
-  std::vector<uint16_t> dataUI16;
-  std::vector<float> dataF32;
+  // Voxels, x fastest, in one buffer shared by all copies of the field:
+  // copying a field copies its layout and a reference, never the voxels.
+  // Owned by the heap (allocate()) or e.g. an mmap'd file (mapped). Once the
+  // field has been handed on, the voxels are read-only.
+  std::shared_ptr<const void> voxels;
+  bool mapped{false}; // voxels live in a file mapping
   int dimX{0};
   int dimY{0};
   int dimZ{0};
   unsigned bytesPerCell{0};
+  // 2-byte cells hold IEEE half floats instead of normalized uint16
+  bool isHalf{false};
   struct
   {
     float x, y;
   } dataRange;
+  // object-space position of voxel (0, 0, 0) and voxel size; cropped
+  // volumes keep the origin of their first voxel in the full volume
+  float origin[3]{0.f, 0.f, 0.f};
+  float spacing[3]{1.f, 1.f, 1.f};
+  // empty unless the reader computed one (NIfTI attenuation fields)
+  MacrocellGrid macrocells;
+  // empty unless the reader computed one (attenuation and RAW fields)
+  ValueHistogram histogram;
+
+  const void *data() const
+  {
+    return voxels.get();
+  }
 
   bool empty() const
   {
-    if (bytesPerCell == 1 && dataUI8.empty())
-      return true;
-    if (bytesPerCell == 2 && dataUI16.empty())
-      return true;
-    if (bytesPerCell == 4 && dataF32.empty())
-      return true;
-    return false;
+    return !voxels;
   }
-};
 
+  size_t numCells() const
+  {
+    return size_t(dimX) * dimY * dimZ;
+  }
+
+  size_t voxelBytes() const
+  {
+    return voxels ? numCells() * bytesPerCell : 0;
+  }
+
+  // A new zero-filled buffer for numCells cells of bytesPerCell bytes
+  // (VolumeMemory.h), replacing the reference to the old one (which other
+  // copies keep); written through the pointer returned before the field is
+  // handed on, best by parallel threads (NUMA placement). nullptr for an
+  // unknown cell size.
+  void *allocate(size_t numCells)
+  {
+    voxels.reset();
+    mapped = false;
+    if (bytesPerCell != 1 && bytesPerCell != 2 && bytesPerCell != 4)
+      return nullptr;
+    auto buffer = allocateVolumeMemory(numCells * bytesPerCell);
+    voxels = buffer;
+    return buffer.get();
+  }
+};
@@ -0,0 +1,1403 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "FirstHit.h"
+// std
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+// ours
+#include "BlockQuantized.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include "VoxelTypes.h"
+
+namespace {
+
+// Rays marched in lockstep; the per-lane loops below are plain arithmetic
+// over fixed-size arrays, which the compiler vectorizes (the voxel fetches
+// in between are gathers)
+constexpr int PacketSize = 8;
+
+// Voxels of one type (VoxelTypes.h) in render units, x fastest
+template <typename Voxel>
+struct Voxels
+{
+  const typename Voxel::Storage *data;
+  size_t sy, sz;
+  float operator()(int x, int y, int z) const
+  {
+    return Voxel::value(data[x + y * sy + z * sz]);
+  }
+};
+
+// The same in the order of a ReorderedVoxels copy
+template <typename Voxel>
+struct OrderedVoxels
+{
+  const typename Voxel::Storage *data;
+  const size_t *offset[3];
+  float operator()(int x, int y, int z) const
+  {
+    return Voxel::value(data[offset[0][x] + offset[1][y] + offset[2][z]]);
+  }
+};
+
+// The same decoded from a block-quantized copy (BlockQuantized.h), Bits 8
+// or 4, so each read is a block lookup without expanding the volume
+template <int Bits>
+struct QuantizedVoxels
+{
+  const uint8_t *blocks;
+  int dims[3];
+  float operator()(int x, int y, int z) const
+  {
+    return quantizedVoxel(blocks, dims, Bits, x, y, z);
+  }
+};
+
+// The settings' quantized copy if it has the field's grid, else null
+const QuantizedVolume *quantizedOf(
+    const StructuredField &field, const FirstHitSettings &settings)
+{
+  const QuantizedVolume *quantized = settings.quantized;
+  if (!quantized || quantized->empty() || quantized->dims[0] != field.dimX
+      || quantized->dims[1] != field.dimY || quantized->dims[2] != field.dimZ)
+    return nullptr;
+  return quantized;
+}
+
+// Voxels to march: the field's own or the settings' quantized copy of them
+bool hasVoxels(const StructuredField &field, const FirstHitSettings &settings)
+{
+  return (field.data() && !field.empty()) || quantizedOf(field, settings);
+}
+
+// Calls func with the field's voxels as the marchers read them: from the
+// settings' quantized copy if it has the field's grid, else from the
+// reordered copy if it was made from the field, else from the field; false
+// for unknown voxel types
+template <typename Func>
+bool dispatchVoxels(
+    const StructuredField &field, const FirstHitSettings &settings, Func &&func)
+{
+  if (const QuantizedVolume *quantized = quantizedOf(field, settings)) {
+    const int *dims = quantized->dims;
+    if (quantized->bits == 4) {
+      func(QuantizedVoxels<4>{
+          quantized->blocks.data(), {dims[0], dims[1], dims[2]}});
+    } else {
+      func(QuantizedVoxels<8>{
+          quantized->blocks.data(), {dims[0], dims[1], dims[2]}});
+    }
+    return true;
+  }
+  const ReorderedVoxels *reordered = settings.voxels;
+  return dispatchVoxelType(field, [&](auto voxel) {
+    using Voxel = decltype(voxel);
+    using Storage = typename Voxel::Storage;
+    if (reordered && reordered->matches(field)) {
+      func(OrderedVoxels<Voxel>{
+          static_cast<const Storage *>(reordered->voxels.get()),
+          {reordered->offset[0].data(),
+              reordered->offset[1].data(),
+              reordered->offset[2].data()}});
+    } else {
+      func(Voxels<Voxel>{voxelData<Voxel>(field),
+          size_t(field.dimX),
+          size_t(field.dimX) * field.dimY});
+    }
+  });
+}
+
+// The field in voxel coordinates, where voxel (i, j, k) sits at (i, j, k)
+struct Grid
+{
+  int dims[3];
+  float origin[3];
+  float spacing[3];
+  float lower[3]; // bounds rays are clipped to
+  float upper[3];
+};
+
+// Clamped trilinear sample
+template <typename Voxels>
+float sample(const Voxels &voxels, const int dims[3], const float p[3])
+{
+  int i0[3], i1[3];
+  float f[3];
+  for (int a = 0; a < 3; ++a) {
+    const float x = std::clamp(p[a], 0.f, float(dims[a] - 1));
+    i0[a] = std::min(int(x), std::max(dims[a] - 2, 0));
+    i1[a] = std::min(i0[a] + 1, dims[a] - 1);
+    f[a] = x - i0[a];
+  }
+  const float c00 = voxels(i0[0], i0[1], i0[2]) * (1.f - f[0])
+      + voxels(i1[0], i0[1], i0[2]) * f[0];
+  const float c10 = voxels(i0[0], i1[1], i0[2]) * (1.f - f[0])
+      + voxels(i1[0], i1[1], i0[2]) * f[0];
+  const float c01 = voxels(i0[0], i0[1], i1[2]) * (1.f - f[0])
+      + voxels(i1[0], i0[1], i1[2]) * f[0];
+  const float c11 = voxels(i0[0], i1[1], i1[2]) * (1.f - f[0])
+      + voxels(i1[0], i1[1], i1[2]) * f[0];
+  const float c0 = c00 * (1.f - f[1]) + c10 * f[1];
+  const float c1 = c01 * (1.f - f[1]) + c11 * f[1];
+  return c0 * (1.f - f[2]) + c1 * f[2];
+}
+
+// Clamped trilinear sample as sample() gives it, and its gradient in voxel
+// coordinates
+template <typename Voxels>
+float sampleGradient(
+    const Voxels &voxels, const int dims[3], const float p[3], float g[3])
+{
+  int i0[3], i1[3];
+  float f[3];
+  for (int a = 0; a < 3; ++a) {
+    const float x = std::clamp(p[a], 0.f, float(dims[a] - 1));
+    i0[a] = std::min(int(x), std::max(dims[a] - 2, 0));
+    i1[a] = std::min(i0[a] + 1, dims[a] - 1);
+    f[a] = x - i0[a];
+  }
+  const float c000 = voxels(i0[0], i0[1], i0[2]);
+  const float c100 = voxels(i1[0], i0[1], i0[2]);
+  const float c010 = voxels(i0[0], i1[1], i0[2]);
+  const float c110 = voxels(i1[0], i1[1], i0[2]);
+  const float c001 = voxels(i0[0], i0[1], i1[2]);
+  const float c101 = voxels(i1[0], i0[1], i1[2]);
+  const float c011 = voxels(i0[0], i1[1], i1[2]);
+  const float c111 = voxels(i1[0], i1[1], i1[2]);
+  auto lerp = [](float a, float b, float t) { return a + (b - a) * t; };
+
+  const float c00 = lerp(c000, c100, f[0]), c10 = lerp(c010, c110, f[0]);
+  const float c01 = lerp(c001, c101, f[0]), c11 = lerp(c011, c111, f[0]);
+  const float c0 = lerp(c00, c10, f[1]), c1 = lerp(c01, c11, f[1]);
+  g[0] = lerp(lerp(c100 - c000, c110 - c010, f[1]),
+      lerp(c101 - c001, c111 - c011, f[1]),
+      f[2]);
+  g[1] = lerp(c10 - c00, c11 - c01, f[2]);
+  g[2] = c1 - c0;
+  return lerp(c0, c1, f[2]);
+}
+
+// The settings' deformation if it has control points, else null
+const DeformationGrid *deformationOf(const FirstHitSettings &settings)
+{
+  const auto *deformation = settings.deformation;
+  return deformation && !deformation->empty() ? deformation : nullptr;
+}
+
+// Where the deformed field is read for voxel-space point p: p + u(x) in
+// voxels, at x = origin + p * spacing; false if that is outside the grid.
+// jacobian, if not null, receives du/dx at x.
+bool warp(const Grid &grid,
+    const DeformationGrid &deformation,
+    const float p[3],
+    float q[3],
+    float *jacobian = nullptr)
+{
+  float x[3], u[3];
+  for (int a = 0; a < 3; ++a)
+    x[a] = grid.origin[a] + p[a] * grid.spacing[a];
+  deformation.displacement(x, u, jacobian);
+  bool inside = true;
+  for (int a = 0; a < 3; ++a) {
+    q[a] = p[a] + u[a] / grid.spacing[a];
+    inside = inside && q[a] >= 0.f && q[a] <= float(grid.dims[a] - 1);
+  }
+  return inside;
+}
+
+void normalize(float v[3])
+{
+  const float len = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  if (len > 0.f) {
+    for (int a = 0; a < 3; ++a)
+      v[a] /= len;
+  }
+}
+
+void cross(const float a[3], const float b[3], float out[3])
+{
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Screen axes of the camera, scaled to the image plane at distance 1
+struct Frustum
+{
+  float dir[3];
+  float right[3];
+  float up[3];
+
+  explicit Frustum(const RayCamera &camera)
+  {
+    std::copy_n(camera.dir, 3, dir);
+    normalize(dir);
+    cross(dir, camera.up, right);
+    normalize(right);
+    cross(right, dir, up);
+    const float halfY = std::tan(0.5f * camera.fovy);
+    const float halfX = halfY * camera.aspect;
+    for (int a = 0; a < 3; ++a) {
+      right[a] *= 2.f * halfX;
+      up[a] *= 2.f * halfY;
+    }
+  }
+};
+
+// Per-sample hook of the lane loops below, given the lane, the sample's
+// share of the integral and where it was taken: a point in voxels
+// (Sampled) or the cell's voxel index (Siddon). Plain integrals need none.
+struct NoTally
+{
+  void operator()(int, float, float, float, float) const {}
+  void operator()(int, float, int64_t) const {}
+};
+
+// Rays of one packet: start in voxels, direction per lane in voxels per unit
+// of object-space distance, and the parametric range within the bounds
+// (tEnd < t for lanes that miss them)
+struct Packet
+{
+  float o[3];
+  float d[3][PacketSize];
+  float t[PacketSize];
+  float tEnd[PacketSize];
+};
+
+void initPacket(const Grid &grid,
+    const RayCamera &camera,
+    const Frustum &frustum,
+    const float *pixels,
+    size_t count,
+    Packet &packet)
+{
+  for (int a = 0; a < 3; ++a)
+    packet.o[a] = (camera.eye[a] - grid.origin[a]) / grid.spacing[a];
+
+  for (int l = 0; l < PacketSize; ++l) {
+    const size_t i = std::min(size_t(l), count - 1); // unused lanes repeat
+    const float u = camera.region[0]
+        + pixels[i * 2] / camera.width * (camera.region[2] - camera.region[0]);
+    const float v = camera.region[1]
+        + pixels[i * 2 + 1] / camera.height
+            * (camera.region[3] - camera.region[1]);
+    float dir[3];
+    for (int a = 0; a < 3; ++a) {
+      dir[a] = frustum.dir[a] + (u - 0.5f) * frustum.right[a]
+          + (v - 0.5f) * frustum.up[a];
+    }
+    normalize(dir);
+
+    float t0 = 0.f, t1 = std::numeric_limits<float>::max();
+    for (int a = 0; a < 3; ++a) {
+      float dv = dir[a] / grid.spacing[a];
+      if (std::abs(dv) < 1e-20f)
+        dv = 1e-20f;
+      packet.d[a][l] = dv;
+      const float ta = (grid.lower[a] - packet.o[a]) / dv;
+      const float tb = (grid.upper[a] - packet.o[a]) / dv;
+      t0 = std::max(t0, std::min(ta, tb));
+      t1 = std::min(t1, std::max(ta, tb));
+    }
+    packet.t[l] = t0;
+    packet.tEnd[l] = t0 <= t1 ? t1 : -1.f; // missing the bounds: done at once
+  }
+}
+
+// Trilinear samples every settings.step voxels, the integral summed step by
+// step. Lanes end where they leave the bounds or once the integral reaches
+// `stop`; hit receives where it reached settings.threshold (NaN if never).
+template <typename Voxels, typename Tally>
+void sampleLanes(const Voxels &voxels,
+    const Grid &grid,
+    Packet &packet,
+    const FirstHitSettings &settings,
+    float stop,
+    float acc[PacketSize],
+    float hit[PacketSize],
+    const Tally &tally)
+{
+  constexpr int P = PacketSize;
+  const float minSpacing =
+      std::min({grid.spacing[0], grid.spacing[1], grid.spacing[2]});
+  const float dt = std::max(settings.step, 1e-3f) * minSpacing;
+  const float threshold = settings.threshold;
+  const DeformationGrid *deformation = deformationOf(settings);
+  const float *o = packet.o;
+  auto &d = packet.d;
+  float *t = packet.t, *tEnd = packet.tEnd;
+
+  for (;;) {
+    float p[3][P], value[P];
+    int active = 0;
+    for (int l = 0; l < P; ++l) {
+      active += t[l] <= tEnd[l];
+      for (int a = 0; a < 3; ++a)
+        p[a][l] = o[a] + t[l] * d[a][l];
+    }
+    if (!active)
+      break;
+
+    for (int l = 0; l < P; ++l) {
+      float q[3] = {p[0][l], p[1][l], p[2][l]};
+      bool inside = t[l] <= tEnd[l];
+      if (deformation && inside) {
+        // the tally sees where the field was read
+        inside = warp(grid, *deformation, q, q);
+        for (int a = 0; a < 3; ++a)
+          p[a][l] = q[a];
+      }
+      value[l] = inside ? sample(voxels, grid.dims, q) : 0.f;
+    }
+
+    for (int l = 0; l < P; ++l) {
+      const bool live = t[l] <= tEnd[l];
+      const float step = live ? std::max(value[l], 0.f) * dt : 0.f;
+      if (step > 0.f)
+        tally(l, step, p[0][l], p[1][l], p[2][l]);
+      const float next = acc[l] + step;
+      // where within the step the integral reaches the threshold
+      const bool crossed = live && acc[l] < threshold && next >= threshold;
+      const float f = step > 0.f ? (threshold - acc[l]) / step : 0.f;
+      hit[l] = crossed ? t[l] + std::clamp(f, 0.f, 1.f) * dt : hit[l];
+      acc[l] = next;
+      t[l] = next >= stop ? tEnd[l] + 1.f : t[l] + dt;
+    }
+  }
+}
+
+// Exact path lengths: voxels are constant cells around their centers, and
+// the lanes step from cell boundary to cell boundary (Jacobs et al.'s
+// incremental form of Siddon's algorithm), one voxel read per cell crossed.
+// The packet's range must span the cells, half a voxel beyond the centers.
+// Same outputs as sampleLanes(), the hit interpolated within its cell.
+template <typename Voxels, typename Tally>
+void siddonLanes(const Voxels &voxels,
+    const Grid &grid,
+    Packet &packet,
+    const FirstHitSettings &settings,
+    float stop,
+    float acc[PacketSize],
+    float hit[PacketSize],
+    const Tally &tally)
+{
+  constexpr int P = PacketSize;
+  const float threshold = settings.threshold;
+  const float *o = packet.o;
+  auto &d = packet.d;
+  float *t = packet.t, *tEnd = packet.tEnd;
+
+  int lo[3], hi[3];
+  int64_t stride[3] = {1, grid.dims[0], int64_t(grid.dims[0]) * grid.dims[1]};
+  for (int a = 0; a < 3; ++a) {
+    lo[a] = int(grid.lower[a] + 0.5f);
+    hi[a] = int(grid.upper[a] - 0.5f);
+  }
+
+  // per lane: the cell, the t of the next boundary and between boundaries
+  // on each axis, and the cell's voxel index
+  int cell[3][P], step[3][P];
+  float tNext[3][P], tDelta[3][P];
+  int64_t index[P];
+  for (int l = 0; l < P; ++l) {
+    index[l] = 0;
+    for (int a = 0; a < 3; ++a) {
+      const float p = o[a] + t[l] * d[a][l];
+      // entry points on a face round into the cell behind it
+      cell[a][l] = std::clamp(int(std::floor(p + 0.5f)), lo[a], hi[a]);
+      step[a][l] = d[a][l] > 0.f ? 1 : -1;
+      tNext[a][l] = (cell[a][l] + 0.5f * step[a][l] - o[a]) / d[a][l];
+      tDelta[a][l] = 1.f / std::abs(d[a][l]);
+      index[l] += cell[a][l] * stride[a];
+    }
+  }
+
+  for (;;) {
+    int active = 0;
+    for (int l = 0; l < P; ++l)
+      active += t[l] < tEnd[l];
+    if (!active)
+      break;
+
+    float value[P];
+    for (int l = 0; l < P; ++l)
+      value[l] = t[l] < tEnd[l]
+          ? voxels(cell[0][l], cell[1][l], cell[2][l])
+          : 0.f;
+
+    for (int l = 0; l < P; ++l) {
+      const bool live = t[l] < tEnd[l];
+      // the axis whose boundary comes first
+      const int a = tNext[0][l] <= tNext[1][l]
+          ? (tNext[0][l] <= tNext[2][l] ? 0 : 2)
+          : (tNext[1][l] <= tNext[2][l] ? 1 : 2);
+      const float exit = std::min(tNext[a][l], tEnd[l]);
+      const float length = std::max(exit - t[l], 0.f);
+      const float segment = live ? std::max(value[l], 0.f) * length : 0.f;
+      if (segment > 0.f)
+        tally(l, segment, index[l]);
+      const float next = acc[l] + segment;
+      const bool crossed = live && acc[l] < threshold && next >= threshold;
+      const float f = segment > 0.f ? (threshold - acc[l]) / segment : 0.f;
+      hit[l] = crossed ? t[l] + std::clamp(f, 0.f, 1.f) * length : hit[l];
+      acc[l] = next;
+
+      cell[a][l] += step[a][l];
+      index[l] += step[a][l] * stride[a];
+      tNext[a][l] += tDelta[a][l];
+      const bool inside = cell[a][l] >= lo[a] && cell[a][l] <= hi[a];
+      t[l] = live && inside && next < stop ? exit : tEnd[l];
+    }
+  }
+}
+
+// The integrals along a packet of rays with the settings' projector
+template <typename Voxels, typename Tally = NoTally>
+void tracePacket(const Voxels &voxels,
+    const Grid &grid,
+    const RayCamera &camera,
+    const Frustum &frustum,
+    const float *pixels,
+    size_t count,
+    const FirstHitSettings &settings,
+    float stop,
+    Packet &packet,
+    float acc[PacketSize],
+    float hit[PacketSize],
+    const Tally &tally = {})
+{
+  for (int l = 0; l < PacketSize; ++l) {
+    acc[l] = 0.f;
+    hit[l] = std::numeric_limits<float>::quiet_NaN();
+  }
+  if (settings.projector == Projector::Siddon && !deformationOf(settings)) {
+    Grid cells = grid;
+    for (int a = 0; a < 3; ++a) {
+      cells.lower[a] -= 0.5f;
+      cells.upper[a] += 0.5f;
+    }
+    initPacket(cells, camera, frustum, pixels, count, packet);
+    siddonLanes(voxels, cells, packet, settings, stop, acc, hit, tally);
+  } else {
+    initPacket(grid, camera, frustum, pixels, count, packet);
+    sampleLanes(voxels, grid, packet, settings, stop, acc, hit, tally);
+  }
+}
+
+// Object-space point at t along lane l, NaN for NaN
+void lanePoint(
+    const Grid &grid, const Packet &packet, int l, float t, float *point)
+{
+  for (int a = 0; a < 3; ++a) {
+    point[a] = std::isnan(t) ? std::numeric_limits<float>::quiet_NaN()
+                             : grid.origin[a]
+            + (packet.o[a] + t * packet.d[a][l]) * grid.spacing[a];
+  }
+}
+
+template <typename Voxels>
+void marchPacket(const Voxels &voxels,
+    const Grid &grid,
+    const RayCamera &camera,
+    const Frustum &frustum,
+    const float *pixels,
+    size_t count,
+    float *points,
+    const FirstHitSettings &settings)
+{
+  Packet packet;
+  float acc[PacketSize], hit[PacketSize];
+  tracePacket(voxels,
+      grid,
+      camera,
+      frustum,
+      pixels,
+      count,
+      settings,
+      settings.threshold,
+      packet,
+      acc,
+      hit);
+  for (size_t l = 0; l < count && l < size_t(PacketSize); ++l)
+    lanePoint(grid, packet, int(l), hit[l], points + l * 3);
+}
+
+template <typename Voxels>
+void march(const Voxels &voxels,
+    const Grid &grid,
+    const RayCamera &camera,
+    const float *pixels,
+    size_t count,
+    float *points,
+    const FirstHitSettings &settings)
+{
+  const Frustum frustum(camera);
+  const size_t numPackets = (count + PacketSize - 1) / PacketSize;
+  parallelFor(
+      0,
+      numPackets,
+      [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          const size_t first = i * PacketSize;
+          marchPacket(voxels,
+              grid,
+              camera,
+              frustum,
+              pixels + first * 2,
+              std::min<size_t>(PacketSize, count - first),
+              points + first * 3,
+              settings);
+        }
+      },
+      16);
+}
+
+// 8-bit sRGB of linear values in [0, 1], looked up in 4096 steps
+struct SrgbTable
+{
+  uint8_t values[4097];
+
+  SrgbTable()
+  {
+    for (int i = 0; i <= 4096; ++i) {
+      const float c = i / 4096.f;
+      const float s = c <= 0.0031308f
+          ? c * 12.92f
+          : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+      values[i] = uint8_t(s * 255.f + 0.5f);
+    }
+  }
+
+  uint8_t operator()(float c) const
+  {
+    return values[int(std::clamp(c, 0.f, 1.f) * 4096.f + 0.5f)];
+  }
+};
+
+// Rays in the packet integrate to where they leave the bounds, or until the
+// beam is gone (below what 8 bits resolve), recording the first hit on the
+// way
+template <typename Voxels>
+void integratePacket(const Voxels &voxels,
+    const Grid &grid,
+    const RayCamera &camera,
+    const Frustum &frustum,
+    const float *pixels,
+    size_t count,
+    uint8_t *color,
+    float *origin,
+    const FirstHitSettings &settings,
+    const SrgbTable &srgb)
+{
+  const float opaque = std::max(12.f, settings.threshold); // exp(-12): 6e-6
+  Packet packet;
+  float acc[PacketSize], hit[PacketSize];
+  tracePacket(voxels,
+      grid,
+      camera,
+      frustum,
+      pixels,
+      count,
+      settings,
+      opaque,
+      packet,
+      acc,
+      hit);
+
+  for (size_t l = 0; l < count && l < size_t(PacketSize); ++l) {
+    if (settings.linear) {
+      std::memcpy(color + l * 4, &acc[l], sizeof(float));
+    } else {
+      const uint8_t grey = srgb(std::exp(-acc[l]));
+      color[l * 4 + 0] = grey;
+      color[l * 4 + 1] = grey;
+      color[l * 4 + 2] = grey;
+      color[l * 4 + 3] = 255;
+    }
+    if (origin)
+      lanePoint(grid, packet, int(l), hit[l], origin + l * 3);
+  }
+}
+
+template <typename Voxels>
+void integrate(const Voxels &voxels,
+    const Grid &grid,
+    const RayCamera &camera,
+    uint8_t *color,
+    float *origin,
+    const FirstHitSettings &settings)
+{
+  static const SrgbTable srgb;
+  const Frustum frustum(camera);
+  const size_t width = camera.width, height = camera.height;
+  // packets of pw x ph pixels in tiles of tileW x tileH, both taken row by
+  // row; packets of tiles at the frame's edges may be short or empty
+  size_t pw = size_t(PacketSize);
+  while (pw > 1 && pw > size_t(std::max(settings.layout.packetWidth, 1)))
+    pw /= 2;
+  const size_t ph = PacketSize / pw;
+  auto roundUp = [](size_t n, size_t m) { return (n + m - 1) / m * m; };
+  const size_t tileSize = size_t(std::max(settings.layout.tileSize, 0));
+  const size_t tileW = roundUp(tileSize > 0 ? tileSize : width, pw);
+  const size_t tileH = roundUp(tileSize > 0 ? tileSize : 1, ph);
+  const size_t tilesX = (width + tileW - 1) / tileW;
+  const size_t tilesY = (height + tileH - 1) / tileH;
+  const size_t packetsPerTileRow = tileW / pw;
+  const size_t packetsPerTile = packetsPerTileRow * (tileH / ph);
+  parallelFor(
+      0,
+      tilesX * tilesY * packetsPerTile,
+      [&](size_t begin, size_t end) {
+        float pixels[PacketSize * 2];
+        size_t index[PacketSize];
+        uint8_t packetColor[PacketSize * 4];
+        float packetOrigin[PacketSize * 3];
+        for (size_t i = begin; i < end; ++i) {
+          const size_t tile = i / packetsPerTile, j = i % packetsPerTile;
+          const size_t x0 =
+              tile % tilesX * tileW + j % packetsPerTileRow * pw;
+          const size_t y0 =
+              tile / tilesX * tileH + j / packetsPerTileRow * ph;
+          size_t count = 0;
+          for (size_t y = y0; y < y0 + ph && y < height; ++y) {
+            for (size_t x = x0; x < x0 + pw && x < width; ++x) {
+              pixels[count * 2] = float(x) + 0.5f;
+              pixels[count * 2 + 1] = float(y) + 0.5f;
+              index[count++] = y * width + x;
+            }
+          }
+          if (count == 0)
+            continue;
+          integratePacket(voxels,
+              grid,
+              camera,
+              frustum,
+              pixels,
+              count,
+              packetColor,
+              origin ? packetOrigin : nullptr,
+              settings,
+              srgb);
+          for (size_t l = 0; l < count; ++l) {
+            std::copy_n(packetColor + l * 4, 4, color + index[l] * 4);
+            if (origin)
+              std::copy_n(packetOrigin + l * 3, 3, origin + index[l] * 3);
+          }
+        }
+      },
+      16);
+}
+
+// Splits the samples of a packet's lanes by the label of their voxel: the
+// nearest one to a sample point, the cell of a Siddon segment
+struct LabelTally
+{
+  const uint8_t *labels;
+  const int *dims;
+  int numChannels;
+  float (*channels)[MaxDrrChannels];
+
+  void operator()(int l, float share, float x, float y, float z) const
+  {
+    const float p[3] = {x, y, z};
+    int64_t index = 0, stride = 1;
+    for (int a = 0; a < 3; ++a) {
+      index += std::clamp(int(p[a] + 0.5f), 0, dims[a] - 1) * stride;
+      stride *= dims[a];
+    }
+    (*this)(l, share, index);
+  }
+
+  void operator()(int l, float share, int64_t index) const
+  {
+    const int c = labels[index];
+    if (c < numChannels)
+      channels[l][c] += share;
+  }
+};
+
+// The frame's integrals per label, packets along rows as integrate() runs
+// them; every ray runs to the end of the bounds, as each channel needs its
+// whole integral
+template <typename Voxels>
+void integrateChannels(const Voxels &voxels,
+    const Grid &grid,
+    const RayCamera &camera,
+    const uint8_t *labels,
+    int numChannels,
+    float *integrals,
+    const FirstHitSettings &settings)
+{
+  const Frustum frustum(camera);
+  const size_t width = camera.width, height = camera.height;
+  const size_t packetsPerRow = (width + PacketSize - 1) / PacketSize;
+  const float whole = std::numeric_limits<float>::infinity();
+  parallelFor(
+      0,
+      packetsPerRow * height,
+      [&](size_t begin, size_t end) {
+        float pixels[PacketSize * 2];
+        Packet packet;
+        float acc[PacketSize], hit[PacketSize];
+        float channels[PacketSize][MaxDrrChannels];
+        const LabelTally tally{labels, grid.dims, numChannels, channels};
+        for (size_t i = begin; i < end; ++i) {
+          const size_t y = i / packetsPerRow;
+          const size_t x0 = (i % packetsPerRow) * PacketSize;
+          const size_t count = std::min<size_t>(PacketSize, width - x0);
+          for (size_t l = 0; l < count; ++l) {
+            pixels[l * 2] = float(x0 + l) + 0.5f;
+            pixels[l * 2 + 1] = float(y) + 0.5f;
+          }
+          for (auto &c : channels)
+            std::fill_n(c, MaxDrrChannels, 0.f);
+          tracePacket(voxels,
+              grid,
+              camera,
+              frustum,
+              pixels,
+              count,
+              settings,
+              whole,
+              packet,
+              acc,
+              hit,
+              tally);
+          float *out = integrals + (y * width + x0) * numChannels;
+          for (size_t l = 0; l < count; ++l)
+            std::copy_n(channels[l], numChannels, out + l * numChannels);
+        }
+      },
+      16);
+}
+
+// Intensities and their pose derivatives along a packet of rays (see
+// renderDrrJacobian()). The derivative of a sample's position is the
+// translation itself, or for a rotation about axis k through the eye
+// t * (axis_k x dir); with the field's world gradient g that gives
+// g . axis_k and t * axis_k . (dir x g). Lanes run one after the other: the
+// gradient terms would not gain from lockstep as the integral does.
+template <typename Voxels>
+void jacobianPacket(const Voxels &voxels,
+    const Grid &grid,
+    const RayCamera &camera,
+    const Frustum &frustum,
+    const float *pixels,
+    size_t count,
+    float *intensity,
+    float *jacobian,
+    const FirstHitSettings &settings)
+{
+  Packet packet;
+  initPacket(grid, camera, frustum, pixels, count, packet);
+  float axes[3][3];
+  for (int a = 0; a < 3; ++a) {
+    axes[0][a] = frustum.right[a];
+    axes[1][a] = frustum.up[a];
+    axes[2][a] = frustum.dir[a];
+  }
+  for (auto &axis : axes)
+    normalize(axis);
+
+  const float minSpacing =
+      std::min({grid.spacing[0], grid.spacing[1], grid.spacing[2]});
+  const float dt = std::max(settings.step, 1e-3f) * minSpacing;
+  const float opaque = std::max(12.f, settings.threshold);
+  const DeformationGrid *deformation = deformationOf(settings);
+  for (size_t l = 0; l < count && l < size_t(PacketSize); ++l) {
+    float dir[3];
+    for (int a = 0; a < 3; ++a)
+      dir[a] = packet.d[a][l] * grid.spacing[a];
+    float acc = 0.f, dA[6] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+    for (float t = packet.t[l]; t <= packet.tEnd[l] && acc < opaque;
+         t += dt) {
+      float p[3], g[3], du[9];
+      for (int a = 0; a < 3; ++a)
+        p[a] = packet.o[a] + t * packet.d[a][l];
+      if (deformation && !warp(grid, *deformation, p, p, du))
+        continue;
+      const float value = sampleGradient(voxels, grid.dims, p, g);
+      if (value <= 0.f)
+        continue;
+      acc += value * dt;
+      for (int a = 0; a < 3; ++a)
+        g[a] /= grid.spacing[a];
+      if (deformation) {
+        // through the warp: (I + du/dx)^T g
+        const float w[3] = {g[0], g[1], g[2]};
+        for (int a = 0; a < 3; ++a)
+          g[a] += du[a] * w[0] + du[3 + a] * w[1] + du[6 + a] * w[2];
+      }
+      float c[3];
+      cross(dir, g, c);
+      for (int k = 0; k < 3; ++k) {
+        const float *axis = axes[k];
+        dA[k] += dt * (axis[0] * g[0] + axis[1] * g[1] + axis[2] * g[2]);
+        dA[3 + k] +=
+            dt * t * (axis[0] * c[0] + axis[1] * c[1] + axis[2] * c[2]);
+      }
+    }
+    const float transmitted = std::exp(-acc);
+    intensity[l] = transmitted;
+    for (int k = 0; k < 6; ++k)
+      jacobian[l * 6 + k] = -transmitted * dA[k];
+  }
+}
+
+// Cells of z each ray is walked through at a time by the linear projectors
+constexpr int SlabCells = 8;
+
+// Slab `slab` of the projection grid, cell bounds as siddonLanes() takes
+Grid slabCells(const ProjectionGrid &projection, int slab)
+{
+  Grid grid;
+  for (int a = 0; a < 3; ++a) {
+    grid.dims[a] = projection.dims[a];
+    grid.origin[a] = projection.origin[a];
+    grid.spacing[a] = projection.spacing[a];
+    grid.lower[a] = -0.5f;
+    grid.upper[a] = projection.dims[a] - 0.5f;
+  }
+  grid.lower[2] = slab * SlabCells - 0.5f;
+  grid.upper[2] = std::min((slab + 1) * SlabCells, grid.dims[2]) - 0.5f;
+  return grid;
+}
+
+int numSlabs(const ProjectionGrid &grid)
+{
+  return (grid.dims[2] + SlabCells - 1) / SlabCells;
+}
+
+// The cells the packet's lanes cross and the path length in each, as
+// siddonLanes() steps through them: visit(lane, voxel index, length)
+template <typename Visit>
+void siddonPath(const Grid &grid, Packet &packet, const Visit &visit)
+{
+  constexpr int P = PacketSize;
+  const float *o = packet.o;
+  auto &d = packet.d;
+  float *t = packet.t, *tEnd = packet.tEnd;
+
+  int lo[3], hi[3];
+  int64_t stride[3] = {1, grid.dims[0], int64_t(grid.dims[0]) * grid.dims[1]};
+  for (int a = 0; a < 3; ++a) {
+    lo[a] = int(grid.lower[a] + 0.5f);
+    hi[a] = int(grid.upper[a] - 0.5f);
+  }
+
+  int cell[3][P], step[3][P];
+  float tNext[3][P], tDelta[3][P];
+  int64_t index[P];
+  for (int l = 0; l < P; ++l) {
+    index[l] = 0;
+    for (int a = 0; a < 3; ++a) {
+      const float p = o[a] + t[l] * d[a][l];
+      cell[a][l] = std::clamp(int(std::floor(p + 0.5f)), lo[a], hi[a]);
+      step[a][l] = d[a][l] > 0.f ? 1 : -1;
+      tNext[a][l] = (cell[a][l] + 0.5f * step[a][l] - o[a]) / d[a][l];
+      tDelta[a][l] = 1.f / std::abs(d[a][l]);
+      index[l] += cell[a][l] * stride[a];
+    }
+  }
+
+  for (;;) {
+    int active = 0;
+    for (int l = 0; l < P; ++l)
+      active += t[l] < tEnd[l];
+    if (!active)
+      break;
+
+    for (int l = 0; l < P; ++l) {
+      if (!(t[l] < tEnd[l]))
+        continue;
+      const int a = tNext[0][l] <= tNext[1][l]
+          ? (tNext[0][l] <= tNext[2][l] ? 0 : 2)
+          : (tNext[1][l] <= tNext[2][l] ? 1 : 2);
+      const float exit = std::min(tNext[a][l], tEnd[l]);
+      const float length = exit - t[l];
+      if (length > 0.f)
+        visit(l, index[l], length);
+
+      cell[a][l] += step[a][l];
+      index[l] += step[a][l] * stride[a];
+      tNext[a][l] += tDelta[a][l];
+      const bool inside = cell[a][l] >= lo[a] && cell[a][l] <= hi[a];
+      t[l] = inside ? exit : tEnd[l];
+    }
+  }
+}
+
+// Pixel centers of packet i of a frame, packets along rows as integrate()
+// runs them; the number of pixels and the first one's index
+size_t rowPacket(
+    const RayCamera &camera, size_t i, float *pixels, size_t &first)
+{
+  const size_t width = camera.width;
+  const size_t packetsPerRow = (width + PacketSize - 1) / PacketSize;
+  const size_t y = i / packetsPerRow;
+  const size_t x0 = (i % packetsPerRow) * PacketSize;
+  const size_t count = std::min<size_t>(PacketSize, width - x0);
+  for (size_t l = 0; l < count; ++l) {
+    pixels[l * 2] = float(x0 + l) + 0.5f;
+    pixels[l * 2 + 1] = float(y) + 0.5f;
+  }
+  first = y * width + x0;
+  return count;
+}
+
+size_t numRowPackets(const RayCamera &camera)
+{
+  return (camera.width + PacketSize - 1) / PacketSize * camera.height;
+}
+
+// Packets [begin, end) of a Jacobian DRR: of the frame's rows (pixels
+// null) or of the list of `count` pixel positions
+template <typename Voxels>
+void jacobianPackets(const Voxels &voxels,
+    const Grid &grid,
+    const RayCamera &camera,
+    const float *pixels,
+    size_t count,
+    float *intensity,
+    float *jacobian,
+    const FirstHitSettings &settings,
+    size_t begin,
+    size_t end)
+{
+  const Frustum frustum(camera);
+  float rowPixels[PacketSize * 2];
+  for (size_t i = begin; i < end; ++i) {
+    size_t first = i * PacketSize;
+    size_t n = 0;
+    const float *at = rowPixels;
+    if (pixels) {
+      n = std::min<size_t>(PacketSize, count - first);
+      at = pixels + first * 2;
+    } else {
+      n = rowPacket(camera, i, rowPixels, first);
+    }
+    jacobianPacket(voxels,
+        grid,
+        camera,
+        frustum,
+        at,
+        n,
+        intensity + first,
+        jacobian + first * 6,
+        settings);
+  }
+}
+
+size_t numListPackets(size_t count)
+{
+  return (count + PacketSize - 1) / PacketSize;
+}
+
+// The field's voxel grid with the rays clipped to its non-empty macrocells
+// (grown by the largest displacement of a deformation) and the settings'
+// clip box; false for fields the rays cannot march (no
+// host voxels, all empty or clipped away)
+bool makeGrid(const StructuredField &field,
+    const FirstHitSettings &settings,
+    Grid &grid)
+{
+  const auto &cells = field.macrocells;
+  const bool allEmpty = !cells.empty() && cells.lower[0] > cells.upper[0];
+  if (!hasVoxels(field, settings) || allEmpty || field.dimX <= 0
+      || field.dimY <= 0 || field.dimZ <= 0)
+    return false;
+
+  const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+  const DeformationGrid *deformation = deformationOf(settings);
+  float bound[3] = {0.f, 0.f, 0.f};
+  if (deformation)
+    deformation->maxDisplacement(bound);
+  for (int a = 0; a < 3; ++a) {
+    grid.dims[a] = dims[a];
+    grid.origin[a] = field.origin[a];
+    grid.spacing[a] = field.spacing[a];
+    grid.lower[a] = cells.empty() ? 0.f : float(cells.lower[a]);
+    grid.upper[a] = cells.empty() ? float(dims[a] - 1)
+                                  : float(std::min(cells.upper[a], dims[a] - 1));
+    if (deformation) {
+      // points up to the largest displacement away read the bounds
+      const float reach = bound[a] / std::abs(grid.spacing[a]) + 1.f;
+      grid.lower[a] -= reach;
+      grid.upper[a] += reach;
+    }
+    float c0 = (settings.clipLower[a] - grid.origin[a]) / grid.spacing[a];
+    float c1 = (settings.clipUpper[a] - grid.origin[a]) / grid.spacing[a];
+    if (c0 > c1)
+      std::swap(c0, c1); // negative spacing
+    grid.lower[a] = std::max(grid.lower[a], c0);
+    grid.upper[a] = std::min(grid.upper[a], c1);
+    if (!(grid.lower[a] <= grid.upper[a]))
+      return false;
+  }
+  return true;
+}
+
+} // namespace
+
+void marchFirstHits(const StructuredField &field,
+    const RayCamera &camera,
+    const float *pixels,
+    size_t count,
+    float *points,
+    const FirstHitSettings &settings)
+{
+  TRACE_SCOPE("volume", "first hits");
+  Grid grid;
+  if (!makeGrid(field, settings, grid)) {
+    std::fill_n(points, count * 3, std::numeric_limits<float>::quiet_NaN());
+    return;
+  }
+
+  const bool known = dispatchVoxels(field, settings, [&](const auto &voxels) {
+    march(voxels,
+        grid,
+        camera,
+        pixels,
+        count,
+        points,
+        settings);
+  });
+  if (!known)
+    std::fill_n(points, count * 3, std::numeric_limits<float>::quiet_NaN());
+}
+
+bool renderDrr(const StructuredField &field,
+    const RayCamera &camera,
+    uint8_t *color,
+    float *origin,
+    const FirstHitSettings &settings)
+{
+  TRACE_SCOPE("volume", "integrate DRR");
+  const size_t numPixels = camera.width * camera.height;
+  Grid grid;
+  if (!makeGrid(field, settings, grid)) {
+    // nothing attenuates: the open beam, no hits
+    const bool ok = hasVoxels(field, settings);
+    if (settings.linear) {
+      const float integral = ok ? 0.f : std::numeric_limits<float>::infinity();
+      std::fill_n(reinterpret_cast<float *>(color), numPixels, integral);
+    } else {
+      std::fill_n(color, numPixels * 4, uint8_t(ok ? 255 : 0));
+    }
+    if (origin) {
+      std::fill_n(
+          origin, numPixels * 3, std::numeric_limits<float>::quiet_NaN());
+    }
+    return ok;
+  }
+
+  return dispatchVoxels(field, settings, [&](const auto &voxels) {
+    integrate(voxels,
+        grid,
+        camera,
+        color,
+        origin,
+        settings);
+  });
+}
+
+bool renderDrrChannels(const StructuredField &field,
+    const uint8_t *labels,
+    const RayCamera &camera,
+    int numChannels,
+    float *integrals,
+    const FirstHitSettings &settings)
+{
+  TRACE_SCOPE("volume", "integrate DRR channels");
+  const size_t numPixels = camera.width * camera.height;
+  numChannels = std::clamp(numChannels, 1, MaxDrrChannels);
+  std::fill_n(integrals, numPixels * numChannels, 0.f);
+  Grid grid;
+  if (!labels || !makeGrid(field, settings, grid))
+    return labels && hasVoxels(field, settings);
+
+  return dispatchVoxels(field, settings, [&](const auto &voxels) {
+    integrateChannels(voxels,
+        grid,
+        camera,
+        labels,
+        numChannels,
+        integrals,
+        settings);
+  });
+}
+
+bool renderDrrJacobian(const StructuredField &field,
+    const RayCamera &camera,
+    float *intensity,
+    float *jacobian,
+    const FirstHitSettings &settings)
+{
+  TRACE_SCOPE("volume", "integrate DRR Jacobian");
+  const size_t numPixels = camera.width * camera.height;
+  Grid grid;
+  if (!makeGrid(field, settings, grid)) {
+    const bool ok = hasVoxels(field, settings);
+    std::fill_n(intensity, numPixels, ok ? 1.f : 0.f);
+    std::fill_n(jacobian, numPixels * 6, 0.f);
+    return ok;
+  }
+
+  return dispatchVoxels(field, settings, [&](const auto &voxels) {
+    parallelFor(
+        0,
+        numRowPackets(camera),
+        [&](size_t begin, size_t end) {
+          jacobianPackets(voxels,
+              grid,
+              camera,
+              nullptr,
+              0,
+              intensity,
+              jacobian,
+              settings,
+              begin,
+              end);
+        },
+        4);
+  });
+}
+
+bool renderDrrJacobianAt(const StructuredField &field,
+    const RayCamera &camera,
+    const float *pixels,
+    size_t count,
+    float *intensity,
+    float *jacobian,
+    const FirstHitSettings &settings)
+{
+  TRACE_SCOPE("volume", "integrate sampled DRR Jacobian");
+  Grid grid;
+  if (!makeGrid(field, settings, grid)) {
+    const bool ok = hasVoxels(field, settings);
+    std::fill_n(intensity, count, ok ? 1.f : 0.f);
+    std::fill_n(jacobian, count * 6, 0.f);
+    return ok;
+  }
+
+  return dispatchVoxels(field, settings, [&](const auto &voxels) {
+    parallelFor(
+        0,
+        numListPackets(count),
+        [&](size_t begin, size_t end) {
+          jacobianPackets(voxels,
+              grid,
+              camera,
+              pixels,
+              count,
+              intensity,
+              jacobian,
+              settings,
+              begin,
+              end);
+        },
+        4);
+  });
+}
+
+JacobianRenderer::JacobianRenderer(const StructuredField &field,
+    const FirstHitSettings &settings,
+    size_t numThreads)
+    : m_hasVoxels(hasVoxels(field, settings)), m_pool(numThreads)
+{
+  Grid grid;
+  if (!makeGrid(field, settings, grid))
+    return;
+  dispatchVoxels(field, settings, [&](const auto &voxels) {
+    m_kernel = [voxels, grid, settings](const RayCamera &camera,
+                   const float *pixels,
+                   size_t count,
+                   float *intensity,
+                   float *jacobian,
+                   size_t begin,
+                   size_t end) {
+      jacobianPackets(voxels,
+          grid,
+          camera,
+          pixels,
+          count,
+          intensity,
+          jacobian,
+          settings,
+          begin,
+          end);
+    };
+  });
+}
+
+bool JacobianRenderer::render(
+    const RayCamera &camera, float *intensity, float *jacobian)
+{
+  TRACE_SCOPE("volume", "integrate DRR Jacobian");
+  return run(camera,
+      nullptr,
+      camera.width * camera.height,
+      numRowPackets(camera),
+      intensity,
+      jacobian);
+}
+
+bool JacobianRenderer::renderAt(const RayCamera &camera,
+    const float *pixels,
+    size_t count,
+    float *intensity,
+    float *jacobian)
+{
+  TRACE_SCOPE("volume", "integrate sampled DRR Jacobian");
+  return run(
+      camera, pixels, count, numListPackets(count), intensity, jacobian);
+}
+
+bool JacobianRenderer::run(const RayCamera &camera,
+    const float *pixels,
+    size_t count,
+    size_t numPackets,
+    float *intensity,
+    float *jacobian)
+{
+  if (!m_kernel) {
+    std::fill_n(intensity, count, m_hasVoxels ? 1.f : 0.f);
+    std::fill_n(jacobian, count * 6, 0.f);
+    return m_hasVoxels;
+  }
+
+  // chunks of a few packets to whoever is free, the caller included
+  constexpr size_t grain = 4;
+  const size_t numChunks = (numPackets + grain - 1) / grain;
+  std::atomic<size_t> next{0};
+  auto work = [&]() {
+    for (size_t c; (c = next.fetch_add(1)) < numChunks;) {
+      m_kernel(camera,
+          pixels,
+          count,
+          intensity,
+          jacobian,
+          c * grain,
+          std::min(numPackets, (c + 1) * grain));
+    }
+  };
+  const size_t numHelpers =
+      std::min(m_pool.numThreads(), numChunks > 0 ? numChunks - 1 : 0);
+  m_helpers.clear();
+  for (size_t i = 0; i < numHelpers; ++i)
+    m_helpers.push_back(m_pool.enqueue(work));
+  work();
+  for (auto &helper : m_helpers)
+    helper.wait();
+  return true;
+}
+
+ProjectionGrid ProjectionGrid::of(const StructuredField &field)
+{
+  ProjectionGrid grid;
+  grid.dims[0] = field.dimX;
+  grid.dims[1] = field.dimY;
+  grid.dims[2] = field.dimZ;
+  std::copy_n(field.origin, 3, grid.origin);
+  std::copy_n(field.spacing, 3, grid.spacing);
+  return grid;
+}
+
+size_t ProjectionGrid::numCells() const
+{
+  return size_t(std::max(dims[0], 0)) * std::max(dims[1], 0)
+      * std::max(dims[2], 0);
+}
+
+void forwardProject(const ProjectionGrid &grid,
+    const float *volume,
+    const RayCamera *cameras,
+    size_t numViews,
+    float *projections)
+{
+  TRACE_SCOPE("volume", "forward projection");
+  const int slabs = grid.numCells() ? numSlabs(grid) : 0;
+  for (size_t v = 0; v < numViews; ++v) {
+    const RayCamera &camera = cameras[v];
+    const Frustum frustum(camera);
+    std::fill_n(projections, camera.width * camera.height, 0.f);
+    parallelFor(
+        0,
+        numRowPackets(camera),
+        [&](size_t begin, size_t end) {
+          float pixels[PacketSize * 2];
+          Packet packet;
+          for (size_t i = begin; i < end; ++i) {
+            size_t first = 0;
+            const size_t count = rowPacket(camera, i, pixels, first);
+            float acc[PacketSize] = {};
+            for (int s = 0; s < slabs; ++s) {
+              const Grid cells = slabCells(grid, s);
+              initPacket(cells, camera, frustum, pixels, count, packet);
+              siddonPath(
+                  cells, packet, [&](int l, int64_t index, float length) {
+                    acc[l] += length * volume[index];
+                  });
+            }
+            std::copy_n(acc, count, projections + first);
+          }
+        },
+        16);
+    projections += camera.width * camera.height;
+  }
+}
+
+void backProject(const ProjectionGrid &grid,
+    const RayCamera *cameras,
+    size_t numViews,
+    const float *projections,
+    float *volume)
+{
+  TRACE_SCOPE("volume", "back projection");
+  std::fill_n(volume, grid.numCells(), 0.f);
+  if (!grid.numCells())
+    return;
+
+  std::vector<size_t> offsets(numViews); // of each view's projection
+  for (size_t v = 1; v < numViews; ++v) {
+    offsets[v] =
+        offsets[v - 1] + cameras[v - 1].width * cameras[v - 1].height;
+  }
+  // a thread's slabs are its own: every write stays within them
+  parallelFor(
+      0,
+      size_t(numSlabs(grid)),
+      [&](size_t begin, size_t end) {
+        float pixels[PacketSize * 2];
+        Packet packet;
+        for (size_t s = begin; s < end; ++s) {
+          const Grid cells = slabCells(grid, int(s));
+          for (size_t v = 0; v < numViews; ++v) {
+            const RayCamera &camera = cameras[v];
+            const Frustum frustum(camera);
+            const float *projection = projections + offsets[v];
+            const size_t numPackets = numRowPackets(camera);
+            for (size_t i = 0; i < numPackets; ++i) {
+              size_t first = 0;
+              const size_t count = rowPacket(camera, i, pixels, first);
+              initPacket(cells, camera, frustum, pixels, count, packet);
+              // lanes past count repeat the last pixel: they add nothing
+              float value[PacketSize] = {};
+              std::copy_n(projection + first, count, value);
+              siddonPath(
+                  cells, packet, [&](int l, int64_t index, float length) {
+                    volume[index] += length * value[l];
+                  });
+            }
+          }
+        }
+      },
+      1);
+}
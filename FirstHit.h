@@ -0,0 +1,247 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <limits>
+#include <vector>
+// ours
+#include "BlockQuantized.h"
+#include "Deformation.h"
+#include "FieldTypes.h"
+#include "ThreadPool.h"
+#include "VoxelOrder.h"
+
+// Perspective camera of a frame as the ANARI camera renders it: rays start
+// at `eye`; `region` is the camera's imageRegion (off-center detectors)
+struct RayCamera
+{
+  float eye[3]{0.f, 0.f, 0.f};
+  float dir[3]{0.f, 0.f, -1.f};
+  float up[3]{0.f, 1.f, 0.f};
+  float fovy{0.7f}; // radians
+  float aspect{1.f};
+  float region[4]{0.f, 0.f, 1.f, 1.f};
+  size_t width{1}; // full frame pixels
+  size_t height{1};
+};
+
+// How rays integrate the field
+enum class Projector
+{
+  // trilinear samples every `step`, as the ANARI renderers filter the field
+  Sampled,
+  // exact path lengths through the voxels as constant cells (Siddon-Jacobs
+  // traversal): one read per voxel crossed, the same integral at any step
+  Siddon,
+};
+
+// How renderDrr() walks the frame: packets of packetWidth x
+// (8 / packetWidth) pixels, in tiles of about tileSize x tileSize pixels
+// taken row by row (0: packets along whole rows). The images are the same
+// for every layout, only the speed differs; DrrTuning.h finds the fastest.
+struct DrrLayout
+{
+  int packetWidth{8}; // 8, 4, 2 or 1
+  int tileSize{0};
+};
+
+struct FirstHitSettings
+{
+  // line integral of the field (voxel value times object-space distance)
+  // at which a ray hits; origins of the renderer's channel are where the
+  // attenuation starts, a small threshold skips noise in the air
+  float threshold{0.05f};
+  float step{0.5f}; // in voxels of the smallest spacing (Sampled only)
+  Projector projector{Projector::Sampled};
+
+  // object-space box the rays enter and leave (a slab around the anatomy
+  // of interest skips the samples outside it); unbounded by default
+  static constexpr float Unbounded = std::numeric_limits<float>::infinity();
+  float clipLower[3]{-Unbounded, -Unbounded, -Unbounded};
+  float clipUpper[3]{Unbounded, Unbounded, Unbounded};
+
+  // warps the field while sampling; rays then always sample
+  // (Projector::Sampled: Siddon's straight cell walk has no warped form).
+  // Not owned, null or empty for none.
+  const DeformationGrid *deformation{nullptr};
+
+  DrrLayout layout; // renderDrr() only
+  // renderDrr() only: color receives the line integral as one float per
+  // pixel (the same 4 bytes) instead of RGBA8, as BatchRenderSettings::linear
+  bool linear{false};
+
+  // the field's voxels in another order (VoxelOrder.h), read instead of
+  // the field's own buffer if made from it. Not owned, null for none.
+  const ReorderedVoxels *voxels{nullptr};
+  // the field's voxels block-quantized (BlockQuantized.h), read instead of
+  // both if of the field's grid; the field needs no voxels of its own then.
+  // Not owned, null for none.
+  const QuantizedVolume *quantized{nullptr};
+};
+
+// First hits of the rays through `count` pixel positions (x, y pairs in
+// pixels of the full frame, row 0 at the bottom), three floats each; NaN
+// for rays that stay below the threshold. Rays are marched through the
+// host field in packets whose lanes step together, the packets spread over
+// threads; the macrocells' non-empty bounds clip the rays where the field
+// has them. Fields without host voxels give NaN.
+void marchFirstHits(const StructuredField &field,
+    const RayCamera &camera,
+    const float *pixels,
+    size_t count,
+    float *points,
+    const FirstHitSettings &settings = {});
+
+// The DRR of a whole frame of camera.width x camera.height pixels (row 0 at
+// the bottom), integrated on the host like marchFirstHits() marches: color
+// receives RGBA8, the transmitted intensity exp(-integral) as sRGB-encoded
+// grey (or the integral as a float with settings.linear); origin, if not
+// null, the first hits as marchFirstHits() gives them (NaN where none).
+// Rays stop once nothing of the beam is left. False for fields without host
+// voxels.
+bool renderDrr(const StructuredField &field,
+    const RayCamera &camera,
+    uint8_t *color,
+    float *origin,
+    const FirstHitSettings &settings = {});
+
+// Channels of renderDrrChannels(), at most
+constexpr int MaxDrrChannels = 16;
+
+// Per-material DRRs of a whole frame in one traversal: the line integral
+// of each ray split by the label of the voxels it passes, numChannels
+// floats per pixel (row 0 at the bottom), channel c summing label c.
+// labels: one per voxel of the field's grid, x fastest; labels of
+// numChannels and above count in no channel. Sampled rays take the label of
+// the voxel nearest to each sample, Siddon's that of each cell. Every ray
+// runs to the end of the field, as each channel needs its whole integral.
+// False for fields without host voxels.
+bool renderDrrChannels(const StructuredField &field,
+    const uint8_t *labels,
+    const RayCamera &camera,
+    int numChannels,
+    float *integrals,
+    const FirstHitSettings &settings = {});
+
+// The DRR of a whole frame as transmitted intensity exp(-integral) per
+// pixel (linear, row 0 at the bottom), and its Jacobian with respect to a
+// small motion of the camera: six floats per pixel, the derivatives for
+// translations along the camera's right, up and view axes (per world unit)
+// and for rotations about those axes through the eye (per radian). The
+// derivatives are integrated along each ray with the analytic gradient of
+// the trilinear field, so rays always sample (Projector::Sampled; Siddon's
+// constant cells have no gradient). The clipping of rays to the bounds is
+// held fixed, which is exact while the field is zero there. With a
+// deformation the gradient is taken through it, (I + du/dx)^T g. False for
+// fields without host voxels.
+bool renderDrrJacobian(const StructuredField &field,
+    const RayCamera &camera,
+    float *intensity,
+    float *jacobian,
+    const FirstHitSettings &settings = {});
+
+// The same for `count` rays only, through pixel positions as
+// marchFirstHits() takes them (x, y pairs in full frame pixels): one
+// intensity and six derivatives per position, so a sparse set of pixels
+// costs its rays and no more. Positions close together in the list share
+// packets, so sorted ones trace faster.
+bool renderDrrJacobianAt(const StructuredField &field,
+    const RayCamera &camera,
+    const float *pixels,
+    size_t count,
+    float *intensity,
+    float *jacobian,
+    const FirstHitSettings &settings = {});
+
+// Jacobian DRRs of one field rendered again and again with only the camera
+// changing, as registration loops render them. What the functions above
+// set up per call is set up once here: the field's clipped grid, the kernel
+// for its voxel type and the threads, a pool whose workers wait between
+// frames instead of being started for each. Frames of a few packets run on
+// the calling thread alone, so small ROIs and sparse samples cost their
+// rays rather than the setup. The field must outlive the renderer.
+class JacobianRenderer
+{
+ public:
+  // numThreads 0: one per hardware thread
+  explicit JacobianRenderer(const StructuredField &field,
+      const FirstHitSettings &settings = {},
+      size_t numThreads = 0);
+
+  JacobianRenderer(const JacobianRenderer &) = delete;
+  JacobianRenderer &operator=(const JacobianRenderer &) = delete;
+
+  // As renderDrrJacobian() and renderDrrJacobianAt()
+  bool render(const RayCamera &camera, float *intensity, float *jacobian);
+  bool renderAt(const RayCamera &camera,
+      const float *pixels,
+      size_t count,
+      float *intensity,
+      float *jacobian);
+
+ private:
+  // Packets [begin, end) of the frame (pixels null) or the pixel list
+  using Kernel = std::function<void(const RayCamera &camera,
+      const float *pixels,
+      size_t count,
+      float *intensity,
+      float *jacobian,
+      size_t begin,
+      size_t end)>;
+
+  bool run(const RayCamera &camera,
+      const float *pixels,
+      size_t count,
+      size_t numPackets,
+      float *intensity,
+      float *jacobian);
+
+  Kernel m_kernel; // empty if the field cannot be marched
+  bool m_hasVoxels{false};
+  ThreadPool m_pool;
+  std::vector<std::future<void>> m_helpers; // of a run, reused
+};
+
+// Linear projector pair for iterative reconstruction (SART, OS-EM) in the
+// geometry of a field: forwardProject() is A, the line integrals of a
+// float volume of constant cells per pixel (Siddon path lengths, as
+// Projector::Siddon integrates), and backProject() its transpose A^T, each
+// pixel's value spread over the cells its ray crosses by path length. Both
+// walk every ray through the same fixed slabs of z, so they see
+// bit-identical path lengths and <A x, y> = <x, A^T y> up to the order of
+// the sums. Unlike renderDrr() they are linear: negative values count and
+// rays cross the whole grid, neither clamped nor clipped to macrocells.
+struct ProjectionGrid
+{
+  int dims[3]{0, 0, 0};
+  float origin[3]{0.f, 0.f, 0.f}; // of voxel (0, 0, 0)
+  float spacing[3]{1.f, 1.f, 1.f};
+
+  static ProjectionGrid of(const StructuredField &field);
+  size_t numCells() const;
+};
+
+// projections: each view's camera.width x camera.height floats (row 0 at
+// the bottom) in turn. Views run one after the other, the rays of a view on
+// all threads.
+void forwardProject(const ProjectionGrid &grid,
+    const float *volume,
+    const RayCamera *cameras,
+    size_t numViews,
+    float *projections);
+
+// volume: grid.numCells() floats, x fastest, overwritten. Voxel-parallel:
+// each thread owns a range of slabs and traces every view's rays through
+// those only, so no two threads write the same voxel and no atomics are
+// needed; the result does not depend on the number of threads.
+void backProject(const ProjectionGrid &grid,
+    const RayCamera *cameras,
+    size_t numViews,
+    const float *projections,
+    float *volume);
@@ -0,0 +1,182 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "FrameCache.h"
+// std
+#include <cmath>
+#include <string>
+// ours
+#include "GLProgram.h"
+#include "Trace.h"
+
+namespace {
+
+// FNV-1a, as the pose cache's keys
+struct Hash
+{
+  uint64_t value{14695981039346656037ull};
+
+  void add(const void *data, size_t size)
+  {
+    auto *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i) {
+      value ^= p[i];
+      value *= 1099511628211ull;
+    }
+  }
+
+  template <typename T>
+  void add(const T &v)
+  {
+    add(&v, sizeof(v));
+  }
+
+  void add(const anari::math::float3 &v, float quantum)
+  {
+    for (float x : {v.x, v.y, v.z}) {
+      const int64_t q = std::llround(x / quantum);
+      add(q);
+    }
+  }
+};
+
+} // namespace
+
+FrameCache::FrameCache(size_t hostBytes, size_t textureBytes, float quantum)
+    : m_quantum(quantum), m_frames(hostBytes), m_textures(textureBytes)
+{
+  m_textures.setEvictCallback([](const uint64_t &, Texture &t) {
+    glDeleteTextures(1, &t.texture);
+  });
+}
+
+FrameCache::~FrameCache()
+{
+  clear();
+  if (m_framebuffer)
+    glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+uint64_t FrameCache::key(
+    const RenderCamera &camera, const FrameParameters &parameters) const
+{
+  Hash h;
+  h.add(camera.position, m_quantum);
+  h.add(camera.direction, 1e-4f);
+  h.add(camera.up, 1e-4f);
+  h.add(camera.fovy);
+  h.add(camera.aspect);
+  h.add(camera.region);
+  h.add(parameters.renderer);
+  h.add(parameters.rendererVersion);
+  h.add(parameters.worldVersion);
+  h.add(parameters.photonEnergy);
+  h.add(parameters.size.x);
+  h.add(parameters.size.y);
+  h.add(parameters.channels);
+  return h.value;
+}
+
+std::shared_ptr<const RenderedFrame> FrameCache::frame(uint64_t key)
+{
+  auto *entry = m_frames.get(key);
+  if (!entry)
+    return nullptr;
+  ++m_hits;
+  return *entry;
+}
+
+void FrameCache::putFrame(
+    uint64_t key, std::shared_ptr<const RenderedFrame> frame)
+{
+  // a budget of 0 would still keep the latest entry
+  if (m_frames.budget() == 0 || !frame)
+    return;
+  const size_t bytes = frame->color.size()
+      + frame->origin.size() * sizeof(float) + frame->depth.size();
+  m_frames.put(key, std::move(frame), bytes);
+}
+
+void FrameCache::putTexture(uint64_t key, GLuint source, int width, int height)
+{
+  if (m_textures.budget() == 0 || width <= 0 || height <= 0)
+    return;
+  TRACE_SCOPE("gl", "frame cache store");
+  Texture t;
+  t.width = width;
+  t.height = height;
+  glGenTextures(1, &t.texture);
+  glBindTexture(GL_TEXTURE_2D, t.texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D,
+      0,
+      GL_RGBA8,
+      width,
+      height,
+      0,
+      GL_RGBA,
+      GL_UNSIGNED_BYTE,
+      nullptr);
+  copy(source, t.texture, width, height);
+  m_textures.put(key, t, size_t(width) * height * 4);
+}
+
+bool FrameCache::presentTexture(
+    uint64_t key, GLuint target, int &width, int &height)
+{
+  auto *t = m_textures.get(key);
+  if (!t)
+    return false;
+  TRACE_SCOPE("gl", "frame cache hit");
+  copy(t->texture, target, t->width, t->height);
+  width = t->width;
+  height = t->height;
+  ++m_hits;
+  return true;
+}
+
+void FrameCache::clear()
+{
+  m_frames.clear();
+  m_textures.clear();
+}
+
+size_t FrameCache::hits() const
+{
+  return m_hits;
+}
+
+size_t FrameCache::numFrames() const
+{
+  return m_frames.size();
+}
+
+size_t FrameCache::numTextures() const
+{
+  return m_textures.size();
+}
+
+void FrameCache::reportMemory(MemoryReport &report) const
+{
+  report.add(MemoryReport::Host,
+      "frame cache (" + std::to_string(m_frames.size()) + " frames)",
+      m_frames.bytes());
+  report.add(MemoryReport::GL,
+      "frame cache (" + std::to_string(m_textures.size()) + " textures)",
+      m_textures.bytes());
+}
+
+void FrameCache::copy(GLuint source, GLuint target, int width, int height)
+{
+  if (!m_framebuffer)
+    glGenFramebuffers(1, &m_framebuffer);
+
+  GLStateGuard state;
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTexture2D(
+      GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, 0);
+  glBindTexture(GL_TEXTURE_2D, target);
+  glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+}
@@ -0,0 +1,84 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// glad
+#include "glad/glad.h"
+// anari
+#include <anari/anari_cpp/ext/linalg.h>
+// std
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+// ours
+#include "LruCache.h"
+#include "MemoryReport.h"
+#include "RenderThread.h"
+
+// Everything a frame depends on besides the camera
+struct FrameParameters
+{
+  int renderer{0}; // index into the viewport's renderers
+  uint64_t rendererVersion{0}; // bumped on parameter edits
+  uint64_t worldVersion{0}; // volume, LUT, window, phase
+  float photonEnergy{0.f};
+  anari::math::int2 size{0, 0};
+  unsigned channels{0}; // FrameChannel bits
+};
+
+// Rendered frames by a key of the camera pose, quantized so nearly
+// identical poses share an entry, and of the frame's parameters. Two tiers,
+// each an LRU cache under a byte budget of its own:
+//  - host: frames with all their channels, as renderFrame() gives them to
+//    the matchers; a hit skips anari::render and hands out the copy
+//  - textures: RGBA8 interactive frames as shown, copied on the GPU into a
+//    texture of their own and back into the display texture on a hit, so
+//    toggling between views neither renders nor uploads
+// Textures are created and deleted here: the cache belongs to the GL
+// thread. A budget of 0 turns its tier off.
+class FrameCache
+{
+ public:
+  // quantum: eye positions are rounded to multiples of it (world units),
+  // directions and up vectors to 1e-4
+  FrameCache(size_t hostBytes, size_t textureBytes, float quantum = 1e-3f);
+  ~FrameCache(); // needs the GL context
+
+  FrameCache(const FrameCache &) = delete;
+  FrameCache &operator=(const FrameCache &) = delete;
+
+  uint64_t key(const RenderCamera &camera,
+      const FrameParameters &parameters) const;
+
+  std::shared_ptr<const RenderedFrame> frame(uint64_t key);
+  void putFrame(uint64_t key, std::shared_ptr<const RenderedFrame> frame);
+
+  // Copies the lower left width x height pixels of `source` into the
+  // texture tier, replacing an entry of that key
+  void putTexture(uint64_t key, GLuint source, int width, int height);
+  // Copies the texture of `key` into the lower left of `target`; false on
+  // a miss
+  bool presentTexture(uint64_t key, GLuint target, int &width, int &height);
+
+  void clear();
+  size_t hits() const; // of both tiers
+  size_t numFrames() const;
+  size_t numTextures() const;
+  void reportMemory(MemoryReport &report) const;
+
+ private:
+  struct Texture
+  {
+    GLuint texture{0};
+    int width{0}, height{0};
+  };
+
+  void copy(GLuint source, GLuint target, int width, int height);
+
+  float m_quantum{1e-3f};
+  LruCache<uint64_t, std::shared_ptr<const RenderedFrame>> m_frames;
+  LruCache<uint64_t, Texture> m_textures;
+  GLuint m_framebuffer{0}; // reads the source of copies
+  size_t m_hits{0};
+};
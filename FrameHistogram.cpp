@@ -0,0 +1,444 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "FrameHistogram.h"
+// std
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+// ours
+#include "GLProgram.h"
+#include "Trace.h"
+
+// every pixel of the frame one point, off the target if not finite
+static const char *s_rangeVertexShader = R"(
+uniform highp sampler2D frame; // GLES samplers default to lowp
+uniform ivec2 size;
+flat out float value;
+
+void main()
+{
+  ivec2 p = ivec2(gl_VertexID % size.x, gl_VertexID / size.x);
+  value = texelFetch(frame, p, 0).r;
+  gl_PointSize = 1.0;
+  gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+  if (isnan(value) || isinf(value))
+    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+}
+)";
+
+// max blending: max, -min
+static const char *s_rangeFragmentShader = R"(
+flat in float value;
+out vec4 color;
+
+void main()
+{
+  color = vec4(value, -value, 0.0, 0.0);
+}
+)";
+
+static const char *s_binVertexShader = R"(
+uniform highp sampler2D frame;
+uniform highp sampler2D range;
+uniform ivec2 size;
+uniform int numBins;
+
+void main()
+{
+  ivec2 p = ivec2(gl_VertexID % size.x, gl_VertexID / size.x);
+  float v = texelFetch(frame, p, 0).r;
+  vec2 r = texelFetch(range, ivec2(0), 0).rg;
+  float lo = -r.y;
+  float extent = r.x - lo;
+  int bin = 0;
+  if (extent > 0.0)
+    bin = clamp(int((v - lo) / extent * float(numBins)), 0, numBins - 1);
+  gl_PointSize = 1.0;
+  gl_Position =
+      vec4((float(bin) + 0.5) * 2.0 / float(numBins) - 1.0, 0.0, 0.0, 1.0);
+  if (isnan(v) || isinf(v))
+    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+}
+)";
+
+// additive blending: one per pixel
+static const char *s_binFragmentShader = R"(
+out vec4 color;
+
+void main()
+{
+  color = vec4(1.0);
+}
+)";
+
+// one fragment: the window between the percentiles, as percentileWindow()
+static const char *s_windowFragmentShader = R"(
+uniform highp sampler2D bins;
+uniform highp sampler2D range;
+uniform vec2 percentiles; // 0..1
+out vec4 color;
+
+void main()
+{
+  int n = textureSize(bins, 0).x;
+  float total = 0.0;
+  for (int i = 0; i < n; ++i)
+    total += texelFetch(bins, ivec2(i, 0), 0).r;
+  vec2 r = texelFetch(range, ivec2(0), 0).rg;
+  float lo = -r.y;
+  float extent = r.x - lo;
+  if (total <= 0.0) {
+    color = vec4(0.0, 1.0, 0.0, 0.0);
+    return;
+  }
+  if (extent <= 0.0) {
+    color = vec4(lo, lo + 1.0, 0.0, 0.0);
+    return;
+  }
+  float lowCount = percentiles.x * total;
+  float highCount = percentiles.y * total;
+  int lower = -1;
+  int upper = n - 1;
+  float sum = 0.0;
+  for (int i = 0; i < n; ++i) {
+    sum += texelFetch(bins, ivec2(i, 0), 0).r;
+    if (lower < 0 && sum > lowCount)
+      lower = i;
+    if (sum >= highCount) {
+      upper = i;
+      break;
+    }
+  }
+  if (lower < 0)
+    lower = upper;
+  float step = extent / float(n);
+  color = vec4(lo + float(lower) * step, 0.0, 0.0, 0.0);
+  color.y = lo + float(upper + 1) * step;
+}
+)";
+
+static bool hasExtension(const char *name)
+{
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; ++i) {
+    const auto *extension =
+        reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+    if (extension && std::strcmp(extension, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Desktop GL 3.3 renders to and blends float textures; GLES 3 only with
+// extensions
+static bool floatBlending()
+{
+  if (!isGLES())
+    return true;
+  return hasExtension("GL_EXT_color_buffer_float")
+      && hasExtension("GL_EXT_float_blend");
+}
+
+static GLuint createTarget(GLenum internalFormat,
+    GLenum format,
+    int width,
+    GLuint framebuffer)
+{
+  // read with texelFetch only
+  GLuint texture = 0;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D,
+      0,
+      internalFormat,
+      width,
+      1,
+      0,
+      format,
+      GL_FLOAT,
+      nullptr);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(
+      GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+  return texture;
+}
+
+// The window between the percentiles of `bins` over [lo, lo + extent), the
+// lower bound of the bin the low one falls in to the upper bound of the
+// high one's
+static DisplayWindow percentileWindow(const std::vector<float> &bins,
+    float lo,
+    float extent,
+    float low,
+    float high)
+{
+  double total = 0.0;
+  for (float b : bins)
+    total += b;
+  if (total <= 0.0)
+    return DisplayWindow();
+  if (extent <= 0.f)
+    return DisplayWindow{lo, lo + 1.f};
+  const double lowCount = low * 0.01 * total;
+  const double highCount = high * 0.01 * total;
+  const int n = int(bins.size());
+  int lower = -1, upper = n - 1;
+  double sum = 0.0;
+  for (int i = 0; i < n; ++i) {
+    sum += bins[i];
+    if (lower < 0 && sum > lowCount)
+      lower = i;
+    if (sum >= highCount) {
+      upper = i;
+      break;
+    }
+  }
+  if (lower < 0)
+    lower = upper;
+  const float step = extent / float(n);
+  return DisplayWindow{lo + float(lower) * step, lo + float(upper + 1) * step};
+}
+
+FrameHistogram::~FrameHistogram()
+{
+  if (m_rangeProgram)
+    glDeleteProgram(m_rangeProgram);
+  if (m_binProgram)
+    glDeleteProgram(m_binProgram);
+  if (m_windowProgram)
+    glDeleteProgram(m_windowProgram);
+  if (m_vertexArray)
+    glDeleteVertexArrays(1, &m_vertexArray);
+  const GLuint textures[3] = {m_rangeTexture, m_binTexture, m_windowTexture};
+  for (GLuint texture : textures) {
+    if (texture)
+      glDeleteTextures(1, &texture);
+  }
+  if (m_framebuffers[0])
+    glDeleteFramebuffers(3, m_framebuffers);
+  if (m_readBuffer)
+    glDeleteBuffers(1, &m_readBuffer);
+  if (m_readFence)
+    glDeleteSync(m_readFence);
+}
+
+bool FrameHistogram::init()
+{
+  m_initialized = true;
+  if (!floatBlending()) {
+    fprintf(stderr,
+        "frame histogram: no float blending, auto windowing on the CPU\n");
+    return false;
+  }
+  m_rangeProgram = buildProgram(
+      "histogram range", s_rangeVertexShader, s_rangeFragmentShader);
+  m_binProgram = buildProgram(
+      "histogram bins", s_binVertexShader, s_binFragmentShader);
+  m_windowProgram =
+      buildFullscreenProgram("histogram window", s_windowFragmentShader);
+  if (!m_rangeProgram || !m_binProgram || !m_windowProgram)
+    return false;
+
+  m_sizeLocation[0] = glGetUniformLocation(m_rangeProgram, "size");
+  m_sizeLocation[1] = glGetUniformLocation(m_binProgram, "size");
+  m_percentileLocation = glGetUniformLocation(m_windowProgram, "percentiles");
+  glUseProgram(m_rangeProgram);
+  glUniform1i(glGetUniformLocation(m_rangeProgram, "frame"), 0);
+  glUseProgram(m_binProgram);
+  glUniform1i(glGetUniformLocation(m_binProgram, "frame"), 0);
+  glUniform1i(glGetUniformLocation(m_binProgram, "range"), 1);
+  glUniform1i(glGetUniformLocation(m_binProgram, "numBins"), numBins);
+  glUseProgram(m_windowProgram);
+  glUniform1i(glGetUniformLocation(m_windowProgram, "bins"), 0);
+  glUniform1i(glGetUniformLocation(m_windowProgram, "range"), 1);
+  glUseProgram(0);
+  glGenVertexArrays(1, &m_vertexArray);
+
+  // called between ImGui frames: leave the bindings as found
+  GLint framebuffer = 0, texture = 0, packBuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+  glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &packBuffer);
+  glGenFramebuffers(3, m_framebuffers);
+  m_rangeTexture = createTarget(GL_RG32F, GL_RG, 1, m_framebuffers[0]);
+  bool complete = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER)
+      == GL_FRAMEBUFFER_COMPLETE;
+  m_binTexture = createTarget(GL_R32F, GL_RED, numBins, m_framebuffers[1]);
+  complete = complete
+      && glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER)
+          == GL_FRAMEBUFFER_COMPLETE;
+  m_windowTexture = createTarget(GL_RG32F, GL_RG, 1, m_framebuffers[2]);
+  complete = complete
+      && glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER)
+          == GL_FRAMEBUFFER_COMPLETE;
+  // read as RGBA, the one float format GLES reads back everywhere
+  glGenBuffers(1, &m_readBuffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readBuffer);
+  glBufferData(GL_PIXEL_PACK_BUFFER,
+      (numBins + 2) * 4 * sizeof(float),
+      nullptr,
+      GL_STREAM_READ);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffer);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+  if (!complete) {
+    fprintf(stderr,
+        "frame histogram: no float render targets, auto windowing on the "
+        "CPU\n");
+    return false;
+  }
+  m_supported = true;
+  return true;
+}
+
+bool FrameHistogram::compute(
+    GLuint source, int width, int height, float low, float high)
+{
+  TRACE_SCOPE("gl", "frame histogram");
+  if (!m_initialized)
+    init();
+  if (!m_supported || width <= 0 || height <= 0)
+    return false;
+
+  GLStateGuard state;
+  if (!isGLES())
+    glEnable(GL_PROGRAM_POINT_SIZE);
+  glBindVertexArray(m_vertexArray);
+  const GLsizei numPixels = GLsizei(width) * height;
+
+  // range: max of (v, -v)
+  const GLfloat lowest[4] = {-FLT_MAX, -FLT_MAX, 0.f, 0.f};
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffers[0]);
+  glViewport(0, 0, 1, 1);
+  glClearBufferfv(GL_COLOR, 0, lowest);
+  glEnable(GL_BLEND);
+  glBlendEquation(GL_MAX);
+  glBlendFunc(GL_ONE, GL_ONE);
+  glUseProgram(m_rangeProgram);
+  glUniform2i(m_sizeLocation[0], width, height);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, source);
+  glDrawArrays(GL_POINTS, 0, numPixels);
+
+  // bins: one per pixel added up
+  const GLfloat zero[4] = {0.f, 0.f, 0.f, 0.f};
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffers[1]);
+  glViewport(0, 0, numBins, 1);
+  glClearBufferfv(GL_COLOR, 0, zero);
+  glBlendEquation(GL_FUNC_ADD);
+  glUseProgram(m_binProgram);
+  glUniform2i(m_sizeLocation[1], width, height);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, m_rangeTexture);
+  glDrawArrays(GL_POINTS, 0, numPixels);
+
+  // window
+  glDisable(GL_BLEND);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffers[2]);
+  glViewport(0, 0, 1, 1);
+  glUseProgram(m_windowProgram);
+  glUniform2f(m_percentileLocation, low * 0.01f, high * 0.01f);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_binTexture);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  // to the host without waiting, unless the last read is still pending
+  if (!m_readFence) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readBuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffers[1]);
+    glReadPixels(0, 0, numBins, 1, GL_RGBA, GL_FLOAT, nullptr);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffers[0]);
+    glReadPixels(0,
+        0,
+        1,
+        1,
+        GL_RGBA,
+        GL_FLOAT,
+        reinterpret_cast<void *>(numBins * 4 * sizeof(float)));
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffers[2]);
+    glReadPixels(0,
+        0,
+        1,
+        1,
+        GL_RGBA,
+        GL_FLOAT,
+        reinterpret_cast<void *>((numBins + 1) * 4 * sizeof(float)));
+    m_readFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+  return true;
+}
+
+GLuint FrameHistogram::windowTexture() const
+{
+  return m_supported ? m_windowTexture : 0;
+}
+
+bool FrameHistogram::read(Result &result)
+{
+  if (!m_readFence)
+    return false;
+  if (glClientWaitSync(m_readFence, 0, 0) == GL_TIMEOUT_EXPIRED)
+    return false;
+  glDeleteSync(m_readFence);
+  m_readFence = nullptr;
+
+  GLint packBuffer = 0;
+  glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &packBuffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readBuffer);
+  const size_t bytes = (numBins + 2) * 4 * sizeof(float);
+  const auto *values = static_cast<const float *>(
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT));
+  bool ok = values != nullptr;
+  if (ok) {
+    result.bins.resize(numBins);
+    for (int i = 0; i < numBins; ++i)
+      result.bins[i] = values[4 * i];
+    const float *range = values + 4 * numBins;
+    const float *window = range + 4;
+    const float lo = -range[1], hi = range[0];
+    result.range = lo > hi ? DisplayWindow()
+                           : DisplayWindow{lo, hi > lo ? hi : lo + 1.f};
+    result.window = DisplayWindow{window[0], window[1]};
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffer);
+  return ok;
+}
+
+FrameHistogram::Result FrameHistogram::of(
+    const float *values, size_t count, float low, float high)
+{
+  Result result;
+  result.bins.assign(numBins, 0.f);
+  float lo = FLT_MAX, hi = -FLT_MAX;
+  for (size_t i = 0; i < count; ++i) {
+    if (std::isfinite(values[i])) {
+      lo = std::min(lo, values[i]);
+      hi = std::max(hi, values[i]);
+    }
+  }
+  if (lo > hi)
+    return result;
+
+  const float extent = hi - lo;
+  for (size_t i = 0; i < count; ++i) {
+    if (!std::isfinite(values[i]))
+      continue;
+    int bin = 0;
+    if (extent > 0.f) {
+      bin = std::clamp(
+          int((values[i] - lo) / extent * float(numBins)), 0, numBins - 1);
+    }
+    result.bins[bin] += 1.f;
+  }
+  result.range = DisplayWindow{lo, hi > lo ? hi : lo + 1.f};
+  result.window = percentileWindow(result.bins, lo, extent, low, high);
+  return result;
+}
@@ -0,0 +1,78 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// glad
+#include "glad/glad.h"
+// std
+#include <cstddef>
+#include <vector>
+// ours
+#include "ToneMapper.h"
+
+// Histogram and auto window of linear frames on the GPU. The float frame
+// is histogrammed where it was uploaded, in three passes without leaving
+// the GPU: every pixel is drawn as a point into a 1x1 target with max
+// blending for the range, then into a numBins x 1 target with additive
+// blending, at its bin over that range; a last pass sums the bins up to
+// the window's percentiles and writes the window into a 1x1 texture the
+// ToneMapper reads. So the displayed window is of the frame shown, and the
+// frame is never read back for it. The bins, range and window reach the
+// host through a pixel buffer a frame or so later, for the overlay and the
+// UI. Non-finite values (NaN where rays miss on some devices) are not
+// counted. GLES 3 contexts need EXT_color_buffer_float and EXT_float_blend.
+class FrameHistogram
+{
+ public:
+  static constexpr int numBins = 256;
+
+  struct Result
+  {
+    DisplayWindow range; // of the finite values
+    DisplayWindow window; // between the percentiles
+    std::vector<float> bins; // numBins over range, pixel counts
+  };
+
+  FrameHistogram() = default;
+  ~FrameHistogram();
+
+  FrameHistogram(const FrameHistogram &) = delete;
+  FrameHistogram &operator=(const FrameHistogram &) = delete;
+
+  // Must be called with the GL context current; histograms the lower left
+  // width x height pixels of `source` (GL_R32F) and windows them from the
+  // `low` to the `high` percentile (0..100). False if the context cannot
+  // (no shaders, float render targets or float blending).
+  bool compute(
+      GLuint source, int width, int height, float low, float high);
+  // GL_RG32F, 1x1: lower and upper of the last computed window
+  GLuint windowTexture() const;
+
+  // The last computed histogram once it is on the host, without waiting;
+  // false if there is none newer than the last one returned
+  bool read(Result &result);
+
+  // The same on the CPU, for contexts compute() does not run on and for
+  // frames leaving the viewport (screenshots, the stream)
+  static Result of(
+      const float *values, size_t count, float low, float high);
+
+ private:
+  bool init();
+
+  GLuint m_rangeProgram{0};
+  GLuint m_binProgram{0};
+  GLuint m_windowProgram{0};
+  GLuint m_vertexArray{0};
+  GLuint m_rangeTexture{0}; // GL_RG32F 1x1: max, -min
+  GLuint m_binTexture{0}; // GL_R32F numBins x 1
+  GLuint m_windowTexture{0}; // GL_RG32F 1x1: lower, upper
+  GLuint m_framebuffers[3]{0, 0, 0}; // of the three textures
+  GLuint m_readBuffer{0}; // GL_PIXEL_PACK_BUFFER: bins, range, window
+  GLsync m_readFence{nullptr};
+  GLint m_sizeLocation[2]{-1, -1}; // of the range and bin programs
+  GLint m_percentileLocation{-1};
+  bool m_initialized{false};
+  bool m_supported{false};
+};
@@ -0,0 +1,270 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "FrameReprojector.h"
+// std
+#include <cmath>
+// ours
+#include "GLProgram.h"
+#include "Trace.h"
+
+static const char *s_vertexShader = R"(
+uniform highp sampler2D origins; // GLES samplers default to lowp
+uniform sampler2D source;
+uniform vec3 eye;
+uniform vec3 dir;
+// scaled to the image plane, so that dot(p - eye, right) / z is u - 0.5
+uniform vec3 right;
+uniform vec3 up;
+uniform vec4 region; // imageRegion of the camera
+uniform vec2 size; // of the target, pixels
+flat out vec4 splat;
+
+const float maxPointSize = 8.0;
+
+// pixels of the target, and the distance along the view direction
+vec3 project(vec3 p)
+{
+  vec3 d = p - eye;
+  float z = dot(d, dir);
+  vec2 uv = vec2(dot(d, right), dot(d, up)) / z + 0.5;
+  uv = (uv - region.xy) / (region.zw - region.xy);
+  return vec3(uv * size, z);
+}
+
+bool valid(vec3 o)
+{
+  return !any(isnan(o)) && !any(isinf(o));
+}
+
+void main()
+{
+  ivec2 sourceSize = textureSize(origins, 0);
+  ivec2 p = ivec2(gl_VertexID % sourceSize.x, gl_VertexID / sourceSize.x);
+  splat = texelFetch(source, p, 0);
+  // outside the clip volume: no hit, or behind the camera
+  gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+  gl_PointSize = 1.0;
+  vec3 o = texelFetch(origins, p, 0).xyz;
+  if (!valid(o))
+    return;
+  vec3 q = project(o);
+  if (q.z <= 0.0)
+    return;
+
+  // reach the points of the right and upper neighbors
+  float extent = 1.0;
+  ivec2 n = min(p + 1, sourceSize - 1);
+  vec3 ox = texelFetch(origins, ivec2(n.x, p.y), 0).xyz;
+  vec3 oy = texelFetch(origins, ivec2(p.x, n.y), 0).xyz;
+  if (valid(ox)) {
+    vec3 qx = project(ox);
+    if (qx.z > 0.0)
+      extent = max(extent, max(abs(qx.x - q.x), abs(qx.y - q.y)));
+  }
+  if (valid(oy)) {
+    vec3 qy = project(oy);
+    if (qy.z > 0.0)
+      extent = max(extent, max(abs(qy.x - q.x), abs(qy.y - q.y)));
+  }
+  gl_PointSize = min(ceil(extent), maxPointSize);
+  // nearer is smaller, within (-1, 1) for any distance in front
+  gl_Position = vec4(2.0 * q.xy / size - 1.0, 1.0 - 2.0 / (1.0 + q.z), 1.0);
+}
+)";
+
+static const char *s_fragmentShader = R"(
+flat in vec4 splat;
+out vec4 color;
+
+void main()
+{
+  color = splat;
+}
+)";
+
+FrameReprojector::~FrameReprojector()
+{
+  if (m_program)
+    glDeleteProgram(m_program);
+  if (m_vertexArray)
+    glDeleteVertexArrays(1, &m_vertexArray);
+  if (m_framebuffer)
+    glDeleteFramebuffers(1, &m_framebuffer);
+  if (m_sourceFramebuffer)
+    glDeleteFramebuffers(1, &m_sourceFramebuffer);
+  if (m_originTexture)
+    glDeleteTextures(1, &m_originTexture);
+  if (m_depthBuffer)
+    glDeleteRenderbuffers(1, &m_depthBuffer);
+}
+
+bool FrameReprojector::init()
+{
+  m_initialized = true;
+  m_program = buildProgram("reprojection", s_vertexShader, s_fragmentShader);
+  if (!m_program)
+    return false;
+
+  m_eyeLocation = glGetUniformLocation(m_program, "eye");
+  m_dirLocation = glGetUniformLocation(m_program, "dir");
+  m_rightLocation = glGetUniformLocation(m_program, "right");
+  m_upLocation = glGetUniformLocation(m_program, "up");
+  m_regionLocation = glGetUniformLocation(m_program, "region");
+  m_sizeLocation = glGetUniformLocation(m_program, "size");
+  glUseProgram(m_program);
+  glUniform1i(glGetUniformLocation(m_program, "origins"), 0);
+  glUniform1i(glGetUniformLocation(m_program, "source"), 1);
+  glUseProgram(0);
+  glGenVertexArrays(1, &m_vertexArray);
+  glGenFramebuffers(1, &m_framebuffer);
+  glGenFramebuffers(1, &m_sourceFramebuffer);
+  glGenRenderbuffers(1, &m_depthBuffer);
+  return true;
+}
+
+void FrameReprojector::setOrigins(const float *origins, int width, int height)
+{
+  m_hasOrigins = origins && width > 0 && height > 0;
+  if (!m_hasOrigins)
+    return;
+
+  TRACE_SCOPE("gl", "upload origins");
+  GLint texture = 0, alignment = 4;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+  if (!m_originTexture) {
+    // read with texelFetch only
+    glGenTextures(1, &m_originTexture);
+    glBindTexture(GL_TEXTURE_2D, m_originTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+  glBindTexture(GL_TEXTURE_2D, m_originTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  if (m_originSize[0] != width || m_originSize[1] != height) {
+    glTexImage2D(GL_TEXTURE_2D,
+        0,
+        GL_RGB32F,
+        width,
+        height,
+        0,
+        GL_RGB,
+        GL_FLOAT,
+        origins);
+    m_originSize[0] = width;
+    m_originSize[1] = height;
+  } else {
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_FLOAT, origins);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+  glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+bool FrameReprojector::hasOrigins() const
+{
+  return m_hasOrigins;
+}
+
+bool FrameReprojector::apply(
+    GLuint color, GLuint target, const RayCamera &camera)
+{
+  TRACE_SCOPE("gl", "reprojection");
+  if (!m_hasOrigins || camera.width == 0 || camera.height == 0)
+    return false;
+  if (!m_initialized)
+    init();
+  if (!m_program)
+    return false;
+
+  const int width = int(camera.width), height = int(camera.height);
+  if (m_depthSize[0] != width || m_depthSize[1] != height) {
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+    glRenderbufferStorage(
+        GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    m_depthSize[0] = width;
+    m_depthSize[1] = height;
+  }
+
+  // the camera's axes as FirstHit's rays use them
+  float dir[3], right[3], up[3];
+  const float dirLength = std::sqrt(camera.dir[0] * camera.dir[0]
+      + camera.dir[1] * camera.dir[1] + camera.dir[2] * camera.dir[2]);
+  for (int a = 0; a < 3; ++a)
+    dir[a] = camera.dir[a] / dirLength;
+  right[0] = dir[1] * camera.up[2] - dir[2] * camera.up[1];
+  right[1] = dir[2] * camera.up[0] - dir[0] * camera.up[2];
+  right[2] = dir[0] * camera.up[1] - dir[1] * camera.up[0];
+  const float rightLength = std::sqrt(
+      right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
+  for (int a = 0; a < 3; ++a)
+    right[a] /= rightLength;
+  up[0] = right[1] * dir[2] - right[2] * dir[1];
+  up[1] = right[2] * dir[0] - right[0] * dir[2];
+  up[2] = right[0] * dir[1] - right[1] * dir[0];
+  const float halfY = std::tan(0.5f * camera.fovy);
+  const float halfX = halfY * camera.aspect;
+  for (int a = 0; a < 3; ++a) {
+    right[a] /= 2.f * halfX;
+    up[a] /= 2.f * halfY;
+  }
+
+  GLStateGuard state;
+
+  // the frame itself behind the points
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_sourceFramebuffer);
+  glFramebufferTexture2D(
+      GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTexture2D(
+      GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+  glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER,
+      GL_DEPTH_ATTACHMENT,
+      GL_RENDERBUFFER,
+      m_depthBuffer);
+  const bool scaled = m_originSize[0] != width || m_originSize[1] != height;
+  glBlitFramebuffer(0,
+      0,
+      m_originSize[0],
+      m_originSize[1],
+      0,
+      0,
+      width,
+      height,
+      GL_COLOR_BUFFER_BIT,
+      scaled ? GL_LINEAR : GL_NEAREST);
+  const GLfloat far = 1.f;
+  glDepthMask(GL_TRUE);
+  glClearBufferfv(GL_DEPTH, 0, &far);
+
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LESS);
+  if (!isGLES())
+    glEnable(GL_PROGRAM_POINT_SIZE);
+  glViewport(0, 0, width, height);
+  glUseProgram(m_program);
+  glUniform3f(m_eyeLocation, camera.eye[0], camera.eye[1], camera.eye[2]);
+  glUniform3fv(m_dirLocation, 1, dir);
+  glUniform3fv(m_rightLocation, 1, right);
+  glUniform3fv(m_upLocation, 1, up);
+  glUniform4fv(m_regionLocation, 1, camera.region);
+  glUniform2f(m_sizeLocation, float(width), float(height));
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_originTexture);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, color);
+  glBindVertexArray(m_vertexArray);
+  glDrawArrays(GL_POINTS, 0, m_originSize[0] * m_originSize[1]);
+
+  glFramebufferRenderbuffer(
+      GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
+  return true;
+}
+
+size_t FrameReprojector::bytes() const
+{
+  return size_t(m_originSize[0]) * m_originSize[1] * 3 * sizeof(float)
+      + size_t(m_depthSize[0]) * m_depthSize[1] * 4;
+}
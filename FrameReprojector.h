@@ -0,0 +1,66 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// glad
+#include "glad/glad.h"
+// std
+#include <cstddef>
+// ours
+#include "FirstHit.h"
+
+// Warps the last finished frame to the current camera while the next one
+// renders, so the view follows the manipulator at the display's rate. The
+// frame's origin channel (the first hit of each pixel's ray) is kept in a
+// float texture; every pixel is drawn as a point at its origin as the new
+// camera sees it, sized to reach its neighbors' points so magnified parts
+// have no holes, nearer origins winning where points overlap. A DRR pixel
+// integrates its whole ray, so the first hit stands in for its depth: a
+// rotation is right about the anatomy in front and drifts behind it, until
+// the rendered frame replaces the warp. Pixels no point lands on keep the
+// frame's own color, which is right for the background around the volume
+// and less jarring than holes where the motion uncovered something.
+class FrameReprojector
+{
+ public:
+  FrameReprojector() = default;
+  ~FrameReprojector();
+
+  FrameReprojector(const FrameReprojector &) = delete;
+  FrameReprojector &operator=(const FrameReprojector &) = delete;
+
+  // Must be called with the GL context current; the origins (width x height
+  // float3, row 0 first, NaN without a hit) of the frame whose color is
+  // warped next. nullptr drops them: nothing is warped until the next.
+  void setOrigins(const float *origins, int width, int height);
+  bool hasOrigins() const;
+
+  // Draws the lower left pixels of `color` (the size of the origins) into
+  // the lower left camera.width x camera.height pixels of `target` as
+  // `camera` sees them. False without origins or if the shader could not be
+  // built.
+  bool apply(GLuint color, GLuint target, const RayCamera &camera);
+
+  size_t bytes() const; // the origin texture and depth buffer
+
+ private:
+  bool init();
+
+  GLuint m_program{0};
+  GLuint m_vertexArray{0};
+  GLuint m_framebuffer{0};
+  GLuint m_sourceFramebuffer{0}; // the color, blitted as the backdrop
+  GLuint m_originTexture{0}; // GL_RGB32F
+  int m_originSize[2]{0, 0};
+  bool m_hasOrigins{false};
+  GLuint m_depthBuffer{0};
+  int m_depthSize[2]{0, 0};
+  GLint m_eyeLocation{-1};
+  GLint m_dirLocation{-1};
+  GLint m_rightLocation{-1};
+  GLint m_upLocation{-1};
+  GLint m_regionLocation{-1};
+  GLint m_sizeLocation{-1};
+  bool m_initialized{false};
+};
@@ -0,0 +1,346 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "FrameRing.h"
+// posix
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+constexpr size_t PageSize = 4096;
+
+size_t pageAlign(size_t bytes)
+{
+  return (bytes + PageSize - 1) / PageSize * PageSize;
+}
+
+// control fields are shared with the consumer, which may run on another core
+uint64_t load(const uint64_t &field)
+{
+  return std::atomic_ref<uint64_t>(const_cast<uint64_t &>(field)).load();
+}
+
+void store(uint64_t &field, uint64_t value)
+{
+  std::atomic_ref<uint64_t>(field).store(value);
+}
+
+size_t imageBytes(const frame_ring_image &image)
+{
+  return size_t(image.row_stride * image.height);
+}
+
+} // namespace
+
+frame_ring_matcher::~frame_ring_matcher()
+{
+  if (!m_memory)
+    return;
+  header()->retired = 1;
+  shm_unlink(m_name.c_str());
+  unmap();
+}
+
+bool frame_ring_matcher::create(
+    const std::string &name, const FrameRingSettings &settings)
+{
+  m_name = name.empty() || name[0] != '/' ? "/" + name : name;
+  m_settings = settings;
+  m_settings.numSlots =
+      std::clamp<uint32_t>(m_settings.numSlots, 2, FRAME_RING_MAX_SLOTS);
+  shm_unlink(m_name.c_str()); // left behind by a viewer that crashed
+  if (!map(0, 0, 0))
+    return false;
+  fprintf(stdout,
+      "Frame ring /dev/shm%s: %u slots\n",
+      m_name.c_str(),
+      m_settings.numSlots);
+  return true;
+}
+
+const std::string &frame_ring_matcher::name() const
+{
+  return m_name;
+}
+
+frame_ring_header *frame_ring_matcher::header() const
+{
+  return reinterpret_cast<frame_ring_header *>(m_memory);
+}
+
+bool frame_ring_matcher::map(
+    size_t referenceBytes, size_t colorBytes, size_t originBytes)
+{
+  const size_t headerBytes = pageAlign(sizeof(frame_ring_header));
+  referenceBytes = pageAlign(referenceBytes);
+  colorBytes = pageAlign(colorBytes);
+  originBytes = pageAlign(originBytes);
+  const size_t size = headerBytes + referenceBytes
+      + m_settings.numSlots * (colorBytes + originBytes);
+
+  const int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    perror(("shm_open " + m_name).c_str());
+    return false;
+  }
+  if (ftruncate(fd, off_t(size)) != 0) {
+    perror("ftruncate");
+    close(fd);
+    shm_unlink(m_name.c_str());
+    return false;
+  }
+  void *memory =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    shm_unlink(m_name.c_str());
+    return false;
+  }
+  m_memory = static_cast<uint8_t *>(memory);
+  m_size = size;
+
+  // the object is zero-filled: no frames, no reference, no consumer
+  auto *h = header();
+  h->magic = FRAME_RING_MAGIC;
+  h->version = FRAME_RING_VERSION;
+  h->num_slots = m_settings.numSlots;
+  h->segment_bytes = size;
+  h->viewer_pid = uint64_t(getpid());
+  h->reference.offset = headerBytes;
+  h->reference.capacity = referenceBytes;
+  size_t offset = headerBytes + referenceBytes;
+  for (uint32_t i = 0; i < m_settings.numSlots; ++i) {
+    auto &slot = h->slots[i];
+    slot.color.offset = offset;
+    slot.color.capacity = colorBytes;
+    offset += colorBytes;
+    slot.origin.offset = offset;
+    slot.origin.capacity = originBytes;
+    offset += originBytes;
+  }
+  return true;
+}
+
+void frame_ring_matcher::unmap()
+{
+  if (m_memory)
+    munmap(m_memory, m_size);
+  m_memory = nullptr;
+  m_size = 0;
+}
+
+bool frame_ring_matcher::grow(
+    size_t referenceBytes, size_t colorBytes, size_t originBytes)
+{
+  auto *old = header();
+  // grown in steps, so slightly larger frames in turn do not remap each time
+  auto size = [](size_t needed, uint64_t capacity) {
+    return needed > capacity ? std::max<size_t>(needed, capacity * 2)
+                             : size_t(capacity);
+  };
+  referenceBytes = size(referenceBytes, old->reference.capacity);
+  colorBytes = size(colorBytes, old->slots[0].color.capacity);
+  originBytes = size(originBytes, old->slots[0].origin.capacity);
+
+  // a consumer drops its result once it sees the segment retired, so let
+  // one that is mid-read finish first; its result moves over below
+  using clock = std::chrono::steady_clock;
+  const auto deadline = clock::now()
+      + std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<float>(m_settings.timeoutSeconds));
+  while (load(old->result_frame) < load(old->reading_frame)
+      && clock::now() < deadline && consumerAttached())
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+  // consumers keep their mapping of the old segment until they see it
+  // retired; the new one takes over its name, sequences and images
+  uint8_t *oldMemory = m_memory;
+  const size_t oldSize = m_size;
+  old->retired = 1;
+  shm_unlink(m_name.c_str());
+  m_memory = nullptr;
+  if (!map(referenceBytes, colorBytes, originBytes)) {
+    munmap(oldMemory, oldSize);
+    return false;
+  }
+  fprintf(stdout,
+      "Frame ring /dev/shm%s grew to %.1f MB\n",
+      m_name.c_str(),
+      m_size / double(1 << 20));
+
+  auto *h = header();
+  auto copy = [&](frame_ring_image &to, const frame_ring_image &from) {
+    const uint64_t offset = to.offset, capacity = to.capacity;
+    to = from;
+    to.offset = offset;
+    to.capacity = capacity;
+    std::memcpy(m_memory + to.offset,
+        oldMemory + from.offset,
+        std::min(imageBytes(from), size_t(capacity)));
+  };
+  copy(h->reference, old->reference);
+  for (uint32_t i = 0; i < h->num_slots; ++i) {
+    auto &to = h->slots[i];
+    const auto &from = old->slots[i];
+    copy(to.color, from.color);
+    copy(to.origin, from.origin);
+    to.has_origin = from.has_origin;
+    to.fovy = from.fovy;
+    to.aspect = from.aspect;
+    std::copy_n(from.eye, 3, to.eye);
+    std::copy_n(from.center, 3, to.center);
+    std::copy_n(from.up, 3, to.up);
+    to.sequence = from.sequence;
+  }
+  h->frame_sequence = old->frame_sequence;
+  h->reference_sequence = old->reference_sequence;
+  h->consumer_pid = old->consumer_pid; // about to reopen
+  h->reading_frame = load(old->reading_frame);
+  h->result_valid = old->result_valid;
+  std::copy_n(old->eye, 3, h->eye);
+  std::copy_n(old->center, 3, h->center);
+  std::copy_n(old->up, 3, h->up);
+  store(h->result_frame, load(old->result_frame));
+  munmap(oldMemory, oldSize);
+  return true;
+}
+
+frame_ring_slot &frame_ring_matcher::pendingSlot()
+{
+  auto *h = header();
+  if (m_pendingSlot != UINT32_MAX)
+    return h->slots[m_pendingSlot];
+
+  // Mark a slot as being written, then make sure the consumer is not
+  // reading it: it either sees the mark or we see its reading_frame. With
+  // at least two slots, one is always free.
+  for (uint32_t i = 1; i <= h->num_slots; ++i) {
+    const uint32_t candidate = (m_lastSlot + i) % h->num_slots;
+    auto &slot = h->slots[candidate];
+    const uint64_t sequence = load(slot.sequence);
+    store(slot.sequence, 0);
+    if (sequence != 0 && load(h->reading_frame) == sequence) {
+      store(slot.sequence, sequence); // untouched, still valid
+      continue;
+    }
+    m_pendingSlot = candidate;
+    break;
+  }
+  auto &slot = h->slots[m_pendingSlot];
+  slot.has_origin = 0;
+  slot.color.width = slot.color.height = slot.color.row_stride = 0;
+  slot.origin.width = slot.origin.height = slot.origin.row_stride = 0;
+  return slot;
+}
+
+void frame_ring_matcher::set_image(const void* data,
+                                   size_t width,
+                                   size_t height,
+                                   PIXEL_TYPE pixel_type,
+                                   IMAGE_TYPE image_type,
+                                   bool swizzle)
+{
+  if (!m_memory)
+    return;
+  const size_t rowBytes = width * matcher_pixel_size(pixel_type);
+  const size_t bytes = rowBytes * height;
+
+  auto *h = header();
+  const bool fits = image_type == REFERENCE
+      ? bytes <= h->reference.capacity
+      : bytes
+          <= (image_type == QUERY ? h->slots[0].color.capacity
+                                  : h->slots[0].origin.capacity);
+  if (!fits) {
+    // color and origin of a frame come in the same size, both grow at once
+    const size_t pixels = width * height;
+    const bool frame = image_type != REFERENCE;
+    if (!grow(frame ? 0 : bytes,
+            frame ? pixels * 4 : 0,
+            frame ? pixels * 3 * sizeof(float) : 0))
+      return;
+    h = header();
+  }
+
+  frame_ring_image *image = nullptr;
+  if (image_type == REFERENCE) {
+    store(h->reference_sequence, 0);
+    image = &h->reference;
+  } else {
+    auto &slot = pendingSlot();
+    image = image_type == QUERY ? &slot.color : &slot.origin;
+    slot.has_origin |= image_type == DEPTH3D;
+  }
+  image->width = width;
+  image->height = height;
+  image->row_stride = rowBytes;
+  image->pixel_type = uint32_t(pixel_type);
+  image->flags = swizzle ? uint32_t(MATCHER_IMAGE_SWIZZLE) : 0u;
+  std::memcpy(m_memory + image->offset, data, bytes);
+  if (image_type == REFERENCE)
+    store(h->reference_sequence, ++m_referenceSequence);
+}
+
+void frame_ring_matcher::match() {}
+
+void frame_ring_matcher::calibrate(size_t, size_t, float fovy, float aspect)
+{
+  m_fovy = fovy;
+  m_aspect = aspect;
+}
+
+bool frame_ring_matcher::consumerAttached() const
+{
+  const auto pid = pid_t(load(header()->consumer_pid));
+  return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+bool frame_ring_matcher::update_camera(std::array<float, 3>& eye,
+                                       std::array<float, 3>& center,
+                                       std::array<float, 3>& up)
+{
+  if (!m_memory || m_pendingSlot == UINT32_MAX)
+    return false;
+  auto *h = header();
+  auto &slot = h->slots[m_pendingSlot];
+  slot.fovy = m_fovy;
+  slot.aspect = m_aspect;
+  std::copy_n(eye.data(), 3, slot.eye);
+  std::copy_n(center.data(), 3, slot.center);
+  std::copy_n(up.data(), 3, slot.up);
+  const uint64_t sequence = load(h->frame_sequence) + 1;
+  store(slot.sequence, sequence);
+  store(h->frame_sequence, sequence);
+  m_lastSlot = m_pendingSlot;
+  m_pendingSlot = UINT32_MAX;
+
+  if (!consumerAttached())
+    return false;
+  using clock = std::chrono::steady_clock;
+  const auto deadline = clock::now()
+      + std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<float>(m_settings.timeoutSeconds));
+  while (load(h->result_frame) < sequence) {
+    if (clock::now() > deadline || !consumerAttached())
+      return false;
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  if (load(h->result_frame) != sequence || !h->result_valid)
+    return false; // answered another frame
+  std::copy_n(h->eye, 3, eye.data());
+  std::copy_n(h->center, 3, center.data());
+  std::copy_n(h->up, 3, up.data());
+  return true;
+}
@@ -0,0 +1,70 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+// ours
+#include "FrameRingLayout.h"
+#include "Matcher.h"
+
+struct FrameRingSettings
+{
+  uint32_t numSlots{3};
+  // how long update_camera() waits for a consumer's result
+  float timeoutSeconds{10.f};
+};
+
+// feature_matcher handing its images to an external process through the
+// shared-memory frame ring (FrameRingLayout.h). set_image() writes straight
+// into the segment, the only copy on the way; update_camera() publishes the
+// frame with its pose and waits for the consumer's result, so in timings
+// the consumer's work shows up there rather than in match(). With no
+// consumer attached it returns right away without an update.
+struct frame_ring_matcher : public feature_matcher
+{
+  frame_ring_matcher() = default;
+  ~frame_ring_matcher() override;
+
+  frame_ring_matcher(const frame_ring_matcher &) = delete;
+  frame_ring_matcher &operator=(const frame_ring_matcher &) = delete;
+
+  // Creates the shared memory object /<name>, replacing a stale one
+  bool create(const std::string &name, const FrameRingSettings &settings = {});
+  const std::string &name() const;
+
+  void set_image(const void* data,
+                 size_t width,
+                 size_t height,
+                 PIXEL_TYPE pixel_type,
+                 IMAGE_TYPE image_type,
+                 bool swizzle) override;
+  void match() override;
+  void calibrate(size_t width, size_t height, float fovy, float aspect) override;
+  bool update_camera(std::array<float, 3>& eye,
+                     std::array<float, 3>& center,
+                     std::array<float, 3>& up) override;
+
+ private:
+  frame_ring_header *header() const;
+  // Remaps into a segment with room for the given images at least, keeping
+  // the sequences and the reference
+  bool grow(size_t referenceBytes, size_t colorBytes, size_t originBytes);
+  bool map(size_t referenceBytes, size_t colorBytes, size_t originBytes);
+  void unmap();
+  // The slot the next frame goes to, picked on its first image
+  frame_ring_slot &pendingSlot();
+  bool consumerAttached() const;
+
+  std::string m_name;
+  FrameRingSettings m_settings;
+  uint8_t *m_memory{nullptr};
+  size_t m_size{0};
+  uint32_t m_pendingSlot{UINT32_MAX};
+  uint32_t m_lastSlot{0};
+  uint64_t m_referenceSequence{0};
+  float m_fovy{0.f};
+  float m_aspect{1.f};
+};
@@ -0,0 +1,85 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// Layout of the shared-memory frame ring (viewer --frame-ring <name>), for
+// matchers in other processes and languages. The viewer creates the POSIX
+// shared memory object /<name> (/dev/shm/<name> on Linux); consumers map it
+// and read frames in place (python/frame_ring.py is one).
+//
+// The segment starts with frame_ring_header. Images live at the offsets
+// their frame_ring_image gives, from the start of the segment. The viewer
+// writes the frame to match into a slot, then publishes it by setting the
+// slot's sequence and frame_sequence. A consumer
+//
+//   1. takes s = frame_sequence, stores s to reading_frame and finds the
+//      slot whose sequence is s (none: the frame was replaced already,
+//      start over). The viewer does not write to the slot of reading_frame.
+//   2. reads the images, and the reference if reference_sequence changed,
+//      then checks that the sequences are unchanged: if not, what it read
+//      was overwritten meanwhile;
+//   3. writes result_valid and the pose, then result_frame = s last.
+//
+// Sequences start at 1, a sequence of 0 marks an image being written. When
+// images outgrow the segment, the viewer waits for the reply to
+// reading_frame, sets retired and replaces the segment with a larger one
+// under the same name, results included; consumers reopen it. All
+// fields are little endian, 64-bit fields 8-byte aligned.
+
+#include <stdint.h>
+
+#define FRAME_RING_MAGIC 0x46525244u // "DRRF"
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_MAX_SLOTS 8
+
+typedef struct frame_ring_image
+{
+  uint64_t offset; // bytes from the start of the segment
+  uint64_t capacity; // bytes available at offset
+  uint64_t width;
+  uint64_t height;
+  uint64_t row_stride; // bytes, rows bottom first as rendered
+  uint32_t pixel_type; // matcher_pixel_type: RGBA8 or FLOAT3
+  uint32_t flags; // matcher_image_flags, MATCHER_IMAGE_SWIZZLE only
+} frame_ring_image;
+
+typedef struct frame_ring_slot
+{
+  uint64_t sequence; // frame held, 0 while written
+  uint32_t has_origin; // origin below holds the rays' 3D origins
+  uint32_t reserved;
+  float fovy; // radians
+  float aspect;
+  float eye[3]; // pose the frame was rendered at
+  float center[3];
+  float up[3];
+  frame_ring_image color;
+  frame_ring_image origin;
+} frame_ring_slot;
+
+typedef struct frame_ring_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_slots;
+  uint32_t retired; // nonzero: replaced by a new segment, reopen
+  uint64_t segment_bytes;
+  uint64_t viewer_pid;
+
+  // written by the viewer
+  uint64_t frame_sequence; // last frame published, 0 for none yet
+  uint64_t reference_sequence; // bumped per reference, 0 while written
+  frame_ring_image reference;
+  frame_ring_slot slots[FRAME_RING_MAX_SLOTS];
+
+  // written by the consumer
+  uint64_t consumer_pid; // 0: nobody to wait for
+  uint64_t reading_frame;
+  uint64_t result_frame; // frame the result belongs to, written last
+  int32_t result_valid; // nonzero if the pose below was estimated
+  uint32_t reserved;
+  float eye[3];
+  float center[3];
+  float up[3];
+} frame_ring_header;
@@ -0,0 +1,139 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Ring buffer of the last N frames' timings (ms) and render sizes, for the
+// viewport overlay's percentiles and sparkline and for CSV export, and of
+// as many input-to-display latencies
+class FrameStats
+{
+ public:
+  struct Frame
+  {
+    float duration{0.f}; // the frame's "duration" property
+    float interval{0.f}; // since the previously completed frame
+    float map{0.f};
+    float upload{0.f};
+    int width{0};
+    int height{0};
+  };
+
+  explicit FrameStats(size_t capacity = 512)
+      : m_frames(capacity), m_durations(capacity), m_inputs(capacity)
+  {}
+
+  void push(const Frame &frame)
+  {
+    const size_t i = m_next++ % m_frames.size();
+    m_frames[i] = frame;
+    m_durations[i] = frame.duration;
+  }
+
+  // ms from a manipulator input until the first frame showing it was on
+  // screen; only frames that showed new input have one
+  void pushInput(float latency)
+  {
+    m_inputs[m_nextInput++ % m_inputs.size()] = latency;
+  }
+
+  void clear()
+  {
+    m_next = 0;
+    m_nextInput = 0;
+  }
+
+  size_t size() const
+  {
+    return std::min(m_next, m_frames.size());
+  }
+
+  // Durations in ring order; start at offset() for chronological order
+  const float *durations() const
+  {
+    return m_durations.data();
+  }
+
+  size_t offset() const
+  {
+    return m_next > m_frames.size() ? m_next % m_frames.size() : 0;
+  }
+
+  // p in [0, 1] of one Frame member, e.g. percentile(&Frame::map, 0.95f)
+  float percentile(float Frame::*member, float p) const
+  {
+    const size_t n = size();
+    if (n == 0)
+      return 0.f;
+    m_scratch.resize(n);
+    for (size_t i = 0; i < n; ++i)
+      m_scratch[i] = m_frames[i].*member;
+    const size_t k = std::min(n - 1, size_t(p * (n - 1) + 0.5f));
+    std::nth_element(m_scratch.begin(), m_scratch.begin() + k, m_scratch.end());
+    return m_scratch[k];
+  }
+
+  size_t numInputs() const
+  {
+    return std::min(m_nextInput, m_inputs.size());
+  }
+
+  // p in [0, 1] of the buffered input-to-display latencies
+  float inputPercentile(float p) const
+  {
+    const size_t n = numInputs();
+    if (n == 0)
+      return 0.f;
+    m_scratch.assign(m_inputs.begin(), m_inputs.begin() + n);
+    const size_t k = std::min(n - 1, size_t(p * (n - 1) + 0.5f));
+    std::nth_element(m_scratch.begin(), m_scratch.begin() + k, m_scratch.end());
+    return m_scratch[k];
+  }
+
+  // Frames per second achieved over the buffered frames
+  float fps() const
+  {
+    const size_t n = size();
+    float total = 0.f;
+    for (size_t i = 0; i < n; ++i)
+      total += m_frames[i].interval;
+    return total > 0.f ? 1000.f * n / total : 0.f;
+  }
+
+  bool writeCsv(const std::string &file) const
+  {
+    FILE *out = fopen(file.c_str(), "w");
+    if (!out)
+      return false;
+    fprintf(out, "frame,duration_ms,interval_ms,map_ms,upload_ms,width,height\n");
+    const size_t n = size();
+    for (size_t j = 0; j < n; ++j) {
+      const auto &f = m_frames[(offset() + j) % m_frames.size()];
+      fprintf(out,
+          "%zu,%.3f,%.3f,%.3f,%.3f,%d,%d\n",
+          m_next - n + j,
+          f.duration,
+          f.interval,
+          f.map,
+          f.upload,
+          f.width,
+          f.height);
+    }
+    return fclose(out) == 0;
+  }
+
+ private:
+  std::vector<Frame> m_frames;
+  std::vector<float> m_durations; // contiguous copy for ImGui::PlotLines
+  std::vector<float> m_inputs;
+  mutable std::vector<float> m_scratch;
+  size_t m_next{0}; // total frames pushed
+  size_t m_nextInput{0};
+};
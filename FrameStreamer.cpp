@@ -0,0 +1,339 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "FrameStreamer.h"
+// posix
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+// stb_image
+#include "stb_image_write.h"
+// ours
+#include "SocketIO.h"
+#include "Trace.h"
+
+namespace {
+
+constexpr int g_minQuality = 30;
+constexpr int g_maxQuality = 90;
+constexpr int g_maxScale = 4;
+
+// Box filter by an integer factor, RGBA8
+void downscale(const std::vector<uint8_t> &src,
+    int width,
+    int height,
+    int factor,
+    std::vector<uint8_t> &dst,
+    int &outWidth,
+    int &outHeight)
+{
+  outWidth = std::max(1, width / factor);
+  outHeight = std::max(1, height / factor);
+  dst.resize(size_t(outWidth) * outHeight * 4);
+  const unsigned n = unsigned(factor * factor);
+  for (int y = 0; y < outHeight; ++y) {
+    for (int x = 0; x < outWidth; ++x) {
+      unsigned sum[4] = {0, 0, 0, 0};
+      for (int sy = y * factor; sy < (y + 1) * factor; ++sy) {
+        const uint8_t *p =
+            src.data() + (size_t(std::min(sy, height - 1)) * width + x * factor) * 4;
+        for (int sx = 0; sx < factor; ++sx, p += 4)
+          for (int c = 0; c < 4; ++c)
+            sum[c] += p[c];
+      }
+      uint8_t *out = dst.data() + (size_t(y) * outWidth + x) * 4;
+      for (int c = 0; c < 4; ++c)
+        out[c] = uint8_t((sum[c] + n / 2) / n);
+    }
+  }
+}
+
+} // namespace
+
+FrameStreamer::FrameStreamer(int port, size_t targetKbps, float maxFps)
+    : m_port(port),
+      m_targetBytesPerSecond(targetKbps * 1000 / 8),
+      m_minInterval(1.f / std::max(maxFps, 1.f))
+{
+  m_listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (m_listener < 0) {
+    perror("socket");
+    return;
+  }
+  int yes = 1;
+  setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(m_listener, (sockaddr *)&addr, sizeof(addr)) < 0
+      || listen(m_listener, 4) < 0) {
+    perror("bind/listen");
+    close(m_listener);
+    m_listener = -1;
+    return;
+  }
+
+  std::cout << "Streaming the viewport as MJPEG on http://<host>:" << port
+            << "/\n";
+  m_acceptThread = std::thread([this]() { acceptLoop(); });
+  m_encodeThread = std::thread([this]() { encodeLoop(); });
+}
+
+FrameStreamer::~FrameStreamer()
+{
+  m_stop = true;
+  m_cv.notify_all();
+  if (m_acceptThread.joinable())
+    m_acceptThread.join();
+  if (m_encodeThread.joinable())
+    m_encodeThread.join();
+  const int client = m_client.exchange(-1);
+  if (client >= 0)
+    close(client);
+  for (int socket : m_retired)
+    close(socket);
+  if (m_listener >= 0)
+    close(m_listener);
+}
+
+bool FrameStreamer::listening() const
+{
+  return m_listener >= 0;
+}
+
+bool FrameStreamer::watched() const
+{
+  return m_client >= 0;
+}
+
+void FrameStreamer::submit(const uint32_t *rgba, int width, int height)
+{
+  if (m_client < 0 || !rgba || width <= 0 || height <= 0)
+    return;
+
+  const auto now = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+  // the encoder holds the lock while it takes the frame; skip, not wait
+  if (!lock.owns_lock() || m_havePending
+      || std::chrono::duration<float>(now - m_lastSubmit).count()
+          < m_minInterval)
+    return;
+
+  TRACE_SCOPE("stream", "copy frame");
+  // top row first for the encoder
+  const size_t rowBytes = size_t(width) * 4;
+  m_pending.resize(rowBytes * height);
+  const auto *src = reinterpret_cast<const uint8_t *>(rgba);
+  for (int y = 0; y < height; ++y) {
+    std::memcpy(m_pending.data() + size_t(height - 1 - y) * rowBytes,
+        src + size_t(y) * rowBytes,
+        rowBytes);
+  }
+  m_width = width;
+  m_height = height;
+  m_havePending = true;
+  m_lastSubmit = now;
+  lock.unlock();
+  m_cv.notify_one();
+}
+
+int FrameStreamer::quality() const
+{
+  return m_quality;
+}
+
+int FrameStreamer::scale() const
+{
+  return m_scale;
+}
+
+float FrameStreamer::kbps() const
+{
+  return m_kbps;
+}
+
+void FrameStreamer::acceptLoop()
+{
+  while (!m_stop) {
+    pollfd pfd{m_listener, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0)
+      continue;
+    int socket = accept(m_listener, nullptr, nullptr);
+    if (socket < 0)
+      continue;
+
+    // any request gets the stream; the request itself is read and ignored
+    char request[1024];
+    pollfd rfd{socket, POLLIN, 0};
+    if (poll(&rfd, 1, 1000) > 0)
+      (void)recv(socket, request, sizeof(request), 0);
+
+    // a stalled client drops out instead of blocking the encoder
+    timeval timeout{2, 0};
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int noDelay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    const std::string header =
+        "HTTP/1.1 200 OK\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: close\r\n"
+        "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
+    if (!sendAll(socket, header.data(), header.size())) {
+      close(socket);
+      continue;
+    }
+    // the newest client takes over the stream, starting with the last frame
+    // (an idle viewport submits none until something changes)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const int previous = m_client.exchange(socket);
+      if (previous >= 0) {
+        ::shutdown(previous, SHUT_RDWR);
+        m_retired.push_back(previous);
+      }
+      m_clientChanged = true;
+    }
+    m_cv.notify_one();
+  }
+}
+
+void FrameStreamer::encodeLoop()
+{
+  std::vector<uint8_t> frame, scaled, jpeg;
+  std::vector<int> retired;
+  int width = 0, height = 0;
+  auto lastSent = std::chrono::steady_clock::now();
+
+  // a client whose send failed is gone, or was replaced (acceptLoop shut it
+  // down and retired it); only the current one is closed here
+  auto drop = [this](int client) {
+    int expected = client;
+    if (m_client.compare_exchange_strong(expected, -1))
+      close(client);
+  };
+
+  while (!m_stop) {
+    int client = -1;
+    bool haveFrame = false, resend = false;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait_for(lock, std::chrono::milliseconds(200), [this]() {
+        return m_stop || m_havePending || m_clientChanged
+            || !m_retired.empty();
+      });
+      retired.swap(m_retired);
+      resend = m_clientChanged;
+      m_clientChanged = false;
+      if (m_havePending) {
+        frame.swap(m_pending);
+        width = m_width;
+        height = m_height;
+        m_havePending = false;
+        haveFrame = true;
+      }
+      client = m_client;
+    }
+    // not sending to any of them now: the retired sockets can go
+    for (int socket : retired)
+      close(socket);
+    retired.clear();
+    if (m_stop || client < 0)
+      continue;
+    if (!haveFrame) {
+      if (resend && !jpeg.empty() && !sendFrame(client, jpeg))
+        drop(client);
+      continue;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<uint8_t> *pixels = &frame;
+    int w = width, h = height;
+    if (m_scale > 1) {
+      TRACE_SCOPE("stream", "downscale");
+      downscale(frame, width, height, m_scale, scaled, w, h);
+      pixels = &scaled;
+    }
+    jpeg.clear();
+    {
+      TRACE_SCOPE("stream", "jpeg");
+      stbi_write_jpg_to_func(
+          [](void *context, void *data, int size) {
+            auto *out = static_cast<std::vector<uint8_t> *>(context);
+            auto *bytes = static_cast<const uint8_t *>(data);
+            out->insert(out->end(), bytes, bytes + size);
+          },
+          &jpeg,
+          w,
+          h,
+          4,
+          pixels->data(),
+          m_quality);
+    }
+
+    const auto sendStart = std::chrono::steady_clock::now();
+    if (!sendFrame(client, jpeg)) {
+      drop(client);
+      continue;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const float interval = std::chrono::duration<float>(end - lastSent).count();
+    lastSent = end;
+    if (interval > 0.f)
+      m_kbps = 0.8f * m_kbps + 0.2f * (jpeg.size() * 8.f / 1000.f / interval);
+    adapt(jpeg.size(),
+        std::chrono::duration<float>(end - sendStart).count()
+            + std::chrono::duration<float>(sendStart - start).count());
+  }
+}
+
+bool FrameStreamer::sendFrame(int socket, const std::vector<uint8_t> &jpeg)
+{
+  TRACE_SCOPE("stream", "send");
+  char part[128];
+  const int n = std::snprintf(part,
+      sizeof(part),
+      "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n",
+      jpeg.size());
+  return sendAll(socket, part, size_t(n))
+      && sendAll(socket, jpeg.data(), jpeg.size())
+      && sendAll(socket, "\r\n", 2);
+}
+
+// Steps quality down while frames exceed the budget of one frame at maxFps
+// (or take longer than that to encode and send), and back up when there is
+// room; the scale halves the resolution once quality is at the floor
+void FrameStreamer::adapt(size_t bytes, float sendSeconds)
+{
+  const float budget = float(m_targetBytesPerSecond) * m_minInterval;
+  int quality = m_quality;
+  int scale = m_scale;
+  if (bytes > 1.1f * budget || sendSeconds > m_minInterval) {
+    if (quality > g_minQuality) {
+      quality = std::max(g_minQuality, quality - 10);
+    } else if (scale < g_maxScale) {
+      scale *= 2;
+      quality = 60;
+    }
+  } else if (bytes < 0.6f * budget && sendSeconds < 0.5f * m_minInterval) {
+    if (quality < g_maxQuality) {
+      quality = std::min(g_maxQuality, quality + 5);
+    } else if (scale > 1) {
+      scale /= 2;
+      quality = 50;
+    }
+  }
+  m_quality = quality;
+  m_scale = scale;
+}
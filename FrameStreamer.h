@@ -0,0 +1,72 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Remote viewing of the viewport as an MJPEG stream over HTTP, so any
+// browser (or ffplay) on the other side shows it. submit() only copies the
+// mapped frame when the encoder is free and a client is watching; a worker
+// thread JPEG-encodes it and sends it. Quality (and, below the lowest
+// quality, the scale) follows the measured throughput so the stream stays
+// near the bit rate target and frames are dropped rather than queued.
+class FrameStreamer
+{
+ public:
+  FrameStreamer(int port, size_t targetKbps = 20000, float maxFps = 30.f);
+  ~FrameStreamer();
+
+  FrameStreamer(const FrameStreamer &) = delete;
+  FrameStreamer &operator=(const FrameStreamer &) = delete;
+
+  bool listening() const;
+  bool watched() const; // a client is connected
+
+  // RGBA8 pixels, bottom row first, as mapped from channel.color
+  void submit(const uint32_t *rgba, int width, int height);
+
+  // For the overlay: current JPEG quality, scale divisor and kbit/s sent
+  int quality() const;
+  int scale() const;
+  float kbps() const;
+
+ private:
+  void acceptLoop();
+  void encodeLoop();
+  bool sendFrame(int socket, const std::vector<uint8_t> &jpeg);
+  void adapt(size_t bytes, float sendSeconds);
+
+  int m_port{0};
+  int m_listener{-1};
+  size_t m_targetBytesPerSecond{0};
+  float m_minInterval{0.f}; // seconds between frames at maxFps
+
+  std::atomic<bool> m_stop{false};
+  std::atomic<int> m_client{-1}; // socket of the watching client
+  std::thread m_acceptThread;
+  std::thread m_encodeThread;
+
+  // the frame handed to the encoder, top row first
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::vector<uint8_t> m_pending;
+  int m_width{0}, m_height{0};
+  bool m_havePending{false};
+  std::chrono::steady_clock::time_point m_lastSubmit;
+  // clients replaced by a newer one, shut down by acceptLoop and closed by
+  // encodeLoop once it is not sending to them
+  std::vector<int> m_retired;
+  bool m_clientChanged{false}; // encodeLoop resends its last frame
+
+  std::atomic<int> m_quality{80};
+  std::atomic<int> m_scale{1};
+  std::atomic<float> m_kbps{0.f};
+};
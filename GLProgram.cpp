@@ -0,0 +1,141 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "GLProgram.h"
+// std
+#include <cstdio>
+#include <cstring>
+
+static const char *s_vertexShader = R"(
+void main()
+{
+  // one triangle covering the viewport
+  vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(2.0 * p - 1.0, 0.0, 1.0);
+}
+)";
+
+bool isGLES()
+{
+  const auto *version =
+      reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  return version && std::strstr(version, "OpenGL ES");
+}
+
+static const char *versionHeader()
+{
+  if (isGLES())
+    return "#version 300 es\nprecision highp float;\nprecision highp int;\n";
+  return "#version 330 core\n";
+}
+
+static GLuint compileShader(GLenum type, const char *name, const char *source)
+{
+  const char *sources[2] = {versionHeader(), source};
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 2, sources, nullptr);
+  glCompileShader(shader);
+  GLint ok = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+  if (!ok) {
+    char log[1024];
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    fprintf(stderr, "%s shader: %s\n", name, log);
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+GLuint buildFullscreenProgram(const char *name, const char *fragmentSource)
+{
+  return buildProgram(name, s_vertexShader, fragmentSource);
+}
+
+GLuint buildProgram(
+    const char *name, const char *vertexSource, const char *fragmentSource)
+{
+  GLuint program = 0;
+  GLuint vs = compileShader(GL_VERTEX_SHADER, name, vertexSource);
+  GLuint fs = compileShader(GL_FRAGMENT_SHADER, name, fragmentSource);
+  if (vs && fs) {
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+      fprintf(stderr, "%s shader does not link\n", name);
+      glDeleteProgram(program);
+      program = 0;
+    }
+  }
+  if (vs)
+    glDeleteShader(vs);
+  if (fs)
+    glDeleteShader(fs);
+  return program;
+}
+
+GLStateGuard::GLStateGuard()
+{
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_drawFramebuffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &m_readFramebuffer);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &m_program);
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &m_vertexArray);
+  glGetIntegerv(GL_ACTIVE_TEXTURE, &m_activeTexture);
+  glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &m_packBuffer);
+  glGetIntegerv(GL_VIEWPORT, m_viewport);
+  glGetIntegerv(GL_BLEND_EQUATION_RGB, &m_blendEquation[0]);
+  glGetIntegerv(GL_BLEND_EQUATION_ALPHA, &m_blendEquation[1]);
+  glGetIntegerv(GL_BLEND_SRC_RGB, &m_blendFunc[0]);
+  glGetIntegerv(GL_BLEND_DST_RGB, &m_blendFunc[1]);
+  glGetIntegerv(GL_BLEND_SRC_ALPHA, &m_blendFunc[2]);
+  glGetIntegerv(GL_BLEND_DST_ALPHA, &m_blendFunc[3]);
+  glGetIntegerv(GL_DEPTH_FUNC, &m_depthFunc);
+  glGetBooleanv(GL_DEPTH_WRITEMASK, &m_depthMask);
+  for (int unit = 0; unit < 2; ++unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &m_textures[unit]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  m_blend = glIsEnabled(GL_BLEND);
+  m_scissor = glIsEnabled(GL_SCISSOR_TEST);
+  m_depth = glIsEnabled(GL_DEPTH_TEST);
+  // GLES sizes points from gl_PointSize always, without the enable
+  m_desktop = !isGLES();
+  if (m_desktop)
+    m_pointSize = glIsEnabled(GL_PROGRAM_POINT_SIZE);
+  glDisable(GL_BLEND);
+  glDisable(GL_SCISSOR_TEST);
+  glDisable(GL_DEPTH_TEST);
+}
+
+GLStateGuard::~GLStateGuard()
+{
+  glBindVertexArray(m_vertexArray);
+  for (int unit = 0; unit < 2; ++unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, m_textures[unit]);
+  }
+  glActiveTexture(m_activeTexture);
+  glUseProgram(m_program);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, m_packBuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_drawFramebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_readFramebuffer);
+  glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+  glBlendEquationSeparate(m_blendEquation[0], m_blendEquation[1]);
+  glBlendFuncSeparate(
+      m_blendFunc[0], m_blendFunc[1], m_blendFunc[2], m_blendFunc[3]);
+  glDepthFunc(m_depthFunc);
+  glDepthMask(m_depthMask);
+  if (m_blend)
+    glEnable(GL_BLEND);
+  if (m_scissor)
+    glEnable(GL_SCISSOR_TEST);
+  if (m_depth)
+    glEnable(GL_DEPTH_TEST);
+  if (m_desktop && !m_pointSize)
+    glDisable(GL_PROGRAM_POINT_SIZE);
+}
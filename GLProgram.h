@@ -0,0 +1,62 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// glad
+#include "glad/glad.h"
+
+// Fullscreen passes /////////////////////////////////////////////////////////
+//
+// The GL passes on the display textures (ToneMapper, EdgeFilter,
+// ImageOverlay) draw one triangle covering the viewport, from gl_VertexID
+// and an empty vertex array. Their fragment shaders are written without a
+// #version line: the one of the current context is put in front, GLSL 3.30
+// core on desktop GL and GLSL ES 3.00 (with highp defaults) on GLES 3
+// contexts, so the passes run on both.
+
+// Whether the current context is GLES (GL_VERSION names "OpenGL ES"),
+// for the calls desktop GL takes and GLES does not
+bool isGLES();
+
+// Links the fullscreen triangle with `fragmentSource`; must be called with
+// the GL context current. 0 if it does not compile or link, with the log on
+// stderr prefixed by `name`.
+GLuint buildFullscreenProgram(const char *name, const char *fragmentSource);
+// The same with a vertex shader of the pass's own (FrameReprojector's
+// points), also without a #version line
+GLuint buildProgram(
+    const char *name, const char *vertexSource, const char *fragmentSource);
+
+// The passes are called between ImGui frames and leave the GL state as
+// found: a guard on the stack saves the bindings they touch (framebuffers,
+// program, vertex array, textures of units 0 and 1, pack buffer), the
+// viewport, blending, depth and the enables, and puts them back when the
+// pass returns. Blending, scissor and depth test start out disabled.
+class GLStateGuard
+{
+ public:
+  GLStateGuard();
+  ~GLStateGuard();
+  GLStateGuard(const GLStateGuard &) = delete;
+  GLStateGuard &operator=(const GLStateGuard &) = delete;
+
+ private:
+  GLint m_drawFramebuffer{0};
+  GLint m_readFramebuffer{0};
+  GLint m_program{0};
+  GLint m_vertexArray{0};
+  GLint m_activeTexture{0};
+  GLint m_textures[2]{0, 0};
+  GLint m_packBuffer{0};
+  GLint m_viewport[4]{0, 0, 0, 0};
+  GLint m_blendEquation[2]{GL_FUNC_ADD, GL_FUNC_ADD};
+  GLint m_blendFunc[4]{GL_ONE, GL_ZERO, GL_ONE, GL_ZERO};
+  GLint m_depthFunc{GL_LESS};
+  GLboolean m_depthMask{GL_TRUE};
+  GLboolean m_blend{GL_FALSE};
+  GLboolean m_scissor{GL_FALSE};
+  GLboolean m_depth{GL_FALSE};
+  bool m_desktop{true};
+  GLboolean m_pointSize{GL_FALSE};
+};
@@ -0,0 +1,238 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "GpuCounters.h"
+// std
+#include <memory>
+// dlopen
+#include <dlfcn.h>
+
+// The few entry points used, declared here so neither SDK is needed to
+// build; both return 0 on success
+struct GpuCounters::Library
+{
+  void *handle{nullptr};
+  bool nvml{false}; // else ROCm SMI
+  unsigned index{0};
+
+  // NVML
+  using nvmlDevice = void *;
+  struct nvmlUtilization
+  {
+    unsigned gpu;
+    unsigned memory;
+  };
+  struct nvmlMemory
+  {
+    unsigned long long total;
+    unsigned long long free;
+    unsigned long long used;
+  };
+  enum
+  {
+    NVML_CLOCK_GRAPHICS = 0,
+    NVML_CLOCK_MEM = 2,
+    NVML_PCIE_UTIL_TX_BYTES = 0,
+    NVML_PCIE_UTIL_RX_BYTES = 1,
+  };
+  nvmlDevice device{nullptr};
+  int (*nvmlShutdown)(){nullptr};
+  int (*nvmlDeviceGetUtilizationRates)(nvmlDevice, nvmlUtilization *){
+      nullptr};
+  int (*nvmlDeviceGetMemoryInfo)(nvmlDevice, nvmlMemory *){nullptr};
+  int (*nvmlDeviceGetClockInfo)(nvmlDevice, int, unsigned *){nullptr};
+  int (*nvmlDeviceGetPcieThroughput)(nvmlDevice, int, unsigned *){nullptr};
+
+  // ROCm SMI
+  enum
+  {
+    RSMI_MEM_TYPE_VRAM = 0,
+  };
+  int (*rsmi_shut_down)(){nullptr};
+  int (*rsmi_dev_busy_percent_get)(uint32_t, uint32_t *){nullptr};
+  int (*rsmi_dev_memory_usage_get)(uint32_t, int, uint64_t *){nullptr};
+  int (*rsmi_dev_memory_total_get)(uint32_t, int, uint64_t *){nullptr};
+  int (*rsmi_dev_pci_throughput_get)(
+      uint32_t, uint64_t *, uint64_t *, uint64_t *){nullptr};
+
+  template <typename F>
+  bool symbol(F &f, const char *name)
+  {
+    f = reinterpret_cast<F>(dlsym(handle, name));
+    return f != nullptr;
+  }
+
+  bool openNvml(unsigned device)
+  {
+    handle = dlopen("libnvidia-ml.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+      return false;
+    int (*init)() = nullptr;
+    int (*getHandle)(unsigned, nvmlDevice *) = nullptr;
+    if (!symbol(init, "nvmlInit_v2")
+        || !symbol(getHandle, "nvmlDeviceGetHandleByIndex_v2")
+        || !symbol(nvmlShutdown, "nvmlShutdown") || init() != 0) {
+      close();
+      return false;
+    }
+    if (getHandle(device, &this->device) != 0) {
+      nvmlShutdown();
+      close();
+      return false;
+    }
+    // the optional ones may be missing in old drivers
+    symbol(nvmlDeviceGetUtilizationRates, "nvmlDeviceGetUtilizationRates");
+    symbol(nvmlDeviceGetMemoryInfo, "nvmlDeviceGetMemoryInfo");
+    symbol(nvmlDeviceGetClockInfo, "nvmlDeviceGetClockInfo");
+    symbol(nvmlDeviceGetPcieThroughput, "nvmlDeviceGetPcieThroughput");
+    nvml = true;
+    return true;
+  }
+
+  bool openRocmSmi(unsigned device)
+  {
+    handle = dlopen("librocm_smi64.so", RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+      handle = dlopen("librocm_smi64.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+      return false;
+    int (*init)(uint64_t) = nullptr;
+    int (*numDevices)(uint32_t *) = nullptr;
+    uint32_t count = 0;
+    if (!symbol(init, "rsmi_init")
+        || !symbol(numDevices, "rsmi_num_monitor_devices")
+        || !symbol(rsmi_shut_down, "rsmi_shut_down") || init(0) != 0) {
+      close();
+      return false;
+    }
+    if (numDevices(&count) != 0 || device >= count) {
+      rsmi_shut_down();
+      close();
+      return false;
+    }
+    index = device;
+    symbol(rsmi_dev_busy_percent_get, "rsmi_dev_busy_percent_get");
+    symbol(rsmi_dev_memory_usage_get, "rsmi_dev_memory_usage_get");
+    symbol(rsmi_dev_memory_total_get, "rsmi_dev_memory_total_get");
+    symbol(rsmi_dev_pci_throughput_get, "rsmi_dev_pci_throughput_get");
+    return true;
+  }
+
+  void close()
+  {
+    if (handle)
+      dlclose(handle);
+    handle = nullptr;
+  }
+
+  GpuSample sampleNvml() const
+  {
+    GpuSample s;
+    s.valid = true;
+    nvmlUtilization utilization{};
+    if (nvmlDeviceGetUtilizationRates
+        && nvmlDeviceGetUtilizationRates(device, &utilization) == 0)
+      s.utilization = int(utilization.gpu);
+    nvmlMemory memory{};
+    if (nvmlDeviceGetMemoryInfo
+        && nvmlDeviceGetMemoryInfo(device, &memory) == 0) {
+      s.memoryUsed = memory.used;
+      s.memoryTotal = memory.total;
+    }
+    unsigned value = 0;
+    if (nvmlDeviceGetClockInfo) {
+      if (nvmlDeviceGetClockInfo(device, NVML_CLOCK_GRAPHICS, &value) == 0)
+        s.graphicsClock = int(value);
+      if (nvmlDeviceGetClockInfo(device, NVML_CLOCK_MEM, &value) == 0)
+        s.memoryClock = int(value);
+    }
+    // KB/s over 20ms
+    if (nvmlDeviceGetPcieThroughput) {
+      if (nvmlDeviceGetPcieThroughput(device, NVML_PCIE_UTIL_RX_BYTES, &value)
+          == 0)
+        s.pcieRx = int(value);
+      if (nvmlDeviceGetPcieThroughput(device, NVML_PCIE_UTIL_TX_BYTES, &value)
+          == 0)
+        s.pcieTx = int(value);
+    }
+    return s;
+  }
+
+  // No clocks: rsmi_frequencies_t changed its layout between ROCm releases
+  GpuSample sampleRocmSmi() const
+  {
+    GpuSample s;
+    s.valid = true;
+    uint32_t busy = 0;
+    if (rsmi_dev_busy_percent_get
+        && rsmi_dev_busy_percent_get(index, &busy) == 0)
+      s.utilization = int(busy);
+    uint64_t used = 0, total = 0;
+    if (rsmi_dev_memory_usage_get
+        && rsmi_dev_memory_usage_get(index, RSMI_MEM_TYPE_VRAM, &used) == 0)
+      s.memoryUsed = used;
+    if (rsmi_dev_memory_total_get
+        && rsmi_dev_memory_total_get(index, RSMI_MEM_TYPE_VRAM, &total) == 0)
+      s.memoryTotal = total;
+    // packets of the last second; blocks for that second
+    uint64_t sent = 0, received = 0, packetSize = 0;
+    if (rsmi_dev_pci_throughput_get
+        && rsmi_dev_pci_throughput_get(index, &sent, &received, &packetSize)
+            == 0) {
+      s.pcieRx = int(received * packetSize / 1024);
+      s.pcieTx = int(sent * packetSize / 1024);
+    }
+    return s;
+  }
+};
+
+GpuCounters::GpuCounters(unsigned device, std::chrono::milliseconds interval)
+    : m_interval(interval)
+{
+  auto library = std::make_unique<Library>();
+  if (library->openNvml(device))
+    m_backend = "NVML";
+  else if (library->openRocmSmi(device))
+    m_backend = "ROCm SMI";
+  else
+    return;
+  m_library = std::move(library);
+  m_thread = std::thread([this]() { loop(); });
+}
+
+GpuCounters::~GpuCounters()
+{
+  if (!m_library)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  m_thread.join();
+  if (m_library->nvml)
+    m_library->nvmlShutdown();
+  else
+    m_library->rsmi_shut_down();
+  m_library->close();
+}
+
+GpuSample GpuCounters::latest() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_latest;
+}
+
+void GpuCounters::loop()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_stop) {
+    lock.unlock();
+    const GpuSample sample = m_library->nvml
+        ? m_library->sampleNvml()
+        : m_library->sampleRocmSmi();
+    lock.lock();
+    m_latest = sample;
+    m_cv.wait_for(lock, m_interval, [this]() { return m_stop; });
+  }
+}
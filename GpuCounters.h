@@ -0,0 +1,73 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// GPU and driver counters ///////////////////////////////////////////////////
+//
+// Utilization, VRAM, clocks and PCIe throughput of one GPU, read from NVML
+// (libnvidia-ml.so.1) or else ROCm SMI (librocm_smi64.so) on a thread of
+// its own. The libraries are loaded at runtime, so builds don't depend on
+// either and machines without them just have no counters. Next to the
+// frame latency they tell GPU-bound frames (high utilization) from
+// transfer-bound ones (PCIe) and from a slow UI thread (neither).
+
+struct GpuSample
+{
+  bool valid{false};
+  int utilization{-1}; // percent of the last sample period, -1: unknown
+  uint64_t memoryUsed{0}; // bytes
+  uint64_t memoryTotal{0};
+  int graphicsClock{-1}; // MHz
+  int memoryClock{-1};
+  int pcieRx{-1}; // KiB/s, host to device
+  int pcieTx{-1}; // KiB/s, device to host
+};
+
+class GpuCounters
+{
+ public:
+  // device: NVML's or ROCm SMI's index, which enumerate by PCI bus and may
+  // order GPUs differently from CUDA
+  explicit GpuCounters(unsigned device = 0,
+      std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+  ~GpuCounters();
+
+  GpuCounters(const GpuCounters &) = delete;
+  GpuCounters &operator=(const GpuCounters &) = delete;
+
+  bool available() const
+  {
+    return m_backend != nullptr;
+  }
+
+  // "NVML", "ROCm SMI" or nullptr
+  const char *backend() const
+  {
+    return m_backend;
+  }
+
+  GpuSample latest() const;
+
+ private:
+  struct Library;
+
+  void loop();
+
+  std::unique_ptr<Library> m_library;
+  const char *m_backend{nullptr};
+  std::chrono::milliseconds m_interval;
+  std::thread m_thread;
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stop{false};
+  GpuSample m_latest;
+};
@@ -0,0 +1,74 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <cstring>
+
+// IEEE 754 binary32 -> binary16, round to nearest even
+inline uint16_t floatToHalf(float f)
+{
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+
+  const uint32_t sign = (x >> 16) & 0x8000;
+  const uint32_t biasedExp = (x >> 23) & 0xff;
+  uint32_t mant = x & 0x7fffff;
+  const int32_t exp = int32_t(biasedExp) - 127 + 15;
+
+  if (biasedExp == 0xff) // inf/nan
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  if (exp >= 31) // overflow
+    return sign | 0x7c00;
+
+  if (exp <= 0) { // subnormal half (or zero)
+    if (exp < -10)
+      return sign;
+    mant |= 0x800000;
+    const uint32_t shift = 14 - exp;
+    uint32_t h = mant >> shift;
+    const uint32_t rem = mant & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (h & 1)))
+      ++h;
+    return sign | h;
+  }
+
+  uint32_t h = (uint32_t(exp) << 10) | (mant >> 13);
+  const uint32_t rem = mant & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+    ++h; // a carry into the exponent is the correct rounding
+  return sign | h;
+}
+
+// IEEE 754 binary16 -> binary32
+inline float halfToFloat(uint16_t h)
+{
+  const uint32_t sign = uint32_t(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t x;
+
+  if (exp == 0x1f) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else if (exp == 0) {
+    if (mant == 0) {
+      x = sign;
+    } else { // normalize subnormal
+      exp = 127 - 15 + 1;
+      while (!(mant & 0x400)) {
+        mant <<= 1;
+        --exp;
+      }
+      x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+  } else {
+    x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  }
+
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
@@ -1,8 +1,21 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// Pixels bottom row first: RGBA8 (bpp 4), 8-bit gray (bpp 1) or GRAY16
+// (bpp 2, one native uint16 per pixel; 16-bit X-ray references as decoded)
+//
+// Images are moved, or shared as std::shared_ptr<const Image>; copies of
+// the pixels have to be asked for (Image(image)), so none is made by
+// accident.
 struct Image
 {
     Image() = default;
+    // Copies the pixels at d
     Image(size_t w, size_t h, size_t b, const void* d)
         : width(w), height(h), bpp(b)
     {
@@ -10,9 +23,24 @@ struct Image
         data.resize(size);
         memcpy(data.data(), d, size);
     }
+    // Adopts the pixels, at least w * h * b bytes
+    Image(size_t w, size_t h, size_t b, std::vector<uint8_t>&& d)
+        : width(w), height(h), bpp(b), data(std::move(d))
+    {
+    }
+
+    explicit Image(const Image&) = default;
+    Image& operator=(const Image&) = default;
+    Image(Image&&) noexcept = default;
+    Image& operator=(Image&&) noexcept = default;
+
+    bool gray16() const
+    {
+        return bpp == 2;
+    }
 
-    size_t width;
-    size_t height;
-    size_t bpp;
+    size_t width{0};
+    size_t height{0};
+    size_t bpp{0};
     std::vector<uint8_t> data;
 };
@@ -0,0 +1,119 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ImageOverlay.h"
+// std
+#include <algorithm>
+// ours
+#include "GLProgram.h"
+#include "Trace.h"
+
+static const char *s_fragmentShader = R"(
+uniform sampler2D drr;
+uniform sampler2D reference;
+uniform vec2 size; // of the frame, pixels
+uniform int mode; // OverlaySettings::Mode
+uniform float opacity;
+uniform float checker;
+uniform float gain;
+out vec4 color;
+
+float luminance(vec2 p) // frame pixels
+{
+  return dot(texture(reference, p / size).rgb, vec3(1.0 / 3.0));
+}
+
+void main()
+{
+  vec3 d = texelFetch(drr, ivec2(gl_FragCoord.xy), 0).rgb;
+  vec3 r = texture(reference, gl_FragCoord.xy / size).rgb;
+  vec3 c = d;
+  if (mode == 1) {
+    c = mix(d, r, opacity);
+  } else if (mode == 2) {
+    ivec2 square = ivec2(gl_FragCoord.xy / checker);
+    c = ((square.x + square.y) & 1) == 0 ? d : r;
+  } else if (mode == 3) {
+    // Sobel at the frame's resolution
+    vec2 p = gl_FragCoord.xy;
+    float l00 = luminance(p + vec2(-1, -1)), l10 = luminance(p + vec2(0, -1));
+    float l20 = luminance(p + vec2(1, -1)), l01 = luminance(p + vec2(-1, 0));
+    float l21 = luminance(p + vec2(1, 0)), l02 = luminance(p + vec2(-1, 1));
+    float l12 = luminance(p + vec2(0, 1)), l22 = luminance(p + vec2(1, 1));
+    float gx = (l20 + 2.0 * l21 + l22) - (l00 + 2.0 * l01 + l02);
+    float gy = (l02 + 2.0 * l12 + l22) - (l00 + 2.0 * l10 + l20);
+    float edge = clamp(length(vec2(gx, gy)) * gain, 0.0, 1.0);
+    c = mix(d, vec3(0.0, 1.0, 0.0), edge * opacity);
+  } else if (mode == 4) {
+    float diff = abs(dot(d - r, vec3(1.0 / 3.0)));
+    c = vec3(clamp(diff * gain, 0.0, 1.0));
+  }
+  color = vec4(c, 1.0);
+}
+)";
+
+ImageOverlay::~ImageOverlay()
+{
+  if (m_program)
+    glDeleteProgram(m_program);
+  if (m_vertexArray)
+    glDeleteVertexArrays(1, &m_vertexArray);
+  if (m_framebuffer)
+    glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+bool ImageOverlay::init()
+{
+  m_initialized = true;
+  m_program = buildFullscreenProgram("image overlay", s_fragmentShader);
+  if (!m_program)
+    return false;
+
+  m_sizeLocation = glGetUniformLocation(m_program, "size");
+  m_modeLocation = glGetUniformLocation(m_program, "mode");
+  m_opacityLocation = glGetUniformLocation(m_program, "opacity");
+  m_checkerLocation = glGetUniformLocation(m_program, "checker");
+  m_gainLocation = glGetUniformLocation(m_program, "gain");
+  glUseProgram(m_program);
+  glUniform1i(glGetUniformLocation(m_program, "drr"), 0);
+  glUniform1i(glGetUniformLocation(m_program, "reference"), 1);
+  glUseProgram(0);
+  glGenVertexArrays(1, &m_vertexArray);
+  glGenFramebuffers(1, &m_framebuffer);
+  return true;
+}
+
+bool ImageOverlay::apply(GLuint drr,
+    GLuint reference,
+    GLuint target,
+    int width,
+    int height,
+    const OverlaySettings &settings)
+{
+  TRACE_SCOPE("gl", "image overlay");
+  if (!m_initialized)
+    init();
+  if (!m_program)
+    return false;
+
+  GLStateGuard state;
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTexture2D(
+      GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+  glViewport(0, 0, width, height);
+  glUseProgram(m_program);
+  glUniform2f(m_sizeLocation, float(width), float(height));
+  glUniform1i(m_modeLocation, settings.mode);
+  glUniform1f(m_opacityLocation, std::clamp(settings.opacity, 0.f, 1.f));
+  glUniform1f(m_checkerLocation, float(std::max(1, settings.checkerSize)));
+  glUniform1f(m_gainLocation, settings.gain);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, reference);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, drr);
+  glBindVertexArray(m_vertexArray);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  return true;
+}
@@ -0,0 +1,62 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// glad
+#include "glad/glad.h"
+
+// How the reference image is shown over the DRR
+struct OverlaySettings
+{
+  enum Mode : int
+  {
+    None,
+    Blend, // reference blended in with `opacity`
+    Checkerboard, // squares of `checkerSize` pixels alternate
+    Edges, // reference edges (Sobel) drawn in green
+    Difference // absolute luminance difference times `gain`
+  };
+
+  int mode{None};
+  float opacity{0.5f};
+  int checkerSize{32}; // frame pixels
+  float gain{4.f}; // of edges and the difference
+};
+
+// Shows the reference image over the DRR: a fullscreen-triangle pass reads
+// the RGBA8 DRR texture and the reference texture and writes the mix into
+// a third texture, so nothing is read back to the host. The reference is
+// stretched over the frame, pixels aligned as the matchers compare them.
+class ImageOverlay
+{
+ public:
+  ImageOverlay() = default;
+  ~ImageOverlay();
+
+  ImageOverlay(const ImageOverlay &) = delete;
+  ImageOverlay &operator=(const ImageOverlay &) = delete;
+
+  // Must be called with the GL context current; mixes the lower left
+  // width x height pixels of `drr` with all of `reference` into the same
+  // pixels of `target`. False if the shader could not be built.
+  bool apply(GLuint drr,
+      GLuint reference,
+      GLuint target,
+      int width,
+      int height,
+      const OverlaySettings &settings);
+
+ private:
+  bool init();
+
+  GLuint m_program{0};
+  GLuint m_vertexArray{0};
+  GLuint m_framebuffer{0};
+  GLint m_sizeLocation{-1};
+  GLint m_modeLocation{-1};
+  GLint m_opacityLocation{-1};
+  GLint m_checkerLocation{-1};
+  GLint m_gainLocation{-1};
+  bool m_initialized{false};
+};
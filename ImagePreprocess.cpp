@@ -0,0 +1,608 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ImagePreprocess.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+// ours
+#include "Parallel.h"
+#include "Trace.h"
+
+namespace {
+
+constexpr char g_magic[8] = {'R', 'E', 'F', 'P', 'R', 'E', 'P', '2'};
+
+// followed by the rows as in Image, at an offset of 32 bytes
+struct Header
+{
+  char magic[8];
+  uint64_t key;
+  uint32_t width;
+  uint32_t height;
+  uint32_t bpp;
+  uint32_t reserved;
+};
+
+// FNV-1a
+struct Hash
+{
+  uint64_t value{14695981039346656037ull};
+
+  void add(const void *data, size_t size)
+  {
+    auto *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i) {
+      value ^= p[i];
+      value *= 1099511628211ull;
+    }
+  }
+
+  template <typename T>
+  void add(const T &v)
+  {
+    add(&v, sizeof(v));
+  }
+};
+
+uint8_t toByte(float v)
+{
+  return uint8_t(std::clamp(v + 0.5f, 0.f, 255.f));
+}
+
+// Source pixels and weights of one output pixel of resizeImage()
+struct Contribution
+{
+  size_t first{0};
+  std::vector<float> weights;
+};
+
+std::vector<Contribution> contributions(size_t srcSize, size_t dstSize)
+{
+  const float scale = float(dstSize) / float(srcSize);
+  const float support = scale < 1.f ? 1.f / scale : 1.f; // triangle radius
+  std::vector<Contribution> result(dstSize);
+  for (size_t i = 0; i < dstSize; ++i) {
+    const float center = (float(i) + 0.5f) / scale;
+    const size_t lo = size_t(std::max(0.f, std::floor(center - support)));
+    const size_t hi = std::min(
+        srcSize - 1, size_t(std::max(0.f, std::ceil(center + support))));
+    auto &c = result[i];
+    c.first = lo;
+    float sum = 0.f;
+    for (size_t j = lo; j <= hi; ++j) {
+      const float d = std::abs(float(j) + 0.5f - center) / support;
+      c.weights.push_back(std::max(0.f, 1.f - d));
+      sum += c.weights.back();
+    }
+    if (sum <= 0.f) {
+      // between two source pixels of an enlarged image: the nearest
+      c.first = std::min(srcSize - 1, size_t(center));
+      c.weights.assign(1, 1.f);
+      continue;
+    }
+    for (auto &w : c.weights)
+      w /= sum;
+  }
+  return result;
+}
+
+} // namespace
+
+bool PreprocessPipeline::empty() const
+{
+  return steps.empty();
+}
+
+uint64_t PreprocessPipeline::hash() const
+{
+  Hash h;
+  for (const auto &step : steps) {
+    h.add(int32_t(step.type));
+    h.add(step.a);
+    h.add(step.b);
+  }
+  return h.value;
+}
+
+Image PreprocessPipeline::apply(const Image &image) const
+{
+  TRACE_SCOPE("images", "preprocess");
+  Image result = rgbaImage(image);
+  for (const auto &step : steps) {
+    switch (step.type) {
+    case PreprocessStep::Clahe:
+      claheImage(result, int(step.a), step.b);
+      break;
+    case PreprocessStep::Gaussian:
+      gaussianBlur(result, step.a);
+      break;
+    case PreprocessStep::Resize: {
+      const size_t longer = std::max(result.width, result.height);
+      if (longer == 0 || step.a < 1.f)
+        break;
+      const float scale = step.a / float(longer);
+      const size_t width =
+          std::max<size_t>(1, size_t(std::lround(result.width * scale)));
+      const size_t height =
+          std::max<size_t>(1, size_t(std::lround(result.height * scale)));
+      if (width != result.width || height != result.height)
+        result = resizeImage(result, width, height);
+      break;
+    }
+    }
+  }
+  return result;
+}
+
+bool PreprocessPipeline::parse(
+    const std::string &text, PreprocessPipeline &pipeline)
+{
+  PreprocessPipeline parsed;
+  std::stringstream list(text);
+  std::string token;
+  while (std::getline(list, token, ',')) {
+    std::vector<std::string> fields;
+    std::stringstream parts(token);
+    std::string field;
+    while (std::getline(parts, field, ':'))
+      fields.push_back(field);
+    if (fields.empty())
+      return false;
+
+    PreprocessStep step;
+    auto number = [&](size_t i, float fallback) {
+      return i < fields.size() ? float(std::atof(fields[i].c_str())) : fallback;
+    };
+    if (fields[0] == "clahe" && fields.size() <= 3) {
+      step.type = PreprocessStep::Clahe;
+      step.a = number(1, 8.f);
+      step.b = number(2, 2.f);
+      if (step.a < 1.f || step.b <= 0.f)
+        return false;
+    } else if (fields[0] == "gauss" && fields.size() == 2) {
+      step.type = PreprocessStep::Gaussian;
+      step.a = number(1, 0.f);
+      if (step.a <= 0.f)
+        return false;
+    } else if (fields[0] == "resize" && fields.size() == 2) {
+      step.type = PreprocessStep::Resize;
+      step.a = number(1, 0.f);
+      if (step.a < 1.f)
+        return false;
+    } else {
+      return false;
+    }
+    parsed.steps.push_back(step);
+  }
+  if (parsed.empty())
+    return false;
+  pipeline = std::move(parsed);
+  return true;
+}
+
+void claheImage(Image &image, int tiles, float clipLimit)
+{
+  TRACE_SCOPE("images", "CLAHE");
+  const size_t width = image.width;
+  const size_t height = image.height;
+  if (image.bpp != 4 || width == 0 || height == 0)
+    return;
+
+  const size_t tilesX = std::clamp<size_t>(size_t(std::max(1, tiles)), 1, width);
+  const size_t tilesY =
+      std::clamp<size_t>(size_t(std::max(1, tiles)), 1, height);
+  const size_t tileW = (width + tilesX - 1) / tilesX;
+  const size_t tileH = (height + tilesY - 1) / tilesY;
+
+  // one map per tile from its clipped luminance histogram
+  std::vector<float> maps(tilesX * tilesY * 256);
+  parallelFor(
+      0,
+      tilesX * tilesY,
+      [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+          const size_t x0 = (t % tilesX) * tileW;
+          const size_t y0 = (t / tilesX) * tileH;
+          const size_t x1 = std::min(width, x0 + tileW);
+          const size_t y1 = std::min(height, y0 + tileH);
+          uint32_t histogram[256]{};
+          for (size_t y = y0; y < y1; ++y) {
+            const uint8_t *row = image.data.data() + y * width * 4;
+            for (size_t x = x0; x < x1; ++x) {
+              const uint8_t *p = row + x * 4;
+              histogram[(p[0] + p[1] + p[2]) / 3]++;
+            }
+          }
+
+          const size_t count = (x1 - x0) * (y1 - y0);
+          const uint32_t limit = std::max<uint32_t>(
+              1, uint32_t(clipLimit * float(count) / 256.f));
+          uint32_t excess = 0;
+          for (auto &bin : histogram) {
+            if (bin > limit) {
+              excess += bin - limit;
+              bin = limit;
+            }
+          }
+          float *map = maps.data() + t * 256;
+          const float spread = float(excess) / 256.f;
+          float cdf = 0.f;
+          for (int v = 0; v < 256; ++v) {
+            cdf += float(histogram[v]) + spread;
+            map[v] = 255.f * cdf / float(count);
+          }
+        }
+      },
+      1);
+
+  // each pixel blends the maps of the four tiles around it
+  parallelFor(
+      0,
+      height,
+      [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+          const float fy = (float(y) + 0.5f) / float(tileH) - 0.5f;
+          const size_t ty0 = size_t(std::clamp(
+              std::floor(fy), 0.f, float(tilesY - 1)));
+          const size_t ty1 = std::min(ty0 + 1, tilesY - 1);
+          const float wy = std::clamp(fy - float(ty0), 0.f, 1.f);
+          uint8_t *row = image.data.data() + y * width * 4;
+          for (size_t x = 0; x < width; ++x) {
+            const float fx = (float(x) + 0.5f) / float(tileW) - 0.5f;
+            const size_t tx0 = size_t(std::clamp(
+                std::floor(fx), 0.f, float(tilesX - 1)));
+            const size_t tx1 = std::min(tx0 + 1, tilesX - 1);
+            const float wx = std::clamp(fx - float(tx0), 0.f, 1.f);
+            const float *m00 = maps.data() + (ty0 * tilesX + tx0) * 256;
+            const float *m10 = maps.data() + (ty0 * tilesX + tx1) * 256;
+            const float *m01 = maps.data() + (ty1 * tilesX + tx0) * 256;
+            const float *m11 = maps.data() + (ty1 * tilesX + tx1) * 256;
+            uint8_t *p = row + x * 4;
+            for (int c = 0; c < 3; ++c) {
+              const uint8_t v = p[c];
+              const float top = m00[v] + wx * (m10[v] - m00[v]);
+              const float bottom = m01[v] + wx * (m11[v] - m01[v]);
+              p[c] = toByte(top + wy * (bottom - top));
+            }
+          }
+        }
+      },
+      64);
+}
+
+void gaussianBlur(Image &image, float sigma)
+{
+  TRACE_SCOPE("images", "gaussian");
+  const size_t width = image.width;
+  const size_t height = image.height;
+  if (image.bpp != 4 || width == 0 || height == 0 || sigma <= 0.f)
+    return;
+
+  const int radius = std::max(1, int(std::ceil(3.f * sigma)));
+  std::vector<float> kernel(2 * radius + 1);
+  float sum = 0.f;
+  for (int k = -radius; k <= radius; ++k) {
+    kernel[k + radius] = std::exp(-0.5f * float(k * k) / (sigma * sigma));
+    sum += kernel[k + radius];
+  }
+  for (auto &w : kernel)
+    w /= sum;
+
+  const size_t rowFloats = width * 4;
+  std::vector<float> blurred(rowFloats * height);
+
+  // rows: into a row padded by the radius, clamped, then one tap at a time
+  // over the whole row
+  parallelFor(
+      0,
+      height,
+      [&](size_t begin, size_t end) {
+        std::vector<float> padded((width + 2 * radius) * 4);
+        for (size_t y = begin; y < end; ++y) {
+          const uint8_t *src = image.data.data() + y * rowFloats;
+          for (size_t x = 0; x < width + 2 * radius; ++x) {
+            const size_t sx = size_t(std::clamp<ptrdiff_t>(
+                ptrdiff_t(x) - radius, 0, ptrdiff_t(width) - 1));
+            for (int c = 0; c < 4; ++c)
+              padded[x * 4 + c] = float(src[sx * 4 + c]);
+          }
+          float *out = blurred.data() + y * rowFloats;
+          std::fill(out, out + rowFloats, 0.f);
+          for (int k = 0; k <= 2 * radius; ++k) {
+            const float w = kernel[k];
+            const float *in = padded.data() + k * 4;
+            for (size_t i = 0; i < rowFloats; ++i)
+              out[i] += w * in[i];
+          }
+        }
+      },
+      16);
+
+  // columns: whole rows per tap
+  parallelFor(
+      0,
+      height,
+      [&](size_t begin, size_t end) {
+        std::vector<float> acc(rowFloats);
+        for (size_t y = begin; y < end; ++y) {
+          std::fill(acc.begin(), acc.end(), 0.f);
+          for (int k = -radius; k <= radius; ++k) {
+            const size_t sy = size_t(std::clamp<ptrdiff_t>(
+                ptrdiff_t(y) + k, 0, ptrdiff_t(height) - 1));
+            const float w = kernel[k + radius];
+            const float *in = blurred.data() + sy * rowFloats;
+            for (size_t i = 0; i < rowFloats; ++i)
+              acc[i] += w * in[i];
+          }
+          uint8_t *dst = image.data.data() + y * rowFloats;
+          for (size_t i = 0; i < rowFloats; ++i) {
+            if (i % 4 != 3)
+              dst[i] = toByte(acc[i]);
+          }
+        }
+      },
+      16);
+}
+
+Image resizeImage(const Image &image, size_t width, size_t height)
+{
+  TRACE_SCOPE("images", "resize");
+  if (image.bpp != 4 || image.width == 0 || image.height == 0
+      || (width == image.width && height == image.height))
+    return Image(image);
+
+  const auto columns = contributions(image.width, width);
+  const auto rows = contributions(image.height, height);
+
+  // horizontal: every source row to the new width
+  const size_t rowFloats = width * 4;
+  std::vector<float> horizontal(rowFloats * image.height);
+  parallelFor(
+      0,
+      image.height,
+      [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+          const uint8_t *src = image.data.data() + y * image.width * 4;
+          float *out = horizontal.data() + y * rowFloats;
+          for (size_t x = 0; x < width; ++x) {
+            const auto &c = columns[x];
+            float acc[4]{0.f, 0.f, 0.f, 0.f};
+            for (size_t j = 0; j < c.weights.size(); ++j) {
+              const uint8_t *p = src + (c.first + j) * 4;
+              for (int ch = 0; ch < 4; ++ch)
+                acc[ch] += c.weights[j] * float(p[ch]);
+            }
+            std::copy_n(acc, 4, out + x * 4);
+          }
+        }
+      },
+      16);
+
+  // vertical: whole rows per tap
+  Image result;
+  result.width = width;
+  result.height = height;
+  result.bpp = 4;
+  result.data.resize(rowFloats * height);
+  parallelFor(
+      0,
+      height,
+      [&](size_t begin, size_t end) {
+        std::vector<float> acc(rowFloats);
+        for (size_t y = begin; y < end; ++y) {
+          const auto &c = rows[y];
+          std::fill(acc.begin(), acc.end(), 0.f);
+          for (size_t j = 0; j < c.weights.size(); ++j) {
+            const float w = c.weights[j];
+            const float *in = horizontal.data() + (c.first + j) * rowFloats;
+            for (size_t i = 0; i < rowFloats; ++i)
+              acc[i] += w * in[i];
+          }
+          uint8_t *dst = result.data.data() + y * rowFloats;
+          for (size_t i = 0; i < rowFloats; ++i)
+            dst[i] = toByte(acc[i]);
+        }
+      },
+      16);
+  return result;
+}
+
+void rgbaToGray(const uint8_t *rgba, size_t count, uint8_t *gray)
+{
+  // integer weights summing to 256, branch-free, so the loop vectorizes
+  parallelFor(
+      0,
+      count,
+      [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          const uint8_t *p = rgba + 4 * i;
+          gray[i] =
+              uint8_t((77u * p[0] + 150u * p[1] + 29u * p[2] + 128u) >> 8);
+        }
+      },
+      size_t(1) << 18);
+}
+
+void rgbaToBgra(const uint8_t *rgba, size_t count, uint8_t *bgra)
+{
+  parallelFor(
+      0,
+      count,
+      [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          uint32_t p;
+          std::memcpy(&p, rgba + 4 * i, 4);
+          // little endian: R is the low byte
+          p = (p & 0xff00ff00u) | ((p & 0xffu) << 16) | ((p >> 16) & 0xffu);
+          std::memcpy(bgra + 4 * i, &p, 4);
+        }
+      },
+      size_t(1) << 18);
+}
+
+void gray16Range(const Image &image, uint16_t &lower, uint16_t &upper)
+{
+  const auto *values = reinterpret_cast<const uint16_t *>(image.data.data());
+  const size_t count = image.data.size() / 2;
+  uint16_t lo = 65535, hi = 0;
+  for (size_t i = 0; i < count; ++i) {
+    lo = std::min(lo, values[i]);
+    hi = std::max(hi, values[i]);
+  }
+  lower = count ? lo : 0;
+  upper = count ? hi : 65535;
+}
+
+// Calls put(i, byte) for the pixels of a GRAY16 image, windowed to 8 bits
+template <typename Put>
+static void gray16ToBytes(const Image &image, Put &&put)
+{
+  uint16_t lower, upper;
+  gray16Range(image, lower, upper);
+  const float scale = upper > lower ? 255.f / float(upper - lower) : 0.f;
+  const auto *values = reinterpret_cast<const uint16_t *>(image.data.data());
+  parallelFor(
+      0,
+      image.width * image.height,
+      [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+          put(i, toByte(float(values[i] - lower) * scale));
+      },
+      size_t(1) << 18);
+}
+
+Image rgbaImage(const Image &image)
+{
+  if (!image.gray16())
+    return Image(image);
+  TRACE_SCOPE("images", "GRAY16 to RGBA");
+  Image result;
+  result.width = image.width;
+  result.height = image.height;
+  result.bpp = 4;
+  result.data.resize(image.width * image.height * 4);
+  gray16ToBytes(image, [&](size_t i, uint8_t v) {
+    const uint32_t p = v * 0x010101u | 0xff000000u;
+    std::memcpy(result.data.data() + 4 * i, &p, 4);
+  });
+  return result;
+}
+
+std::shared_ptr<const Image> rgbaImage(std::shared_ptr<const Image> image)
+{
+  if (!image || !image->gray16())
+    return image;
+  return std::make_shared<const Image>(rgbaImage(*image));
+}
+
+Image grayImage(const Image &image)
+{
+  TRACE_SCOPE("images", "to gray");
+  Image result;
+  result.width = image.width;
+  result.height = image.height;
+  result.bpp = 1;
+  result.data.resize(image.width * image.height);
+  if (image.gray16())
+    gray16ToBytes(image, [&](size_t i, uint8_t v) { result.data[i] = v; });
+  else
+    rgbaToGray(image.data.data(), result.data.size(), result.data.data());
+  return result;
+}
+
+Image bgraImage(const Image &image)
+{
+  if (image.gray16())
+    return rgbaImage(image); // gray: the same in either order
+  TRACE_SCOPE("images", "to BGRA");
+  Image result;
+  result.width = image.width;
+  result.height = image.height;
+  result.bpp = 4;
+  result.data.resize(image.data.size());
+  rgbaToBgra(image.data.data(), image.width * image.height, result.data.data());
+  return result;
+}
+
+uint64_t preprocessKey(
+    const std::string &filename, const PreprocessPipeline &pipeline)
+{
+  Hash h;
+  h.add(filename.data(), filename.size());
+  std::error_code ec;
+  const uint64_t size = std::filesystem::file_size(filename, ec);
+  const int64_t mtime = ec
+      ? 0
+      : int64_t(std::filesystem::last_write_time(filename, ec)
+                    .time_since_epoch()
+                    .count());
+  h.add(size);
+  h.add(mtime);
+  h.add(pipeline.hash());
+  return h.value;
+}
+
+static std::filesystem::path preprocessedFile(
+    const std::string &dir, uint64_t key)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.ref", (unsigned long long)key);
+  return std::filesystem::path(dir) / name;
+}
+
+std::shared_ptr<const Image> readPreprocessed(
+    const std::string &dir, uint64_t key)
+{
+  std::ifstream in(preprocessedFile(dir, key), std::ios::binary);
+  Header header;
+  if (!in || !in.read(reinterpret_cast<char *>(&header), sizeof(header))
+      || std::memcmp(header.magic, g_magic, sizeof(g_magic)) != 0
+      || header.key != key || header.width == 0 || header.height == 0
+      || (header.bpp != 1 && header.bpp != 2 && header.bpp != 4))
+    return nullptr;
+
+  auto image = std::make_shared<Image>();
+  image->width = header.width;
+  image->height = header.height;
+  image->bpp = header.bpp;
+  image->data.resize(image->width * image->height * image->bpp);
+  if (!in.read(reinterpret_cast<char *>(image->data.data()),
+          std::streamsize(image->data.size())))
+    return nullptr;
+  return image;
+}
+
+void writePreprocessed(const std::string &dir, uint64_t key, const Image &image)
+{
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  const auto file = preprocessedFile(dir, key);
+  auto tmp = file;
+  tmp += ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary);
+    Header header{};
+    std::memcpy(header.magic, g_magic, sizeof(g_magic));
+    header.key = key;
+    header.width = uint32_t(image.width);
+    header.height = uint32_t(image.height);
+    header.bpp = uint32_t(image.bpp);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(image.data.data()),
+        std::streamsize(image.data.size()));
+    if (!out) {
+      fprintf(stderr, "could not write %s\n", tmp.c_str());
+      out.close();
+      std::filesystem::remove(tmp, ec);
+      return;
+    }
+  }
+  std::filesystem::rename(tmp, file, ec);
+}
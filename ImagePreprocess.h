@@ -0,0 +1,92 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+// ours
+#include "Image.h"
+
+// Preprocessing of reference images before matching /////////////////////////
+//
+// X-ray references usually want contrast equalization, denoising and a
+// smaller size before a matcher looks at them. A pipeline of such steps is
+// applied once per image (see ImageStore::reference()). The kernels work on
+// RGBA8 images in float rows whose inner loops run over contiguous pixels,
+// so they vectorize, with rows spread over threads; alpha is kept. GRAY16
+// images are converted to RGBA8 (rgbaImage()) by the first step.
+
+struct PreprocessStep
+{
+  enum Type : int
+  {
+    Clahe, // a: tiles per side, b: clip limit (times the mean bin count)
+    Gaussian, // a: sigma in pixels
+    Resize // a: longer side in pixels, the aspect is kept
+  };
+
+  Type type{Clahe};
+  float a{0.f};
+  float b{0.f};
+};
+
+struct PreprocessPipeline
+{
+  std::vector<PreprocessStep> steps;
+
+  bool empty() const;
+  // Of the steps and their parameters; keys cached results
+  uint64_t hash() const;
+  Image apply(const Image &image) const;
+
+  // Comma-separated steps, applied in order: "clahe[:<tiles>[:<clip>]]"
+  // (default 8 tiles, clip 2), "gauss:<sigma>" and "resize:<pixels>".
+  // False, leaving the pipeline untouched, on anything else.
+  static bool parse(const std::string &text, PreprocessPipeline &pipeline);
+};
+
+// Contrast limited adaptive histogram equalization: per tile a histogram of
+// the luminance is clipped, the excess spread over all bins, and its CDF
+// maps the channels; pixels blend the maps of the four nearest tiles
+void claheImage(Image &image, int tiles, float clipLimit);
+// Separable, clamped at the borders
+void gaussianBlur(Image &image, float sigma);
+// Separable linear filter, widened to the scale when shrinking
+Image resizeImage(const Image &image, size_t width, size_t height);
+
+// Pixel formats of matchers (MatcherABI.h 1.4), converted once on the host
+// rather than by every matcher on every set_image(). count RGBA8 pixels to
+// 8-bit luminance (BT.601 weights in fixed point), or with R and B swapped.
+void rgbaToGray(const uint8_t *rgba, size_t count, uint8_t *gray);
+void rgbaToBgra(const uint8_t *rgba, size_t count, uint8_t *bgra);
+// Of whole RGBA8 images: one byte per pixel, or BGRA8. GRAY16 images are
+// windowed to 8 bits as by rgbaImage() (BGRA8 is their RGBA8 then).
+Image grayImage(const Image &image);
+Image bgraImage(const Image &image);
+
+// GRAY16 images (Image.h) for the consumers of RGBA8 (preprocessing,
+// similarity scores, thumbnails, legacy matchers): gray RGBA8, the range of
+// values in use stretched over 0..255. Other images are returned as they
+// are, the shared one without a copy.
+Image rgbaImage(const Image &image);
+std::shared_ptr<const Image> rgbaImage(std::shared_ptr<const Image> image);
+// Lowest and highest value of a GRAY16 image; 0 and 65535 if it is empty
+void gray16Range(const Image &image, uint16_t &lower, uint16_t &upper);
+
+// Preprocessed images on disk: one file per (image file, pipeline) in
+// `dir`, named after the hash of both, written through a temporary file
+// that is renamed into place. The pixels follow a 32-byte header as they
+// are in memory, so reading one back is a single read without decoding.
+// Decoded images are kept the same way, as the empty pipeline's results
+// (see ImageStore::setDecodedCache()).
+std::shared_ptr<const Image> readPreprocessed(
+    const std::string &dir, uint64_t key);
+void writePreprocessed(const std::string &dir, uint64_t key, const Image &image);
+// The image file by path, size and modification time, and the pipeline
+uint64_t preprocessKey(
+    const std::string &filename, const PreprocessPipeline &pipeline);
@@ -0,0 +1,86 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <memory>
+#include <vector>
+// ours
+#include "Image.h"
+
+// Successively halved copies of an image, level 0 being the image itself,
+// for coarse-to-fine matching. Levels are 2x2 box filtered, per byte, or
+// per value for GRAY16 images.
+struct ImagePyramid
+{
+  std::vector<std::shared_ptr<const Image>> levels;
+
+  size_t size() const
+  {
+    return levels.size();
+  }
+
+  const Image &level(size_t l) const
+  {
+    return *levels[std::min(l, levels.size() - 1)];
+  }
+
+  static std::shared_ptr<const ImagePyramid> build(
+      std::shared_ptr<const Image> image, size_t numLevels)
+  {
+    auto pyramid = std::make_shared<ImagePyramid>();
+    pyramid->levels.push_back(image);
+    for (size_t l = 1; l < numLevels; ++l) {
+      const auto &src = *pyramid->levels.back();
+      if (src.width < 2 || src.height < 2)
+        break;
+      pyramid->levels.push_back(std::make_shared<const Image>(downsample(src)));
+    }
+    return pyramid;
+  }
+
+  static Image downsample(const Image &src)
+  {
+    Image dst;
+    dst.width = src.width / 2;
+    dst.height = src.height / 2;
+    dst.bpp = src.bpp;
+    dst.data.resize(dst.width * dst.height * dst.bpp);
+    if (src.gray16()) {
+      downsample16(src, dst);
+      return dst;
+    }
+
+    const size_t bpp = src.bpp;
+    for (size_t y = 0; y < dst.height; ++y) {
+      const uint8_t *row0 = src.data.data() + (2 * y) * src.width * bpp;
+      const uint8_t *row1 = row0 + src.width * bpp;
+      uint8_t *out = dst.data.data() + y * dst.width * bpp;
+      for (size_t x = 0; x < dst.width; ++x) {
+        for (size_t c = 0; c < bpp; ++c) {
+          unsigned sum = row0[2 * x * bpp + c] + row0[(2 * x + 1) * bpp + c]
+              + row1[2 * x * bpp + c] + row1[(2 * x + 1) * bpp + c];
+          out[x * bpp + c] = uint8_t((sum + 2) / 4);
+        }
+      }
+    }
+    return dst;
+  }
+
+  static void downsample16(const Image &src, Image &dst)
+  {
+    const auto *in = reinterpret_cast<const uint16_t *>(src.data.data());
+    auto *out = reinterpret_cast<uint16_t *>(dst.data.data());
+    for (size_t y = 0; y < dst.height; ++y) {
+      const uint16_t *row0 = in + (2 * y) * src.width;
+      const uint16_t *row1 = row0 + src.width;
+      for (size_t x = 0; x < dst.width; ++x) {
+        const uint32_t sum = row0[2 * x] + row0[2 * x + 1] + row1[2 * x]
+            + row1[2 * x + 1];
+        out[y * dst.width + x] = uint16_t((sum + 2) / 4);
+      }
+    }
+  }
+};
@@ -0,0 +1,61 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <cmath>
+
+// Rectangle of a frame or image in normalized coordinates with the origin at
+// the lower left (row 0 at v = 0), as the perspective camera's imageRegion.
+// Rendered frames and reference images share it, so an ROI drawn on either
+// selects the same pixels of both.
+struct ImageRoi
+{
+  float lower[2]{0.f, 0.f};
+  float upper[2]{1.f, 1.f};
+
+  bool full() const
+  {
+    return lower[0] <= 0.f && lower[1] <= 0.f && upper[0] >= 1.f
+        && upper[1] >= 1.f;
+  }
+
+  // Ordered and clamped to the image
+  static ImageRoi fromCorners(const float a[2], const float b[2])
+  {
+    ImageRoi roi;
+    for (int i = 0; i < 2; ++i) {
+      roi.lower[i] = std::clamp(std::min(a[i], b[i]), 0.f, 1.f);
+      roi.upper[i] = std::clamp(std::max(a[i], b[i]), 0.f, 1.f);
+    }
+    return roi;
+  }
+
+  // This ROI of an image that is itself the `outer` part of a larger one
+  ImageRoi within(const ImageRoi &outer) const
+  {
+    ImageRoi roi;
+    for (int i = 0; i < 2; ++i) {
+      const float extent = outer.upper[i] - outer.lower[i];
+      roi.lower[i] = outer.lower[i] + lower[i] * extent;
+      roi.upper[i] = outer.lower[i] + upper[i] * extent;
+    }
+    return roi;
+  }
+
+  // Whole pixels of a width x height image covering the ROI, at least one
+  void pixels(int width, int height, int offset[2], int size[2]) const
+  {
+    const int dims[2] = {width, height};
+    for (int i = 0; i < 2; ++i) {
+      const int lo =
+          std::clamp(int(std::floor(lower[i] * dims[i])), 0, dims[i] - 1);
+      const int hi =
+          std::clamp(int(std::ceil(upper[i] * dims[i])), lo + 1, dims[i]);
+      offset[i] = lo;
+      size[i] = hi - lo;
+    }
+  }
+};
@@ -0,0 +1,487 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ImageStore.h"
+// visionaray
+#include <common/image.h>
+// std
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+// ours
+#ifdef HAVE_ITK
+#include "readDicom.h"
+#endif
+
+namespace {
+
+// Baseline TIFF of one uncompressed 16-bit unsigned channel in strips, as
+// X-ray detectors (and --format tiff16) write them; false for other files,
+// which are left to visionaray
+bool readGray16Tiff(const std::string &filename, Image &image)
+{
+  std::ifstream in(filename, std::ios::binary);
+  const std::vector<uint8_t> file(
+      (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (file.size() < 8 || (file[0] != 'I' && file[0] != 'M')
+      || file[0] != file[1])
+    return false;
+  const bool big = file[0] == 'M';
+  auto get = [&](size_t offset, size_t bytes) -> uint32_t {
+    if (offset + bytes > file.size())
+      return 0;
+    uint32_t v = 0;
+    for (size_t i = 0; i < bytes; ++i)
+      v |= uint32_t(file[offset + (big ? bytes - 1 - i : i)]) << (8 * i);
+    return v;
+  };
+  if (get(2, 2) != 42)
+    return false;
+
+  constexpr uint16_t SHORT = 3, LONG = 4;
+  const uint32_t ifd = get(4, 4);
+  const uint32_t numEntries = get(ifd, 2);
+  uint32_t width = 0, height = 0;
+  uint32_t bits = 1, compression = 1, photometric = 1, samples = 1;
+  uint32_t sampleFormat = 1;
+  std::vector<uint32_t> offsets, counts;
+  for (uint32_t e = 0; e < numEntries; ++e) {
+    const size_t entry = ifd + 2 + 12 * size_t(e);
+    const uint32_t tag = get(entry, 2), type = get(entry + 2, 2);
+    const uint32_t count = get(entry + 4, 4);
+    if (type != SHORT && type != LONG)
+      continue;
+    const size_t bytes = type == SHORT ? 2 : 4;
+    // values that fit into the entry are stored in it
+    const size_t values =
+        count * bytes <= 4 ? entry + 8 : size_t(get(entry + 8, 4));
+    auto value = [&](size_t i) { return get(values + i * bytes, bytes); };
+    switch (tag) {
+    case 256:
+      width = value(0);
+      break;
+    case 257:
+      height = value(0);
+      break;
+    case 258:
+      bits = value(0);
+      break;
+    case 259:
+      compression = value(0);
+      break;
+    case 262:
+      photometric = value(0);
+      break;
+    case 277:
+      samples = value(0);
+      break;
+    case 339:
+      sampleFormat = value(0);
+      break;
+    case 273: // StripOffsets
+      for (uint32_t i = 0; i < count; ++i)
+        offsets.push_back(value(i));
+      break;
+    case 279: // StripByteCounts
+      for (uint32_t i = 0; i < count; ++i)
+        counts.push_back(value(i));
+      break;
+    }
+  }
+  if (bits != 16 || compression != 1 || samples != 1 || sampleFormat != 1
+      || photometric > 1 || !width || !height || offsets.empty()
+      || offsets.size() != counts.size())
+    return false;
+
+  // strips concatenated give the rows, top down
+  const size_t rowBytes = size_t(width) * 2;
+  std::vector<uint8_t> rows;
+  rows.reserve(rowBytes * height);
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    if (size_t(offsets[i]) + counts[i] > file.size())
+      return false;
+    rows.insert(rows.end(),
+        file.begin() + offsets[i],
+        file.begin() + offsets[i] + counts[i]);
+  }
+  if (rows.size() < rowBytes * height)
+    return false;
+
+  image.width = width;
+  image.height = height;
+  image.bpp = 2;
+  image.data.resize(rowBytes * height);
+  auto *dst = reinterpret_cast<uint16_t *>(image.data.data());
+  for (size_t y = 0; y < height; ++y) {
+    const uint8_t *src = rows.data() + (height - 1 - y) * rowBytes;
+    for (size_t x = 0; x < width; ++x) {
+      const uint16_t v = big ? uint16_t(src[2 * x] << 8 | src[2 * x + 1])
+                             : uint16_t(src[2 * x + 1] << 8 | src[2 * x]);
+      // WhiteIsZero
+      dst[y * width + x] = photometric == 0 ? uint16_t(65535 - v) : v;
+    }
+  }
+  return true;
+}
+
+// visionaray's pixels as RGBA8 or GRAY16; null for other formats
+ImageStore::ImagePtr fromVisionaray(const visionaray::image &source)
+{
+  const size_t count = source.width() * source.height();
+  auto image = std::make_shared<Image>();
+  image->width = source.width();
+  image->height = source.height();
+  switch (source.format()) {
+  case visionaray::PF_RGBA8:
+    image->bpp = 4;
+    image->data.assign(source.data(), source.data() + count * 4);
+    return image;
+  case visionaray::PF_R16UI:
+    image->bpp = 2;
+    image->data.assign(source.data(), source.data() + count * 2);
+    return image;
+  case visionaray::PF_RGB8:
+  case visionaray::PF_R8: {
+    const size_t channels = source.format() == visionaray::PF_RGB8 ? 3 : 1;
+    image->bpp = 4;
+    image->data.resize(count * 4);
+    for (size_t i = 0; i < count; ++i) {
+      const uint8_t *p = source.data() + i * channels;
+      uint8_t *q = image->data.data() + i * 4;
+      q[0] = p[0];
+      q[1] = p[channels / 2];
+      q[2] = p[channels - 1];
+      q[3] = 255;
+    }
+    return image;
+  }
+  default:
+    return nullptr;
+  }
+}
+
+} // namespace
+
+ImageStore::~ImageStore()
+{
+  m_prefetches.cancel();
+}
+
+void ImageStore::setScheduler(TaskScheduler *scheduler)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_scheduler = scheduler;
+}
+
+void ImageStore::setFilenames(std::vector<std::string> filenames)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_prefetches.cancel();
+  m_prefetches = CancelToken();
+  m_filenames = std::move(filenames);
+  m_images.clear();
+  m_images.resize(m_filenames.size());
+  m_references.clear();
+  m_references.resize(m_filenames.size());
+  m_pyramids.clear();
+  m_pyramids.resize(m_filenames.size());
+  ++m_generation;
+}
+
+void ImageStore::appendFilenames(std::vector<std::string> filenames)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto &filename : filenames)
+    m_filenames.push_back(std::move(filename));
+  m_images.resize(m_filenames.size());
+  m_references.resize(m_filenames.size());
+  m_pyramids.resize(m_filenames.size());
+}
+
+void ImageStore::adopt(ImageStore &other)
+{
+  if (&other == this)
+    return;
+  std::scoped_lock lock(m_mutex, other.m_mutex);
+  m_prefetches.cancel();
+  m_prefetches = other.m_prefetches;
+  other.m_prefetches = CancelToken();
+  m_filenames = std::move(other.m_filenames);
+  m_images = std::move(other.m_images);
+  if (other.m_pipeline.hash() == m_pipeline.hash()
+      && other.m_preprocessDir == m_preprocessDir) {
+    m_references = std::move(other.m_references);
+    m_pyramids = std::move(other.m_pyramids);
+  } else {
+    m_references.assign(m_filenames.size(), {});
+    m_pyramids.assign(m_filenames.size(), nullptr);
+  }
+  other.m_filenames.clear();
+  other.m_images.clear();
+  other.m_references.clear();
+  other.m_pyramids.clear();
+  ++m_generation;
+}
+
+std::string ImageStore::filename(size_t index) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return index < m_filenames.size() ? m_filenames[index] : std::string();
+}
+
+size_t ImageStore::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_filenames.size();
+}
+
+bool ImageStore::empty() const
+{
+  return size() == 0;
+}
+
+uint64_t ImageStore::generation() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_generation;
+}
+
+void ImageStore::setDecodedCache(std::string dir)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_decodedDir = std::move(dir);
+}
+
+ImageStore::ImagePtr ImageStore::get(size_t index)
+{
+  std::promise<ImagePtr> promise;
+  std::shared_future<ImagePtr> future;
+  std::string dir, filename;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index >= m_images.size())
+      return nullptr;
+    if (m_images[index].valid()) {
+      future = m_images[index];
+    } else {
+      m_images[index] = promise.get_future().share();
+      dir = m_decodedDir;
+      filename = m_filenames[index];
+    }
+  }
+
+  if (future.valid())
+    return future.get();
+
+  auto image = load(dir, filename);
+  promise.set_value(image);
+  return image;
+}
+
+void ImageStore::prefetch(size_t index)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (index >= m_images.size())
+    return;
+
+  auto submit = [this](auto task) {
+    if (m_scheduler) {
+      return m_scheduler->submit(TaskPriority::Prefetch, m_prefetches, task)
+          .share();
+    }
+    if (!m_pool)
+      m_pool = std::make_unique<ThreadPool>();
+    return m_pool->enqueue(task).share();
+  };
+  auto filename = m_filenames[index];
+  if (!m_images[index].valid()) {
+    m_images[index] = submit(
+        [dir = m_decodedDir, filename]() { return load(dir, filename); });
+  }
+  // queued after the decode, which it waits for
+  if (!m_pipeline.empty() && !m_references[index].valid()) {
+    auto decoded = m_images[index];
+    m_references[index] = submit(
+        [pipeline = m_pipeline, dir = m_preprocessDir, filename, decoded]() {
+          return preprocess(pipeline, dir, filename, decoded.get());
+        });
+  }
+}
+
+void ImageStore::setPreprocessing(
+    PreprocessPipeline pipeline, std::string cacheDir)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_pipeline = std::move(pipeline);
+  m_preprocessDir = std::move(cacheDir);
+  m_references.clear();
+  m_references.resize(m_filenames.size());
+  m_pyramids.clear();
+  m_pyramids.resize(m_filenames.size());
+}
+
+ImageStore::ImagePtr ImageStore::reference(size_t index)
+{
+  std::promise<ImagePtr> promise;
+  std::shared_future<ImagePtr> future;
+  PreprocessPipeline pipeline;
+  std::string dir, filename;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index >= m_references.size())
+      return nullptr;
+    if (!m_pipeline.empty()) {
+      if (m_references[index].valid()) {
+        future = m_references[index];
+      } else {
+        m_references[index] = promise.get_future().share();
+        pipeline = m_pipeline;
+        dir = m_preprocessDir;
+        filename = m_filenames[index];
+      }
+    }
+  }
+
+  if (future.valid())
+    return future.get();
+  if (pipeline.empty())
+    return get(index);
+
+  auto image = preprocess(pipeline, dir, filename, get(index));
+  promise.set_value(image);
+  return image;
+}
+
+ImageStore::ImagePtr ImageStore::load(
+    const std::string &dir, const std::string &filename)
+{
+  if (dir.empty())
+    return decode(filename);
+  // decoded images are the results of the empty pipeline
+  const uint64_t key = preprocessKey(filename, PreprocessPipeline());
+  if (auto cached = readPreprocessed(dir, key))
+    return cached;
+  auto image = decode(filename);
+  if (image)
+    writePreprocessed(dir, key, *image);
+  return image;
+}
+
+ImageStore::ImagePtr ImageStore::preprocess(const PreprocessPipeline &pipeline,
+    const std::string &dir,
+    const std::string &filename,
+    const ImagePtr &image)
+{
+  if (!image)
+    return nullptr;
+  const uint64_t key = preprocessKey(filename, pipeline);
+  if (!dir.empty()) {
+    if (auto cached = readPreprocessed(dir, key))
+      return cached;
+  }
+  auto result = std::make_shared<const Image>(pipeline.apply(*image));
+  if (!dir.empty())
+    writePreprocessed(dir, key, *result);
+  return result;
+}
+
+void ImageStore::reportMemory(MemoryReport &report) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t images = 0, numImages = 0, pyramids = 0;
+  for (auto &f : m_images) {
+    if (!f.valid()
+        || f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      continue;
+    if (auto image = f.get()) {
+      images += image->data.size();
+      numImages++;
+    }
+  }
+  size_t references = 0;
+  for (auto &f : m_references) {
+    if (!f.valid()
+        || f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      continue;
+    if (auto image = f.get())
+      references += image->data.size();
+  }
+  for (auto &p : m_pyramids) {
+    if (!p)
+      continue;
+    for (size_t l = 1; l < p->size(); ++l)
+      pyramids += p->levels[l]->data.size();
+  }
+  report.add(MemoryReport::Host,
+      "decoded images (" + std::to_string(numImages) + ")",
+      images);
+  if (!m_pipeline.empty())
+    report.add(MemoryReport::Host, "preprocessed references", references);
+  report.add(MemoryReport::Host, "image pyramids", pyramids);
+}
+
+std::shared_ptr<const ImagePyramid> ImageStore::pyramid(
+    size_t index, size_t numLevels)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index >= m_pyramids.size())
+      return nullptr;
+    auto cached = m_pyramids[index];
+    // an image too small for more levels is complete as it is
+    if (cached
+        && (cached->size() >= numLevels
+            || cached->levels.back()->width < 2
+            || cached->levels.back()->height < 2))
+      return cached;
+  }
+
+  auto image = reference(index);
+  if (!image)
+    return nullptr;
+  auto result = ImagePyramid::build(image, numLevels);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (index < m_pyramids.size())
+    m_pyramids[index] = result;
+  return result;
+}
+
+ImageStore::ImagePtr ImageStore::decode(const std::string &filename)
+{
+  // 16-bit gray references stay 16-bit (GRAY16), not expanded to RGBA8
+  auto ext = std::filesystem::path(filename).extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) {
+    return char(std::tolower(c));
+  });
+  auto image = std::make_shared<Image>();
+  bool gray16 = false;
+  if (ext == ".tif" || ext == ".tiff")
+    gray16 = readGray16Tiff(filename, *image);
+#ifdef HAVE_ITK
+  else if (ext == ".dcm")
+    gray16 = readDicomImage(filename, *image);
+#endif
+  if (gray16) {
+    std::cout << "Loaded " << filename << ": (" << image->width << "x"
+              << image->height << ", GRAY16)\n";
+    return image;
+  }
+
+  visionaray::image visionarayImage;
+  if (!visionarayImage.load(filename)) {
+    std::cerr << "Could not load " << filename << "\n";
+    return nullptr;
+  }
+  std::cout << "Loaded " << filename << ": (" << visionarayImage.width() << "x"
+            << visionarayImage.height() << ", " << visionarayImage.format()
+            << ")\n";
+  auto converted = fromVisionaray(visionarayImage);
+  if (!converted)
+    std::cerr << "Unsupported pixel format in " << filename << "\n";
+  return converted;
+}
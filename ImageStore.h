@@ -0,0 +1,99 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+// ours
+#include "Image.h"
+#include "ImagePreprocess.h"
+#include "ImagePyramid.h"
+#include "MemoryReport.h"
+#include "TaskScheduler.h"
+#include "ThreadPool.h"
+
+// Reference images of the loaded predictions. Images are decoded lazily, on
+// first use or ahead of time on a worker pool, and handed out as shared
+// immutable buffers so viewports and matchers never copy the pixels.
+class ImageStore
+{
+ public:
+  using ImagePtr = std::shared_ptr<const Image>;
+
+  ImageStore() = default;
+  ~ImageStore(); // drops the prefetches that have not started
+
+  // Prefetches run on the scheduler at prefetch priority, on a pool of
+  // their own without one
+  void setScheduler(TaskScheduler *scheduler);
+  // Drops prefetches of the previous files that have not started
+  void setFilenames(std::vector<std::string> filenames);
+  // Adds files after the current ones (a live prediction feed); the images
+  // decoded or in flight for the others are kept
+  void appendFilenames(std::vector<std::string> filenames);
+  // Takes over the files of `other` with the images decoded or prefetched
+  // for them (e.g. read ahead for the next case), leaving it empty. Its
+  // preprocessed images are kept if it had the same pipeline.
+  void adopt(ImageStore &other);
+  std::string filename(size_t index) const; // empty if out of range
+  size_t size() const;
+  bool empty() const;
+  // Changes when the files are replaced (setFilenames(), adopt()), not when
+  // files are appended
+  uint64_t generation() const;
+
+  // Decoded images are also kept in `dir`, one raw file per image file,
+  // keyed by its path, size and modification time, and later sessions read
+  // them back instead of decoding (readPreprocessed()). Empty: not kept.
+  void setDecodedCache(std::string dir);
+  // Decoded image; decodes on the calling thread unless a worker already
+  // started on it, in which case this waits for the worker's result.
+  // Returns nullptr if the file could not be decoded.
+  ImagePtr get(size_t index);
+  // Start decoding (and preprocessing) in the background if not done or
+  // in flight yet
+  void prefetch(size_t index);
+  // Steps applied to the images matchers see (see reference()); with a
+  // directory the results are also kept on disk, keyed by image file and
+  // pipeline. Drops the preprocessed images of the previous pipeline.
+  void setPreprocessing(PreprocessPipeline pipeline, std::string cacheDir = {});
+  // The image preprocessed for matching, once per image like get(); the
+  // decoded image itself without a pipeline. nullptr if it does not decode.
+  ImagePtr reference(size_t index);
+  // Pyramid of the reference image, built once per image and cached; a
+  // request for more levels than cached rebuilds it
+  std::shared_ptr<const ImagePyramid> pyramid(size_t index, size_t numLevels);
+  // Decoded images and pyramid levels; images still decoding are skipped
+  void reportMemory(MemoryReport &report) const;
+
+  // Decodes a file without storing the result (e.g. for thumbnails)
+  static ImagePtr decode(const std::string &filename);
+
+ private:
+  // decode() through the decoded-image cache in dir, if one is set
+  static ImagePtr load(const std::string &dir, const std::string &filename);
+  // from the disk cache, or applied and written there
+  static ImagePtr preprocess(const PreprocessPipeline &pipeline,
+      const std::string &dir,
+      const std::string &filename,
+      const ImagePtr &image);
+
+  std::vector<std::string> m_filenames;
+  std::vector<std::shared_future<ImagePtr>> m_images;
+  std::vector<std::shared_future<ImagePtr>> m_references; // with a pipeline
+  PreprocessPipeline m_pipeline;
+  std::string m_preprocessDir;
+  std::string m_decodedDir;
+  std::vector<std::shared_ptr<const ImagePyramid>> m_pyramids;
+  uint64_t m_generation{0};
+  mutable std::mutex m_mutex;
+  TaskScheduler *m_scheduler{nullptr};
+  CancelToken m_prefetches; // of the current files
+  std::unique_ptr<ThreadPool> m_pool;
+};
@@ -7,148 +7,270 @@
 #include <cmath>
 #include <iostream>
 #include <stdexcept>
+// ours
+#include "ImagePreprocess.h"
 
 namespace anari_viewer::windows {
 
-ImageViewport::ImageViewport(const std::vector<Image>& images, const char *name)
+ImageViewport::ImageViewport(ImageStore& images, const char *name)
     : Window(name, true), m_images(images)
 {
-  glGenTextures(1, &m_framebufferTexture);
-  glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexImage2D(GL_TEXTURE_2D,
-      0,
-      GL_RGBA8,
-      m_viewportSize.x,
-      m_viewportSize.y,
-      0,
-      GL_RGBA,
-      GL_UNSIGNED_BYTE,
-      0);
+  m_textures.setEvictCallback(
+      [](const size_t &, GLuint &texture) { glDeleteTextures(1, &texture); });
+}
 
-  reshape(m_viewportSize);
+ImageViewport::~ImageViewport()
+{
+  if (m_windowed)
+    glDeleteTextures(1, &m_windowed);
 }
 
 void ImageViewport::buildUI()
 {
-  ImVec2 _viewportSize = ImGui::GetContentRegionAvail();
-  anari::math::int2 viewportSize(_viewportSize.x, _viewportSize.y);
+  if (m_imageIndex < 0 || !m_texture)
+    return;
+
+  // letterbox the image into the available region
+  ImVec2 viewportSize = ImGui::GetContentRegionAvail();
+  if (viewportSize.x <= 0 || viewportSize.y <= 0)
+    return;
+
+  float renderWidth = viewportSize.x;
+  float renderHeight = viewportSize.y;
+  float ratioImg = float(m_imageSize.x) / m_imageSize.y;
+  float ratioScreen = renderWidth / renderHeight;
+  if (ratioImg > ratioScreen)
+      renderHeight = renderWidth / ratioImg;
+  else
+      renderWidth = renderHeight * ratioImg;
+
+  ImVec2 cursor = ImGui::GetCursorPos();
+  ImGui::SetCursorPos(ImVec2(cursor.x + (viewportSize.x - renderWidth) * .5f,
+      cursor.y + (viewportSize.y - renderHeight) * .5f));
+
+  // images are stored bottom row first
+  ImGui::Image((void *)(intptr_t)m_texture,
+      ImVec2(renderWidth, renderHeight),
+      ImVec2(0, 1),
+      ImVec2(1, 0));
+  ui_roi(ImGui::GetItemRectMin(), ImGui::GetItemRectMax());
+  if (m_gray16Texture)
+    ui_window();
+}
+
+void ImageViewport::ui_window()
+{
+  if (!ImGui::BeginPopupContextItem("image window"))
+    return;
+  ImGui::Text("GRAY16 window");
+  if (ImGui::DragFloatRange2("values",
+          &m_window[0],
+          &m_window[1],
+          16.f,
+          0.f,
+          65535.f,
+          "%.0f",
+          nullptr,
+          ImGuiSliderFlags_AlwaysClamp))
+    applyWindow();
+  if (ImGui::Button("auto")) {
+    std::copy_n(m_autoWindow, 2, m_window);
+    applyWindow();
+  }
+  ImGui::EndPopup();
+}
 
-  if (m_viewportSize != viewportSize)
-    reshape(viewportSize);
+void ImageViewport::setRoi(const ImageRoi &roi)
+{
+  m_roi = roi;
+}
 
-  ImGui::Image((void *)(intptr_t)m_framebufferTexture,
-      ImGui::GetContentRegionAvail(),
-      ImVec2(1, 0),
-      ImVec2(0, 1));
+void ImageViewport::setRoiChangedCallback(
+    std::function<void(const ImageRoi &)> callback)
+{
+  m_roiChanged = std::move(callback);
+}
+
+void ImageViewport::ui_roi(ImVec2 imageMin, ImVec2 imageMax)
+{
+  ImGuiIO &io = ImGui::GetIO();
+  const float w = imageMax.x - imageMin.x;
+  const float h = imageMax.y - imageMin.y;
+
+  // shown upright: v runs up from the bottom edge
+  const float uv[2] = {std::clamp((io.MousePos.x - imageMin.x) / w, 0.f, 1.f),
+      std::clamp(1.f - (io.MousePos.y - imageMin.y) / h, 0.f, 1.f)};
+  if (!m_drawingRoi && ImGui::IsItemHovered()
+      && ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+    m_drawingRoi = true;
+    std::copy_n(uv, 2, m_roiStart);
+  }
+
+  ImageRoi roi = m_roi;
+  if (m_drawingRoi) {
+    roi = ImageRoi::fromCorners(m_roiStart, uv);
+    if (!ImGui::IsMouseDown(ImGuiMouseButton_Left)) {
+      m_drawingRoi = false;
+      // a click without a drag clears the ROI
+      const float minExtent = 4.f / std::min(w, h);
+      if (roi.upper[0] - roi.lower[0] < minExtent
+          || roi.upper[1] - roi.lower[1] < minExtent)
+        roi = ImageRoi();
+      m_roi = roi;
+      if (m_roiChanged)
+        m_roiChanged(m_roi);
+    }
+  }
+
+  if (!m_drawingRoi && roi.full())
+    return;
+  const ImVec2 a(imageMin.x + roi.lower[0] * w,
+      imageMin.y + (1.f - roi.upper[1]) * h);
+  const ImVec2 b(imageMin.x + roi.upper[0] * w,
+      imageMin.y + (1.f - roi.lower[1]) * h);
+  const ImU32 color =
+      m_drawingRoi ? IM_COL32(255, 255, 0, 255) : IM_COL32(0, 255, 0, 255);
+  ImGui::GetWindowDrawList()->AddRect(a, b, color);
 }
 
 void ImageViewport::showImage(size_t index)
 {
-  if ((index >= m_images.size()) || (m_images[index].data.empty()))
+  auto image = m_images.get(index);
+  if (!image || image->data.empty())
     return;
-  if (m_images[index].bpp != 4) {
-    printf("bad image: unsupported bpp = %lu\n", m_images[index].bpp);
+  if (image->bpp != 4 && !image->gray16()) {
+    printf("bad image: unsupported bpp = %lu\n", image->bpp);
     return;
   }
+  GLuint texture = 0;
+  if (auto *cached = m_textures.get(index)) {
+    texture = *cached;
+  } else {
+    texture = m_textures.put(index,
+        uploadTexture(*image),
+        image->width * image->height * image->bpp);
+  }
   m_imageIndex = static_cast<ssize_t>(index);
+  m_imageSize = anari::math::int2(image->width, image->height);
+  m_gray16Texture = 0;
+  m_texture = texture;
+  if (image->gray16())
+    showGray16(texture, *image);
+}
 
-  // copy into temporary texture
-  GLuint tempTexture{0};
-  glGenTextures(1, &tempTexture);
-  glBindTexture(GL_TEXTURE_2D, tempTexture);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexImage2D(GL_TEXTURE_2D,
-      0,
-      GL_RGBA8,
-      m_images[index].width,
-      m_images[index].height,
-      0,
-      GL_RGBA,
-      GL_UNSIGNED_BYTE,
-      0);
-  glTexSubImage2D(GL_TEXTURE_2D,
-      0,
-      0,
-      0,
-      m_images[index].width,
-      m_images[index].height,
-      GL_RGBA,
-      GL_UNSIGNED_BYTE,
-      m_images[index].data.data());
-
-  // setup fb to render into m_framebufferTexture
-  GLint oldFbo{0};
-  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFbo);
-  GLuint fbo;
-  glGenFramebuffers(1, &fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_framebufferTexture, 0);
-
-  // calc scaling and offset
-  int imgWidth = m_images[index].width;
-  int imgHeight = m_images[index].height;
-  GLfloat offsetX = 0;
-  GLfloat offsetY = 0;
-  GLfloat renderWidth = m_viewportSize.x;
-  GLfloat renderHeight = m_viewportSize.y;
-  float ratioImg = float(imgWidth) / imgHeight;
-  float ratioScreen = renderWidth / renderHeight;
-  if (ratioImg > ratioScreen)
-      renderHeight = renderWidth / ratioImg;
-  else
-      renderWidth = renderHeight * ratioImg;
-  offsetX = 0 + (m_viewportSize.x - renderWidth) * .5f;
-  offsetY = 0 + (m_viewportSize.y - renderHeight) * .5f;
-
-  // render to fbo (and flip x+y axes)
-  glEnable(GL_TEXTURE_2D);
-  glBindTexture(GL_TEXTURE_2D, tempTexture);
-  glMatrixMode(GL_PROJECTION);
-  glLoadIdentity();
-  glMatrixMode(GL_MODELVIEW);
-  glLoadIdentity();
-  glTranslatef(-1, -1, 0);
-  glScalef(2.0f / m_viewportSize.x, 2.0f / m_viewportSize.y, 1.0);
-  glBegin(GL_QUADS);
-  glTexCoord2f(1, 1);
-  glVertex2f(offsetX, offsetY);
-  glTexCoord2f(0, 1);
-  glVertex2f(offsetX + renderWidth, offsetY);
-  glTexCoord2f(0, 0);
-  glVertex2f(offsetX + renderWidth, offsetY + renderHeight);
-  glTexCoord2f(1, 0);
-  glVertex2f(offsetX, offsetY + renderHeight);
-  glEnd();
-  glBindFramebuffer(GL_FRAMEBUFFER, oldFbo);
+void ImageViewport::showGray16(GLuint texture, const Image &image)
+{
+  const anari::math::int2 size(image.width, image.height);
+  if (!m_windowed || m_windowedSize.x != size.x
+      || m_windowedSize.y != size.y) {
+    if (!m_windowed)
+      glGenTextures(1, &m_windowed);
+    glBindTexture(GL_TEXTURE_2D, m_windowed);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D,
+        0,
+        GL_RGBA8,
+        size.x,
+        size.y,
+        0,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_windowedSize = size;
+  }
+  uint16_t lower, upper;
+  gray16Range(image, lower, upper);
+  m_autoWindow[0] = m_window[0] = float(lower);
+  m_autoWindow[1] = m_window[1] = float(upper);
+  m_gray16Texture = texture;
+  m_texture = m_windowed;
+  applyWindow();
 }
 
-void ImageViewport::reshape(anari::math::int2 newSize)
+void ImageViewport::applyWindow()
 {
-  if (newSize.x <= 0 || newSize.y <= 0)
-    return;
+  DisplayWindow window;
+  window.lower = m_window[0] / 65535.f;
+  window.upper = std::max(m_window[1], m_window[0] + 1.f) / 65535.f;
+  if (!m_toneMapper.apply(m_gray16Texture,
+          m_windowed,
+          m_windowedSize.x,
+          m_windowedSize.y,
+          window))
+    printf("GRAY16 images cannot be windowed on this GL context\n");
+}
+
+void ImageViewport::clear()
+{
+  m_textures.clear();
+  m_imageIndex = -1;
+  m_texture = 0;
+  m_gray16Texture = 0;
+  m_imageSize = anari::math::int2(0, 0);
+}
 
-  m_viewportSize = newSize;
+GLuint ImageViewport::texture() const
+{
+  return m_imageIndex < 0 ? 0 : m_texture;
+}
+
+void ImageViewport::setTextureBudget(size_t bytes)
+{
+  m_textures.setBudget(bytes);
+}
 
-  glViewport(0, 0, newSize.x, newSize.y);
+void ImageViewport::reportMemory(MemoryReport &report) const
+{
+  report.add(MemoryReport::GL,
+      "image textures (" + std::to_string(m_textures.size()) + ")",
+      m_textures.bytes());
+  if (m_windowed) {
+    report.add(MemoryReport::GL,
+        "windowed GRAY16 image",
+        size_t(m_windowedSize.x) * m_windowedSize.y * 4);
+  }
+}
 
-  glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
+GLuint ImageViewport::uploadTexture(const Image &image)
+{
+  GLuint texture{0};
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  if (image.gray16()) {
+    // the values as they are, normalized; windowed by the tone mapper
+    GLint alignment = 4;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D,
+        0,
+        GL_R16,
+        image.width,
+        image.height,
+        0,
+        GL_RED,
+        GL_UNSIGNED_SHORT,
+        image.data.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    return texture;
+  }
   glTexImage2D(GL_TEXTURE_2D,
       0,
       GL_RGBA8,
-      newSize.x,
-      newSize.y,
+      image.width,
+      image.height,
       0,
       GL_RGBA,
       GL_UNSIGNED_BYTE,
-      0);
-
-  if (m_imageIndex >= 0)
-    showImage(m_imageIndex);
+      image.data.data());
+  return texture;
 }
 
 } // namespace anari_viewer::windows
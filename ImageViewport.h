@@ -15,28 +15,65 @@
 #include <string>
 #include <vector>
 // ours
-#include "Image.h"
+#include "ImageRoi.h"
+#include "ImageStore.h"
+#include "LruCache.h"
+#include "MemoryReport.h"
+#include "ToneMapper.h"
 
 namespace anari_viewer::windows {
 
 class ImageViewport : public anari_viewer::windows::Window
 {
  public:
-  ImageViewport(const std::vector<Image>& images, const char *name = "Image Viewport");
-  ~ImageViewport() = default;
+  ImageViewport(ImageStore& images, const char *name = "Image Viewport");
+  ~ImageViewport();
 
   void buildUI() override;
 
   void showImage(size_t index);
+  // The store holds other files now: drops the textures and the image
+  // shown
+  void clear();
+  // Texture of the image shown, 0 before the first; owned by the texture
+  // cache, or the windowed RGBA8 texture of a GRAY16 image
+  GLuint texture() const;
+  // GPU memory budget of the texture cache in bytes
+  void setTextureBudget(size_t bytes);
+  void reportMemory(MemoryReport &report) const;
+  // Matching ROI, drawn on the image with a left drag (a click clears it)
+  // and shared with the DRR viewport through the callback
+  void setRoi(const ImageRoi &roi);
+  void setRoiChangedCallback(std::function<void(const ImageRoi &)> callback);
 
  private:
-  void reshape(anari::math::int2 newWindowSize);
+  GLuint uploadTexture(const Image &image);
+  void ui_roi(ImVec2 imageMin, ImVec2 imageMax);
+  void ui_window();
+  // GRAY16 images are cached as GL_R16 textures and windowed on the GPU
+  // into m_windowed, which is shown
+  void showGray16(GLuint texture, const Image &image);
+  void applyWindow();
 
-  std::vector<Image> m_images;
+  ImageStore& m_images;
   ssize_t m_imageIndex{-1};
 
-  GLuint m_framebufferTexture{0};
-  anari::math::int2 m_viewportSize{1920, 1080};
+  // one texture per image index, least recently shown are deleted first
+  LruCache<size_t, GLuint> m_textures{size_t(256) << 20};
+  GLuint m_texture{0};
+  anari::math::int2 m_imageSize{0, 0};
+
+  GLuint m_gray16Texture{0}; // of the image shown, 0 for RGBA8 images
+  GLuint m_windowed{0};
+  anari::math::int2 m_windowedSize{0, 0};
+  float m_window[2]{0.f, 65535.f}; // of GRAY16 values
+  float m_autoWindow[2]{0.f, 65535.f}; // the image's range
+  ToneMapper m_toneMapper;
+
+  ImageRoi m_roi;
+  bool m_drawingRoi{false};
+  float m_roiStart[2]{0.f, 0.f};
+  std::function<void(const ImageRoi &)> m_roiChanged;
 };
 
 } // namespace anari_viewer::windows
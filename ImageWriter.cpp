@@ -0,0 +1,322 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ImageWriter.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+// stb_image
+#include "stb_image_write.h"
+// ours
+#include "Trace.h"
+
+namespace {
+
+// Little-endian writers; all supported targets are little-endian
+template <typename T>
+void put(std::vector<uint8_t> &out, T value)
+{
+  const auto *bytes = reinterpret_cast<const uint8_t *>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+void putString(std::vector<uint8_t> &out, const char *s)
+{
+  out.insert(out.end(), s, s + std::strlen(s) + 1);
+}
+
+bool writeFile(const std::string &fileName, const std::vector<uint8_t> &data)
+{
+  std::ofstream out(fileName, std::ios::binary);
+  out.write(reinterpret_cast<const char *>(data.data()), data.size());
+  return bool(out);
+}
+
+// Baseline TIFF: one uncompressed strip of single-channel samples
+void encodeTiff(const ExportImage &image, bool half, std::vector<uint8_t> &out)
+{
+  const auto values = channelValues(image);
+  const uint16_t bits = half ? 16 : 32;
+  const uint32_t stripBytes = uint32_t(values.size() * bits / 8);
+
+  struct Entry
+  {
+    uint16_t tag, type;
+    uint32_t value;
+  };
+  constexpr uint16_t SHORT = 3, LONG = 4;
+  const uint32_t headerBytes = 8;
+  const Entry entries[] = {
+      {256, LONG, uint32_t(image.width)}, // ImageWidth
+      {257, LONG, uint32_t(image.height)}, // ImageLength
+      {258, SHORT, bits}, // BitsPerSample
+      {259, SHORT, 1}, // Compression: none
+      {262, SHORT, 1}, // PhotometricInterpretation: BlackIsZero
+      {273, LONG, headerBytes}, // StripOffsets
+      {277, SHORT, 1}, // SamplesPerPixel
+      {278, LONG, uint32_t(image.height)}, // RowsPerStrip
+      {279, LONG, stripBytes}, // StripByteCounts
+      {339, SHORT, uint32_t(half ? 1 : 3)}, // SampleFormat: uint, float
+  };
+
+  out.clear();
+  out.reserve(headerBytes + stripBytes + 256);
+  out.insert(out.end(), {'I', 'I', 42, 0});
+  put<uint32_t>(out, headerBytes + stripBytes); // IFD after the strip
+  if (half) {
+    for (float v : values)
+      put<uint16_t>(out,
+          uint16_t(std::lround(std::clamp(v, 0.f, 1.f) * 65535.f)));
+  } else {
+    const auto *bytes = reinterpret_cast<const uint8_t *>(values.data());
+    out.insert(out.end(), bytes, bytes + stripBytes);
+  }
+  put<uint16_t>(out, uint16_t(std::size(entries)));
+  for (const auto &e : entries) {
+    put<uint16_t>(out, e.tag);
+    put<uint16_t>(out, e.type);
+    put<uint32_t>(out, 1); // count
+    if (e.type == SHORT) {
+      put<uint16_t>(out, uint16_t(e.value));
+      put<uint16_t>(out, 0);
+    } else {
+      put<uint32_t>(out, e.value);
+    }
+  }
+  put<uint32_t>(out, 0); // no next IFD
+}
+
+// OpenEXR scanline file with one FLOAT channel "Y", no compression
+void encodeExr(const ExportImage &image, std::vector<uint8_t> &out)
+{
+  const auto values = channelValues(image);
+  const int w = image.width, h = image.height;
+
+  out.clear();
+  out.reserve(values.size() * 4 + size_t(h) * 16 + 512);
+  out.insert(out.end(), {0x76, 0x2f, 0x31, 0x01});
+  put<uint32_t>(out, 2); // version 2, scanline
+
+  auto attribute = [&](const char *name, const char *type, uint32_t size) {
+    putString(out, name);
+    putString(out, type);
+    put<uint32_t>(out, size);
+  };
+  attribute("channels", "chlist", 2 + 16 + 1);
+  putString(out, "Y");
+  put<int32_t>(out, 2); // FLOAT
+  put<uint32_t>(out, 0); // pLinear + reserved
+  put<int32_t>(out, 1); // x sampling
+  put<int32_t>(out, 1); // y sampling
+  out.push_back(0);
+  attribute("compression", "compression", 1);
+  out.push_back(0); // NO_COMPRESSION
+  for (const char *window : {"dataWindow", "displayWindow"}) {
+    attribute(window, "box2i", 16);
+    put<int32_t>(out, 0);
+    put<int32_t>(out, 0);
+    put<int32_t>(out, w - 1);
+    put<int32_t>(out, h - 1);
+  }
+  attribute("lineOrder", "lineOrder", 1);
+  out.push_back(0); // INCREASING_Y
+  attribute("pixelAspectRatio", "float", 4);
+  put<float>(out, 1.f);
+  attribute("screenWindowCenter", "v2f", 8);
+  put<float>(out, 0.f);
+  put<float>(out, 0.f);
+  attribute("screenWindowWidth", "float", 4);
+  put<float>(out, 1.f);
+  out.push_back(0); // end of header
+
+  const uint32_t lineBytes = uint32_t(w) * sizeof(float);
+  uint64_t offset = out.size() + size_t(h) * sizeof(uint64_t);
+  for (int y = 0; y < h; ++y, offset += 8 + lineBytes)
+    put<uint64_t>(out, offset);
+  for (int y = 0; y < h; ++y) {
+    put<int32_t>(out, y);
+    put<uint32_t>(out, lineBytes);
+    const auto *row =
+        reinterpret_cast<const uint8_t *>(values.data() + size_t(y) * w);
+    out.insert(out.end(), row, row + lineBytes);
+  }
+}
+
+} // namespace
+
+std::vector<float> channelValues(const ExportImage &image)
+{
+  if (!image.values.empty())
+    return image.values;
+
+  float lut[256];
+  for (int i = 0; i < 256; ++i) {
+    const float c = i / 255.f;
+    lut[i] = c <= 0.04045f ? c / 12.92f
+                           : std::pow((c + 0.055f) / 1.055f, 2.4f);
+  }
+  std::vector<float> values(size_t(image.width) * image.height);
+  for (size_t i = 0; i < values.size(); ++i)
+    values[i] = lut[image.rgba[i * 4]];
+  return values;
+}
+
+void encodeValues(ExportImage &image)
+{
+  const size_t numPixels = size_t(image.width) * image.height;
+  if (image.values.size() < numPixels)
+    return;
+  image.rgba.resize(numPixels * 4);
+  for (size_t i = 0; i < numPixels; ++i) {
+    const float c = std::clamp(image.values[i], 0.f, 1.f);
+    const float s = c <= 0.0031308f ? c * 12.92f
+                                    : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+    const uint8_t v = uint8_t(s * 255.f + 0.5f);
+    image.rgba[i * 4 + 0] = v;
+    image.rgba[i * 4 + 1] = v;
+    image.rgba[i * 4 + 2] = v;
+    image.rgba[i * 4 + 3] = 255;
+  }
+}
+
+bool parseImageFormat(const std::string &name, ImageFormat &format)
+{
+  if (name == "png")
+    format = ImageFormat::Png;
+  else if (name == "tiff16")
+    format = ImageFormat::Tiff16;
+  else if (name == "tiff32" || name == "tiff")
+    format = ImageFormat::TiffFloat;
+  else if (name == "exr")
+    format = ImageFormat::Exr;
+  else
+    return false;
+  return true;
+}
+
+const char *imageExtension(ImageFormat format)
+{
+  switch (format) {
+  case ImageFormat::Tiff16:
+  case ImageFormat::TiffFloat:
+    return ".tiff";
+  case ImageFormat::Exr:
+    return ".exr";
+  default:
+    return ".png";
+  }
+}
+
+ImageWriter::ImageWriter(size_t numThreads, size_t maxPending)
+    : m_numThreads(numThreads), m_maxPending(std::max<size_t>(1, maxPending))
+{}
+
+ImageWriter::~ImageWriter()
+{
+  wait();
+}
+
+void ImageWriter::write(std::string fileName,
+    ImageFormat format,
+    ExportImage image,
+    std::function<void()> written)
+{
+  TaskScheduler *scheduler = TaskScheduler::shared();
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return m_pending < m_maxPending; });
+    ++m_pending;
+    if (!scheduler && !m_pool)
+      m_pool = std::make_unique<ThreadPool>(m_numThreads);
+  }
+  // counts the write out once its task goes: after it ran, or unrun (and
+  // failed) when a stopping scheduler drops it
+  std::shared_ptr<bool> ok(new bool(false), [this](bool *ok) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_failed |= !*ok;
+      --m_pending;
+    }
+    m_cv.notify_all();
+    delete ok;
+  });
+  auto task = [ok,
+                  fileName = std::move(fileName),
+                  format,
+                  image = std::move(image),
+                  written = std::move(written)]() {
+    *ok = writeNow(fileName, format, image);
+    if (*ok && written)
+      written();
+  };
+  if (scheduler)
+    scheduler->submit(TaskPriority::Background, std::move(task));
+  else
+    m_pool->enqueue(std::move(task));
+}
+
+bool ImageWriter::wait()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cv.wait(lock, [this]() { return m_pending == 0; });
+  const bool ok = !m_failed;
+  m_failed = false;
+  return ok;
+}
+
+size_t ImageWriter::pending() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_pending;
+}
+
+bool ImageWriter::writeNow(
+    const std::string &fileName, ImageFormat format, const ExportImage &image)
+{
+  TRACE_SCOPE("export", "write image");
+  std::vector<uint8_t> data;
+  const bool ok = encode(format, image, data) && writeFile(fileName, data);
+  if (!ok)
+    std::cerr << "Could not write " << fileName << "\n";
+  return ok;
+}
+
+bool ImageWriter::encode(
+    ImageFormat format, const ExportImage &image, std::vector<uint8_t> &data)
+{
+  TRACE_SCOPE("export", "encode image");
+  data.clear();
+  const size_t numPixels = size_t(image.width) * image.height;
+  if (!numPixels || (image.rgba.size() < numPixels * 4
+          && image.values.size() < numPixels))
+    return false;
+
+  switch (format) {
+  case ImageFormat::Png:
+    return image.rgba.size() >= numPixels * 4
+        && stbi_write_png_to_func(
+            [](void *context, void *bytes, int size) {
+              auto *out = static_cast<std::vector<uint8_t> *>(context);
+              auto *begin = static_cast<const uint8_t *>(bytes);
+              out->insert(out->end(), begin, begin + size);
+            },
+            &data,
+            image.width,
+            image.height,
+            4,
+            image.rgba.data(),
+            4 * image.width);
+  case ImageFormat::Tiff16:
+  case ImageFormat::TiffFloat:
+    encodeTiff(image, format == ImageFormat::Tiff16, data);
+    return true;
+  case ImageFormat::Exr:
+    encodeExr(image, data);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,87 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+// ours
+#include "TaskScheduler.h"
+#include "ThreadPool.h"
+
+enum class ImageFormat
+{
+  Png, // RGBA8
+  Tiff16, // one 16-bit channel, values 0..1 scaled to 0..65535
+  TiffFloat, // one float32 channel
+  Exr, // one float32 channel ("Y"), uncompressed scanlines
+};
+
+// By name (png, tiff16, tiff32, exr); false for unknown names
+bool parseImageFormat(const std::string &name, ImageFormat &format);
+const char *imageExtension(ImageFormat format);
+
+// Pixels of one image, rows in frame order (bottom row first, written as
+// they come, as the PNGs always were). The float formats store `values`;
+// without them they store the color's red channel, sRGB-decoded to linear.
+struct ExportImage
+{
+  int width{0}, height{0};
+  std::vector<uint8_t> rgba; // width * height * 4
+  std::vector<float> values; // width * height, may be empty
+};
+
+// What the float formats store: `values`, or the red channel sRGB-decoded
+std::vector<float> channelValues(const ExportImage &image);
+// rgba as the sRGB-encoded grey of `values`, for the formats storing color
+void encodeValues(ExportImage &image);
+
+// Encodes and writes images on worker threads, so neither the UI nor a
+// render loop waits for compression or the disk: on the shared
+// TaskScheduler at background priority in a session, else on numThreads
+// threads of its own. write() takes ownership of
+// the pixels and returns right away unless maxPending writes are already
+// queued, which bounds the memory held by a producer outrunning the disk.
+class ImageWriter
+{
+ public:
+  explicit ImageWriter(size_t numThreads = 2, size_t maxPending = 8);
+  ~ImageWriter(); // finishes the queued writes
+
+  ImageWriter(const ImageWriter &) = delete;
+  ImageWriter &operator=(const ImageWriter &) = delete;
+
+  // `written` is called on the worker thread once the file is written
+  void write(std::string fileName,
+      ImageFormat format,
+      ExportImage image,
+      std::function<void()> written = nullptr);
+  // Waits for all queued writes; false if one failed since the last wait()
+  bool wait();
+  size_t pending() const;
+
+  // Synchronous, on the calling thread
+  static bool writeNow(const std::string &fileName,
+      ImageFormat format,
+      const ExportImage &image);
+  // The file's bytes, in memory; false if the image has no pixels
+  static bool encode(
+      ImageFormat format, const ExportImage &image, std::vector<uint8_t> &data);
+
+ private:
+  size_t m_numThreads{2};
+  size_t m_maxPending{8};
+  size_t m_pending{0};
+  bool m_failed{false};
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cv;
+  // without a shared scheduler; last, so it joins before the state above
+  // goes
+  std::unique_ptr<ThreadPool> m_pool;
+};
@@ -0,0 +1,298 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "LacCache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <vector>
+// ours
+#include "Trace.h"
+
+namespace {
+
+constexpr char g_magic[8] = {'L', 'A', 'C', 'V', 'O', 'L', '0', '2'};
+constexpr size_t g_dataAlignment = 4096; // voxels start on a page
+
+struct Header
+{
+  char magic[8];
+  uint64_t key;
+  int32_t dims[3];
+  uint32_t bytesPerCell;
+  uint32_t isHalf;
+  float origin[3];
+  float spacing[3];
+  float dataRange[2];
+  int32_t cellSize;
+  int32_t cellDims[3];
+  int32_t cellLower[3];
+  int32_t cellUpper[3];
+  uint64_t dataOffset;
+  uint64_t dataBytes;
+  uint64_t cellOffset;
+  uint64_t cellBytes;
+  uint64_t histogramOffset; // bins over dataRange
+  uint64_t histogramBytes;
+};
+
+// FNV-1a
+struct Hash
+{
+  uint64_t value{14695981039346656037ull};
+
+  void add(const void *data, size_t size)
+  {
+    auto *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i) {
+      value ^= p[i];
+      value *= 1099511628211ull;
+    }
+  }
+
+  template <typename T>
+  void add(const T &v)
+  {
+    add(&v, sizeof(v));
+  }
+
+  void add(const std::string &s)
+  {
+    add(s.data(), s.size());
+    add(s.size());
+  }
+};
+
+} // namespace
+
+uint64_t LacCacheKey::hash() const
+{
+  Hash h;
+
+  std::error_code ec;
+  auto path = std::filesystem::weakly_canonical(volumeFile, ec);
+  h.add(ec ? volumeFile : path.string());
+  struct stat st;
+  if (stat(volumeFile.c_str(), &st) == 0) {
+    h.add(int64_t(st.st_size));
+    h.add(int64_t(st.st_mtim.tv_sec));
+    h.add(int64_t(st.st_mtim.tv_nsec));
+  }
+  if (!densityFormat.empty()) // keeps the keys of NIfTI volumes as they were
+    h.add(densityFormat);
+  if (!region.empty())
+    h.add(region);
+
+  std::ifstream lut(lutFile, std::ios::binary);
+  h.add(std::string(std::istreambuf_iterator<char>(lut), {}));
+
+  h.add(uint64_t(lutId));
+  if (!lutSamples.empty()) // keeps the keys of the file's LUTs as they were
+    h.add(lutSamples.data(), lutSamples.size() * sizeof(float));
+  h.add(uint8_t(halfPrecision));
+  h.add(uint8_t(crop));
+  h.add(crop ? cropThreshold : 0.f);
+  h.add(int32_t(macrocellSize));
+  return h.value;
+}
+
+std::string lacCacheFile(const std::string &dir, const LacCacheKey &key)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.lac", (unsigned long long)key.hash());
+  return (std::filesystem::path(dir) / name).string();
+}
+
+bool readLacCache(const std::string &dir,
+    const LacCacheKey &key,
+    StructuredField &field,
+    bool shared)
+{
+  TRACE_SCOPE("volume", "read LAC cache");
+  const std::string file = lacCacheFile(dir, key);
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  if (shared) {
+    // one shared lock per process mapping the file; a file the last one
+    // removed between open() and flock() is left to be written again
+    struct stat st;
+    if (flock(fd, LOCK_SH) != 0 || fstat(fd, &st) != 0 || st.st_nlink == 0) {
+      ::close(fd);
+      return false;
+    }
+  }
+
+  Header hdr;
+  struct stat st;
+  const bool valid = pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr)
+      && fstat(fd, &st) == 0
+      && std::memcmp(hdr.magic, g_magic, sizeof(g_magic)) == 0
+      && hdr.key == key.hash()
+      && hdr.dataBytes
+          == size_t(hdr.dims[0]) * hdr.dims[1] * hdr.dims[2] * hdr.bytesPerCell
+      && hdr.dataOffset + hdr.dataBytes <= size_t(st.st_size)
+      && hdr.cellOffset + hdr.cellBytes <= size_t(st.st_size)
+      && hdr.histogramOffset + hdr.histogramBytes <= size_t(st.st_size);
+  if (!valid) {
+    ::close(fd);
+    std::cerr << "ignoring invalid LAC cache file " << file << '\n';
+    return false;
+  }
+
+  const size_t mapSize = size_t(st.st_size);
+  void *ptr = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (ptr == MAP_FAILED) {
+    ::close(fd);
+    return false;
+  }
+  madvise(ptr, mapSize, MADV_WILLNEED);
+  if (!shared) {
+    ::close(fd);
+    fd = -1;
+  }
+
+  field = StructuredField();
+  field.dimX = hdr.dims[0];
+  field.dimY = hdr.dims[1];
+  field.dimZ = hdr.dims[2];
+  field.bytesPerCell = hdr.bytesPerCell;
+  field.isHalf = hdr.isHalf != 0;
+  std::copy_n(hdr.origin, 3, field.origin);
+  std::copy_n(hdr.spacing, 3, field.spacing);
+  field.dataRange = {hdr.dataRange[0], hdr.dataRange[1]};
+
+  auto *base = static_cast<const uint8_t *>(ptr);
+  // the field's handle keeps the whole mapping (and the lock) alive
+  std::shared_ptr<const void> mapping(ptr, [mapSize, fd, file](const void *p) {
+    munmap(const_cast<void *>(p), mapSize);
+    if (fd < 0)
+      return;
+    // no other process holds a shared lock: the last one out cleans up
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+      unlink(file.c_str());
+    ::close(fd);
+  });
+  field.voxels = std::shared_ptr<const void>(mapping, base + hdr.dataOffset);
+  field.mapped = true;
+
+  auto &grid = field.macrocells;
+  if (hdr.cellSize > 0 && hdr.cellBytes > 0) {
+    grid.cellSize = hdr.cellSize;
+    std::copy_n(hdr.cellDims, 3, grid.dims);
+    std::copy_n(hdr.cellLower, 3, grid.lower);
+    std::copy_n(hdr.cellUpper, 3, grid.upper);
+    const float *cells =
+        reinterpret_cast<const float *>(base + hdr.cellOffset);
+    grid.minMax.assign(cells, cells + hdr.cellBytes / sizeof(float));
+  }
+
+  if (hdr.histogramBytes > 0) {
+    // follows odd-sized half volumes, so it may be unaligned
+    field.histogram.lower = hdr.dataRange[0];
+    field.histogram.upper = hdr.dataRange[1];
+    field.histogram.bins.resize(hdr.histogramBytes / sizeof(uint64_t));
+    std::memcpy(field.histogram.bins.data(),
+        base + hdr.histogramOffset,
+        field.histogram.bytes());
+  }
+
+  std::cout << "Mapped cached attenuation volume " << file << '\n';
+  return true;
+}
+
+bool writeLacCache(const std::string &dir,
+    const LacCacheKey &key,
+    const StructuredField &field)
+{
+  TRACE_SCOPE("volume", "write LAC cache");
+  if (field.empty())
+    return false;
+
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  const std::string file = lacCacheFile(dir, key);
+  // processes converting the same volume at once write files of their own
+  const std::string tmp = file + "." + std::to_string(getpid()) + ".tmp";
+
+  auto &grid = field.macrocells;
+  Header hdr{};
+  std::memcpy(hdr.magic, g_magic, sizeof(g_magic));
+  hdr.key = key.hash();
+  hdr.dims[0] = field.dimX;
+  hdr.dims[1] = field.dimY;
+  hdr.dims[2] = field.dimZ;
+  hdr.bytesPerCell = field.bytesPerCell;
+  hdr.isHalf = field.isHalf;
+  std::copy_n(field.origin, 3, hdr.origin);
+  std::copy_n(field.spacing, 3, hdr.spacing);
+  hdr.dataRange[0] = field.dataRange.x;
+  hdr.dataRange[1] = field.dataRange.y;
+  hdr.cellSize = grid.cellSize;
+  std::copy_n(grid.dims, 3, hdr.cellDims);
+  std::copy_n(grid.lower, 3, hdr.cellLower);
+  std::copy_n(grid.upper, 3, hdr.cellUpper);
+  hdr.dataOffset = g_dataAlignment;
+  hdr.dataBytes =
+      size_t(field.dimX) * field.dimY * field.dimZ * field.bytesPerCell;
+  hdr.cellOffset = hdr.dataOffset + hdr.dataBytes;
+  hdr.cellBytes = grid.bytes();
+  hdr.histogramOffset = hdr.cellOffset + hdr.cellBytes;
+  hdr.histogramBytes = field.histogram.bytes();
+
+  FILE *out = fopen(tmp.c_str(), "wb");
+  if (!out) {
+    std::cerr << "cannot write LAC cache file " << tmp << '\n';
+    return false;
+  }
+  std::vector<char> padding(g_dataAlignment - sizeof(hdr), 0);
+  bool ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1
+      && fwrite(padding.data(), padding.size(), 1, out) == 1
+      && fwrite(field.data(), hdr.dataBytes, 1, out) == 1
+      && (hdr.cellBytes == 0
+          || fwrite(grid.minMax.data(), hdr.cellBytes, 1, out) == 1)
+      && (hdr.histogramBytes == 0
+          || fwrite(field.histogram.bins.data(), hdr.histogramBytes, 1, out)
+              == 1);
+  ok = fclose(out) == 0 && ok;
+
+  std::error_code renameError;
+  if (ok)
+    std::filesystem::rename(tmp, file, renameError);
+  if (!ok || renameError) {
+    std::cerr << "cannot write LAC cache file " << file << '\n';
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  return true;
+}
+
+std::string sharedLacCacheDir()
+{
+  if (!std::filesystem::is_directory("/dev/shm"))
+    return "";
+  const std::string dir = "/dev/shm/anariDRR-" + std::to_string(getuid());
+  // patient data: other users may not list or read the volumes
+  if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+    return "";
+  struct stat st;
+  if (stat(dir.c_str(), &st) != 0 || st.st_uid != getuid()
+      || (st.st_mode & 077) != 0) {
+    std::cerr << dir << " is not a private directory of this user\n";
+    return "";
+  }
+  return dir;
+}
@@ -0,0 +1,63 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+#include <vector>
+// ours
+#include "FieldTypes.h"
+
+// On-disk cache of converted attenuation volumes ////////////////////////////
+//
+// One file per (volume file, LUT file content, LUT id, conversion settings),
+// named after the 64-bit hash of those inputs: a small header, the voxels
+// (float16 or float32, page aligned), the macrocell grid and the value
+// histogram. Cached volumes are mmap'd and handed to ANARI without reading or
+// converting anything.
+
+struct LacCacheKey
+{
+  std::string volumeFile; // identified by path, size and modification time
+  std::string densityFormat; // of RAW CT volumes (RawCtFormat::str())
+  std::string region; // voxels read of NIfTI volumes; empty: all of them
+  std::string lutFile; // identified by content
+  size_t lutId{0};
+  // breakpoints (density, LAC) of a LUT not from lutFile, e.g. the
+  // --spectrum's effective one; empty for the file's LUTs
+  std::vector<float> lutSamples;
+  bool halfPrecision{false};
+  bool crop{false};
+  float cropThreshold{0.f};
+  int macrocellSize{0};
+
+  uint64_t hash() const;
+};
+
+// Path of the cache file for `key` in `dir`
+std::string lacCacheFile(const std::string &dir, const LacCacheKey &key);
+
+// Maps a cached volume into `field` (a mapped field); false if there is none
+// or it does not match the key. With `shared`, the mapping holds a shared
+// lock on the file for as long as the field's voxels live, and the last
+// process to let go of it removes the file (see sharedLacCacheDir()).
+bool readLacCache(const std::string &dir,
+    const LacCacheKey &key,
+    StructuredField &field,
+    bool shared = false);
+
+// Writes `field` (owned or mapped voxels) through a temporary file that is
+// renamed into place, so readers never see partial files
+bool writeLacCache(const std::string &dir,
+    const LacCacheKey &key,
+    const StructuredField &field);
+
+// Node-local cache in shared memory (/dev/shm/anariDRR-<uid>, created owner
+// only), for viewer processes of one user on the same node: the first one
+// converts a volume and writes it there, every process maps the same pages,
+// so the next one attaches without reading or converting and host memory
+// holds one copy. Read with `shared`, files live while any process maps
+// them. Empty if there is no /dev/shm.
+std::string sharedLacCacheDir();
@@ -0,0 +1,318 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "LacConvertCuda.h"
+
+#include <cuda_fp16.h>
+#include <cuda_runtime.h>
+// std
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+// ours
+#include "Trace.h"
+
+namespace {
+
+constexpr int g_numStreams = 3;
+constexpr size_t g_chunkBytes = size_t(32) << 20; // densities per upload
+
+bool check(cudaError_t err, const char *what)
+{
+  if (err == cudaSuccess)
+    return true;
+  std::cerr << "CUDA " << what << ": " << cudaGetErrorString(err) << '\n';
+  return false;
+}
+
+// Floats as unsigned keys with the same order, so cell ranges can be
+// reduced with integer atomics
+__device__ inline unsigned orderedKey(float f)
+{
+  const unsigned u = __float_as_uint(f);
+  return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+inline float fromOrderedKey(unsigned k)
+{
+  const unsigned u = (k & 0x80000000u) ? (k & 0x7fffffffu) : ~k;
+  float f;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+__global__ void initCells(unsigned *cells, size_t numCells)
+{
+  const size_t c = blockIdx.x * size_t(blockDim.x) + threadIdx.x;
+  if (c >= numCells)
+    return;
+  cells[2 * c] = 0xffffffffu;
+  cells[2 * c + 1] = 0u;
+}
+
+// Cells a voxel position counts towards along one axis: its own and, on a
+// cell border, also the previous one (cells share their last voxel)
+__device__ inline int cellsOf(int p, int cellSize, int out[2])
+{
+  out[0] = p / cellSize;
+  if (p > 0 && p % cellSize == 0) {
+    out[1] = out[0] - 1;
+    return 2;
+  }
+  return 1;
+}
+
+template <typename T>
+__global__ void lacKernel(const T *density,
+    size_t first,
+    size_t count,
+    const float *table,
+    bool halfPrecision,
+    void *dst,
+    int dimX,
+    int dimY,
+    int cellSize,
+    int cellsX,
+    int cellsY,
+    unsigned *cells)
+{
+  const size_t i = blockIdx.x * size_t(blockDim.x) + threadIdx.x;
+  if (i >= count)
+    return;
+
+  // rounded and clamped to the table like LacReader::lookup
+  double d = double(density[i]);
+  if (d != d)
+    d = -32768.0;
+  d = fmin(fmax(rint(d), -32768.0), 32767.0);
+  const float lac = table[int(d) + 32768];
+
+  const size_t v = first + i;
+  if (halfPrecision)
+    static_cast<__half *>(dst)[v] = __float2half(lac);
+  else
+    static_cast<float *>(dst)[v] = lac;
+
+  if (cellSize <= 0)
+    return;
+  const int x = int(v % dimX);
+  const int y = int((v / dimX) % dimY);
+  const int z = int(v / (size_t(dimX) * dimY));
+  int cx[2], cy[2], cz[2];
+  const int nx = cellsOf(x, cellSize, cx);
+  const int ny = cellsOf(y, cellSize, cy);
+  const int nz = cellsOf(z, cellSize, cz);
+  const unsigned key = orderedKey(lac);
+  for (int k = 0; k < nz; ++k)
+    for (int j = 0; j < ny; ++j)
+      for (int l = 0; l < nx; ++l) {
+        const size_t c = (size_t(cz[k]) * cellsY + cy[j]) * cellsX + cx[l];
+        atomicMin(&cells[2 * c], key);
+        atomicMax(&cells[2 * c + 1], key);
+      }
+}
+
+size_t densitySize(DensityType type)
+{
+  switch (type) {
+  case DensityType::UInt8:
+  case DensityType::Int8:
+    return 1;
+  case DensityType::UInt16:
+  case DensityType::Int16:
+    return 2;
+  case DensityType::UInt32:
+  case DensityType::Int32:
+  case DensityType::Float32:
+    return 4;
+  default:
+    return 8;
+  }
+}
+
+template <typename Func>
+void dispatchDensity(DensityType type, Func &&func)
+{
+  switch (type) {
+  case DensityType::UInt8:
+    func(uint8_t{});
+    break;
+  case DensityType::Int8:
+    func(int8_t{});
+    break;
+  case DensityType::UInt16:
+    func(uint16_t{});
+    break;
+  case DensityType::Int16:
+    func(int16_t{});
+    break;
+  case DensityType::UInt32:
+    func(uint32_t{});
+    break;
+  case DensityType::Int32:
+    func(int32_t{});
+    break;
+  case DensityType::Float32:
+    func(float{});
+    break;
+  default:
+    func(double{});
+    break;
+  }
+}
+
+} // namespace
+
+bool isCudaWritable(const void *ptr)
+{
+  cudaPointerAttributes attr;
+  if (cudaPointerGetAttributes(&attr, ptr) != cudaSuccess) {
+    cudaGetLastError(); // not a CUDA pointer; clear the error
+    return false;
+  }
+  return attr.type == cudaMemoryTypeDevice
+      || attr.type == cudaMemoryTypeManaged;
+}
+
+size_t cudaFreeMemory()
+{
+  size_t free = 0, total = 0;
+  if (cudaMemGetInfo(&free, &total) != cudaSuccess) {
+    cudaGetLastError(); // no device; clear the error
+    return 0;
+  }
+  return free;
+}
+
+bool convertLacCuda(const LacCudaJob &job)
+{
+  TRACE_SCOPE("volume", "HU to LAC (CUDA)");
+
+  const size_t elemSize = densitySize(job.type);
+  const size_t sliceVoxels = size_t(job.dims[0]) * job.dims[1];
+  const size_t numVoxels = sliceVoxels * job.dims[2];
+  const size_t sliceBytes = sliceVoxels * elemSize;
+  const size_t chunkSlices = std::max<size_t>(1, g_chunkBytes / sliceBytes);
+  const size_t chunkVoxels = chunkSlices * sliceVoxels;
+
+  const int s = job.macrocells ? job.macrocellSize : 0;
+  const int cells[3] = {s > 0 ? (job.dims[0] + s - 1) / s : 0,
+      s > 0 ? (job.dims[1] + s - 1) / s : 0,
+      s > 0 ? (job.dims[2] + s - 1) / s : 0};
+  const size_t numCells = size_t(cells[0]) * cells[1] * cells[2];
+
+  // pinned source memory turns the copies asynchronous; pageable memory
+  // still works, just without overlap
+  const bool pinned =
+      cudaHostRegister(const_cast<void *>(job.density),
+          numVoxels * elemSize,
+          cudaHostRegisterDefault)
+      == cudaSuccess;
+  if (!pinned)
+    cudaGetLastError();
+
+  float *table = nullptr;
+  unsigned *cellKeys = nullptr;
+  void *staging[g_numStreams] = {};
+  cudaStream_t streams[g_numStreams] = {};
+  bool ok = check(cudaMalloc(&table, 65536 * sizeof(float)), "malloc")
+      && check(cudaMemcpy(table,
+                   job.table,
+                   65536 * sizeof(float),
+                   cudaMemcpyHostToDevice),
+          "upload LUT");
+  if (ok && numCells > 0) {
+    ok = check(cudaMalloc(&cellKeys, numCells * 2 * sizeof(unsigned)), "malloc");
+    if (ok)
+      initCells<<<(numCells + 255) / 256, 256>>>(cellKeys, numCells);
+  }
+  for (int i = 0; ok && i < g_numStreams; ++i) {
+    ok = check(cudaStreamCreate(&streams[i]), "stream")
+        && check(cudaMalloc(&staging[i], chunkVoxels * elemSize), "malloc");
+  }
+
+  const auto *src = static_cast<const uint8_t *>(job.density);
+  for (size_t first = 0, k = 0; ok && first < numVoxels;
+       first += chunkVoxels, ++k) {
+    const size_t count = std::min(chunkVoxels, numVoxels - first);
+    const size_t end = (first + count) * elemSize;
+    if (job.waitForBytes && !job.waitForBytes(end)) {
+      std::cerr << "\t Volume data incomplete, conversion aborted\n";
+      ok = false;
+      break;
+    }
+    auto stream = streams[k % g_numStreams];
+    void *chunk = staging[k % g_numStreams];
+    ok = check(cudaMemcpyAsync(chunk,
+                   src + first * elemSize,
+                   count * elemSize,
+                   cudaMemcpyHostToDevice,
+                   stream),
+        "upload");
+    if (!ok)
+      break;
+    const unsigned blocks = unsigned((count + 255) / 256);
+    dispatchDensity(job.type, [&](auto tag) {
+      using T = decltype(tag);
+      lacKernel<T><<<blocks, 256, 0, stream>>>(static_cast<const T *>(chunk),
+          first,
+          count,
+          table,
+          job.halfPrecision,
+          job.dst,
+          job.dims[0],
+          job.dims[1],
+          s,
+          cells[0],
+          cells[1],
+          cellKeys);
+    });
+    ok = check(cudaGetLastError(), "LUT kernel");
+  }
+  ok = check(cudaDeviceSynchronize(), "convert") && ok;
+
+  if (ok && numCells > 0) {
+    std::vector<unsigned> keys(numCells * 2);
+    ok = check(cudaMemcpy(keys.data(),
+                   cellKeys,
+                   keys.size() * sizeof(unsigned),
+                   cudaMemcpyDeviceToHost),
+        "download cells");
+
+    auto &grid = *job.macrocells;
+    grid = MacrocellGrid();
+    grid.cellSize = s;
+    for (int a = 0; a < 3; ++a) {
+      grid.dims[a] = cells[a];
+      grid.lower[a] = job.dims[a];
+      grid.upper[a] = -1;
+    }
+    grid.minMax.resize(keys.size());
+    for (size_t c = 0; c < numCells; ++c) {
+      grid.minMax[2 * c] = fromOrderedKey(keys[2 * c]);
+      grid.minMax[2 * c + 1] = fromOrderedKey(keys[2 * c + 1]);
+      if (grid.minMax[2 * c + 1] <= 0.f)
+        continue;
+      const int cell[3] = {int(c % cells[0]),
+          int((c / cells[0]) % cells[1]),
+          int(c / (size_t(cells[0]) * cells[1]))};
+      for (int a = 0; a < 3; ++a) {
+        grid.lower[a] = std::min(grid.lower[a], cell[a] * s);
+        grid.upper[a] = std::max(
+            grid.upper[a], std::min((cell[a] + 1) * s, job.dims[a] - 1));
+      }
+    }
+  }
+
+  for (int i = 0; i < g_numStreams; ++i) {
+    cudaFree(staging[i]);
+    if (streams[i])
+      cudaStreamDestroy(streams[i]);
+  }
+  cudaFree(cellKeys);
+  cudaFree(table);
+  if (pinned)
+    cudaHostUnregister(const_cast<void *>(job.density));
+  return ok;
+}
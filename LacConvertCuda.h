@@ -0,0 +1,76 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+// ours
+#include "FieldTypes.h"
+
+// HU to LAC conversion on the GPU (CUDA builds, USE_CUDA_LAC) ///////////////
+//
+// For ANARI devices whose mapped arrays are CUDA device or managed memory:
+// the densities are uploaded in chunks of slices on a few streams, as they
+// are decoded, and a LUT kernel writes the attenuation (and the macrocell
+// ranges) straight into the mapped array. Disk read, PCIe transfer (of the
+// densities, usually int16 and half the size of the result) and conversion
+// overlap.
+
+enum class DensityType
+{
+  UInt8,
+  Int8,
+  UInt16,
+  Int16,
+  UInt32,
+  Int32,
+  Float32,
+  Float64
+};
+
+template <typename T>
+constexpr DensityType densityTypeOf()
+{
+  if constexpr (std::is_same_v<T, uint8_t>)
+    return DensityType::UInt8;
+  else if constexpr (std::is_same_v<T, int8_t>)
+    return DensityType::Int8;
+  else if constexpr (std::is_same_v<T, uint16_t>)
+    return DensityType::UInt16;
+  else if constexpr (std::is_same_v<T, int16_t>)
+    return DensityType::Int16;
+  else if constexpr (std::is_same_v<T, uint32_t>)
+    return DensityType::UInt32;
+  else if constexpr (std::is_same_v<T, int32_t>)
+    return DensityType::Int32;
+  else if constexpr (std::is_same_v<T, float>)
+    return DensityType::Float32;
+  else
+    return DensityType::Float64;
+}
+
+struct LacCudaJob
+{
+  const void *density{nullptr}; // host voxels, x-fastest
+  DensityType type{DensityType::Int16};
+  int dims[3]{0, 0, 0};
+  const float *table{nullptr}; // dense LUT, one entry per int16 from -32768
+  bool halfPrecision{false};
+  void *dst{nullptr}; // device or managed memory
+  int macrocellSize{0};
+  MacrocellGrid *macrocells{nullptr}; // filled if given and size > 0
+  // blocks until the first `bytes` of density are decoded; false on errors
+  std::function<bool(size_t)> waitForBytes;
+};
+
+// Whether ptr is CUDA device or managed memory (a kernel can write it)
+bool isCudaWritable(const void *ptr);
+
+bool convertLacCuda(const LacCudaJob &job);
+
+// Free memory of the current CUDA device in bytes; 0 without one
+size_t cudaFreeMemory();
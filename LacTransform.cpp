@@ -1,14 +1,38 @@
 
 // std
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <vector>
 // json
 #include <nlohmann/json.hpp>
 // ours
 #include "LacTransform.h"
+#include "attenuation.h"
+
+// Dense tables of g_builtinLacLuts, evaluated by the compiler; one constant
+// expression each, which keeps them within its evaluation limits
+static constexpr DenseLacTable g_dense0 = denseLacTable(g_builtinLacLuts[0]);
+static constexpr DenseLacTable g_dense1 = denseLacTable(g_builtinLacLuts[1]);
+static constexpr DenseLacTable g_dense2 = denseLacTable(g_builtinLacLuts[2]);
+static constexpr DenseLacTable g_dense3 = denseLacTable(g_builtinLacLuts[3]);
+static constexpr DenseLacTable g_dense4 = denseLacTable(g_builtinLacLuts[4]);
+static constexpr const DenseLacTable *g_builtinDense[] = {
+    &g_dense0, &g_dense1, &g_dense2, &g_dense3, &g_dense4};
+static_assert(std::size(g_builtinDense) == std::size(g_builtinLacLuts));
+
+float LacReader::interpolate(const LacLut &lacLut, float density)
+{
+  return interpolateLac(lacLut.density.data(),
+      lacLut.lac.data(),
+      lacLut.density.size(),
+      density);
+}
 
 LacReader::LacReader()
     : m_filename("LacLuts.json") {};
@@ -21,13 +45,21 @@ void LacReader::setFilename(std::string &filename)
   m_filename = filename;
 }
 
-void LacReader::read()
+static int64_t modificationTime(const std::string &fileName)
 {
-  std::ifstream json_file(m_filename);
+  std::error_code ec;
+  const auto time = std::filesystem::last_write_time(fileName, ec);
+  return ec ? 0 : int64_t(time.time_since_epoch().count());
+}
+
+// All LUTs of the file, or none and the reason
+static bool parseLacLuts(
+    const std::string &fileName, std::vector<LacLut> &luts, std::string &error)
+{
+  std::ifstream json_file(fileName);
   if (json_file.fail()) {
-    std::cerr << "ERROR: Could not open json file: " << m_filename << "\n"
-              << std::strerror(errno) << std::endl;
-    exit(1);
+    error = std::string("Could not open json file: ") + std::strerror(errno);
+    return false;
   }
   try {
     nlohmann::json data = nlohmann::json::parse(json_file);
@@ -36,21 +68,110 @@ void LacReader::read()
       LacLut lacLut;
       lacLut.name = p["name"];
       lacLut.eV = p["eV"];
-      for (auto &e : p["lut"])
-        lacLut.lut.emplace_back(e["density"], e["lac"]);
-      m_lacLuts.push_back(lacLut);
+      for (auto &e : p["lut"]) {
+        lacLut.density.push_back(e["density"].get<float>());
+        lacLut.lac.push_back(e["lac"].get<float>());
+      }
+      if (lacLut.density.empty()
+          || !std::is_sorted(lacLut.density.begin(), lacLut.density.end())) {
+        error = "LUT " + lacLut.name + ": densities not ascending";
+        return false;
+      }
+      luts.push_back(std::move(lacLut));
     }
-  } catch (...) {
-    std::cerr << "ERROR: Could not parse json file: " << m_filename
-              << std::endl;
+  } catch (const std::exception &e) {
+    error = std::string("Could not parse json file: ") + e.what();
+    return false;
+  }
+  return true;
+}
+
+// The compiled-in LUTs (attenuation.h), dense tables copied
+static std::vector<LacLut> builtinLacLuts()
+{
+  std::vector<LacLut> luts;
+  for (size_t i = 0; i < std::size(g_builtinLacLuts); ++i) {
+    const auto &builtin = g_builtinLacLuts[i];
+    LacLut lut;
+    lut.name = builtin.name;
+    lut.eV = builtin.eV;
+    lut.density.assign(builtin.density, builtin.density + builtin.numPoints);
+    lut.lac.assign(builtin.lac, builtin.lac + builtin.numPoints);
+    lut.dense.assign(g_builtinDense[i]->begin(), g_builtinDense[i]->end());
+    luts.push_back(std::move(lut));
+  }
+  return luts;
+}
+
+void LacReader::read()
+{
+  std::vector<LacLut> luts;
+  std::string error;
+  m_fileTime = modificationTime(m_filename);
+  std::error_code ec;
+  if (!std::filesystem::exists(m_filename, ec)) {
+    // picked up by reload() once the file is there
+    std::cerr << "WARNING: " << m_filename
+              << " not found, using the built-in LUTs\n";
+    luts = builtinLacLuts();
+  } else if (parseLacLuts(m_filename, luts, error)) {
+    for (auto &lut : luts)
+      buildDenseTable(lut);
+  } else {
+    std::cerr << "ERROR: " << m_filename << ": " << error << std::endl;
     exit(1);
   }
+  for (auto &lut : luts)
+    m_lacLuts.push_back(std::move(lut));
+  m_numFileLuts = m_lacLuts.size();
 
   std::cout << "Read LAC LUTs:\n";
   for (auto &lut : m_lacLuts)
     std::cout << lut.name << " (" << lut.eV << "eV)\n";
 }
 
+bool LacReader::fileChanged() const
+{
+  return modificationTime(m_filename) != m_fileTime;
+}
+
+bool LacReader::reload(std::vector<size_t> &changed)
+{
+  // a file that does not parse is tried again once it changes again
+  m_fileTime = modificationTime(m_filename);
+  std::vector<LacLut> luts;
+  std::string error;
+  if (!parseLacLuts(m_filename, luts, error)) {
+    std::cerr << "WARNING: " << m_filename << ": " << error
+              << ", keeping the previous LUTs\n";
+    return false;
+  }
+
+  changed.clear();
+  const bool sameCount = luts.size() == m_numFileLuts;
+  for (size_t i = 0; i < luts.size(); ++i) {
+    auto &lut = luts[i];
+    if (sameCount && lut.name == m_lacLuts[i].name && lut.eV == m_lacLuts[i].eV
+        && lut.density == m_lacLuts[i].density
+        && lut.lac == m_lacLuts[i].lac) {
+      lut.dense = std::move(m_lacLuts[i].dense);
+      continue;
+    }
+    buildDenseTable(lut);
+    changed.push_back(i);
+  }
+  for (size_t i = luts.size(); !sameCount && i < m_lacLuts.size(); ++i)
+    changed.push_back(i);
+
+  m_lacLuts = std::move(luts);
+  m_numFileLuts = m_lacLuts.size();
+  if (m_activeLut >= m_lacLuts.size())
+    m_activeLut = 0;
+  std::cout << "Reloaded " << m_filename << ": " << changed.size()
+            << " LUT(s) changed\n";
+  return true;
+}
+
 std::vector<std::pair<size_t, std::string>> LacReader::getNames() const
 {
   std::vector<std::pair<size_t, std::string>> names;
@@ -67,17 +188,182 @@ float LacReader::lookup(ssize_t density) const
 
 float LacReader::lookup(ssize_t density, size_t lacLutId) const
 {
-  // clamp density to range of lut
-  density = std::min(m_lacLuts[lacLutId].lut.back().density,
-      std::max(density, m_lacLuts[lacLutId].lut.front().density));
-
-  const auto pos = find_if(m_lacLuts[lacLutId].lut.begin(),
-      m_lacLuts[lacLutId].lut.end(),
-      [density](LacLutEntry elem) { return elem.density > density; });
-  const auto previous = pos - 1;
-  return previous->lac
-      + (density - previous->density) / (pos->density - previous->density)
-      * (pos->lac - previous->lac);
+  return interpolate(m_lacLuts[lacLutId], float(density));
+}
+
+void LacReader::lookup(
+    std::span<const int16_t> density, std::span<float> lac) const
+{
+  const auto &dense = m_lacLuts[m_activeLut].dense;
+  if (dense.empty())
+    return;
+
+  const float *table = dense.data() - std::numeric_limits<int16_t>::min();
+  for (size_t i = 0; i < density.size(); ++i)
+    lac[i] = table[density[i]];
+}
+
+void LacReader::lookup(std::span<const float> density, std::span<float> lac) const
+{
+  const auto &lacLut = m_lacLuts[m_activeLut];
+  for (size_t i = 0; i < density.size(); ++i)
+    lac[i] = interpolate(lacLut, density[i]);
+}
+
+void LacReader::buildDenseTable(LacLut &lacLut)
+{
+  lacLut.dense.clear();
+  if (lacLut.density.empty())
+    return;
+
+  constexpr int32_t minDensity = std::numeric_limits<int16_t>::min();
+  constexpr int32_t maxDensity = std::numeric_limits<int16_t>::max();
+  lacLut.dense.resize(maxDensity - minDensity + 1);
+  for (int32_t d = minDensity; d <= maxDensity; ++d)
+    lacLut.dense[d - minDensity] = interpolate(lacLut, float(d));
+}
+
+std::vector<float> LacReader::sample(
+    size_t lacLutId, size_t numSamples, float &minDensity, float &maxDensity) const
+{
+  const auto &lut = m_lacLuts[lacLutId];
+  minDensity = lut.density.front();
+  maxDensity = lut.density.back();
+
+  std::vector<float> samples(numSamples);
+  const float step =
+      numSamples > 1 ? (maxDensity - minDensity) / (numSamples - 1) : 0.f;
+  for (size_t i = 0; i < numSamples; ++i)
+    samples[i] = interpolate(lut, minDensity + i * step);
+  return samples;
+}
+
+bool LacReader::bracketEnergy(
+    float eV, size_t &lower, size_t &upper, float &t) const
+{
+  if (m_lacLuts.empty())
+    return false;
+
+  // nearest LUT at or below eV and at or above it, in any file order
+  lower = upper = m_lacLuts.size();
+  for (size_t i = 0; i < m_lacLuts.size(); ++i) {
+    const float e = float(m_lacLuts[i].eV);
+    if (e <= eV && (lower == m_lacLuts.size() || e > m_lacLuts[lower].eV))
+      lower = i;
+    if (e >= eV && (upper == m_lacLuts.size() || e < m_lacLuts[upper].eV))
+      upper = i;
+  }
+  if (lower == m_lacLuts.size())
+    lower = upper;
+  if (upper == m_lacLuts.size())
+    upper = lower;
+
+  const float e0 = float(m_lacLuts[lower].eV);
+  const float e1 = float(m_lacLuts[upper].eV);
+  t = e1 > e0 && e0 > 0.f
+      ? (std::log(eV) - std::log(e0)) / (std::log(e1) - std::log(e0))
+      : 0.f;
+  return true;
+}
+
+// LAC between two LUTs' energies, t the weight of the upper one
+static float blend(float a, float b, float t)
+{
+  return a > 0.f && b > 0.f
+      ? std::exp((1.f - t) * std::log(a) + t * std::log(b))
+      : (1.f - t) * a + t * b;
+}
+
+std::vector<float> LacReader::sampleAtEnergy(
+    float eV, size_t numSamples, float &minDensity, float &maxDensity) const
+{
+  size_t lower = 0, upper = 0;
+  float t = 0.f;
+  if (!bracketEnergy(eV, lower, upper, t))
+    return {};
+  if (lower == upper || t <= 0.f)
+    return sample(lower, numSamples, minDensity, maxDensity);
+  if (t >= 1.f)
+    return sample(upper, numSamples, minDensity, maxDensity);
+
+  const auto &lut0 = m_lacLuts[lower];
+  const auto &lut1 = m_lacLuts[upper];
+  minDensity = std::min(lut0.density.front(), lut1.density.front());
+  maxDensity = std::max(lut0.density.back(), lut1.density.back());
+
+  std::vector<float> samples(numSamples);
+  const float step =
+      numSamples > 1 ? (maxDensity - minDensity) / (numSamples - 1) : 0.f;
+  for (size_t i = 0; i < numSamples; ++i) {
+    const float d = minDensity + i * step;
+    samples[i] = blend(interpolate(lut0, d), interpolate(lut1, d), t);
+  }
+  return samples;
+}
+
+size_t LacReader::addSpectrumLut(
+    const std::string &name, const std::vector<SpectrumBin> &bins)
+{
+  std::vector<float> densities;
+  for (auto &lut : m_lacLuts)
+    densities.insert(densities.end(), lut.density.begin(), lut.density.end());
+  std::sort(densities.begin(), densities.end());
+  densities.erase(
+      std::unique(densities.begin(), densities.end()), densities.end());
+
+  float totalWeight = 0.f;
+  for (auto &bin : bins)
+    totalWeight += std::max(bin.weight, 0.f);
+
+  LacLut spectrum;
+  spectrum.name = name;
+  std::vector<float> lac(densities.size(), 0.f);
+  float meanEnergy = 0.f;
+  for (auto &bin : bins) {
+    size_t lower = 0, upper = 0;
+    float t = 0.f;
+    if (totalWeight <= 0.f || bin.weight <= 0.f
+        || !bracketEnergy(bin.eV, lower, upper, t))
+      continue;
+    t = std::clamp(t, 0.f, 1.f);
+    const float w = bin.weight / totalWeight;
+    meanEnergy += w * bin.eV;
+    for (size_t i = 0; i < densities.size(); ++i) {
+      const auto d = densities[i];
+      lac[i] += w
+          * blend(interpolate(m_lacLuts[lower], d),
+              interpolate(m_lacLuts[upper], d),
+              t);
+    }
+  }
+  spectrum.eV = size_t(std::lround(meanEnergy));
+  spectrum.density = std::move(densities);
+  spectrum.lac = std::move(lac);
+
+  m_lacLuts.push_back(std::move(spectrum));
+  buildDenseTable(m_lacLuts.back());
+  return m_lacLuts.size() - 1;
+}
+
+bool readSpectrum(const std::string &fileName, std::vector<SpectrumBin> &bins)
+{
+  std::ifstream in(fileName);
+  if (!in) {
+    std::cerr << "ERROR: Could not open spectrum file: " << fileName << '\n';
+    return false;
+  }
+  try {
+    nlohmann::json data = nlohmann::json::parse(in);
+    std::vector<SpectrumBin> result;
+    for (auto &b : data.at("spectrum"))
+      result.push_back({b.at("eV").get<float>(), b.at("weight").get<float>()});
+    bins = std::move(result);
+  } catch (const nlohmann::json::exception &e) {
+    std::cerr << "ERROR: Could not parse spectrum file: " << fileName << ": "
+              << e.what() << '\n';
+    return false;
+  }
+  return !bins.empty();
 }
 
 size_t LacReader::getActiveLut() const
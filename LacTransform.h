@@ -1,23 +1,39 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
-struct LacLutEntry
-{
-    ssize_t density;
-    float lac;
-};
-
 struct LacLut
 {
     std::string name;
     size_t eV;
-    std::vector<LacLutEntry> lut;
+    // Breakpoints by ascending density, as two arrays: the search only
+    // touches densities
+    std::vector<float> density;
+    std::vector<float> lac;
+    // LAC for every int16 density, indexed by (density - INT16_MIN);
+    // built once by LacReader::read()
+    std::vector<float> dense;
+};
+
+// One energy bin of a tube spectrum: photon energy and relative weight
+struct SpectrumBin
+{
+    float eV;
+    float weight;
 };
 
+// {"spectrum": [{"eV": ..., "weight": ...}, ...]}; false on errors
+bool readSpectrum(const std::string &fileName, std::vector<SpectrumBin> &bins);
+
 struct LacReader
 {
     LacReader();
@@ -25,13 +41,91 @@ struct LacReader
 
     void setFilename(std::string& filename);
     void read();
+    // Whether the LUT file was modified since it was last read
+    bool fileChanged() const;
+    // Reads the LUT file again, keeping the current LUTs if it does not
+    // parse (false). `changed` receives the ids whose tables differ; all of
+    // them if the number of LUTs changed. LUTs added after the file's
+    // (addSpectrumLut()) are dropped.
+    bool reload(std::vector<size_t> &changed);
     std::vector<std::pair<size_t, std::string>> getNames() const;
     float lookup(ssize_t density) const;
     float lookup(ssize_t density, size_t lacLutId) const;
+    // Batch conversion with the active LUT, lac.size() >= density.size();
+    // thread-safe, so callers can split a volume into ranges and convert
+    // them concurrently
+    void lookup(std::span<const int16_t> density, std::span<float> lac) const;
+    // Fractional densities interpolate between the breakpoints, which the
+    // integral dense table cannot
+    void lookup(std::span<const float> density, std::span<float> lac) const;
+    // Same for any other voxel type: integers are clamped to the int16
+    // range of the dense table, doubles go through float
+    template <typename T>
+    void lookup(std::span<const T> density, std::span<float> lac) const;
+    // LAC at a density, clamped to the breakpoints' range (NaN to the
+    // lowest one, like denseIndex())
+    static float interpolate(const LacLut &lacLut, float density);
+    // Index of a density into the dense table, rounded and clamped like
+    // lookup()
+    template <typename T>
+    static size_t denseIndex(T density);
+    static void buildDenseTable(LacLut &lacLut);
+    // LAC sampled at numSamples evenly spaced densities spanning the LUT's
+    // density range (returned in minDensity/maxDensity); used as a 1D
+    // transfer function when the LUT is applied on the device
+    std::vector<float> sample(size_t lacLutId,
+        size_t numSamples,
+        float &minDensity,
+        float &maxDensity) const;
+    // Same for a photon energy between the LUTs' energies: the two LUTs
+    // nearest to eV are interpolated per density, log-log (attenuation
+    // falls roughly as a power of the energy), over both LUTs' density
+    // range; energies outside the LUTs' clamp to the nearest one
+    std::vector<float> sampleAtEnergy(float eV,
+        size_t numSamples,
+        float &minDensity,
+        float &maxDensity) const;
+    // The LUTs bracketing eV and the weight of `upper` in [0, 1]
+    bool bracketEnergy(float eV, size_t &lower, size_t &upper, float &t) const;
+    // Effective LUT of a polychromatic beam: per density the weighted mean
+    // (weights normalized) of the LACs at the bins' energies, interpolated
+    // like sampleAtEnergy(), at every density of the existing LUTs.
+    // Appended to the LUTs with the mean energy as its eV; returns its id.
+    size_t addSpectrumLut(
+        const std::string &name, const std::vector<SpectrumBin> &bins);
     size_t getActiveLut() const;
     void setActiveLut(size_t id);
 
     std::string m_filename;
     std::vector<LacLut> m_lacLuts;
+    size_t m_numFileLuts{0}; // the first ones, read from m_filename
     size_t m_activeLut{0};
+    int64_t m_fileTime{0}; // of m_filename when last read
 };
+
+template <typename T>
+inline void LacReader::lookup(std::span<const T> density, std::span<float> lac) const
+{
+    const auto &lacLut = m_lacLuts[m_activeLut];
+    if constexpr (std::is_floating_point_v<T>) {
+        for (size_t i = 0; i < density.size(); ++i)
+            lac[i] = interpolate(lacLut, float(density[i]));
+    } else {
+        const float *dense = lacLut.dense.data();
+        if (!dense)
+            return;
+        for (size_t i = 0; i < density.size(); ++i)
+            lac[i] = dense[denseIndex(density[i])];
+    }
+}
+
+template <typename T>
+inline size_t LacReader::denseIndex(T density)
+{
+    constexpr double minDensity = std::numeric_limits<int16_t>::min();
+    constexpr double maxDensity = std::numeric_limits<int16_t>::max();
+    double d = double(density);
+    if constexpr (std::is_floating_point_v<T>)
+        d = std::isnan(d) ? minDensity : std::nearbyint(d);
+    return size_t(ssize_t(std::clamp(d, minDensity, maxDensity)) - ssize_t(minDensity));
+}
@@ -0,0 +1,127 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// Least-recently-used cache with a byte budget. The most recently inserted
+// entry is always kept, even when it alone exceeds the budget, so a budget of
+// zero degenerates to "keep only the current entry".
+template <typename Key, typename Value>
+class LruCache
+{
+ public:
+  using EvictCallback = std::function<void(const Key &, Value &)>;
+
+  explicit LruCache(size_t budget = 0) : m_budget(budget) {}
+  ~LruCache()
+  {
+    clear();
+  }
+
+  LruCache(const LruCache &) = delete;
+  LruCache &operator=(const LruCache &) = delete;
+
+  // Returns nullptr on a miss; a hit becomes the most recently used entry
+  Value *get(const Key &key)
+  {
+    auto it = m_index.find(key);
+    if (it == m_index.end())
+      return nullptr;
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return &it->second->value;
+  }
+
+  // A lookup that leaves the order alone, e.g. to check what is cached
+  const Value *peek(const Key &key) const
+  {
+    auto it = m_index.find(key);
+    return it == m_index.end() ? nullptr : &it->second->value;
+  }
+
+  Value &put(const Key &key, Value value, size_t bytes)
+  {
+    erase(key);
+    m_entries.push_front({key, std::move(value), bytes});
+    m_index[key] = m_entries.begin();
+    m_bytes += bytes;
+    evict();
+    return m_entries.front().value;
+  }
+
+  void erase(const Key &key)
+  {
+    auto it = m_index.find(key);
+    if (it == m_index.end())
+      return;
+    release(it->second);
+  }
+
+  void clear()
+  {
+    while (!m_entries.empty())
+      release(std::prev(m_entries.end()));
+  }
+
+  void setBudget(size_t bytes)
+  {
+    m_budget = bytes;
+    evict();
+  }
+
+  void setEvictCallback(EvictCallback cb)
+  {
+    m_evictCallback = std::move(cb);
+  }
+
+  size_t budget() const
+  {
+    return m_budget;
+  }
+
+  size_t bytes() const
+  {
+    return m_bytes;
+  }
+
+  size_t size() const
+  {
+    return m_entries.size();
+  }
+
+ private:
+  struct Entry
+  {
+    Key key;
+    Value value;
+    size_t bytes;
+  };
+  using Iterator = typename std::list<Entry>::iterator;
+
+  void evict()
+  {
+    while (m_bytes > m_budget && m_entries.size() > 1)
+      release(std::prev(m_entries.end()));
+  }
+
+  void release(Iterator it)
+  {
+    if (m_evictCallback)
+      m_evictCallback(it->key, it->value);
+    m_bytes -= it->bytes;
+    m_index.erase(it->key);
+    m_entries.erase(it);
+  }
+
+  std::list<Entry> m_entries;
+  std::unordered_map<Key, Iterator> m_index;
+  EvictCallback m_evictCallback;
+  size_t m_budget{0};
+  size_t m_bytes{0};
+};
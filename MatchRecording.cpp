@@ -0,0 +1,133 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "MatchRecording.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// std
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+bool writeRaw(const std::filesystem::path &file, const void *data, size_t size)
+{
+  std::ofstream out(file, std::ios::binary);
+  out.write((const char *)data, size);
+  if (!out) {
+    std::cerr << "Could not write " << file << '\n';
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+bool readRaw(const std::filesystem::path &file, size_t count, std::vector<T> &data)
+{
+  std::ifstream in(file, std::ios::binary);
+  data.resize(count);
+  in.read((char *)data.data(), count * sizeof(T));
+  if (!in) {
+    std::cerr << "Could not read " << file << '\n';
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+bool writeMatchRecord(
+    const std::string &dir, size_t index, const MatchRecord &record)
+{
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+
+  char name[32];
+  snprintf(name, sizeof(name), "match_%06zu", index);
+  const auto base = std::filesystem::path(dir) / name;
+
+  nlohmann::json json;
+  json["width"] = record.width;
+  json["height"] = record.height;
+  json["reference_width"] = record.referenceWidth;
+  json["reference_height"] = record.referenceHeight;
+  json["reference_swizzle"] = record.referenceSwizzle;
+  json["has_depth"] = !record.depth.empty();
+  json["fovy"] = record.fovy;
+  json["aspect"] = record.aspect;
+  json["eye"] = record.eye;
+  json["center"] = record.center;
+  json["up"] = record.up;
+
+  std::ofstream out(base.string() + ".json");
+  out << json.dump(2) << '\n';
+  if (!out) {
+    std::cerr << "Could not write " << base.string() << ".json\n";
+    return false;
+  }
+
+  return writeRaw(base.string() + ".query", record.query.data(), record.query.size())
+      && (record.depth.empty()
+          || writeRaw(base.string() + ".depth",
+              record.depth.data(),
+              record.depth.size() * sizeof(float)))
+      && writeRaw(base.string() + ".reference",
+          record.reference.data(),
+          record.reference.size());
+}
+
+bool readMatchRecords(const std::string &dir, std::vector<MatchRecord> &records)
+{
+  std::error_code ec;
+  std::vector<std::filesystem::path> files;
+  for (auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+    const auto name = entry.path().filename().string();
+    if (name.rfind("match_", 0) == 0 && entry.path().extension() == ".json")
+      files.push_back(entry.path());
+  }
+  if (ec) {
+    std::cerr << "Could not list " << dir << ": " << ec.message() << '\n';
+    return false;
+  }
+  std::sort(files.begin(), files.end());
+
+  records.clear();
+  for (auto &file : files) {
+    MatchRecord record;
+    try {
+      std::ifstream in(file);
+      auto json = nlohmann::json::parse(in);
+      record.width = json["width"];
+      record.height = json["height"];
+      record.referenceWidth = json["reference_width"];
+      record.referenceHeight = json["reference_height"];
+      record.referenceSwizzle = json["reference_swizzle"];
+      record.fovy = json["fovy"];
+      record.aspect = json["aspect"];
+      record.eye = json["eye"];
+      record.center = json["center"];
+      record.up = json["up"];
+
+      auto base = file;
+      base.replace_extension();
+      const size_t pixels = record.width * record.height;
+      if (!readRaw(base.string() + ".query", pixels * 4, record.query))
+        return false;
+      if (json["has_depth"]
+          && !readRaw(base.string() + ".depth", pixels * 3, record.depth))
+        return false;
+      if (!readRaw(base.string() + ".reference",
+              record.referenceWidth * record.referenceHeight * 4,
+              record.reference))
+        return false;
+    } catch (const std::exception &e) {
+      std::cerr << "Could not parse " << file << ": " << e.what() << '\n';
+      return false;
+    }
+    records.push_back(std::move(record));
+  }
+  return true;
+}
@@ -0,0 +1,39 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The inputs of one match as handed to a matcher: reference, query and
+// depth3d images plus the camera they were rendered with. Recorded by the
+// viewer (--record-matches) and replayed by anariDRRMatcherBench.
+struct MatchRecord
+{
+  size_t width{0};
+  size_t height{0};
+  std::vector<uint8_t> query; // RGBA8
+  std::vector<float> depth; // float3 ray origins, empty if not recorded
+
+  size_t referenceWidth{0};
+  size_t referenceHeight{0};
+  std::vector<uint8_t> reference; // RGBA8
+  bool referenceSwizzle{false};
+
+  float fovy{0.f};
+  float aspect{1.f};
+  std::array<float, 3> eye{}, center{}, up{};
+};
+
+// Writes <dir>/match_<index>.json plus raw .query, .depth and .reference
+// files next to it
+bool writeMatchRecord(
+    const std::string &dir, size_t index, const MatchRecord &record);
+
+// Reads all match_*.json records in dir, sorted by name
+bool readMatchRecords(const std::string &dir, std::vector<MatchRecord> &records);
@@ -1,4 +1,331 @@
 #include "Matcher.h"
+#include "MatcherProcess.h"
+#include "SimilarityMatcher.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+abi_matcher::abi_matcher(const matcher_abi *abi) : m_abi(abi)
+{
+  if (m_abi && m_abi->create)
+    m_instance = m_abi->create();
+}
+
+abi_matcher::~abi_matcher()
+{
+  if (m_instance && m_abi->destroy)
+    m_abi->destroy(m_instance);
+}
+
+bool abi_matcher::valid() const
+{
+  return m_instance != nullptr;
+}
+
+uint64_t abi_matcher::capabilities() const
+{
+  return m_abi->capabilities;
+}
+
+void abi_matcher::set_image(const void* data,
+                            size_t width,
+                            size_t height,
+                            PIXEL_TYPE pixel_type,
+                            IMAGE_TYPE image_type,
+                            bool swizzle)
+{
+  set_image_view(
+      make_image_view(data, width, height, pixel_type, swizzle), image_type);
+}
+
+void abi_matcher::match()
+{
+  if (m_abi->match)
+    m_abi->match(m_instance);
+}
+
+void abi_matcher::calibrate(size_t width, size_t height, float fovy, float aspect)
+{
+  if (m_abi->calibrate)
+    m_abi->calibrate(m_instance, width, height, fovy, aspect);
+}
+
+bool abi_matcher::update_camera(std::array<float, 3>& eye,
+                                std::array<float, 3>& center,
+                                std::array<float, 3>& up)
+{
+  if (!m_abi->update_camera)
+    return false;
+  return m_abi->update_camera(m_instance, eye.data(), center.data(), up.data())
+      != 0;
+}
+
+bool abi_matcher::set_image_view(
+    const matcher_image_view &view, IMAGE_TYPE image_type)
+{
+  if (!m_abi->set_image)
+    return false;
+  if (view.memory_space != MATCHER_MEMORY_HOST
+      && !(m_abi->capabilities & MATCHER_CAP_DEVICE_MEMORY))
+    return false;
+  return m_abi->set_image(m_instance, &view, uint32_t(image_type)) == 0;
+}
+
+bool abi_matcher::set_reference_pyramid(const matcher_pyramid_view &pyramid)
+{
+  if (!(m_abi->capabilities & MATCHER_CAP_PYRAMID)
+      || !m_abi->set_reference_pyramid)
+    return false;
+  return m_abi->set_reference_pyramid(m_instance, &pyramid) == 0;
+}
+
+bool abi_matcher::match_batch(matcher_batch_item *items, size_t count)
+{
+  if (!(m_abi->capabilities & MATCHER_CAP_BATCH) || !m_abi->match_batch)
+    return false;
+  return m_abi->match_batch(m_instance, items, count) == 0;
+}
+
+bool abi_matcher::save_reference(std::vector<uint8_t> &state)
+{
+  if (!(m_abi->capabilities & MATCHER_CAP_REFERENCE_STATE)
+      || m_abi->struct_size < MATCHER_ABI_SIZE_1_1 || !m_abi->save_reference)
+    return false;
+  const size_t size = m_abi->save_reference(m_instance, nullptr, 0);
+  if (size == 0)
+    return false;
+  state.resize(size);
+  return m_abi->save_reference(m_instance, state.data(), state.size()) == size;
+}
+
+bool abi_matcher::load_reference(const std::vector<uint8_t> &state)
+{
+  if (!(m_abi->capabilities & MATCHER_CAP_REFERENCE_STATE)
+      || m_abi->struct_size < MATCHER_ABI_SIZE_1_1 || !m_abi->load_reference)
+    return false;
+  return m_abi->load_reference(m_instance, state.data(), state.size()) == 0;
+}
+
+bool abi_matcher::set_point_query(const matcher_point_query &query)
+{
+  if (!(m_abi->capabilities & MATCHER_CAP_POINT_QUERY)
+      || m_abi->struct_size < MATCHER_ABI_SIZE_1_2 || !m_abi->set_point_query)
+    return false;
+  return m_abi->set_point_query(m_instance, &query) == 0;
+}
+
+bool abi_matcher::set_scratch(const matcher_scratch *scratch)
+{
+  if (m_abi->struct_size < MATCHER_ABI_SIZE_1_6 || !m_abi->set_scratch)
+    return false;
+  return m_abi->set_scratch(m_instance, scratch) == 0;
+}
+
+bool abi_matcher::set_threading(const matcher_threading &threading)
+{
+  if (m_abi->struct_size < sizeof(matcher_abi) || !m_abi->set_threading)
+    return false;
+  return m_abi->set_threading(m_instance, &threading) == 0;
+}
+
+uint64_t matcher_capabilities(feature_matcher *matcher)
+{
+  auto *abi = dynamic_cast<abi_matcher *>(matcher);
+  return abi ? abi->capabilities() : 0;
+}
+
+matcher_pixel_type reference_pixel_type(
+    uint64_t capabilities, bool swizzle, bool gray16)
+{
+  if (gray16 && (capabilities & MATCHER_CAP_GRAY16))
+    return MATCHER_PIXEL_GRAY16;
+  if (capabilities & MATCHER_CAP_GRAY)
+    return MATCHER_PIXEL_GRAY8;
+  if (swizzle && (capabilities & MATCHER_CAP_BGRA))
+    return MATCHER_PIXEL_BGRA8;
+  return MATCHER_PIXEL_RGBA8;
+}
+
+bool set_image_view(feature_matcher *matcher,
+                    const matcher_image_view &view,
+                    feature_matcher::IMAGE_TYPE image_type)
+{
+  if (!matcher)
+    return false;
+  if (auto *abi = dynamic_cast<abi_matcher *>(matcher))
+    return abi->set_image_view(view, image_type);
+  if (view.memory_space != MATCHER_MEMORY_HOST)
+    return false;
+
+  const auto pixelType = feature_matcher::PIXEL_TYPE(view.pixel_type);
+  const bool swizzle = view.flags & MATCHER_IMAGE_SWIZZLE;
+  const size_t rowBytes = view.width * matcher_pixel_size(view.pixel_type);
+  if (view.row_stride == rowBytes) {
+    matcher->set_image(view.data,
+        view.width,
+        view.height,
+        pixelType,
+        image_type,
+        swizzle);
+    return true;
+  }
+
+  // legacy matchers only take packed rows
+  std::vector<uint8_t> packed(rowBytes * view.height);
+  for (size_t y = 0; y < view.height; ++y) {
+    std::memcpy(packed.data() + y * rowBytes,
+        static_cast<const uint8_t *>(view.data) + y * view.row_stride,
+        rowBytes);
+  }
+  matcher->set_image(
+      packed.data(), view.width, view.height, pixelType, image_type, swizzle);
+  return true;
+}
+
+bool set_point_query(feature_matcher *matcher,
+                     const matcher_point_query &query)
+{
+  auto *abi = dynamic_cast<abi_matcher *>(matcher);
+  return abi && abi->set_point_query(query);
+}
+
+bool set_matcher_scratch(feature_matcher *matcher,
+                         const matcher_scratch *scratch)
+{
+  auto *abi = dynamic_cast<abi_matcher *>(matcher);
+  return abi && abi->set_scratch(scratch);
+}
+
+bool set_matcher_threading(feature_matcher *matcher,
+                           const matcher_threading &threading)
+{
+  if (auto *abi = dynamic_cast<abi_matcher *>(matcher))
+    return abi->set_threading(threading);
+  if (auto *process = dynamic_cast<process_matcher *>(matcher))
+    return process->set_threading(threading);
+  return false;
+}
+
+matcher_parallel_for::matcher_parallel_for(
+    TaskScheduler &scheduler, unsigned threads)
+    : m_scheduler(scheduler), m_threads(threads)
+{}
+
+void matcher_parallel_for::setThreads(unsigned threads)
+{
+  m_threads = threads;
+}
+
+int matcher_parallel_for::run(void *host,
+    size_t count,
+    size_t grain,
+    void (*body)(void *arg, size_t begin, size_t end),
+    void *arg)
+{
+  auto *self = static_cast<matcher_parallel_for *>(host);
+  if (!self || !body)
+    return 1;
+  if (count == 0)
+    return 0;
+  self->m_scheduler.runChunks(count,
+      grain,
+      std::max(self->m_threads.load(), 1u),
+      [&](size_t begin, size_t end) { body(arg, begin, end); });
+  return 0;
+}
+
+bool open_matcher_library(const std::string &path, matcher_library &library)
+{
+  void *handle = dlopen(path.c_str(), RTLD_NOW);
+  if (!handle) {
+    fprintf(stderr, "Error: %s\n", dlerror());
+    fprintf(stderr, "Could not load %s\n", path.c_str());
+    return false;
+  }
+
+  // Prefer the versioned C ABI, fall back to the legacy vtable symbols
+  auto get_abi = (get_matcher_abi_fn)dlsym(handle, "get_matcher_abi");
+  if (get_abi) {
+    const matcher_abi *abi = get_abi(MATCHER_ABI_VERSION);
+    if (!abi || (abi->version >> 16) != MATCHER_ABI_VERSION_MAJOR
+        || abi->struct_size < MATCHER_ABI_SIZE_1_0) {
+      fprintf(stderr, "Incompatible matcher ABI in %s\n", path.c_str());
+      dlclose(handle);
+      return false;
+    }
+
+    auto matcher = std::make_unique<abi_matcher>(abi);
+    if (!matcher->valid()) {
+      fprintf(stderr, "Could not create instance of matcher\n");
+      dlclose(handle);
+      return false;
+    }
+    library.handle = handle;
+    library.matcher = matcher.get();
+    library.adapter = std::move(matcher);
+    library.name = abi->name ? abi->name : path;
+    library.description = abi->description ? abi->description : "";
+
+    fprintf(stdout, "Loaded Matcher %s (ABI %u.%u): %s\n",
+        library.name.c_str(),
+        abi->version >> 16,
+        abi->version & 0xffff,
+        library.description.c_str());
+    return true;
+  }
+
+  // Load symbols
+  feature_matcher* (*create_matcher)() = (feature_matcher* (*)()) dlsym(handle, "create_matcher");
+  const char* (*get_name)() = (const char* (*)())dlsym(handle, "get_matcher_type");
+  const char* (*get_desc)() = (const char* (*)())dlsym(handle, "get_matcher_description");
+
+  if (!create_matcher || !get_name || !get_desc) {
+    fprintf(stderr, "Error: %s\n", dlerror());
+    fprintf(stderr, "Could not load symbols from file: %s\n", path.c_str());
+    dlclose(handle);
+    return false;
+  }
+
+  feature_matcher* matcher = create_matcher();
+  if (!matcher) {
+    fprintf(stderr, "Could not create instance of matcher\n");
+    dlclose(handle);
+    return false;
+  }
+  library.handle = handle;
+  library.matcher = matcher;
+  library.name = get_name();
+  library.description = get_desc();
+
+  fprintf(stdout, "Loaded Matcher %s: %s\n", library.name.c_str(), library.description.c_str());
+  return true;
+}
+
+void close_matcher_library(matcher_library &library)
+{
+  if (!library.handle)
+    return;
+  // ABI instances must go before their libraries are closed
+  if (library.adapter) {
+    library.adapter.reset();
+  } else if (library.matcher) {
+    void (*destroy_matcher)(feature_matcher*) =
+        (void (*)(feature_matcher*))dlsym(library.handle, "destroy_matcher");
+    if (destroy_matcher)
+      destroy_matcher(library.matcher);
+  }
+  dlclose(library.handle);
+  library.handle = nullptr;
+  library.matcher = nullptr;
+}
 
 MatchersWrapper::~MatchersWrapper() noexcept
 {
@@ -9,57 +336,124 @@ MatchersWrapper::~MatchersWrapper() noexcept
 
 void MatchersWrapper::init(std::vector<std::string> &matcherLibraryNames)
 {
-  for (auto &lib : matcherLibraryNames) {
-    void *handle = dlopen(lib.c_str(), RTLD_NOW);
-    if (!handle) {
-      fprintf(stderr, "Error: %s\n", dlerror());
-      fprintf(stderr, "Could not load %s\n", lib.c_str());
-      continue;
-    }
+  std::vector<MatcherLibrary> libraries;
+  for (auto &lib : matcherLibraryNames)
+    libraries.push_back({lib, false});
+  init(libraries, false);
+}
 
-    // Load symbols
-    feature_matcher* (*create_matcher)() = (feature_matcher* (*)()) dlsym(handle, "create_matcher");
-    const char* (*get_name)() = (const char* (*)())dlsym(handle, "get_matcher_type");
-    const char* (*get_desc)() = (const char* (*)())dlsym(handle, "get_matcher_description");
+void MatchersWrapper::init(
+    const std::vector<MatcherLibrary> &libraries, bool lazy)
+{
+  if (m_hostExecutable.empty()) {
+    std::error_code ec;
+    auto self = std::filesystem::read_symlink("/proc/self/exe", ec);
+    m_hostExecutable = (self.parent_path() / "anariDRRMatcherHost").string();
+  }
 
-    if (!create_matcher || !get_name || !get_desc) {
-      fprintf(stderr, "Error: %s\n", dlerror());
-      fprintf(stderr, "Could not load symbols from file: %s\n", lib.c_str());
-      dlclose(handle);
+  for (auto &lib : libraries) {
+    const size_t index = m_matchers.size();
+    m_libraries.push_back(lib);
+    m_openLibraries.emplace_back();
+    m_ownedMatchers.emplace_back();
+    m_loadTried.push_back(0);
+    m_matchers.push_back(nullptr);
+    m_matcherNames.push_back(std::filesystem::path(lib.path).stem().string());
+    m_matcherDescriptions.push_back("not loaded yet: " + lib.path);
+    if (lazy || load(index))
       continue;
-    }
+    m_libraries.pop_back();
+    m_openLibraries.pop_back();
+    m_ownedMatchers.pop_back();
+    m_loadTried.pop_back();
+    m_matchers.pop_back();
+    m_matcherNames.pop_back();
+    m_matcherDescriptions.pop_back();
+  }
 
-    feature_matcher* matcher = create_matcher();
-    if (!matcher) {
-      fprintf(stderr, "Could not create instance of matcher\n");
-      continue;
-    }
-    m_matchers.push_back(matcher);
-    m_matcherLibraryHandles.push_back(handle);
-    m_matcherNames.emplace_back(get_name());
-    m_matcherDescriptions.emplace_back(get_desc());
+  m_libraries.emplace_back();
+  m_openLibraries.emplace_back();
+  m_ownedMatchers.push_back(std::make_unique<SimilarityMatcher>());
+  m_loadTried.push_back(1);
+  m_matchers.push_back(m_ownedMatchers.back().get());
+  m_matcherNames.emplace_back("similarity");
+  m_matcherDescriptions.emplace_back(
+      "Intensity metrics (NCC, gradient correlation, mutual information)");
 
-    fprintf(stdout, "Loaded Matcher %s: %s\n", m_matcherNames.back().c_str(), m_matcherDescriptions.back().c_str());
-  }
+  m_heldReferences.assign(m_matchers.size(), std::string());
+  m_heldDeviceReferences.assign(m_matchers.size(), nullptr);
+  m_parallelFor.resize(m_matchers.size());
 
   if (!m_matchers.empty())
     setActiveMatcherIndex(0);
 }
 
-void MatchersWrapper::destroy()
+bool MatchersWrapper::load(size_t index)
 {
-  for (size_t i = 0; i < m_matcherLibraryHandles.size(); ++i) {
-    auto handle = m_matcherLibraryHandles[i];
-    void (*destroy_matcher)(feature_matcher*) =
-        (void (*)(feature_matcher*))dlsym(handle, "destroy_matcher");
+  m_loadTried[index] = 1;
+  const auto &lib = m_libraries[index];
+  if (lib.isolated) {
+    auto matcher = std::make_unique<process_matcher>();
+    if (!matcher->start(m_hostExecutable, lib.path))
+      return false;
+    m_matcherNames[index] = matcher->name();
+    m_matcherDescriptions[index] = matcher->description();
+    m_matchers[index] = matcher.get();
+    m_ownedMatchers[index] = std::move(matcher);
+    applyThreadBudget(index, m_threadBudget.threads);
+    return true;
+  }
 
-    if (destroy_matcher) {
-      destroy_matcher(m_matchers[i]);
-    }
-    dlclose(handle);
+  auto &library = m_openLibraries[index];
+  if (!open_matcher_library(lib.path, library))
+    return false;
+  m_matcherNames[index] = library.name;
+  m_matcherDescriptions[index] = library.description;
+  m_matchers[index] = library.matcher;
+  applyThreadBudget(index, m_threadBudget.threads);
+  return true;
+}
+
+void MatchersWrapper::applyThreadBudget(size_t index, unsigned threads)
+{
+  auto *matcher = m_matchers[index];
+  if (!matcher || m_threadBudget.threads == 0)
+    return;
+  const std::vector<int32_t> cpus(
+      m_threadBudget.cpus.begin(), m_threadBudget.cpus.end());
+  matcher_threading threading{};
+  threading.max_threads = threads;
+  threading.num_cpus = uint32_t(cpus.size());
+  threading.cpus = cpus.empty() ? nullptr : cpus.data();
+  // kept across calls, the matcher may still hold the previous one
+  auto &parallelFor = m_parallelFor[index];
+  if (m_threadBudget.scheduler) {
+    if (parallelFor)
+      parallelFor->setThreads(threads);
+    else
+      parallelFor = std::make_unique<matcher_parallel_for>(
+          *m_threadBudget.scheduler, threads);
+    threading.host = parallelFor.get();
+    threading.parallel_for = &matcher_parallel_for::run;
   }
+  set_matcher_threading(matcher, threading);
+}
+
+void MatchersWrapper::destroy()
+{
+  // host processes are stopped (and built-ins destroyed) with their owners
+  m_ownedMatchers.clear();
+  for (auto &library : m_openLibraries)
+    close_matcher_library(library);
+  m_parallelFor.clear();
+  m_libraries.clear();
+  m_openLibraries.clear();
+  m_loadTried.clear();
   m_matchers.clear();
-  m_matcherLibraryHandles.clear();
+  m_activeMatcherIndex = 0;
+  m_heldReferences.clear();
+  m_heldDeviceReferences.clear();
+  m_referenceStates.clear();
   m_matcherNames.clear();
   m_matcherDescriptions.clear();
 }
@@ -69,10 +463,362 @@ void MatchersWrapper::setActiveMatcherIndex(size_t index)
   if (index >= m_matchers.size())
     return;
   m_activeMatcherIndex = index;
-  m_activeMatcher = m_matchers[index];
 }
 
 feature_matcher* MatchersWrapper::getActiveMatcher()
 {
-  return m_activeMatcher;
+  return matcher(m_activeMatcherIndex);
+}
+
+size_t MatchersWrapper::size() const
+{
+  return m_matchers.size();
+}
+
+bool MatchersWrapper::loaded(size_t index) const
+{
+  std::lock_guard<std::mutex> lock(m_loadMutex);
+  return index < m_matchers.size() && m_matchers[index];
+}
+
+feature_matcher *MatchersWrapper::matcher(size_t index)
+{
+  std::lock_guard<std::mutex> lock(m_loadMutex);
+  if (index >= m_matchers.size())
+    return nullptr;
+  if (!m_matchers[index] && !m_loadTried[index]) {
+    TRACE_SCOPE("matcher", "load");
+    load(index);
+  }
+  return m_matchers[index];
+}
+
+void MatchersWrapper::addMatcher(std::unique_ptr<feature_matcher> matcher,
+                                 const std::string &name,
+                                 const std::string &description)
+{
+  std::lock_guard<std::mutex> lock(m_loadMutex);
+  m_libraries.emplace_back();
+  m_openLibraries.emplace_back();
+  m_loadTried.push_back(1);
+  m_matchers.push_back(matcher.get());
+  m_ownedMatchers.push_back(std::move(matcher));
+  m_matcherNames.push_back(name);
+  m_matcherDescriptions.push_back(description);
+  m_heldReferences.emplace_back();
+  m_heldDeviceReferences.emplace_back();
+  m_parallelFor.emplace_back();
+  applyThreadBudget(m_matchers.size() - 1, m_threadBudget.threads);
+}
+
+void MatchersWrapper::setHostExecutable(const std::string &path)
+{
+  m_hostExecutable = path;
+}
+
+// Keys of RGBA8 references stay as they were before other pixel types
+static std::string pixelTag(const matcher_image_view &view)
+{
+  return view.pixel_type == MATCHER_PIXEL_RGBA8
+      ? std::string()
+      : "p" + std::to_string(view.pixel_type);
+}
+
+// Of the image's path in reference keys: short, and valid in file names
+static std::string pathTag(const std::string &path)
+{
+  if (path.empty())
+    return std::string();
+  uint64_t hash = 14695981039346656037ull; // FNV-1a
+  for (unsigned char c : path) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  char tag[18];
+  snprintf(tag, sizeof(tag), "_%016llx", (unsigned long long)hash);
+  return tag;
+}
+
+std::string MatchersWrapper::identity(size_t index) const
+{
+  if (index >= m_matcherNames.size())
+    return "similarity"; // scores only, see evaluatePredictions()
+  return m_matcherNames[index] + "|" + m_matcherDescriptions[index] + "|"
+      + m_referenceVariant;
+}
+
+bool MatchersWrapper::setReference(size_t matcherIndex,
+                                   size_t imageIndex,
+                                   const std::string &imagePath,
+                                   const matcher_image_view &view)
+{
+  auto *matcher = this->matcher(matcherIndex);
+  if (!matcher)
+    return false;
+  auto &held = m_heldReferences[matcherIndex];
+
+  if (imageIndex == SIZE_MAX) {
+    held.clear();
+    return setReferenceView(matcherIndex, std::string(), view);
+  }
+
+  // also the file name in the on-disk store
+  std::string key = m_matcherNames[matcherIndex] + "_"
+      + std::to_string(imageIndex) + "_" + std::to_string(view.width) + "x"
+      + std::to_string(view.height) + ((view.flags & MATCHER_IMAGE_SWIZZLE) ? "s" : "")
+      + pixelTag(view) + pathTag(imagePath)
+      + (m_referenceVariant.empty() ? "" : "_" + m_referenceVariant);
+  for (auto &c : key) {
+    if (!isalnum((unsigned char)c) && c != '_' && c != '-')
+      c = '_';
+  }
+  if (held == key)
+    return true;
+  held.clear();
+
+  auto *abi = dynamic_cast<abi_matcher *>(matcher);
+  const bool hasState =
+      abi && (abi->capabilities() & MATCHER_CAP_REFERENCE_STATE);
+
+  if (hasState) {
+    // copied out, matchAll() sets references from several threads
+    std::vector<uint8_t> state;
+    {
+      std::lock_guard<std::mutex> lock(m_referenceMutex);
+      if (auto *cached = m_referenceStates.get(key))
+        state = *cached;
+    }
+    if (state.empty() && !m_referenceCacheDir.empty()) {
+      std::ifstream in(
+          std::filesystem::path(m_referenceCacheDir) / (key + ".ref"),
+          std::ios::binary);
+      if (in) {
+        state.assign(std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>());
+        if (!state.empty()) {
+          std::lock_guard<std::mutex> lock(m_referenceMutex);
+          m_referenceStates.put(key, state, state.size());
+        }
+      }
+    }
+    if (!state.empty() && abi->load_reference(state)) {
+      held = key;
+      return true;
+    }
+  }
+
+  // the path tells apart images of another list at the same index
+  const std::string imageKey = std::to_string(imageIndex) + "_"
+      + std::to_string(view.width) + "x" + std::to_string(view.height)
+      + pixelTag(view) + pathTag(imagePath);
+  if (!setReferenceView(matcherIndex, imageKey, view))
+    return false;
+  held = key;
+
+  std::vector<uint8_t> state;
+  if (hasState && abi->save_reference(state)) {
+    if (!m_referenceCacheDir.empty()) {
+      std::error_code ec;
+      std::filesystem::create_directories(m_referenceCacheDir, ec);
+      std::ofstream out(
+          std::filesystem::path(m_referenceCacheDir) / (key + ".ref"),
+          std::ios::binary);
+      out.write((const char *)state.data(), state.size());
+      if (!out)
+        fprintf(stderr, "Could not write reference state %s\n", key.c_str());
+    }
+    const size_t bytes = state.size();
+    std::lock_guard<std::mutex> lock(m_referenceMutex);
+    m_referenceStates.put(key, std::move(state), bytes);
+  }
+  return true;
+}
+
+std::vector<MatchOutcome> MatchersWrapper::matchAll(const MatchInput &input)
+{
+  if (!m_pool)
+    m_pool = std::make_unique<ThreadPool>();
+
+  using clock = std::chrono::steady_clock;
+  auto ms = [](clock::time_point a, clock::time_point b) {
+    return std::chrono::duration<float, std::milli>(b - a).count();
+  };
+
+  // every matcher reads the same snapshot; none of them writes to it.
+  // Matchers not loaded yet are loaded here, one after the other, those that
+  // fail are left out.
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < m_matchers.size(); ++i) {
+    if (this->matcher(i))
+      indices.push_back(i);
+  }
+  // running at once, they share the budget
+  const unsigned share = std::max(1u,
+      m_threadBudget.threads / unsigned(std::max<size_t>(indices.size(), 1)));
+  if (indices.size() > 1) {
+    for (size_t i : indices)
+      applyThreadBudget(i, share);
+  }
+
+  std::vector<std::future<MatchOutcome>> futures;
+  for (size_t i : indices) {
+    auto *matcher = m_matchers[i];
+    futures.push_back(m_pool->enqueue([this, i, matcher, &input, ms]() {
+      MatchOutcome outcome;
+      outcome.matcherIndex = i;
+      outcome.eye = input.eye;
+      outcome.center = input.center;
+      outcome.up = input.up;
+
+      TRACE_SCOPE("matcher", "match all job");
+      const auto t0 = clock::now();
+      {
+        TRACE_SCOPE("matcher", "set_image + calibrate");
+        const uint64_t capabilities = matcher_capabilities(matcher);
+        const bool gray = capabilities & MATCHER_CAP_GRAY;
+        const auto &reference =
+            (capabilities & MATCHER_CAP_GRAY16) && input.referenceGray16.data
+            ? input.referenceGray16
+            : gray ? input.referenceGray
+            : (capabilities & MATCHER_CAP_BGRA) && input.referenceBgra.data
+            ? input.referenceBgra
+            : input.reference;
+        if (reference.data)
+          setReference(
+              i, input.referenceIndex, input.referencePath, reference);
+        if (!input.points.lookup || !set_point_query(matcher, input.points))
+          set_image_view(
+              matcher, input.depth, feature_matcher::IMAGE_TYPE::DEPTH3D);
+        if (input.edges.data && (capabilities & MATCHER_CAP_QUERY_EDGES))
+          set_image_view(
+              matcher, input.edges, feature_matcher::IMAGE_TYPE::QUERY_EDGES);
+        set_image_view(matcher,
+            gray ? input.queryGray : input.query,
+            feature_matcher::IMAGE_TYPE::QUERY);
+        matcher->calibrate(
+            input.query.width, input.query.height, input.fovy, input.aspect);
+      }
+      const auto t1 = clock::now();
+      {
+        TRACE_SCOPE("matcher", "match");
+        matcher->match();
+      }
+      const auto t2 = clock::now();
+      {
+        TRACE_SCOPE("matcher", "update_camera");
+        outcome.updated =
+            matcher->update_camera(outcome.eye, outcome.center, outcome.up);
+      }
+      const auto t3 = clock::now();
+
+      outcome.setImageMs = ms(t0, t1);
+      outcome.matchMs = ms(t1, t2);
+      outcome.updateMs = ms(t2, t3);
+      return outcome;
+    }));
+  }
+
+  std::vector<MatchOutcome> outcomes;
+  for (auto &f : futures)
+    outcomes.push_back(f.get());
+  if (indices.size() > 1) {
+    for (size_t i : indices)
+      applyThreadBudget(i, m_threadBudget.threads);
+  }
+  return outcomes;
+}
+
+bool MatchersWrapper::setReferenceView(size_t matcherIndex,
+                                       const std::string &imageKey,
+                                       const matcher_image_view &view)
+{
+  auto *matcher = m_matchers[matcherIndex];
+  auto *abi = dynamic_cast<abi_matcher *>(matcher);
+  // the previous device copy is kept until the matcher let go of it
+  auto &deviceMemory = m_heldDeviceReferences[matcherIndex];
+  if (m_devicePool && abi
+      && (abi->capabilities() & MATCHER_CAP_DEVICE_MEMORY)) {
+    matcher_image_view device;
+    auto memory = m_devicePool->acquire(imageKey, view, device);
+    if (memory
+        && set_image_view(
+            matcher, device, feature_matcher::IMAGE_TYPE::REFERENCE)) {
+      deviceMemory = std::move(memory);
+      return true;
+    }
+  }
+  if (!set_image_view(matcher, view, feature_matcher::IMAGE_TYPE::REFERENCE))
+    return false;
+  deviceMemory.reset();
+  return true;
+}
+
+size_t MatchersWrapper::referenceStateBytes() const
+{
+  std::lock_guard<std::mutex> lock(m_referenceMutex);
+  return m_referenceStates.bytes();
+}
+
+size_t MatchersWrapper::deviceReferenceBytes() const
+{
+  return m_devicePool ? m_devicePool->bytes() : 0;
+}
+
+size_t MatchersWrapper::numDeviceReferences() const
+{
+  return m_devicePool ? m_devicePool->size() : 0;
+}
+
+void MatchersWrapper::invalidateReference(size_t matcherIndex)
+{
+  if (matcherIndex < m_heldReferences.size())
+    m_heldReferences[matcherIndex].clear();
+}
+
+void MatchersWrapper::clearReferences()
+{
+  for (auto &held : m_heldReferences)
+    held.clear();
+  {
+    std::lock_guard<std::mutex> lock(m_referenceMutex);
+    m_referenceStates.clear();
+  }
+  if (m_devicePool)
+    m_devicePool->clear();
+}
+
+void MatchersWrapper::setReferenceCacheDir(const std::string &dir)
+{
+  m_referenceCacheDir = dir;
+}
+
+void MatchersWrapper::setReferenceVariant(const std::string &variant)
+{
+  m_referenceVariant = variant;
+}
+
+void MatchersWrapper::setThreadBudget(const MatcherThreadBudget &budget)
+{
+  std::lock_guard<std::mutex> lock(m_loadMutex);
+  // parallel_fors of another scheduler go once the matchers let go of them
+  std::vector<std::unique_ptr<matcher_parallel_for>> previous;
+  if (budget.scheduler != m_threadBudget.scheduler) {
+    previous = std::move(m_parallelFor);
+    m_parallelFor.resize(m_matchers.size());
+  }
+  m_threadBudget = budget;
+  for (size_t i = 0; i < m_matchers.size(); ++i)
+    applyThreadBudget(i, budget.threads);
+}
+
+void MatchersWrapper::setDeviceReferenceBudget(size_t bytes)
+{
+  if (bytes == 0 || !DeviceImagePool::available()) {
+    m_devicePool.reset(); // matchers keep what they hold
+    return;
+  }
+  if (m_devicePool)
+    m_devicePool->setBudget(bytes);
+  else
+    m_devicePool = std::make_unique<DeviceImagePool>(bytes);
 }
\ No newline at end of file
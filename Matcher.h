@@ -1,36 +1,262 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <dlfcn.h>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "DeviceImagePool.h"
+#include "LruCache.h"
+#include "MatcherABI.h"
+#include "TaskScheduler.h"
+#include "ThreadPool.h"
+
 struct feature_matcher
 {
   enum PIXEL_TYPE
   {
     RGBA = 0,
-    FLOAT3 = 1
+    FLOAT3 = 1,
+    BGRA = 2, // the rest for ABI matchers only (MatcherABI.h 1.4)
+    GRAY8 = 3,
+    GRAY16 = 4,
+    GRAYF32 = 5
   };
 
   enum IMAGE_TYPE {
       REFERENCE = 0,
       QUERY = 1,
-      DEPTH3D = 2
+      DEPTH3D = 2,
+      QUERY_EDGES = 3 // MATCHER_CAP_QUERY_EDGES only
   };
 
+  // pure here: every matcher, plugin or built-in, overrides all of them,
+  // and the vtable slots stay those of the plugins' headers
   virtual void set_image(const void* data,
                          size_t width,
                          size_t height,
                          PIXEL_TYPE pixel_type,
                          IMAGE_TYPE image_type,
-                         bool swizzle);
-  virtual void match();
-  virtual void calibrate(size_t width, size_t height, float fovy, float aspect);
+                         bool swizzle) = 0;
+  virtual void match() = 0;
+  virtual void calibrate(
+      size_t width, size_t height, float fovy, float aspect) = 0;
   virtual bool update_camera(std::array<float, 3>& eye,
                              std::array<float, 3>& center,
-                             std::array<float, 3>& up);
+                             std::array<float, 3>& up) = 0;
+  virtual ~feature_matcher() = default;
+};
+
+// feature_matcher over a plugin exporting the C ABI (MatcherABI.h). The
+// virtual set_image() wraps the packed host image in a view; callers that
+// know they talk to an ABI matcher can hand over strided, device-resident or
+// retained images and whole pyramids directly.
+struct abi_matcher : public feature_matcher
+{
+  explicit abi_matcher(const matcher_abi *abi);
+  ~abi_matcher() override;
+
+  abi_matcher(const abi_matcher &) = delete;
+  abi_matcher &operator=(const abi_matcher &) = delete;
+
+  bool valid() const;
+  uint64_t capabilities() const;
+
+  void set_image(const void* data,
+                 size_t width,
+                 size_t height,
+                 PIXEL_TYPE pixel_type,
+                 IMAGE_TYPE image_type,
+                 bool swizzle) override;
+  void match() override;
+  void calibrate(size_t width, size_t height, float fovy, float aspect) override;
+  bool update_camera(std::array<float, 3>& eye,
+                     std::array<float, 3>& center,
+                     std::array<float, 3>& up) override;
+
+  bool set_image_view(const matcher_image_view &view, IMAGE_TYPE image_type);
+  bool set_reference_pyramid(const matcher_pyramid_view &pyramid);
+  bool match_batch(matcher_batch_item *items, size_t count);
+  bool save_reference(std::vector<uint8_t> &state);
+  bool load_reference(const std::vector<uint8_t> &state);
+  bool set_point_query(const matcher_point_query &query);
+  bool set_scratch(const matcher_scratch *scratch);
+  bool set_threading(const matcher_threading &threading);
+
+ private:
+  const matcher_abi *m_abi{nullptr};
+  void *m_instance{nullptr};
+};
+
+// Capability bits of any matcher; legacy vtable matchers report none
+uint64_t matcher_capabilities(feature_matcher *matcher);
+
+// Passes a view to the matcher without a copy where it supports one;
+// otherwise packs host views into a contiguous copy for set_image(). Fails
+// for device memory the matcher cannot take.
+bool set_image_view(feature_matcher *matcher,
+                    const matcher_image_view &view,
+                    feature_matcher::IMAGE_TYPE image_type);
+
+// Point lookups instead of a DEPTH3D image for matchers that take them;
+// false for the others, which need the dense image
+bool set_point_query(feature_matcher *matcher,
+                     const matcher_point_query &query);
+
+// Hands the matcher the host's scratch arena for its per-match temporaries
+// (ABI 1.6), or takes it back (nullptr); false for matchers without it,
+// which allocate on their own
+bool set_matcher_scratch(feature_matcher *matcher,
+                         const matcher_scratch *scratch);
+
+// Hands the matcher its thread budget (ABI 1.7), in process or in its host
+// process; false for matchers without it, which size their pools to the
+// machine
+bool set_matcher_threading(feature_matcher *matcher,
+                           const matcher_threading &threading);
+
+// The host's matcher_threading::parallel_for: chunks run through the
+// scheduler's runChunks(), on its workers and the calling thread, so it
+// finishes even if every worker is busy.
+class matcher_parallel_for
+{
+ public:
+  matcher_parallel_for(TaskScheduler &scheduler, unsigned threads);
+
+  matcher_parallel_for(const matcher_parallel_for &) = delete;
+  matcher_parallel_for &operator=(const matcher_parallel_for &) = delete;
+
+  // at most this many at once, the calling thread included
+  void setThreads(unsigned threads);
+
+  static int run(void *host,
+      size_t count,
+      size_t grain,
+      void (*body)(void *arg, size_t begin, size_t end),
+      void *arg);
+
+ private:
+  TaskScheduler &m_scheduler;
+  std::atomic<unsigned> m_threads;
+};
+
+// set_matcher_scratch() for a scope, taken back when it ends
+class matcher_scratch_scope
+{
+ public:
+  matcher_scratch_scope(feature_matcher *matcher,
+                        const matcher_scratch &scratch)
+      : m_matcher(matcher), m_scratch(scratch)
+  {
+    if (!m_matcher || !set_matcher_scratch(m_matcher, &m_scratch))
+      m_matcher = nullptr;
+  }
+  ~matcher_scratch_scope()
+  {
+    if (m_matcher)
+      set_matcher_scratch(m_matcher, nullptr);
+  }
+
+  matcher_scratch_scope(const matcher_scratch_scope &) = delete;
+  matcher_scratch_scope &operator=(const matcher_scratch_scope &) = delete;
+
+ private:
+  feature_matcher *m_matcher;
+  matcher_scratch m_scratch; // the plugin may keep the pointer to it
+};
+
+// A plugin library opened in this process and the matcher created from it
+struct matcher_library
+{
+  void *handle{nullptr};
+  feature_matcher *matcher{nullptr};
+  std::unique_ptr<feature_matcher> adapter; // owns matcher for C ABI plugins
+  std::string name;
+  std::string description;
+};
+
+// dlopens path and creates its matcher, through the versioned C ABI if the
+// plugin exports it and the legacy create_matcher() symbols otherwise.
+// Errors go to stderr.
+bool open_matcher_library(const std::string &path, matcher_library &library);
+void close_matcher_library(matcher_library &library);
+
+inline matcher_image_view make_image_view(const void *data,
+    size_t width,
+    size_t height,
+    feature_matcher::PIXEL_TYPE pixel_type,
+    bool swizzle = false)
+{
+  matcher_image_view view{};
+  view.data = data;
+  view.width = width;
+  view.height = height;
+  view.row_stride = width * matcher_pixel_size(pixel_type);
+  view.pixel_type = uint32_t(pixel_type);
+  view.memory_space = MATCHER_MEMORY_HOST;
+  view.flags = swizzle ? uint32_t(MATCHER_IMAGE_SWIZZLE) : 0u;
+  return view;
+}
+
+// Pixel type of the REFERENCE images a matcher is handed: GRAY16 for
+// MATCHER_CAP_GRAY16 if the reference is a GRAY16 image (gray16), GRAY8 for
+// MATCHER_CAP_GRAY (whose QUERY images are GRAY8 too), BGRA8 in place of
+// swizzled RGBA8 for MATCHER_CAP_BGRA, RGBA8 otherwise
+matcher_pixel_type reference_pixel_type(
+    uint64_t capabilities, bool swizzle, bool gray16 = false);
+
+// One snapshot of a rendered frame, handed to every matcher by matchAll()
+struct MatchInput
+{
+  matcher_image_view query{};
+  matcher_image_view depth{};
+  // used instead of depth by matchers looking up points (lookup nullptr:
+  // depth for all); depth may be empty if every matcher does
+  matcher_point_query points{};
+  // for matchers with MATCHER_CAP_QUERY_EDGES; data nullptr: none
+  matcher_image_view edges{};
+  matcher_image_view reference{}; // data nullptr keeps the matchers' reference
+  // the same in the other pixel types matchers take (reference_pixel_type());
+  // data nullptr where no matcher takes them
+  matcher_image_view queryGray{};
+  matcher_image_view referenceGray{};
+  matcher_image_view referenceBgra{};
+  matcher_image_view referenceGray16{}; // of GRAY16 references only
+  size_t referenceIndex{SIZE_MAX}; // see MatchersWrapper::setReference()
+  std::string referencePath;
+  float fovy{0.f};
+  float aspect{1.f};
+  std::array<float, 3> eye{}, center{}, up{};
+};
+
+struct MatchOutcome
+{
+  size_t matcherIndex{0};
+  bool updated{false};
+  std::array<float, 3> eye{}, center{}, up{};
+  float setImageMs{0.f}; // set_image + calibrate
+  float matchMs{0.f};
+  float updateMs{0.f}; // update_camera
+};
+
+// How much of the machine the matchers get (see matcher_threading)
+struct MatcherThreadBudget
+{
+  unsigned threads{0}; // per match, the calling thread included; 0: no budget
+  std::vector<int> cpus; // suggested cores, empty: no hint
+  TaskScheduler *scheduler{nullptr}; // runs their parallel_for; may be null
+};
+
+struct MatcherLibrary
+{
+  std::string path;
+  // hosted by an anariDRRMatcherHost process (MatcherProcess.h) instead of
+  // being opened here
+  bool isolated{false};
 };
 
 struct MatchersWrapper
@@ -39,14 +265,111 @@ struct MatchersWrapper
   ~MatchersWrapper() noexcept;
 
   void init(std::vector<std::string> &matcherLibraryNames);
+  // With lazy, libraries are not opened (or their hosts started) here but
+  // when their matcher is first used: listed under their file name until
+  // then, they stay empty if that fails. Otherwise libraries that fail to
+  // load are left out.
+  void init(const std::vector<MatcherLibrary> &libraries, bool lazy = false);
   void destroy();
   void setActiveMatcherIndex(size_t index);
   feature_matcher* getActiveMatcher();
 
-  std::vector<void*> m_matcherLibraryHandles;
-  std::vector<feature_matcher*> m_matchers;
+  size_t size() const;
+  bool loaded(size_t index) const;
+  // Name, description and reference variant: matchers with the same one
+  // give the same outcomes (e.g. the key of a PoseCache)
+  std::string identity(size_t index) const;
+  // The matcher at index, loaded first if needed; nullptr if it could not be
+  feature_matcher *matcher(size_t index);
+  // Appends a matcher created by the caller, after init()
+  void addMatcher(std::unique_ptr<feature_matcher> matcher,
+                  const std::string &name,
+                  const std::string &description);
+  // Defaults to anariDRRMatcherHost next to the running executable
+  void setHostExecutable(const std::string &path);
+
+  // Sets matcher's reference image. imageIndex and imagePath identify the
+  // image (SIZE_MAX for images that cannot be identified, e.g. framebuffer
+  // copies); together with the matcher and the resolution they key a cache,
+  // so re-selecting the reference a matcher already holds is a no-op, and
+  // matchers exporting their reference state restore it from memory or disk
+  // instead of extracting features again. The path tells apart images of
+  // another image list with the same index.
+  bool setReference(size_t matcherIndex,
+                    size_t imageIndex,
+                    const std::string &imagePath,
+                    const matcher_image_view &view);
+  // Forget which reference matcher holds (after setting one behind our back)
+  void invalidateReference(size_t matcherIndex);
+  // Forget the references of every matcher and the reference states and
+  // device copies kept in memory (the image list was replaced)
+  void clearReferences();
+  // Directory for reference states; empty keeps them in memory only
+  void setReferenceCacheDir(const std::string &dir);
+  // Part of every reference key, e.g. the images' preprocessing (see
+  // ImageStore::setPreprocessing()), so states extracted from differently
+  // processed images are not mixed up
+  void setReferenceVariant(const std::string &variant);
+  // Matchers taking device memory (MATCHER_CAP_DEVICE_MEMORY) get their
+  // references as device copies, uploaded once per image and kept within
+  // this budget (see DeviceImagePool); 0, or a build without CUDA, hands
+  // them the host images
+  void setDeviceReferenceBudget(size_t bytes);
+  // Passed to every matcher taking it (ABI 1.7) once it is loaded; matchAll()
+  // splits the threads between the matchers while they run at once. Not
+  // while matching.
+  void setThreadBudget(const MatcherThreadBudget &budget);
+
+  // Runs the same match on every matcher at once (one pool task each) and
+  // returns their poses and timings in matcher order. Blocks until all are
+  // done; the matchers must not be used elsewhere meanwhile.
+  std::vector<MatchOutcome> matchAll(const MatchInput &input);
+
+  // Cached reference states (plugins' own memory is not visible here)
+  size_t referenceStateBytes() const;
+  // Reference images kept on the device, and how many of them
+  size_t deviceReferenceBytes() const;
+  size_t numDeviceReferences() const;
+
+  // Per matcher, the plugins listed first and the ones compiled into the
+  // viewer after them: its library (empty path for built-ins), the library
+  // if opened in process, the matcher if owned here (process hosts and
+  // built-ins) and whether loading was tried
+  std::vector<MatcherLibrary> m_libraries;
+  std::vector<matcher_library> m_openLibraries;
+  std::vector<std::unique_ptr<feature_matcher>> m_ownedMatchers;
+  std::vector<uint8_t> m_loadTried;
+  std::vector<feature_matcher*> m_matchers; // nullptr until loaded
   std::vector<std::string> m_matcherNames;
   std::vector<std::string> m_matcherDescriptions;
-  size_t m_activeMatcherIndex{0};
-  feature_matcher* m_activeMatcher{nullptr};
+  size_t m_activeMatcherIndex{0}; // loaded by getActiveMatcher()
+
+  // per matcher, key of the reference it holds (empty if unknown)
+  std::vector<std::string> m_heldReferences;
+  LruCache<std::string, std::vector<uint8_t>> m_referenceStates{64ull << 20};
+  std::string m_referenceCacheDir;
+  std::string m_referenceVariant;
+  mutable std::mutex m_referenceMutex;
+  std::unique_ptr<DeviceImagePool> m_devicePool;
+  // per matcher, device memory of the reference it holds
+  std::vector<std::shared_ptr<const void>> m_heldDeviceReferences;
+
+  std::string m_hostExecutable;
+  mutable std::mutex m_loadMutex;
+
+  MatcherThreadBudget m_threadBudget;
+  // per matcher, the parallel_for it was handed (null until it was)
+  std::vector<std::unique_ptr<matcher_parallel_for>> m_parallelFor;
+
+  std::unique_ptr<ThreadPool> m_pool;
+
+ private:
+  bool load(size_t index);
+  // The budget, with threads in place of its own, to matcher index
+  void applyThreadBudget(size_t index, unsigned threads);
+  // Sets the reference, from the device pool for matchers taking device
+  // memory; imageKey names the image there (empty: not kept)
+  bool setReferenceView(size_t matcherIndex,
+                        const std::string &imageKey,
+                        const matcher_image_view &view);
 };
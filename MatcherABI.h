@@ -0,0 +1,254 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// Versioned C ABI for matcher plugins. Unlike the feature_matcher vtable
+// (Matcher.h), which ties plugins to the viewer's compiler and passes every
+// image as a packed host copy, images cross this boundary as views: pointer,
+// row stride and memory space. A plugin exports
+//
+//   const matcher_abi *get_matcher_abi(uint32_t host_version);
+//
+// and returns a table for the matching major version, or NULL. Plugins
+// without it are still loaded through the legacy create_matcher() symbols.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// major in the upper 16 bits; minor bumps only append to matcher_abi
+#define MATCHER_ABI_VERSION_MAJOR 1
+#define MATCHER_ABI_VERSION_MINOR 7
+#define MATCHER_ABI_VERSION \
+  ((MATCHER_ABI_VERSION_MAJOR << 16) | MATCHER_ABI_VERSION_MINOR)
+
+typedef enum matcher_capability
+{
+  // views may point to device memory (memory_space != HOST)
+  MATCHER_CAP_DEVICE_MEMORY = 1u << 0,
+  // a reference pyramid may be set once; the matcher picks the level
+  // whose size matches the query
+  MATCHER_CAP_PYRAMID = 1u << 1,
+  // several instances may match concurrently from different threads
+  MATCHER_CAP_THREAD_SAFE = 1u << 2,
+  // match_batch() is implemented
+  MATCHER_CAP_BATCH = 1u << 3,
+  // save_reference()/load_reference() are implemented (ABI 1.1)
+  MATCHER_CAP_REFERENCE_STATE = 1u << 4,
+  // set_point_query() is implemented: the 3D points of the keypoints are
+  // looked up instead of read from a DEPTH3D image (ABI 1.2)
+  MATCHER_CAP_POINT_QUERY = 1u << 5,
+  // set_image(QUERY_EDGES) takes an edge image of the query, filtered on
+  // the GPU (1.3); it is set before the QUERY image when the host has one
+  MATCHER_CAP_QUERY_EDGES = 1u << 6,
+  // REFERENCE and QUERY images come as MATCHER_PIXEL_GRAY8, converted by
+  // the host once per reference and per frame (1.4)
+  MATCHER_CAP_GRAY = 1u << 7,
+  // references come as MATCHER_PIXEL_BGRA8 instead of RGBA8 with
+  // MATCHER_IMAGE_SWIZZLE, reordered by the host once per reference (1.4)
+  MATCHER_CAP_BGRA = 1u << 8,
+  // 16-bit gray references (X-ray images) come as MATCHER_PIXEL_GRAY16 as
+  // decoded, instead of converted to 8 bits; other references and QUERY
+  // images are not affected (1.5)
+  MATCHER_CAP_GRAY16 = 1u << 9,
+} matcher_capability;
+
+typedef enum matcher_pixel_type
+{
+  MATCHER_PIXEL_RGBA8 = 0,
+  MATCHER_PIXEL_FLOAT3 = 1,
+  // 1.4; gray is the luminance of the RGBA image (BT.601 weights)
+  MATCHER_PIXEL_BGRA8 = 2,
+  MATCHER_PIXEL_GRAY8 = 3,
+  MATCHER_PIXEL_GRAY16 = 4,
+  MATCHER_PIXEL_GRAYF32 = 5,
+} matcher_pixel_type;
+
+// Bytes per pixel, 0 for types this header does not know
+static inline size_t matcher_pixel_size(uint32_t pixel_type)
+{
+  switch (pixel_type) {
+  case MATCHER_PIXEL_RGBA8:
+  case MATCHER_PIXEL_BGRA8:
+  case MATCHER_PIXEL_GRAYF32:
+    return 4;
+  case MATCHER_PIXEL_FLOAT3:
+    return 3 * sizeof(float);
+  case MATCHER_PIXEL_GRAY8:
+    return 1;
+  case MATCHER_PIXEL_GRAY16:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+typedef enum matcher_image_type
+{
+  MATCHER_IMAGE_REFERENCE = 0,
+  MATCHER_IMAGE_QUERY = 1,
+  MATCHER_IMAGE_DEPTH3D = 2,
+  // gray RGBA8 on the query's grid: Sobel gradient magnitude, or a band of
+  // a Laplacian pyramid with mid gray as zero (1.3)
+  MATCHER_IMAGE_QUERY_EDGES = 3,
+} matcher_image_type;
+
+typedef enum matcher_memory_space
+{
+  MATCHER_MEMORY_HOST = 0,
+  MATCHER_MEMORY_CUDA = 1,
+} matcher_memory_space;
+
+typedef enum matcher_image_flags
+{
+  // RGBA to BGRA (the legacy swizzle argument)
+  MATCHER_IMAGE_SWIZZLE = 1u << 0,
+  // data stays valid (and unchanged) until the matcher is destroyed or the
+  // image is replaced, so the matcher may keep the pointer instead of a copy
+  MATCHER_IMAGE_RETAINED = 1u << 1,
+} matcher_image_flags;
+
+typedef struct matcher_image_view
+{
+  const void *data;
+  size_t width;
+  size_t height;
+  size_t row_stride; // bytes between rows, >= width * pixel size
+  uint32_t pixel_type; // matcher_pixel_type
+  uint32_t memory_space; // matcher_memory_space
+  int32_t device; // device ordinal for non-host memory
+  uint32_t flags; // matcher_image_flags
+} matcher_image_view;
+
+typedef struct matcher_pyramid_view
+{
+  const matcher_image_view *levels; // level 0 = full resolution
+  size_t num_levels;
+} matcher_pyramid_view;
+
+// Per-query input and output of match_batch()
+typedef struct matcher_batch_item
+{
+  matcher_image_view query;
+  matcher_image_view depth; // data may be NULL
+  float eye[3], center[3], up[3]; // in: render pose, out: estimate
+  int32_t valid; // out: nonzero if a pose was estimated
+} matcher_batch_item;
+
+// 3D points on demand (1.2), for matchers that need them at their
+// keypoints only. lookup() takes count pixel positions of the query image
+// (x, y pairs; row 0 is the first one in memory, as in the image) and
+// writes three floats per position, NaN where the pixel has no point. It
+// may be called from the thread matching and stays valid until the next
+// query image is set, or until set_image(DEPTH3D) replaces it.
+typedef struct matcher_point_query
+{
+  void *host;
+  int (*lookup)(void *host, const float *pixels, size_t count, float *points);
+} matcher_point_query;
+
+// Scratch memory of the host's registration loop (1.6). alloc() returns
+// size bytes aligned to alignment (a power of two), or NULL. They are never
+// freed one by one: the host takes all of them back when it starts the
+// next iteration, before it sets that iteration's first query-side image
+// (DEPTH3D, QUERY_EDGES or QUERY). So temporaries of one match belong
+// there (keypoints, descriptors, the query's pyramid), state of the
+// reference does not. Taken from here, they cost no heap allocations once
+// the loop has run a few iterations. alloc() is called from the thread
+// matching, within set_image(), calibrate(), match() and update_camera().
+typedef struct matcher_scratch
+{
+  void *host;
+  void *(*alloc)(void *host, size_t size, size_t alignment);
+} matcher_scratch;
+
+// How much of the machine a matcher may use (1.7). The host renders,
+// decodes and converts on threads of its own, so plugin pools sized by the
+// core count (OpenMP, TBB, OpenCV) oversubscribe it. max_threads is how
+// many threads one match may keep busy, the calling thread included: a
+// plugin sizes its pools to it (omp_set_num_threads(), cv::setNumThreads(),
+// a tbb::task_arena). cpus (num_cpus of them, 0: no hint) are the cores
+// the host suggests for those threads, leaving the others to its own work;
+// the array is valid during set_threading() only. parallel_for, if not
+// NULL, runs body(arg, begin, end) over [0, count) in chunks of grain items
+// on the host's workers and the calling thread, at most max_threads at
+// once, and returns 0 once all are done. A plugin parallelizing with it
+// instead of a pool of its own shares the host's threads and priorities.
+// It stays valid, with host, until the next set_threading() or destroy(),
+// and is called from the thread matching, within set_image(), calibrate(),
+// match(), match_batch() and update_camera().
+typedef struct matcher_threading
+{
+  uint32_t max_threads;
+  uint32_t num_cpus;
+  const int32_t *cpus;
+  void *host;
+  int (*parallel_for)(void *host,
+      size_t count,
+      size_t grain,
+      void (*body)(void *arg, size_t begin, size_t end),
+      void *arg);
+} matcher_threading;
+
+// Functions return 0 on success. Entries a plugin lacks are NULL.
+typedef struct matcher_abi
+{
+  uint32_t version; // MATCHER_ABI_VERSION the plugin was built against
+  uint32_t struct_size; // sizeof(matcher_abi) in the plugin
+  uint64_t capabilities; // matcher_capability bits
+  const char *name;
+  const char *description;
+
+  void *(*create)(void);
+  void (*destroy)(void *matcher);
+
+  int (*set_image)(
+      void *matcher, const matcher_image_view *image, uint32_t image_type);
+  int (*set_reference_pyramid)(
+      void *matcher, const matcher_pyramid_view *pyramid);
+  int (*calibrate)(
+      void *matcher, size_t width, size_t height, float fovy, float aspect);
+  int (*match)(void *matcher);
+  // nonzero if the pose was updated
+  int (*update_camera)(void *matcher, float eye[3], float center[3], float up[3]);
+  int (*match_batch)(void *matcher, matcher_batch_item *items, size_t count);
+
+  // 1.1: the state extracted from the reference image (keypoints,
+  // descriptors, ...) as an opaque blob. save_reference() returns the blob's
+  // size and copies it if it fits into size bytes at data; load_reference()
+  // restores it in place of a set_image(REFERENCE).
+  size_t (*save_reference)(void *matcher, void *data, size_t size);
+  int (*load_reference)(void *matcher, const void *data, size_t size);
+
+  // 1.2: the host answers point lookups for the next match in place of a
+  // DEPTH3D image (see matcher_point_query)
+  int (*set_point_query)(void *matcher, const matcher_point_query *query);
+
+  // 1.6: per-match temporaries from the host's arena (matcher_scratch)
+  // until it is set to NULL again, which the host does before the arena
+  // goes away or another thread matches; the plugin allocates on its own
+  // then
+  int (*set_scratch)(void *matcher, const matcher_scratch *scratch);
+
+  // 1.7: the thread budget (matcher_threading), set after create() and
+  // again when the host changes it, e.g. while several matchers run at once
+  int (*set_threading)(void *matcher, const matcher_threading *threading);
+} matcher_abi;
+
+// struct_size of plugins built against 1.0 and 1.1
+#define MATCHER_ABI_SIZE_1_0 offsetof(matcher_abi, save_reference)
+#define MATCHER_ABI_SIZE_1_1 offsetof(matcher_abi, set_point_query)
+// and of those built against 1.2 to 1.5
+#define MATCHER_ABI_SIZE_1_2 offsetof(matcher_abi, set_scratch)
+// and 1.6
+#define MATCHER_ABI_SIZE_1_6 offsetof(matcher_abi, set_threading)
+
+typedef const matcher_abi *(*get_matcher_abi_fn)(uint32_t host_version);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
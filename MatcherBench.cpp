@@ -0,0 +1,231 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+// Replays recorded matches (viewer --record-matches) through matcher
+// plugins without a window or ANARI device and reports per-call latency
+// percentiles, throughput and memory.
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+// ours
+#include "MatchRecording.h"
+#include "Matcher.h"
+#include "ResourceUsage.h"
+#include "ScratchArena.h"
+
+static std::vector<std::string> g_matcherLibraryNames;
+static std::string g_recordDir;
+static std::string g_onlyMatcher;
+static int g_iterations = 10;
+static int g_warmup = 1;
+
+static void printUsage()
+{
+  std::cout << "./anariDRRMatcherBench [{--help|-h}]\n"
+            << "   [{--matcher|-m} <library>]\n"
+            << "   [--only <matcher name>]\n"
+            << "   [--iterations <count>]\n"
+            << "   [--warmup <count>]\n"
+            << "   <record directory>\n";
+}
+
+static void parseCommandLine(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      std::exit(0);
+    } else if (arg == "-m" || arg == "--matcher")
+      g_matcherLibraryNames.emplace_back(argv[++i]);
+    else if (arg == "--only")
+      g_onlyMatcher = argv[++i];
+    else if (arg == "--iterations")
+      g_iterations = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--warmup")
+      g_warmup = std::max(0, std::atoi(argv[++i]));
+    else
+      g_recordDir = arg;
+  }
+}
+
+namespace {
+
+enum Stage
+{
+  SetImage,
+  Calibrate,
+  Match,
+  UpdateCamera,
+  Total,
+  NumStages
+};
+
+const char *stageNames[NumStages] = {
+    "set_image", "calibrate", "match", "update_camera", "total"};
+
+float percentile(std::vector<float> &samples, float p)
+{
+  if (samples.empty())
+    return 0.f;
+  const size_t i =
+      std::min(samples.size() - 1, size_t(p * (samples.size() - 1) + 0.5f));
+  std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+  return samples[i];
+}
+
+// set_image (reference, depth3d, query), calibrate, match and update_camera
+// on one record; times in ms
+void runRecord(feature_matcher *matcher,
+    const MatchRecord &record,
+    float times[NumStages],
+    bool &updated)
+{
+  using clock = std::chrono::steady_clock;
+  auto ms = [](clock::time_point a, clock::time_point b) {
+    return std::chrono::duration<float, std::milli>(b - a).count();
+  };
+
+  const auto t0 = clock::now();
+  matcher->set_image(record.reference.data(),
+      record.referenceWidth,
+      record.referenceHeight,
+      feature_matcher::PIXEL_TYPE::RGBA,
+      feature_matcher::IMAGE_TYPE::REFERENCE,
+      record.referenceSwizzle);
+  if (!record.depth.empty()) {
+    matcher->set_image(record.depth.data(),
+        record.width,
+        record.height,
+        feature_matcher::PIXEL_TYPE::FLOAT3,
+        feature_matcher::IMAGE_TYPE::DEPTH3D,
+        false);
+  }
+  matcher->set_image(record.query.data(),
+      record.width,
+      record.height,
+      feature_matcher::PIXEL_TYPE::RGBA,
+      feature_matcher::IMAGE_TYPE::QUERY,
+      false);
+  const auto t1 = clock::now();
+  matcher->calibrate(record.width, record.height, record.fovy, record.aspect);
+  const auto t2 = clock::now();
+  matcher->match();
+  const auto t3 = clock::now();
+  auto eye = record.eye;
+  auto center = record.center;
+  auto up = record.up;
+  updated = matcher->update_camera(eye, center, up);
+  const auto t4 = clock::now();
+
+  times[SetImage] = ms(t0, t1);
+  times[Calibrate] = ms(t1, t2);
+  times[Match] = ms(t2, t3);
+  times[UpdateCamera] = ms(t3, t4);
+  times[Total] = ms(t0, t4);
+}
+
+void benchmark(const std::string &name,
+    feature_matcher *matcher,
+    const std::vector<MatchRecord> &records)
+{
+  std::vector<float> samples[NumStages];
+  size_t numUpdated = 0;
+  float times[NumStages];
+  bool updated = false;
+
+  // as in a registration loop: the arena is reset before each query
+  ScratchArena scratch;
+  const matcher_scratch scratchView = scratch.scratch();
+  const bool haveScratch = set_matcher_scratch(matcher, &scratchView);
+
+  const size_t rssBefore = currentResidentSetSize();
+  for (int it = 0; it < g_warmup; ++it) {
+    for (auto &record : records) {
+      scratch.reset();
+      runRecord(matcher, record, times, updated);
+    }
+  }
+  const uint64_t warmBlocks = scratch.heapAllocations();
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int it = 0; it < g_iterations; ++it) {
+    for (auto &record : records) {
+      scratch.reset();
+      runRecord(matcher, record, times, updated);
+      for (int s = 0; s < NumStages; ++s)
+        samples[s].push_back(times[s]);
+      numUpdated += updated;
+    }
+  }
+  const float seconds = std::chrono::duration<float>(
+      std::chrono::steady_clock::now() - start)
+                            .count();
+  const size_t rssAfter = currentResidentSetSize();
+
+  const size_t numMatches = samples[Total].size();
+  printf("%s: %zu matches, %.2f matches/s, %zu with pose\n",
+      name.c_str(),
+      numMatches,
+      seconds > 0.f ? numMatches / seconds : 0.f,
+      numUpdated);
+  printf("  %-14s %9s %9s %9s %9s\n", "ms", "p50", "p90", "p99", "max");
+  for (int s = 0; s < NumStages; ++s) {
+    printf("  %-14s %9.3f %9.3f %9.3f %9.3f\n",
+        stageNames[s],
+        percentile(samples[s], 0.5f),
+        percentile(samples[s], 0.9f),
+        percentile(samples[s], 0.99f),
+        percentile(samples[s], 1.f));
+  }
+  printf("  memory: %.1f MiB resident (%+.1f MiB), %.1f MiB peak\n",
+      toMiB(rssAfter),
+      (double(rssAfter) - double(rssBefore)) / (1024.0 * 1024.0),
+      toMiB(peakResidentSetSize()));
+  if (haveScratch) {
+    // blocks added after the warmup are heap allocations of steady state
+    printf("  scratch: %.1f MiB high water, %llu blocks after warmup\n",
+        toMiB(scratch.highWater()),
+        (unsigned long long)(scratch.heapAllocations() - warmBlocks));
+    set_matcher_scratch(matcher, nullptr);
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  parseCommandLine(argc, argv);
+  if (g_recordDir.empty()) {
+    printf("ERROR: no record directory provided\n");
+    printUsage();
+    std::exit(1);
+  }
+
+  std::vector<MatchRecord> records;
+  if (!readMatchRecords(g_recordDir, records))
+    return 1;
+  if (records.empty()) {
+    printf("ERROR: no match records in %s\n", g_recordDir.c_str());
+    return 1;
+  }
+  printf("%zu records, %d iterations (+%d warmup)\n",
+      records.size(),
+      g_iterations,
+      g_warmup);
+
+  MatchersWrapper matchers;
+  matchers.init(g_matcherLibraryNames);
+  for (size_t i = 0; i < matchers.size(); ++i) {
+    if (!g_onlyMatcher.empty() && matchers.m_matcherNames[i] != g_onlyMatcher)
+      continue;
+    benchmark(matchers.m_matcherNames[i], matchers.matcher(i), records);
+  }
+  return 0;
+}
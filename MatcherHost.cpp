@@ -0,0 +1,156 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+// Serves one matcher plugin to a viewer over the descriptors it passes (see
+// MatcherProcess.h). Started by the viewer, not by hand.
+
+// posix
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+// std
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+// ours
+#include "MatcherProcess.h"
+#include "ScratchArena.h"
+#include "SocketIO.h"
+
+int main(int argc, char *argv[])
+{
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <library> <socket fd> <memory fd>\n", argv[0]);
+    return 1;
+  }
+  const int socket = std::atoi(argv[2]);
+  const int memoryFd = std::atoi(argv[3]);
+
+  matcher_library library;
+  MatcherHostRequest request;
+  if (!recvAll(socket, &request, sizeof(request))
+      || request.op != MatcherHostOp::Hello)
+    return 1;
+  MatcherHostReply hello;
+  if (open_matcher_library(argv[1], library)) {
+    std::strncpy(hello.name, library.name.c_str(), sizeof(hello.name) - 1);
+    std::strncpy(hello.description,
+        library.description.c_str(),
+        sizeof(hello.description) - 1);
+  } else {
+    hello.status = 1;
+  }
+  if (!sendAll(socket, &hello, sizeof(hello)) || hello.status != 0)
+    return 1;
+
+  feature_matcher *matcher = library.matcher;
+  // requests come one at a time, so the plugin keeps the arena throughout;
+  // an iteration starts with the first query-side image after a match
+  ScratchArena scratch;
+  const matcher_scratch scratchView = scratch.scratch();
+  set_matcher_scratch(matcher, &scratchView);
+  bool matched = false;
+  void *memory = nullptr;
+  size_t memorySize = 0;
+  while (recvAll(socket, &request, sizeof(request))
+      && request.op != MatcherHostOp::Quit) {
+    if (request.memorySize != memorySize) {
+      if (memory)
+        munmap(memory, memorySize);
+      memory = nullptr;
+      memorySize = 0;
+      void *mapped = request.memorySize == 0 ? nullptr
+                                             : mmap(nullptr,
+                                                 request.memorySize,
+                                                 PROT_READ,
+                                                 MAP_SHARED,
+                                                 memoryFd,
+                                                 0);
+      if (mapped == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+      }
+      memory = mapped;
+      memorySize = mapped ? request.memorySize : 0;
+    }
+
+    MatcherHostReply reply;
+    switch (request.op) {
+    case MatcherHostOp::SetImage: {
+      // the viewer reuses the memory for the next image, so the matcher
+      // copies what it keeps
+      const size_t pixelSize = matcher_pixel_size(request.pixelType);
+      if (pixelSize == 0
+          || request.width * request.height * pixelSize > memorySize) {
+        reply.status = 1;
+        break;
+      }
+      if (matched
+          && request.imageType != feature_matcher::IMAGE_TYPE::REFERENCE) {
+        scratch.reset();
+        matched = false;
+      }
+      auto view = make_image_view(memory,
+          request.width,
+          request.height,
+          feature_matcher::PIXEL_TYPE(request.pixelType),
+          request.flags & MATCHER_IMAGE_SWIZZLE);
+      reply.status = set_image_view(matcher,
+                         view,
+                         feature_matcher::IMAGE_TYPE(request.imageType))
+          ? 0
+          : 1;
+      break;
+    }
+    case MatcherHostOp::Calibrate:
+      matcher->calibrate(
+          request.width, request.height, request.fovy, request.aspect);
+      break;
+    case MatcherHostOp::Match:
+      matcher->match();
+      matched = true;
+      break;
+    case MatcherHostOp::SetThreading: {
+      // threads the plugin starts from here on inherit the affinity
+      std::vector<int32_t> cpus;
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (int32_t cpu = 0; cpu < 256; ++cpu) {
+        if (request.cpus[cpu / 64] & (uint64_t(1) << (cpu % 64))) {
+          cpus.push_back(cpu);
+          CPU_SET(cpu, &set);
+        }
+      }
+      if (!cpus.empty() && sched_setaffinity(0, sizeof(set), &set) != 0)
+        perror("sched_setaffinity");
+      matcher_threading threading{};
+      threading.max_threads = request.maxThreads;
+      threading.num_cpus = uint32_t(cpus.size());
+      threading.cpus = cpus.empty() ? nullptr : cpus.data();
+      reply.status = set_matcher_threading(matcher, threading) ? 0 : 1;
+      break;
+    }
+    case MatcherHostOp::UpdateCamera: {
+      std::array<float, 3> eye, center, up;
+      std::memcpy(eye.data(), request.eye, sizeof(request.eye));
+      std::memcpy(center.data(), request.center, sizeof(request.center));
+      std::memcpy(up.data(), request.up, sizeof(request.up));
+      reply.updated = matcher->update_camera(eye, center, up) ? 1 : 0;
+      std::memcpy(reply.eye, eye.data(), sizeof(reply.eye));
+      std::memcpy(reply.center, center.data(), sizeof(reply.center));
+      std::memcpy(reply.up, up.data(), sizeof(reply.up));
+      break;
+    }
+    default:
+      reply.status = 1;
+    }
+    if (!sendAll(socket, &reply, sizeof(reply)))
+      break;
+  }
+
+  set_matcher_scratch(matcher, nullptr);
+  close_matcher_library(library);
+  return 0;
+}
@@ -0,0 +1,269 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "MatcherProcess.h"
+// posix
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+// ours
+#include "SocketIO.h"
+
+process_matcher::~process_matcher()
+{
+  stop();
+}
+
+bool process_matcher::start(
+    const std::string &hostExecutable, const std::string &library)
+{
+  m_library = library;
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) {
+    perror("socketpair");
+    return false;
+  }
+  m_memoryFd = memfd_create("anari-drr-matcher", MFD_CLOEXEC);
+  if (m_memoryFd < 0) {
+    perror("memfd_create");
+    close(sockets[0]);
+    close(sockets[1]);
+    return false;
+  }
+
+  // everything the child needs is prepared before the fork, it only
+  // clears close-on-exec of its descriptors before exec
+  const std::string socketArg = std::to_string(sockets[1]);
+  const std::string memoryArg = std::to_string(m_memoryFd);
+  const char *argv[] = {hostExecutable.c_str(),
+      library.c_str(),
+      socketArg.c_str(),
+      memoryArg.c_str(),
+      nullptr};
+  const int childSocket = sockets[1];
+  const int memoryFd = m_memoryFd;
+  const pid_t pid = fork();
+  if (pid == 0) {
+    fcntl(childSocket, F_SETFD, 0);
+    fcntl(memoryFd, F_SETFD, 0);
+    execv(argv[0], const_cast<char *const *>(argv));
+    _exit(127);
+  }
+  close(sockets[1]);
+  m_socket = sockets[0];
+  if (pid < 0) {
+    perror("fork");
+    stop();
+    return false;
+  }
+  m_pid = pid;
+
+  MatcherHostRequest request;
+  request.op = MatcherHostOp::Hello;
+  MatcherHostReply reply;
+  if (!call(request, reply) || reply.status != 0) {
+    fprintf(stderr,
+        "Could not start %s for %s\n",
+        hostExecutable.c_str(),
+        library.c_str());
+    stop();
+    return false;
+  }
+  reply.name[sizeof(reply.name) - 1] = '\0';
+  reply.description[sizeof(reply.description) - 1] = '\0';
+  m_name = reply.name;
+  m_description = reply.description;
+  fprintf(stdout,
+      "Matcher %s runs in process %d\n",
+      m_name.c_str(),
+      int(m_pid));
+  return true;
+}
+
+bool process_matcher::alive() const
+{
+  return m_socket >= 0;
+}
+
+const std::string &process_matcher::name() const
+{
+  return m_name;
+}
+
+const std::string &process_matcher::description() const
+{
+  return m_description;
+}
+
+void process_matcher::set_image(const void* data,
+                                size_t width,
+                                size_t height,
+                                PIXEL_TYPE pixel_type,
+                                IMAGE_TYPE image_type,
+                                bool swizzle)
+{
+  const size_t bytes = width * height * matcher_pixel_size(pixel_type);
+  if (!alive() || !reserve(bytes))
+    return;
+  std::memcpy(m_memory, data, bytes);
+
+  MatcherHostRequest request;
+  request.op = MatcherHostOp::SetImage;
+  request.imageType = uint32_t(image_type);
+  request.pixelType = uint32_t(pixel_type);
+  request.flags = swizzle ? uint32_t(MATCHER_IMAGE_SWIZZLE) : 0u;
+  request.width = width;
+  request.height = height;
+  MatcherHostReply reply;
+  call(request, reply);
+}
+
+void process_matcher::match()
+{
+  MatcherHostRequest request;
+  request.op = MatcherHostOp::Match;
+  MatcherHostReply reply;
+  call(request, reply);
+}
+
+void process_matcher::calibrate(
+    size_t width, size_t height, float fovy, float aspect)
+{
+  MatcherHostRequest request;
+  request.op = MatcherHostOp::Calibrate;
+  request.width = width;
+  request.height = height;
+  request.fovy = fovy;
+  request.aspect = aspect;
+  MatcherHostReply reply;
+  call(request, reply);
+}
+
+bool process_matcher::update_camera(std::array<float, 3>& eye,
+                                    std::array<float, 3>& center,
+                                    std::array<float, 3>& up)
+{
+  MatcherHostRequest request;
+  request.op = MatcherHostOp::UpdateCamera;
+  std::memcpy(request.eye, eye.data(), sizeof(request.eye));
+  std::memcpy(request.center, center.data(), sizeof(request.center));
+  std::memcpy(request.up, up.data(), sizeof(request.up));
+  MatcherHostReply reply;
+  if (!call(request, reply) || !reply.updated)
+    return false;
+  std::memcpy(eye.data(), reply.eye, sizeof(reply.eye));
+  std::memcpy(center.data(), reply.center, sizeof(reply.center));
+  std::memcpy(up.data(), reply.up, sizeof(reply.up));
+  return true;
+}
+
+bool process_matcher::set_threading(const matcher_threading &threading)
+{
+  MatcherHostRequest request;
+  request.op = MatcherHostOp::SetThreading;
+  request.maxThreads = threading.max_threads;
+  for (uint32_t i = 0; i < threading.num_cpus; ++i) {
+    const int32_t cpu = threading.cpus[i];
+    if (cpu >= 0 && cpu < 256)
+      request.cpus[cpu / 64] |= uint64_t(1) << (cpu % 64);
+  }
+  MatcherHostReply reply;
+  return call(request, reply);
+}
+
+bool process_matcher::call(
+    MatcherHostRequest &request, MatcherHostReply &reply)
+{
+  if (!alive())
+    return false;
+  request.memorySize = m_memorySize;
+  if (sendAll(m_socket, &request, sizeof(request))
+      && recvAll(m_socket, &reply, sizeof(reply)))
+    return reply.status == 0;
+
+  int status = 0;
+  if (m_pid > 0 && waitpid(m_pid, &status, 0) == m_pid) {
+    m_pid = -1;
+    if (WIFSIGNALED(status)) {
+      fprintf(stderr,
+          "Matcher host for %s was killed by signal %d\n",
+          m_library.c_str(),
+          WTERMSIG(status));
+    } else {
+      fprintf(stderr,
+          "Matcher host for %s exited with status %d\n",
+          m_library.c_str(),
+          WEXITSTATUS(status));
+    }
+  }
+  close(m_socket);
+  m_socket = -1;
+  return false;
+}
+
+bool process_matcher::reserve(size_t bytes)
+{
+  if (bytes <= m_memorySize)
+    return true;
+  // grown in steps, so a few sizes in turn do not remap every time
+  const size_t size = std::max(bytes, m_memorySize * 2);
+  if (m_memory)
+    munmap(m_memory, m_memorySize);
+  m_memory = nullptr;
+  m_memorySize = 0;
+  if (ftruncate(m_memoryFd, off_t(size)) != 0) {
+    perror("ftruncate");
+    return false;
+  }
+  void *memory =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memoryFd, 0);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    return false;
+  }
+  m_memory = static_cast<uint8_t *>(memory);
+  m_memorySize = size;
+  return true;
+}
+
+void process_matcher::stop()
+{
+  if (m_socket >= 0) {
+    MatcherHostRequest request;
+    request.op = MatcherHostOp::Quit;
+    sendAll(m_socket, &request, sizeof(request));
+    close(m_socket);
+    m_socket = -1;
+  }
+  if (m_pid > 0) {
+    // a host busy matching gets a second to notice, then is killed
+    int status = 0;
+    bool exited = false;
+    for (int i = 0; i < 100 && !exited; ++i) {
+      exited = waitpid(m_pid, &status, WNOHANG) == m_pid;
+      if (!exited)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (!exited) {
+      kill(m_pid, SIGKILL);
+      waitpid(m_pid, &status, 0);
+    }
+    m_pid = -1;
+  }
+  if (m_memory)
+    munmap(m_memory, m_memorySize);
+  m_memory = nullptr;
+  m_memorySize = 0;
+  if (m_memoryFd >= 0)
+    close(m_memoryFd);
+  m_memoryFd = -1;
+}
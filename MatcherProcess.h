@@ -0,0 +1,108 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+// ours
+#include "Matcher.h"
+
+// Matchers hosted out of process. anariDRRMatcherHost (MatcherHost.cpp)
+// opens one plugin library and serves it to the viewer, so a plugin gets a
+// CUDA/GPU context of its own and a crash in it ends the host only. The
+// viewer starts it as
+//
+//   anariDRRMatcherHost <library> <socket fd> <memory fd>
+//
+// passing one end of a socketpair and a memfd both map. Requests and
+// replies below alternate on the socket; images travel through the shared
+// memory, packed rows starting at its beginning. Both ends are built
+// together, so the structs are sent as they are.
+
+enum class MatcherHostOp : uint32_t
+{
+  Hello = 1, // reply carries name and description
+  SetImage = 2,
+  Calibrate = 3,
+  Match = 4,
+  UpdateCamera = 5,
+  Quit = 6,
+  SetThreading = 7 // the host itself runs on the cpus, if any are given
+};
+
+struct MatcherHostRequest
+{
+  MatcherHostOp op{MatcherHostOp::Hello};
+  uint32_t imageType{0}; // feature_matcher::IMAGE_TYPE
+  uint32_t pixelType{0}; // feature_matcher::PIXEL_TYPE
+  uint32_t flags{0}; // matcher_image_flags
+  uint64_t memorySize{0}; // of the shared memory, the host remaps on change
+  uint64_t width{0};
+  uint64_t height{0};
+  float fovy{0.f};
+  float aspect{1.f};
+  float eye[3]{};
+  float center[3]{};
+  float up[3]{};
+  uint32_t maxThreads{0}; // SetThreading
+  uint64_t cpus[4]{}; // SetThreading: bit i for core i, the first 256
+};
+
+struct MatcherHostReply
+{
+  int32_t status{0}; // 0 on success
+  int32_t updated{0}; // UpdateCamera: pose below was updated
+  float eye[3]{};
+  float center[3]{};
+  float up[3]{};
+  char name[64]{};
+  char description[256]{};
+};
+
+// feature_matcher forwarding to a host process. Once the host is gone
+// (crashed or killed) every call fails without touching it again, and
+// update_camera() leaves the pose alone.
+struct process_matcher : public feature_matcher
+{
+  process_matcher() = default;
+  ~process_matcher() override;
+
+  process_matcher(const process_matcher &) = delete;
+  process_matcher &operator=(const process_matcher &) = delete;
+
+  // Starts hostExecutable for library and waits for its hello
+  bool start(const std::string &hostExecutable, const std::string &library);
+  bool alive() const;
+  const std::string &name() const;
+  const std::string &description() const;
+
+  void set_image(const void* data,
+                 size_t width,
+                 size_t height,
+                 PIXEL_TYPE pixel_type,
+                 IMAGE_TYPE image_type,
+                 bool swizzle) override;
+  void match() override;
+  void calibrate(size_t width, size_t height, float fovy, float aspect) override;
+  bool update_camera(std::array<float, 3>& eye,
+                     std::array<float, 3>& center,
+                     std::array<float, 3>& up) override;
+  // Without parallel_for, the host has no scheduler to run it on
+  bool set_threading(const matcher_threading &threading);
+
+ private:
+  bool call(MatcherHostRequest &request, MatcherHostReply &reply);
+  bool reserve(size_t bytes);
+  void stop();
+
+  std::string m_library;
+  std::string m_name;
+  std::string m_description;
+  int m_pid{-1};
+  int m_socket{-1};
+  int m_memoryFd{-1};
+  uint8_t *m_memory{nullptr};
+  size_t m_memorySize{0};
+};
@@ -0,0 +1,97 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "MaterialRender.h"
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+// ours
+#include "ImageWriter.h"
+#include "Trace.h"
+
+bool renderAllMaterials(BatchRenderer &renderer,
+    const std::vector<prediction> &poses,
+    const LabelVolume &labels)
+{
+  const auto &settings = renderer.settings();
+  const int numChannels = labels.numChannels;
+  if (labels.empty() || numChannels < 1 || numChannels > MaxDrrChannels) {
+    std::cerr << "Per-material DRRs take 1 to " << MaxDrrChannels
+              << " labels\n";
+    return false;
+  }
+
+  // one output directory and manifest per channel
+  std::vector<BatchRenderSettings> channelSettings(numChannels, settings);
+  std::vector<std::vector<nlohmann::json>> entries(numChannels);
+  for (int c = 0; c < numChannels; ++c) {
+    auto &s = channelSettings[c];
+    s.outputDir = (std::filesystem::path(settings.outputDir)
+        / ("label_" + std::to_string(c)))
+                      .string();
+    s.writeOrigin = false;
+    std::error_code ec;
+    std::filesystem::create_directories(s.outputDir, ec);
+    if (ec) {
+      std::cerr << "Could not create " << s.outputDir << ": " << ec.message()
+                << "\n";
+      return false;
+    }
+    entries[c].resize(poses.size());
+  }
+
+  ImageWriter writer(std::max(2u, std::thread::hardware_concurrency() / 2),
+      size_t(2 * numChannels));
+  const size_t numPixels = size_t(settings.width) * settings.height;
+  std::vector<float> integrals;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < poses.size(); ++i) {
+    if (!renderer.renderChannels(
+            poses[i], labels.labels.data(), numChannels, integrals)) {
+      std::cerr << "Per-material DRRs need the builtin renderer\n";
+      writer.wait();
+      return false;
+    }
+    TRACE_SCOPE("batch", "write materials");
+    for (int c = 0; c < numChannels; ++c) {
+      std::vector<float> intensity(numPixels);
+      for (size_t p = 0; p < numPixels; ++p)
+        intensity[p] = std::exp(-integrals[p * numChannels + c]);
+      const auto &s = channelSettings[c];
+      entries[c][i] = BatchRenderer::manifestEntry(
+          i, poses[i], imageExtension(s.format), false);
+      entries[c][i]["label"] = c;
+      BatchRenderer::writeOutputs(s,
+          i,
+          BatchRenderer::exportImage(s, i, std::move(intensity)),
+          nullptr,
+          &writer);
+    }
+    std::cout << "\rrendered " << i + 1 << "/" << poses.size() << std::flush;
+  }
+  const auto end = std::chrono::steady_clock::now();
+  std::cout << "\n";
+  if (!writer.wait())
+    return false;
+
+  const float seconds = std::chrono::duration<float>(end - start).count();
+  std::cout << "Rendered " << poses.size() << " poses in " << numChannels
+            << " materials in " << seconds << "s ("
+            << (seconds > 0.f ? poses.size() / seconds : 0.f)
+            << " poses/s)\n";
+  for (int c = 0; c < numChannels; ++c) {
+    const auto &s = channelSettings[c];
+    if (!BatchRenderer::writeManifest(s.outputDir,
+            s.width,
+            s.height,
+            s.fovy,
+            std::move(entries[c])))
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,38 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+// ours
+#include "BatchRenderer.h"
+#include "prediction.h"
+
+// Per-material DRRs /////////////////////////////////////////////////////////
+//
+// Bone-only, soft-tissue-only, ... DRRs of every pose from one traversal of
+// the attenuation field by the builtin renderer: a label volume on the
+// field's grid assigns each voxel its material, and the integral of each
+// ray is split by label (renderDrrChannels()), so K materials cost about
+// one render instead of K conversions and renders. Channel c of pose i
+// goes to <outputDir>/label_<c>/drr_<i>.<ext>, each directory with a
+// manifest of its own as --batch writes it; no origins, as first hits are
+// of the whole volume.
+
+struct LabelVolume
+{
+  std::vector<uint8_t> labels; // x fastest
+  int dims[3]{0, 0, 0};
+  int numChannels{0}; // the highest label + 1
+
+  bool empty() const
+  {
+    return labels.empty();
+  }
+};
+
+bool renderAllMaterials(BatchRenderer &renderer,
+    const std::vector<prediction> &poses,
+    const LabelVolume &labels);
@@ -0,0 +1,136 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "MemoryFit.h"
+// std
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+// ours
+#include "FieldPyramid.h"
+#include "Half.h"
+#ifdef HAVE_CUDA
+#include "LacConvertCuda.h"
+#endif
+#include "Parallel.h"
+#include "ResourceUsage.h"
+
+namespace {
+
+constexpr int g_maxLevel = 3;
+
+// MemAvailable of /proc/meminfo; 0 if unknown
+size_t hostAvailableMemory()
+{
+  std::ifstream in("/proc/meminfo");
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t kib = 0;
+    if (std::sscanf(line.c_str(), "MemAvailable: %zu kB", &kib) == 1)
+      return kib << 10;
+  }
+  return 0;
+}
+
+size_t fieldBytes(const int dims[3], unsigned bytesPerCell, int level)
+{
+  size_t cells = 1;
+  for (int a = 0; a < 3; ++a) {
+    size_t n = size_t(dims[a]);
+    for (int l = 0; l < level; ++l)
+      n = (n + 1) / 2;
+    cells *= n;
+  }
+  return cells * bytesPerCell;
+}
+
+// Rounds through float16, which is monotonic: voxel ranges stay ranges
+float roundToHalf(float v)
+{
+  return halfToFloat(floatToHalf(v));
+}
+
+} // namespace
+
+std::string MemoryFitPlan::str() const
+{
+  std::ostringstream out;
+  if (outOfCore)
+    out << "out of core";
+  else
+    out << (half ? "float16" : "as read") << ", level " << level;
+  out << " (" << size_t(toMiB(bytes)) << " MiB of " << size_t(toMiB(budget))
+      << " MiB)";
+  return out.str();
+}
+
+size_t availableDeviceMemory()
+{
+#ifdef HAVE_CUDA
+  if (size_t bytes = cudaFreeMemory())
+    return bytes;
+#endif
+  return hostAvailableMemory();
+}
+
+MemoryFitPlan planMemoryFit(const int dims[3],
+    unsigned bytesPerCell,
+    bool halfOk,
+    bool streamOk,
+    size_t budget)
+{
+  MemoryFitPlan plan;
+  plan.planned = true;
+  plan.budget = budget;
+  const size_t usable = budget - budget / 5;
+  const bool canHalf = halfOk && bytesPerCell == 4;
+  for (int level = 0; level <= g_maxLevel; ++level) {
+    for (bool half : {false, true}) {
+      if (half && !canHalf)
+        continue;
+      plan.half = half;
+      plan.level = level;
+      plan.bytes = fieldBytes(dims, half ? 2 : bytesPerCell, level);
+      if (plan.bytes <= usable)
+        return plan;
+    }
+    // the stream keeps full resolution, preferred to a coarser level
+    if (level == 0 && streamOk) {
+      plan.half = false;
+      plan.outOfCore = true;
+      plan.bytes = usable;
+      return plan;
+    }
+  }
+  return plan; // the coarsest, which does not fit either
+}
+
+StructuredField applyMemoryFit(
+    const StructuredField &field, const MemoryFitPlan &plan)
+{
+  StructuredField result = field;
+  if (plan.half && field.bytesPerCell == 4 && !field.empty()) {
+    const auto *src = static_cast<const float *>(field.data());
+    result.bytesPerCell = 2;
+    result.isHalf = true;
+    auto *dst = static_cast<uint16_t *>(result.allocate(field.numCells()));
+    parallelFor(0, field.numCells(), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+        dst[i] = floatToHalf(src[i]);
+    });
+    for (float &v : result.macrocells.minMax)
+      v = roundToHalf(v);
+    result.dataRange = {
+        roundToHalf(field.dataRange.x), roundToHalf(field.dataRange.y)};
+  }
+  if (plan.level > 0 && !result.empty()) {
+    auto levels = buildFieldPyramid(result, size_t(plan.level));
+    if (!levels.empty()) {
+      // the full volume's histogram, for windowing
+      levels.back().histogram = result.histogram;
+      result = std::move(levels.back());
+    }
+  }
+  return result;
+}
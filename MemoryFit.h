@@ -0,0 +1,54 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <string>
+// ours
+#include "FieldTypes.h"
+
+// Fitting volumes into device memory ////////////////////////////////////////
+//
+// Picks the first representation of a volume whose device field fits the
+// memory available, instead of failing in the upload:
+//
+//   as read (float32 attenuation or densities, RAW cells)
+//   -> float16 (attenuation and densities; half the bytes)
+//   -> levels 1..3 of the field's pyramid (FieldPyramid.h, 1/8 each)
+//   -> out of core (RAW volumes in the interactive viewer, BrickStream.h)
+//
+// The volume is planned once, from its first field; later fields (other
+// LUTs) go through the same plan.
+
+struct MemoryFitPlan
+{
+  bool planned{false};
+  bool half{false}; // float32 fields are stored as float16
+  int level{0}; // of the field's pyramid, 0: full resolution
+  bool outOfCore{false};
+  size_t bytes{0}; // of the field as planned
+  size_t budget{0};
+
+  // e.g. "float16, level 1 (212 MiB of 1843 MiB)"
+  std::string str() const;
+};
+
+// Bytes free on the device for volumes: CUDA's free memory in CUDA builds,
+// else the host's available memory (CPU devices keep fields there)
+size_t availableDeviceMemory();
+
+// The representation of a field of dims and bytesPerCell that fits budget,
+// leaving room for the renderer (a fifth of it). halfOk: float32 cells may
+// become float16; streamOk: an out-of-core stream may be used. If nothing
+// fits, the coarsest level (or the stream, if allowed) is planned.
+MemoryFitPlan planMemoryFit(const int dims[3],
+    unsigned bytesPerCell,
+    bool halfOk,
+    bool streamOk,
+    size_t budget);
+
+// The field as planned; float16 conversion and downsampling on all cores
+StructuredField applyMemoryFit(
+    const StructuredField &field, const MemoryFitPlan &plan);
@@ -0,0 +1,94 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+// ours
+#include "FieldTypes.h"
+#include "ResourceUsage.h"
+
+// Bytes held by the viewer's buffers, grouped into host, device and GL
+// memory. Components add their own entries (reportMemory()); device entries
+// are what was handed to ANARI, since devices do not report their usage.
+struct MemoryReport
+{
+  enum Category
+  {
+    Host,
+    Device,
+    GL,
+    NumCategories
+  };
+
+  struct Entry
+  {
+    Category category;
+    std::string name;
+    size_t bytes;
+  };
+
+  std::vector<Entry> entries;
+  // voxel buffers counted so far: copies of a field share theirs
+  std::vector<const void *> fieldBuffers;
+
+  void add(Category category, std::string name, size_t bytes)
+  {
+    if (bytes)
+      entries.push_back({category, std::move(name), bytes});
+  }
+
+  // Voxel storage of a field, counted for the first field sharing it;
+  // mapped (mmap'd) fields are file-backed and reported separately
+  void addField(const std::string &name, const StructuredField &field)
+  {
+    size_t voxelBytes = field.voxelBytes();
+    if (std::find(fieldBuffers.begin(), fieldBuffers.end(), field.data())
+        != fieldBuffers.end())
+      voxelBytes = 0;
+    else if (field.data())
+      fieldBuffers.push_back(field.data());
+    add(Host, name, (field.mapped ? 0 : voxelBytes) + field.macrocells.bytes());
+    if (field.mapped)
+      add(Host, name + " (mapped)", voxelBytes);
+  }
+
+  size_t total(Category category) const
+  {
+    size_t bytes = 0;
+    for (auto &e : entries)
+      bytes += e.category == category ? e.bytes : 0;
+    return bytes;
+  }
+
+  static const char *categoryName(Category category)
+  {
+    static const char *names[] = {"host", "device", "GL"};
+    return names[category];
+  }
+
+  void print(FILE *out = stdout) const
+  {
+    fprintf(out, "Memory report:\n");
+    for (int c = 0; c < NumCategories; ++c) {
+      const auto category = Category(c);
+      fprintf(out,
+          "  %s: %.1f MiB\n",
+          categoryName(category),
+          toMiB(total(category)));
+      for (auto &e : entries) {
+        if (e.category == category)
+          fprintf(out, "    %-32s %10.1f MiB\n", e.name.c_str(), toMiB(e.bytes));
+      }
+    }
+    fprintf(out,
+        "  process: %.1f MiB resident, %.1f MiB peak\n",
+        toMiB(currentResidentSetSize()),
+        toMiB(peakResidentSetSize()));
+  }
+};
@@ -0,0 +1,63 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "MemoryWindow.h"
+
+namespace anari_viewer::windows {
+
+MemoryWindow::MemoryWindow(CollectMemoryCallback cb, const char *name)
+    : Window(name, true), m_collect(cb)
+{}
+
+void MemoryWindow::buildUI()
+{
+  const auto now = std::chrono::steady_clock::now();
+  if (ImGui::Button("refresh") || now - m_lastRefresh > std::chrono::seconds(1))
+    refresh();
+
+  ImGui::SameLine();
+  if (ImGui::Button("print"))
+    m_report.print();
+
+  ImGui::Text("process: %.1f MiB resident, %.1f MiB peak",
+      toMiB(currentResidentSetSize()),
+      toMiB(peakResidentSetSize()));
+
+  if (!ImGui::BeginTable("memory",
+          2,
+          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg
+              | ImGuiTableFlags_SizingFixedFit))
+    return;
+
+  ImGui::TableSetupColumn("buffer");
+  ImGui::TableSetupColumn("MiB");
+  ImGui::TableHeadersRow();
+  for (int c = 0; c < MemoryReport::NumCategories; ++c) {
+    const auto category = MemoryReport::Category(c);
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    ImGui::Text("%s", MemoryReport::categoryName(category));
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", toMiB(m_report.total(category)));
+    for (auto &e : m_report.entries) {
+      if (e.category != category)
+        continue;
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("  %s", e.name.c_str());
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", toMiB(e.bytes));
+    }
+  }
+  ImGui::EndTable();
+}
+
+void MemoryWindow::refresh()
+{
+  m_lastRefresh = std::chrono::steady_clock::now();
+  m_report = MemoryReport();
+  if (m_collect)
+    m_collect(m_report);
+}
+
+} // namespace anari_viewer::windows
@@ -0,0 +1,36 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// anari
+#include "anari_viewer/windows/Window.h"
+// std
+#include <chrono>
+#include <functional>
+// ours
+#include "MemoryReport.h"
+
+namespace anari_viewer::windows {
+
+using CollectMemoryCallback = std::function<void(MemoryReport &)>;
+
+// Memory report of the viewer's volumes, frames, textures and images,
+// refreshed about once per second while the window is shown
+class MemoryWindow : public anari_viewer::windows::Window
+{
+ public:
+  MemoryWindow(CollectMemoryCallback cb, const char *name = "Memory");
+  ~MemoryWindow() = default;
+
+  void buildUI() override;
+
+ private:
+  void refresh();
+
+  CollectMemoryCallback m_collect;
+  MemoryReport m_report;
+  std::chrono::steady_clock::time_point m_lastRefresh;
+};
+
+} // namespace anari_viewer::windows
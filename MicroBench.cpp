@@ -0,0 +1,476 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+// Times the viewer's hot primitives one at a time, without a window or
+// ANARI device: LAC lookups, the NIfTI reader's HU to attenuation
+// conversion, Image copies, the frame copy of DRRViewport::getFrame(),
+// pixel format conversions and JSON prediction parsing. Each case runs in
+// batches of calls long enough to time (--min-time), repeated; the median
+// batch gives the time per call, items and bytes per second. Results go to
+// the terminal and to --out as JSON or CSV, and a previous --out JSON file
+// given as --baseline adds the speedup over it.
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <span>
+#include <string>
+#include <vector>
+// nlohmann
+#include <nlohmann/json.hpp>
+// ours
+#include "Image.h"
+#include "ImagePreprocess.h"
+#include "LacTransform.h"
+#include "Phantom.h"
+#include "prediction.h"
+#ifdef HAVE_ITK
+#include "readNifti.h"
+#endif
+
+static std::string g_filter;
+static std::string g_outFile;
+static std::string g_baselineFile;
+static std::string g_lutFile;
+static std::string g_scratchDir = "/tmp";
+static float g_minTimeMs = 100.f;
+static int g_repetitions = 5;
+static int g_volumeEdge = 128;
+static size_t g_frameSize[2] = {1024, 1024};
+static size_t g_numPredictions = 10000;
+
+static void printUsage()
+{
+  std::cout << "./anariDRRMicroBench [{--help|-h}]\n"
+            << "   [--filter <substring>]\n"
+            << "   [--min-time <ms>]\n"
+            << "   [--repetitions <count>]\n"
+            << "   [--volume <edge>]\n"
+            << "   [--frame <width> <height>]\n"
+            << "   [--predictions <count>]\n"
+            << "   [--lac <lut file>]\n"
+            << "   [--scratch <directory>]\n"
+            << "   [--out <json or csv file>]\n"
+            << "   [--baseline <json file>]\n";
+}
+
+static void parseCommandLine(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      std::exit(0);
+    } else if (arg == "--filter")
+      g_filter = argv[++i];
+    else if (arg == "--min-time")
+      g_minTimeMs = std::max(1.f, float(std::atof(argv[++i])));
+    else if (arg == "--repetitions")
+      g_repetitions = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--volume")
+      g_volumeEdge = std::max(8, std::atoi(argv[++i]));
+    else if (arg == "--frame") {
+      g_frameSize[0] = size_t(std::max(1, std::atoi(argv[++i])));
+      g_frameSize[1] = size_t(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--predictions")
+      g_numPredictions = size_t(std::max(1, std::atoi(argv[++i])));
+    else if (arg == "--lac" || arg == "--lacfile")
+      g_lutFile = argv[++i];
+    else if (arg == "--scratch")
+      g_scratchDir = argv[++i];
+    else if (arg == "--out")
+      g_outFile = argv[++i];
+    else if (arg == "--baseline")
+      g_baselineFile = argv[++i];
+    else {
+      printf("ERROR: unknown argument %s\n", arg.c_str());
+      printUsage();
+      std::exit(1);
+    }
+  }
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Written by every case, so the compiler cannot drop the work
+volatile float g_sink = 0.f;
+
+// The primitives print progress to std::cout on every call; muted while
+// they are timed
+class MuteStdout
+{
+ public:
+  MuteStdout() : m_buffer(std::cout.rdbuf(nullptr)) {}
+  ~MuteStdout()
+  {
+    std::cout.rdbuf(m_buffer);
+  }
+
+ private:
+  std::streambuf *m_buffer;
+};
+
+// One primitive; call() does the work once
+struct Case
+{
+  std::string name;
+  size_t items{0}; // per call: voxels, pixels, predictions
+  size_t bytes{0}; // per call, read plus written
+  std::function<void()> call;
+};
+
+struct Result
+{
+  std::string name;
+  size_t items{0};
+  size_t bytes{0};
+  size_t calls{0}; // per batch
+  double medianNs{0.0}; // per call
+  double minNs{0.0};
+  double baselineNs{0.0}; // 0: not in the baseline
+};
+
+double perSecond(double amount, double ns)
+{
+  return ns > 0.0 ? amount / (ns * 1e-9) : 0.0;
+}
+
+double median(std::vector<double> values)
+{
+  std::nth_element(
+      values.begin(), values.begin() + values.size() / 2, values.end());
+  return values[values.size() / 2];
+}
+
+Result benchmark(const Case &c)
+{
+  auto timeBatch = [&](size_t calls) {
+    const auto t0 = Clock::now();
+    for (size_t i = 0; i < calls; ++i)
+      c.call();
+    return std::chrono::duration<double, std::nano>(Clock::now() - t0)
+        .count();
+  };
+
+  // warm caches and allocators, then grow the batch until it takes
+  // --min-time
+  c.call();
+  const double minNs = double(g_minTimeMs) * 1e6;
+  size_t calls = 1;
+  double ns = timeBatch(calls);
+  while (ns < minNs && calls < (size_t(1) << 30)) {
+    const double scale = ns > 0.0 ? std::min(minNs / ns * 1.2, 10.0) : 10.0;
+    calls = std::max(calls + 1, size_t(double(calls) * scale));
+    ns = timeBatch(calls);
+  }
+
+  std::vector<double> perCall{ns / double(calls)};
+  for (int r = 1; r < g_repetitions; ++r)
+    perCall.push_back(timeBatch(calls) / double(calls));
+
+  Result result;
+  result.name = c.name;
+  result.items = c.items;
+  result.bytes = c.bytes;
+  result.calls = calls;
+  result.medianNs = median(perCall);
+  result.minNs = *std::min_element(perCall.begin(), perCall.end());
+  return result;
+}
+
+void printResult(const Result &r)
+{
+  printf("%-24s %12.0f %12.0f %10.1f %10.2f",
+      r.name.c_str(),
+      r.medianNs,
+      r.minNs,
+      perSecond(double(r.items) / 1e6, r.medianNs),
+      perSecond(double(r.bytes) / 1e9, r.medianNs));
+  if (r.baselineNs > 0.0)
+    printf(" %8.2fx", r.baselineNs / r.medianNs);
+  printf("\n");
+}
+
+bool writeResults(const std::string &file, const std::vector<Result> &results)
+{
+  std::ofstream out(file);
+  const bool json = file.size() >= 5 && file.substr(file.size() - 5) == ".json";
+  if (json) {
+    nlohmann::json rows = nlohmann::json::array();
+    for (const auto &r : results) {
+      nlohmann::json row = {{"name", r.name},
+          {"items", r.items},
+          {"bytes", r.bytes},
+          {"calls", r.calls},
+          {"median_ns", r.medianNs},
+          {"min_ns", r.minNs},
+          {"mitems_s", perSecond(double(r.items) / 1e6, r.medianNs)},
+          {"gb_s", perSecond(double(r.bytes) / 1e9, r.medianNs)}};
+      if (r.baselineNs > 0.0)
+        row["speedup"] = r.baselineNs / r.medianNs;
+      rows.push_back(std::move(row));
+    }
+    out << nlohmann::json{{"repetitions", g_repetitions},
+        {"min_time_ms", g_minTimeMs},
+        {"benchmarks", rows}}
+               .dump(2)
+        << '\n';
+  } else {
+    out << "name,items,bytes,calls,median_ns,min_ns,mitems_s,gb_s,speedup\n";
+    for (const auto &r : results) {
+      out << r.name << ',' << r.items << ',' << r.bytes << ',' << r.calls
+          << ',' << r.medianNs << ',' << r.minNs << ','
+          << perSecond(double(r.items) / 1e6, r.medianNs) << ','
+          << perSecond(double(r.bytes) / 1e9, r.medianNs) << ','
+          << (r.baselineNs > 0.0 ? r.baselineNs / r.medianNs : 0.0) << '\n';
+    }
+  }
+  if (!out) {
+    std::cerr << "Could not write " << file << "\n";
+    return false;
+  }
+  return true;
+}
+
+// median_ns by name of an --out JSON file
+bool readBaseline(const std::string &file, std::map<std::string, double> &ns)
+{
+  try {
+    std::ifstream in(file);
+    nlohmann::json json;
+    in >> json;
+    for (const auto &row : json.at("benchmarks"))
+      ns[row.at("name").get<std::string>()] = row.at("median_ns").get<double>();
+  } catch (const std::exception &e) {
+    std::cerr << "Could not read baseline " << file << ": " << e.what() << "\n";
+    return false;
+  }
+  return true;
+}
+
+// Inputs shared by the cases, made once
+struct Inputs
+{
+  LacReader lac;
+  std::vector<int16_t> hu; // phantom, --volume edge^3
+  std::vector<int32_t> hu32;
+  std::vector<float> huFloat;
+  std::vector<float> lacOut;
+  Image frame; // RGBA8, --frame
+  Image frameCopy;
+  std::vector<uint8_t> frameBuffer; // reused like getFrame()'s vector
+  std::vector<uint8_t> converted;
+  std::string predictionFile;
+#ifdef HAVE_ITK
+  NiftiReader volume;
+#endif
+};
+
+// A "predictions" file like the viewer loads with --json
+bool writePredictions(const std::string &file, size_t count)
+{
+  std::ofstream out(file);
+  out << "{\"sensor\": {\"fov_x_rad\": 0.3, \"fov_y_rad\": 0.3, "
+         "\"width\": 1024, \"height\": 1024},\n \"predictions\": [\n";
+  for (size_t i = 0; i < count; ++i) {
+    const float a = float(i) * 0.001f;
+    out << (i ? ",\n" : "") << "  {\"file\": \"img_" << i
+        << ".png\", \"eye\": {\"x\": " << 600.f * std::sin(a)
+        << ", \"y\": " << 10.f * a << ", \"z\": " << 600.f * std::cos(a)
+        << "}, \"center\": {\"x\": 0, \"y\": 0, \"z\": 0}, "
+           "\"up\": {\"x\": 0, \"y\": 1, \"z\": 0}}";
+  }
+  out << "\n]}\n";
+  if (!out) {
+    std::cerr << "Could not write " << file << "\n";
+    return false;
+  }
+  return true;
+}
+
+std::vector<Case> makeCases(Inputs &in)
+{
+  std::vector<Case> cases;
+  const size_t voxels = in.hu.size();
+  const size_t pixels = g_frameSize[0] * g_frameSize[1];
+
+  // LacReader::lookup(): per voxel, interpolating; in batches, interpolating
+  // fractional densities or reading the dense table
+  cases.push_back({"lac/scalar", voxels, voxels * 2, [&in]() {
+                     float sum = 0.f;
+                     for (int16_t d : in.hu)
+                       sum += in.lac.lookup(ssize_t(d));
+                     g_sink = sum;
+                   }});
+  cases.push_back({"lac/batch-float", voxels, voxels * 8, [&in]() {
+                     in.lac.lookup(std::span<const float>(in.huFloat),
+                         std::span<float>(in.lacOut));
+                     g_sink = in.lacOut.back();
+                   }});
+  cases.push_back({"lac/dense-int16", voxels, voxels * 6, [&in]() {
+                     in.lac.lookup(std::span<const int16_t>(in.hu),
+                         std::span<float>(in.lacOut));
+                     g_sink = in.lacOut.back();
+                   }});
+  cases.push_back({"lac/dense-int32", voxels, voxels * 8, [&in]() {
+                     in.lac.lookup(std::span<const int32_t>(in.hu32),
+                         std::span<float>(in.lacOut));
+                     g_sink = in.lacOut.back();
+                   }});
+
+#ifdef HAVE_ITK
+  // the whole conversion, on all cores; the LUT's cached field is dropped
+  // before each call
+  cases.push_back({"nifti/getField-int16", voxels, voxels * 6, [&in]() {
+                     in.volume.lacFieldCache.clear();
+                     const auto &field = in.volume.getField(0, in.lac);
+                     g_sink = field.dataRange.y;
+                   }});
+#endif
+
+  const size_t frameBytes = pixels * 4;
+  cases.push_back({"image/construct", pixels, frameBytes * 2, [&in]() {
+                     Image image(in.frame.width,
+                         in.frame.height,
+                         in.frame.bpp,
+                         in.frame.data.data());
+                     g_sink = image.data.back();
+                   }});
+  cases.push_back({"image/copy", pixels, frameBytes * 2, [&in]() {
+                     Image image(in.frame);
+                     g_sink = image.data.back();
+                   }});
+  cases.push_back({"image/copy-assign", pixels, frameBytes * 2, [&in]() {
+                     in.frameCopy = in.frame;
+                     g_sink = in.frameCopy.data.back();
+                   }});
+  // DRRViewport::getFrame(): the mapped frame into the caller's vector
+  cases.push_back({"frame/copy", pixels, frameBytes * 2, [&in]() {
+                     in.frameBuffer.assign(
+                         in.frame.data.begin(), in.frame.data.end());
+                     g_sink = in.frameBuffer.back();
+                   }});
+
+  cases.push_back({"convert/rgba-to-gray", pixels, pixels * 5, [&in, pixels]() {
+                     rgbaToGray(
+                         in.frame.data.data(), pixels, in.converted.data());
+                     g_sink = in.converted.back();
+                   }});
+  cases.push_back({"convert/rgba-to-bgra", pixels, pixels * 8, [&in, pixels]() {
+                     rgbaToBgra(
+                         in.frame.data.data(), pixels, in.converted.data());
+                     g_sink = in.converted.back();
+                   }});
+
+  const size_t fileBytes = std::filesystem::file_size(in.predictionFile);
+  cases.push_back({"json/predictions", g_numPredictions, fileBytes, [&in]() {
+                     MuteStdout mute;
+                     prediction_container predictions;
+                     predictions.load_json(in.predictionFile);
+                     g_sink = predictions.fovy;
+                   }});
+  return cases;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  parseCommandLine(argc, argv);
+
+  Inputs in;
+  if (!g_lutFile.empty())
+    in.lac.setFilename(g_lutFile);
+  in.lac.read();
+  if (in.lac.m_lacLuts.empty()) {
+    printf("ERROR: no LAC LUTs in %s\n", in.lac.m_filename.c_str());
+    return 1;
+  }
+
+  PhantomSpec spec;
+  spec.dims[0] = spec.dims[1] = spec.dims[2] = g_volumeEdge;
+  const size_t voxels = size_t(g_volumeEdge) * g_volumeEdge * g_volumeEdge;
+  in.hu.resize(voxels);
+  fillPhantom(spec, in.hu.data());
+  in.hu32.assign(in.hu.begin(), in.hu.end());
+  in.huFloat.assign(in.hu.begin(), in.hu.end());
+  in.lacOut.resize(voxels);
+#ifdef HAVE_ITK
+  {
+    const float spacing[3] = {spec.spacing(), spec.spacing(), spec.spacing()};
+    const float origin[3] = {0.f, 0.f, 0.f};
+    in.volume.setVolume(
+        itk::IOComponentEnum::SHORT, spec.dims, spacing, origin);
+    std::copy_n(reinterpret_cast<const uint8_t *>(in.hu.data()),
+        voxels * sizeof(int16_t),
+        in.volume.voxels.data());
+  }
+#endif
+
+  // a smooth gradient with some texture, like a DRR
+  const size_t pixels = g_frameSize[0] * g_frameSize[1];
+  in.frame.width = g_frameSize[0];
+  in.frame.height = g_frameSize[1];
+  in.frame.bpp = 4;
+  in.frame.data.resize(pixels * 4);
+  for (size_t i = 0; i < pixels; ++i) {
+    const uint8_t v = uint8_t((i % g_frameSize[0]) * 255 / g_frameSize[0]);
+    in.frame.data[i * 4] = v;
+    in.frame.data[i * 4 + 1] = uint8_t(v ^ (i >> 7));
+    in.frame.data[i * 4 + 2] = uint8_t(255 - v);
+    in.frame.data[i * 4 + 3] = 255;
+  }
+  in.converted.resize(pixels * 4);
+
+  in.predictionFile =
+      (std::filesystem::path(g_scratchDir) / "microbench_predictions.json")
+          .string();
+  if (!writePredictions(in.predictionFile, g_numPredictions))
+    return 1;
+
+  std::map<std::string, double> baseline;
+  if (!g_baselineFile.empty() && !readBaseline(g_baselineFile, baseline))
+    return 1;
+
+  printf("%d repetitions of at least %.0f ms; volume %d^3, frame %zux%zu, "
+         "%zu predictions\n",
+      g_repetitions,
+      g_minTimeMs,
+      g_volumeEdge,
+      g_frameSize[0],
+      g_frameSize[1],
+      g_numPredictions);
+  printf("%-24s %12s %12s %10s %10s%s\n",
+      "case",
+      "median ns",
+      "min ns",
+      "Mitems/s",
+      "GB/s",
+      baseline.empty() ? "" : "  speedup");
+  std::vector<Result> results;
+  for (const auto &c : makeCases(in)) {
+    if (!g_filter.empty() && c.name.find(g_filter) == std::string::npos)
+      continue;
+    Result result = benchmark(c);
+    if (auto it = baseline.find(c.name); it != baseline.end())
+      result.baselineNs = it->second;
+    printResult(result);
+    results.push_back(result);
+  }
+
+  std::error_code ec;
+  std::filesystem::remove(in.predictionFile, ec);
+  if (!g_outFile.empty() && !writeResults(g_outFile, results))
+    return 1;
+  return 0;
+}
@@ -0,0 +1,170 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "OriginDepth.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+// ours
+#include "Half.h"
+#include "Parallel.h"
+
+namespace {
+
+void normalize(float v[3])
+{
+  const float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  if (length > 0.f) {
+    for (int a = 0; a < 3; ++a)
+      v[a] /= length;
+  }
+}
+
+// The camera's view direction and the image plane's extent, scaled so
+// that dir + (u - 0.5) * right + (v - 0.5) * up points through (u, v)
+struct RayBasis
+{
+  float dir[3];
+  float right[3];
+  float up[3];
+
+  explicit RayBasis(const RayCamera &camera)
+  {
+    std::copy_n(camera.dir, 3, dir);
+    normalize(dir);
+    right[0] = dir[1] * camera.up[2] - dir[2] * camera.up[1];
+    right[1] = dir[2] * camera.up[0] - dir[0] * camera.up[2];
+    right[2] = dir[0] * camera.up[1] - dir[1] * camera.up[0];
+    normalize(right);
+    up[0] = right[1] * dir[2] - right[2] * dir[1];
+    up[1] = right[2] * dir[0] - right[0] * dir[2];
+    up[2] = right[0] * dir[1] - right[1] * dir[0];
+    const float halfY = std::tan(0.5f * camera.fovy);
+    const float halfX = halfY * camera.aspect;
+    for (int a = 0; a < 3; ++a) {
+      right[a] *= 2.f * halfX;
+      up[a] *= 2.f * halfY;
+    }
+  }
+
+  void unproject(const RayCamera &camera,
+      size_t x,
+      size_t y,
+      float depth,
+      float origin[3]) const
+  {
+    const float u = camera.region[0]
+        + (float(x) + 0.5f) / camera.width
+            * (camera.region[2] - camera.region[0]);
+    const float v = camera.region[1]
+        + (float(y) + 0.5f) / camera.height
+            * (camera.region[3] - camera.region[1]);
+    float ray[3];
+    for (int a = 0; a < 3; ++a)
+      ray[a] = dir[a] + (u - 0.5f) * right[a] + (v - 0.5f) * up[a];
+    normalize(ray);
+    for (int a = 0; a < 3; ++a)
+      origin[a] = camera.eye[a] + depth * ray[a];
+  }
+};
+
+float depthAt(const void *depth, OriginFormat format, size_t i)
+{
+  if (format == OriginFormat::Depth16)
+    return halfToFloat(static_cast<const uint16_t *>(depth)[i]);
+  return static_cast<const float *>(depth)[i];
+}
+
+} // namespace
+
+bool parseOriginFormat(const std::string &name, OriginFormat &format)
+{
+  if (name == "float3")
+    format = OriginFormat::Float3;
+  else if (name == "depth32")
+    format = OriginFormat::Depth32;
+  else if (name == "depth16")
+    format = OriginFormat::Depth16;
+  else
+    return false;
+  return true;
+}
+
+size_t originPixelBytes(OriginFormat format)
+{
+  switch (format) {
+  case OriginFormat::Depth32:
+    return sizeof(float);
+  case OriginFormat::Depth16:
+    return sizeof(uint16_t);
+  default:
+    return 3 * sizeof(float);
+  }
+}
+
+void packOriginDepth(const float *origins,
+    size_t count,
+    const float eye[3],
+    OriginFormat format,
+    void *depth)
+{
+  if (format == OriginFormat::Float3) {
+    std::copy_n(origins, count * 3, static_cast<float *>(depth));
+    return;
+  }
+  parallelFor(0, count, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const float *o = origins + i * 3;
+      const float dx = o[0] - eye[0], dy = o[1] - eye[1], dz = o[2] - eye[2];
+      const float d = std::sqrt(dx * dx + dy * dy + dz * dz); // NaN stays
+      if (format == OriginFormat::Depth16)
+        static_cast<uint16_t *>(depth)[i] = floatToHalf(d);
+      else
+        static_cast<float *>(depth)[i] = d;
+    }
+  });
+}
+
+void unprojectDepth(const void *depth,
+    OriginFormat format,
+    const RayCamera &camera,
+    float *origins)
+{
+  if (format == OriginFormat::Float3) {
+    std::copy_n(static_cast<const float *>(depth),
+        camera.width * camera.height * 3,
+        origins);
+    return;
+  }
+  const RayBasis basis(camera);
+  parallelFor(
+      0,
+      camera.height,
+      [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+          for (size_t x = 0; x < camera.width; ++x) {
+            const size_t i = y * camera.width + x;
+            basis.unproject(
+                camera, x, y, depthAt(depth, format, i), origins + i * 3);
+          }
+        }
+      },
+      16);
+}
+
+void unprojectDepthAt(const void *depth,
+    OriginFormat format,
+    const RayCamera &camera,
+    size_t x,
+    size_t y,
+    float origin[3])
+{
+  const size_t i = y * camera.width + x;
+  if (format == OriginFormat::Float3) {
+    std::copy_n(static_cast<const float *>(depth) + i * 3, 3, origin);
+    return;
+  }
+  RayBasis(camera).unproject(
+      camera, x, y, depthAt(depth, format, i), origin);
+}
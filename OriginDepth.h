@@ -0,0 +1,50 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <string>
+// ours
+#include "FirstHit.h"
+
+// How host copies of a frame keep its origin channel, the first hit of
+// each pixel's ray. The renderer writes three floats per pixel, but every
+// hit lies on the ray through its pixel: with the frame's camera known,
+// the distance from the eye is all a copy has to keep, and the points are
+// unprojected from it where a matcher or the reprojector reads them.
+enum class OriginFormat
+{
+  Float3, // x, y, z, 12 bytes per pixel
+  Depth32, // distance along the ray as a float, 4 bytes
+  Depth16, // the same as a half float, 2 bytes (about 1/2000 of it off)
+};
+
+// "float3", "depth32" or "depth16"; false for other names
+bool parseOriginFormat(const std::string &name, OriginFormat &format);
+size_t originPixelBytes(OriginFormat format);
+
+// The distances of `count` origins from `eye` into depth, originPixelBytes()
+// each; NaN (no hit) stays NaN. Float3 copies the origins.
+void packOriginDepth(const float *origins,
+    size_t count,
+    const float eye[3],
+    OriginFormat format,
+    void *depth);
+
+// The origins of a camera.width x camera.height frame (row 0 at the
+// bottom) from its depth: the ray through each pixel's center, aimed as
+// RayCamera aims it, at the distance kept; NaN where there was no hit
+void unprojectDepth(const void *depth,
+    OriginFormat format,
+    const RayCamera &camera,
+    float *origins);
+
+// The same for the one pixel (x, y) of the frame
+void unprojectDepthAt(const void *depth,
+    OriginFormat format,
+    const RayCamera &camera,
+    size_t x,
+    size_t y,
+    float origin[3]);
@@ -0,0 +1,56 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+// ours
+#include "TaskScheduler.h"
+
+// Split [begin, end) into contiguous ranges, one per hardware thread, and run
+// func(rangeBegin, rangeEnd) on each range concurrently: on the shared
+// TaskScheduler's workers and the calling thread in a session, else on
+// threads of its own. Runs inline when the range is too small to be worth
+// spreading.
+template <typename Func>
+inline void parallelFor(
+    size_t begin, size_t end, Func &&func, size_t minGrainSize = 1 << 16)
+{
+  if (end <= begin)
+    return;
+
+  const size_t count = end - begin;
+  const size_t maxThreads =
+      std::max<size_t>(1, std::thread::hardware_concurrency());
+  const size_t numThreads =
+      std::min(maxThreads, std::max<size_t>(1, count / minGrainSize));
+
+  if (numThreads == 1) {
+    func(begin, end);
+    return;
+  }
+
+  const size_t chunk = (count + numThreads - 1) / numThreads;
+  if (TaskScheduler *scheduler = TaskScheduler::shared()) {
+    scheduler->runChunks(count, chunk, numThreads, [&](size_t b, size_t e) {
+      func(begin + b, begin + e);
+    });
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads);
+  for (size_t t = 0; t < numThreads; ++t) {
+    const size_t b = begin + t * chunk;
+    const size_t e = std::min(end, b + chunk);
+    if (b >= e)
+      break;
+    threads.emplace_back([&func, b, e]() { func(b, e); });
+  }
+  for (auto &t : threads)
+    t.join();
+}
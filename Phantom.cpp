@@ -0,0 +1,185 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Phantom.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+// ours
+#include "Parallel.h"
+#include "Trace.h"
+
+namespace {
+
+// Axis-aligned but for a rotation by phi (degrees) about z; contributions
+// add up where ellipsoids overlap
+struct Ellipsoid
+{
+  float center[3];
+  float axes[3];
+  float phi;
+  float hu;
+};
+
+// Kak & Slaney's 3D Shepp-Logan head, intensities as HU differences: air
+// -1000, skull 1000, brain 40, ventricles 0, lesions 60-70
+const Ellipsoid g_sheppLogan[] = {
+    {{0.f, 0.f, 0.f}, {0.69f, 0.92f, 0.9f}, 0.f, 2000.f},
+    {{0.f, -0.0184f, 0.f}, {0.6624f, 0.874f, 0.88f}, 0.f, -960.f},
+    {{-0.22f, 0.f, -0.25f}, {0.41f, 0.16f, 0.21f}, 108.f, -40.f},
+    {{0.22f, 0.f, -0.25f}, {0.31f, 0.11f, 0.22f}, 72.f, -40.f},
+    {{0.f, 0.35f, -0.25f}, {0.21f, 0.25f, 0.5f}, 0.f, 20.f},
+    {{0.f, 0.1f, -0.25f}, {0.046f, 0.046f, 0.046f}, 0.f, 20.f},
+    {{-0.08f, -0.605f, -0.25f}, {0.046f, 0.023f, 0.02f}, 0.f, 20.f},
+    {{0.06f, -0.605f, -0.25f}, {0.046f, 0.023f, 0.02f}, 90.f, 20.f},
+    {{0.06f, -0.105f, 0.625f}, {0.056f, 0.04f, 0.1f}, 90.f, 30.f},
+    {{0.f, 0.1f, 0.625f}, {0.056f, 0.056f, 0.1f}, 0.f, -30.f},
+};
+
+struct PreparedEllipsoid
+{
+  float center[3];
+  float inverseAxes[3];
+  float cosPhi, sinPhi;
+  float hu;
+};
+
+float sheppLogan(const std::vector<PreparedEllipsoid> &ellipsoids,
+    float x,
+    float y,
+    float z)
+{
+  float hu = -1000.f;
+  for (const auto &e : ellipsoids) {
+    const float dx = x - e.center[0], dy = y - e.center[1];
+    const float u = (dx * e.cosPhi + dy * e.sinPhi) * e.inverseAxes[0];
+    const float v = (dy * e.cosPhi - dx * e.sinPhi) * e.inverseAxes[1];
+    const float w = (z - e.center[2]) * e.inverseAxes[2];
+    if (u * u + v * v + w * w <= 1.f)
+      hu += e.hu;
+  }
+  return hu;
+}
+
+float body(float x, float y, float z)
+{
+  auto inCircle = [](float x, float z, float cx, float cz, float r) {
+    return (x - cx) * (x - cx) + (z - cz) * (z - cz) <= r * r;
+  };
+  const float r = (x / 0.8f) * (x / 0.8f) + (z / 0.6f) * (z / 0.6f);
+  if (std::abs(y) >= 0.9f || r > 1.f)
+    return -1000.f; // air
+  if (inCircle(x, z, 0.f, 0.35f, 0.08f))
+    return 1000.f; // spine
+  if (y < -0.3f
+      && (inCircle(x, z, -0.35f, 0.f, 0.07f)
+          || inCircle(x, z, 0.35f, 0.f, 0.07f)))
+    return 1000.f; // femurs
+  const float lx = std::abs(x) - 0.35f, ly = y - 0.45f;
+  if (lx * lx / 0.04f + ly * ly / 0.12f + z * z / 0.09f <= 1.f)
+    return -800.f; // lungs
+  return 40.f; // soft tissue
+}
+
+// Calls fn(index, hu) for every voxel, slices in parallel
+template <typename Fn>
+void forEachVoxel(const PhantomSpec &spec, Fn &&fn)
+{
+  std::vector<PreparedEllipsoid> ellipsoids;
+  for (const auto &e : g_sheppLogan) {
+    const float phi = e.phi * 3.14159265f / 180.f;
+    ellipsoids.push_back({{e.center[0], e.center[1], e.center[2]},
+        {1.f / e.axes[0], 1.f / e.axes[1], 1.f / e.axes[2]},
+        std::cos(phi),
+        std::sin(phi),
+        e.hu});
+  }
+
+  // -1..1 across the cube's largest axis, centered on the others
+  const int nx = spec.dims[0], ny = spec.dims[1], nz = spec.dims[2];
+  const float scale = 2.f / std::max({nx, ny, nz});
+  parallelFor(0, size_t(nz), [&](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ++k) {
+      const float z = (float(k) + 0.5f - 0.5f * nz) * scale;
+      for (int j = 0; j < ny; ++j) {
+        const float y = (float(j) + 0.5f - 0.5f * ny) * scale;
+        const size_t row = (k * ny + j) * size_t(nx);
+        for (int i = 0; i < nx; ++i) {
+          const float x = (float(i) + 0.5f - 0.5f * nx) * scale;
+          fn(row + i,
+              spec.kind == PhantomKind::Body ? body(x, y, z)
+                                             : sheppLogan(ellipsoids, x, y, z));
+        }
+      }
+    }
+  });
+}
+
+} // namespace
+
+float PhantomSpec::spacing() const
+{
+  return 256.f / std::max({dims[0], dims[1], dims[2], 1});
+}
+
+bool PhantomSpec::parse(const std::string &fileName, PhantomSpec &spec)
+{
+  const std::string prefix = "phantom:";
+  if (fileName.compare(0, prefix.size(), prefix) != 0)
+    return false;
+
+  PhantomSpec result;
+  std::string size = fileName.substr(prefix.size());
+  const auto colon = size.find(':');
+  if (colon != std::string::npos) {
+    const auto kind = size.substr(0, colon);
+    if (kind == "shepp")
+      result.kind = PhantomKind::SheppLogan;
+    else if (kind == "body")
+      result.kind = PhantomKind::Body;
+    else
+      return false;
+    size = size.substr(colon + 1);
+  }
+  char rest = 0;
+  if (std::sscanf(size.c_str(),
+          "%dx%dx%d%c",
+          &result.dims[0],
+          &result.dims[1],
+          &result.dims[2],
+          &rest)
+          != 3
+      || std::min({result.dims[0], result.dims[1], result.dims[2]}) < 1)
+    return false;
+  spec = result;
+  return true;
+}
+
+void fillPhantom(const PhantomSpec &spec, int16_t *hu)
+{
+  TRACE_SCOPE("volume", "generate phantom");
+  forEachVoxel(spec, [hu](size_t i, float value) { hu[i] = int16_t(value); });
+}
+
+StructuredField makePhantomField(const PhantomSpec &spec)
+{
+  TRACE_SCOPE("volume", "generate phantom");
+  StructuredField field;
+  field.dimX = spec.dims[0];
+  field.dimY = spec.dims[1];
+  field.dimZ = spec.dims[2];
+  field.bytesPerCell = 4;
+  auto *mu = static_cast<float *>(field.allocate(field.numCells()));
+  std::fill_n(field.spacing, 3, spec.spacing());
+
+  // water 0.02/mm at diagnostic energies, linear in HU
+  constexpr float water = 0.02f;
+  forEachVoxel(spec, [mu](size_t i, float value) {
+    mu[i] = std::max(0.f, water * (1.f + value / 1000.f));
+  });
+  field.dataRange.x = 0.f;
+  field.dataRange.y = water * 2.f; // skull and bone, 1000 HU
+  return field;
+}
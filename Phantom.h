@@ -0,0 +1,45 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+// ours
+#include "FieldTypes.h"
+
+// Procedural CT phantoms, for benchmarks and scaling studies without patient
+// data. Named on the command line like volume files:
+//
+//   phantom:<X>x<Y>x<Z>           the 3D Shepp-Logan head
+//   phantom:<kind>:<X>x<Y>x<Z>    kind shepp or body
+//
+// The phantom fills a 256 mm cube whatever the size, so sizes differ only
+// in resolution. Densities are HU (air -1000, water 0), converted to
+// attenuation through the LUTs like any CT volume.
+
+enum class PhantomKind
+{
+  SheppLogan, // Kak-Slaney ellipsoids: skull, brain, ventricles, lesions
+  Body, // water ellipse with lungs, spine and femurs along y
+};
+
+struct PhantomSpec
+{
+  PhantomKind kind{PhantomKind::SheppLogan};
+  int dims[3]{0, 0, 0};
+
+  // Spacing of the 256 mm cube, the same on all axes (mm)
+  float spacing() const;
+
+  // False for names that are not phantoms (or have bad sizes)
+  static bool parse(const std::string &fileName, PhantomSpec &spec);
+};
+
+// dims[0] * dims[1] * dims[2] HU values, x fastest, on all cores
+void fillPhantom(const PhantomSpec &spec, int16_t *hu);
+
+// The phantom as an attenuation field (float32, 1/mm, water 0.02), for
+// builds without the LUT conversion
+StructuredField makePhantomField(const PhantomSpec &spec);
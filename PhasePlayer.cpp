@@ -0,0 +1,189 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "PhasePlayer.h"
+// std
+#include <cstdio>
+// ours
+#include "Trace.h"
+
+PhasePlayer::~PhasePlayer()
+{
+  // the scene may be gone already, stop() is the owner's job
+  if (m_job.valid())
+    m_job.wait();
+}
+
+void PhasePlayer::setScheduler(TaskScheduler *scheduler)
+{
+  m_scheduler = scheduler;
+}
+
+bool PhasePlayer::start(VolumeScene &scene,
+    const StructuredField &layout,
+    size_t numPhases,
+    ConvertFunc convert)
+{
+  stop();
+  if (!scene.mapBackField(layout))
+    return false;
+  m_scene = &scene;
+  m_layout = layout;
+  m_numPhases = numPhases;
+  m_convert = std::move(convert);
+  m_phase = 0;
+  m_shownAt = Clock::now();
+  return true;
+}
+
+void PhasePlayer::stop()
+{
+  cancel();
+  if (m_scene)
+    m_scene->releaseBackField();
+  m_scene = nullptr;
+  m_haveNext = false;
+  m_presentNow = false;
+}
+
+bool PhasePlayer::active() const
+{
+  return m_scene != nullptr;
+}
+
+void PhasePlayer::setPlaying(bool playing)
+{
+  if (playing && !m_playing)
+    m_shownAt = Clock::now();
+  m_playing = playing;
+}
+
+bool PhasePlayer::playing() const
+{
+  return m_playing;
+}
+
+void PhasePlayer::setRate(float phasesPerSecond)
+{
+  if (phasesPerSecond > 0.f)
+    m_rate = phasesPerSecond;
+}
+
+float PhasePlayer::rate() const
+{
+  return m_rate;
+}
+
+void PhasePlayer::seek(size_t phase)
+{
+  if (!m_scene || phase >= m_numPhases)
+    return;
+  if (m_next != phase)
+    cancel();
+  else
+    wait();
+  if (m_haveNext && m_next == phase) {
+    m_presentNow = true;
+    return;
+  }
+  m_haveNext = false; // the back field is converted again
+  if (phase == m_phase)
+    return;
+  m_presentNow = true;
+  prefetch(phase);
+}
+
+void PhasePlayer::refresh()
+{
+  if (!m_scene)
+    return;
+  cancel();
+  m_haveNext = false;
+  m_presentNow = true;
+  prefetch(m_phase);
+}
+
+void PhasePlayer::cancel()
+{
+  m_jobToken.cancel();
+  wait();
+}
+
+void PhasePlayer::wait()
+{
+  if (!m_job.valid())
+    return;
+  try {
+    m_haveNext = m_job.get();
+  } catch (const std::future_error &) {
+    m_haveNext = false; // cancelled before it started
+    return;
+  }
+  if (!m_haveNext) {
+    fprintf(stderr, "Phase %zu could not be converted\n", m_next);
+    m_playing = false;
+    m_presentNow = false;
+  }
+}
+
+void PhasePlayer::update()
+{
+  if (!m_scene)
+    return;
+  if (m_job.valid()) {
+    if (m_job.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      return;
+    wait();
+  }
+
+  if (m_haveNext) {
+    const auto now = Clock::now();
+    const auto period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / m_rate));
+    if (!m_presentNow && (!m_playing || now - m_shownAt < period))
+      return;
+    m_scene->presentBackField(m_nextLayout);
+    m_phase = m_next;
+    m_haveNext = false;
+    // a steady rate; after a stall the clock restarts instead of catching up
+    m_shownAt = m_presentNow || now - m_shownAt > 2 * period
+        ? now
+        : m_shownAt + period;
+    m_presentNow = false;
+  }
+
+  if (m_playing && m_numPhases > 1)
+    prefetch((m_phase + 1) % m_numPhases);
+}
+
+size_t PhasePlayer::phase() const
+{
+  return m_phase;
+}
+
+size_t PhasePlayer::numPhases() const
+{
+  return m_numPhases;
+}
+
+void PhasePlayer::prefetch(size_t phase)
+{
+  void *dst = m_scene->mapBackField(m_layout);
+  if (!dst) {
+    fprintf(stderr, "Playback stopped: the field cannot be double-buffered\n");
+    m_playing = false;
+    return;
+  }
+  m_next = phase;
+  m_nextLayout = m_layout;
+  auto convert = [this, phase, dst]() {
+    TRACE_SCOPE("volume", "convert phase");
+    return m_convert(phase, dst, m_nextLayout);
+  };
+  if (m_scheduler) {
+    m_jobToken = CancelToken();
+    m_job = m_scheduler->submit(TaskPriority::Prefetch, m_jobToken, convert);
+  } else {
+    m_job = std::async(std::launch::async, convert);
+  }
+}
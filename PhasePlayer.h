@@ -0,0 +1,99 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <chrono>
+#include <functional>
+#include <future>
+// ours
+#include "FieldTypes.h"
+#include "TaskScheduler.h"
+#include "VolumeScene.h"
+
+// Time-varying volume playback //////////////////////////////////////////////
+//
+// The volumes of a session as phases of one grid (e.g. respiratory-gated 4D
+// CT), played in a loop. The scene's field and its back field take turns:
+// while one phase is shown a worker thread converts the next into the back
+// field's mapped data array, and update() swaps it onto the volume once it
+// is due. The UI thread only maps, commits and swaps, so a conversion slower
+// than the rate delays the next phase, never a frame.
+
+class PhasePlayer
+{
+ public:
+  // Writes phase `phase` into dst (the voxels of the layout passed to
+  // start()) and may set the layout's macrocells; runs on the worker thread
+  using ConvertFunc =
+      std::function<bool(size_t phase, void *dst, StructuredField &layout)>;
+
+  PhasePlayer() = default;
+  ~PhasePlayer();
+
+  PhasePlayer(const PhasePlayer &) = delete;
+  PhasePlayer &operator=(const PhasePlayer &) = delete;
+
+  // Conversions run on the scheduler at prefetch priority (on a thread of
+  // their own without one); one superseded by seek() or refresh() before it
+  // started is dropped
+  void setScheduler(TaskScheduler *scheduler);
+
+  // The scene shows phase 0 in a field of `layout` (geometry and cell
+  // type, no voxels needed) it can update in place; false if it cannot.
+  // Nothing else may replace the scene's field until stop().
+  bool start(VolumeScene &scene,
+      const StructuredField &layout,
+      size_t numPhases,
+      ConvertFunc convert);
+  // Waits for a running conversion and releases the back field
+  void stop();
+  bool active() const;
+
+  void setPlaying(bool playing);
+  bool playing() const;
+  void setRate(float phasesPerSecond);
+  float rate() const;
+
+  // Shows `phase` as soon as it is converted (and pauses there unless
+  // playing)
+  void seek(size_t phase);
+  // Converts the shown phase again, e.g. after a LUT switch; call cancel()
+  // or wait() before changing what the conversion reads
+  void refresh();
+  // Drops a conversion that has not started, waits for a running one
+  void cancel();
+  void wait();
+
+  // Once per frame on the UI thread
+  void update();
+
+  size_t phase() const; // the one shown
+  size_t numPhases() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  void prefetch(size_t phase);
+
+  VolumeScene *m_scene{nullptr};
+  StructuredField m_layout;
+  size_t m_numPhases{0};
+  ConvertFunc m_convert;
+
+  bool m_playing{false};
+  float m_rate{10.f};
+  size_t m_phase{0};
+  Clock::time_point m_shownAt;
+
+  // phase in (or being converted into) the back field, its macrocells;
+  // m_nextLayout belongs to the worker while m_job is valid
+  size_t m_next{0};
+  bool m_haveNext{false};
+  bool m_presentNow{false}; // seek() and refresh() skip the wait
+  StructuredField m_nextLayout;
+  std::future<bool> m_job;
+  TaskScheduler *m_scheduler{nullptr};
+  CancelToken m_jobToken;
+};
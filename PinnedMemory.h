@@ -0,0 +1,94 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+// std
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#ifdef HAVE_CUDA
+// cuda
+#include <cuda_runtime.h>
+#endif
+
+// Page-locked host memory for frame readback. CUDA builds allocate with
+// cudaHostAlloc, so device-to-host copies into it are DMA transfers at full
+// PCIe bandwidth instead of being staged through a driver buffer; other
+// builds lock page-aligned memory with mlock() (best effort), which keeps
+// the buffers resident but does not change how the device copies.
+template <typename T>
+struct PinnedAllocator
+{
+  using value_type = T;
+
+  PinnedAllocator() = default;
+  template <typename U>
+  PinnedAllocator(const PinnedAllocator<U> &)
+  {}
+
+  T *allocate(size_t n)
+  {
+    const size_t bytes = n * sizeof(T);
+#ifdef HAVE_CUDA
+    void *p = nullptr;
+    if (cudaHostAlloc(&p, bytes, cudaHostAllocPortable) == cudaSuccess)
+      return static_cast<T *>(p);
+    cudaGetLastError(); // no CUDA device: pageable memory
+#endif
+    const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    void *q = std::aligned_alloc(page, (bytes + page - 1) / page * page);
+    if (!q)
+      throw std::bad_alloc();
+    mlock(q, bytes);
+    return static_cast<T *>(q);
+  }
+
+  void deallocate(T *p, size_t n)
+  {
+#ifdef HAVE_CUDA
+    cudaPointerAttributes attributes;
+    if (cudaPointerGetAttributes(&attributes, p) == cudaSuccess
+        && attributes.type == cudaMemoryTypeHost) {
+      cudaFreeHost(p);
+      return;
+    }
+    cudaGetLastError();
+#endif
+    munlock(p, n * sizeof(T));
+    std::free(p);
+  }
+
+  template <typename U>
+  bool operator==(const PinnedAllocator<U> &) const
+  {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const PinnedAllocator<U> &) const
+  {
+    return false;
+  }
+};
+
+template <typename T>
+using PinnedVector = std::vector<T, PinnedAllocator<T>>;
+
+// Copies a mapped frame channel to the host; `onDevice` channels (mapped
+// as device memory) need a CUDA build and fail otherwise
+inline bool copyToHost(void *dst, const void *src, size_t bytes, bool onDevice)
+{
+  if (!onDevice) {
+    std::memcpy(dst, src, bytes);
+    return true;
+  }
+#ifdef HAVE_CUDA
+  return cudaMemcpy(dst, src, bytes, cudaMemcpyDeviceToHost) == cudaSuccess;
+#else
+  return false;
+#endif
+}
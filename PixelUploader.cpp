@@ -0,0 +1,138 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "PixelUploader.h"
+// std
+#include <cstring>
+// ours
+#include "Trace.h"
+
+static bool hasBufferStorage()
+{
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  return major > 4 || (major == 4 && minor >= 4);
+}
+
+PixelUploader::~PixelUploader()
+{
+  free();
+}
+
+size_t PixelUploader::bytes() const
+{
+  return m_capacity * NumBuffers;
+}
+
+bool PixelUploader::persistent() const
+{
+  return m_persistent;
+}
+
+void PixelUploader::upload(GLuint texture,
+    int width,
+    int height,
+    const void *pixels,
+    GLenum format,
+    GLenum type)
+{
+  TRACE_SCOPE("gl", "PBO upload");
+  if (!m_initialized) {
+    m_persistent = hasBufferStorage();
+    m_initialized = true;
+  }
+
+  const size_t bytes = size_t(width) * height * 4;
+  if (bytes > m_capacity)
+    allocate(bytes);
+
+  const size_t i = m_next;
+  m_next = (m_next + 1) % NumBuffers;
+
+  // The fence was set after the last texture update sourced from this
+  // buffer; with three buffers this almost never blocks
+  if (m_fences[i]) {
+    glClientWaitSync(m_fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1e9));
+    glDeleteSync(m_fences[i]);
+    m_fences[i] = nullptr;
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[i]);
+
+  if (m_persistent) {
+    std::memcpy(m_mapped[i], pixels, bytes);
+    glFlushMappedBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes);
+    glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+  } else {
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+        0,
+        bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (dst) {
+      std::memcpy(dst, pixels, bytes);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+  }
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexSubImage2D(GL_TEXTURE_2D,
+      0,
+      0,
+      0,
+      width,
+      height,
+      format,
+      type,
+      nullptr);
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  m_fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void PixelUploader::allocate(size_t bytes)
+{
+  free();
+
+  glGenBuffers(NumBuffers, m_buffers.data());
+  for (size_t i = 0; i < NumBuffers; ++i) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[i]);
+    if (m_persistent) {
+      const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT;
+      glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, flags);
+      m_mapped[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+          0,
+          bytes,
+          flags | GL_MAP_FLUSH_EXPLICIT_BIT);
+    } else {
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  m_capacity = bytes;
+}
+
+void PixelUploader::free()
+{
+  if (m_capacity == 0)
+    return;
+
+  for (size_t i = 0; i < NumBuffers; ++i) {
+    if (m_fences[i]) {
+      glDeleteSync(m_fences[i]);
+      m_fences[i] = nullptr;
+    }
+    if (m_mapped[i]) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[i]);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      m_mapped[i] = nullptr;
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glDeleteBuffers(NumBuffers, m_buffers.data());
+  m_buffers.fill(0);
+  m_capacity = 0;
+  m_next = 0;
+}
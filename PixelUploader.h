@@ -0,0 +1,54 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// glad
+#include "glad/glad.h"
+// std
+#include <array>
+#include <cstddef>
+
+// Streams frames of 4 bytes per pixel (RGBA8, or one float for linear
+// frames) into a GL texture through a small ring of pixel buffer objects.
+// Each upload copies into a buffer the GPU is done with (guarded by a
+// fence) and the texture update is sourced from that buffer, so
+// glTexSubImage2D returns without waiting for the transfer.
+//
+// Uses persistently mapped buffers (GL 4.4 / ARB_buffer_storage) when
+// available, otherwise orphaned glMapBufferRange buffers.
+class PixelUploader
+{
+ public:
+  PixelUploader() = default;
+  ~PixelUploader();
+
+  PixelUploader(const PixelUploader &) = delete;
+  PixelUploader &operator=(const PixelUploader &) = delete;
+
+  // Must be called with the GL context current
+  void upload(GLuint texture,
+      int width,
+      int height,
+      const void *pixels,
+      GLenum format = GL_RGBA,
+      GLenum type = GL_UNSIGNED_BYTE);
+
+  bool persistent() const;
+  // GL memory of the pixel buffers
+  size_t bytes() const;
+
+ private:
+  static constexpr size_t NumBuffers = 3;
+
+  void allocate(size_t bytes);
+  void free();
+
+  std::array<GLuint, NumBuffers> m_buffers{};
+  std::array<void *, NumBuffers> m_mapped{};
+  std::array<GLsync, NumBuffers> m_fences{};
+  size_t m_capacity{0};
+  size_t m_next{0};
+  bool m_persistent{false};
+  bool m_initialized{false};
+};
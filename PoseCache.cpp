@@ -0,0 +1,197 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "PoseCache.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+#pragma pack(push, 1)
+struct FileHeader
+{
+  char magic[8]{'D', 'R', 'R', 'P', 'C', 'A', 'C', '1'};
+  uint32_t recordSize{0};
+  uint32_t reserved{0};
+};
+#pragma pack(pop)
+
+struct Record
+{
+  uint64_t key;
+  float eye[3], center[3], up[3];
+  float poseDelta, ncc, gradientCorrelation, mutualInformation;
+  uint32_t updated, iterations, reserved;
+};
+static_assert(sizeof(Record) == 72);
+
+// FNV-1a
+struct Hash
+{
+  uint64_t value{14695981039346656037ull};
+
+  void add(const void *data, size_t size)
+  {
+    auto *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i) {
+      value ^= p[i];
+      value *= 1099511628211ull;
+    }
+  }
+
+  void add(const std::string &s)
+  {
+    add(s.data(), s.size());
+    add("", 1); // separator, so "ab" + "c" differs from "a" + "bc"
+  }
+
+  void add(const std::array<float, 3> &v, float quantum)
+  {
+    for (float x : v) {
+      const int64_t q = std::llround(x / quantum);
+      add(&q, sizeof(q));
+    }
+  }
+};
+
+} // namespace
+
+PoseCache::PoseCache(float quantum) : m_quantum(quantum) {}
+
+PoseCache::~PoseCache()
+{
+  if (m_file)
+    std::fclose(m_file);
+}
+
+bool PoseCache::open(const std::string &file)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_file) {
+    std::fclose(m_file);
+    m_file = nullptr;
+  }
+
+  size_t numLoaded = 0;
+  if (FILE *in = std::fopen(file.c_str(), "rb")) {
+    FileHeader header, expected;
+    expected.recordSize = sizeof(Record);
+    const bool ok = std::fread(&header, sizeof(header), 1, in) == 1
+        && std::memcmp(header.magic, expected.magic, 8) == 0
+        && header.recordSize == expected.recordSize;
+    Record r;
+    while (ok && std::fread(&r, sizeof(r), 1, in) == 1) {
+      Entry e;
+      e.updated = r.updated != 0;
+      std::copy_n(r.eye, 3, e.eye.begin());
+      std::copy_n(r.center, 3, e.center.begin());
+      std::copy_n(r.up, 3, e.up.begin());
+      e.poseDelta = r.poseDelta;
+      e.ncc = r.ncc;
+      e.gradientCorrelation = r.gradientCorrelation;
+      e.mutualInformation = r.mutualInformation;
+      e.iterations = r.iterations;
+      m_entries[r.key] = e; // later records win
+      ++numLoaded;
+    }
+    std::fclose(in);
+    if (!ok) {
+      std::cerr << "Not a pose cache: " << file << "\n";
+      return false;
+    }
+    // a torn record at the end is dropped, so appends stay aligned
+    const auto size = sizeof(FileHeader) + numLoaded * sizeof(Record);
+    std::error_code ec;
+    if (std::filesystem::file_size(file, ec) != size)
+      std::filesystem::resize_file(file, size, ec);
+  }
+
+  const bool exists = std::filesystem::exists(file);
+  m_file = std::fopen(file.c_str(), "ab");
+  if (!m_file) {
+    std::cerr << "Could not open pose cache " << file << "\n";
+    return false;
+  }
+  if (!exists) {
+    FileHeader header;
+    header.recordSize = sizeof(Record);
+    std::fwrite(&header, sizeof(header), 1, m_file);
+    std::fflush(m_file);
+  }
+  if (numLoaded)
+    std::cout << "Pose cache " << file << ": " << m_entries.size()
+              << " matches\n";
+  return true;
+}
+
+void PoseCache::setContext(const std::string &context)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_context = context;
+}
+
+uint64_t PoseCache::key(const std::string &reference,
+    const std::array<float, 3> &eye,
+    const std::array<float, 3> &center,
+    const std::array<float, 3> &up,
+    const std::string &matcher) const
+{
+  Hash h;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    h.add(m_context);
+  }
+  h.add(reference);
+  h.add(eye, m_quantum);
+  h.add(center, m_quantum);
+  h.add(up, 1e-4f);
+  h.add(matcher);
+  return h.value;
+}
+
+bool PoseCache::get(uint64_t key, Entry &entry) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(key);
+  if (it == m_entries.end())
+    return false;
+  entry = it->second;
+  return true;
+}
+
+void PoseCache::put(uint64_t key, const Entry &entry)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries[key] = entry;
+  if (!m_file)
+    return;
+
+  Record r{};
+  r.key = key;
+  std::copy_n(entry.eye.begin(), 3, r.eye);
+  std::copy_n(entry.center.begin(), 3, r.center);
+  std::copy_n(entry.up.begin(), 3, r.up);
+  r.poseDelta = entry.poseDelta;
+  r.ncc = entry.ncc;
+  r.gradientCorrelation = entry.gradientCorrelation;
+  r.mutualInformation = entry.mutualInformation;
+  r.updated = entry.updated;
+  r.iterations = entry.iterations;
+  // flushed per record: a run killed halfway resumes from here
+  if (std::fwrite(&r, sizeof(r), 1, m_file) != 1
+      || std::fflush(m_file) != 0) {
+    std::cerr << "Could not write to the pose cache\n";
+    std::fclose(m_file);
+    m_file = nullptr;
+  }
+}
+
+size_t PoseCache::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.size();
+}
@@ -0,0 +1,61 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Outcomes of matches already run, so that matching the same reference from
+// the same starting pose again returns at once. Keys hash the reference
+// image (its file name), the starting pose rounded to a grid, the matcher
+// with its parameters, and a context set once for everything else that
+// changes the DRR (volume, renderer). Entries live for the session and,
+// with a file, across sessions: the file is append-only, read on open()
+// and written through on every put(), so an interrupted run leaves all
+// finished matches behind (a torn last record is ignored).
+class PoseCache
+{
+ public:
+  struct Entry
+  {
+    bool updated{false}; // the matcher returned a pose
+    std::array<float, 3> eye{}, center{}, up{};
+    float poseDelta{0.f};
+    float ncc{0.f}, gradientCorrelation{0.f}, mutualInformation{0.f};
+    uint32_t iterations{0};
+  };
+
+  // Eye and center are rounded to multiples of quantum (world units), up
+  // to 1e-4
+  explicit PoseCache(float quantum = 1e-3f);
+  ~PoseCache();
+
+  PoseCache(const PoseCache &) = delete;
+  PoseCache &operator=(const PoseCache &) = delete;
+
+  // Loads the entries in file, if it exists, and appends new ones to it
+  bool open(const std::string &file);
+  void setContext(const std::string &context);
+
+  uint64_t key(const std::string &reference,
+      const std::array<float, 3> &eye,
+      const std::array<float, 3> &center,
+      const std::array<float, 3> &up,
+      const std::string &matcher) const;
+  bool get(uint64_t key, Entry &entry) const;
+  void put(uint64_t key, const Entry &entry);
+  size_t size() const;
+
+ private:
+  float m_quantum{1e-3f};
+  std::string m_context;
+  std::unordered_map<uint64_t, Entry> m_entries;
+  FILE *m_file{nullptr};
+  mutable std::mutex m_mutex;
+};
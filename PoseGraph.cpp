@@ -0,0 +1,90 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "PoseGraph.h"
+// std
+#include <algorithm>
+#include <numeric>
+
+PoseKdTree::PoseKdTree(const std::vector<prediction> &poses)
+{
+  m_points.reserve(poses.size());
+  for (auto &p : poses)
+    m_points.push_back(point(p));
+  m_nodes.resize(m_points.size());
+  std::iota(m_nodes.begin(), m_nodes.end(), size_t(0));
+  build(0, m_nodes.size(), 0);
+}
+
+PoseKdTree::Point PoseKdTree::point(const prediction &pose)
+{
+  return {pose.eye.x,
+      pose.eye.y,
+      pose.eye.z,
+      pose.center.x,
+      pose.center.y,
+      pose.center.z};
+}
+
+size_t PoseKdTree::size() const
+{
+  return m_points.size();
+}
+
+float PoseKdTree::distance2(const Point &a, const Point &b)
+{
+  float d = 0.f;
+  for (size_t i = 0; i < a.size(); ++i)
+    d += (a[i] - b[i]) * (a[i] - b[i]);
+  return d;
+}
+
+void PoseKdTree::build(size_t begin, size_t end, size_t depth)
+{
+  if (end - begin <= 1)
+    return;
+  const size_t mid = begin + (end - begin) / 2;
+  const size_t axis = depth % 6;
+  std::nth_element(m_nodes.begin() + begin,
+      m_nodes.begin() + mid,
+      m_nodes.begin() + end,
+      [&](size_t a, size_t b) { return m_points[a][axis] < m_points[b][axis]; });
+  build(begin, mid, depth + 1);
+  build(mid + 1, end, depth + 1);
+}
+
+bool parseWarmStartOrder(const std::string &name, WarmStartOrder &order)
+{
+  if (name == "none")
+    order = WarmStartOrder::None;
+  else if (name == "sequence")
+    order = WarmStartOrder::Sequence;
+  else if (name == "proximity")
+    order = WarmStartOrder::Proximity;
+  else
+    return false;
+  return true;
+}
+
+std::vector<size_t> registrationOrder(
+    const std::vector<prediction> &poses, WarmStartOrder order)
+{
+  std::vector<size_t> result(poses.size());
+  std::iota(result.begin(), result.end(), size_t(0));
+  if (order != WarmStartOrder::Proximity || poses.size() < 3)
+    return result;
+
+  // greedy walk: always on to the nearest pose not visited yet
+  PoseKdTree tree(poses);
+  std::vector<uint8_t> visited(poses.size(), 0);
+  size_t current = 0;
+  for (size_t i = 0; i < poses.size(); ++i) {
+    result[i] = current;
+    visited[current] = 1;
+    current = tree.nearest(PoseKdTree::point(poses[current]),
+        [&](size_t index) { return !visited[index]; });
+    if (current == SIZE_MAX)
+      break;
+  }
+  return result;
+}
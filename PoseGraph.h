@@ -0,0 +1,107 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+// ours
+#include "prediction.h"
+
+// k-d tree over the eye and center of poses, one 6D point each. Built once;
+// queries take a filter, so "the nearest pose solved so far" needs no
+// rebuild as poses get solved.
+class PoseKdTree
+{
+ public:
+  using Point = std::array<float, 6>;
+
+  PoseKdTree() = default;
+  explicit PoseKdTree(const std::vector<prediction> &poses);
+
+  static Point point(const prediction &pose);
+
+  // Index of the point nearest to `query` for which accept(index) is true,
+  // SIZE_MAX if there is none
+  template <typename Accept>
+  size_t nearest(const Point &query, Accept &&accept) const
+  {
+    size_t best = SIZE_MAX;
+    float bestDistance = std::numeric_limits<float>::max();
+    search(0, m_nodes.size(), 0, query, accept, best, bestDistance);
+    return best;
+  }
+
+  size_t size() const;
+
+ private:
+  static float distance2(const Point &a, const Point &b);
+
+  // nodes [begin, end) form a subtree rooted at their middle, split on
+  // axis depth % 6
+  template <typename Accept>
+  void search(size_t begin,
+      size_t end,
+      size_t depth,
+      const Point &query,
+      Accept &accept,
+      size_t &best,
+      float &bestDistance) const
+  {
+    if (begin >= end)
+      return;
+    const size_t mid = begin + (end - begin) / 2;
+    const size_t index = m_nodes[mid];
+    const Point &p = m_points[index];
+    const float d = distance2(query, p);
+    if (d < bestDistance && accept(index)) {
+      best = index;
+      bestDistance = d;
+    }
+
+    const size_t axis = depth % 6;
+    const float offset = query[axis] - p[axis];
+    const bool left = offset < 0.f;
+    search(left ? begin : mid + 1,
+        left ? mid : end,
+        depth + 1,
+        query,
+        accept,
+        best,
+        bestDistance);
+    if (offset * offset < bestDistance) {
+      search(left ? mid + 1 : begin,
+          left ? end : mid,
+          depth + 1,
+          query,
+          accept,
+          best,
+          bestDistance);
+    }
+  }
+
+  void build(size_t begin, size_t end, size_t depth);
+
+  std::vector<Point> m_points;
+  std::vector<size_t> m_nodes; // point indices in tree order
+};
+
+// Order poses are registered in when each warm-starts from a solved
+// neighbour: the file's (frames of a sequence), or a nearest-neighbour walk
+// from the first pose, so the neighbour is usually the pose just solved
+enum class WarmStartOrder
+{
+  None, // every registration starts from its prediction
+  Sequence,
+  Proximity,
+};
+
+bool parseWarmStartOrder(const std::string &name, WarmStartOrder &order);
+
+std::vector<size_t> registrationOrder(
+    const std::vector<prediction> &poses, WarmStartOrder order);
@@ -0,0 +1,173 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "PoseSampler.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+// ours
+#include "Rotation.h"
+
+namespace {
+
+using float3 = anari::math::float3;
+
+uint64_t splitmix64(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// Draws of one sample (or shard), a function of (seed, stream, index)
+struct Random
+{
+  uint64_t state;
+
+  Random(uint64_t seed, uint64_t stream, uint64_t index)
+      : state(splitmix64(seed ^ splitmix64(stream ^ splitmix64(index))))
+  {}
+
+  // [0, 1)
+  float uniform()
+  {
+    state = splitmix64(state);
+    return float(state >> 40) * 0x1p-24f;
+  }
+
+  // [-1, 1)
+  float symmetric()
+  {
+    return 2.f * uniform() - 1.f;
+  }
+
+  float3 direction()
+  {
+    const float z = symmetric();
+    const float phi = 6.2831853f * uniform();
+    const float r = std::sqrt(std::max(0.f, 1.f - z * z));
+    return float3(r * std::cos(phi), r * std::sin(phi), z);
+  }
+};
+
+constexpr float g_radians = 3.14159265f / 180.f;
+
+} // namespace
+
+uint64_t PoseSamplerSettings::numShards() const
+{
+  const uint64_t size = std::max<uint64_t>(shardSize, 1);
+  return (count + size - 1) / size;
+}
+
+bool PoseSamplerSettings::parse(
+    const std::string &text, PoseSamplerSettings &settings)
+{
+  PoseSamplerSettings result;
+  std::stringstream list(text);
+  std::string item;
+  while (std::getline(list, item, ',')) {
+    std::vector<std::string> fields;
+    std::stringstream parts(item);
+    std::string field;
+    while (std::getline(parts, field, ':'))
+      fields.push_back(field);
+    if (fields.size() < 2)
+      return false;
+    std::vector<double> v;
+    for (size_t i = 1; i < fields.size(); ++i) {
+      char *end = nullptr;
+      v.push_back(std::strtod(fields[i].c_str(), &end));
+      if (end == fields[i].c_str() || *end != '\0' || v.back() < 0.0)
+        return false;
+    }
+    const std::string &key = fields[0];
+    if (key == "luts") {
+      result.luts.clear();
+      for (double id : v)
+        result.luts.push_back(uint32_t(id));
+    } else if (key == "energy" && v.size() == 2 && v[0] <= v[1]) {
+      result.energy[0] = float(v[0]);
+      result.energy[1] = float(v[1]);
+    } else if (v.size() != 1) {
+      return false;
+    } else if (key == "count") {
+      result.count = uint64_t(v[0]);
+    } else if (key == "seed") {
+      result.seed = uint64_t(v[0]);
+    } else if (key == "rotate") {
+      result.rotation = float(v[0]);
+    } else if (key == "roll") {
+      result.roll = float(v[0]);
+    } else if (key == "shift") {
+      result.translation = float(v[0]);
+    } else if (key == "distance") {
+      result.distance = std::min(float(v[0]), 0.9f);
+    } else if (key == "shard" && v[0] >= 1.0) {
+      result.shardSize = uint64_t(v[0]);
+    } else {
+      return false;
+    }
+  }
+  if (result.count == 0)
+    return false;
+  settings = std::move(result);
+  return true;
+}
+
+PoseSampler::PoseSampler(
+    std::vector<prediction> bases, PoseSamplerSettings settings)
+    : m_bases(std::move(bases)), m_settings(std::move(settings))
+{}
+
+const PoseSamplerSettings &PoseSampler::settings() const
+{
+  return m_settings;
+}
+
+PoseSample PoseSampler::sample(uint64_t index) const
+{
+  PoseSample s{m_bases[index % m_bases.size()]};
+  s.base = uint32_t(index % m_bases.size());
+  shardBeam(index / std::max<uint64_t>(m_settings.shardSize, 1),
+      s.lut,
+      s.photonEnergy);
+
+  Random random(m_settings.seed, 0, index);
+  auto &p = s.pose;
+  float3 offset = p.eye - p.center;
+  float3 up = p.up;
+
+  const float angle = m_settings.rotation * g_radians * random.symmetric();
+  const float3 axis = random.direction();
+  offset = rotate(offset, axis, angle);
+  up = rotate(up, axis, angle);
+
+  const float roll = m_settings.roll * g_radians * random.symmetric();
+  up = rotate(up, anari::math::normalize(offset), roll);
+
+  offset = offset * (1.f + m_settings.distance * random.symmetric());
+
+  const float t = m_settings.translation;
+  const float3 shift(
+      t * random.symmetric(), t * random.symmetric(), t * random.symmetric());
+  p.center = p.center + shift;
+  p.eye = p.center + offset;
+  p.up = up;
+  return s;
+}
+
+void PoseSampler::shardBeam(
+    uint64_t shard, uint32_t &lut, float &photonEnergy) const
+{
+  Random random(m_settings.seed, 1, shard);
+  const auto &luts = m_settings.luts;
+  lut = luts.empty() ? UINT32_MAX
+                     : luts[std::min(size_t(random.uniform() * luts.size()),
+                         luts.size() - 1)];
+  const float lo = m_settings.energy[0], hi = m_settings.energy[1];
+  photonEnergy = lo + (hi - lo) * random.uniform();
+}
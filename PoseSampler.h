@@ -0,0 +1,65 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+#include <vector>
+// ours
+#include "prediction.h"
+
+// Random poses for dataset generation ///////////////////////////////////////
+//
+// Sample i perturbs base pose i % (number of bases): the eye orbits the
+// center by up to `rotation` degrees about a random axis, the view rolls by
+// up to `roll`, eye and center shift together by up to `translation` per
+// axis, and their distance scales by up to +-`distance`. LUT and photon
+// energy are drawn per shard, so a renderer switches them once per shard
+// rather than per image. Every draw is hashed from (seed, index), so a
+// sample is the same whichever device renders it and in whatever order.
+
+struct PoseSamplerSettings
+{
+  uint64_t count{0};
+  uint64_t seed{0};
+  float rotation{0.f}; // degrees
+  float roll{0.f}; // degrees
+  float translation{0.f}; // world units
+  float distance{0.f}; // relative
+  std::vector<uint32_t> luts; // empty: the active LUT
+  float energy[2]{0.f, 0.f}; // keV; 0: the renderer's default
+  uint64_t shardSize{1000}; // samples per shard file
+
+  uint64_t numShards() const;
+
+  // Comma-separated "<key>:<value>" with keys count, seed, rotate, roll,
+  // shift, distance, shard, "energy:<lo>:<hi>" and "luts:<id>[:<id>...]";
+  // false, leaving the settings untouched, on anything else or without a
+  // count
+  static bool parse(const std::string &text, PoseSamplerSettings &settings);
+};
+
+struct PoseSample
+{
+  prediction pose;
+  uint32_t base{0}; // index of the base pose
+  uint32_t lut{0}; // UINT32_MAX: the active LUT
+  float photonEnergy{0.f}; // keV, 0: the renderer's default
+};
+
+class PoseSampler
+{
+ public:
+  PoseSampler(std::vector<prediction> bases, PoseSamplerSettings settings);
+
+  const PoseSamplerSettings &settings() const;
+  PoseSample sample(uint64_t index) const;
+  // LUT and energy shared by the shard's samples
+  void shardBeam(uint64_t shard, uint32_t &lut, float &photonEnergy) const;
+
+ private:
+  std::vector<prediction> m_bases;
+  PoseSamplerSettings m_settings;
+};
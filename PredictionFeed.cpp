@@ -0,0 +1,152 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "PredictionFeed.h"
+// std
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+// posix
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+PredictionFeed::PredictionFeed(std::string filename, TaskScheduler &scheduler)
+    : m_filename(std::move(filename)), m_scheduler(scheduler)
+{}
+
+PredictionFeed::~PredictionFeed()
+{
+  m_token.cancelAndWait();
+}
+
+bool PredictionFeed::poll()
+{
+  const int fd = open(m_filename.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (!m_missing)
+      std::cerr << "Waiting for prediction feed " << m_filename << "\n";
+    m_missing = true;
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  m_missing = false;
+
+  const uint64_t size = uint64_t(st.st_size);
+  if (uint64_t(st.st_ino) != m_inode || size < m_offset) {
+    if (m_inode != 0)
+      std::cout << "Prediction feed " << m_filename << " was replaced\n";
+    m_inode = uint64_t(st.st_ino);
+    m_offset = 0;
+    m_partial.clear();
+  }
+  if (size == m_offset) {
+    close(fd);
+    return false;
+  }
+
+  // the line cut short last time first
+  std::string data = std::move(m_partial);
+  m_partial.clear();
+  const size_t begin = data.size();
+  data.resize(begin + size_t(std::min<uint64_t>(size - m_offset, maxRead)));
+  size_t read = begin;
+  while (read < data.size()) {
+    const ssize_t n =
+        pread(fd, data.data() + read, data.size() - read, off_t(m_offset));
+    if (n <= 0)
+      break;
+    read += size_t(n);
+    m_offset += uint64_t(n);
+  }
+  close(fd);
+  data.resize(read);
+
+  const size_t end = data.rfind('\n');
+  if (end == std::string::npos) {
+    m_partial = std::move(data);
+    return read > begin;
+  }
+  m_partial = data.substr(end + 1);
+  data.resize(end + 1);
+  m_chunks.push_back(m_scheduler.submit(TaskPriority::Prefetch,
+      m_token,
+      [lines = std::move(data)]() { return parse(lines); }));
+  return true;
+}
+
+size_t PredictionFeed::take(prediction_container &predictions)
+{
+  size_t count = 0;
+  while (!m_chunks.empty()
+      && m_chunks.front().wait_for(std::chrono::seconds(0))
+          == std::future_status::ready) {
+    Chunk chunk;
+    try {
+      chunk = m_chunks.front().get();
+    } catch (const std::future_error &) {
+      // cancelled
+    }
+    m_chunks.pop_front();
+
+    if (chunk.numBadLines > 0) {
+      std::cerr << "Skipped " << chunk.numBadLines << " lines of "
+                << m_filename << "\n";
+      m_numBadLines += chunk.numBadLines;
+    }
+    auto &parsed = chunk.predictions;
+    if (parsed.fovy > 0.f) {
+      predictions.fovx = parsed.fovx;
+      predictions.fovy = parsed.fovy;
+      predictions.sensor_width = parsed.sensor_width;
+      predictions.sensor_height = parsed.sensor_height;
+      predictions.intrinsics = parsed.intrinsics;
+    }
+    predictions.predictions.insert(predictions.predictions.end(),
+        std::make_move_iterator(parsed.predictions.begin()),
+        std::make_move_iterator(parsed.predictions.end()));
+    count += parsed.predictions.size();
+  }
+  return count;
+}
+
+const std::string &PredictionFeed::filename() const
+{
+  return m_filename;
+}
+
+size_t PredictionFeed::numBadLines() const
+{
+  return m_numBadLines;
+}
+
+PredictionFeed::Chunk PredictionFeed::parse(const std::string &lines)
+{
+  Chunk chunk;
+  for (size_t begin = 0; begin < lines.size();) {
+    size_t end = lines.find('\n', begin);
+    if (end == std::string::npos)
+      end = lines.size();
+    const char *first = lines.data() + begin;
+    const char *last = lines.data() + end;
+    begin = end + 1;
+    const auto blank = [](unsigned char c) { return std::isspace(c) != 0; };
+    if (std::all_of(first, last, blank))
+      continue;
+    try {
+      const auto entry = nlohmann::json::parse(first, last);
+      if (entry.contains("sensor"))
+        chunk.predictions.read_sensor(entry.at("sensor"));
+      else
+        chunk.predictions.predictions.push_back(
+            prediction_container::from_json(entry));
+    } catch (const std::exception &) {
+      ++chunk.numBadLines;
+    }
+  }
+  return chunk;
+}
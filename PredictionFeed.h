@@ -0,0 +1,72 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <string>
+// ours
+#include "TaskScheduler.h"
+#include "prediction.h"
+
+// Predictions appended to a JSON lines file while the viewer runs, e.g. by
+// a pipeline predicting poses as images come off the detector. One object
+// per line, a pose like an entry of the JSON file's "predictions" array or
+// a sensor block:
+//
+//   {"sensor": {"fov_x_rad": 0.3, "fov_y_rad": 0.3}}
+//   {"file": "img_0042.png", "eye": {"x": 0, "y": 0, "z": 600},
+//    "center": {"x": 0, "y": 0, "z": 0}, "up": {"x": 0, "y": 1, "z": 0}}
+//
+// poll() reads what was appended since the last poll and hands the complete
+// lines to the scheduler's workers, which parse them; a line still being
+// written waits for the next poll. take() appends the parsed predictions to
+// the container in file order, so the poses already loaded are neither
+// parsed nor copied again. A file that shrinks or is replaced (rotated) is
+// read from its start again.
+class PredictionFeed
+{
+ public:
+  // Parsed on the scheduler's workers at prefetch priority
+  PredictionFeed(std::string filename, TaskScheduler &scheduler);
+  ~PredictionFeed(); // drops the lines not parsed yet
+
+  PredictionFeed(const PredictionFeed &) = delete;
+  PredictionFeed &operator=(const PredictionFeed &) = delete;
+
+  // Reads at most maxRead bytes of what was appended; true if it read any
+  // (poll again soon, there may be more)
+  bool poll();
+  // Appends the predictions parsed since the last call, stopping at the
+  // first chunk still being parsed, and takes over a sensor block; returns
+  // how many were appended
+  size_t take(prediction_container &predictions);
+
+  const std::string &filename() const;
+  size_t numBadLines() const; // not JSON or incomplete, skipped
+
+  static constexpr size_t maxRead = 4 << 20;
+
+ private:
+  struct Chunk
+  {
+    prediction_container predictions; // fovy > 0 if it had a sensor block
+    size_t numBadLines{0};
+  };
+
+  static Chunk parse(const std::string &lines);
+
+  std::string m_filename;
+  TaskScheduler &m_scheduler;
+  CancelToken m_token;
+  uint64_t m_inode{0};
+  uint64_t m_offset{0}; // read up to here
+  std::string m_partial; // of a line still being written
+  std::deque<std::future<Chunk>> m_chunks; // in file order
+  size_t m_numBadLines{0};
+  bool m_missing{false}; // reported once
+};
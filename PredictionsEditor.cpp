@@ -2,10 +2,15 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "PredictionsEditor.h"
+// ours
+#include "ThumbnailAtlas.h"
 // std
 #include <algorithm>
+#include <cfloat>
 #include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 
 namespace anari_viewer::windows {
@@ -31,23 +36,99 @@ void PredictionsEditor::buildUI()
 
   ImGui::Separator();
 
-  for (size_t i=0; i<m_predictions.predictions.size(); ++i)
-  {
-    // Button to load the camera
-    const auto loadCamera = "Load camera " + std::to_string(i);
-    if (ImGui::Button(loadCamera.c_str())) {
-      triggerUpdateCameraCallback(
-          m_predictions.predictions[i].eye,
-          m_predictions.predictions[i].center,
-          m_predictions.predictions[i].up);
-    }
+  const size_t numRows = m_filtered.size();
+  const bool filterChanged = m_filter.Draw("filter");
+  if (filterChanged)
+    m_filteredCount = SIZE_MAX;
+  updateFilter();
+  const bool appended = !filterChanged && m_filtered.size() > numRows;
+  ImGui::Text("%zu of %zu predictions",
+      m_filtered.size(),
+      m_predictions.predictions.size());
+  if (m_thumbnails) {
+    ImGui::SameLine();
+    ImGui::Checkbox("thumbnails", &m_showThumbnails);
+    m_thumbnails->update();
+  }
+  const bool thumbnails = m_thumbnails && m_showThumbnails;
 
-    // Button to show the image in the ImageViewport
-    const auto loadImage = "Load image " + std::to_string(i);
-    if (ImGui::Button(loadImage.c_str())) {
-      triggerShowImageCallback(i);
-      triggerLoadReferenceImageCallback(i);
+  // rows are selected to load the camera; "image" also shows and matches
+  // against the reference image
+  const float textHeight = ImGui::GetTextLineHeightWithSpacing();
+  const float thumbSize = 3.f * textHeight;
+  const float rowHeight = thumbnails ? thumbSize : 0.f;
+  if (ImGui::BeginTable("predictions",
+          thumbnails ? 6 : 5,
+          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg
+              | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable
+              | ImGuiTableFlags_SizingFixedFit,
+          ImVec2(0.f, textHeight * (thumbnails ? 20.f : 12.f)))) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("#");
+    if (thumbnails)
+      ImGui::TableSetupColumn("", ImGuiTableColumnFlags_WidthFixed, thumbSize);
+    ImGui::TableSetupColumn("file", ImGuiTableColumnFlags_WidthStretch);
+    ImGui::TableSetupColumn("eye");
+    ImGui::TableSetupColumn("delta");
+    ImGui::TableSetupColumn("");
+    ImGui::TableHeadersRow();
+
+    ImGuiListClipper clipper;
+    clipper.Begin(int(m_filtered.size()));
+    while (clipper.Step()) {
+      for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+        const size_t i = m_filtered[row];
+        const auto &p = m_predictions.predictions[i];
+        ImGui::PushID(int(i));
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        char label[32];
+        std::snprintf(label, sizeof(label), "%zu", i);
+        if (ImGui::Selectable(label,
+                m_selected == i,
+                ImGuiSelectableFlags_SpanAllColumns
+                    | ImGuiSelectableFlags_AllowOverlap,
+                ImVec2(0.f, rowHeight))) {
+          m_selected = i;
+          triggerUpdateCameraCallback(p.eye, p.center, p.up);
+        }
+        ImGui::TableNextColumn();
+        ThumbnailAtlas::Cell cell;
+        if (thumbnails && m_thumbnails->get(i, cell)) {
+          const ImVec2 size = cell.aspect > 1.f
+              ? ImVec2(thumbSize, thumbSize / cell.aspect)
+              : ImVec2(thumbSize * cell.aspect, thumbSize);
+          ImGui::Image((void *)(intptr_t)cell.texture,
+              size,
+              ImVec2(cell.uv0[0], cell.uv0[1]),
+              ImVec2(cell.uv1[0], cell.uv1[1]));
+          ImGui::TableNextColumn();
+        } else if (thumbnails) {
+          ImGui::Dummy(ImVec2(thumbSize, thumbSize));
+          ImGui::TableNextColumn();
+        }
+        ImGui::TextUnformatted(p.filename.c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3g %.3g %.3g", p.eye.x, p.eye.y, p.eye.z);
+        ImGui::TableNextColumn();
+        if (i < m_matchScores.size() && !std::isnan(m_matchScores[i]))
+          ImGui::Text("%.4g", m_matchScores[i]);
+        else
+          ImGui::TextDisabled("-");
+        ImGui::TableNextColumn();
+        if (ImGui::SmallButton("image")) {
+          m_selected = i;
+          triggerShowImageCallback(i);
+          triggerLoadReferenceImageCallback(i);
+        }
+        ImGui::PopID();
+      }
     }
+    // scrolled to the end, the list follows appended predictions
+    if (appended && m_followEnd)
+      ImGui::SetScrollHereY(1.f);
+    m_followEnd = ImGui::GetScrollY() >= ImGui::GetScrollMaxY();
+    ImGui::EndTable();
   }
 
   ImGui::Separator();
@@ -75,6 +156,167 @@ void PredictionsEditor::buildUI()
   if (ImGui::Button("Match")) {
     triggerMatchCallback();
   }
+  ImGui::SameLine();
+  if (ImGui::Button("Match all")) {
+    triggerMatchAllCallback();
+  }
+
+  if (!m_matchComparison.empty()
+      && ImGui::BeginTable("match comparison",
+          5,
+          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg
+              | ImGuiTableFlags_SizingFixedFit)) {
+    ImGui::TableSetupColumn("matcher");
+    ImGui::TableSetupColumn("set ms");
+    ImGui::TableSetupColumn("match ms");
+    ImGui::TableSetupColumn("delta");
+    ImGui::TableSetupColumn("");
+    ImGui::TableHeadersRow();
+    for (size_t i = 0; i < m_matchComparison.size(); ++i) {
+      const auto &c = m_matchComparison[i];
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("%s", c.matcher.c_str());
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", c.setImageMs);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", c.matchMs + c.updateMs);
+      ImGui::TableNextColumn();
+      if (c.updated)
+        ImGui::Text("%.4g", c.poseDelta);
+      else
+        ImGui::TextDisabled("no pose");
+      ImGui::TableNextColumn();
+      ImGui::PushID(int(i));
+      if (c.updated && ImGui::SmallButton("apply"))
+        triggerUpdateCameraCallback(c.eye, c.center, c.up);
+      ImGui::PopID();
+    }
+    ImGui::EndTable();
+  }
+
+  buildMatchStages();
+
+  ImGui::Separator();
+
+  ImGui::InputInt("max iterations", &m_maxIterations);
+  m_maxIterations = std::max(m_maxIterations, 1);
+  ImGui::InputFloat("tolerance", &m_tolerance, 0.f, 0.f, "%g");
+  ImGui::SliderInt("pyramid levels", &m_numLevels, 1, 4);
+
+  if (ImGui::Button("Register")) {
+    triggerRegisterCallback();
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Stop")) {
+    triggerStopRegistrationCallback();
+  }
+
+  if (!m_registrationStatus.empty())
+    ImGui::Text("%s", m_registrationStatus.c_str());
+}
+
+void PredictionsEditor::buildMatchStages()
+{
+  if (m_matchStages.empty()
+      || !ImGui::CollapsingHeader(
+          "match stages", ImGuiTreeNodeFlags_DefaultOpen))
+    return;
+
+  struct Stage
+  {
+    const char *name;
+    float MatchStages::*ms;
+  };
+  static const Stage stages[] = {
+      {"frame", &MatchStages::frame},
+      {"queue", &MatchStages::queue},
+      {"set reference", &MatchStages::setReference},
+      {"set query", &MatchStages::setQuery},
+      {"calibrate", &MatchStages::calibrate},
+      {"match", &MatchStages::match},
+      {"update camera", &MatchStages::update},
+      {"render", &MatchStages::render},
+  };
+
+  // chronological, for the plot
+  const size_t count = m_matchStages.size();
+  const size_t first = count < matchHistory ? 0 : m_matchStagesNext;
+  const auto &last = m_matchStages[(first + count - 1) % count];
+  std::vector<float> totals(count);
+  for (size_t i = 0; i < count; ++i)
+    totals[i] = m_matchStages[(first + i) % count].total();
+
+  if (ImGui::BeginTable("match stages",
+          4,
+          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg
+              | ImGuiTableFlags_SizingFixedFit)) {
+    ImGui::TableSetupColumn("stage");
+    ImGui::TableSetupColumn("last ms");
+    ImGui::TableSetupColumn("mean");
+    ImGui::TableSetupColumn("max");
+    ImGui::TableHeadersRow();
+    auto row = [&](const char *name, float value, float mean, float max) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(name);
+      ImGui::TableNextColumn();
+      // well above the history's mean: a stage that regressed stands out
+      if (count >= 8 && value > 1.5f * mean && value - mean > 1.f)
+        ImGui::TextColored(ImVec4(1.f, 0.4f, 0.3f, 1.f), "%.2f", value);
+      else
+        ImGui::Text("%.2f", value);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", mean);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", max);
+    };
+    for (const auto &stage : stages) {
+      float sum = 0.f, max = 0.f;
+      for (const auto &s : m_matchStages) {
+        sum += s.*stage.ms;
+        max = std::max(max, s.*stage.ms);
+      }
+      row(stage.name, last.*stage.ms, sum / count, max);
+    }
+    float sum = 0.f;
+    for (float t : totals)
+      sum += t;
+    row("total",
+        last.total(),
+        sum / count,
+        *std::max_element(totals.begin(), totals.end()));
+    ImGui::EndTable();
+  }
+
+  char overlay[48];
+  std::snprintf(overlay, sizeof(overlay), "%zu matches", count);
+  ImGui::PlotLines("total ms",
+      totals.data(),
+      int(count),
+      0,
+      overlay,
+      0.f,
+      FLT_MAX,
+      ImVec2(0.f, 3.f * ImGui::GetTextLineHeightWithSpacing()));
+}
+
+void PredictionsEditor::updateFilter()
+{
+  const size_t count = m_predictions.predictions.size();
+  if (m_filteredCount == count)
+    return;
+  // appended predictions are filtered on their own, the rows so far stay
+  size_t first = m_filteredCount;
+  if (first > count) {
+    first = 0;
+    m_filtered.clear();
+  }
+  m_filteredCount = count;
+  for (size_t i = first; i < count; ++i) {
+    if (m_filter.PassFilter(m_predictions.predictions[i].filename.c_str()))
+      m_filtered.push_back(i);
+  }
 }
 
 void PredictionsEditor::setUpdateCameraCallback(UpdateCameraCallback cb)
@@ -112,6 +354,83 @@ void PredictionsEditor::setMatchCallback(MatchCallback cb)
   m_matchCallback = cb;
 }
 
+void PredictionsEditor::setRegisterCallback(RegisterCallback cb)
+{
+  m_registerCallback = cb;
+}
+
+void PredictionsEditor::setStopRegistrationCallback(StopRegistrationCallback cb)
+{
+  m_stopRegistrationCallback = cb;
+}
+
+void PredictionsEditor::setMatchAllCallback(MatchAllCallback cb)
+{
+  m_matchAllCallback = cb;
+}
+
+void PredictionsEditor::setRegistrationStatus(const std::string &status)
+{
+  m_registrationStatus = status;
+}
+
+void PredictionsEditor::setMatchComparison(
+    std::vector<MatchComparison> comparison)
+{
+  m_matchComparison = std::move(comparison);
+}
+
+void PredictionsEditor::setMatchScore(size_t index, float poseDelta)
+{
+  if (index >= m_predictions.predictions.size())
+    return;
+  if (m_matchScores.size() <= index)
+    m_matchScores.resize(m_predictions.predictions.size(),
+        std::numeric_limits<float>::quiet_NaN());
+  m_matchScores[index] = poseDelta;
+}
+
+void PredictionsEditor::addMatchStages(const MatchStages &stages)
+{
+  if (m_matchStages.size() < matchHistory)
+    m_matchStages.push_back(stages);
+  else
+    m_matchStages[m_matchStagesNext] = stages;
+  m_matchStagesNext = (m_matchStagesNext + 1) % matchHistory;
+}
+
+void PredictionsEditor::setThumbnails(ThumbnailAtlas *thumbnails)
+{
+  m_thumbnails = thumbnails;
+}
+
+void PredictionsEditor::resetPredictions()
+{
+  m_filteredCount = SIZE_MAX;
+  m_filtered.clear();
+  m_matchScores.clear();
+  m_matchComparison.clear();
+  m_selected = SIZE_MAX;
+  m_registrationStatus.clear();
+}
+
+void PredictionsEditor::selectMatcher(size_t index)
+{
+  if (index >= m_matcherNames.size() || index == m_matcherIndex)
+    return;
+  m_matcherIndex = index;
+  triggerSetActiveMatcherIndexCallback(index);
+}
+
+void PredictionsEditor::selectReference(size_t index)
+{
+  if (index >= m_predictions.predictions.size())
+    return;
+  m_selected = index;
+  triggerShowImageCallback(index);
+  triggerLoadReferenceImageCallback(index);
+}
+
 void PredictionsEditor::triggerResetCameraCallback()
 {
   if (m_resetCameraCallback)
@@ -157,4 +476,22 @@ void PredictionsEditor::triggerMatchCallback()
     m_matchCallback();
 }
 
+void PredictionsEditor::triggerRegisterCallback()
+{
+  if (m_registerCallback)
+    m_registerCallback(m_maxIterations, m_tolerance, m_numLevels);
+}
+
+void PredictionsEditor::triggerStopRegistrationCallback()
+{
+  if (m_stopRegistrationCallback)
+    m_stopRegistrationCallback();
+}
+
+void PredictionsEditor::triggerMatchAllCallback()
+{
+  if (m_matchAllCallback)
+    m_matchAllCallback();
+}
+
 } // namespace anari_viewer::windows
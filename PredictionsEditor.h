@@ -6,6 +6,7 @@
 // anari
 #include "anari_viewer/windows/Window.h"
 // std
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <vector>
@@ -14,6 +15,8 @@
 
 #include "prediction.h"
 
+class ThumbnailAtlas;
+
 namespace anari_viewer::windows {
 
 using UpdateCameraCallback =
@@ -26,10 +29,46 @@ using SetActiveMatcherIndexCallback = std::function<void(size_t)>;
 using LoadReferenceImageCallback = std::function<void(size_t)>;
 using LoadFramebufferAsReferenceImageCallback = std::function<void(void)>;
 using MatchCallback = std::function<void(void)>;
+using RegisterCallback =
+    std::function<void(int maxIterations, float tolerance, int numLevels)>;
+using StopRegistrationCallback = std::function<void(void)>;
+using MatchAllCallback = std::function<void(void)>;
+
+// One row of the side-by-side comparison after "Match all"
+struct MatchComparison
+{
+  std::string matcher;
+  bool updated{false};
+  float setImageMs{0.f};
+  float matchMs{0.f};
+  float updateMs{0.f};
+  float poseDelta{0.f}; // world units the matcher moved the camera
+  anari::math::float3 eye, center, up;
+};
+
+// Where the time of one "Match" went (ms), in the order the stages run
+struct MatchStages
+{
+  float frame{0.f}; // render the frame to match, copy it out of the mapping
+  float queue{0.f}; // submitted until a worker picked the job up
+  float setReference{0.f}; // set_image of the (swizzled) reference, 0 if held
+  float setQuery{0.f}; // set_image of query, depth or points, and edges
+  float calibrate{0.f};
+  float match{0.f};
+  float update{0.f}; // update_camera
+  float render{0.f}; // setView until a frame at the new pose was shown
+
+  float total() const
+  {
+    return frame + queue + setReference + setQuery + calibrate + match + update
+        + render;
+  }
+};
 
 class PredictionsEditor : public anari_viewer::windows::Window
 {
  public:
+  // keeps a reference to the predictions, which have to outlive the editor
   PredictionsEditor(
         const prediction_container& predictions,
         std::vector<std::string> matcherNames,
@@ -45,6 +84,26 @@ class PredictionsEditor : public anari_viewer::windows::Window
   void setLoadReferenceImageCallback(LoadReferenceImageCallback cb);
   void setLoadFramebufferAsReferenceImageCallback(LoadFramebufferAsReferenceImageCallback cb);
   void setMatchCallback(MatchCallback cb);
+  void setRegisterCallback(RegisterCallback cb);
+  void setStopRegistrationCallback(StopRegistrationCallback cb);
+  void setMatchAllCallback(MatchAllCallback cb);
+  void setRegistrationStatus(const std::string &status);
+  void setMatchComparison(std::vector<MatchComparison> comparison);
+  // Pose delta of the last match against prediction `index`'s image
+  void setMatchScore(size_t index, float poseDelta);
+  // Stage timings of a finished match, shown next to the mean and max of
+  // the last 128 matches
+  void addMatchStages(const MatchStages &stages);
+  // Thumbnails in the predictions list; the atlas has to outlive the editor
+  void setThumbnails(ThumbnailAtlas *thumbnails);
+  // The predictions were replaced (another case): selection, scores,
+  // comparison and filter start over
+  void resetPredictions();
+  // As if picked in the UI (a restored session): the matcher by index, and
+  // prediction `index` selected with its image shown and loaded as the
+  // reference
+  void selectMatcher(size_t index);
+  void selectReference(size_t index);
   void triggerUpdateCameraCallback(
       const anari::math::float3& eye,
       const anari::math::float3& center,
@@ -55,6 +114,9 @@ class PredictionsEditor : public anari_viewer::windows::Window
   void triggerLoadReferenceImageCallback(size_t index);
   void triggerLoadFramebufferAsReferenceImageCallback();
   void triggerMatchCallback();
+  void triggerRegisterCallback();
+  void triggerStopRegistrationCallback();
+  void triggerMatchAllCallback();
 
  private:
   // callback called whenever new camera selected
@@ -68,8 +130,36 @@ class PredictionsEditor : public anari_viewer::windows::Window
   LoadReferenceImageCallback m_loadReferenceImageCallback;
   LoadFramebufferAsReferenceImageCallback m_loadFramebufferAsReferenceImageCallback;
   MatchCallback m_matchCallback;
+  RegisterCallback m_registerCallback;
+  StopRegistrationCallback m_stopRegistrationCallback;
+  MatchAllCallback m_matchAllCallback;
+
+  int m_maxIterations{20};
+  float m_tolerance{1e-3f};
+  int m_numLevels{1};
+  std::string m_registrationStatus;
+  std::vector<MatchComparison> m_matchComparison;
+
+  // ring of the latest match timings, oldest at m_matchStagesNext once full
+  static constexpr size_t matchHistory = 128;
+  void buildMatchStages();
+  std::vector<MatchStages> m_matchStages;
+  size_t m_matchStagesNext{0};
+
+  // predictions list: only the rows in view are built (list clipper); the
+  // rows passing the file name filter are collected when the filter changes,
+  // those of appended predictions when they come in
+  void updateFilter();
 
-  prediction_container m_predictions;
+  const prediction_container& m_predictions; // owned by the application
+  ImGuiTextFilter m_filter;
+  std::vector<size_t> m_filtered;
+  size_t m_filteredCount{SIZE_MAX}; // predictions m_filtered was built for
+  bool m_followEnd{true}; // list scrolled to its end
+  std::vector<float> m_matchScores; // NaN: not matched yet
+  size_t m_selected{SIZE_MAX};
+  ThumbnailAtlas *m_thumbnails{nullptr};
+  bool m_showThumbnails{true};
   size_t m_matcherIndex;
   std::vector<std::string> m_matcherNamesStr;
   std::vector<const char*> m_matcherNames;
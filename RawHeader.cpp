@@ -0,0 +1,250 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "RawHeader.h"
+
+#include <sys/stat.h>
+// std
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+// nlohmann
+#include <nlohmann/json.hpp>
+// ours
+#include "Parallel.h"
+#include "Trace.h"
+#include "VoxelTypes.h"
+
+namespace {
+
+bool fileStamp(const std::string &fileName, uint64_t &size, int64_t &mtime)
+{
+  struct stat st;
+  if (stat(fileName.c_str(), &st) != 0)
+    return false;
+  size = uint64_t(st.st_size);
+  mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+const char *typeName(const RawHeader &header)
+{
+  switch (header.bytesPerCell) {
+  case 1:
+    return "uint8";
+  case 2:
+    return header.isHalf ? "float16" : "uint16";
+  case 4:
+    return "float32";
+  default:
+    return "unknown";
+  }
+}
+
+bool parseType(const std::string &name, RawHeader &header)
+{
+  header.isHalf = false;
+  if (name == "uint8")
+    header.bytesPerCell = 1;
+  else if (name == "uint16")
+    header.bytesPerCell = 2;
+  else if (name == "float16") {
+    header.bytesPerCell = 2;
+    header.isHalf = true;
+  } else if (name == "float32")
+    header.bytesPerCell = 4;
+  else
+    return false;
+  return true;
+}
+
+// Range and histogram in render units (see RawHeader::dataRange)
+template <typename Voxel>
+void computeStatistics(const typename Voxel::Storage *data,
+    size_t n,
+    int numBins,
+    RawHeader &header)
+{
+  using T = typename Voxel::Storage;
+  const size_t grain = 1 << 20;
+  const size_t numChunks = std::max<size_t>(1, (n + grain - 1) / grain);
+  std::vector<float> chunkRanges(numChunks * 2);
+  std::vector<std::vector<uint64_t>> chunkBins(numChunks);
+
+  // one pass: each chunk keeps its range and a fine histogram over the
+  // type's full range, merged and rebinned to the data range afterwards;
+  // integer cells are binned exactly by value, float cells in a second pass
+  // over the data range
+  constexpr bool exact = Voxel::exact;
+  const size_t exactBins = sizeof(T) == 1 ? 256 : 65536;
+  parallelFor(
+      0,
+      numChunks,
+      [&](size_t b, size_t e) {
+        for (size_t c = b; c < e; ++c) {
+          const size_t first = c * grain;
+          const size_t last = std::min(n, first + grain);
+          float lo = std::numeric_limits<float>::max();
+          float hi = std::numeric_limits<float>::lowest();
+          if constexpr (exact) {
+            chunkBins[c].assign(exactBins, 0);
+            for (size_t i = first; i < last; ++i)
+              ++chunkBins[c][data[i]];
+          }
+          for (size_t i = first; i < last; ++i) {
+            const float v = Voxel::value(data[i]);
+            if (std::isnan(v))
+              continue;
+            lo = std::min(lo, v);
+            hi = std::max(hi, v);
+          }
+          chunkRanges[2 * c] = lo;
+          chunkRanges[2 * c + 1] = hi;
+        }
+      },
+      1);
+
+  float lo = std::numeric_limits<float>::max();
+  float hi = std::numeric_limits<float>::lowest();
+  for (size_t c = 0; c < numChunks; ++c) {
+    lo = std::min(lo, chunkRanges[2 * c]);
+    hi = std::max(hi, chunkRanges[2 * c + 1]);
+  }
+  if (lo > hi)
+    lo = hi = 0.f;
+  header.dataRange[0] = lo;
+  header.dataRange[1] = hi;
+
+  header.histogram.assign(numBins, 0);
+  const float scale = hi > lo ? numBins / (hi - lo) : 0.f;
+  auto binOf = [&](float v) {
+    return std::clamp(int((v - lo) * scale), 0, numBins - 1);
+  };
+
+  if constexpr (exact) {
+    std::vector<uint64_t> counts(exactBins, 0);
+    for (auto &bins : chunkBins)
+      for (size_t i = 0; i < bins.size(); ++i)
+        counts[i] += bins[i];
+    for (size_t i = 0; i < exactBins; ++i)
+      if (counts[i])
+        header.histogram[binOf(Voxel::value(T(i)))] += counts[i];
+    return;
+  }
+
+  std::mutex mutex;
+  parallelFor(0, n, [&](size_t b, size_t e) {
+    std::vector<uint64_t> bins(numBins, 0);
+    for (size_t i = b; i < e; ++i) {
+      const float v = Voxel::value(data[i]);
+      if (!std::isnan(v))
+        ++bins[binOf(v)];
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < numBins; ++i)
+      header.histogram[i] += bins[i];
+  });
+}
+
+} // namespace
+
+std::string rawHeaderFile(const std::string &volumeFile)
+{
+  return volumeFile + ".header";
+}
+
+bool readRawHeader(const std::string &volumeFile, RawHeader &header)
+{
+  std::ifstream in(rawHeaderFile(volumeFile));
+  if (!in)
+    return false;
+
+  uint64_t size = 0;
+  int64_t mtime = 0;
+  if (!fileStamp(volumeFile, size, mtime))
+    return false;
+
+  try {
+    nlohmann::json json = nlohmann::json::parse(in);
+    if (json.at("file").at("size").get<uint64_t>() != size
+        || json.at("file").at("mtime").get<int64_t>() != mtime) {
+      std::cerr << "Ignoring stale RAW header " << rawHeaderFile(volumeFile)
+                << '\n';
+      return false;
+    }
+    RawHeader result;
+    for (int a = 0; a < 3; ++a) {
+      result.dims[a] = json.at("dims").at(a).get<int>();
+      result.spacing[a] = json.value("spacing", nlohmann::json{1, 1, 1})
+                              .at(a)
+                              .get<float>();
+    }
+    if (!parseType(json.at("type").get<std::string>(), result)) {
+      std::cerr << "Unknown cell type in RAW header "
+                << rawHeaderFile(volumeFile) << '\n';
+      return false;
+    }
+    result.dataRange[0] = json.at("dataRange").at(0).get<float>();
+    result.dataRange[1] = json.at("dataRange").at(1).get<float>();
+    result.histogram =
+        json.value("histogram", std::vector<uint64_t>{});
+    if (!result.valid())
+      return false;
+    header = std::move(result);
+  } catch (const nlohmann::json::exception &e) {
+    std::cerr << "Cannot parse RAW header " << rawHeaderFile(volumeFile)
+              << ": " << e.what() << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool writeRawHeader(const std::string &volumeFile, const RawHeader &header)
+{
+  uint64_t size = 0;
+  int64_t mtime = 0;
+  if (!fileStamp(volumeFile, size, mtime))
+    return false;
+
+  nlohmann::json json;
+  json["dims"] = {header.dims[0], header.dims[1], header.dims[2]};
+  json["type"] = typeName(header);
+  json["spacing"] = {header.spacing[0], header.spacing[1], header.spacing[2]};
+  json["dataRange"] = {header.dataRange[0], header.dataRange[1]};
+  json["histogram"] = header.histogram;
+  json["file"] = {{"size", size}, {"mtime", mtime}};
+
+  const std::string fileName = rawHeaderFile(volumeFile);
+  std::ofstream out(fileName);
+  if (!(out << json.dump(2) << '\n')) {
+    std::cerr << "Cannot write RAW header " << fileName << '\n';
+    return false;
+  }
+  std::cout << "Wrote RAW header " << fileName << '\n';
+  return true;
+}
+
+RawHeader computeRawHeader(const StructuredField &field, int numBins)
+{
+  TRACE_SCOPE("volume", "RAW header statistics");
+  RawHeader header;
+  header.dims[0] = field.dimX;
+  header.dims[1] = field.dimY;
+  header.dims[2] = field.dimZ;
+  header.bytesPerCell = field.bytesPerCell;
+  header.isHalf = field.isHalf;
+  std::copy_n(field.spacing, 3, header.spacing);
+
+  const size_t n = size_t(field.dimX) * field.dimY * field.dimZ;
+  const void *data = field.data();
+  if (!data || n == 0)
+    return header;
+  dispatchVoxelType(field, [&](auto voxel) {
+    using Voxel = decltype(voxel);
+    computeStatistics<Voxel>(voxelData<Voxel>(field), n, numBins, header);
+  });
+  return header;
+}
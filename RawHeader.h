@@ -0,0 +1,48 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+#include <vector>
+// ours
+#include "FieldTypes.h"
+
+// Sidecar header of RAW volumes /////////////////////////////////////////////
+//
+// "<volume file>.header", a small JSON file next to the volume: dims, cell
+// type, spacing, the data range and a histogram over it. Written after the
+// first load (dims from the command line or the file name), read instead of
+// guessing on every later load, so the range and histogram never need
+// another pass over the voxels. The file's size and modification time are
+// recorded; a header that no longer matches its volume is ignored.
+
+struct RawHeader
+{
+  int dims[3]{0, 0, 0};
+  unsigned bytesPerCell{0};
+  bool isHalf{false}; // 2-byte cells are float16 rather than uint16
+  float spacing[3]{1.f, 1.f, 1.f};
+  // in the units the volume is rendered in: normalized to [0, 1] for
+  // uint8/uint16 cells, the values themselves for float cells
+  float dataRange[2]{0.f, 1.f};
+  std::vector<uint64_t> histogram; // equal-width bins over dataRange
+
+  bool valid() const
+  {
+    return dims[0] > 0 && dims[1] > 0 && dims[2] > 0 && bytesPerCell > 0;
+  }
+};
+
+std::string rawHeaderFile(const std::string &volumeFile);
+
+// False if there is no header or it is stale
+bool readRawHeader(const std::string &volumeFile, RawHeader &header);
+
+bool writeRawHeader(const std::string &volumeFile, const RawHeader &header);
+
+// Data range and histogram of `field` (dims, cell type and spacing are taken
+// over too), computed in one parallel pass over the voxels
+RawHeader computeRawHeader(const StructuredField &field, int numBins = ValueHistogram::defaultBins);
@@ -0,0 +1,566 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+// Reads volume files as the viewer does, without a window or ANARI device,
+// and reports per reader and page cache state: open and read time, disk
+// and voxel throughput, LAC conversion rate and peak memory. RAW files go
+// through RAWReader (read, mapped, or gzip/zstd decompressed), NIfTI and
+// HDF5 files through NiftiReader, Zarr stores through ZarrReader.
+
+// posix
+#include <fcntl.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+// ours
+#include "Decompress.h"
+#include "LacTransform.h"
+#include "Phantom.h"
+#include "RawHeader.h"
+#include "ResourceUsage.h"
+#include "readRAW.h"
+#ifdef HAVE_ITK
+#include "ZarrReader.h"
+#include "readNifti.h"
+#endif
+
+static std::vector<std::string> g_files;
+static std::vector<int> g_phantomSizes;
+static std::string g_scratchDir = "/tmp";
+static std::string g_lutFile;
+static std::string g_csvFile;
+static int g_iterations = 3;
+static bool g_cold = true;
+static bool g_warm = true;
+static int g_dims[3] = {0, 0, 0};
+static unsigned g_bytesPerCell = 0;
+
+static void printUsage()
+{
+  std::cout << "./anariDRRReaderBench [{--help|-h}]\n"
+            << "   [--iterations <count>]\n"
+            << "   [--cache {cold|warm|both}]\n"
+            << "   [--phantoms <edge,edge,...>]\n"
+            << "   [--scratch <directory>]\n"
+            << "   [{--dims|-d} <dimx> <dimy> <dimz>]\n"
+            << "   [{--type|-t} {uint8|uint16|float32}]\n"
+            << "   [--lac <lut file>]\n"
+            << "   [--csv <file>]\n"
+            << "   [<volume file> ...]\n";
+}
+
+static void parseCommandLine(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      std::exit(0);
+    } else if (arg == "--iterations")
+      g_iterations = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--cache") {
+      const std::string v = argv[++i];
+      g_cold = v == "cold" || v == "both";
+      g_warm = v == "warm" || v == "both";
+      if (!g_cold && !g_warm) {
+        printf("ERROR: --cache is cold, warm or both\n");
+        std::exit(1);
+      }
+    } else if (arg == "--phantoms") {
+      std::string list = argv[++i];
+      for (size_t pos = 0; pos <= list.size();) {
+        const size_t comma = std::min(list.find(',', pos), list.size());
+        const int edge = std::atoi(list.substr(pos, comma - pos).c_str());
+        if (edge > 0)
+          g_phantomSizes.push_back(edge);
+        pos = comma + 1;
+      }
+    } else if (arg == "--scratch")
+      g_scratchDir = argv[++i];
+    else if (arg == "--dims" || arg == "-d") {
+      for (int a = 0; a < 3; ++a)
+        g_dims[a] = std::atoi(argv[++i]);
+    } else if (arg == "--type" || arg == "-t") {
+      const std::string v = argv[++i];
+      if (v == "uint8")
+        g_bytesPerCell = 1;
+      else if (v == "uint16")
+        g_bytesPerCell = 2;
+      else if (v == "float32")
+        g_bytesPerCell = 4;
+      else {
+        printUsage();
+        std::exit(1);
+      }
+    } else if (arg == "--lac" || arg == "--lacfile")
+      g_lutFile = argv[++i];
+    else if (arg == "--csv")
+      g_csvFile = argv[++i];
+    else
+      g_files.push_back(arg);
+  }
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+float ms(Clock::time_point a, Clock::time_point b)
+{
+  return std::chrono::duration<float, std::milli>(b - a).count();
+}
+
+bool endsWith(const std::string &s, const std::string &suffix)
+{
+  return s.size() >= suffix.size()
+      && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool isRemote(const std::string &path)
+{
+  return path.rfind("http://", 0) == 0 || path.rfind("https://", 0) == 0;
+}
+
+// The regular files of a file or (Zarr) directory
+std::vector<std::filesystem::path> filesOf(const std::string &path)
+{
+  std::vector<std::filesystem::path> files;
+  std::error_code ec;
+  if (!std::filesystem::is_directory(path, ec)) {
+    files.emplace_back(path);
+    return files;
+  }
+  for (const auto &entry :
+      std::filesystem::recursive_directory_iterator(path, ec)) {
+    if (entry.is_regular_file(ec))
+      files.push_back(entry.path());
+  }
+  return files;
+}
+
+uint64_t bytesOnDisk(const std::string &path)
+{
+  uint64_t bytes = 0;
+  std::error_code ec;
+  for (const auto &file : filesOf(path)) {
+    const auto size = std::filesystem::file_size(file, ec);
+    bytes += ec ? 0 : size;
+  }
+  return bytes;
+}
+
+// Drops the pages of the files from the page cache, so the next read goes
+// to the disk; pages other processes have mapped stay
+void dropPageCache(const std::string &path)
+{
+  for (const auto &file : filesOf(path)) {
+    const int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+      continue;
+    ::fdatasync(fd);
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+  }
+}
+
+// Reads the files once, so the next read finds them in the page cache
+void warmPageCache(const std::string &path)
+{
+  std::vector<char> buffer(size_t(1) << 20);
+  for (const auto &file : filesOf(path)) {
+    const int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+      continue;
+    while (::read(fd, buffer.data(), buffer.size()) > 0) {
+    }
+    ::close(fd);
+  }
+}
+
+// Dimensions and cell size of a RAW file: --dims/--type, its sidecar
+// header, or its name (name_256x256x128_uint16.raw)
+bool rawLayout(const std::string &file, int dims[3], unsigned &bytesPerCell)
+{
+  std::copy_n(g_dims, 3, dims);
+  bytesPerCell = g_bytesPerCell;
+  RawHeader header;
+  if (!dims[0] && readRawHeader(file, header)) {
+    std::copy_n(header.dims, 3, dims);
+    bytesPerCell = header.bytesPerCell;
+  }
+  const std::string name = std::filesystem::path(file).filename().string();
+  for (size_t pos = 0; pos < name.size();) {
+    const size_t next = std::min(name.find('_', pos), name.size());
+    const std::string part = name.substr(pos, next - pos);
+    int x = 0, y = 0, z = 0, bits = 0;
+    if (!dims[0] && sscanf(part.c_str(), "%ix%ix%i", &x, &y, &z) == 3) {
+      dims[0] = x;
+      dims[1] = y;
+      dims[2] = z;
+    }
+    if (!bytesPerCell
+        && (sscanf(part.c_str(), "uint%i", &bits) == 1
+            || sscanf(part.c_str(), "int%i", &bits) == 1))
+      bytesPerCell = unsigned(bits / 8);
+    if (!bytesPerCell && part.rfind("float32", 0) == 0)
+      bytesPerCell = 4;
+    pos = next + 1;
+  }
+  return dims[0] > 0 && dims[1] > 0 && dims[2] > 0 && bytesPerCell > 0;
+}
+
+struct Run
+{
+  bool ok{false};
+  float openMs{0.f};
+  float readMs{0.f}; // to all voxels in memory
+  float convertMs{0.f}; // to attenuation, 0: none
+  uint64_t voxels{0};
+  uint64_t voxelBytes{0}; // as read, before conversion
+  size_t peakRss{0};
+};
+
+// One reader over one file; each call reads it from scratch
+struct Case
+{
+  std::string file;
+  std::string reader;
+  bool (*run)(const std::string &file, LacReader &lac, Run &run);
+};
+
+bool runRaw(const std::string &file, bool useMmap, Run &run)
+{
+  int dims[3];
+  unsigned bytesPerCell = 0;
+  if (!rawLayout(file, dims, bytesPerCell)) {
+    std::cerr << "No dimensions for " << file << ", give --dims/--type\n";
+    return false;
+  }
+  const auto t0 = Clock::now();
+  RAWReader reader;
+  if (!reader.open(
+          file.c_str(), dims[0], dims[1], dims[2], bytesPerCell, useMmap))
+    return false;
+  const auto t1 = Clock::now();
+  const auto &field = reader.getField();
+  if (field.empty())
+    return false;
+  if (useMmap) {
+    // mapped pages are read when touched
+    const auto *bytes = static_cast<const uint8_t *>(field.data());
+    const size_t size = field.voxelBytes();
+    const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    volatile uint8_t sum = 0;
+    for (size_t i = 0; i < size; i += page)
+      sum = sum + bytes[i];
+    (void)sum;
+  }
+  const auto t2 = Clock::now();
+  run.openMs = ms(t0, t1);
+  run.readMs = ms(t1, t2);
+  run.voxels = field.numCells();
+  run.voxelBytes = field.voxelBytes();
+  return true;
+}
+
+bool runRawRead(const std::string &file, LacReader &, Run &run)
+{
+  return runRaw(file, false, run);
+}
+
+bool runRawMapped(const std::string &file, LacReader &, Run &run)
+{
+  return runRaw(file, true, run);
+}
+
+#ifdef HAVE_ITK
+bool runNifti(const std::string &file, LacReader &lac, Run &run)
+{
+  const auto t0 = Clock::now();
+  NiftiReader reader;
+  if (!reader.open(file.c_str()))
+    return false;
+  const auto t1 = Clock::now();
+  if (!reader.waitForVoxels())
+    return false;
+  const auto t2 = Clock::now();
+  const auto &field = reader.getField(0, lac);
+  const auto t3 = Clock::now();
+  if (field.empty())
+    return false;
+  run.openMs = ms(t0, t1);
+  run.readMs = ms(t1, t2);
+  run.convertMs = ms(t2, t3);
+  run.voxels = field.numCells();
+  run.voxelBytes = reader.voxels.size();
+  return true;
+}
+
+bool runZarr(const std::string &file, LacReader &lac, Run &run)
+{
+  const auto t0 = Clock::now();
+  ZarrReader zarr;
+  if (!zarr.open(file))
+    return false;
+  const auto t1 = Clock::now();
+  NiftiReader volume;
+  if (!zarr.read(0, volume))
+    return false;
+  const auto t2 = Clock::now();
+  const auto &field = volume.getField(0, lac);
+  const auto t3 = Clock::now();
+  if (field.empty())
+    return false;
+  run.openMs = ms(t0, t1);
+  run.readMs = ms(t1, t2);
+  run.convertMs = ms(t2, t3);
+  run.voxels = field.numCells();
+  run.voxelBytes = volume.voxels.size();
+  return true;
+}
+#endif
+
+// The readers that apply to a file
+std::vector<Case> casesOf(const std::string &file)
+{
+  std::vector<Case> cases;
+  std::string base = file;
+  const Compression compression = detectCompression(file.c_str());
+  if (endsWith(base, ".gz"))
+    base.resize(base.size() - 3);
+  else if (endsWith(base, ".zst"))
+    base.resize(base.size() - 4);
+
+  if (endsWith(base, ".raw")) {
+    if (compression == Compression::None) {
+      cases.push_back({file, "raw", runRawRead});
+      cases.push_back({file, "raw-mmap", runRawMapped});
+    } else {
+      cases.push_back({file,
+          compression == Compression::Zstd ? "raw-zst" : "raw-gzip",
+          runRawRead});
+    }
+    return cases;
+  }
+#ifdef HAVE_ITK
+  if (ZarrReader::isZarr(file)) {
+    cases.push_back({file, "zarr", runZarr});
+  } else if (endsWith(base, ".nii") || endsWith(base, ".h5")
+      || endsWith(base, ".hdf5")) {
+    const char *name = compression == Compression::Zstd ? "nifti-zst"
+        : compression != Compression::None             ? "nifti-gzip"
+        : endsWith(base, ".nii")                       ? "nifti"
+                                                       : "hdf5";
+    cases.push_back({file, name, runNifti});
+  }
+#endif
+  if (cases.empty())
+    printf("WARNING: no reader for %s in this build\n", file.c_str());
+  return cases;
+}
+
+float median(std::vector<float> values)
+{
+  if (values.empty())
+    return 0.f;
+  std::nth_element(
+      values.begin(), values.begin() + values.size() / 2, values.end());
+  return values[values.size() / 2];
+}
+
+struct Result
+{
+  std::string file, reader;
+  bool cold{false};
+  uint64_t fileBytes{0};
+  Run run; // medians of the times, the largest peak
+};
+
+bool benchmark(const Case &c, bool cold, LacReader &lac, Result &result)
+{
+  const bool remote = isRemote(c.file);
+  if (cold && remote)
+    return false; // the server's cache is out of reach
+  if (!cold && !remote)
+    warmPageCache(c.file);
+
+  std::vector<float> openMs, readMs, convertMs;
+  Run last;
+  for (int it = 0; it < g_iterations; ++it) {
+    if (cold)
+      dropPageCache(c.file);
+    Run run;
+    const bool peakReset = resetPeakResidentSetSize();
+    run.ok = c.run(c.file, lac, run);
+    if (!run.ok) {
+      std::cerr << c.reader << " could not read " << c.file << "\n";
+      return false;
+    }
+    run.peakRss = peakReset ? residentSetSizeHighWater() : 0;
+    openMs.push_back(run.openMs);
+    readMs.push_back(run.readMs);
+    convertMs.push_back(run.convertMs);
+    last.peakRss = std::max(last.peakRss, run.peakRss);
+    last.voxels = run.voxels;
+    last.voxelBytes = run.voxelBytes;
+  }
+  last.ok = true;
+  last.openMs = median(openMs);
+  last.readMs = median(readMs);
+  last.convertMs = median(convertMs);
+
+  result.file = c.file;
+  result.reader = c.reader;
+  result.cold = cold;
+  result.fileBytes = remote ? 0 : bytesOnDisk(c.file);
+  result.run = last;
+  return true;
+}
+
+double perSecond(double amount, float ms)
+{
+  return ms > 0.f ? amount / (ms * 1e-3) : 0.0;
+}
+
+void printResult(const Result &r)
+{
+  const float ioMs = r.run.openMs + r.run.readMs;
+  printf("  %-10s %-5s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+      r.reader.c_str(),
+      r.cold ? "cold" : "warm",
+      r.run.openMs,
+      r.run.readMs,
+      perSecond(double(r.fileBytes) / 1e6, ioMs),
+      perSecond(double(r.run.voxelBytes) / 1e6, ioMs),
+      r.run.convertMs,
+      perSecond(double(r.run.voxels) / 1e6, r.run.convertMs),
+      toMiB(r.run.peakRss));
+}
+
+bool writeCsv(const std::string &file, const std::vector<Result> &results)
+{
+  std::ofstream out(file);
+  out << "file,reader,cache,file_bytes,voxel_bytes,voxels,open_ms,read_ms,"
+         "convert_ms,disk_mb_s,voxel_mb_s,convert_mvox_s,peak_rss_mib\n";
+  for (const auto &r : results) {
+    const float ioMs = r.run.openMs + r.run.readMs;
+    out << r.file << ',' << r.reader << ',' << (r.cold ? "cold" : "warm")
+        << ',' << r.fileBytes << ',' << r.run.voxelBytes << ','
+        << r.run.voxels << ',' << r.run.openMs << ',' << r.run.readMs << ','
+        << r.run.convertMs << ','
+        << perSecond(double(r.fileBytes) / 1e6, ioMs) << ','
+        << perSecond(double(r.run.voxelBytes) / 1e6, ioMs) << ','
+        << perSecond(double(r.run.voxels) / 1e6, r.run.convertMs) << ','
+        << toMiB(r.run.peakRss) << '\n';
+  }
+  if (!out) {
+    std::cerr << "Could not write " << file << "\n";
+    return false;
+  }
+  return true;
+}
+
+// --phantoms: Shepp-Logan heads of edge^3 int16 voxels as RAW files
+std::vector<std::string> writePhantoms()
+{
+  std::vector<std::string> files;
+  for (int edge : g_phantomSizes) {
+    PhantomSpec spec;
+    spec.dims[0] = spec.dims[1] = spec.dims[2] = edge;
+    const size_t numCells = size_t(edge) * edge * edge;
+    std::vector<int16_t> hu(numCells);
+    fillPhantom(spec, hu.data());
+    char name[64];
+    std::snprintf(name,
+        sizeof(name),
+        "phantom_%dx%dx%d_int16.raw",
+        edge,
+        edge,
+        edge);
+    const auto file = (std::filesystem::path(g_scratchDir) / name).string();
+    std::ofstream out(file, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(hu.data()),
+        std::streamsize(numCells * sizeof(int16_t)));
+    if (!out) {
+      std::cerr << "Could not write " << file << "\n";
+      continue;
+    }
+    files.push_back(file);
+  }
+  return files;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  parseCommandLine(argc, argv);
+  const auto phantoms = writePhantoms();
+  std::vector<std::string> files = phantoms;
+  files.insert(files.end(), g_files.begin(), g_files.end());
+  if (files.empty()) {
+    printf("ERROR: no volume files or --phantoms provided\n");
+    printUsage();
+    std::exit(1);
+  }
+
+  LacReader lac;
+  if (!g_lutFile.empty())
+    lac.setFilename(g_lutFile);
+  lac.read();
+
+  printf("%d iterations per reader, medians; MB/s of the file on disk and of "
+         "the voxels read\n",
+      g_iterations);
+  std::vector<Result> results;
+  for (const auto &file : files) {
+    const auto cases = casesOf(file);
+    if (cases.empty())
+      continue;
+    // untimed: writes RAW sidecar headers, which later reads take the
+    // value range and histogram from
+    {
+      Run run;
+      cases.front().run(file, lac, run);
+    }
+    printf("%s (%.1f MiB)\n", file.c_str(), toMiB(bytesOnDisk(file)));
+    printf("  %-10s %-5s %9s %9s %9s %9s %9s %9s %9s\n",
+        "reader",
+        "cache",
+        "open ms",
+        "read ms",
+        "disk MB/s",
+        "vox MB/s",
+        "conv ms",
+        "Mvox/s",
+        "peak MiB");
+    for (const auto &c : cases) {
+      for (const bool cold : {true, false}) {
+        if ((cold && !g_cold) || (!cold && !g_warm))
+          continue;
+        Result result;
+        if (!benchmark(c, cold, lac, result))
+          continue;
+        printResult(result);
+        results.push_back(result);
+      }
+    }
+  }
+
+  for (const auto &file : phantoms) {
+    std::error_code ec;
+    std::filesystem::remove(file, ec);
+    std::filesystem::remove(rawHeaderFile(file), ec);
+  }
+  if (!g_csvFile.empty() && !writeCsv(g_csvFile, results))
+    return 1;
+  return 0;
+}
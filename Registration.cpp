@@ -0,0 +1,158 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Registration.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+// ours
+#include "Rotation.h"
+
+void RegistrationLoop::start(
+    size_t maxIterations, float tolerance, size_t numLevels)
+{
+  m_maxIterations = std::max<size_t>(maxIterations, 1);
+  m_tolerance = tolerance;
+  m_level = std::max<size_t>(numLevels, 1) - 1;
+  m_history.clear();
+  m_history.reserve(m_maxIterations); // no reallocation while iterating
+  m_startTime = m_stepTime = clock::now();
+  m_state = State::Running;
+}
+
+void RegistrationLoop::stop()
+{
+  if (m_state == State::Running)
+    m_state = State::Stopped;
+}
+
+void RegistrationLoop::reset()
+{
+  m_state = State::Idle;
+  m_level = 0;
+  m_history.clear();
+}
+
+bool RegistrationLoop::step(const anari::math::float3 &eyeBefore,
+    const anari::math::float3 &centerBefore,
+    const anari::math::float3 &eyeAfter,
+    const anari::math::float3 &centerAfter)
+{
+  if (m_state != State::Running)
+    return false;
+
+  auto now = clock::now();
+  RegistrationStep step;
+  step.iteration = m_history.size() + 1;
+  step.poseDelta = poseDelta(eyeBefore, centerBefore, eyeAfter, centerAfter);
+  step.seconds = std::chrono::duration<float>(now - m_stepTime).count();
+  step.level = m_level;
+  m_stepTime = now;
+  m_history.push_back(step);
+
+  if (step.poseDelta < m_tolerance && m_level > 0)
+    m_level--; // converged on a coarse level: refine
+  else if (step.poseDelta < m_tolerance)
+    m_state = State::Converged;
+  else if (m_history.size() >= m_maxIterations)
+    m_state = State::IterationLimit;
+
+  return m_state == State::Running;
+}
+
+bool RegistrationLoop::running() const
+{
+  return m_state == State::Running;
+}
+
+size_t RegistrationLoop::level() const
+{
+  return m_level;
+}
+
+RegistrationLoop::State RegistrationLoop::state() const
+{
+  return m_state;
+}
+
+const std::vector<RegistrationStep> &RegistrationLoop::history() const
+{
+  return m_history;
+}
+
+float RegistrationLoop::iterationsPerSecond() const
+{
+  if (m_history.empty())
+    return 0.f;
+  float seconds =
+      std::chrono::duration<float>(m_stepTime - m_startTime).count();
+  return seconds > 0.f ? m_history.size() / seconds : 0.f;
+}
+
+std::string RegistrationLoop::status() const
+{
+  const char *state = "idle";
+  switch (m_state) {
+  case State::Idle:
+    break;
+  case State::Running:
+    state = "running";
+    break;
+  case State::Converged:
+    state = "converged";
+    break;
+  case State::IterationLimit:
+    state = "iteration limit";
+    break;
+  case State::Stopped:
+    state = "stopped";
+    break;
+  }
+
+  char text[128];
+  if (m_history.empty()) {
+    snprintf(text, sizeof(text), "%s", state);
+  } else {
+    snprintf(text,
+        sizeof(text),
+        "%s: %zu it, level %zu, delta %.4g, %.2f it/s",
+        state,
+        m_history.size(),
+        m_level,
+        m_history.back().poseDelta,
+        iterationsPerSecond());
+  }
+  return text;
+}
+
+float RegistrationLoop::poseDelta(const anari::math::float3 &eyeBefore,
+    const anari::math::float3 &centerBefore,
+    const anari::math::float3 &eyeAfter,
+    const anari::math::float3 &centerAfter)
+{
+  return std::max(anari::math::length(eyeAfter - eyeBefore),
+      anari::math::length(centerAfter - centerBefore));
+}
+
+void applyCameraTwist(anari::math::float3 &eye,
+    anari::math::float3 &center,
+    anari::math::float3 &up,
+    const float twist[6])
+{
+  using anari::math::float3;
+  const float3 dir = anari::math::normalize(center - eye);
+  const float3 right = anari::math::normalize(anari::math::cross(dir, up));
+  const float3 upAxis = anari::math::cross(right, dir);
+
+  const float3 move = right * twist[0] + upAxis * twist[1] + dir * twist[2];
+  const float3 rotation =
+      right * twist[3] + upAxis * twist[4] + dir * twist[5];
+  const float angle = anari::math::length(rotation);
+  // about the rotation's axis; none for a zero rotation
+  const float3 axis = angle > 0.f ? rotation * (1.f / angle) : dir;
+  const float3 view = rotate(center - eye, axis, angle);
+  eye = eye + move;
+  center = eye + view;
+  up = rotate(up, axis, angle);
+}
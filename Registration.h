@@ -0,0 +1,84 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// anari
+#include "anari/anari_cpp/ext/linalg.h" // math::float3
+// std
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct RegistrationStep
+{
+  size_t iteration{0};
+  float poseDelta{0.f}; // world units the camera moved in this step
+  float seconds{0.f}; // render + match + update time of this step
+  size_t level{0}; // pyramid level the step ran at, 0 = full resolution
+};
+
+// Bookkeeping for closed-loop 2D/3D registration: render at the current pose,
+// match, update the pose, repeat until the update is smaller than the
+// tolerance or the iteration cap is hit. With several pyramid levels the
+// loop starts at the coarsest and moves one level finer each time the pose
+// converges there. The caller drives the steps so rendering and matching
+// can stay wherever they already run.
+class RegistrationLoop
+{
+ public:
+  enum class State
+  {
+    Idle,
+    Running,
+    Converged,
+    IterationLimit,
+    Stopped
+  };
+
+  void start(size_t maxIterations, float tolerance, size_t numLevels = 1);
+  void stop();
+  // Back to Idle, e.g. when a step could not even be started
+  void reset();
+
+  // Records one iteration from the pose before and after update_camera();
+  // returns true if another iteration should run
+  bool step(const anari::math::float3 &eyeBefore,
+      const anari::math::float3 &centerBefore,
+      const anari::math::float3 &eyeAfter,
+      const anari::math::float3 &centerAfter);
+
+  bool running() const;
+  State state() const;
+  // Current pyramid level; frames render at 1 / 2^level resolution
+  size_t level() const;
+  const std::vector<RegistrationStep> &history() const;
+  float iterationsPerSecond() const;
+  std::string status() const;
+
+  // Largest displacement of eye and center
+  static float poseDelta(const anari::math::float3 &eyeBefore,
+      const anari::math::float3 &centerBefore,
+      const anari::math::float3 &eyeAfter,
+      const anari::math::float3 &centerAfter);
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  State m_state{State::Idle};
+  size_t m_maxIterations{0};
+  float m_tolerance{0.f};
+  size_t m_level{0};
+  std::vector<RegistrationStep> m_history;
+  clock::time_point m_startTime;
+  clock::time_point m_stepTime;
+};
+
+// Moves a camera by a small motion in its own frame, as renderDrrJacobian()
+// differentiates: twist[0..2] translate along its right, up and view axes
+// (world units), twist[3..5] rotate about those axes through the eye
+// (radians)
+void applyCameraTwist(anari::math::float3 &eye,
+    anari::math::float3 &center,
+    anari::math::float3 &up,
+    const float twist[6]);
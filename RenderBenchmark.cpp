@@ -0,0 +1,469 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "RenderBenchmark.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+static prediction makePose(const anari::math::float3 &eye,
+    const anari::math::float3 &center,
+    const anari::math::float3 &up)
+{
+  return prediction(
+      "", eye.x, eye.y, eye.z, center.x, center.y, center.z, up.x, up.y, up.z);
+}
+
+std::vector<RenderBenchmarkPose> makeBenchmarkPath(anari::Device device,
+    anari::World world,
+    float fovy,
+    const RenderBenchmarkSettings &settings,
+    const std::vector<prediction> &predictions)
+{
+  anari::math::float3 bounds[2] = {{0.f, 0.f, 0.f}, {1.f, 1.f, 1.f}};
+  if (!anariGetProperty(device,
+          world,
+          "bounds",
+          ANARI_FLOAT32_BOX3,
+          &bounds[0],
+          sizeof(bounds),
+          ANARI_WAIT)) {
+    printf("WARNING: bounds not returned by the device! Using unit cube.\n");
+  }
+
+  const auto center = (bounds[0] + bounds[1]) * 0.5f;
+  const float radius = anari::math::length(bounds[1] - bounds[0]) * 0.5f;
+  const float distance = radius / std::sin(fovy * 0.5f);
+  const anari::math::float3 up(0.f, 1.f, 0.f);
+
+  std::vector<RenderBenchmarkPose> path;
+  for (size_t i = 0; i < settings.orbitSteps; ++i) {
+    const float angle = 2.f * float(M_PI) * i / settings.orbitSteps;
+    const auto eye = center
+        + anari::math::float3(std::sin(angle), 0.f, std::cos(angle)) * distance;
+    path.push_back({"orbit", makePose(eye, center, up)});
+  }
+  for (size_t i = 0; i < settings.zoomSteps; ++i) {
+    const float t = settings.zoomSteps > 1 ? i / float(settings.zoomSteps - 1) : 0.f;
+    const auto eye =
+        center + anari::math::float3(0.f, 0.f, 1.f) * distance * (1.5f - t);
+    path.push_back({"zoom", makePose(eye, center, up)});
+  }
+  for (auto &p : predictions)
+    path.push_back({"prediction", p});
+  return path;
+}
+
+bool runRenderBenchmark(anari::Device device,
+    anari::World world,
+    const BatchRenderSettings &base,
+    const RenderBenchmarkSettings &settings,
+    const std::vector<RenderBenchmarkPose> &path,
+    std::vector<RenderBenchmarkSample> &samples)
+{
+  using clock = std::chrono::steady_clock;
+  if (path.empty())
+    return false;
+
+  for (auto &size : settings.sizes) {
+    BatchRenderSettings rs = base;
+    rs.width = size.first;
+    rs.height = size.second;
+    rs.framesInFlight = 1;
+    BatchRenderer renderer(device, world, rs);
+
+    for (float energy : settings.photonEnergies) {
+      if (energy > 0.f)
+        renderer.setPhotonEnergy(energy);
+
+      for (size_t i = 0; i < settings.warmupFrames; ++i) {
+        const auto &p = path[i % path.size()];
+        renderer.submit(0, p.pose, p.fovy);
+        renderer.readback(0);
+      }
+
+      float wallSum = 0.f, durationSum = 0.f;
+      for (size_t i = 0; i < path.size(); ++i) {
+        RenderBenchmarkSample sample;
+        sample.segment = path[i].segment;
+        sample.frame = i;
+        sample.width = rs.width;
+        sample.height = rs.height;
+        sample.photonEnergy = energy;
+
+        const auto start = clock::now();
+        renderer.submit(0, path[i].pose, path[i].fovy);
+        // the readback batch mode uses
+        if (!renderer.readback(0, &sample.timing))
+          return false;
+        sample.wall =
+            std::chrono::duration<float, std::milli>(clock::now() - start)
+                .count();
+
+        if (settings.gpu)
+          sample.gpu = settings.gpu->latest();
+
+        wallSum += sample.wall;
+        durationSum += sample.timing.duration;
+        samples.push_back(sample);
+      }
+
+      printf("%dx%d @ %g keV: %.2f ms/frame wall, %.2f ms duration, %.1f fps\n",
+          rs.width,
+          rs.height,
+          energy,
+          wallSum / path.size(),
+          durationSum / path.size(),
+          wallSum > 0.f ? 1000.f * path.size() / wallSum : 0.f);
+    }
+  }
+  return true;
+}
+
+bool writeRenderBenchmark(
+    const std::string &file, const std::vector<RenderBenchmarkSample> &samples)
+{
+  std::ofstream out(file);
+  const bool json = file.size() >= 5 && file.substr(file.size() - 5) == ".json";
+
+  // GPU columns only if there were counters; -1: not reported
+  const bool gpu = std::any_of(samples.begin(),
+      samples.end(),
+      [](const RenderBenchmarkSample &s) { return s.gpu.valid; });
+  auto vramMiB = [](const GpuSample &g) {
+    return g.valid ? int(g.memoryUsed >> 20) : -1;
+  };
+
+  if (json) {
+    nlohmann::json rows = nlohmann::json::array();
+    for (auto &s : samples) {
+      nlohmann::json row = {{"segment", s.segment},
+          {"frame", s.frame},
+          {"width", s.width},
+          {"height", s.height},
+          {"photon_energy", s.photonEnergy},
+          {"wall_ms", s.wall},
+          {"duration_ms", s.timing.duration},
+          {"latency_ms", s.timing.latency},
+          {"wait_ms", s.timing.wait},
+          {"map_ms", s.timing.map}};
+      if (gpu) {
+        row["gpu_util"] = s.gpu.utilization;
+        row["vram_mib"] = vramMiB(s.gpu);
+        row["gpu_mhz"] = s.gpu.graphicsClock;
+        row["mem_mhz"] = s.gpu.memoryClock;
+        row["pcie_rx_kibs"] = s.gpu.pcieRx;
+        row["pcie_tx_kibs"] = s.gpu.pcieTx;
+      }
+      rows.push_back(std::move(row));
+    }
+    out << nlohmann::json{{"frames", rows}}.dump(2) << '\n';
+  } else {
+    out << "segment,frame,width,height,photon_energy,wall_ms,duration_ms,"
+           "latency_ms,wait_ms,map_ms";
+    if (gpu)
+      out << ",gpu_util,vram_mib,gpu_mhz,mem_mhz,pcie_rx_kibs,pcie_tx_kibs";
+    out << '\n';
+    for (auto &s : samples) {
+      out << s.segment << ',' << s.frame << ',' << s.width << ',' << s.height
+          << ',' << s.photonEnergy << ',' << s.wall << ','
+          << s.timing.duration << ',' << s.timing.latency << ','
+          << s.timing.wait << ',' << s.timing.map;
+      if (gpu) {
+        out << ',' << s.gpu.utilization << ',' << vramMiB(s.gpu) << ','
+            << s.gpu.graphicsClock << ',' << s.gpu.memoryClock << ','
+            << s.gpu.pcieRx << ',' << s.gpu.pcieTx;
+      }
+      out << '\n';
+    }
+  }
+
+  if (!out) {
+    std::cerr << "Could not write " << file << "\n";
+    return false;
+  }
+  return true;
+}
+
+// Regression gate ///////////////////////////////////////////////////////////
+
+std::vector<RenderBenchmarkPose> makeRegressionPath(
+    anari::Device device, anari::World world, float fovy)
+{
+  RenderBenchmarkSettings settings;
+  settings.orbitSteps = 12;
+  settings.zoomSteps = 4;
+  return makeBenchmarkPath(device, world, fovy, settings, {});
+}
+
+bool renderRegressionFrames(BatchRenderer &renderer,
+    const std::vector<RenderBenchmarkPose> &path,
+    const RegressionGateSettings &settings,
+    std::vector<RegressionFrame> &frames)
+{
+  using clock = std::chrono::steady_clock;
+  if (path.empty())
+    return false;
+
+  for (size_t i = 0; i < settings.warmupFrames; ++i) {
+    const auto &p = path[i % path.size()];
+    renderer.submit(0, p.pose, p.fovy);
+    renderer.readback(0);
+  }
+
+  frames.assign(path.size(), {});
+  std::vector<float> durations;
+  for (size_t i = 0; i < path.size(); ++i) {
+    const BatchRenderer::Readback *r = nullptr;
+    durations.clear();
+    for (size_t n = 0; n < std::max<size_t>(settings.repeats, 1); ++n) {
+      FrameTiming timing;
+      const auto start = clock::now();
+      renderer.submit(0, path[i].pose, path[i].fovy);
+      if (!(r = renderer.readback(0, &timing)))
+        return false;
+      const float wall =
+          std::chrono::duration<float, std::milli>(clock::now() - start)
+              .count();
+      // devices without a "duration" property report 0
+      durations.push_back(timing.duration > 0.f ? timing.duration : wall);
+    }
+    std::nth_element(durations.begin(),
+        durations.begin() + durations.size() / 2,
+        durations.end());
+
+    auto &frame = frames[i];
+    frame.duration = durations[durations.size() / 2];
+    frame.checksum = 14695981039346656037ull; // FNV-1a
+    frame.image.resize(size_t(r->width) * r->height);
+    for (size_t p = 0; p < frame.image.size(); ++p) {
+      for (size_t c = 0; c < 4; ++c) {
+        frame.checksum ^= r->color[p * 4 + c];
+        frame.checksum *= 1099511628211ull;
+      }
+      frame.image[p] = r->color[p * 4];
+    }
+  }
+  return true;
+}
+
+bool readRegressionBaseline(
+    const std::string &file, RegressionBaseline &baseline)
+{
+  std::ifstream in(file);
+  std::ifstream images(file + ".images", std::ios::binary);
+  if (!in || !images)
+    return false;
+  try {
+    nlohmann::json json;
+    in >> json;
+    RegressionBaseline result;
+    result.width = json.at("width").get<int>();
+    result.height = json.at("height").get<int>();
+    result.library = json.value("library", "");
+    const size_t numPixels = size_t(result.width) * result.height;
+    for (auto &f : json.at("frames")) {
+      RegressionFrame frame;
+      frame.duration = f.at("duration_ms").get<float>();
+      frame.checksum =
+          std::stoull(f.at("checksum").get<std::string>(), nullptr, 16);
+      frame.image.resize(numPixels);
+      if (!images.read(reinterpret_cast<char *>(frame.image.data()),
+              numPixels)) {
+        std::cerr << "Could not read the images of " << file << "\n";
+        return false;
+      }
+      result.frames.push_back(std::move(frame));
+    }
+    baseline = std::move(result);
+  } catch (const std::exception &e) {
+    std::cerr << "Could not parse " << file << ": " << e.what() << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool writeRegressionBaseline(
+    const std::string &file, const RegressionBaseline &baseline)
+{
+  nlohmann::json frames = nlohmann::json::array();
+  std::ofstream images(file + ".images", std::ios::binary);
+  for (auto &f : baseline.frames) {
+    char checksum[17];
+    std::snprintf(checksum,
+        sizeof(checksum),
+        "%016llx",
+        (unsigned long long)f.checksum);
+    frames.push_back({{"duration_ms", f.duration}, {"checksum", checksum}});
+    images.write(
+        reinterpret_cast<const char *>(f.image.data()), f.image.size());
+  }
+  std::ofstream out(file);
+  out << nlohmann::json{{"width", baseline.width},
+      {"height", baseline.height},
+      {"library", baseline.library},
+      {"frames", frames}}
+             .dump(2)
+      << '\n';
+  if (!out || !images) {
+    std::cerr << "Could not write " << file << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool compareRegression(const RegressionGateSettings &settings,
+    const RegressionBaseline &baseline,
+    const RegressionBaseline &current)
+{
+  if (baseline.width != current.width || baseline.height != current.height
+      || baseline.frames.size() != current.frames.size()) {
+    printf("FAIL: the baseline has %zu poses at %dx%d, this run %zu at %dx%d\n",
+        baseline.frames.size(),
+        baseline.width,
+        baseline.height,
+        current.frames.size(),
+        current.width,
+        current.height);
+    return false;
+  }
+
+  size_t numSlower = 0, numChanged = 0;
+  float baseTotal = 0.f, currentTotal = 0.f, minPsnr = INFINITY;
+  for (size_t i = 0; i < current.frames.size(); ++i) {
+    const auto &b = baseline.frames[i];
+    const auto &c = current.frames[i];
+    baseTotal += b.duration;
+    currentTotal += c.duration;
+
+    if (c.duration > b.duration * (1.f + settings.timeTolerance)
+        && c.duration - b.duration > settings.minTimeDelta) {
+      printf("pose %zu: %.2f ms, baseline %.2f ms (+%.0f%%)\n",
+          i,
+          c.duration,
+          b.duration,
+          100.f * (c.duration / b.duration - 1.f));
+      numSlower++;
+    }
+
+    if (c.checksum == b.checksum)
+      continue;
+    double squares = 0.0;
+    for (size_t p = 0; p < c.image.size(); ++p) {
+      const double d = double(c.image[p]) - double(b.image[p]);
+      squares += d * d;
+    }
+    const double mse = squares / std::max<size_t>(c.image.size(), 1);
+    const float psnr =
+        mse > 0.0 ? float(10.0 * std::log10(255.0 * 255.0 / mse)) : INFINITY;
+    minPsnr = std::min(minPsnr, psnr);
+    if (psnr < settings.minPsnr) {
+      printf("pose %zu: image changed, PSNR %.1f dB\n", i, psnr);
+      numChanged++;
+    }
+  }
+
+  printf("%zu poses: %.2f ms total, baseline %.2f ms (%s)\n",
+      current.frames.size(),
+      currentTotal,
+      baseTotal,
+      baseline.library.c_str());
+  if (std::isinf(minPsnr))
+    printf("images identical to the baseline\n");
+  else
+    printf("lowest PSNR of the changed images: %.1f dB\n", minPsnr);
+  if (numSlower || numChanged) {
+    printf("FAIL: %zu poses slower than +%.0f%%, %zu images below %.1f dB\n",
+        numSlower,
+        100.f * settings.timeTolerance,
+        numChanged,
+        settings.minPsnr);
+    return false;
+  }
+  printf("PASS\n");
+  return true;
+}
+
+// Scaling study /////////////////////////////////////////////////////////////
+
+bool writeScalingStudy(
+    const std::string &file, const std::vector<ScalingSample> &samples)
+{
+  auto mib = [](size_t bytes) { return bytes / (1024.0 * 1024.0); };
+  printf("%6s %-8s %11s %9s %9s %9s %9s %9s %9s %10s\n",
+      "volume",
+      "cells",
+      "resolution",
+      "load ms",
+      "conv ms",
+      "commit ms",
+      "first ms",
+      "frame ms",
+      "field MiB",
+      "peak MiB");
+  for (auto &s : samples) {
+    char resolution[32];
+    std::snprintf(resolution, sizeof(resolution), "%dx%d", s.width, s.height);
+    if (!s.ok) {
+      printf("%6d %-8s %11s  failed\n",
+          s.volumeSize,
+          s.cellType.c_str(),
+          resolution);
+      continue;
+    }
+    printf("%6d %-8s %11s %9.1f %9.1f %9.1f %9.2f %9.2f %9.0f %10.0f\n",
+        s.volumeSize,
+        s.cellType.c_str(),
+        resolution,
+        s.load,
+        s.convert,
+        s.commit,
+        s.firstFrame,
+        s.steadyFrame,
+        mib(s.fieldBytes),
+        mib(s.peakRss));
+  }
+
+  std::ofstream out(file);
+  const bool json = file.size() >= 5 && file.substr(file.size() - 5) == ".json";
+  if (json) {
+    nlohmann::json rows = nlohmann::json::array();
+    for (auto &s : samples) {
+      rows.push_back({{"volume_size", s.volumeSize},
+          {"cell_type", s.cellType},
+          {"width", s.width},
+          {"height", s.height},
+          {"ok", s.ok},
+          {"load_ms", s.load},
+          {"convert_ms", s.convert},
+          {"commit_ms", s.commit},
+          {"first_frame_ms", s.firstFrame},
+          {"steady_frame_ms", s.steadyFrame},
+          {"field_bytes", s.fieldBytes},
+          {"peak_rss_bytes", s.peakRss}});
+    }
+    out << nlohmann::json{{"samples", rows}}.dump(2) << '\n';
+  } else {
+    out << "volume_size,cell_type,width,height,ok,load_ms,convert_ms,"
+           "commit_ms,first_frame_ms,steady_frame_ms,field_bytes,"
+           "peak_rss_bytes\n";
+    for (auto &s : samples) {
+      out << s.volumeSize << ',' << s.cellType << ',' << s.width << ','
+          << s.height << ',' << int(s.ok) << ',' << s.load << ','
+          << s.convert << ',' << s.commit << ',' << s.firstFrame << ','
+          << s.steadyFrame << ',' << s.fieldBytes << ',' << s.peakRss
+          << '\n';
+    }
+  }
+  if (!out) {
+    std::cerr << "Could not write " << file << "\n";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,144 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// anari
+#include <anari/anari_cpp.hpp>
+// std
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+// ours
+#include "BatchRenderer.h"
+#include "GpuCounters.h"
+#include "prediction.h"
+
+struct RenderBenchmarkSettings
+{
+  std::vector<std::pair<int, int>> sizes{{512, 512}, {1024, 1024}};
+  std::vector<float> photonEnergies{0.f}; // keV, 0 keeps the renderer default
+  size_t orbitSteps{36}; // poses on a full circle around the volume
+  size_t zoomSteps{12}; // poses moving from 1.5x to 0.5x the fit distance
+  size_t warmupFrames{3}; // rendered before every configuration, not recorded
+  std::string output; // .json writes JSON, anything else CSV
+  // sampled after every frame (nullptr: no GPU columns)
+  const GpuCounters *gpu{nullptr};
+};
+
+struct RenderBenchmarkPose
+{
+  std::string segment; // "orbit", "zoom", "prediction" or "replay"
+  prediction pose;
+  float fovy{0.f}; // radians, 0 for the renderer settings' one
+};
+
+struct RenderBenchmarkSample
+{
+  std::string segment;
+  size_t frame{0}; // index into the camera path
+  int width{0};
+  int height{0};
+  float photonEnergy{0.f};
+  float wall{0.f}; // ms, submit until the channels are copied out
+  FrameTiming timing;
+  GpuSample gpu; // the counters' latest sample when the frame was read
+};
+
+// The fixed camera path: an orbit and a zoom, both framing the world's
+// bounds like DRRViewport::resetView(), followed by the prediction poses
+std::vector<RenderBenchmarkPose> makeBenchmarkPath(anari::Device device,
+    anari::World world,
+    float fovy,
+    const RenderBenchmarkSettings &settings,
+    const std::vector<prediction> &predictions);
+
+// Renders the path once per size and photon energy with a renderer set up
+// like the batch renderer's (one frame in flight, so the timings are of
+// single frames, not of the pipeline)
+bool runRenderBenchmark(anari::Device device,
+    anari::World world,
+    const BatchRenderSettings &base,
+    const RenderBenchmarkSettings &settings,
+    const std::vector<RenderBenchmarkPose> &path,
+    std::vector<RenderBenchmarkSample> &samples);
+
+bool writeRenderBenchmark(
+    const std::string &file, const std::vector<RenderBenchmarkSample> &samples);
+
+// Regression gate ///////////////////////////////////////////////////////////
+//
+// Renders a canonical path and compares it to a baseline recorded with an
+// earlier build or ANARI library: per pose the median frame duration and the
+// image, exact by checksum and otherwise by PSNR. The baseline is a JSON
+// file plus <baseline>.images with the frames' red channels (DRRs are grey).
+
+struct RegressionGateSettings
+{
+  std::string baseline;
+  float timeTolerance{0.1f}; // relative slowdown of a pose that fails it
+  float minTimeDelta{0.5f}; // ms; smaller slowdowns are taken as noise
+  float minPsnr{40.f}; // dB, of images whose checksum changed
+  size_t repeats{5}; // renders per pose; the median duration counts
+  size_t warmupFrames{3};
+};
+
+struct RegressionFrame
+{
+  float duration{0.f}; // ms, median of the repeats
+  uint64_t checksum{0}; // FNV-1a of the RGBA8 image
+  std::vector<uint8_t> image; // red channel, width * height
+};
+
+struct RegressionBaseline
+{
+  int width{0};
+  int height{0};
+  std::string library; // the ANARI library it was recorded with
+  std::vector<RegressionFrame> frames; // one per pose of the path
+};
+
+// The canonical path: makeBenchmarkPath()'s orbit and zoom, shortened
+std::vector<RenderBenchmarkPose> makeRegressionPath(
+    anari::Device device, anari::World world, float fovy);
+
+// With one frame in flight, so the durations are of single frames
+bool renderRegressionFrames(BatchRenderer &renderer,
+    const std::vector<RenderBenchmarkPose> &path,
+    const RegressionGateSettings &settings,
+    std::vector<RegressionFrame> &frames);
+
+bool readRegressionBaseline(
+    const std::string &file, RegressionBaseline &baseline);
+bool writeRegressionBaseline(
+    const std::string &file, const RegressionBaseline &baseline);
+
+// Prints one line per pose that drifted and a summary; false if any pose
+// exceeds the settings' thresholds
+bool compareRegression(const RegressionGateSettings &settings,
+    const RegressionBaseline &baseline,
+    const RegressionBaseline &current);
+
+// Scaling study /////////////////////////////////////////////////////////////
+
+// One volume size, cell type and output resolution
+struct ScalingSample
+{
+  int volumeSize{0}; // voxels per axis
+  std::string cellType; // float32, float16
+  int width{0};
+  int height{0};
+  bool ok{false}; // false: ran out of memory (or the device failed)
+  float load{0.f}; // ms, generating the phantom's densities
+  float convert{0.f}; // ms, densities to attenuation
+  float commit{0.f}; // ms, field upload and commit until the world is ready
+  float firstFrame{0.f}; // ms, the first frame of the resolution
+  float steadyFrame{0.f}; // ms, median of the later frames
+  size_t fieldBytes{0};
+  size_t peakRss{0}; // bytes, of the process so far
+};
+
+// A table on stdout and the samples as JSON (.json) or CSV
+bool writeScalingStudy(
+    const std::string &file, const std::vector<ScalingSample> &samples);
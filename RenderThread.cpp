@@ -0,0 +1,286 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "RenderThread.h"
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+// ours
+#include "AnariCalls.h"
+#include "Trace.h"
+
+bool RenderCamera::operator==(const RenderCamera &other) const
+{
+  return position == other.position && direction == other.direction
+      && up == other.up && fovy == other.fovy && aspect == other.aspect
+      && std::equal(region, region + 4, other.region);
+}
+
+void applyCamera(anari::Device device,
+    anari::Camera camera,
+    const RenderCamera &params,
+    anari_calls::ParameterCache &parameters)
+{
+  parameters.set(device, camera, "aspect", params.aspect);
+  parameters.set(device, camera, "position", params.position);
+  parameters.set(device, camera, "direction", params.direction);
+  parameters.set(device, camera, "up", params.up);
+  parameters.set(device, camera, "fovy", params.fovy);
+  parameters.set(device,
+      camera,
+      "imageRegion",
+      ANARI_FLOAT32_BOX2,
+      params.region,
+      sizeof(params.region));
+  parameters.commit(device, camera);
+}
+
+RenderThread::RenderThread(anari::Device device,
+    anari::Camera camera,
+    const std::vector<anari::Frame> &frames,
+    anari_calls::ParameterCache &parameters)
+    : m_device(device), m_camera(camera), m_parameters(parameters)
+{
+  setFrames(frames);
+  m_thread = std::thread([this]() { loop(); });
+}
+
+RenderThread::~RenderThread()
+{
+  m_stop = true;
+  m_pauseRequested = false;
+  m_signal.fetch_add(1, std::memory_order_release);
+  m_signal.notify_one();
+  m_pauseRequested.notify_one();
+  m_thread.join();
+}
+
+bool RenderThread::push(RenderRequest request)
+{
+  // counted first, so outstanding() never sees it handled before pushed
+  m_pushed.fetch_add(1, std::memory_order_acq_rel);
+  if (!m_requests.push(request)) {
+    m_pushed.fetch_sub(1, std::memory_order_acq_rel);
+    return false;
+  }
+  m_signal.fetch_add(1, std::memory_order_release);
+  m_signal.notify_one();
+  return true;
+}
+
+size_t RenderThread::outstanding() const
+{
+  const uint64_t handled = m_handled.load(std::memory_order_acquire);
+  return size_t(m_pushed.load(std::memory_order_acquire) - handled);
+}
+
+bool RenderThread::acquire()
+{
+  return m_results.acquire();
+}
+
+const RenderedFrame &RenderThread::frame() const
+{
+  return m_results.front();
+}
+
+void RenderThread::pause()
+{
+  if (m_pauseDepth++ > 0)
+    return;
+  m_pauseRequested = true;
+  m_signal.fetch_add(1, std::memory_order_release);
+  m_signal.notify_one();
+  m_parked.wait(false);
+}
+
+void RenderThread::resume()
+{
+  if (--m_pauseDepth > 0)
+    return;
+  m_pauseRequested = false;
+  m_pauseRequested.notify_one();
+  // parked again right away otherwise, by the next pause()
+  m_parked.wait(true);
+}
+
+bool RenderThread::paused() const
+{
+  return m_pauseDepth > 0;
+}
+
+void RenderThread::setFrames(const std::vector<anari::Frame> &frames)
+{
+  m_frames = frames;
+  m_nextFrame = 0;
+}
+
+void RenderThread::loop()
+{
+  std::deque<InFlight> inFlight; // oldest first
+  RenderRequest next;
+  bool haveNext = false;
+
+  for (;;) {
+    const uint32_t signal = m_signal.load(std::memory_order_acquire);
+
+    if (m_stop || m_pauseRequested) {
+      for (auto &f : inFlight) {
+        anari::discard(m_device, m_frames[f.frame]);
+        anari::wait(m_device, m_frames[f.frame]);
+      }
+      // the latest request is rendered again after the pause
+      if (!haveNext && !inFlight.empty()) {
+        next = inFlight.back().request;
+        haveNext = true;
+        inFlight.pop_back();
+      }
+      m_handled.fetch_add(inFlight.size(), std::memory_order_acq_rel);
+      inFlight.clear();
+      if (m_stop)
+        return;
+      park();
+      continue;
+    }
+
+    // the latest request replaces those queued before it
+    RenderRequest request;
+    while (m_requests.pop(request)) {
+      if (haveNext) {
+        request.cancel |= next.cancel;
+        request.keep |= next.keep;
+        if (next.input != decltype(next.input)()
+            && (request.input == decltype(request.input)()
+                || next.input < request.input))
+          request.input = next.input;
+        m_handled.fetch_add(1, std::memory_order_acq_rel);
+      }
+      next = request;
+      haveNext = true;
+    }
+
+    if (haveNext && next.cancel) {
+      for (auto &f : inFlight) {
+        if (!f.request.keep && !f.discarded) {
+          anari::discard(m_device, m_frames[f.frame]);
+          f.discarded = true;
+        }
+      }
+      next.cancel = false;
+    }
+
+    // frames in flight are the latest ones submitted, so with room in the
+    // ring the next one round-robin is free
+    if (haveNext && inFlight.size() < m_frames.size()) {
+      const size_t index = m_nextFrame;
+      m_nextFrame = (m_nextFrame + 1) % m_frames.size();
+      submit(index, next);
+      inFlight.push_back({index, next});
+      haveNext = false;
+      continue;
+    }
+
+    if (inFlight.empty()) {
+      m_signal.wait(signal, std::memory_order_acquire);
+      continue;
+    }
+
+    // polled rather than waited for, so requests arriving meanwhile can
+    // cancel it
+    const auto &f = inFlight.front();
+    if (!anari::isReady(m_device, m_frames[f.frame])) {
+      std::this_thread::sleep_for(std::chrono::microseconds(250));
+      continue;
+    }
+    if (!f.discarded)
+      readBack(f);
+    inFlight.pop_front();
+    m_handled.fetch_add(1, std::memory_order_acq_rel);
+  }
+}
+
+void RenderThread::park()
+{
+  m_parked = true;
+  m_parked.notify_one();
+  while (m_pauseRequested && !m_stop)
+    m_pauseRequested.wait(true);
+
+  m_cameraValid = false;
+  m_parked = false;
+  m_parked.notify_one();
+}
+
+void RenderThread::submit(size_t index, const RenderRequest &request)
+{
+  if (!m_cameraValid || !(m_appliedCamera == request.camera)) {
+    applyCamera(m_device, m_camera, request.camera, m_parameters);
+    m_appliedCamera = request.camera;
+    m_cameraValid = true;
+  }
+
+  // committed only if the size or channels changed
+  auto frame = m_frames[index];
+  m_parameters.set(
+      m_device, frame, "size", anari::math::uint2(request.size));
+  m_parameters.set(m_device, frame, "channel.color", request.colorType);
+  if (request.origin)
+    m_parameters.set(m_device, frame, "channel.origin", ANARI_FLOAT32_VEC3);
+  else
+    m_parameters.unset(m_device, frame, "channel.origin");
+  m_parameters.commit(m_device, frame);
+
+  TRACE_SCOPE("anari", "render");
+  anari_calls::render(m_device, frame);
+}
+
+void RenderThread::readBack(const InFlight &f)
+{
+  auto frame = m_frames[f.frame];
+  auto &result = m_results.back();
+  result.sequence = f.request.sequence;
+  result.keep = f.request.keep;
+  result.cacheKey = f.request.cacheKey;
+  result.input = f.request.input;
+  result.camera = f.request.camera;
+
+  float duration = 0.f;
+  anari::getProperty(m_device, frame, "duration", duration);
+  result.duration = duration * 1000.f;
+  anari::getProperty(
+      m_device, frame, "numSamples", result.samples, ANARI_NO_WAIT);
+
+  const auto start = std::chrono::steady_clock::now();
+  {
+    TRACE_SCOPE("anari", "map");
+    auto fb = anari_calls::map<uint32_t>(m_device, frame, "channel.color");
+    if (!fb.data) {
+      printf("mapped bad frame: %p | %i x %i\n", fb.data, fb.width, fb.height);
+      anari::unmap(m_device, frame, "channel.color");
+      return;
+    }
+    // RGBA8 and float32 alike take four bytes per pixel
+    const auto *bytes = reinterpret_cast<const uint8_t *>(fb.data);
+    result.width = int(fb.width);
+    result.height = int(fb.height);
+    result.linear = fb.pixelType == ANARI_FLOAT32;
+    result.color.assign(bytes, bytes + size_t(fb.width) * fb.height * 4);
+    anari::unmap(m_device, frame, "channel.color");
+  }
+  result.origin.clear();
+  if (f.request.origin) {
+    auto db = anari_calls::map<anari::math::float3>(
+        m_device, frame, "channel.origin");
+    if (db.data) {
+      const auto *values = reinterpret_cast<const float *>(db.data);
+      result.origin.assign(values, values + size_t(db.width) * db.height * 3);
+    }
+    anari::unmap(m_device, frame, "channel.origin");
+  }
+  result.map = std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - start)
+                   .count();
+  m_results.publish();
+}
@@ -0,0 +1,263 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// anari
+#include <anari/anari_cpp/ext/linalg.h>
+#include <anari/anari_cpp.hpp>
+// std
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+// ours
+#include "AnariCalls.h"
+#include "OriginDepth.h"
+
+// Lock-free queue of N - 1 entries between one producer and one consumer
+template <typename T, size_t N>
+class SpscQueue
+{
+ public:
+  // False when full
+  bool push(const T &value)
+  {
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    const size_t next = (tail + 1) % N;
+    if (next == m_head.load(std::memory_order_acquire))
+      return false;
+    m_items[tail] = value;
+    m_tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &value)
+  {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire))
+      return false;
+    value = std::move(m_items[head]);
+    m_head.store((head + 1) % N, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const
+  {
+    return m_head.load(std::memory_order_acquire)
+        == m_tail.load(std::memory_order_acquire);
+  }
+
+ private:
+  std::array<T, N> m_items{};
+  alignas(64) std::atomic<size_t> m_head{0};
+  alignas(64) std::atomic<size_t> m_tail{0};
+};
+
+// Hands the latest value from one writer to one reader without either
+// waiting: the writer fills back() and publish() swaps it with the middle
+// buffer; the reader's acquire() swaps the middle buffer in as front() when
+// it holds a newer value. Values the reader never acquired are overwritten.
+template <typename T>
+class TripleBuffer
+{
+ public:
+  T &back()
+  {
+    return m_buffers[m_back];
+  }
+
+  void publish()
+  {
+    m_back = m_middle.exchange(m_back | g_fresh, std::memory_order_acq_rel)
+        & g_index;
+  }
+
+  // True if front() changed
+  bool acquire()
+  {
+    if (!(m_middle.load(std::memory_order_acquire) & g_fresh))
+      return false;
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & g_index;
+    return true;
+  }
+
+  const T &front() const
+  {
+    return m_buffers[m_front];
+  }
+
+ private:
+  static constexpr unsigned g_index = 3;
+  static constexpr unsigned g_fresh = 4;
+
+  std::array<T, 3> m_buffers{};
+  unsigned m_back{0}; // writer's
+  unsigned m_front{1}; // reader's
+  std::atomic<unsigned> m_middle{2};
+};
+
+// Camera parameters of the interactive frames; region is the camera's
+// imageRegion (lower x, lower y, upper x, upper y)
+struct RenderCamera
+{
+  anari::math::float3 position{0.f, 0.f, 0.f};
+  anari::math::float3 direction{0.f, 0.f, -1.f};
+  anari::math::float3 up{0.f, 1.f, 0.f};
+  float fovy{0.f};
+  float aspect{1.f};
+  float region[4]{0.f, 0.f, 1.f, 1.f};
+
+  bool operator==(const RenderCamera &other) const;
+};
+
+// Sets and commits the camera's parameters that changed
+void applyCamera(anari::Device device,
+    anari::Camera camera,
+    const RenderCamera &params,
+    anari_calls::ParameterCache &parameters);
+
+// Everything the interactive frame depends on that the UI changes between
+// frames. Requests carry the complete state, so a newer one replaces those
+// still queued.
+struct RenderRequest
+{
+  uint64_t sequence{0};
+  RenderCamera camera;
+  anari::math::int2 size{1, 1};
+  anari::DataType colorType{ANARI_UFIXED8_RGBA_SRGB};
+  bool origin{false}; // render and copy channel.origin
+  // discard the frames in flight first (parameter edits) rather than let
+  // them finish
+  bool cancel{false};
+  // rendered and published even when newer requests arrive (screenshots)
+  bool keep{false};
+  uint64_t cacheKey{0}; // of the viewport's frame cache, 0: not cached
+  // the oldest input event not yet on screen, for input-to-display latency
+  std::chrono::steady_clock::time_point input{};
+};
+
+// A finished frame, copied out of the mapped channels
+struct RenderedFrame
+{
+  uint64_t sequence{0}; // of the request rendered
+  bool keep{false};
+  uint64_t cacheKey{0};
+  std::chrono::steady_clock::time_point input{}; // of the request
+  RenderCamera camera; // of the request
+  int width{0}, height{0};
+  bool linear{false}; // color is one float32 per pixel
+  std::vector<uint8_t> color; // RGBA8, or float32 values if linear
+  std::vector<float> origin; // width * height * 3, or empty
+  // the origins as originFormat's distances from camera.position instead,
+  // width * height of them (see OriginDepth.h), or empty
+  OriginFormat originFormat{OriginFormat::Float3};
+  std::vector<uint8_t> depth;
+  float duration{0.f}; // ms, as reported by the device
+  float map{0.f}; // ms to map and copy
+  int samples{0}; // numSamples of accumulating renderers
+};
+
+// Renders the viewport's interactive frames on a thread of its own, so the
+// UI runs at the display's rate however long frames take. The UI pushes
+// requests through a lock-free queue; the thread applies them to the camera
+// and frames, renders, waits, maps and copies the result into a triple
+// buffer the UI reads from. Frames are rendered round-robin over the ring
+// as with the viewport's own loop: with more than one, the next request is
+// submitted before the previous frame is read back.
+//
+// The camera and the frames belong to the thread while it runs. Anything
+// else that touches them (resizing the ring, renderFrame(), changing the
+// world or renderer of the frames) pauses it first; a paused thread has no
+// frame in flight. Renderer and world parameters are committed from the UI
+// as before, since ANARI objects other than the frames and the camera are
+// not touched here. Both sides set the frames' and camera's parameters
+// through the viewport's ParameterCache, so what the other side set is
+// not set and committed again.
+class RenderThread
+{
+ public:
+  RenderThread(anari::Device device,
+      anari::Camera camera,
+      const std::vector<anari::Frame> &frames,
+      anari_calls::ParameterCache &parameters);
+  ~RenderThread();
+
+  RenderThread(const RenderThread &) = delete;
+  RenderThread &operator=(const RenderThread &) = delete;
+
+  // UI thread: false if the queue is full
+  bool push(RenderRequest request);
+  // Requests pushed and not yet published or superseded
+  size_t outstanding() const;
+  // The latest frame, true if it is new since the last call
+  bool acquire();
+  const RenderedFrame &frame() const;
+
+  // Waits for the thread to discard its frames and park; nested pauses
+  // resume on the outermost resume(). The ring may be replaced meanwhile.
+  void pause();
+  void resume();
+  bool paused() const;
+  void setFrames(const std::vector<anari::Frame> &frames); // while paused
+
+  // Scoped pause, of no thread if null
+  class Pause
+  {
+   public:
+    explicit Pause(RenderThread *thread) : m_thread(thread)
+    {
+      if (m_thread)
+        m_thread->pause();
+    }
+    ~Pause()
+    {
+      if (m_thread)
+        m_thread->resume();
+    }
+    Pause(const Pause &) = delete;
+    Pause &operator=(const Pause &) = delete;
+
+   private:
+    RenderThread *m_thread{nullptr};
+  };
+
+ private:
+  struct InFlight
+  {
+    size_t frame{0}; // index into m_frames
+    RenderRequest request;
+    bool discarded{false};
+  };
+
+  void loop();
+  void park();
+  void submit(size_t index, const RenderRequest &request);
+  void readBack(const InFlight &f);
+
+  anari::Device m_device{nullptr};
+  anari::Camera m_camera{nullptr};
+  std::vector<anari::Frame> m_frames;
+  size_t m_nextFrame{0};
+  // the frames' and camera's parameters, shared with the UI thread
+  anari_calls::ParameterCache &m_parameters;
+  // last state applied to the camera; cleared after a pause, when the UI
+  // may have changed it
+  bool m_cameraValid{false};
+  RenderCamera m_appliedCamera;
+
+  SpscQueue<RenderRequest, 16> m_requests;
+  TripleBuffer<RenderedFrame> m_results;
+  std::atomic<uint64_t> m_pushed{0};
+  std::atomic<uint64_t> m_handled{0};
+
+  // bumped on every push, pause and stop; the thread sleeps on it
+  std::atomic<uint32_t> m_signal{0};
+  std::atomic<bool> m_pauseRequested{false};
+  std::atomic<bool> m_parked{false};
+  std::atomic<bool> m_stop{false};
+  int m_pauseDepth{0}; // UI thread only
+  std::thread m_thread;
+};
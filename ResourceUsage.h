@@ -0,0 +1,66 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
+// std
+#include <cstddef>
+
+// Peak resident set size of this process in bytes
+inline size_t peakResidentSetSize()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return size_t(usage.ru_maxrss) * 1024; // ru_maxrss is in KiB on Linux
+}
+
+// Current resident set size of this process in bytes
+inline size_t currentResidentSetSize()
+{
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f)
+    return 0;
+  long pages = 0, resident = 0;
+  int res = fscanf(f, "%ld %ld", &pages, &resident);
+  fclose(f);
+  if (res != 2)
+    return 0;
+  return size_t(resident) * size_t(sysconf(_SC_PAGESIZE));
+}
+
+// Resets the peak resident set size residentSetSizeHighWater() reports to
+// the current one (Linux 4.0+); false if it cannot be reset
+inline bool resetPeakResidentSetSize()
+{
+  FILE *f = fopen("/proc/self/clear_refs", "w");
+  if (!f)
+    return false;
+  const bool ok = fputs("5", f) >= 0;
+  return fclose(f) == 0 && ok;
+}
+
+// Peak resident set size in bytes since the last
+// resetPeakResidentSetSize(); peakResidentSetSize() never goes down
+inline size_t residentSetSizeHighWater()
+{
+  FILE *f = fopen("/proc/self/status", "r");
+  if (!f)
+    return 0;
+  char line[256];
+  size_t kib = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "VmHWM: %zu kB", &kib) == 1)
+      break;
+  }
+  fclose(f);
+  return kib * 1024;
+}
+
+inline double toMiB(size_t bytes)
+{
+  return bytes / (1024.0 * 1024.0);
+}
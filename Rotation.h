@@ -0,0 +1,19 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// anari
+#include "anari/anari_cpp/ext/linalg.h" // math::float3
+// std
+#include <cmath>
+
+// Rodrigues: v rotated about the unit axis by angle radians
+inline anari::math::float3 rotate(const anari::math::float3 &v,
+    const anari::math::float3 &axis,
+    float angle)
+{
+  const float c = std::cos(angle), s = std::sin(angle);
+  return v * c + anari::math::cross(axis, v) * s
+      + axis * (anari::math::dot(axis, v) * (1.f - c));
+}
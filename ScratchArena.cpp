@@ -0,0 +1,97 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ScratchArena.h"
+// std
+#include <algorithm>
+#include <new>
+
+namespace {
+
+constexpr size_t g_minBlockSize = size_t(64) << 10;
+
+void *allocateScratch(void *host, size_t size, size_t alignment)
+{
+  return static_cast<ScratchArena *>(host)->allocate(size, alignment);
+}
+
+} // namespace
+
+ScratchArena::ScratchArena(size_t initialBytes)
+{
+  m_blocks.reserve(8);
+  if (initialBytes > 0)
+    addBlock(initialBytes);
+}
+
+void *ScratchArena::allocate(size_t bytes, size_t alignment)
+{
+  alignment = std::max<size_t>(alignment, 1);
+  if (!m_blocks.empty()) {
+    auto &block = m_blocks.back();
+    const uintptr_t base = uintptr_t(block.data.get());
+    const size_t offset =
+        size_t((base + m_offset + alignment - 1) & ~uintptr_t(alignment - 1))
+        - base;
+    if (offset + bytes <= block.size) {
+      m_used += offset - m_offset + bytes;
+      m_offset = offset + bytes;
+      return block.data.get() + offset;
+    }
+  }
+  // a block at least as large as all before it, so the number of blocks
+  // an iteration adds stays logarithmic in its size
+  const size_t size = std::max({g_minBlockSize, capacity(), bytes + alignment});
+  try {
+    addBlock(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+  return allocate(bytes, alignment);
+}
+
+void ScratchArena::reset()
+{
+  m_highWater = std::max(m_highWater, m_used);
+  if (m_blocks.size() > 1) {
+    // the next iteration of this size fits one block
+    const size_t size = capacity();
+    m_blocks.clear();
+    addBlock(size);
+  }
+  m_offset = 0;
+  m_used = 0;
+}
+
+matcher_scratch ScratchArena::scratch()
+{
+  return matcher_scratch{this, allocateScratch};
+}
+
+size_t ScratchArena::capacity() const
+{
+  size_t size = 0;
+  for (const auto &block : m_blocks)
+    size += block.size;
+  return size;
+}
+
+size_t ScratchArena::highWater() const
+{
+  return std::max(m_highWater, m_used);
+}
+
+uint64_t ScratchArena::heapAllocations() const
+{
+  return m_heapAllocations;
+}
+
+void ScratchArena::addBlock(size_t bytes)
+{
+  Block block;
+  block.data.reset(new uint8_t[bytes]);
+  block.size = bytes;
+  m_blocks.push_back(std::move(block));
+  m_offset = 0;
+  ++m_heapAllocations;
+}
@@ -0,0 +1,63 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+// ours
+#include "MatcherABI.h"
+
+// Scratch memory of a registration loop /////////////////////////////////////
+//
+// A bump allocator for the temporaries of one iteration (render, match,
+// update): allocate() hands out bytes, reset() takes all of them back at
+// once. Blocks are kept across resets, and those added while an iteration
+// outgrew the arena are merged into one, so after the first iterations
+// the loop runs without touching the heap. Matchers get it through
+// matcher_scratch (MatcherABI.h 1.6). Not thread-safe: one arena per loop.
+
+class ScratchArena
+{
+ public:
+  explicit ScratchArena(size_t initialBytes = 0);
+
+  ScratchArena(const ScratchArena &) = delete;
+  ScratchArena &operator=(const ScratchArena &) = delete;
+
+  // alignment: a power of two; nullptr only if the heap is exhausted
+  void *allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+  template <typename T>
+  T *allocate(size_t count)
+  {
+    return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+  }
+
+  // Invalidates everything allocated since the last reset
+  void reset();
+
+  // The view handed to matchers, valid while the arena is
+  matcher_scratch scratch();
+
+  size_t capacity() const; // bytes of all blocks
+  size_t highWater() const; // most bytes used by an iteration
+  uint64_t heapAllocations() const; // blocks taken from the heap so far
+
+ private:
+  struct Block
+  {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size{0};
+  };
+
+  void addBlock(size_t bytes);
+
+  std::vector<Block> m_blocks; // the last one is being filled
+  size_t m_offset{0}; // in the last block
+  size_t m_used{0}; // bytes handed out since the last reset
+  size_t m_highWater{0};
+  uint64_t m_heapAllocations{0};
+};
@@ -0,0 +1,207 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ServerMetrics.h"
+// std
+#include <cstdio>
+// ours
+#include "MemoryFit.h"
+#include "ResourceUsage.h"
+
+namespace {
+
+// seconds
+constexpr double g_timeBuckets[] = {0.0005,
+    0.001,
+    0.0025,
+    0.005,
+    0.01,
+    0.025,
+    0.05,
+    0.1,
+    0.25,
+    0.5,
+    1.0,
+    2.5,
+    10.0};
+// poses, client batches
+constexpr double g_sizeBuckets[] = {
+    1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
+
+const char *g_stageNames[] = {"queue_wait", "render", "readback", "send"};
+
+template <typename H, size_t N>
+void add(H &histogram, const double (&bounds)[N], double value)
+{
+  size_t b = 0;
+  while (b < N && value > bounds[b])
+    ++b;
+  ++histogram.counts[b];
+  histogram.sum += value;
+  ++histogram.count;
+}
+
+void header(
+    std::string &out, const char *name, const char *type, const char *help)
+{
+  out += "# HELP ";
+  out += name;
+  out += ' ';
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += ' ';
+  out += type;
+  out += '\n';
+}
+
+void sample(std::string &out,
+    const char *name,
+    double value,
+    const char *labels = "")
+{
+  char line[256];
+  std::snprintf(line, sizeof(line), "%s%s %.9g\n", name, labels, value);
+  out += line;
+}
+
+// cumulative buckets; label, if any, ends in a comma: `stage="render",`
+template <typename H, size_t N>
+void histogram(std::string &out,
+    const char *name,
+    const H &h,
+    const double (&bounds)[N],
+    const std::string &label = "")
+{
+  char labels[128];
+  const std::string bucket = std::string(name) + "_bucket";
+  uint64_t cumulative = 0;
+  for (size_t b = 0; b <= N; ++b) {
+    cumulative += h.counts[b];
+    if (b < N)
+      std::snprintf(labels,
+          sizeof(labels),
+          "{%sle=\"%g\"}",
+          label.c_str(),
+          bounds[b]);
+    else
+      std::snprintf(labels, sizeof(labels), "{%sle=\"+Inf\"}", label.c_str());
+    sample(out, bucket.c_str(), double(cumulative), labels);
+  }
+  std::string plain = label;
+  if (!plain.empty())
+    plain = "{" + plain.substr(0, plain.size() - 1) + "}";
+  sample(out, (std::string(name) + "_sum").c_str(), h.sum, plain.c_str());
+  sample(out,
+      (std::string(name) + "_count").c_str(),
+      double(h.count),
+      plain.c_str());
+}
+
+} // namespace
+
+void ServerMetrics::batchReceived(size_t poses)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ++m_batches;
+  m_poses += poses;
+}
+
+void ServerMetrics::batchRejected(size_t poses)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ++m_rejectedBatches;
+  m_rejectedPoses += poses;
+}
+
+void ServerMetrics::combinedRender(size_t batches, size_t poses)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  add(m_renderBatches, g_sizeBuckets, double(batches));
+  add(m_renderPoses, g_sizeBuckets, double(poses));
+}
+
+void ServerMetrics::observe(Stage stage, double seconds)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  add(m_stages[stage], g_timeBuckets, seconds);
+}
+
+void ServerMetrics::setQueued(size_t batches, size_t poses)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_queuedBatches = batches;
+  m_queuedPoses = poses;
+}
+
+std::string ServerMetrics::text() const
+{
+  // outside the lock, either may take a moment
+  const size_t rss = currentResidentSetSize();
+  const size_t deviceFree = availableDeviceMemory();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::string out;
+  header(out,
+      "drr_server_batches_total",
+      "counter",
+      "Render batches received");
+  sample(out, "drr_server_batches_total", double(m_batches));
+  header(out, "drr_server_poses_total", "counter", "Poses received");
+  sample(out, "drr_server_poses_total", double(m_poses));
+  header(out,
+      "drr_server_rejected_batches_total",
+      "counter",
+      "Batches turned down as busy (queue full or device memory)");
+  sample(out, "drr_server_rejected_batches_total", double(m_rejectedBatches));
+  header(out,
+      "drr_server_rejected_poses_total",
+      "counter",
+      "Poses of the batches turned down");
+  sample(out, "drr_server_rejected_poses_total", double(m_rejectedPoses));
+
+  header(out,
+      "drr_server_queued_batches",
+      "gauge",
+      "Batches waiting for the device");
+  sample(out, "drr_server_queued_batches", double(m_queuedBatches));
+  header(out,
+      "drr_server_queued_poses",
+      "gauge",
+      "Poses waiting for the device");
+  sample(out, "drr_server_queued_poses", double(m_queuedPoses));
+
+  header(out,
+      "drr_server_stage_seconds",
+      "histogram",
+      "Queue wait per chunk; render, readback and send time per pose");
+  for (int s = 0; s < NumStages; ++s) {
+    histogram(out,
+        "drr_server_stage_seconds",
+        m_stages[s],
+        g_timeBuckets,
+        std::string("stage=\"") + g_stageNames[s] + "\",");
+  }
+  header(out,
+      "drr_server_render_poses",
+      "histogram",
+      "Poses per combined render");
+  histogram(out, "drr_server_render_poses", m_renderPoses, g_sizeBuckets);
+  header(out,
+      "drr_server_render_batches",
+      "histogram",
+      "Client batches per combined render");
+  histogram(out, "drr_server_render_batches", m_renderBatches, g_sizeBuckets);
+
+  header(out,
+      "drr_server_resident_bytes",
+      "gauge",
+      "Resident set size of the server process");
+  sample(out, "drr_server_resident_bytes", double(rss));
+  header(out,
+      "drr_server_device_available_bytes",
+      "gauge",
+      "Free device memory (host memory for CPU devices)");
+  sample(out, "drr_server_device_available_bytes", double(deviceFree));
+  return out;
+}
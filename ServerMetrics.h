@@ -0,0 +1,63 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Render server metrics /////////////////////////////////////////////////////
+//
+// Counters and histograms of the render server (Distributed.h), written in
+// the Prometheus text format for its --metrics-port endpoint. Rates, e.g.
+// requests per second, are left to the scraper (rate(...[1m])); memory is
+// read when scraped. Thread-safe.
+
+class ServerMetrics
+{
+ public:
+  enum Stage
+  {
+    QueueWait, // batch (or its next chunk) queued until rendered
+    Render, // the device's frame duration
+    Readback, // map, copy out and unmap
+    Send, // framing and sending a result
+    NumStages
+  };
+
+  void batchReceived(size_t poses);
+  // turned down by admission control (queue full, device memory)
+  void batchRejected(size_t poses);
+  // one render() call on the device, of poses from `batches` client batches
+  void combinedRender(size_t batches, size_t poses);
+  void observe(Stage stage, double seconds);
+  void setQueued(size_t batches, size_t poses);
+
+  std::string text() const;
+
+ private:
+  template <size_t N>
+  struct Histogram
+  {
+    std::array<uint64_t, N + 1> counts{}; // the last one is +Inf
+    double sum{0.0};
+    uint64_t count{0};
+  };
+
+  static constexpr size_t NumTimeBuckets = 13;
+  static constexpr size_t NumSizeBuckets = 11;
+
+  mutable std::mutex m_mutex;
+  uint64_t m_batches{0};
+  uint64_t m_poses{0};
+  uint64_t m_rejectedBatches{0};
+  uint64_t m_rejectedPoses{0};
+  uint64_t m_queuedBatches{0};
+  uint64_t m_queuedPoses{0};
+  Histogram<NumTimeBuckets> m_stages[NumStages];
+  Histogram<NumSizeBuckets> m_renderPoses;
+  Histogram<NumSizeBuckets> m_renderBatches;
+};
@@ -0,0 +1,167 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Session.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// std
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+SessionVolume SessionVolume::identify(const std::string &file)
+{
+  SessionVolume volume;
+  volume.file = file;
+  std::error_code ec;
+  volume.size = std::filesystem::file_size(file, ec);
+  if (ec) {
+    volume.size = 0;
+    return volume;
+  }
+  const auto time = std::filesystem::last_write_time(file, ec);
+  volume.time = ec ? 0 : int64_t(time.time_since_epoch().count());
+  return volume;
+}
+
+bool SessionVolume::changed() const
+{
+  const auto now = identify(file);
+  return now.size != size || now.time != time;
+}
+
+bool Session::load(const std::string &file)
+{
+  std::ifstream in(file);
+  if (!in) {
+    std::cerr << "ERROR: could not open session " << file << "\n";
+    return false;
+  }
+  const auto dir = std::filesystem::path(file).parent_path();
+  auto path = [&](const std::string &p) {
+    return p.empty() || std::filesystem::path(p).is_absolute()
+        ? p
+        : (dir / p).string();
+  };
+
+  Session session;
+  try {
+    const auto data = nlohmann::json::parse(in);
+    for (const auto &v : data.at("volumes")) {
+      SessionVolume volume;
+      volume.file = path(v.at("file").get<std::string>());
+      volume.size = v.value("size", uint64_t(0));
+      volume.time = v.value("time", int64_t(0));
+      session.volumes.push_back(std::move(volume));
+    }
+    session.predictions = path(data.value("predictions", std::string()));
+    session.worklist = path(data.value("worklist", std::string()));
+    session.caseIndex = data.value("case", size_t(0));
+    session.lutFile = path(data.value("lut", std::string()));
+    if (data.contains("lut_id"))
+      session.lutId = data["lut_id"].get<size_t>();
+    session.photonEnergy = data.value("energy", 0.f);
+    if (data.contains("camera")) {
+      const auto &camera = data["camera"];
+      for (int a = 0; a < 3; ++a) {
+        session.eye[a] = camera.at("eye").at(a).get<float>();
+        session.center[a] = camera.at("center").at(a).get<float>();
+        session.up[a] = camera.at("up").at(a).get<float>();
+      }
+      session.hasCamera = true;
+    }
+    session.matcher = data.value("matcher", std::string());
+    if (data.contains("reference"))
+      session.reference = data["reference"].get<size_t>();
+    if (data.contains("caches")) {
+      const auto &caches = data["caches"];
+      session.lacCacheDir = path(caches.value("lac", std::string()));
+      session.imageCacheDir = path(caches.value("images", std::string()));
+      session.descriptorCacheDir =
+          path(caches.value("descriptors", std::string()));
+      session.lacHalf = caches.value("lac_half", false);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "ERROR: could not parse session " << file << ": "
+              << e.what() << "\n";
+    return false;
+  }
+  if (session.volumes.empty()) {
+    std::cerr << "ERROR: session " << file << " names no volume\n";
+    return false;
+  }
+  *this = std::move(session);
+  return true;
+}
+
+bool Session::save(const std::string &file) const
+{
+  // files below the session's directory relative to it, so they can move
+  // together
+  const auto dir =
+      std::filesystem::absolute(std::filesystem::path(file)).parent_path();
+  auto path = [&](const std::string &p) {
+    if (p.empty())
+      return p;
+    const auto relative =
+        std::filesystem::absolute(p).lexically_proximate(dir);
+    return *relative.begin() == ".." ? std::filesystem::absolute(p).string()
+                                     : relative.string();
+  };
+
+  nlohmann::json volumeList = nlohmann::json::array();
+  for (const auto &v : volumes) {
+    volumeList.push_back(
+        {{"file", path(v.file)}, {"size", v.size}, {"time", v.time}});
+  }
+  nlohmann::json data{{"volumes", volumeList}};
+  if (!predictions.empty())
+    data["predictions"] = path(predictions);
+  if (!worklist.empty()) {
+    data["worklist"] = path(worklist);
+    data["case"] = caseIndex;
+  }
+  if (!lutFile.empty())
+    data["lut"] = path(lutFile);
+  if (lutId != SIZE_MAX)
+    data["lut_id"] = lutId;
+  if (photonEnergy > 0.f)
+    data["energy"] = photonEnergy;
+  if (hasCamera) {
+    data["camera"] = {{"eye", {eye[0], eye[1], eye[2]}},
+        {"center", {center[0], center[1], center[2]}},
+        {"up", {up[0], up[1], up[2]}}};
+  }
+  if (!matcher.empty())
+    data["matcher"] = matcher;
+  if (reference != SIZE_MAX)
+    data["reference"] = reference;
+  nlohmann::json caches = nlohmann::json::object();
+  if (!lacCacheDir.empty())
+    caches["lac"] = path(lacCacheDir);
+  if (!imageCacheDir.empty())
+    caches["images"] = path(imageCacheDir);
+  if (!descriptorCacheDir.empty())
+    caches["descriptors"] = path(descriptorCacheDir);
+  caches["lac_half"] = lacHalf;
+  data["caches"] = caches;
+
+  // through a temporary file, so a crash never leaves half a session
+  const std::string temp = file + ".tmp";
+  {
+    std::ofstream out(temp);
+    out << data.dump(2) << "\n";
+    if (!out) {
+      std::cerr << "ERROR: could not write session " << file << "\n";
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(temp, file, ec);
+  if (ec) {
+    std::cerr << "ERROR: could not write session " << file << ": "
+              << ec.message() << "\n";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,73 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Viewer session snapshot ///////////////////////////////////////////////////
+//
+// What an operator set up in the viewer, so reopening it resumes where they
+// left off (--session): the volumes and predictions (or the worklist case),
+// the LUT and photon energy, the camera, the matcher and the reference image
+// loaded, and the on-disk caches the volumes, reference images and their
+// descriptors were kept in. The snapshot holds no data of its own; with the
+// caches warm, the volume is mapped from the LAC cache and the references
+// from the image and descriptor caches, nothing is converted again. The
+// file is JSON, with paths relative to its directory:
+//
+//   {"volumes": [{"file": "ct/12.nii.gz", "size": 81920352,
+//                 "time": 1718031823000000000}],
+//    "predictions": "ct/12.json", "lut": "lac.json", "lut_id": 2,
+//    "energy": 13500, "camera": {"eye": [..], "center": [..], "up": [..]},
+//    "matcher": "sift", "reference": 17,
+//    "caches": {"lac": "cache/lac", "images": "cache/images",
+//               "descriptors": "ct/12.refcache", "lac_half": false}}
+//
+// Each volume is identified by size and modification time as well; a
+// volume that changed since is read and converted again (the LAC cache
+// misses for it), with a warning.
+
+struct SessionVolume
+{
+  std::string file;
+  uint64_t size{0};
+  int64_t time{0}; // modification time, file clock ticks
+
+  // The file's size and modification time now
+  static SessionVolume identify(const std::string &file);
+  bool changed() const;
+};
+
+struct Session
+{
+  std::vector<SessionVolume> volumes; // the first one is shown
+  std::string predictions; // empty: none
+  std::string worklist; // empty: the volumes above
+  size_t caseIndex{0}; // of the worklist
+
+  std::string lutFile; // empty: the default LUT file
+  size_t lutId{SIZE_MAX}; // SIZE_MAX: the LUT file's first
+  float photonEnergy{0.f}; // eV, 0: the LUT's
+
+  bool hasCamera{false};
+  float eye[3]{0.f, 0.f, 0.f};
+  float center[3]{0.f, 0.f, 0.f};
+  float up[3]{0.f, 1.f, 0.f};
+
+  std::string matcher; // name, empty: the first
+  size_t reference{SIZE_MAX}; // prediction whose image is the reference
+
+  std::string lacCacheDir; // empty: none
+  std::string imageCacheDir; // empty: none
+  std::string descriptorCacheDir; // <predictions>.refcache, empty: none
+  bool lacHalf{false}; // part of the LAC cache key
+
+  // False, with a message, if the file cannot be read or names no volume
+  bool load(const std::string &file);
+  bool save(const std::string &file) const;
+};
@@ -4,6 +4,8 @@
 #include "SettingsEditor.h"
 // std
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <vector>
 
 namespace anari_viewer::windows {
@@ -18,6 +20,22 @@ void SettingsEditor::buildUI()
     m_settingsChanged = false;
   }
 
+  if (m_numPhases > 1) {
+    buildPlaybackUI();
+    ImGui::Separator();
+  } else if (m_volumeNames.size() > 1) {
+    std::vector<const char *> volumeNames;
+    for (auto &name : m_volumeNames)
+      volumeNames.push_back(name.c_str());
+    if (ImGui::Combo("volume",
+            &m_volumeIndex,
+            volumeNames.data(),
+            int(volumeNames.size()))
+        && m_updateVolumeCallback)
+      m_updateVolumeCallback(size_t(m_volumeIndex));
+    ImGui::Separator();
+  }
+
   //combo box
   std::vector<const char *> names(m_names.size(), nullptr);
   std::transform(m_names.begin(),
@@ -40,20 +58,160 @@ void SettingsEditor::buildUI()
 
   ImGui::Separator();
 
-//  //DragFloatRange2
-//  m_tfnChanged |= ImGui::DragFloatRange2("value range",
-//      &m_valueRange.x,
-//      &m_valueRange.y,
-//      0.1f,
-//      -10000.f,
-//      10000.0f,
-//      "Min: %.7f",
-//      "Max: %.7f");
-//
-//  if (ImGui::Button("reset##valueRange")) {
-//    m_valueRange = m_defaultValueRange;
-//    m_tfnChanged = true;
-//  }
+  buildWindowUI();
+
+  if (m_clipBounds[3] > m_clipBounds[0]) {
+    ImGui::Separator();
+    buildClipUI();
+  }
+}
+
+void SettingsEditor::buildPlaybackUI()
+{
+  bool changed = ImGui::Checkbox("play", &m_playing);
+  ImGui::SameLine();
+  changed |= ImGui::SliderFloat("phases/s", &m_phaseRate, 0.5f, 30.f);
+  if (changed && m_updatePlaybackCallback)
+    m_updatePlaybackCallback(m_playing, m_phaseRate);
+
+  int phase = int(m_phase);
+  if (ImGui::SliderInt("phase", &phase, 0, int(m_numPhases) - 1)) {
+    // scrubbing pauses playback
+    if (m_playing) {
+      m_playing = false;
+      if (m_updatePlaybackCallback)
+        m_updatePlaybackCallback(m_playing, m_phaseRate);
+    }
+    if (m_seekPhaseCallback)
+      m_seekPhaseCallback(size_t(phase));
+  }
+}
+
+void SettingsEditor::buildWindowUI()
+{
+  if (m_histogramPlot.empty())
+    return;
+
+  ImGui::PlotHistogram("##histogram",
+      m_histogramPlot.data(),
+      int(m_histogramPlot.size()),
+      0,
+      nullptr,
+      0.f,
+      FLT_MAX,
+      ImVec2(0.f, 80.f));
+  ImGui::Text("data range: [%.5g, %.5g]", m_dataRange[0], m_dataRange[1]);
+
+  const float speed = std::max(m_dataRange[1] - m_dataRange[0], 1e-6f) / 1000.f;
+  bool changed = ImGui::DragFloatRange2("window",
+      &m_valueRange[0],
+      &m_valueRange[1],
+      speed,
+      m_dataRange[0],
+      m_dataRange[1],
+      "Min: %.5g",
+      "Max: %.5g");
+
+  if (ImGui::Button("reset##valueRange")) {
+    std::copy_n(m_dataRange, 2, m_valueRange);
+    changed = true;
+  }
+  if (changed)
+    triggerUpdateValueRangeCallback();
+}
+
+void SettingsEditor::buildClipUI()
+{
+  bool changed = ImGui::Checkbox("clip", &m_clip);
+  if (!m_clip) {
+    if (changed)
+      triggerUpdateClipCallback();
+    return;
+  }
+
+  // renders cost the samples inside the box: a thin slab around the
+  // anatomy of interest renders several times faster
+  static const char *axisNames[3] = {"x [mm]", "y [mm]", "z [mm]"};
+  for (int a = 0; a < 3; ++a) {
+    const float lower = m_clipBounds[a], upper = m_clipBounds[a + 3];
+    ImGui::DragFloatRange2(axisNames[a],
+        &m_clipBox[a],
+        &m_clipBox[a + 3],
+        std::max(upper - lower, 1e-3f) / 500.f,
+        lower,
+        upper,
+        "%.1f",
+        "%.1f",
+        ImGuiSliderFlags_AlwaysClamp);
+    changed |= ImGui::IsItemDeactivatedAfterEdit();
+  }
+
+  // the slab: the box's extent along one axis, about its center
+  ImGui::Combo("slab axis", &m_slabAxis, "x\0y\0z\0");
+  const int a = m_slabAxis;
+  const float center = 0.5f * (m_clipBox[a] + m_clipBox[a + 3]);
+  float thickness = m_clipBox[a + 3] - m_clipBox[a];
+  if (ImGui::SliderFloat("thickness [mm]",
+          &thickness,
+          1.f,
+          std::max(m_clipBounds[a + 3] - m_clipBounds[a], 1.f),
+          "%.1f")) {
+    m_clipBox[a] = std::max(center - 0.5f * thickness, m_clipBounds[a]);
+    m_clipBox[a + 3] =
+        std::min(center + 0.5f * thickness, m_clipBounds[a + 3]);
+  }
+  changed |= ImGui::IsItemDeactivatedAfterEdit();
+
+  if (ImGui::Button("reset##clip")) {
+    std::copy_n(m_clipBounds, 6, m_clipBox);
+    changed = true;
+  }
+  if (changed)
+    triggerUpdateClipCallback();
+}
+
+void SettingsEditor::setValueHistogram(const ValueHistogram &histogram)
+{
+  m_histogramPlot.clear();
+  m_dataRange[0] = m_valueRange[0] = histogram.lower;
+  m_dataRange[1] = m_valueRange[1] = histogram.upper;
+  if (histogram.empty())
+    return;
+
+  // log scale: air and soft tissue would flatten everything else
+  const size_t numBars = 256;
+  const size_t perBar = (histogram.bins.size() + numBars - 1) / numBars;
+  for (size_t b = 0; b < histogram.bins.size(); b += perBar) {
+    uint64_t count = 0;
+    for (size_t i = b; i < std::min(b + perBar, histogram.bins.size()); ++i)
+      count += histogram.bins[i];
+    m_histogramPlot.push_back(std::log1p(float(count)));
+  }
+}
+
+void SettingsEditor::setClipBounds(const float lower[3], const float upper[3])
+{
+  bool overlaps = true;
+  for (int a = 0; a < 3; ++a) {
+    m_clipBounds[a] = lower[a];
+    m_clipBounds[a + 3] = upper[a];
+    overlaps &= m_clipBox[a] < m_clipBox[a + 3] && m_clipBox[a] < upper[a]
+        && m_clipBox[a + 3] > lower[a];
+  }
+  if (!overlaps) {
+    std::copy_n(m_clipBounds, 6, m_clipBox);
+    return;
+  }
+  for (int a = 0; a < 3; ++a) {
+    m_clipBox[a] = std::max(m_clipBox[a], lower[a]);
+    m_clipBox[a + 3] = std::min(m_clipBox[a + 3], upper[a]);
+  }
+}
+
+void SettingsEditor::setClip(bool clip, const float box[6])
+{
+  m_clip = clip;
+  std::copy_n(box, 6, m_clipBox);
 }
 
 void SettingsEditor::setLacLut(size_t lacLutIndex)
@@ -63,7 +221,10 @@ void SettingsEditor::setLacLut(size_t lacLutIndex)
     return;
   m_lacLutId = lacLutId;
   triggerUpdateLacLutCallback();
-  //TODO set photonEnergy
+  if (lacLutId < m_lutEnergies.size()) {
+    m_photonEnergy = m_lutEnergies[lacLutId];
+    m_settingsChanged = true;
+  }
 }
 
 void SettingsEditor::setActiveLacLut(size_t id)
@@ -76,6 +237,21 @@ void SettingsEditor::setLacLutNames(std::vector<std::pair<size_t, std::string>>
   m_names = names;
 }
 
+void SettingsEditor::setLacLutEnergies(std::vector<float> energies)
+{
+  m_lutEnergies = std::move(energies);
+  if (m_lacLutId < m_lutEnergies.size()) {
+    m_photonEnergy = m_defaultPhotonEnergy = m_lutEnergies[m_lacLutId];
+    m_settingsChanged = true;
+  }
+}
+
+void SettingsEditor::setPhotonEnergy(float eV)
+{
+  m_photonEnergy = eV;
+  m_settingsChanged = true;
+}
+
 void SettingsEditor::setUpdateLacLutCallback(SettingsUpdateLacLutCallback cb)
 {
   m_updateLacLutCallback = cb;
@@ -88,6 +264,65 @@ void SettingsEditor::setUpdatePhotonEnergyCallback(SettingsUpdatePhotonEnergyCal
   triggerUpdatePhotonEnergyCallback();
 }
 
+void SettingsEditor::setVolumeNames(std::vector<std::string> names)
+{
+  m_volumeNames = std::move(names);
+  m_volumeIndex = 0;
+}
+
+void SettingsEditor::setUpdateVolumeCallback(SettingsUpdateVolumeCallback cb)
+{
+  m_updateVolumeCallback = cb;
+}
+
+void SettingsEditor::setPhases(
+    size_t count, bool playing, float phasesPerSecond)
+{
+  m_numPhases = count;
+  m_phase = 0;
+  m_playing = playing;
+  m_phaseRate = phasesPerSecond;
+}
+
+void SettingsEditor::setPhase(size_t phase)
+{
+  m_phase = phase;
+}
+
+void SettingsEditor::setUpdatePlaybackCallback(
+    SettingsUpdatePlaybackCallback cb)
+{
+  m_updatePlaybackCallback = cb;
+}
+
+void SettingsEditor::setSeekPhaseCallback(SettingsSeekPhaseCallback cb)
+{
+  m_seekPhaseCallback = cb;
+}
+
+void SettingsEditor::setUpdateValueRangeCallback(
+    SettingsUpdateValueRangeCallback cb)
+{
+  m_updateValueRangeCallback = cb;
+}
+
+void SettingsEditor::setUpdateClipCallback(SettingsUpdateClipCallback cb)
+{
+  m_updateClipCallback = cb;
+}
+
+void SettingsEditor::triggerUpdateClipCallback()
+{
+  if (m_updateClipCallback)
+    m_updateClipCallback(m_clip, m_clipBox);
+}
+
+void SettingsEditor::triggerUpdateValueRangeCallback()
+{
+  if (m_updateValueRangeCallback)
+    m_updateValueRangeCallback(m_valueRange);
+}
+
 void SettingsEditor::triggerUpdateLacLutCallback()
 {
   if (m_updateLacLutCallback)
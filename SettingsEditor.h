@@ -9,6 +9,8 @@
 #include <functional>
 #include <string>
 #include <vector>
+// ours
+#include "FieldTypes.h"
 
 namespace anari_viewer::windows {
 
@@ -16,6 +18,19 @@ using SettingsUpdatePhotonEnergyCallback =
     std::function<void(const float &)>;
 using SettingsUpdateLacLutCallback =
     std::function<void(const size_t &)>;
+using SettingsUpdateVolumeCallback =
+    std::function<void(const size_t &)>;
+// time series: play or pause, phases per second
+using SettingsUpdatePlaybackCallback =
+    std::function<void(bool, float)>;
+using SettingsSeekPhaseCallback =
+    std::function<void(const size_t &)>;
+// window [lower, upper] the transfer function is mapped to
+using SettingsUpdateValueRangeCallback =
+    std::function<void(const float *)>;
+// clipping on or off, the box in object space (lower x, y, z, upper x, y, z)
+using SettingsUpdateClipCallback =
+    std::function<void(bool, const float *)>;
 
 class SettingsEditor : public anari_viewer::windows::Window
 {
@@ -27,27 +42,87 @@ class SettingsEditor : public anari_viewer::windows::Window
 
   void setActiveLacLut(size_t id);
   void setLacLutNames(std::vector<std::pair<size_t, std::string>> names);
+  // Photon energy (eV) of each LUT; selecting a LUT moves the energy to it,
+  // and the active one's is the initial and reset energy
+  void setLacLutEnergies(std::vector<float> energies);
   void setLacLut(size_t lacLutIndex);
+  // Moves the energy as the slider would (a restored session)
+  void setPhotonEnergy(float eV);
   void setUpdateLacLutCallback(SettingsUpdateLacLutCallback cb);
   void setUpdatePhotonEnergyCallback(SettingsUpdatePhotonEnergyCallback cb);
+  void setUpdateValueRangeCallback(SettingsUpdateValueRangeCallback cb);
+  // Volumes of the session; the selector is shown for two or more
+  void setVolumeNames(std::vector<std::string> names);
+  void setUpdateVolumeCallback(SettingsUpdateVolumeCallback cb);
+  // Time series of `count` phases; playback controls replace the volume
+  // selector. setPhase() reports the phase shown.
+  void setPhases(size_t count, bool playing, float phasesPerSecond);
+  void setPhase(size_t phase);
+  void setUpdatePlaybackCallback(SettingsUpdatePlaybackCallback cb);
+  void setSeekPhaseCallback(SettingsSeekPhaseCallback cb);
+  // Histogram of the volume shown; resets the window to its full range
+  void setValueHistogram(const ValueHistogram &histogram);
+  // Object-space bounds of the volume shown, which the clip box is edited
+  // within; the box is kept where it overlaps them, else reset to them
+  void setClipBounds(const float lower[3], const float upper[3]);
+  // Clip box of the command line (--clip), as lower and upper corners
+  void setClip(bool clip, const float box[6]);
+  // Called when an edit of the box ends, not while dragging: each call
+  // uploads the clipped field
+  void setUpdateClipCallback(SettingsUpdateClipCallback cb);
   void triggerUpdateLacLutCallback();
   void triggerUpdatePhotonEnergyCallback();
+  void triggerUpdateValueRangeCallback();
+  void triggerUpdateClipCallback();
 
  private:
+  void buildPlaybackUI();
+  void buildWindowUI();
+  void buildClipUI();
+
   // callback called whenever settings are updated
   SettingsUpdatePhotonEnergyCallback m_updatePhotonEnergyCallback;
   SettingsUpdateLacLutCallback m_updateLacLutCallback;
+  SettingsUpdateValueRangeCallback m_updateValueRangeCallback;
+  SettingsUpdateVolumeCallback m_updateVolumeCallback;
+  SettingsUpdatePlaybackCallback m_updatePlaybackCallback;
+  SettingsSeekPhaseCallback m_seekPhaseCallback;
+  SettingsUpdateClipCallback m_updateClipCallback;
 
   // flag indicating transfer function has changed in UI
   bool m_settingsChanged{true};
 
+  // volumes of the session
+  std::vector<std::string> m_volumeNames;
+  int m_volumeIndex{0};
+
+  // time series playback
+  size_t m_numPhases{0};
+  size_t m_phase{0};
+  bool m_playing{false};
+  float m_phaseRate{10.f};
+
   // LAC LUTs
   std::vector<std::pair<size_t, std::string>> m_names;
   size_t m_lacLutId{0};
+  std::vector<float> m_lutEnergies;
 
   // photon energy
   float m_photonEnergy{120000.f};
   float m_defaultPhotonEnergy{120000.f};
+
+  // value histogram (log counts, merged to a plottable number of bars) and
+  // the window within its range
+  std::vector<float> m_histogramPlot;
+  float m_dataRange[2]{0.f, 1.f};
+  float m_valueRange[2]{0.f, 1.f};
+
+  // clip box (lower xyz, upper xyz) within the volume's bounds, and the
+  // axis its slab controls move
+  bool m_clip{false};
+  float m_clipBounds[6]{0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+  float m_clipBox[6]{0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+  int m_slabAxis{2};
 };
 
 } // namespace anari_viewer::windows
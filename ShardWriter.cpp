@@ -0,0 +1,248 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ShardWriter.h"
+// std
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+// posix
+#include <fcntl.h>
+#include <unistd.h>
+// ours
+#include "Half.h"
+#include "ImageWriter.h"
+#include "Trace.h"
+
+namespace {
+
+#pragma pack(push, 1)
+struct ShardHeader
+{
+  char magic[8]{'D', 'R', 'R', 'S', 'H', 'R', 'D', '1'};
+  uint32_t width{0}, height{0}, count{0};
+  uint32_t format{1}; // float16 linear intensity
+};
+
+struct PosesHeader
+{
+  char magic[8]{'D', 'R', 'R', 'P', 'O', 'S', 'E', '1'};
+  uint64_t count{0}, shardSize{0};
+  uint32_t width{0}, height{0};
+  float fovy{0.f};
+  uint32_t reserved{0};
+};
+#pragma pack(pop)
+
+bool writeAt(int fd, const void *data, size_t size, uint64_t offset)
+{
+  const auto *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    const ssize_t n = pwrite(fd, bytes, size, off_t(offset));
+    if (n <= 0)
+      return false;
+    bytes += n;
+    size -= size_t(n);
+    offset += uint64_t(n);
+  }
+  return true;
+}
+
+} // namespace
+
+ShardWriter::ShardWriter(size_t numThreads, size_t maxPending)
+    : m_maxPending(std::max<size_t>(1, maxPending)), m_pool(numThreads)
+{}
+
+ShardWriter::~ShardWriter()
+{
+  wait();
+  close();
+}
+
+bool ShardWriter::open(const std::string &outputDir,
+    int width,
+    int height,
+    float fovy,
+    uint64_t count,
+    uint64_t shardSize,
+    bool resume)
+{
+  close();
+  std::error_code ec;
+  std::filesystem::create_directories(outputDir, ec);
+  if (ec) {
+    std::cerr << "Could not create " << outputDir << ": " << ec.message()
+              << "\n";
+    return false;
+  }
+
+  m_outputDir = outputDir;
+  m_width = width;
+  m_height = height;
+  m_count = count;
+  m_shardSize = std::max<uint64_t>(shardSize, 1);
+  const size_t numShards = size_t((count + m_shardSize - 1) / m_shardSize);
+  m_shardFds.assign(numShards, -1);
+  m_shardWritten.assign(numShards, 0);
+  m_openFlags = O_WRONLY | O_CREAT | (resume ? 0 : O_TRUNC);
+
+  const auto fileName = outputDir + "/poses.bin";
+  m_posesFd = ::open(fileName.c_str(), m_openFlags, 0644);
+  PosesHeader header;
+  header.count = count;
+  header.shardSize = m_shardSize;
+  header.width = uint32_t(width);
+  header.height = uint32_t(height);
+  header.fovy = fovy;
+  if (m_posesFd < 0 || !writeAt(m_posesFd, &header, sizeof(header), 0)) {
+    std::cerr << "Could not write " << fileName << "\n";
+    close();
+    return false;
+  }
+  return true;
+}
+
+void ShardWriter::skip(uint64_t index)
+{
+  if (index < m_count) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_shardWritten[index / m_shardSize];
+  }
+}
+
+void ShardWriter::setWrittenCallback(
+    std::function<void(uint64_t index)> written)
+{
+  m_written = std::move(written);
+}
+
+void ShardWriter::write(uint64_t index,
+    const PoseSample &sample,
+    const uint8_t *rgba,
+    const DetectorSettings &detector)
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return m_pending < m_maxPending; });
+    ++m_pending;
+  }
+  std::vector<uint8_t> pixels(rgba, rgba + size_t(m_width) * m_height * 4);
+  m_pool.enqueue(
+      [this, index, sample, pixels = std::move(pixels), detector]() {
+        const bool ok = writeNow(index, sample, pixels, detector);
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_failed |= !ok;
+          --m_pending;
+        }
+        m_cv.notify_all();
+      });
+}
+
+bool ShardWriter::wait()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cv.wait(lock, [this]() { return m_pending == 0; });
+  const bool ok = !m_failed;
+  m_failed = false;
+  return ok;
+}
+
+bool ShardWriter::writeNow(uint64_t index,
+    const PoseSample &sample,
+    const std::vector<uint8_t> &rgba,
+    const DetectorSettings &detector)
+{
+  TRACE_SCOPE("export", "write sample");
+  if (index >= m_count)
+    return false;
+
+  ExportImage image;
+  image.width = m_width;
+  image.height = m_height;
+  image.rgba = rgba;
+  auto values = channelValues(image);
+  simulateDetector(values.data(), m_width, m_height, detector, index);
+  std::vector<uint16_t> half(values.size());
+  std::transform(values.begin(), values.end(), half.begin(), floatToHalf);
+
+  const uint64_t shard = index / m_shardSize;
+  const uint64_t imageBytes = half.size() * sizeof(uint16_t);
+  const uint64_t offset =
+      sizeof(ShardHeader) + (index % m_shardSize) * imageBytes;
+
+  PoseRecord record{};
+  record.index = index;
+  record.shard = uint32_t(shard);
+  record.base = sample.base;
+  record.lut = sample.lut;
+  record.photonEnergy = sample.photonEnergy;
+  const auto &p = sample.pose;
+  std::memcpy(record.eye, &p.eye, sizeof(record.eye));
+  std::memcpy(record.center, &p.center, sizeof(record.center));
+  std::memcpy(record.up, &p.up, sizeof(record.up));
+
+  const int fd = shardFile(shard);
+  const bool ok = fd >= 0 && writeAt(fd, half.data(), imageBytes, offset)
+      && writeAt(m_posesFd,
+          &record,
+          sizeof(record),
+          sizeof(PosesHeader) + index * sizeof(PoseRecord));
+  if (!ok) {
+    std::cerr << "Could not write sample " << index << " to "
+              << m_outputDir << "\n";
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const uint64_t shardCount =
+        std::min(m_shardSize, m_count - shard * m_shardSize);
+    if (++m_shardWritten[shard] == shardCount) {
+      ::close(m_shardFds[shard]);
+      m_shardFds[shard] = -1;
+    }
+  }
+  if (m_written)
+    m_written(index);
+  return true;
+}
+
+int ShardWriter::shardFile(uint64_t shard)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_shardFds[shard] >= 0)
+    return m_shardFds[shard];
+
+  char name[32];
+  std::snprintf(name, sizeof(name), "/shard_%05llu.bin", (unsigned long long)shard);
+  const auto fileName = m_outputDir + name;
+  const int fd = ::open(fileName.c_str(), m_openFlags, 0644);
+  ShardHeader header;
+  header.width = uint32_t(m_width);
+  header.height = uint32_t(m_height);
+  header.count = uint32_t(std::min(m_shardSize, m_count - shard * m_shardSize));
+  if (fd < 0 || !writeAt(fd, &header, sizeof(header), 0)) {
+    std::cerr << "Could not write " << fileName << "\n";
+    if (fd >= 0)
+      ::close(fd);
+    return -1;
+  }
+  m_shardFds[shard] = fd;
+  return fd;
+}
+
+void ShardWriter::close()
+{
+  for (int &fd : m_shardFds) {
+    if (fd >= 0)
+      ::close(fd);
+    fd = -1;
+  }
+  if (m_posesFd >= 0)
+    ::close(m_posesFd);
+  m_posesFd = -1;
+}
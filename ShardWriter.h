@@ -0,0 +1,98 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+// ours
+#include "DetectorNoise.h"
+#include "PoseSampler.h"
+#include "ThreadPool.h"
+
+// Training sets of sampled poses, as a few large files instead of one image
+// file per pose. Little-endian, with fixed-size records, so a data loader
+// seeks straight to sample i and the writer fills samples in any order:
+//
+//   shard_<n>.bin  header {"DRRSHRD1", uint32 width, height, count, format
+//                  (1: float16 linear intensity, bottom row first)}, then
+//                  count images of width * height values
+//   poses.bin      header {"DRRPOSE1", uint64 count, shardSize, uint32
+//                  width, height, float fovy}, then per sample
+//                  PoseRecord, in sample order
+class ShardWriter
+{
+ public:
+  struct PoseRecord
+  {
+    uint64_t index;
+    uint32_t shard, base; // shard file, base pose
+    uint32_t lut; // UINT32_MAX: the active LUT
+    float photonEnergy; // keV, 0: the renderer's default
+    float eye[3], center[3], up[3];
+    uint32_t reserved;
+  };
+  static_assert(sizeof(PoseRecord) == 64);
+
+  ShardWriter(size_t numThreads = 2, size_t maxPending = 8);
+  ~ShardWriter(); // finishes the queued writes and closes the files
+
+  ShardWriter(const ShardWriter &) = delete;
+  ShardWriter &operator=(const ShardWriter &) = delete;
+
+  // Creates outputDir and poses.bin for `count` samples. With `resume`
+  // the files of an earlier run of the job are written into, not replaced;
+  // skip() the samples it wrote.
+  bool open(const std::string &outputDir,
+      int width,
+      int height,
+      float fovy,
+      uint64_t count,
+      uint64_t shardSize,
+      bool resume = false);
+  // Sample `index` is in its shard already (resume)
+  void skip(uint64_t index);
+  // Called on a worker thread once a sample's image and pose record are
+  // written (BatchCheckpoint)
+  void setWrittenCallback(std::function<void(uint64_t index)> written);
+
+  // Copies the RGBA8 image, then on a worker thread decodes its red
+  // channel to linear intensity, applies the detector (seeded by the
+  // sample index) and writes image and pose record. Blocks while
+  // maxPending writes are queued.
+  void write(uint64_t index,
+      const PoseSample &sample,
+      const uint8_t *rgba,
+      const DetectorSettings &detector);
+  // Waits for all queued writes; false if one failed
+  bool wait();
+
+ private:
+  bool writeNow(uint64_t index,
+      const PoseSample &sample,
+      const std::vector<uint8_t> &rgba,
+      const DetectorSettings &detector);
+  int shardFile(uint64_t shard);
+  void close();
+
+  std::string m_outputDir;
+  int m_width{0}, m_height{0};
+  uint64_t m_count{0}, m_shardSize{1};
+  int m_openFlags{0}; // of the files, O_TRUNC unless resuming
+  std::function<void(uint64_t)> m_written;
+  int m_posesFd{-1};
+  std::vector<int> m_shardFds; // opened on their first image
+  std::vector<uint64_t> m_shardWritten; // closed once full
+
+  size_t m_maxPending{8};
+  size_t m_pending{0};
+  bool m_failed{false};
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  ThreadPool m_pool; // last, so it joins before the state above goes
+};
@@ -0,0 +1,204 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "SimilarityMatcher.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+// ours
+#include "Parallel.h"
+
+void SimilarityMatcher::set_image(const void *data,
+    size_t width,
+    size_t height,
+    PIXEL_TYPE pixel_type,
+    IMAGE_TYPE image_type,
+    bool /*swizzle: gray is channel-order agnostic*/)
+{
+  if (pixel_type != PIXEL_TYPE::RGBA || !data)
+    return; // 3D positions are not needed for intensity scores
+
+  if (image_type == IMAGE_TYPE::REFERENCE) {
+    auto *bytes = static_cast<const uint8_t *>(data);
+    m_referenceRGBA.assign(bytes, bytes + width * height * 4);
+    m_referenceWidth = width;
+    m_referenceHeight = height;
+    m_reference.clear(); // resampled lazily onto the next query grid
+  } else if (image_type == IMAGE_TYPE::QUERY) {
+    if (width != m_width || height != m_height)
+      m_reference.clear();
+    m_width = width;
+    m_height = height;
+    toGray(data, width, height, width, height, m_query);
+  }
+}
+
+void SimilarityMatcher::calibrate(size_t, size_t, float, float) {}
+
+void SimilarityMatcher::match()
+{
+  if (m_query.empty() || m_referenceRGBA.empty()) {
+    fprintf(stderr, "similarity: need a reference and a query image\n");
+    return;
+  }
+
+  if (m_reference.empty()) {
+    toGray(m_referenceRGBA.data(),
+        m_referenceWidth,
+        m_referenceHeight,
+        m_width,
+        m_height,
+        m_reference);
+    gradients(
+        m_reference.data(), m_width, m_height, m_referenceDx, m_referenceDy);
+  }
+
+  const size_t n = m_width * m_height;
+  gradients(m_query.data(), m_width, m_height, m_queryDx, m_queryDy);
+
+  m_scores.ncc = ncc(m_query.data(), m_reference.data(), n);
+  m_scores.gradientCorrelation = 0.5f
+      * (ncc(m_queryDx.data(), m_referenceDx.data(), n)
+          + ncc(m_queryDy.data(), m_referenceDy.data(), n));
+  m_scores.mutualInformation =
+      mutualInformation(m_query.data(), m_reference.data(), n);
+}
+
+bool SimilarityMatcher::update_camera(
+    std::array<float, 3> &, std::array<float, 3> &, std::array<float, 3> &)
+{
+  return false;
+}
+
+const SimilarityMatcher::Scores &SimilarityMatcher::score() const
+{
+  return m_scores;
+}
+
+float SimilarityMatcher::ncc(const float *a, const float *b, size_t n)
+{
+  if (n == 0)
+    return 0.f;
+
+  // one pass over both images, accumulated per range in double
+  std::mutex mutex;
+  double sa = 0.0, sb = 0.0, saa = 0.0, sbb = 0.0, sab = 0.0;
+  parallelFor(0, n, [&](size_t begin, size_t end) {
+    double la = 0.0, lb = 0.0, laa = 0.0, lbb = 0.0, lab = 0.0;
+    for (size_t i = begin; i < end; ++i) {
+      la += a[i];
+      lb += b[i];
+      laa += double(a[i]) * a[i];
+      lbb += double(b[i]) * b[i];
+      lab += double(a[i]) * b[i];
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    sa += la;
+    sb += lb;
+    saa += laa;
+    sbb += lbb;
+    sab += lab;
+  });
+
+  const double cov = sab - sa * sb / n;
+  const double va = saa - sa * sa / n;
+  const double vb = sbb - sb * sb / n;
+  if (va <= 0.0 || vb <= 0.0)
+    return 0.f;
+  return float(cov / std::sqrt(va * vb));
+}
+
+float SimilarityMatcher::mutualInformation(
+    const float *a, const float *b, size_t n, size_t numBins)
+{
+  if (n == 0 || numBins < 2)
+    return 0.f;
+
+  auto bin = [numBins](float v) {
+    return std::min(numBins - 1, size_t(std::clamp(v, 0.f, 1.f) * numBins));
+  };
+
+  std::mutex mutex;
+  std::vector<size_t> joint(numBins * numBins, 0);
+  parallelFor(0, n, [&](size_t begin, size_t end) {
+    std::vector<size_t> local(numBins * numBins, 0);
+    for (size_t i = begin; i < end; ++i)
+      local[bin(a[i]) * numBins + bin(b[i])]++;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < local.size(); ++i)
+      joint[i] += local[i];
+  });
+
+  std::vector<double> pa(numBins, 0.0), pb(numBins, 0.0);
+  for (size_t i = 0; i < numBins; ++i) {
+    for (size_t j = 0; j < numBins; ++j) {
+      double p = double(joint[i * numBins + j]) / n;
+      pa[i] += p;
+      pb[j] += p;
+    }
+  }
+
+  double mi = 0.0;
+  for (size_t i = 0; i < numBins; ++i) {
+    for (size_t j = 0; j < numBins; ++j) {
+      double p = double(joint[i * numBins + j]) / n;
+      if (p > 0.0)
+        mi += p * std::log(p / (pa[i] * pb[j]));
+    }
+  }
+  return float(mi);
+}
+
+void SimilarityMatcher::gradients(const float *image,
+    size_t width,
+    size_t height,
+    std::vector<float> &dx,
+    std::vector<float> &dy)
+{
+  dx.assign(width * height, 0.f);
+  dy.assign(width * height, 0.f);
+  if (width < 3 || height < 3)
+    return;
+
+  parallelFor(
+      1,
+      height - 1,
+      [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+          const float *row = image + y * width;
+          for (size_t x = 1; x + 1 < width; ++x) {
+            dx[y * width + x] = 0.5f * (row[x + 1] - row[x - 1]);
+            dy[y * width + x] = 0.5f * (row[x + width] - row[x - width]);
+          }
+        }
+      },
+      64);
+}
+
+void SimilarityMatcher::toGray(const void *rgba,
+    size_t width,
+    size_t height,
+    size_t outWidth,
+    size_t outHeight,
+    std::vector<float> &gray)
+{
+  auto *bytes = static_cast<const uint8_t *>(rgba);
+  gray.resize(outWidth * outHeight);
+
+  parallelFor(
+      0,
+      outHeight,
+      [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+          const size_t sy = y * height / outHeight;
+          for (size_t x = 0; x < outWidth; ++x) {
+            const size_t sx = x * width / outWidth;
+            const uint8_t *p = bytes + (sy * width + sx) * 4;
+            gray[y * outWidth + x] = (p[0] + p[1] + p[2]) / (3.f * 255.f);
+          }
+        }
+      },
+      64);
+}
@@ -0,0 +1,72 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <vector>
+// ours
+#include "Matcher.h"
+
+// Built-in intensity-based matcher: scores the rendered DRR (QUERY) against
+// the reference image with normalized cross correlation, gradient
+// correlation and mutual information. It estimates no pose of its own
+// (update_camera() leaves the camera unchanged); optimizers read score()
+// after match() to rank candidate poses.
+struct SimilarityMatcher : public feature_matcher
+{
+  struct Scores
+  {
+    float ncc{0.f}; // [-1, 1]
+    float gradientCorrelation{0.f}; // [-1, 1], mean of d/dx and d/dy NCC
+    float mutualInformation{0.f}; // nats
+  };
+
+  void set_image(const void *data,
+      size_t width,
+      size_t height,
+      PIXEL_TYPE pixel_type,
+      IMAGE_TYPE image_type,
+      bool swizzle) override;
+  void match() override;
+  void calibrate(size_t width, size_t height, float fovy, float aspect) override;
+  bool update_camera(std::array<float, 3> &eye,
+      std::array<float, 3> &center,
+      std::array<float, 3> &up) override;
+
+  const Scores &score() const;
+
+  static float ncc(const float *a, const float *b, size_t n);
+  static float mutualInformation(
+      const float *a, const float *b, size_t n, size_t numBins = 64);
+  // central differences, zero at the border
+  static void gradients(const float *image,
+      size_t width,
+      size_t height,
+      std::vector<float> &dx,
+      std::vector<float> &dy);
+
+ private:
+  // Grayscale in [0, 1], resampled to the query grid when sizes differ
+  static void toGray(const void *rgba,
+      size_t width,
+      size_t height,
+      size_t outWidth,
+      size_t outHeight,
+      std::vector<float> &gray);
+
+  std::vector<uint8_t> m_referenceRGBA;
+  size_t m_referenceWidth{0};
+  size_t m_referenceHeight{0};
+
+  std::vector<float> m_query;
+  std::vector<float> m_reference; // on the query grid
+  size_t m_width{0};
+  size_t m_height{0};
+
+  // scratch, reused across match() calls
+  std::vector<float> m_queryDx, m_queryDy, m_referenceDx, m_referenceDy;
+
+  Scores m_scores;
+};
@@ -0,0 +1,315 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "SlabRender.h"
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <thread>
+// ours
+#include "Distributed.h"
+#include "Trace.h"
+
+namespace {
+
+// Sums the slabs of one pose after the other and writes the DRRs like
+// BatchRenderer::renderAll(), the manifest at the end
+class SlabSum
+{
+ public:
+  SlabSum(const BatchRenderSettings &settings,
+      const std::vector<prediction> &poses,
+      size_t numSlabs)
+      : m_settings(settings),
+        m_poses(poses),
+        m_numSlabs(numSlabs),
+        m_numPixels(size_t(settings.width) * settings.height),
+        m_writer(std::max(2u, std::thread::hardware_concurrency() / 2), 8),
+        m_entries(poses.size()),
+        m_integral(m_numPixels),
+        m_origin(settings.writeOrigin ? m_numPixels * 3 : 0)
+  {}
+
+  bool createOutputDir() const
+  {
+    std::error_code ec;
+    std::filesystem::create_directories(m_settings.outputDir, ec);
+    if (ec) {
+      std::cerr << "Could not create " << m_settings.outputDir << ": "
+                << ec.message() << "\n";
+    }
+    return !ec;
+  }
+
+  void begin()
+  {
+    std::fill(m_integral.begin(), m_integral.end(), 0.f);
+    std::fill(m_origin.begin(),
+        m_origin.end(),
+        std::numeric_limits<float>::quiet_NaN());
+  }
+
+  void add(size_t index, const uint8_t *color, const float *origin)
+  {
+    TRACE_SCOPE("slabs", "add slab");
+    const auto &pose = m_poses[index];
+    const float eye[3] = {pose.eye.x, pose.eye.y, pose.eye.z};
+    addSlab(reinterpret_cast<const float *>(color),
+        origin,
+        m_numPixels,
+        eye,
+        m_integral.data(),
+        m_origin.empty() ? nullptr : m_origin.data());
+  }
+
+  bool write(size_t index)
+  {
+    std::vector<float> intensity(m_numPixels);
+    for (size_t p = 0; p < m_numPixels; ++p)
+      intensity[p] = std::exp(-m_integral[p]);
+    auto &entry = m_entries[index];
+    entry = BatchRenderer::manifestEntry(index,
+        m_poses[index],
+        imageExtension(m_settings.format),
+        !m_origin.empty());
+    entry["slabs"] = m_numSlabs;
+    std::cout << "\rrendered " << index + 1 << "/" << m_poses.size()
+              << std::flush;
+    return BatchRenderer::writeOutputs(m_settings,
+        index,
+        BatchRenderer::exportImage(m_settings, index, std::move(intensity)),
+        m_origin.empty() ? nullptr : m_origin.data(),
+        &m_writer);
+  }
+
+  bool finish(bool success, std::chrono::steady_clock::time_point start)
+  {
+    const auto end = std::chrono::steady_clock::now();
+    std::cout << "\n";
+    if (!m_writer.wait() || !success)
+      return false;
+
+    const float seconds = std::chrono::duration<float>(end - start).count();
+    std::cout << "Rendered " << m_poses.size() << " poses in " << m_numSlabs
+              << " slabs in " << seconds << "s ("
+              << (seconds > 0.f ? m_poses.size() / seconds : 0.f)
+              << " poses/s)\n";
+    return BatchRenderer::writeManifest(m_settings.outputDir,
+        m_settings.width,
+        m_settings.height,
+        m_settings.fovy,
+        std::move(m_entries));
+  }
+
+ private:
+  const BatchRenderSettings &m_settings;
+  const std::vector<prediction> &m_poses;
+  size_t m_numSlabs{0};
+  size_t m_numPixels{0};
+  ImageWriter m_writer;
+  std::vector<nlohmann::json> m_entries;
+  std::vector<float> m_integral;
+  std::vector<float> m_origin;
+};
+
+} // namespace
+
+SlabRange slabRange(int dimZ, size_t slab, size_t numSlabs)
+{
+  // numSlabs pieces of the dimZ - 1 gaps between slices
+  const size_t gaps = size_t(std::max(dimZ - 1, 0));
+  numSlabs = std::max<size_t>(numSlabs, 1);
+  SlabRange range;
+  range.z0 = int(gaps * slab / numSlabs);
+  range.z1 = int(gaps * (slab + 1) / numSlabs);
+  return range;
+}
+
+StructuredField slabField(const StructuredField &field, const SlabRange &range)
+{
+  StructuredField slab;
+  slab.bytesPerCell = field.bytesPerCell;
+  slab.isHalf = field.isHalf;
+  slab.mapped = field.mapped;
+  slab.dataRange = field.dataRange;
+  slab.dimX = field.dimX;
+  slab.dimY = field.dimY;
+  slab.dimZ = std::max(range.z1 - range.z0 + 1, 0);
+  std::copy_n(field.spacing, 3, slab.spacing);
+  std::copy_n(field.origin, 3, slab.origin);
+  slab.origin[2] += range.z0 * field.spacing[2];
+  if (!field.empty() && slab.dimZ > 0) {
+    const size_t sliceBytes =
+        size_t(field.dimX) * field.dimY * field.bytesPerCell;
+    const auto *first =
+        static_cast<const uint8_t *>(field.data()) + range.z0 * sliceBytes;
+    // aliases the whole buffer, which stays alive while the slab does
+    slab.voxels = std::shared_ptr<const void>(field.voxels, first);
+  }
+  return slab;
+}
+
+void addSlab(const float *partial,
+    const float *partialOrigin,
+    size_t numPixels,
+    const float eye[3],
+    float *integral,
+    float *origin)
+{
+  for (size_t i = 0; i < numPixels; ++i)
+    integral[i] += partial[i];
+  if (!origin || !partialOrigin)
+    return;
+
+  auto distance = [eye](const float *p) {
+    const float dx = p[0] - eye[0], dy = p[1] - eye[1], dz = p[2] - eye[2];
+    return dx * dx + dy * dy + dz * dz;
+  };
+  for (size_t i = 0; i < numPixels; ++i) {
+    const float *p = partialOrigin + i * 3;
+    float *o = origin + i * 3;
+    if (!std::isfinite(p[0]) || !std::isfinite(p[1]) || !std::isfinite(p[2]))
+      continue;
+    if (std::isnan(o[0]) || distance(p) < distance(o))
+      std::copy_n(p, 3, o);
+  }
+}
+
+bool renderAllSlabs(const std::vector<BatchRenderer *> &renderers,
+    const std::vector<prediction> &poses)
+{
+  if (renderers.empty())
+    return false;
+
+  const auto &settings = renderers.front()->settings();
+  if (!settings.linear) {
+    std::cerr << "Slabs need renderers with linear (float32) color\n";
+    return false;
+  }
+  SlabSum sum(settings, poses, renderers.size());
+  if (!sum.createOutputDir())
+    return false;
+
+  // every slab renders pose i in slot i % numSlots; the devices work on
+  // their slabs of the same poses at once, and the oldest pose is summed
+  // and written once all of them are done with it
+  const size_t numSlots = renderers.front()->numSlots();
+  bool success = true;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; success && i < poses.size() + numSlots; ++i) {
+    if (i >= numSlots) {
+      const size_t done = i - numSlots;
+      sum.begin();
+      for (auto *renderer : renderers) {
+        const auto *r = renderer->readback(done % numSlots);
+        success = success && r;
+        if (r) {
+          sum.add(done,
+              r->color.data(),
+              r->origin.empty() ? nullptr : r->origin.data());
+        }
+      }
+      success = success && sum.write(done);
+    }
+    if (success && i < poses.size()) {
+      for (auto *renderer : renderers)
+        renderer->submit(i % numSlots, poses[i]);
+    }
+  }
+  return sum.finish(success, start);
+}
+
+bool renderAllRemoteSlabs(const std::vector<std::string> &servers,
+    const BatchRenderSettings &settings,
+    const std::vector<prediction> &poses,
+    size_t batchSize)
+{
+  std::vector<std::unique_ptr<RenderClient>> clients;
+  for (const auto &server : servers) {
+    const auto colon = server.rfind(':');
+    auto client = std::make_unique<RenderClient>();
+    if (colon == std::string::npos
+        || !client->connect(
+            server.substr(0, colon), std::atoi(server.c_str() + colon + 1)))
+      return false;
+    clients.push_back(std::move(client));
+  }
+  if (clients.empty())
+    return false;
+  SlabSum sum(settings, poses, clients.size());
+  if (!sum.createOutputDir())
+    return false;
+
+  RenderBatchHeader header;
+  header.width = uint32_t(settings.width);
+  header.height = uint32_t(settings.height);
+  header.flags =
+      g_renderLinear | (settings.writeOrigin ? g_renderWithOrigin : 0);
+  batchSize = std::max<size_t>(batchSize, 1);
+  const size_t numBatches = (poses.size() + batchSize - 1) / batchSize;
+  auto send = [&](size_t batch) {
+    std::vector<RenderPose> renderPoses;
+    for (size_t i = batch * batchSize;
+         i < std::min(poses.size(), (batch + 1) * batchSize);
+         ++i) {
+      const auto &p = poses[i];
+      auto copy = [](const anari::math::float3 &v, float *out) {
+        out[0] = v.x;
+        out[1] = v.y;
+        out[2] = v.z;
+      };
+      RenderPose r;
+      r.id = i;
+      copy(p.eye, r.eye);
+      copy(p.center, r.center);
+      copy(p.up, r.up);
+      r.fovy = settings.fovy;
+      renderPoses.push_back(r);
+    }
+    bool ok = true;
+    for (auto &client : clients)
+      ok = client->sendBatch(header, renderPoses) && ok;
+    return ok;
+  };
+
+  // one batch ahead: the servers render the next batch while this one's
+  // partials are summed
+  bool success = numBatches == 0 || send(0);
+  const auto start = std::chrono::steady_clock::now();
+  RenderResultHeader result;
+  std::vector<uint8_t> color;
+  std::vector<float> origin;
+  for (size_t batch = 0; success && batch < numBatches; ++batch) {
+    if (batch + 1 < numBatches)
+      success = send(batch + 1);
+    const size_t end = std::min(poses.size(), (batch + 1) * batchSize);
+    for (size_t i = batch * batchSize; success && i < end; ++i) {
+      sum.begin();
+      for (auto &client : clients) {
+        bool done = false;
+        success = client->receive(result, color, origin, done) && !done
+            && result.status == 0 && result.id == i
+            && result.width == header.width && result.height == header.height
+            && (result.flags & g_renderLinear);
+        if (!success) {
+          std::cerr << "Slab server failed on pose " << i << "\n";
+          break;
+        }
+        sum.add(i, color.data(), origin.empty() ? nullptr : origin.data());
+      }
+      success = success && sum.write(i);
+    }
+    for (auto &client : clients) {
+      bool done = false;
+      success = success && client->receive(result, color, origin, done)
+          && done;
+    }
+  }
+  return sum.finish(success, start);
+}
@@ -0,0 +1,66 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <string>
+#include <vector>
+// ours
+#include "BatchRenderer.h"
+#include "Crop.h"
+#include "FieldTypes.h"
+#include "prediction.h"
+
+// Data-parallel DRRs of volumes larger than one device ////////////////////////
+//
+// Line integrals add up along the ray, so a volume split into z slabs can be
+// rendered slab by slab, one slab per device, and the partial integrals
+// (float32 color frames, BatchRenderSettings::linear) summed on the host.
+// Nothing is sorted or composited between slabs, and the slabs may live on
+// other nodes, each reading only its slices. Neighbouring slabs share
+// their boundary slice, so the slab boxes abut and trilinear samples inside
+// each are those of the whole volume.
+
+// Slices z0..z1 (inclusive) of a slab
+struct SlabRange
+{
+  int z0{0};
+  int z1{-1};
+};
+
+// Slab `slab` of numSlabs over dimZ slices, as even as the slices allow
+SlabRange slabRange(int dimZ, size_t slab, size_t numSlabs);
+
+// The slab's slices as a field of their own, sharing the voxels of `field`
+// (z slabs are contiguous in memory) with the origin moved to the first
+// slice; the data range is kept, macrocells and histogram are dropped
+StructuredField slabField(const StructuredField &field, const SlabRange &range);
+
+// Adds one slab's partial integrals to `integral`; origin, if not null,
+// keeps the first hit nearest to eye of the slabs added so far (start with
+// NaN, partialOrigin may be null)
+void addSlab(const float *partial,
+    const float *partialOrigin,
+    size_t numPixels,
+    const float eye[3],
+    float *integral,
+    float *origin);
+
+// Renders every pose on all renderers, one per slab, and writes the summed
+// DRR like BatchRenderer::renderAll(): <outputDir>/drr_<index> images of the
+// intensity exp(-integral) (after the settings' detector), .origin files and
+// a manifest. The renderers must share the settings, with linear set.
+bool renderAllSlabs(const std::vector<BatchRenderer *> &renderers,
+    const std::vector<prediction> &poses);
+
+// The same across nodes: every render server (host:port) holds one slab
+// (--slab), renders the partial integrals of all poses (g_renderLinear,
+// Distributed.h) and the sums are written here; batches of batchSize poses
+// go out to all servers at once, one batch ahead of the one being summed.
+// The servers' volumes must be slabs of the same volume.
+bool renderAllRemoteSlabs(const std::vector<std::string> &servers,
+    const BatchRenderSettings &settings,
+    const std::vector<prediction> &poses,
+    size_t batchSize = 32);
@@ -0,0 +1,39 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// posix
+#include <sys/socket.h>
+#include <sys/types.h>
+// std
+#include <cstddef>
+
+// Blocking send of all `size` bytes; false once the peer is gone. Uses
+// MSG_NOSIGNAL, a closed peer does not raise SIGPIPE.
+inline bool sendAll(int socket, const void *data, size_t size)
+{
+  auto *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t n = ::send(socket, bytes, size, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    bytes += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Blocking receive of exactly `size` bytes; false on EOF or error
+inline bool recvAll(int socket, void *data, size_t size)
+{
+  auto *bytes = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t n = ::recv(socket, bytes, size, 0);
+    if (n <= 0)
+      return false;
+    bytes += n;
+    size -= n;
+  }
+  return true;
+}
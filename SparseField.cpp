@@ -0,0 +1,70 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "SparseField.h"
+// std
+#include <cstring>
+// nanovdb
+#ifdef HAVE_NANOVDB
+#include <nanovdb/NanoVDB.h>
+#include <nanovdb/tools/CreateNanoGrid.h>
+#endif
+// ours
+#include "BrickedField.h"
+#include "Trace.h"
+#include "VoxelTypes.h"
+
+SparseGrid makeSparseGrid(const StructuredField &field, float emptyValue)
+{
+  SparseGrid result;
+#ifdef HAVE_NANOVDB
+  TRACE_SCOPE("field", "make sparse grid");
+  constexpr int leafSize = 8;
+  const auto leaves = makeBrickedField(field, leafSize, 0, emptyValue);
+  if (leaves.empty())
+    return result;
+  result.totalLeaves = leaves.bricks.size();
+  result.leaves = leaves.numStoredBricks();
+
+  nanovdb::tools::build::Grid<float> grid(0.f, "attenuation");
+  // index to world: the field's spacing on the diagonal, its origin
+  double mat[3][3] = {}, invMat[3][3] = {}, translate[3];
+  for (int a = 0; a < 3; ++a) {
+    mat[a][a] = field.spacing[a];
+    invMat[a][a] = 1.0 / field.spacing[a];
+    translate[a] = field.origin[a];
+  }
+  grid.mMap.set(mat, invMat, translate);
+
+  auto accessor = grid.getAccessor();
+  dispatchVoxelType(field, [&](auto voxel) {
+    using Voxel = decltype(voxel);
+    using Storage = typename Voxel::Storage;
+    for (const auto &b : leaves.bricks) {
+      const auto *src = static_cast<const Storage *>(leaves.brickData(b));
+      if (!src)
+        continue;
+      for (int z = 0; z < b.dims[2]; ++z)
+        for (int y = 0; y < b.dims[1]; ++y)
+          for (int x = 0; x < b.dims[0]; ++x) {
+            const float v = Voxel::value(*src++);
+            if (v <= emptyValue)
+              continue;
+            accessor.setValue(nanovdb::Coord(b.origin[0] + x,
+                                  b.origin[1] + y,
+                                  b.origin[2] + z),
+                v);
+            ++result.activeVoxels;
+          }
+    }
+  });
+
+  auto handle = nanovdb::tools::createNanoGrid(grid);
+  result.buffer.resize(handle.size());
+  std::memcpy(result.buffer.data(), handle.data(), handle.size());
+#else
+  (void)field;
+  (void)emptyValue;
+#endif
+  return result;
+}
@@ -0,0 +1,38 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+// ours
+#include "FieldTypes.h"
+
+// Sparse fields of mostly empty volumes /////////////////////////////////////
+//
+// Attenuation volumes of segmented or thresholded scans (bone-only DRRs,
+// implants) are mostly air, yet dense fields store and march through every
+// voxel. A NanoVDB float grid holds the occupied voxels only, so devices
+// with a "nanovdb" spatial field scale in storage and ray traversal with
+// them. The grid is built after the LAC conversion: the occupied 8^3 leaves
+// (NanoVDB's leaf size) are found on all cores, only their voxels go into
+// the build grid, and NanoVDB lays out the tree. Needs the NanoVDB headers
+// (HAVE_NANOVDB); the buffer stays empty without them.
+struct SparseGrid
+{
+  std::vector<uint8_t> buffer; // NanoVDB grid, as the device takes it
+  size_t activeVoxels{0};
+  size_t leaves{0}; // occupied 8^3 leaves
+  size_t totalLeaves{0}; // of the dense field
+
+  bool empty() const
+  {
+    return buffer.empty();
+  }
+};
+
+// Voxels above emptyValue become the grid's active voxels, placed with the
+// field's spacing and origin; the others read as the background, 0
+SparseGrid makeSparseGrid(const StructuredField &field, float emptyValue = 0.f);
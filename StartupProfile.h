@@ -0,0 +1,93 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstdio>
+#include <mutex>
+#include <vector>
+// ours
+#include "Trace.h"
+
+// Cold start of the viewer in stages, timed from (about) process start to
+// the first frame showing the volume. Stages may overlap, e.g. the volume
+// read on the loader thread while the device comes up, so their durations
+// need not add up to the total. With tracing on they also go to the trace
+// (category "startup").
+class StartupProfile
+{
+ public:
+  using Clock = trace::Clock;
+
+  // Times a stage from construction to destruction
+  class Stage
+  {
+   public:
+    Stage(StartupProfile &profile, const char *name)
+        : m_profile(profile), m_name(name), m_begin(Clock::now())
+    {}
+    ~Stage()
+    {
+      m_profile.record(m_name, m_begin, Clock::now());
+    }
+
+    Stage(const Stage &) = delete;
+    Stage &operator=(const Stage &) = delete;
+
+   private:
+    StartupProfile &m_profile;
+    const char *m_name;
+    Clock::time_point m_begin;
+  };
+
+  // name must outlive the profile (a string literal); any thread
+  void record(const char *name, Clock::time_point begin, Clock::time_point end)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stages.push_back({name, begin, end});
+    }
+    if (trace::enabled())
+      trace::record(name, "startup", begin, end);
+  }
+
+  // Ends the profile on the first call and prints it; later calls return
+  // right away
+  void finish(const char *what = "first frame")
+  {
+    if (m_finished)
+      return;
+    m_finished = true;
+    const auto end = Clock::now();
+    auto seconds = [](Clock::duration d) {
+      return std::chrono::duration<double>(d).count();
+    };
+    std::lock_guard<std::mutex> lock(m_mutex);
+    printf("Startup: %s after %.2f s\n", what, seconds(end - m_start));
+    for (const auto &stage : m_stages) {
+      printf("  %-24s %7.1f ms  (at %.2f s)\n",
+          stage.name,
+          1000.0 * seconds(stage.end - stage.begin),
+          seconds(stage.begin - m_start));
+    }
+  }
+
+  bool finished() const
+  {
+    return m_finished;
+  }
+
+ private:
+  struct Entry
+  {
+    const char *name;
+    Clock::time_point begin;
+    Clock::time_point end;
+  };
+
+  Clock::time_point m_start{Clock::now()};
+  std::mutex m_mutex;
+  std::vector<Entry> m_stages;
+  bool m_finished{false};
+};
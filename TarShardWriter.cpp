@@ -0,0 +1,289 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "TarShardWriter.h"
+// std
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+// posix
+#include <fcntl.h>
+#include <unistd.h>
+// ours
+#include "Trace.h"
+
+namespace {
+
+constexpr size_t g_tarBlock = 512;
+// appended to the files in whole chunks, at chunk-aligned offsets
+constexpr size_t g_chunkBytes = size_t(4) << 20;
+constexpr size_t g_chunkAlignment = 4096;
+
+void octal(char *field, size_t width, uint64_t value)
+{
+  // width - 1 digits and a NUL
+  std::snprintf(field,
+      width,
+      "%0*llo",
+      int(width - 1),
+      (unsigned long long)value);
+}
+
+// One ustar member: header block, data, zeros up to the next block
+void addMember(std::vector<uint8_t> &tar,
+    const std::string &name,
+    const void *data,
+    size_t size,
+    uint64_t mtime)
+{
+  char header[g_tarBlock] = {};
+  std::strncpy(header, name.c_str(), 99);
+  octal(header + 100, 8, 0644); // mode
+  octal(header + 108, 8, 0); // uid
+  octal(header + 116, 8, 0); // gid
+  octal(header + 124, 12, size);
+  octal(header + 136, 12, mtime);
+  header[156] = '0'; // regular file
+  std::memcpy(header + 257, "ustar", 6);
+  std::memcpy(header + 263, "00", 2);
+
+  // computed with the checksum field as spaces
+  std::memset(header + 148, ' ', 8);
+  unsigned checksum = 0;
+  for (char c : header)
+    checksum += uint8_t(c);
+  std::snprintf(header + 148, 8, "%06o", checksum);
+  header[155] = ' ';
+
+  tar.insert(tar.end(), header, header + g_tarBlock);
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  tar.insert(tar.end(), bytes, bytes + size);
+  tar.resize(tar.size() + (g_tarBlock - size % g_tarBlock) % g_tarBlock, 0);
+}
+
+bool writeAll(int fd, const uint8_t *data, size_t size)
+{
+  while (size > 0) {
+    const ssize_t n = ::write(fd, data, size);
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= size_t(n);
+  }
+  return true;
+}
+
+} // namespace
+
+TarShardWriter::TarShardWriter(size_t numThreads, size_t maxPending)
+    : m_maxPending(std::max<size_t>(1, maxPending)), m_pool(numThreads)
+{
+  m_io = std::thread([this]() { ioLoop(); });
+}
+
+TarShardWriter::~TarShardWriter()
+{
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  m_io.join();
+  // shards short of samples (after failures) still end as valid archives
+  for (auto &shard : m_shards)
+    finish(shard);
+}
+
+bool TarShardWriter::open(
+    const std::string &outputDir, size_t numSamples, size_t shardSize)
+{
+  wait();
+  for (auto &shard : m_shards)
+    finish(shard);
+
+  std::error_code ec;
+  std::filesystem::create_directories(outputDir, ec);
+  if (ec) {
+    std::cerr << "Could not create " << outputDir << ": " << ec.message()
+              << "\n";
+    return false;
+  }
+  m_outputDir = outputDir;
+  m_shardSize = std::max<size_t>(shardSize, 1);
+  std::vector<Shard> shards((numSamples + m_shardSize - 1) / m_shardSize);
+  for (size_t i = 0; i < shards.size(); ++i)
+    shards[i].numSamples = std::min(m_shardSize, numSamples - i * m_shardSize);
+  m_shards = std::move(shards);
+  return true;
+}
+
+std::string TarShardWriter::shardName(size_t shard)
+{
+  char name[32];
+  std::snprintf(name, sizeof(name), "shard_%05zu.tar", shard);
+  return name;
+}
+
+void TarShardWriter::setWrittenCallback(
+    std::function<void(size_t index)> written)
+{
+  m_written = std::move(written);
+}
+
+void TarShardWriter::write(size_t index,
+    const std::string &baseName,
+    ImageFormat format,
+    ExportImage image,
+    std::vector<float> origin,
+    std::string json)
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return m_pending < m_maxPending; });
+    ++m_pending;
+  }
+  m_pool.enqueue([this,
+                     index,
+                     baseName,
+                     format,
+                     image = std::move(image),
+                     origin = std::move(origin),
+                     json = std::move(json)]() {
+    Sample sample{index / m_shardSize, {}};
+    std::vector<uint8_t> encoded;
+    if (sample.shard >= m_shards.size()
+        || !ImageWriter::encode(format, image, encoded)) {
+      std::cerr << "Could not encode " << baseName << "\n";
+      done(false);
+      return;
+    }
+
+    const uint64_t mtime = uint64_t(std::time(nullptr));
+    sample.tar.reserve(encoded.size() + origin.size() * sizeof(float)
+        + json.size() + 6 * g_tarBlock);
+    addMember(sample.tar,
+        baseName + imageExtension(format),
+        encoded.data(),
+        encoded.size(),
+        mtime);
+    if (!origin.empty()) {
+      addMember(sample.tar,
+          baseName + ".origin",
+          origin.data(),
+          origin.size() * sizeof(float),
+          mtime);
+    }
+    addMember(sample.tar, baseName + ".json", json.data(), json.size(), mtime);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_queue.push_back(std::move(sample));
+    }
+    m_cv.notify_all();
+  });
+}
+
+bool TarShardWriter::wait()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cv.wait(lock, [this]() { return m_pending == 0; });
+  const bool ok = !m_failed;
+  m_failed = false;
+  return ok;
+}
+
+void TarShardWriter::ioLoop()
+{
+  for (;;) {
+    Sample sample;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+      if (m_queue.empty())
+        return;
+      sample = std::move(m_queue.front());
+      m_queue.pop_front();
+    }
+
+    TRACE_SCOPE("export", "append sample");
+    auto &shard = m_shards[sample.shard];
+    bool ok = append(shard, sample.shard, sample.tar.data(), sample.tar.size());
+    if (ok && ++shard.numWritten == shard.numSamples) {
+      ok = finish(shard);
+      const size_t first = sample.shard * m_shardSize;
+      for (size_t i = first; ok && m_written && i < first + shard.numSamples;
+           ++i)
+        m_written(i);
+    }
+    done(ok);
+  }
+}
+
+bool TarShardWriter::append(
+    Shard &shard, size_t number, const uint8_t *data, size_t size)
+{
+  if (shard.fd < 0) {
+    const auto fileName = m_outputDir + "/" + shardName(number);
+    shard.fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    shard.chunk = {static_cast<uint8_t *>(
+                       std::aligned_alloc(g_chunkAlignment, g_chunkBytes)),
+        std::free};
+    shard.used = 0;
+    if (shard.fd < 0 || !shard.chunk) {
+      std::cerr << "Could not create " << fileName << "\n";
+      if (shard.fd >= 0)
+        ::close(shard.fd);
+      shard.fd = -1;
+      return false;
+    }
+  }
+
+  while (size > 0) {
+    const size_t n = std::min(size, g_chunkBytes - shard.used);
+    std::memcpy(shard.chunk.get() + shard.used, data, n);
+    shard.used += n;
+    data += n;
+    size -= n;
+    if (shard.used == g_chunkBytes && !flush(shard))
+      return false;
+  }
+  return true;
+}
+
+bool TarShardWriter::flush(Shard &shard)
+{
+  const bool ok = writeAll(shard.fd, shard.chunk.get(), shard.used);
+  shard.used = 0;
+  if (!ok)
+    std::cerr << "Could not write to " << m_outputDir << "\n";
+  return ok;
+}
+
+bool TarShardWriter::finish(Shard &shard)
+{
+  if (shard.fd < 0)
+    return true;
+  // the archive ends with two zero blocks
+  const uint8_t end[2 * g_tarBlock] = {};
+  bool ok = append(shard, size_t(&shard - m_shards.data()), end, sizeof(end))
+      && flush(shard);
+  ok = ::close(shard.fd) == 0 && ok;
+  shard.fd = -1;
+  shard.chunk.reset();
+  return ok;
+}
+
+void TarShardWriter::done(bool ok)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_failed |= !ok;
+    --m_pending;
+  }
+  m_cv.notify_all();
+}
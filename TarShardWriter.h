@@ -0,0 +1,91 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+// ours
+#include "ImageWriter.h"
+#include "ThreadPool.h"
+
+// Batch output as a few large tar files instead of one file per image:
+// sample i goes to shard_<i / shardSize>.tar as the members <base><ext>,
+// <base>.origin (if any) and <base>.json, the WebDataset layout. Images are
+// encoded on worker threads; one I/O thread appends the encoded samples to
+// their shards in large aligned chunks, so a slow (network) filesystem
+// sees few big sequential writes and neither the encoders nor the render
+// loops wait for it unless maxPending samples are already queued.
+class TarShardWriter
+{
+ public:
+  explicit TarShardWriter(size_t numThreads = 2, size_t maxPending = 8);
+  ~TarShardWriter(); // finishes the queued samples and closes the shards
+
+  TarShardWriter(const TarShardWriter &) = delete;
+  TarShardWriter &operator=(const TarShardWriter &) = delete;
+
+  // Shards for numSamples samples, created in outputDir as they fill
+  bool open(const std::string &outputDir, size_t numSamples, size_t shardSize);
+  static std::string shardName(size_t shard);
+  // Called on the I/O thread for every sample of a shard once the shard is
+  // complete and closed (BatchCheckpoint)
+  void setWrittenCallback(std::function<void(size_t index)> written);
+
+  // Takes ownership of the pixels; origin may be empty, json is the
+  // sample's metadata
+  void write(size_t index,
+      const std::string &baseName,
+      ImageFormat format,
+      ExportImage image,
+      std::vector<float> origin,
+      std::string json);
+  // Waits for all queued samples; false if one failed since the last
+  // wait(). Shards are complete (and closed) once all their samples are.
+  bool wait();
+
+ private:
+  struct Shard
+  {
+    int fd{-1};
+    size_t numSamples{0}; // expected
+    size_t numWritten{0};
+    std::unique_ptr<uint8_t, void (*)(void *)> chunk{nullptr, nullptr};
+    size_t used{0}; // bytes in chunk
+  };
+
+  struct Sample
+  {
+    size_t shard;
+    std::vector<uint8_t> tar; // the members, padded to tar blocks
+  };
+
+  void ioLoop();
+  bool append(Shard &shard, size_t number, const uint8_t *data, size_t size);
+  bool flush(Shard &shard);
+  bool finish(Shard &shard);
+  void done(bool ok);
+
+  std::string m_outputDir;
+  size_t m_shardSize{1};
+  std::vector<Shard> m_shards; // touched by the I/O thread only
+  std::function<void(size_t)> m_written;
+
+  size_t m_maxPending{8};
+  size_t m_pending{0}; // written but not yet appended
+  bool m_failed{false};
+  bool m_stop{false};
+  std::deque<Sample> m_queue; // encoded, for the I/O thread
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::thread m_io;
+  ThreadPool m_pool; // last, so it joins before the state above goes
+};
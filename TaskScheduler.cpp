@@ -0,0 +1,267 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "TaskScheduler.h"
+// std
+#include <algorithm>
+
+namespace {
+
+// the scheduler and index of the worker running on this thread, if any
+thread_local const void *t_scheduler = nullptr;
+thread_local size_t t_worker = 0;
+
+std::atomic<TaskScheduler *> g_shared{nullptr};
+
+} // namespace
+
+// CancelToken definitions ////////////////////////////////////////////////////
+
+CancelToken::CancelToken() : m_state(std::make_shared<State>()) {}
+
+void CancelToken::cancel()
+{
+  std::lock_guard<std::mutex> lock(m_state->mutex);
+  m_state->cancelled = true;
+}
+
+bool CancelToken::cancelled() const
+{
+  std::lock_guard<std::mutex> lock(m_state->mutex);
+  return m_state->cancelled;
+}
+
+void CancelToken::cancelAndWait()
+{
+  std::unique_lock<std::mutex> lock(m_state->mutex);
+  m_state->cancelled = true;
+  m_state->cv.wait(lock, [this]() { return m_state->running == 0; });
+}
+
+// TaskScheduler definitions //////////////////////////////////////////////////
+
+TaskScheduler::TaskScheduler(size_t numThreads)
+{
+  if (numThreads == 0)
+    numThreads = std::max<size_t>(2, std::thread::hardware_concurrency() / 2);
+  for (size_t i = 0; i < numThreads; ++i)
+    m_workers.push_back(std::make_unique<Worker>());
+  for (size_t i = 0; i < numThreads; ++i)
+    m_threads.emplace_back([this, i]() { workerLoop(i); });
+}
+
+TaskScheduler::~TaskScheduler()
+{
+  stop();
+}
+
+void TaskScheduler::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (auto &t : m_threads) {
+    if (t.joinable())
+      t.join();
+  }
+
+  // destroying a task breaks its promise
+  auto drop = [](std::mutex &mutex, Queues &queues) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &queue : queues)
+      queue.clear();
+  };
+  drop(m_sharedMutex, m_shared);
+  for (auto &worker : m_workers)
+    drop(worker->mutex, worker->queues);
+  for (auto &queued : m_queued)
+    queued = 0;
+  m_numQueued = 0;
+}
+
+void TaskScheduler::runChunks(size_t count,
+    size_t grain,
+    size_t maxThreads,
+    const std::function<void(size_t, size_t)> &body)
+{
+  if (count == 0)
+    return;
+  grain = std::max<size_t>(grain, 1);
+  const size_t chunks = (count - 1) / grain + 1;
+  // the workers and the caller
+  const size_t threads = std::min(
+      {std::max<size_t>(maxThreads, 1), chunks, numThreads() + 1});
+  if (threads == 1) {
+    body(0, count);
+    return;
+  }
+
+  // helpers that start after the last chunk was taken find nothing to do;
+  // they keep the job alive, not the caller's body
+  struct Job
+  {
+    std::atomic<size_t> next{0};
+    size_t count{0};
+    size_t grain{0};
+    const std::function<void(size_t, size_t)> *body{nullptr};
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t done{0}; // items
+  };
+  auto job = std::make_shared<Job>();
+  job->count = count;
+  job->grain = grain;
+  job->body = &body;
+  auto work = [job]() {
+    size_t items = 0;
+    for (size_t begin = job->next.fetch_add(job->grain); begin < job->count;
+         begin = job->next.fetch_add(job->grain)) {
+      const size_t end = std::min(begin + job->grain, job->count);
+      (*job->body)(begin, end);
+      items += end - begin;
+    }
+    if (items == 0)
+      return;
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->done += items;
+    if (job->done == job->count)
+      job->cv.notify_all();
+  };
+  for (size_t i = 1; i < threads; ++i)
+    submit(TaskPriority::Interactive, work);
+  work();
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->cv.wait(lock, [&]() { return job->done == job->count; });
+}
+
+TaskScheduler *TaskScheduler::shared()
+{
+  return g_shared;
+}
+
+void TaskScheduler::setShared(TaskScheduler *scheduler)
+{
+  g_shared = scheduler;
+}
+
+size_t TaskScheduler::queued(TaskPriority priority) const
+{
+  return m_queued[int(priority)];
+}
+
+size_t TaskScheduler::running() const
+{
+  return m_running;
+}
+
+size_t TaskScheduler::numThreads() const
+{
+  return m_threads.size();
+}
+
+void TaskScheduler::push(TaskPriority priority, Task task)
+{
+  const int p = int(priority);
+  // checked under the queue's lock, which stop() takes after setting it
+  if (t_scheduler == this) {
+    auto &worker = *m_workers[t_worker];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (m_stop)
+      return;
+    worker.queues[p].push_back(std::move(task));
+  } else {
+    std::lock_guard<std::mutex> lock(m_sharedMutex);
+    if (m_stop)
+      return;
+    m_shared[p].push_back(std::move(task));
+  }
+  ++m_queued[p];
+  ++m_numQueued;
+  {
+    // a worker about to sleep either sees the count or gets the
+    // notification
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+  }
+  m_wake.notify_one();
+}
+
+bool TaskScheduler::tryPop(size_t worker, Task &task)
+{
+  auto take = [&](std::mutex &mutex, std::deque<Task> &queue, bool newest) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (queue.empty())
+      return false;
+    if (newest) {
+      task = std::move(queue.back());
+      queue.pop_back();
+    } else {
+      task = std::move(queue.front());
+      queue.pop_front();
+    }
+    return true;
+  };
+
+  const size_t n = m_workers.size();
+  for (int p = 0; p < int(NumTaskPriorities); ++p) {
+    if (m_queued[p] == 0)
+      continue;
+    // own tasks newest first (their data is likely still in cache), then
+    // the shared queue, then the oldest tasks of the others
+    auto &own = *m_workers[worker];
+    bool found = take(own.mutex, own.queues[p], true)
+        || take(m_sharedMutex, m_shared[p], false);
+    for (size_t i = 1; !found && i < n; ++i) {
+      auto &victim = *m_workers[(worker + i) % n];
+      found = take(victim.mutex, victim.queues[p], false);
+    }
+    if (found) {
+      --m_queued[p];
+      --m_numQueued;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::run(Task &task)
+{
+  if (task.token) {
+    std::lock_guard<std::mutex> lock(task.token->mutex);
+    if (task.token->cancelled)
+      return; // dropped: the future sees a broken promise
+    ++task.token->running;
+  }
+
+  ++m_running;
+  task.run();
+  --m_running;
+
+  if (task.token) {
+    {
+      std::lock_guard<std::mutex> lock(task.token->mutex);
+      --task.token->running;
+    }
+    task.token->cv.notify_all();
+  }
+}
+
+void TaskScheduler::workerLoop(size_t worker)
+{
+  t_scheduler = this;
+  t_worker = worker;
+  for (;;) {
+    if (m_stop)
+      return; // the queued tasks are dropped
+    Task task;
+    if (tryPop(worker, task)) {
+      run(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_sleepMutex);
+    m_wake.wait(lock, [this]() { return m_stop || m_numQueued > 0; });
+    if (m_stop)
+      return;
+  }
+}
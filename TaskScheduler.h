@@ -0,0 +1,155 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Higher priorities first: a worker picks the oldest task of the highest
+// priority any queue holds
+enum class TaskPriority : int
+{
+  Interactive, // matching the user waits for
+  Prefetch, // reference images, the next phase
+  Thumbnail,
+  Background, // idle-time work nobody waits for (DRRs rendered ahead)
+};
+constexpr size_t NumTaskPriorities = 4;
+
+// Shared by the tasks of one piece of work (e.g. prefetches of a prediction
+// set); copies refer to the same state. Cancelled tasks that have not
+// started are dropped, their futures throw std::future_error (broken
+// promise); running ones finish unless they poll cancelled().
+class CancelToken
+{
+ public:
+  CancelToken();
+
+  void cancel();
+  bool cancelled() const;
+  // Cancels and waits for the tasks already running, e.g. before the
+  // objects they use go away
+  void cancelAndWait();
+
+ private:
+  friend class TaskScheduler;
+
+  struct State
+  {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool cancelled{false};
+    int running{0};
+  };
+
+  std::shared_ptr<State> m_state;
+};
+
+// One pool of worker threads for the viewer's background work: image
+// decoding, phase conversion, matching and thumbnails. Each worker has its
+// own deque per priority. Tasks submitted from a worker go to its deque and
+// run last in, first out; tasks from other threads go to a shared queue,
+// and idle workers steal the oldest tasks of the others.
+class TaskScheduler
+{
+ public:
+  explicit TaskScheduler(size_t numThreads = 0); // 0: half the cores, >= 2
+  ~TaskScheduler(); // stop()
+
+  // Drops the queued tasks (their futures throw std::future_error) and
+  // joins the running ones; tasks submitted later are dropped too. For
+  // owners whose tasks use state that goes before the scheduler.
+  void stop();
+
+  TaskScheduler(const TaskScheduler &) = delete;
+  TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+  template <typename Func>
+  auto submit(TaskPriority priority, Func &&func)
+      -> std::future<std::invoke_result_t<Func>>
+  {
+    return submitTask(priority, nullptr, std::forward<Func>(func));
+  }
+
+  template <typename Func>
+  auto submit(TaskPriority priority, const CancelToken &token, Func &&func)
+      -> std::future<std::invoke_result_t<Func>>
+  {
+    return submitTask(priority, token.m_state, std::forward<Func>(func));
+  }
+
+  // Runs body(begin, end) over [0, count) in chunks of grain items, at most
+  // maxThreads at once: on the workers at interactive priority and on the
+  // calling thread, which takes chunks until none are left and then waits
+  // for the ones still running. So it finishes even if every worker is
+  // busy, e.g. when called from a task of the same scheduler.
+  void runChunks(size_t count,
+      size_t grain,
+      size_t maxThreads,
+      const std::function<void(size_t, size_t)> &body);
+
+  // The session's scheduler (AppState sets it), which parallelFor() and
+  // jobs without one of their own run on; null outside of a session
+  static TaskScheduler *shared();
+  static void setShared(TaskScheduler *scheduler);
+
+  // Tasks waiting to start, tasks running
+  size_t queued(TaskPriority priority) const;
+  size_t running() const;
+  size_t numThreads() const;
+
+ private:
+  struct Task
+  {
+    std::function<void()> run;
+    std::shared_ptr<CancelToken::State> token; // null: not cancellable
+  };
+
+  using Queues = std::deque<Task>[NumTaskPriorities];
+
+  struct Worker
+  {
+    std::mutex mutex;
+    Queues queues;
+  };
+
+  template <typename Func>
+  auto submitTask(TaskPriority priority,
+      std::shared_ptr<CancelToken::State> token,
+      Func &&func) -> std::future<std::invoke_result_t<Func>>
+  {
+    using Result = std::invoke_result_t<Func>;
+    auto task = std::make_shared<std::packaged_task<Result()>>(
+        std::forward<Func>(func));
+    auto future = task->get_future();
+    push(priority, Task{[task]() { (*task)(); }, std::move(token)});
+    return future;
+  }
+
+  void push(TaskPriority priority, Task task);
+  bool tryPop(size_t worker, Task &task);
+  void run(Task &task);
+  void workerLoop(size_t worker);
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::mutex m_sharedMutex;
+  Queues m_shared; // submitted from outside the pool
+  std::atomic<size_t> m_queued[NumTaskPriorities]{};
+  std::atomic<size_t> m_numQueued{0};
+  std::atomic<size_t> m_running{0};
+
+  std::mutex m_sleepMutex;
+  std::condition_variable m_wake;
+  std::atomic<bool> m_stop{false};
+  std::vector<std::thread> m_threads; // last, the state above outlives them
+};
@@ -0,0 +1,342 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "TemplateLibrary.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+// ours
+#include "ImagePreprocess.h"
+#include "Parallel.h"
+
+namespace {
+
+#pragma pack(push, 1)
+struct FileHeader
+{
+  char magic[8]{'D', 'R', 'R', 'T', 'M', 'P', 'L', '1'};
+  uint32_t width{0}, height{0};
+  uint64_t count{0};
+  uint32_t numLists{0};
+  uint32_t contextLength{0};
+};
+#pragma pack(pop)
+
+float dot(const float *a, const float *b, size_t n)
+{
+  float sum = 0.f;
+  for (size_t i = 0; i < n; ++i)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+// To unit length; all zeros stay zero
+void normalize(float *v, size_t n)
+{
+  const float length = std::sqrt(dot(v, v, n));
+  if (length > 0.f) {
+    for (size_t i = 0; i < n; ++i)
+      v[i] /= length;
+  }
+}
+
+} // namespace
+
+TemplateLibrary::TemplateLibrary(int width, int height)
+    : m_width(std::max(1, width)), m_height(std::max(1, height))
+{}
+
+std::vector<float> TemplateLibrary::embed(
+    const uint8_t *rgba, size_t width, size_t height) const
+{
+  std::vector<float> e(dims(), 0.f);
+  if (!rgba || !width || !height)
+    return e;
+  const size_t w = size_t(m_width), h = size_t(m_height);
+  for (size_t y = 0; y < h; ++y) {
+    const size_t y0 = y * height / h;
+    const size_t y1 = std::max(y0 + 1, (y + 1) * height / h);
+    for (size_t x = 0; x < w; ++x) {
+      const size_t x0 = x * width / w;
+      const size_t x1 = std::max(x0 + 1, (x + 1) * width / w);
+      uint64_t sum = 0;
+      for (size_t sy = y0; sy < y1; ++sy) {
+        const uint8_t *row = rgba + sy * width * 4;
+        for (size_t sx = x0; sx < x1; ++sx)
+          sum += row[sx * 4] + row[sx * 4 + 1] + row[sx * 4 + 2];
+      }
+      e[y * w + x] = float(sum) / float(3 * (y1 - y0) * (x1 - x0));
+    }
+  }
+
+  const float mean =
+      std::accumulate(e.begin(), e.end(), 0.f) / float(e.size());
+  for (float &v : e)
+    v -= mean;
+  normalize(e.data(), e.size());
+  return e;
+}
+
+std::vector<float> TemplateLibrary::embed(const Image &image) const
+{
+  if (image.gray16()) {
+    const Image rgba = rgbaImage(image);
+    return embed(rgba.data.data(), rgba.width, rgba.height);
+  }
+  if (image.bpp != 4)
+    return std::vector<float>(dims(), 0.f);
+  return embed(image.data.data(), image.width, image.height);
+}
+
+void TemplateLibrary::add(
+    const prediction &pose, const std::vector<float> &embedding)
+{
+  const float p[9] = {pose.eye.x,
+      pose.eye.y,
+      pose.eye.z,
+      pose.center.x,
+      pose.center.y,
+      pose.center.z,
+      pose.up.x,
+      pose.up.y,
+      pose.up.z};
+  m_poses.insert(m_poses.end(), p, p + 9);
+  m_embeddings.insert(m_embeddings.end(), embedding.begin(), embedding.end());
+  m_embeddings.resize(m_poses.size() / 9 * dims(), 0.f);
+}
+
+void TemplateLibrary::buildIndex(int iterations)
+{
+  const size_t n = size();
+  const size_t d = dims();
+  m_centroids.clear();
+  m_listOffsets.assign(1, 0);
+  m_listIds.clear();
+  if (n == 0)
+    return;
+
+  // spherical k-means: centroids are unit length like the embeddings, and
+  // templates go to the centroid of the largest dot product
+  const size_t lists = std::clamp<size_t>(
+      size_t(std::lround(std::sqrt(double(n)))), 1, 4096);
+  m_centroids.resize(lists * d);
+  for (size_t j = 0; j < lists; ++j)
+    std::copy_n(embedding(j * n / lists), d, m_centroids.begin() + j * d);
+
+  std::vector<uint32_t> assignment(n, 0);
+  auto assign = [&]() {
+    parallelFor(
+        0,
+        n,
+        [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end; ++i) {
+            float best = -2.f;
+            for (size_t j = 0; j < lists; ++j) {
+              const float s = dot(embedding(i), centroid(j), d);
+              if (s > best) {
+                best = s;
+                assignment[i] = uint32_t(j);
+              }
+            }
+          }
+        },
+        256);
+  };
+
+  for (int it = 0; it < iterations; ++it) {
+    assign();
+    std::vector<float> sums(lists * d, 0.f);
+    std::vector<size_t> counts(lists, 0);
+    for (size_t i = 0; i < n; ++i) {
+      const float *e = embedding(i);
+      float *s = sums.data() + assignment[i] * d;
+      for (size_t k = 0; k < d; ++k)
+        s[k] += e[k];
+      ++counts[assignment[i]];
+    }
+    // empty lists keep their centroid
+    for (size_t j = 0; j < lists; ++j) {
+      if (!counts[j])
+        continue;
+      normalize(sums.data() + j * d, d);
+      std::copy_n(sums.data() + j * d, d, m_centroids.begin() + j * d);
+    }
+  }
+  assign();
+
+  // the lists, by a counting sort of the assignment
+  m_listOffsets.assign(lists + 1, 0);
+  for (uint32_t j : assignment)
+    ++m_listOffsets[j + 1];
+  std::partial_sum(
+      m_listOffsets.begin(), m_listOffsets.end(), m_listOffsets.begin());
+  m_listIds.resize(n);
+  std::vector<uint32_t> fill(m_listOffsets.begin(), m_listOffsets.end() - 1);
+  for (size_t i = 0; i < n; ++i)
+    m_listIds[fill[assignment[i]]++] = uint32_t(i);
+}
+
+std::vector<TemplateMatch> TemplateLibrary::query(
+    const std::vector<float> &e, size_t count, size_t probes) const
+{
+  std::vector<TemplateMatch> matches;
+  const size_t d = dims();
+  if (e.size() != d || size() == 0 || numLists() == 0)
+    return matches;
+
+  std::vector<TemplateMatch> lists(numLists());
+  for (size_t j = 0; j < lists.size(); ++j)
+    lists[j] = {j, dot(e.data(), centroid(j), d)};
+  probes = std::clamp<size_t>(probes, 1, lists.size());
+  auto better = [](const TemplateMatch &a, const TemplateMatch &b) {
+    return a.score > b.score;
+  };
+  std::partial_sort(
+      lists.begin(), lists.begin() + probes, lists.end(), better);
+
+  for (size_t p = 0; p < probes; ++p) {
+    const size_t j = lists[p].index;
+    for (uint32_t k = m_listOffsets[j]; k < m_listOffsets[j + 1]; ++k) {
+      const uint32_t i = m_listIds[k];
+      matches.push_back({i, dot(e.data(), embedding(i), d)});
+    }
+  }
+  count = std::min(count, matches.size());
+  std::partial_sort(
+      matches.begin(), matches.begin() + count, matches.end(), better);
+  matches.resize(count);
+  return matches;
+}
+
+bool TemplateLibrary::save(
+    const std::string &file, const std::string &context) const
+{
+  FILE *out = std::fopen(file.c_str(), "wb");
+  if (!out) {
+    std::cerr << "Could not write template library " << file << "\n";
+    return false;
+  }
+  FileHeader header;
+  header.width = uint32_t(m_width);
+  header.height = uint32_t(m_height);
+  header.count = size();
+  header.numLists = uint32_t(numLists());
+  header.contextLength = uint32_t(context.size());
+  auto write = [&](const void *data, size_t bytes) {
+    return bytes == 0 || std::fwrite(data, bytes, 1, out) == 1;
+  };
+  bool ok = write(&header, sizeof(header))
+      && write(context.data(), context.size())
+      && write(m_poses.data(), m_poses.size() * sizeof(float))
+      && write(m_embeddings.data(), m_embeddings.size() * sizeof(float))
+      && write(m_centroids.data(), m_centroids.size() * sizeof(float))
+      && write(m_listOffsets.data(), m_listOffsets.size() * sizeof(uint32_t))
+      && write(m_listIds.data(), m_listIds.size() * sizeof(uint32_t));
+  ok = std::fclose(out) == 0 && ok;
+  if (!ok)
+    std::cerr << "Could not write template library " << file << "\n";
+  return ok;
+}
+
+bool TemplateLibrary::load(const std::string &file, std::string &context)
+{
+  FILE *in = std::fopen(file.c_str(), "rb");
+  if (!in)
+    return false;
+  FileHeader header, expected;
+  auto read = [&](void *data, size_t bytes) {
+    return bytes == 0 || std::fread(data, bytes, 1, in) == 1;
+  };
+  bool ok = read(&header, sizeof(header))
+      && std::memcmp(header.magic, expected.magic, 8) == 0 && header.width
+      && header.height && header.numLists <= header.count;
+  if (ok) {
+    m_width = int(header.width);
+    m_height = int(header.height);
+    const size_t d = dims();
+    context.resize(header.contextLength);
+    m_poses.resize(header.count * 9);
+    m_embeddings.resize(header.count * d);
+    m_centroids.resize(size_t(header.numLists) * d);
+    m_listOffsets.resize(size_t(header.numLists) + 1);
+    m_listIds.resize(header.count);
+    ok = read(context.data(), context.size())
+        && read(m_poses.data(), m_poses.size() * sizeof(float))
+        && read(m_embeddings.data(), m_embeddings.size() * sizeof(float))
+        && read(m_centroids.data(), m_centroids.size() * sizeof(float))
+        && read(m_listOffsets.data(), m_listOffsets.size() * sizeof(uint32_t))
+        && read(m_listIds.data(), m_listIds.size() * sizeof(uint32_t))
+        && m_listOffsets.front() == 0 && m_listOffsets.back() == header.count
+        && std::is_sorted(m_listOffsets.begin(), m_listOffsets.end())
+        && std::all_of(m_listIds.begin(), m_listIds.end(), [&](uint32_t i) {
+             return i < header.count;
+           });
+  }
+  std::fclose(in);
+  if (!ok) {
+    std::cerr << "Not a template library: " << file << "\n";
+    *this = TemplateLibrary();
+  }
+  return ok;
+}
+
+size_t TemplateLibrary::size() const
+{
+  return m_poses.size() / 9;
+}
+
+size_t TemplateLibrary::numLists() const
+{
+  return m_listOffsets.empty() ? 0 : m_listOffsets.size() - 1;
+}
+
+int TemplateLibrary::width() const
+{
+  return m_width;
+}
+
+int TemplateLibrary::height() const
+{
+  return m_height;
+}
+
+prediction TemplateLibrary::pose(size_t index) const
+{
+  const float *p = m_poses.data() + index * 9;
+  return prediction("template " + std::to_string(index),
+      p[0],
+      p[1],
+      p[2],
+      p[3],
+      p[4],
+      p[5],
+      p[6],
+      p[7],
+      p[8]);
+}
+
+size_t TemplateLibrary::bytes() const
+{
+  return (m_poses.size() + m_embeddings.size() + m_centroids.size())
+      * sizeof(float)
+      + (m_listOffsets.size() + m_listIds.size()) * sizeof(uint32_t);
+}
+
+size_t TemplateLibrary::dims() const
+{
+  return size_t(m_width) * size_t(m_height);
+}
+
+const float *TemplateLibrary::embedding(size_t index) const
+{
+  return m_embeddings.data() + index * dims();
+}
+
+const float *TemplateLibrary::centroid(size_t list) const
+{
+  return m_centroids.data() + list * dims();
+}
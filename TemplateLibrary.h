@@ -0,0 +1,83 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+// ours
+#include "Image.h"
+#include "prediction.h"
+
+// Coarse pose initialization from precomputed DRRs //////////////////////////
+//
+// An offline run renders DRRs at many poses around the predictions and
+// keeps one embedding per pose: the DRR box-filtered to a few pixels, as
+// gray levels normalized to zero mean and unit length, so the dot product
+// of two embeddings is their normalized cross-correlation. An inverted-file
+// index (k-means centroids, one list of templates per centroid) answers
+// queries by scanning the lists of the few centroids closest to the query,
+// a small fraction of the library. Looking up a reference image gives the
+// poses of the most similar templates: an initial pose for registration
+// within milliseconds, however far off the prediction was. Images are RGBA8
+// with the bottom row first, as DRRs and references are.
+
+struct TemplateMatch
+{
+  size_t index{0}; // into the library
+  float score{0.f}; // normalized cross-correlation, -1..1
+};
+
+class TemplateLibrary
+{
+ public:
+  // Embeddings are width x height; the longer side is 32 pixels
+  static constexpr int embeddingSize = 32;
+
+  TemplateLibrary() = default;
+  TemplateLibrary(int width, int height);
+
+  // Embedding of an image of any size, box filtered to the library's size
+  std::vector<float> embed(const uint8_t *rgba,
+      size_t width,
+      size_t height) const;
+  std::vector<float> embed(const Image &image) const;
+
+  // Building: templates first, then the index over them
+  void add(const prediction &pose, const std::vector<float> &embedding);
+  void buildIndex(int iterations = 10);
+
+  // Best first; probes: lists scanned, the nearest centroids' ones
+  std::vector<TemplateMatch> query(const std::vector<float> &embedding,
+      size_t count = 1,
+      size_t probes = 8) const;
+
+  // One file: a header, the context string, the poses (eye, center, up),
+  // the embeddings and the index. load() is false on a missing or broken
+  // file; context is what the templates were rendered with (renderer,
+  // volume, fov), for the caller to compare.
+  bool save(const std::string &file, const std::string &context) const;
+  bool load(const std::string &file, std::string &context);
+
+  size_t size() const;
+  size_t numLists() const;
+  int width() const;
+  int height() const;
+  prediction pose(size_t index) const;
+  size_t bytes() const;
+
+ private:
+  size_t dims() const;
+  const float *embedding(size_t index) const;
+  const float *centroid(size_t list) const;
+
+  int m_width{0}, m_height{0};
+  std::vector<float> m_poses; // eye, center, up: 9 floats per template
+  std::vector<float> m_embeddings; // dims() per template
+  std::vector<float> m_centroids; // dims() per list
+  std::vector<uint32_t> m_listOffsets; // numLists() + 1, into m_listIds
+  std::vector<uint32_t> m_listIds;
+};
@@ -0,0 +1,86 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed-size pool of worker threads consuming a FIFO task queue
+class ThreadPool
+{
+ public:
+  explicit ThreadPool(size_t numThreads = 0)
+  {
+    if (numThreads == 0)
+      numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < numThreads; ++i)
+      m_workers.emplace_back([this]() { workerLoop(); });
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto &w : m_workers)
+      w.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  template <typename Func>
+  auto enqueue(Func &&func) -> std::future<std::invoke_result_t<Func>>
+  {
+    using Result = std::invoke_result_t<Func>;
+    auto task = std::make_shared<std::packaged_task<Result()>>(
+        std::forward<Func>(func));
+    auto future = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.emplace_back([task]() { (*task)(); });
+    }
+    m_cv.notify_one();
+    return future;
+  }
+
+  size_t numThreads() const
+  {
+    return m_workers.size();
+  }
+
+ private:
+  void workerLoop()
+  {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+        if (m_stop && m_tasks.empty())
+          return;
+        task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> m_workers;
+  std::deque<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stop{false};
+};
@@ -0,0 +1,365 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ThumbnailAtlas.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+// ours
+#include "Trace.h"
+
+namespace {
+
+constexpr int g_pageSize = 1024; // atlas texture width and height
+constexpr int g_cellsPerRow = g_pageSize / ThumbnailAtlas::cellSize;
+constexpr size_t g_cellsPerPage = size_t(g_cellsPerRow) * g_cellsPerRow;
+constexpr uint64_t g_staleFrames = 2; // queued rows not seen since are dropped
+
+// Cache file: this header, then one fixed-size entry per image index
+struct CacheHeader
+{
+  char magic[4]{'T', 'H', 'M', 'B'};
+  uint32_t version{1};
+  uint32_t cellSize{ThumbnailAtlas::cellSize};
+  uint32_t reserved{0};
+};
+
+struct CacheEntry
+{
+  uint64_t key{0}; // 0: empty
+  uint32_t width{0}, height{0};
+  // followed by cellSize^2 RGBA pixels, the first width x height used
+};
+
+constexpr size_t g_entryBytes = sizeof(CacheEntry)
+    + size_t(ThumbnailAtlas::cellSize) * ThumbnailAtlas::cellSize * 4;
+
+size_t entryOffset(size_t index)
+{
+  return sizeof(CacheHeader) + index * g_entryBytes;
+}
+
+} // namespace
+
+ThumbnailAtlas::ThumbnailAtlas(
+    ImageStore &images, std::string cacheFile, TaskScheduler *scheduler)
+    : m_images(images), m_cacheFile(std::move(cacheFile)),
+      m_scheduler(scheduler)
+{}
+
+ThumbnailAtlas::~ThumbnailAtlas()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true; // queued tasks return right away
+  }
+  m_token.cancelAndWait();
+  m_pool.reset();
+  for (auto texture : m_pages) {
+    if (texture)
+      glDeleteTextures(1, &texture);
+  }
+  if (m_cacheFd >= 0)
+    close(m_cacheFd);
+}
+
+bool ThumbnailAtlas::get(size_t index, Cell &cell)
+{
+  const size_t count = m_images.size();
+  const uint64_t generation = m_images.generation();
+  if (generation == m_generation && count > m_states.size()) {
+    // predictions appended: the thumbnails so far stay
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requestedAt.resize(count, 0);
+    m_states.resize(count, Missing);
+    m_cells.resize(count, Cell());
+    if (m_cacheFd < 0)
+      openCache(count);
+  } else if (generation != m_generation || m_states.size() != count) {
+    // new predictions: workers of the old ones finish into the void
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_token.cancelAndWait();
+    m_token = CancelToken();
+    m_pool.reset();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = false;
+    m_results.clear();
+    m_requestedAt.assign(count, 0);
+    m_states.assign(count, Missing);
+    m_cells.assign(count, Cell());
+    m_generation = generation;
+    openCache(count);
+  }
+  if (index >= count)
+    return false;
+
+  if (m_states[index] == Ready) {
+    cell = m_cells[index];
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_requestedAt[index] = m_frame;
+  if (m_states[index] != Missing)
+    return false;
+
+  m_states[index] = Queued;
+  auto task = [this, index]() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_stopping || m_frame - m_requestedAt[index] > g_staleFrames) {
+        m_results.push_back({index, nullptr, true});
+        return;
+      }
+    }
+    auto thumbnail = build(index);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_results.push_back({index, std::move(thumbnail)});
+  };
+  if (m_scheduler) {
+    m_scheduler->submit(TaskPriority::Thumbnail, m_token, std::move(task));
+    return false;
+  }
+  if (!m_pool)
+    m_pool = std::make_unique<ThreadPool>(
+        std::max<size_t>(1, std::thread::hardware_concurrency() / 4));
+  m_pool->enqueue(std::move(task));
+  return false;
+}
+
+void ThumbnailAtlas::update()
+{
+  std::vector<Result> results;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_frame;
+    results.swap(m_results);
+  }
+
+  for (auto &r : results) {
+    if (r.index >= m_states.size())
+      continue;
+    if (r.dropped) {
+      m_states[r.index] = Missing;
+      continue;
+    }
+    if (!r.thumbnail) {
+      m_states[r.index] = Failed;
+      continue;
+    }
+
+    const size_t page = r.index / g_cellsPerPage;
+    const size_t slot = r.index % g_cellsPerPage;
+    if (m_pages.size() <= page)
+      m_pages.resize(page + 1, 0);
+    if (!m_pages[page]) {
+      glGenTextures(1, &m_pages[page]);
+      glBindTexture(GL_TEXTURE_2D, m_pages[page]);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexImage2D(GL_TEXTURE_2D,
+          0,
+          GL_RGBA8,
+          g_pageSize,
+          g_pageSize,
+          0,
+          GL_RGBA,
+          GL_UNSIGNED_BYTE,
+          nullptr);
+    }
+
+    const auto &image = *r.thumbnail;
+    const int x = int(slot % g_cellsPerRow) * cellSize;
+    const int y = int(slot / g_cellsPerRow) * cellSize;
+    glBindTexture(GL_TEXTURE_2D, m_pages[page]);
+    glTexSubImage2D(GL_TEXTURE_2D,
+        0,
+        x,
+        y,
+        GLsizei(image.width),
+        GLsizei(image.height),
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        image.data.data());
+
+    auto &cell = m_cells[r.index];
+    cell.texture = m_pages[page];
+    cell.uv0[0] = float(x) / g_pageSize;
+    cell.uv0[1] = float(y + image.height) / g_pageSize;
+    cell.uv1[0] = float(x + image.width) / g_pageSize;
+    cell.uv1[1] = float(y) / g_pageSize;
+    cell.aspect = float(image.width) / float(image.height);
+    m_states[r.index] = Ready;
+  }
+}
+
+void ThumbnailAtlas::reportMemory(MemoryReport &report) const
+{
+  const size_t pages =
+      std::count_if(m_pages.begin(), m_pages.end(), [](GLuint t) { return t; });
+  report.add(MemoryReport::GL,
+      "thumbnail atlas (" + std::to_string(pages) + " pages)",
+      pages * g_pageSize * g_pageSize * 4);
+}
+
+std::shared_ptr<const Image> ThumbnailAtlas::build(size_t index)
+{
+  TRACE_SCOPE("image", "thumbnail");
+  const uint64_t key = cacheKey(index);
+  if (auto cached = readCache(index, key))
+    return cached;
+
+  auto image = rgbaImage(ImageStore::decode(m_images.filename(index)));
+  if (!image || image->bpp != 4 || !image->width || !image->height)
+    return nullptr;
+  // images that fit into a cell are shared, not copied
+  auto thumbnail = std::max(image->width, image->height) <= size_t(cellSize)
+      ? image
+      : std::make_shared<const Image>(downscale(*image));
+  writeCache(index, key, *thumbnail);
+  return thumbnail;
+}
+
+// Box filter into at most cellSize x cellSize, keeping the aspect ratio;
+// smaller images are kept as they are
+Image ThumbnailAtlas::downscale(const Image &image)
+{
+  const size_t longer = std::max(image.width, image.height);
+  if (longer <= size_t(cellSize))
+    return Image(image);
+
+  Image dst;
+  dst.bpp = 4;
+  dst.width = std::max<size_t>(1, image.width * cellSize / longer);
+  dst.height = std::max<size_t>(1, image.height * cellSize / longer);
+  dst.data.resize(dst.width * dst.height * 4);
+  for (size_t y = 0; y < dst.height; ++y) {
+    const size_t y0 = y * image.height / dst.height;
+    const size_t y1 = std::max(y0 + 1, (y + 1) * image.height / dst.height);
+    for (size_t x = 0; x < dst.width; ++x) {
+      const size_t x0 = x * image.width / dst.width;
+      const size_t x1 = std::max(x0 + 1, (x + 1) * image.width / dst.width);
+      unsigned sum[4] = {0, 0, 0, 0};
+      for (size_t sy = y0; sy < y1; ++sy) {
+        const uint8_t *src = image.data.data() + (sy * image.width + x0) * 4;
+        for (size_t sx = x0; sx < x1; ++sx, src += 4)
+          for (int c = 0; c < 4; ++c)
+            sum[c] += src[c];
+      }
+      const unsigned n = unsigned((y1 - y0) * (x1 - x0));
+      uint8_t *out = dst.data.data() + (y * dst.width + x) * 4;
+      for (int c = 0; c < 4; ++c)
+        out[c] = uint8_t((sum[c] + n / 2) / n);
+    }
+  }
+  return dst;
+}
+
+bool ThumbnailAtlas::openCache(size_t count)
+{
+  if (m_cacheFd >= 0) {
+    close(m_cacheFd);
+    m_cacheFd = -1;
+  }
+  if (m_cacheFile.empty() || count == 0)
+    return false;
+
+  m_cacheFd = open(m_cacheFile.c_str(), O_RDWR | O_CREAT, 0644);
+  if (m_cacheFd < 0) {
+    std::cerr << "Thumbnails are not cached: cannot open " << m_cacheFile
+              << '\n';
+    return false;
+  }
+  const CacheHeader expected;
+  CacheHeader header;
+  if (pread(m_cacheFd, &header, sizeof(header), 0) != ssize_t(sizeof(header))
+      || std::memcmp(&header, &expected, sizeof(header)) != 0) {
+    // new or of another layout: start over
+    if (ftruncate(m_cacheFd, 0) != 0
+        || pwrite(m_cacheFd, &expected, sizeof(expected), 0)
+            != ssize_t(sizeof(expected))) {
+      close(m_cacheFd);
+      m_cacheFd = -1;
+      return false;
+    }
+  }
+  return true;
+}
+
+// File name, size and modification time; a changed image is built again
+uint64_t ThumbnailAtlas::cacheKey(size_t index) const
+{
+  const std::string filename = m_images.filename(index);
+  uint64_t hash = 14695981039346656037ull; // FNV-1a
+  auto mix = [&](const void *data, size_t size) {
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i)
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+  };
+  mix(filename.data(), filename.size());
+  std::error_code ec;
+  const uint64_t size = std::filesystem::file_size(filename, ec);
+  const int64_t mtime = ec
+      ? 0
+      : int64_t(std::filesystem::last_write_time(filename, ec)
+                    .time_since_epoch()
+                    .count());
+  mix(&size, sizeof(size));
+  mix(&mtime, sizeof(mtime));
+  return hash | 1;
+}
+
+std::shared_ptr<const Image> ThumbnailAtlas::readCache(
+    size_t index, uint64_t key) const
+{
+  if (m_cacheFd < 0)
+    return nullptr;
+  CacheEntry entry;
+  const off_t offset = off_t(entryOffset(index));
+  if (pread(m_cacheFd, &entry, sizeof(entry), offset) != ssize_t(sizeof(entry))
+      || entry.key != key || entry.width == 0 || entry.height == 0
+      || entry.width > unsigned(cellSize) || entry.height > unsigned(cellSize))
+    return nullptr;
+
+  auto image = std::make_shared<Image>();
+  image->width = entry.width;
+  image->height = entry.height;
+  image->bpp = 4;
+  image->data.resize(image->width * image->height * 4);
+  if (pread(m_cacheFd,
+          image->data.data(),
+          image->data.size(),
+          offset + off_t(sizeof(entry)))
+      != ssize_t(image->data.size()))
+    return nullptr;
+  return image;
+}
+
+void ThumbnailAtlas::writeCache(
+    size_t index, uint64_t key, const Image &thumbnail) const
+{
+  if (m_cacheFd < 0)
+    return;
+  // pixels first, so an interrupted write leaves the entry invalid
+  const off_t offset = off_t(entryOffset(index));
+  CacheEntry entry;
+  entry.key = key;
+  entry.width = uint32_t(thumbnail.width);
+  entry.height = uint32_t(thumbnail.height);
+  if (pwrite(m_cacheFd,
+          thumbnail.data.data(),
+          thumbnail.data.size(),
+          offset + off_t(sizeof(entry)))
+      == ssize_t(thumbnail.data.size()))
+    pwrite(m_cacheFd, &entry, sizeof(entry), offset);
+}
@@ -0,0 +1,101 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// glad
+#include "glad/glad.h"
+// std
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+// ours
+#include "Image.h"
+#include "ImageStore.h"
+#include "MemoryReport.h"
+#include "TaskScheduler.h"
+#include "ThreadPool.h"
+
+// Thumbnails of the reference images for browsing large prediction sets.
+// Requested thumbnails are decoded and box filtered on worker threads,
+// without keeping the full image in the store, and uploaded into fixed cells
+// of a few large atlas textures (one page per 256 images), so a list of
+// thumbnails binds a handful of textures instead of one per image. Finished
+// thumbnails are written to a cache file keyed by file name, size and
+// modification time; later sessions read them from there without decoding.
+class ThumbnailAtlas
+{
+ public:
+  static constexpr int cellSize = 64; // longer side of a thumbnail
+
+  // cacheFile empty: no disk cache. Thumbnails are built on the
+  // scheduler's workers at thumbnail priority, or on a pool of their own
+  // without one.
+  ThumbnailAtlas(ImageStore &images,
+      std::string cacheFile = {},
+      TaskScheduler *scheduler = nullptr);
+  ~ThumbnailAtlas(); // needs the GL context
+
+  ThumbnailAtlas(const ThumbnailAtlas &) = delete;
+  ThumbnailAtlas &operator=(const ThumbnailAtlas &) = delete;
+
+  struct Cell
+  {
+    GLuint texture{0};
+    float uv0[2]{0.f, 0.f}, uv1[2]{0.f, 0.f}; // flipped, images are bottom up
+    float aspect{1.f};
+  };
+
+  // The thumbnail if it is uploaded; queues it otherwise. Rows scrolled out
+  // of view before their turn are dropped from the queue.
+  bool get(size_t index, Cell &cell);
+  // Once per frame on the UI thread: uploads finished thumbnails
+  void update();
+  void reportMemory(MemoryReport &report) const;
+
+ private:
+  enum State : uint8_t
+  {
+    Missing,
+    Queued,
+    Ready,
+    Failed
+  };
+
+  struct Result
+  {
+    size_t index;
+    std::shared_ptr<const Image> thumbnail; // null: no thumbnail
+    bool dropped{false}; // out of view, queued again on the next get()
+  };
+
+  std::shared_ptr<const Image> build(size_t index);
+  static Image downscale(const Image &image);
+
+  bool openCache(size_t count);
+  uint64_t cacheKey(size_t index) const;
+  std::shared_ptr<const Image> readCache(size_t index, uint64_t key) const;
+  void writeCache(size_t index, uint64_t key, const Image &thumbnail) const;
+
+  ImageStore &m_images;
+  std::string m_cacheFile;
+  int m_cacheFd{-1};
+
+  // UI thread only
+  uint64_t m_generation{0}; // of the image store's files
+  std::vector<State> m_states;
+  std::vector<GLuint> m_pages;
+  std::vector<Cell> m_cells;
+
+  // shared with the workers
+  mutable std::mutex m_mutex;
+  uint64_t m_frame{0};
+  bool m_stopping{false};
+  std::vector<uint64_t> m_requestedAt; // frame of the last get()
+  std::vector<Result> m_results;
+  TaskScheduler *m_scheduler{nullptr};
+  CancelToken m_token; // of the tasks on m_scheduler
+  std::unique_ptr<ThreadPool> m_pool;
+};
@@ -0,0 +1,222 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "TiledRender.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+// ours
+#include "Trace.h"
+
+namespace {
+
+// Output file of a known size, written through a shared mapping
+class MappedOutput
+{
+ public:
+  MappedOutput(const std::string &fileName, size_t size) : m_size(size)
+  {
+    m_fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0 || ftruncate(m_fd, off_t(size)) != 0) {
+      std::cerr << "Could not create " << fileName << "\n";
+      return;
+    }
+    void *p = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (p == MAP_FAILED) {
+      std::cerr << "Could not map " << fileName << "\n";
+      return;
+    }
+    m_data = static_cast<uint8_t *>(p);
+  }
+
+  ~MappedOutput()
+  {
+    if (m_data)
+      munmap(m_data, m_size);
+    if (m_fd >= 0)
+      close(m_fd);
+  }
+
+  MappedOutput(const MappedOutput &) = delete;
+  MappedOutput &operator=(const MappedOutput &) = delete;
+
+  uint8_t *data() const
+  {
+    return m_data;
+  }
+
+  // Hands written pages to the kernel for writeback, so dirty pages of
+  // finished tile rows don't pile up in memory
+  void flush(size_t offset, size_t size)
+  {
+    const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    const size_t begin = offset / page * page;
+    msync(m_data + begin, offset + size - begin, MS_ASYNC);
+  }
+
+ private:
+  int m_fd{-1};
+  uint8_t *m_data{nullptr};
+  size_t m_size{0};
+};
+
+// Start of tile i of `tile` pixels along an axis of `size` pixels; the last
+// one ends at the border
+int tileStart(int i, int tile, int size)
+{
+  return std::min(i * tile, size - tile);
+}
+
+} // namespace
+
+bool renderTiled(BatchRenderer &renderer,
+    const prediction &pose,
+    int width,
+    int height,
+    const std::string &basePath)
+{
+  TRACE_SCOPE("batch", "tiled render");
+  const auto &settings = renderer.settings();
+  const int tileW = settings.width, tileH = settings.height;
+  if (tileW > width || tileH > height) {
+    std::cerr << "Tiles of " << tileW << "x" << tileH << " do not fit a "
+              << width << "x" << height << " image\n";
+    return false;
+  }
+
+  char header[128];
+  const int headerSize = std::snprintf(header,
+      sizeof(header),
+      "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\n"
+      "ENDHDR\n",
+      width,
+      height);
+  const size_t numPixels = size_t(width) * height;
+  MappedOutput color(basePath + ".pam", headerSize + numPixels * 4);
+  if (!color.data())
+    return false;
+  std::memcpy(color.data(), header, headerSize);
+  uint8_t *colorPixels = color.data() + headerSize;
+
+  std::unique_ptr<MappedOutput> origin;
+  if (settings.writeOrigin) {
+    origin = std::make_unique<MappedOutput>(
+        basePath + ".origin", numPixels * 3 * sizeof(float));
+    if (!origin->data())
+      return false;
+  }
+
+  const int tilesX = (width + tileW - 1) / tileW;
+  const int tilesY = (height + tileH - 1) / tileH;
+  const size_t numTiles = size_t(tilesX) * tilesY;
+  const size_t numSlots = renderer.numSlots();
+  const float aspect = width / float(height);
+
+  auto submit = [&](size_t t) {
+    const int x0 = tileStart(int(t % tilesX), tileW, width);
+    const int y0 = tileStart(int(t / tilesX), tileH, height);
+    ImageRegion region;
+    region.lower[0] = x0 / float(width);
+    region.lower[1] = y0 / float(height);
+    region.upper[0] = (x0 + tileW) / float(width);
+    region.upper[1] = (y0 + tileH) / float(height);
+    region.aspect = aspect;
+    renderer.submit(t % numSlots, pose, 0.f, &region);
+  };
+
+  // all slots in flight; tile t is written while the next ones render
+  for (size_t t = 0; t < std::min(numSlots, numTiles); ++t)
+    submit(t);
+  bool ok = true;
+  for (size_t t = 0; t < numTiles; ++t) {
+    const auto *r = renderer.readback(t % numSlots);
+    if (!r || r->width != tileW || r->height != tileH) {
+      // let the tiles in flight finish before the slots go away
+      for (size_t k = t + 1; k < std::min(t + numSlots, numTiles); ++k)
+        renderer.readback(k % numSlots);
+      ok = false;
+      break;
+    }
+
+    // pixels of this tile not written by the previous one
+    const int tx = int(t % tilesX), ty = int(t / tilesX);
+    const int x0 = tileStart(tx, tileW, width);
+    const int y0 = tileStart(ty, tileH, height);
+    const int skipX = tx * tileW - x0, skipY = ty * tileH - y0;
+    {
+      TRACE_SCOPE("batch", "write tile");
+      for (int y = skipY; y < tileH; ++y) {
+        const size_t src = size_t(y) * tileW + skipX;
+        const size_t dst = size_t(y0 + y) * width + x0 + skipX;
+        const size_t n = size_t(tileW - skipX);
+        std::memcpy(colorPixels + dst * 4, r->color.data() + src * 4, n * 4);
+        if (origin && !r->origin.empty()) {
+          std::memcpy(reinterpret_cast<float *>(origin->data()) + dst * 3,
+              r->origin.data() + src * 3,
+              n * 3 * sizeof(float));
+        }
+      }
+    }
+    if (t + numSlots < numTiles)
+      submit(t + numSlots);
+
+    if (tx == tilesX - 1) {
+      // a finished band of rows
+      const size_t band = size_t(y0 + skipY) * width;
+      const size_t bandPixels = size_t(tileH - skipY) * width;
+      color.flush(headerSize + band * 4, bandPixels * 4);
+      if (origin) {
+        origin->flush(
+            band * 3 * sizeof(float), bandPixels * 3 * sizeof(float));
+      }
+    }
+  }
+  if (!ok)
+    std::cerr << "Tiled render of " << basePath << " failed\n";
+  return ok;
+}
+
+bool renderAllTiled(BatchRenderer &renderer,
+    const std::vector<prediction> &poses,
+    int width,
+    int height)
+{
+  const auto &settings = renderer.settings();
+  std::error_code ec;
+  std::filesystem::create_directories(settings.outputDir, ec);
+  if (ec) {
+    std::cerr << "Could not create " << settings.outputDir << ": "
+              << ec.message() << "\n";
+    return false;
+  }
+
+  std::vector<nlohmann::json> entries(poses.size());
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < poses.size(); ++i) {
+    const auto base = std::filesystem::path(settings.outputDir)
+        / BatchRenderer::baseName(i);
+    if (!renderTiled(renderer, poses[i], width, height, base.string()))
+      return false;
+    entries[i] = BatchRenderer::manifestEntry(
+        i, poses[i], ".pam", settings.writeOrigin);
+    std::cout << "\rrendered " << i + 1 << "/" << poses.size() << std::flush;
+  }
+  std::cout << "\n";
+  const float seconds = std::chrono::duration<float>(
+      std::chrono::steady_clock::now() - start)
+                            .count();
+  std::cout << "Rendered " << poses.size() << " poses of " << width << "x"
+            << height << " in tiles of " << settings.width << "x"
+            << settings.height << " in " << seconds << "s\n";
+
+  return BatchRenderer::writeManifest(
+      settings.outputDir, width, height, settings.fovy, std::move(entries));
+}
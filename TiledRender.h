@@ -0,0 +1,31 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+// ours
+#include "BatchRenderer.h"
+#include "prediction.h"
+
+// DRRs larger than one frame (detector resolution, e.g. 8k x 8k), rendered
+// in tiles of the renderer's frame size through the camera's imageRegion,
+// so device memory is bounded by one frame per slot however large the
+// image. Tiles go straight into memory-mapped output files, so host memory
+// stays bounded as well: <base>.pam (RGBA, PAM "P7" header) and, with
+// writeOrigin, <base>.origin (raw float32 xyz), both in the row order of
+// the --batch outputs. The last tile of a row or column is moved back to
+// end at the image border and only its new pixels are written.
+bool renderTiled(BatchRenderer &renderer,
+    const prediction &pose,
+    int width,
+    int height,
+    const std::string &basePath);
+
+// All poses into <outputDir>/drr_<index>.pam (+ .origin) and a manifest
+bool renderAllTiled(BatchRenderer &renderer,
+    const std::vector<prediction> &poses,
+    int width,
+    int height);
@@ -0,0 +1,112 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ToneMapper.h"
+// std
+#include <algorithm>
+#include <cmath>
+// ours
+#include "GLProgram.h"
+#include "Trace.h"
+
+static const char *s_fragmentShader = R"(
+uniform sampler2D linearFrame;
+uniform highp sampler2D windowTexture; // lower, upper
+uniform bool autoWindow;
+uniform vec2 window; // lower, 1 / (upper - lower)
+out vec4 color;
+void main()
+{
+  vec2 w = window;
+  if (autoWindow) {
+    vec2 bounds = texelFetch(windowTexture, ivec2(0), 0).rg;
+    float extent = bounds.y - bounds.x;
+    w = vec2(bounds.x, abs(extent) > 1e-12 ? 1.0 / extent : 1e12);
+  }
+  float v = texelFetch(linearFrame, ivec2(gl_FragCoord.xy), 0).r;
+  color = vec4(vec3(clamp((v - w.x) * w.y, 0.0, 1.0)), 1.0);
+}
+)";
+
+static float windowScale(const DisplayWindow &window)
+{
+  const float extent = window.upper - window.lower;
+  return std::abs(extent) > 1e-12f ? 1.f / extent : 1e12f;
+}
+
+ToneMapper::~ToneMapper()
+{
+  if (m_program)
+    glDeleteProgram(m_program);
+  if (m_vertexArray)
+    glDeleteVertexArrays(1, &m_vertexArray);
+  if (m_framebuffer)
+    glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+bool ToneMapper::init()
+{
+  m_initialized = true;
+  m_program = buildFullscreenProgram("tone mapping", s_fragmentShader);
+  if (!m_program)
+    return false;
+
+  m_windowLocation = glGetUniformLocation(m_program, "window");
+  m_autoWindowLocation = glGetUniformLocation(m_program, "autoWindow");
+  glUseProgram(m_program);
+  glUniform1i(glGetUniformLocation(m_program, "linearFrame"), 0);
+  glUniform1i(glGetUniformLocation(m_program, "windowTexture"), 1);
+  glUseProgram(0);
+  glGenVertexArrays(1, &m_vertexArray);
+  glGenFramebuffers(1, &m_framebuffer);
+  return true;
+}
+
+bool ToneMapper::apply(GLuint source,
+    GLuint target,
+    int width,
+    int height,
+    const DisplayWindow &window,
+    GLuint windowTexture)
+{
+  TRACE_SCOPE("gl", "tone mapping");
+  if (!m_initialized)
+    init();
+  if (!m_program)
+    return false;
+
+  GLStateGuard state;
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTexture2D(
+      GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+  glViewport(0, 0, width, height);
+  glUseProgram(m_program);
+  glUniform2f(m_windowLocation, window.lower, windowScale(window));
+  glUniform1i(m_autoWindowLocation, windowTexture != 0);
+  if (windowTexture) {
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, windowTexture);
+    glActiveTexture(GL_TEXTURE0);
+  }
+  glBindTexture(GL_TEXTURE_2D, source);
+  glBindVertexArray(m_vertexArray);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  return true;
+}
+
+void ToneMapper::map(const float *values,
+    size_t count,
+    const DisplayWindow &window,
+    uint32_t *rgba)
+{
+  const float scale = windowScale(window);
+  for (size_t i = 0; i < count; ++i) {
+    // NaN (rays missing the volume on some devices) shows black
+    float t = (values[i] - window.lower) * scale;
+    t = t > 0.f ? std::min(t, 1.f) : 0.f;
+    const uint32_t v = uint32_t(t * 255.f + 0.5f);
+    rgba[i] = v | (v << 8) | (v << 16) | 0xff000000u;
+  }
+}
@@ -0,0 +1,58 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// glad
+#include "glad/glad.h"
+// std
+#include <cstddef>
+#include <cstdint>
+
+// Display window of linear single-channel frames: values from `lower` to
+// `upper` map to black..white, clamped outside
+struct DisplayWindow
+{
+  float lower{0.f};
+  float upper{1.f};
+};
+
+// Shows linear frames: a fullscreen-triangle pass windows a GL_R32F texture
+// into the RGBA8 display texture, so the linear values are uploaded as they
+// are and stay exact on the CPU side. map() is the same on the CPU, for
+// consumers that need RGBA8 (screenshots as PNG, the frame streamer).
+class ToneMapper
+{
+ public:
+  ToneMapper() = default;
+  ~ToneMapper();
+
+  ToneMapper(const ToneMapper &) = delete;
+  ToneMapper &operator=(const ToneMapper &) = delete;
+
+  // Must be called with the GL context current; windows the lower left
+  // width x height pixels of `source` into the same pixels of `target`,
+  // with the window in `windowTexture` (FrameHistogram's) if given.
+  // False if the shader could not be built.
+  bool apply(GLuint source,
+      GLuint target,
+      int width,
+      int height,
+      const DisplayWindow &window,
+      GLuint windowTexture = 0);
+
+  static void map(const float *values,
+      size_t count,
+      const DisplayWindow &window,
+      uint32_t *rgba);
+
+ private:
+  bool init();
+
+  GLuint m_program{0};
+  GLuint m_vertexArray{0};
+  GLuint m_framebuffer{0};
+  GLint m_windowLocation{-1};
+  GLint m_autoWindowLocation{-1};
+  bool m_initialized{false};
+};
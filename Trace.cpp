@@ -0,0 +1,106 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Trace.h"
+// std
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+struct Event
+{
+  const char *name;
+  const char *category;
+  Clock::time_point begin;
+  Clock::time_point end;
+};
+
+// One per thread; the mutex is only contended while the session writes
+struct ThreadBuffer
+{
+  std::mutex mutex;
+  std::vector<Event> events;
+  size_t tid{0};
+};
+
+std::mutex g_buffersMutex;
+std::vector<std::shared_ptr<ThreadBuffer>> g_buffers; // outlive their threads
+Clock::time_point g_start;
+
+ThreadBuffer &threadBuffer()
+{
+  thread_local std::shared_ptr<ThreadBuffer> buffer = []() {
+    auto b = std::make_shared<ThreadBuffer>();
+    std::lock_guard<std::mutex> lock(g_buffersMutex);
+    b->tid = g_buffers.size();
+    g_buffers.push_back(b);
+    return b;
+  }();
+  return *buffer;
+}
+
+} // namespace
+
+void record(const char *name,
+    const char *category,
+    Clock::time_point begin,
+    Clock::time_point end)
+{
+  auto &buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  buffer.events.push_back({name, category, begin, end});
+}
+
+Session::Session(const std::string &file) : m_file(file)
+{
+  if (m_file.empty())
+    return;
+  g_start = Clock::now();
+  g_enabled = true;
+}
+
+Session::~Session()
+{
+  if (m_file.empty())
+    return;
+  g_enabled = false;
+
+  FILE *out = fopen(m_file.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "Could not write trace %s\n", m_file.c_str());
+    return;
+  }
+
+  auto us = [](Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  };
+
+  size_t numEvents = 0;
+  fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  std::lock_guard<std::mutex> lock(g_buffersMutex);
+  for (auto &buffer : g_buffers) {
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    for (auto &e : buffer->events) {
+      fprintf(out,
+          "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+          "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %zu}",
+          numEvents++ ? ",\n" : "",
+          e.name,
+          e.category,
+          us(e.begin - g_start),
+          us(e.end - e.begin),
+          buffer->tid);
+    }
+    buffer->events.clear();
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+  printf("wrote %zu trace events to %s\n", numEvents, m_file.c_str());
+}
+
+} // namespace trace
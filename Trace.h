@@ -0,0 +1,78 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Scoped timers for the hot paths, written as a Chrome trace (load the file
+// in chrome://tracing or ui.perfetto.dev). Disabled scopes cost one relaxed
+// atomic load; enabled ones two clock reads and an append to a per-thread
+// buffer.
+namespace trace {
+
+using Clock = std::chrono::steady_clock;
+
+inline std::atomic<bool> g_enabled{false};
+
+inline bool enabled()
+{
+  return g_enabled.load(std::memory_order_relaxed);
+}
+
+// name and category must outlive the trace (string literals)
+void record(const char *name,
+    const char *category,
+    Clock::time_point begin,
+    Clock::time_point end);
+
+// Collects events from construction on and writes them to file when
+// destroyed; an empty file name leaves tracing off
+class Session
+{
+ public:
+  explicit Session(const std::string &file);
+  ~Session();
+
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+
+ private:
+  std::string m_file;
+};
+
+class Scope
+{
+ public:
+  Scope(const char *name, const char *category)
+      : m_name(name), m_category(category), m_active(enabled())
+  {
+    if (m_active)
+      m_begin = Clock::now();
+  }
+
+  ~Scope()
+  {
+    if (m_active)
+      record(m_name, m_category, m_begin, Clock::now());
+  }
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+ private:
+  const char *m_name;
+  const char *m_category;
+  bool m_active;
+  Clock::time_point m_begin;
+};
+
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(category, name) \
+  ::trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name, category)
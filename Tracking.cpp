@@ -0,0 +1,294 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Tracking.h"
+// std
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <thread>
+// ours
+#include "ImagePyramid.h"
+#include "ImageStore.h"
+#include "Registration.h"
+#include "Trace.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+float msSince(Clock::time_point start)
+{
+  return std::chrono::duration<float, std::milli>(Clock::now() - start)
+      .count();
+}
+
+bool isImageFile(const std::filesystem::path &path)
+{
+  std::string ext = path.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) {
+    return char(std::tolower(c));
+  });
+  return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp"
+      || ext == ".tga" || ext == ".pnm" || ext == ".tif" || ext == ".tiff"
+      || ext == ".dcm";
+}
+
+std::string patternFile(const std::string &pattern, size_t number)
+{
+  char name[4096];
+  std::snprintf(name, sizeof(name), pattern.c_str(), int(number));
+  return name;
+}
+
+// A frame read from the sequence and decoded; end: there is none
+struct PendingFrame
+{
+  std::string file;
+  ImageStore::ImagePtr image;
+  bool end{false};
+};
+
+} // namespace
+
+FrameSequence::FrameSequence(
+    std::string source, bool follow, std::chrono::milliseconds timeout)
+    : m_source(std::move(source)),
+      m_pattern(m_source.find('%') != std::string::npos),
+      m_follow(follow),
+      m_timeout(timeout)
+{
+  // patterns count from 0, or from 1 if there is no frame 0
+  if (m_pattern && !std::filesystem::exists(patternFile(m_source, 0))
+      && std::filesystem::exists(patternFile(m_source, 1)))
+    m_number = 1;
+}
+
+bool FrameSequence::next(std::string &file)
+{
+  const auto deadline = Clock::now() + m_timeout;
+  for (;;) {
+    std::string found = candidate();
+    if (!found.empty() && m_follow) {
+      // a capture tool may still be writing it
+      std::error_code error;
+      const uintmax_t size = std::filesystem::file_size(found, error);
+      if (error || found != m_pending || size != m_pendingSize) {
+        m_pending = found;
+        m_pendingSize = error ? 0 : size;
+        found.clear();
+      }
+    }
+    if (!found.empty()) {
+      m_pending.clear();
+      if (m_pattern)
+        ++m_number;
+      else
+        m_last = found;
+      ++m_position;
+      file = found;
+      return true;
+    }
+    if (!m_follow || Clock::now() >= deadline)
+      return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+}
+
+size_t FrameSequence::position() const
+{
+  return m_position;
+}
+
+std::string FrameSequence::candidate()
+{
+  if (m_pattern) {
+    const std::string file = patternFile(m_source, m_number);
+    return std::filesystem::exists(file) ? file : std::string();
+  }
+  // the first image file after the last one, by name
+  std::string first;
+  std::error_code error;
+  for (const auto &entry :
+      std::filesystem::directory_iterator(m_source, error)) {
+    if (!entry.is_regular_file() || !isImageFile(entry.path()))
+      continue;
+    const std::string name = entry.path().string();
+    if (name > m_last && (first.empty() || name < first))
+      first = name;
+  }
+  return first;
+}
+
+void trackingFrameSize(const ImageRoi &roi,
+    size_t fullWidth,
+    size_t fullHeight,
+    size_t level,
+    int &width,
+    int &height)
+{
+  int offset[2], size[2];
+  roi.pixels(int(std::max<size_t>(fullWidth >> level, 1)),
+      int(std::max<size_t>(fullHeight >> level, 1)),
+      offset,
+      size);
+  width = size[0];
+  height = size[1];
+}
+
+bool trackSequence(const TrackingRenderers &renderers,
+    MatchersWrapper &matchers,
+    size_t matcherIndex,
+    float fovy,
+    prediction start,
+    FrameSequence &frames,
+    const TrackingSettings &settings,
+    const std::function<bool(const TrackedFrame &)> &onFrame)
+{
+  using anari::math::float3;
+  feature_matcher *matcher = matchers.matcher(matcherIndex);
+  if (!matcher || renderers.levels.empty()) {
+    std::cerr << "ERROR: tracking needs a matcher (-m)\n";
+    return false;
+  }
+  const float aspect = float(renderers.fullWidth)
+      / float(std::max<size_t>(renderers.fullHeight, 1));
+
+  // the next frame is waited for and decoded while this one registers
+  auto fetch = [&]() {
+    PendingFrame frame;
+    frame.end = !frames.next(frame.file);
+    if (frame.end)
+      return frame;
+    frame.image = rgbaImage(ImageStore::decode(frame.file));
+    if (frame.image && frame.image->bpp == 4 && !settings.preprocess.empty()) {
+      frame.image = std::make_shared<const Image>(
+          settings.preprocess.apply(*frame.image));
+    }
+    return frame;
+  };
+  auto pending = std::async(std::launch::async, fetch);
+
+  prediction pose = start;
+  RegistrationLoop loop;
+  std::vector<uint8_t> color, fullColor;
+  std::vector<float> origin, fullOrigin;
+  for (size_t index = 0;; ++index) {
+    auto t = Clock::now();
+    PendingFrame frame = pending.get();
+    if (frame.end)
+      return true;
+    pending = std::async(std::launch::async, fetch);
+
+    TRACE_SCOPE("tracking", "frame");
+    TrackedFrame f;
+    f.index = index;
+    f.file = frame.file;
+    f.decodeWaitMs = msSince(t);
+    f.haveReference = frame.image && frame.image->bpp == 4;
+    t = Clock::now();
+    if (f.haveReference) {
+      const auto pyramid =
+          ImagePyramid::build(frame.image, renderers.levels.size());
+      loop.start(settings.maxIterations, settings.tolerance, pyramid->size());
+      size_t heldLevel = SIZE_MAX;
+      bool more = true;
+      while (more) {
+        const size_t level = loop.level();
+        if (level != heldLevel) {
+          const auto &reference = pyramid->level(level);
+          matchers.setReference(matcherIndex,
+              SIZE_MAX,
+              std::string(),
+              make_image_view(reference.data.data(),
+                  reference.width,
+                  reference.height,
+                  feature_matcher::PIXEL_TYPE::RGBA,
+                  true));
+          heldLevel = level;
+        }
+
+        // the ROI's pixels of the level, placed into a full frame for the
+        // matchers, whose calibration stays that of the whole view
+        auto &renderer = *renderers.levels[level];
+        const size_t width = std::max<size_t>(renderers.fullWidth >> level, 1);
+        const size_t height =
+            std::max<size_t>(renderers.fullHeight >> level, 1);
+        const bool full = settings.roi.full();
+        int offset[2], size[2];
+        settings.roi.pixels(int(width), int(height), offset, size);
+        ImageRegion region;
+        region.lower[0] = float(offset[0]) / width;
+        region.lower[1] = float(offset[1]) / height;
+        region.upper[0] = float(offset[0] + size[0]) / width;
+        region.upper[1] = float(offset[1] + size[1]) / height;
+        region.aspect = aspect;
+        renderer.submit(0, pose, fovy, full ? nullptr : &region);
+        if (!renderer.collect(0, color, origin)) {
+          std::cerr << "Tracking stopped: frame " << index
+                    << " failed to render\n";
+          return false;
+        }
+        const uint8_t *query = color.data();
+        const float *depth = origin.data();
+        if (!full) {
+          fullColor.assign(width * height * 4, 0);
+          fullOrigin.assign(
+              width * height * 3, std::numeric_limits<float>::quiet_NaN());
+          for (int y = 0; y < size[1]; ++y) {
+            const size_t row = (offset[1] + y) * width + offset[0];
+            std::copy_n(color.data() + size_t(y) * size[0] * 4,
+                size[0] * 4,
+                fullColor.data() + row * 4);
+            std::copy_n(origin.data() + size_t(y) * size[0] * 3,
+                size[0] * 3,
+                fullOrigin.data() + row * 3);
+          }
+          query = fullColor.data();
+          depth = fullOrigin.data();
+        }
+
+        matcher->set_image(depth,
+            width,
+            height,
+            feature_matcher::PIXEL_TYPE::FLOAT3,
+            feature_matcher::IMAGE_TYPE::DEPTH3D,
+            false);
+        matcher->set_image(query,
+            width,
+            height,
+            feature_matcher::PIXEL_TYPE::RGBA,
+            feature_matcher::IMAGE_TYPE::QUERY,
+            false);
+        matcher->calibrate(width, height, fovy, aspect);
+        matcher->match();
+        std::array<float, 3> eye{pose.eye.x, pose.eye.y, pose.eye.z};
+        std::array<float, 3> center{
+            pose.center.x, pose.center.y, pose.center.z};
+        std::array<float, 3> up{pose.up.x, pose.up.y, pose.up.z};
+        const bool updated = matcher->update_camera(eye, center, up);
+        ++f.iterations;
+        if (!updated)
+          break;
+
+        f.updated = true;
+        const float3 eyeAfter(eye[0], eye[1], eye[2]);
+        const float3 centerAfter(center[0], center[1], center[2]);
+        more = loop.step(pose.eye, pose.center, eyeAfter, centerAfter);
+        pose.eye = eyeAfter;
+        pose.center = centerAfter;
+        pose.up = float3(up[0], up[1], up[2]);
+      }
+    }
+    f.ms = msSince(t);
+    f.eye = {pose.eye.x, pose.eye.y, pose.eye.z};
+    f.center = {pose.center.x, pose.center.y, pose.center.z};
+    f.up = {pose.up.x, pose.up.y, pose.up.z};
+    if (!onFrame(f))
+      return true; // after the frame being fetched, if any
+  }
+}
@@ -0,0 +1,108 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+// ours
+#include "BatchRenderer.h"
+#include "ImagePreprocess.h"
+#include "ImageRoi.h"
+#include "Matcher.h"
+#include "prediction.h"
+
+// Fluoroscopy sequence tracking /////////////////////////////////////////////
+//
+// Reference frames come one after the other and each gets a pose, starting
+// from the pose of the frame before: a short coarse-to-fine registration
+// per frame instead of loading and matching images by hand.
+
+// Frames of a sequence, in order. The source is a printf pattern of frame
+// numbers ("frames/f_%04d.png", counting from 0 or 1) or a directory of
+// image files, taken in name order. With `follow` the sequence does not end
+// at the last frame on disk: it waits for the next one that a capture tool
+// writes, taking a file once its size stopped changing, and ends after
+// `timeout` without a new frame.
+class FrameSequence
+{
+ public:
+  FrameSequence(std::string source,
+      bool follow = false,
+      std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
+  // The next frame's file; false at the end of the sequence
+  bool next(std::string &file);
+  size_t position() const; // frames returned so far
+
+ private:
+  std::string candidate(); // the next file on disk, empty if none yet
+
+  std::string m_source;
+  bool m_pattern{false};
+  bool m_follow{false};
+  std::chrono::milliseconds m_timeout;
+  size_t m_number{0}; // pattern: of the next frame
+  std::string m_last; // directory: the last file returned
+  std::string m_pending; // follow: file waiting for its size to settle
+  uintmax_t m_pendingSize{0};
+  size_t m_position{0};
+};
+
+struct TrackingSettings
+{
+  size_t maxIterations{4}; // per frame, over all levels
+  float tolerance{0.1f}; // world units, see RegistrationLoop
+  // levels of the reference pyramid and of the renderers, coarsest last
+  size_t numLevels{1};
+  ImageRoi roi; // rendered and matched part of the frames
+  PreprocessPipeline preprocess; // applied to every frame
+};
+
+struct TrackedFrame
+{
+  size_t index{0};
+  std::string file;
+  bool haveReference{false};
+  bool updated{false};
+  std::array<float, 3> eye{}, center{}, up{};
+  size_t iterations{0};
+  float decodeWaitMs{0.f}; // waiting for the frame's decode
+  float ms{0.f}; // the frame's registration
+};
+
+// Renderers of the tracking levels, all over the same world: renderer l
+// renders 1 / 2^l of the full size, only the ROI's pixels of it.
+// fullWidth/fullHeight: the level-0 frame the matchers calibrate with.
+struct TrackingRenderers
+{
+  std::vector<BatchRenderer *> levels;
+  size_t fullWidth{0}, fullHeight{0};
+};
+
+// Size of the ROI's pixels at a level of a full-size frame, what the level's
+// renderer is created with
+void trackingFrameSize(const ImageRoi &roi,
+    size_t fullWidth,
+    size_t fullHeight,
+    size_t level,
+    int &width,
+    int &height);
+
+// Tracks the sequence from `start`, one registration per frame whose result
+// starts the next; the next frame decodes while the current one registers.
+// onFrame sees each frame once it is done and returns false to stop.
+// False if a frame failed to render or there is no matcher.
+bool trackSequence(const TrackingRenderers &renderers,
+    MatchersWrapper &matchers,
+    size_t matcherIndex,
+    float fovy,
+    prediction start,
+    FrameSequence &frames,
+    const TrackingSettings &settings,
+    const std::function<bool(const TrackedFrame &)> &onFrame);
@@ -0,0 +1,111 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ViewRig.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// std
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+// ours
+#include "Rotation.h"
+
+namespace {
+
+using anari::math::float3;
+
+// The pose rotated about its center by `degrees` about an axis in its own
+// frame, the eye's distance scaled. Rotations about an axis leave the axis'
+// coordinates in the rotated frame unchanged, so (axis, -degrees, 1 /
+// scale) undoes it.
+prediction transform(
+    prediction p, const float axis[3], float degrees, float scale)
+{
+  const float3 dir = anari::math::normalize(p.center - p.eye);
+  const float3 right = anari::math::normalize(anari::math::cross(dir, p.up));
+  const float3 up = anari::math::cross(right, dir);
+  const float3 a =
+      anari::math::normalize(right * axis[0] + up * axis[1] + dir * axis[2]);
+  const float angle = degrees * 3.14159265f / 180.f;
+  p.eye = p.center + rotate(p.eye - p.center, a, angle) * scale;
+  p.up = rotate(p.up, a, angle);
+  return p;
+}
+
+} // namespace
+
+bool ViewRig::load(const std::string &file)
+{
+  std::ifstream in(file);
+  if (!in) {
+    std::cerr << "ERROR: could not open view rig " << file << "\n";
+    return false;
+  }
+  std::vector<DetectorView> views;
+  try {
+    const auto data = nlohmann::json::parse(in);
+    for (const auto &v : data.at("views")) {
+      DetectorView view;
+      view.name = v.value("name", "view " + std::to_string(views.size() + 1));
+      view.suffix = v.at("suffix").get<std::string>();
+      view.angle = v.at("angle").get<float>();
+      view.distance = v.value("distance", 1.f);
+      if (v.contains("axis")) {
+        for (int a = 0; a < 3; ++a)
+          view.axis[a] = v["axis"].at(a).get<float>();
+      }
+      views.push_back(view);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "ERROR: could not parse view rig " << file << ": " << e.what()
+              << "\n";
+    return false;
+  }
+  if (views.empty()) {
+    std::cerr << "ERROR: view rig " << file << " has no views\n";
+    return false;
+  }
+  m_file = file;
+  m_views = std::move(views);
+  return true;
+}
+
+size_t ViewRig::size() const
+{
+  return m_views.size();
+}
+
+const DetectorView &ViewRig::view(size_t v) const
+{
+  return m_views[v];
+}
+
+const std::string &ViewRig::file() const
+{
+  return m_file;
+}
+
+prediction ViewRig::pose(const prediction &primary, size_t v) const
+{
+  const auto &view = m_views[v];
+  prediction p = transform(primary, view.axis, view.angle, view.distance);
+  p.filename = reference(primary.filename, v);
+  return p;
+}
+
+prediction ViewRig::primary(const prediction &viewPose, size_t v) const
+{
+  const auto &view = m_views[v];
+  return transform(viewPose, view.axis, -view.angle, 1.f / view.distance);
+}
+
+std::string ViewRig::reference(const std::string &primaryFile, size_t v) const
+{
+  const std::filesystem::path path(primaryFile);
+  return (path.parent_path()
+             / (path.stem().string() + m_views[v].suffix
+                 + path.extension().string()))
+      .string();
+}
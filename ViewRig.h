@@ -0,0 +1,59 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <string>
+#include <vector>
+// ours
+#include "prediction.h"
+
+// Multi-view (biplane) detector geometry ////////////////////////////////////
+//
+// Further detectors at a fixed geometry relative to the primary one, the
+// camera of the predictions. A view's camera is the primary camera rotated
+// about the isocenter (the pose's center) by `angle` degrees about `axis`,
+// given in the primary camera's frame (right, up, view direction), with
+// its eye-isocenter distance scaled by `distance`. A biplane room whose
+// second C-arm sits at 90 degrees about the patient's long axis is
+// {"angle": 90}. All views share the primary's field of view. The rig file
+// is JSON:
+//
+//   {"views": [{"name": "lateral", "suffix": "_lat", "angle": 90,
+//               "axis": [0, 1, 0], "distance": 1}]}
+//
+// A view's reference images are the primary's with `suffix` inserted
+// before the extension (frame_0001.png: frame_0001_lat.png).
+
+struct DetectorView
+{
+  std::string name;
+  std::string suffix;
+  float axis[3]{0.f, 1.f, 0.f};
+  float angle{0.f}; // degrees
+  float distance{1.f};
+};
+
+class ViewRig
+{
+ public:
+  // False, with a message, if the file cannot be read or has no views
+  bool load(const std::string &file);
+
+  // the views besides the primary
+  size_t size() const;
+  const DetectorView &view(size_t v) const;
+  const std::string &file() const;
+
+  // The camera of view v for the primary pose, and the primary pose a
+  // camera of view v implies
+  prediction pose(const prediction &primary, size_t v) const;
+  prediction primary(const prediction &viewPose, size_t v) const;
+  std::string reference(const std::string &primaryFile, size_t v) const;
+
+ private:
+  std::string m_file;
+  std::vector<DetectorView> m_views;
+};
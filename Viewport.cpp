@@ -6,18 +6,365 @@
 #include <common/input/keyboard.h>
 #include <common/input/mouse.h>
 // std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <memory>
-// stb_image
-#include "stb_image_write.h"
+// ours
+#include "AnariCalls.h"
+#include "ResourceUsage.h"
+#include "Trace.h"
 
 namespace anari_viewer::windows {
 
+///////////////////////////////////////////////////////////////////////////////
+// FrameView definitions //////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+FrameView::FrameView(anari::Device device, anari::Frame frame, bool mapOrigin)
+    : m_device(device), m_frame(frame)
+{
+  TRACE_SCOPE("anari", "map");
+  auto fb = anari_calls::map<uint32_t>(m_device, m_frame, "channel.color");
+  if (!fb.data) {
+    printf("mapped bad frame: %p | %i x %i\n", fb.data, fb.width, fb.height);
+    anari::unmap(m_device, m_frame, "channel.color");
+    m_frame = nullptr;
+    return;
+  }
+  m_color = reinterpret_cast<const uint8_t *>(fb.data);
+  m_linear = fb.pixelType == ANARI_FLOAT32;
+  m_width = fb.width;
+  m_height = fb.height;
+  m_fullWidth = m_width;
+  m_fullHeight = m_height;
+
+  if (mapOrigin) {
+    auto db = anari_calls::map<anari::math::float3>(
+        m_device, m_frame, "channel.origin");
+    if (db.data)
+      m_origin = reinterpret_cast<const float *>(db.data);
+    else
+      anari::unmap(m_device, m_frame, "channel.origin");
+  }
+}
+
+FrameView::FrameView(std::shared_ptr<const RenderedFrame> frame, bool withOrigin)
+    : m_host(std::move(frame))
+{
+  if (!m_host || m_host->color.empty()) {
+    m_host.reset();
+    return;
+  }
+  m_color = m_host->color.data();
+  m_linear = m_host->linear;
+  m_width = size_t(m_host->width);
+  m_height = size_t(m_host->height);
+  m_fullWidth = m_width;
+  m_fullHeight = m_height;
+  m_camera = m_host->camera;
+  if (withOrigin && !m_host->origin.empty())
+    m_origin = m_host->origin.data();
+  if (withOrigin && !m_host->depth.empty()) {
+    m_depth = m_host->depth.data();
+    m_originFormat = m_host->originFormat;
+  }
+}
+
+FrameView::~FrameView()
+{
+  unmap();
+}
+
+std::shared_ptr<const RenderedFrame> FrameView::copy(
+    OriginFormat format) const
+{
+  auto frame = std::make_shared<RenderedFrame>();
+  frame->width = int(m_width);
+  frame->height = int(m_height);
+  frame->linear = m_linear;
+  frame->camera = m_camera;
+  const auto c = color();
+  frame->color.assign(c.begin(), c.end());
+  const size_t count = m_width * m_height;
+  std::vector<float> unprojected;
+  const float *origins = m_origin;
+  if (m_depth && format != m_originFormat) {
+    unprojected.resize(count * 3);
+    unprojectDepth(m_depth, m_originFormat, rayCamera(), unprojected.data());
+    origins = unprojected.data();
+  }
+  if (m_depth && format == m_originFormat) {
+    const auto *bytes = static_cast<const uint8_t *>(m_depth);
+    frame->originFormat = format;
+    frame->depth.assign(bytes, bytes + count * originPixelBytes(format));
+  } else if (origins && format == OriginFormat::Float3) {
+    frame->origin.assign(origins, origins + count * 3);
+  } else if (origins) {
+    const auto &eye = m_camera.position;
+    const float position[3] = {eye.x, eye.y, eye.z};
+    frame->originFormat = format;
+    frame->depth.resize(count * originPixelBytes(format));
+    packOriginDepth(origins, count, position, format, frame->depth.data());
+  }
+  return frame;
+}
+
+void FrameView::setCamera(const RenderCamera &camera)
+{
+  m_camera = camera;
+}
+
+RayCamera FrameView::rayCamera() const
+{
+  const auto &c = m_camera;
+  RayCamera camera{{c.position.x, c.position.y, c.position.z},
+      {c.direction.x, c.direction.y, c.direction.z},
+      {c.up.x, c.up.y, c.up.z},
+      c.fovy,
+      c.aspect};
+  std::copy_n(c.region, 4, camera.region);
+  camera.width = m_width;
+  camera.height = m_height;
+  return camera;
+}
+
+FrameView::FrameView(FrameView &&other) noexcept
+{
+  *this = std::move(other);
+}
+
+FrameView &FrameView::operator=(FrameView &&other) noexcept
+{
+  if (this != &other) {
+    unmap();
+    m_device = other.m_device;
+    m_frame = other.m_frame;
+    m_host = std::move(other.m_host);
+    m_color = other.m_color;
+    m_origin = other.m_origin;
+    m_depth = other.m_depth;
+    m_originFormat = other.m_originFormat;
+    m_camera = other.m_camera;
+    m_edges = other.m_edges;
+    m_linear = other.m_linear;
+    m_width = other.m_width;
+    m_height = other.m_height;
+    std::copy_n(other.m_offset, 2, m_offset);
+    m_fullWidth = other.m_fullWidth;
+    m_fullHeight = other.m_fullHeight;
+    other.m_frame = nullptr;
+    other.m_color = nullptr;
+    other.m_origin = nullptr;
+    other.m_depth = nullptr;
+    other.m_edges = nullptr;
+  }
+  return *this;
+}
+
+void FrameView::unmap()
+{
+  if (m_host) {
+    m_host.reset();
+    m_color = nullptr;
+    m_origin = nullptr;
+    m_depth = nullptr;
+    m_edges = nullptr;
+  }
+  if (!m_frame)
+    return;
+  TRACE_SCOPE("anari", "unmap");
+  if (m_color)
+    anari::unmap(m_device, m_frame, "channel.color");
+  if (m_origin)
+    anari::unmap(m_device, m_frame, "channel.origin");
+  m_frame = nullptr;
+  m_color = nullptr;
+  m_origin = nullptr;
+  m_edges = nullptr;
+}
+
+bool FrameView::valid() const
+{
+  return m_color != nullptr;
+}
+
+size_t FrameView::width() const
+{
+  return m_width;
+}
+
+size_t FrameView::height() const
+{
+  return m_height;
+}
+
+std::span<const uint8_t> FrameView::color() const
+{
+  return {m_color, m_color ? m_width * m_height * 4 : 0};
+}
+
+bool FrameView::linear() const
+{
+  return m_linear;
+}
+
+std::span<const float> FrameView::values() const
+{
+  if (!m_linear || !m_color)
+    return {};
+  return {reinterpret_cast<const float *>(m_color), m_width * m_height};
+}
+
+std::span<const float> FrameView::origin() const
+{
+  return {m_origin, m_origin ? m_width * m_height * 3 : 0};
+}
+
+bool FrameView::hasOrigins() const
+{
+  return m_origin || m_depth;
+}
+
+std::span<const uint8_t> FrameView::edges() const
+{
+  return {m_edges, m_edges ? m_width * m_height * 4 : 0};
+}
+
+void FrameView::setEdges(const uint8_t *edges)
+{
+  m_edges = edges;
+}
+
+void FrameView::setRegion(
+    int offsetX, int offsetY, size_t fullWidth, size_t fullHeight)
+{
+  m_offset[0] = offsetX;
+  m_offset[1] = offsetY;
+  m_fullWidth = fullWidth;
+  m_fullHeight = fullHeight;
+}
+
+size_t FrameView::fullWidth() const
+{
+  return m_fullWidth;
+}
+
+size_t FrameView::fullHeight() const
+{
+  return m_fullHeight;
+}
+
+void FrameView::copyFull(
+    std::vector<uint8_t> &color, std::vector<float> &origin) const
+{
+  const auto c = this->color();
+  std::span<const float> o = this->origin();
+  std::vector<float> unprojected;
+  if (m_depth) {
+    unprojected.resize(m_width * m_height * 3);
+    unprojectDepth(m_depth, m_originFormat, rayCamera(), unprojected.data());
+    o = unprojected;
+  }
+  if (m_fullWidth == m_width && m_fullHeight == m_height) {
+    color.assign(c.begin(), c.end());
+    origin.assign(o.begin(), o.end());
+    return;
+  }
+
+  // nothing was rendered outside the ROI: zero color and origin there
+  color.assign(m_fullWidth * m_fullHeight * 4, 0);
+  origin.assign(o.empty() ? 0 : m_fullWidth * m_fullHeight * 3, 0.f);
+  for (size_t y = 0; y < m_height; ++y) {
+    const size_t row = (m_offset[1] + y) * m_fullWidth + m_offset[0];
+    std::copy_n(c.data() + y * m_width * 4, m_width * 4, &color[row * 4]);
+    if (!o.empty())
+      std::copy_n(o.data() + y * m_width * 3, m_width * 3, &origin[row * 3]);
+  }
+}
+
+void FrameView::copyFull(std::vector<uint8_t> &color) const
+{
+  const auto c = this->color();
+  if (m_fullWidth == m_width && m_fullHeight == m_height) {
+    color.assign(c.begin(), c.end());
+    return;
+  }
+
+  color.assign(m_fullWidth * m_fullHeight * 4, 0);
+  for (size_t y = 0; y < m_height; ++y) {
+    const size_t row = (m_offset[1] + y) * m_fullWidth + m_offset[0];
+    std::copy_n(c.data() + y * m_width * 4, m_width * 4, &color[row * 4]);
+  }
+}
+
+void FrameView::copyFullEdges(std::vector<uint8_t> &edges) const
+{
+  const auto e = this->edges();
+  if (e.empty() || (m_fullWidth == m_width && m_fullHeight == m_height)) {
+    edges.assign(e.begin(), e.end());
+    return;
+  }
+
+  edges.assign(m_fullWidth * m_fullHeight * 4, 0);
+  for (size_t y = 0; y < m_height; ++y) {
+    const size_t row = (m_offset[1] + y) * m_fullWidth + m_offset[0];
+    std::copy_n(e.data() + y * m_width * 4, m_width * 4, &edges[row * 4]);
+  }
+}
+
+void FrameView::sampleOrigins(
+    const float *pixels, size_t count, float *points) const
+{
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const RayCamera camera = m_depth ? rayCamera() : RayCamera();
+  for (size_t i = 0; i < count; ++i) {
+    // nearest pixel: origins do not interpolate across silhouettes
+    const float fx = std::floor(pixels[i * 2]) - m_offset[0];
+    const float fy = std::floor(pixels[i * 2 + 1]) - m_offset[1];
+    float *p = points + i * 3;
+    if (!hasOrigins() || !(fx >= 0.f && fx < m_width && fy >= 0.f
+            && fy < m_height)) {
+      p[0] = p[1] = p[2] = nan;
+      continue;
+    }
+    if (m_depth) {
+      unprojectDepthAt(
+          m_depth, m_originFormat, camera, size_t(fx), size_t(fy), p);
+      continue;
+    }
+    const float *o = m_origin + (size_t(fy) * m_width + size_t(fx)) * 3;
+    std::copy_n(o, 3, p);
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // DRRViewport definitions ///////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 
-DRRViewport::DRRViewport(anari::Device device, visionaray::pinhole_camera &camera, const char *name)
+// Whether the device lists "channel.colorGL" among its frame parameters,
+// the introspection the renderer parameters are parsed from
+static bool hasGLFrameChannel(anari::Device device)
+{
+  const auto *parameter = static_cast<const ANARIParameter *>(
+      anariGetObjectInfo(device,
+          ANARI_FRAME,
+          "default",
+          "parameter",
+          ANARI_PARAMETER_LIST));
+  for (; parameter && parameter->name; ++parameter) {
+    if (std::strcmp(parameter->name, "channel.colorGL") == 0)
+      return true;
+  }
+  return false;
+}
+
+DRRViewport::DRRViewport(anari::Device device,
+    visionaray::pinhole_camera &camera,
+    const char *name,
+    const char *renderer)
     : Window(name, true), m_device(device), m_camera(camera)
 {
   m_overlayWindowName = "overlay_";
@@ -48,27 +395,46 @@ DRRViewport::DRRViewport(anari::Device device, visionaray::pinhole_camera &camer
 
   anari::retain(m_device, m_device);
 
-  const char **r_subtypes = anariGetObjectSubtypes(m_device, ANARI_RENDERER);
-
-  if (r_subtypes != nullptr) {
-    for (int i = 0; r_subtypes[i] != nullptr; i++) {
-      std::string subtype = r_subtypes[i];
-      auto parameters =
-          anari_viewer::ui::parseParameters(m_device, ANARI_RENDERER, subtype.c_str());
-      m_rendererNames.push_back(subtype);
-      m_rendererParameters.push_back(parameters);
+  {
+    TRACE_SCOPE("startup", "renderer subtypes");
+    const char **r_subtypes =
+        anariGetObjectSubtypes(m_device, ANARI_RENDERER);
+    if (r_subtypes != nullptr) {
+      for (int i = 0; r_subtypes[i] != nullptr; i++)
+        m_rendererNames.emplace_back(r_subtypes[i]);
     }
-  } else
-    m_rendererNames.emplace_back("default");
+    if (m_rendererNames.empty())
+      m_rendererNames.emplace_back("default");
+  }
+  // parameter lists are parsed along with the renderer, on first use
+  m_rendererParameters.resize(m_rendererNames.size());
+  m_renderers.resize(m_rendererNames.size(), nullptr);
 
-  anari::commitParameters(m_device, m_device);
+  anari_calls::commitParameters(m_device, m_device);
+  m_glFramesSupported = hasGLFrameChannel(m_device);
 
-  m_frame = anari::newObject<anari::Frame>(m_device);
+  m_frames.push_back(anari::newObject<anari::Frame>(m_device));
+  m_frame = m_frames.front();
   m_perspCamera = anari::newObject<anari::Camera>(m_device, "perspective");
 
-  for (auto &name : m_rendererNames) {
-    m_renderers.push_back(
-        anari::newObject<anari::Renderer>(m_device, name.c_str()));
+  size_t initial = 0;
+  if (renderer) {
+    auto it =
+        std::find(m_rendererNames.begin(), m_rendererNames.end(), renderer);
+    if (it != m_rendererNames.end())
+      initial = size_t(it - m_rendererNames.begin());
+    else
+      fprintf(stderr,
+          "WARNING: no renderer '%s', using '%s'\n",
+          renderer,
+          m_rendererNames[0].c_str());
+  }
+  // without one selected yet, the first other one that can be created
+  if (!selectRenderer(initial)) {
+    for (size_t i = 0; i < m_rendererNames.size(); ++i) {
+      if (i != initial && selectRenderer(i))
+        break;
+    }
   }
 
   reshape(m_viewportSize);
@@ -81,41 +447,147 @@ DRRViewport::DRRViewport(anari::Device device, visionaray::pinhole_camera &camer
 
 DRRViewport::~DRRViewport()
 {
+  m_renderThread.reset();
   cancelFrame();
-  anari::wait(m_device, m_frame);
+  for (auto &f : m_frames)
+    anari::wait(m_device, f);
 
   anari::release(m_device, m_perspCamera);
   anari::release(m_device, m_world);
-  for (auto &r : m_renderers)
-    anari::release(m_device, r);
-  anari::release(m_device, m_frame);
+  for (auto &r : m_renderers) {
+    if (r)
+      anari::release(m_device, r);
+  }
+  for (auto &f : m_frames)
+    anari::release(m_device, f);
+  if (m_renderedFrame)
+    anari::release(m_device, m_renderedFrame);
   anari::release(m_device, m_device);
+
+  m_frameCache.reset(); // its textures go with the GL context
+  if (m_linearTexture)
+    glDeleteTextures(1, &m_linearTexture);
+  for (GLuint texture : {m_overlayTexture,
+           m_reprojectedTexture,
+           m_edgeTexture,
+           m_edgeSourceTexture,
+           m_edgeTargetTexture}) {
+    if (texture)
+      glDeleteTextures(1, &texture);
+  }
+  if (m_glFrameFramebuffer)
+    glDeleteFramebuffers(1, &m_glFrameFramebuffer);
 }
 
 void DRRViewport::buildUI()
 {
+  measureInputLatency();
+
   ImVec2 _viewportSize = ImGui::GetContentRegionAvail();
   anari::math::int2 viewportSize(_viewportSize.x, _viewportSize.y);
 
   if (m_viewportSize != viewportSize)
     reshape(viewportSize);
 
-  if (m_viewChanged || (!m_singleShot)) {
-    updateCamera();
+  // Interaction ended on a reduced-resolution image: refine to full size
+  const bool interacting = isInteracting();
+  if (m_wasInteracting && !interacting && m_displaySize != frameSize())
+    m_viewChanged = true;
+  m_wasInteracting = interacting;
+
+  if (m_worldVersion) {
+    const uint64_t version = m_worldVersion();
+    if (version != m_seenWorldVersion) {
+      m_seenWorldVersion = version;
+      m_renderDirty = true;
+    }
+  }
+  // the camera itself is committed when the next frame starts, once for
+  // all the input since the last one
+  if (m_viewChanged)
+    m_renderDirty = true;
+  // a frame in flight is polled until it can be shown; new frames only
+  // when something changed or the renderer accumulates
+  ++m_numUiFrames;
+  if (needsFrame() || m_currentlyRendering || m_saveNextFrame)
     updateImage();
+  else
+    ++m_numIdleUiFrames;
+  if (m_arbiter)
+    m_arbiter->setInteractive(!idle() || interacting);
+
+  FrameHistogram::Result histogram;
+  if (m_histogram.read(histogram))
+    takeHistogram(std::move(histogram));
+
+  // a new display window applies to the frame shown, without rendering
+  if (m_windowChanged && m_lastFrameLinear
+      && m_linearTextureSize == m_textureSize) {
+    // new percentiles
+    if (m_autoWindow) {
+      m_histogram.compute(m_linearTexture,
+          m_displaySize.x,
+          m_displaySize.y,
+          m_autoWindowPercentiles[0],
+          m_autoWindowPercentiles[1]);
+    }
+    m_toneMapper.apply(m_linearTexture,
+        m_framebufferTexture,
+        m_displaySize.x,
+        m_displaySize.y,
+        m_displayWindow,
+        m_autoWindow ? m_histogram.windowTexture() : 0);
+    if (m_mipmapped) {
+      glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
+      glGenerateMipmap(GL_TEXTURE_2D);
+    }
   }
-
-  ImGui::Image((void *)(intptr_t)m_framebufferTexture,
-      ImGui::GetContentRegionAvail(),
-      ImVec2(1, 0),
-      ImVec2(0, 1));
+  m_windowChanged = false;
+
+  // Reduced-resolution frames occupy the lower left of the texture and are
+  // stretched over the whole viewport; detector frames keep their aspect
+  const float su = m_displaySize.x / float(m_textureSize.x);
+  const float sv = m_displaySize.y / float(m_textureSize.y);
+  ImVec2 imageSize = ImGui::GetContentRegionAvail();
+  if (const float aspect = frameAspect(); aspect > 0.f) {
+    const ImVec2 available = imageSize;
+    if (available.x > available.y * aspect)
+      imageSize.x = available.y * aspect;
+    else
+      imageSize.y = available.x / aspect;
+    ImVec2 cursor = ImGui::GetCursorPos();
+    ImGui::SetCursorPos(ImVec2(cursor.x + (available.x - imageSize.x) * .5f,
+        cursor.y + (available.y - imageSize.y) * .5f));
+  }
+  const GLuint shown =
+      applyOverlay(applyEdges(applyReprojection(m_framebufferTexture)));
+  ImGui::Image((void *)(intptr_t)shown,
+      imageSize,
+      ImVec2(su, 0),
+      ImVec2(0, sv));
+  m_imageMin = ImGui::GetItemRectMin();
+  m_imageMax = ImGui::GetItemRectMax();
+
+  // supersampled frames: mipmaps instead of skipping texels
+  const bool minified = m_displaySize.x > 1.25f * imageSize.x
+      || m_displaySize.y > 1.25f * imageSize.y;
+  if (minified != m_mipmapped) {
+    m_mipmapped = minified;
+    glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
+    if (m_mipmapped)
+      glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D,
+        GL_TEXTURE_MIN_FILTER,
+        m_mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  }
+  ui_roi();
 
   if (m_showOverlay)
     ui_overlay();
 
   ui_contextMenu();
 
-  if (!m_contextMenuVisible)
+  if (!m_contextMenuVisible && m_inputEnabled)
     ui_handleInput();
 }
 
@@ -130,7 +602,7 @@ void DRRViewport::setWorld(anari::World world, bool resetCameraView)
   } else
     anari::retain(m_device, world);
 
-  anari::commitParameters(m_device, world);
+  anari_calls::commitParameters(m_device, world);
   m_world = world;
 
   if (resetCameraView)
@@ -172,154 +644,1165 @@ void DRRViewport::resetView()
   m_camera.view_all({min, max}, {0.f, 1.f, 0.f});
   m_viewChanged = true;
 
-  cancelFrame();
-  updateCamera(true);
-  startNewFrame();
-  updateImage();
+  cancelFrame();
+  updateCamera(true);
+  startNewFrame();
+  updateImage();
+}
+
+void DRRViewport::reportMemory(MemoryReport &report) const
+{
+  for (size_t i = 0; i < m_frames.size(); ++i) {
+    const size_t pixels = size_t(m_frameSizes[i].x) * m_frameSizes[i].y;
+    const size_t bytesPerPixel =
+        4 + ((m_frameChannels[i] & ChannelOrigin) ? 3 * sizeof(float) : 0);
+    report.add(MemoryReport::Device,
+        "frame " + std::to_string(i) + " channels",
+        pixels * bytesPerPixel);
+  }
+  if (m_renderedFrame) {
+    const size_t pixels =
+        size_t(m_renderedFrameSize.x) * m_renderedFrameSize.y;
+    const size_t bytesPerPixel = 4
+        + ((m_renderedFrameChannels & ChannelOrigin) ? 3 * sizeof(float) : 0);
+    report.add(MemoryReport::Device,
+        "rendered frame channels",
+        pixels * bytesPerPixel);
+  }
+  report.add(MemoryReport::GL,
+      "viewport texture",
+      size_t(m_textureSize.x) * m_textureSize.y * 4);
+  if (m_linearTexture) {
+    report.add(MemoryReport::GL,
+        "viewport linear texture",
+        size_t(m_linearTextureSize.x) * m_linearTextureSize.y * sizeof(float));
+  }
+  if (m_overlayTexture) {
+    report.add(MemoryReport::GL,
+        "viewport overlay texture",
+        size_t(m_overlayTextureSize.x) * m_overlayTextureSize.y * 4);
+  }
+  if (m_reprojectedTexture) {
+    report.add(MemoryReport::GL,
+        "viewport reprojection",
+        size_t(m_reprojectedTextureSize.x) * m_reprojectedTextureSize.y * 4
+            + m_reprojector.bytes());
+  }
+  if (m_edgeTexture) {
+    report.add(MemoryReport::GL,
+        "viewport edge texture",
+        size_t(m_edgeTextureSize.x) * m_edgeTextureSize.y * 4);
+  }
+  if (m_edgeSourceTexture) {
+    report.add(MemoryReport::GL,
+        "edge channel textures",
+        (size_t(m_edgeSourceSize.x) * m_edgeSourceSize.y
+            + size_t(m_edgeTargetSize.x) * m_edgeTargetSize.y)
+            * 4);
+  }
+  report.add(MemoryReport::GL, "viewport pixel buffers", m_uploader.bytes());
+  if (m_frameCache)
+    m_frameCache->reportMemory(report);
+}
+
+void DRRViewport::setView(anari::math::float3 eye, anari::math::float3 center, anari::math::float3 up)
+{
+  m_camera.look_at({eye.x, eye.y, eye.z}, {center.x, center.y, center.z}, {up.x, up.y, up.z});
+
+  m_viewChanged = true;
+  restartFrame();
+}
+
+void DRRViewport::getView(anari::math::float3& eye, anari::math::float3& center, anari::math::float3& up, float& fovy, float& aspect)
+{
+  auto& e = m_camera.eye();
+  auto& c = m_camera.center();
+  auto& u = m_camera.up();
+  eye    = {e.x, e.y, e.z};
+  center = {c.x, c.y, c.z};
+  up     = {u.x, u.y, u.z};
+  fovy = m_useDetector ? m_detector.fovy() : m_camera.fovy();
+  aspect = m_useDetector ? m_detector.aspect() : m_camera.aspect();
+}
+
+void DRRViewport::setFovy(float fovy)
+{
+  m_fov = fovy * 180.f / float(M_PI);
+  m_camera.perspective(
+      fovy, m_camera.aspect(), m_camera.z_near(), m_camera.z_far());
+
+  m_viewChanged = true;
+  restartFrame();
+}
+
+anari::Device DRRViewport::device() const
+{
+  return m_device;
+}
+
+void DRRViewport::setPhotonEnergy(float energy)
+{
+  m_photonEnergy = energy;
+  m_photonEnergyPending = true;
+  restartFrame();
+}
+
+void DRRViewport::applyPendingEdits()
+{
+  if (m_photonEnergyPending) {
+    auto renderer = m_renderers[m_currentRenderer];
+    m_parameters.set(m_device, renderer, "photonEnergy", m_photonEnergy);
+    m_parameters.commit(m_device, renderer);
+    m_photonEnergyPending = false;
+  }
+}
+
+FrameView DRRViewport::mapFrame(bool mapOrigin)
+{
+  // the render thread's frames are in host memory already: the view gets a
+  // copy of the latest one, which the next frames don't overwrite
+  if (m_renderThread) {
+    return FrameView(
+        std::make_shared<const RenderedFrame>(m_renderThread->frame()),
+        mapOrigin);
+  }
+  return FrameView(m_device, m_frame, mapOrigin);
+}
+
+bool DRRViewport::getFrame(std::vector<uint8_t>& color, size_t& width, size_t& height)
+{
+  auto view = mapFrame(false);
+  if (!view.valid())
+    return false;
+
+  width = view.fullWidth();
+  height = view.fullHeight();
+  view.copyFull(color);
+  return true;
+}
+
+void DRRViewport::setLoadingProgress(float progress, const std::string &stage)
+{
+  m_loadingProgress = progress;
+  m_loadingStage = stage;
+}
+
+void DRRViewport::reshape(anari::math::int2 newSize)
+{
+  if (newSize.x <= 0 || newSize.y <= 0)
+    return;
+
+  m_viewportSize = newSize;
+
+  glViewport(0, 0, newSize.x, newSize.y);
+
+  m_camera.set_viewport(0, 0, newSize.x, newSize.y);
+  float fovy = m_camera.fovy();
+  float aspect = newSize.x / static_cast<float>(newSize.y);
+  float z_near = std::max(m_camera.z_near(), 1.f);
+  float z_far = std::min(m_camera.z_far(), FLT_MAX);
+  m_camera.perspective(fovy, aspect, z_near, z_far);
+
+  // detector and fixed-size frames don't depend on the viewport: only the
+  // display scales
+  if (frameAspect() > 0.f && m_textureSize == frameSize())
+    return;
+
+  resizeTexture();
+  updateFrame();
+  cancelFrame();
+  updateCamera(true);
+  startNewFrame();
+  updateImage();
+}
+
+void DRRViewport::startNewFrame()
+{
+  updateCamera();
+  const auto size = targetRenderSize();
+  if (!m_renderThread) {
+    if (m_frameIndex < m_frameSizes.size()
+        && m_frameSizes[m_frameIndex] != size) {
+      m_parameters.set(m_device, m_frame, "size", anari::math::uint2(size));
+      m_parameters.commit(m_device, m_frame);
+      m_frameSizes[m_frameIndex] = size;
+    }
+    setChannels(m_frameIndex, interactiveChannels());
+  }
+  applyPendingEdits();
+  // full frames of the view are kept by the frame cache once shown
+  const uint64_t cacheKey = m_frameCache && size == frameSize()
+          && !(m_defaultChannels & ChannelLinear)
+      ? frameKey(size, ChannelColor)
+      : 0;
+
+  // something changed: the device restarts accumulation, and so do we
+  if (m_renderDirty || m_frameCancelled) {
+    m_convergence.reset();
+    m_accumulationDone = false;
+  }
+
+  if (m_renderThread) {
+    RenderRequest request;
+    request.sequence = ++m_requestSequence;
+    request.camera = m_renderCamera;
+    request.size = size;
+    request.colorType = (m_defaultChannels & ChannelLinear)
+        ? ANARI_FLOAT32
+        : ANARI_UFIXED8_RGBA_SRGB;
+    request.origin = interactiveChannels() & ChannelOrigin;
+    request.cancel = m_frameCancelled;
+    request.keep = m_saveNextFrame;
+    request.cacheKey = cacheKey;
+    request.input = m_oldestInput;
+    // a full queue is tried again on the next UI frame
+    if (!m_renderThread->push(request))
+      return;
+    m_saveRequested |= request.keep;
+  } else {
+    if (m_frameIndex < m_frameKeys.size()) {
+      m_frameKeys[m_frameIndex] = cacheKey;
+      m_frameInputs[m_frameIndex] = m_oldestInput;
+      m_frameCameras[m_frameIndex] = m_renderCamera;
+    }
+    anari::getProperty(
+        m_device, m_frame, "numSamples", m_frameSamples, ANARI_NO_WAIT);
+    TRACE_SCOPE("anari", "render");
+    anari_calls::render(m_device, m_frame);
+  }
+  m_renderSize = size;
+  m_currentlyRendering = true;
+  m_frameCancelled = false;
+  m_renderDirty = false;
+  if (m_idle) {
+    // intervals measure frames, not the idle time before them
+    m_lastFrameCompleted = std::chrono::steady_clock::now();
+    m_idle = false;
+  }
+}
+
+bool DRRViewport::isInteracting() const
+{
+  return m_dolly || m_pan || m_orbit;
+}
+
+anari::math::int2 DRRViewport::frameSize() const
+{
+  if (m_useDetector)
+    return anari::math::int2(m_detector.width, m_detector.height);
+  if (m_fixedRenderSize)
+    return m_renderSizeSetting;
+  return anari::math::int2(std::max(1, int(m_viewportSize.x * m_renderScale)),
+      std::max(1, int(m_viewportSize.y * m_renderScale)));
+}
+
+float DRRViewport::frameAspect() const
+{
+  if (m_useDetector)
+    return m_detector.aspect();
+  if (m_fixedRenderSize)
+    return m_renderSizeSetting.x / float(m_renderSizeSetting.y);
+  return 0.f;
+}
+
+anari::math::int2 DRRViewport::targetRenderSize() const
+{
+  const auto size = frameSize();
+  if (!m_adaptiveResolution || !isInteracting())
+    return size;
+
+  return anari::math::int2(std::max(1, int(size.x * m_resolutionScale)),
+      std::max(1, int(size.y * m_resolutionScale)));
+}
+
+void DRRViewport::resizeTexture()
+{
+  const auto size = frameSize();
+  if (size == m_textureSize)
+    return;
+
+  glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
+  glTexImage2D(GL_TEXTURE_2D,
+      0,
+      GL_RGBA8,
+      size.x,
+      size.y,
+      0,
+      GL_RGBA,
+      GL_UNSIGNED_BYTE,
+      0);
+  m_textureSize = size;
+  m_mipmapped = false;
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  resizeLinearTexture(m_linearTexture != 0);
+  m_reprojector.setOrigins(nullptr, 0, 0); // the frame is gone
+}
+
+void DRRViewport::resizeLinearTexture(bool needed)
+{
+  const auto size = needed ? m_textureSize : anari::math::int2(0, 0);
+  if (size == m_linearTextureSize)
+    return;
+
+  m_linearTextureSize = size;
+  m_lastFrameLinear = false;
+  if (!needed) {
+    glDeleteTextures(1, &m_linearTexture);
+    m_linearTexture = 0;
+    return;
+  }
+  if (!m_linearTexture) {
+    // read with texelFetch only
+    glGenTextures(1, &m_linearTexture);
+    glBindTexture(GL_TEXTURE_2D, m_linearTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+  glBindTexture(GL_TEXTURE_2D, m_linearTexture);
+  glTexImage2D(GL_TEXTURE_2D,
+      0,
+      GL_R32F,
+      size.x,
+      size.y,
+      0,
+      GL_RED,
+      GL_FLOAT,
+      0);
+}
+
+void DRRViewport::ensureTexture(
+    GLuint &texture, anari::math::int2 &size, anari::math::int2 wanted)
+{
+  if (!texture) {
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  glBindTexture(GL_TEXTURE_2D, texture);
+  if (size == wanted)
+    return;
+  glTexImage2D(GL_TEXTURE_2D,
+      0,
+      GL_RGBA8,
+      wanted.x,
+      wanted.y,
+      0,
+      GL_RGBA,
+      GL_UNSIGNED_BYTE,
+      0);
+  size = wanted;
+}
+
+GLuint DRRViewport::applyEdges(GLuint frame)
+{
+  if (m_edgeDisplay.mode == EdgeSettings::None)
+    return frame;
+
+  ensureTexture(m_edgeTexture, m_edgeTextureSize, m_textureSize);
+  // redone every UI frame like the overlay, a fullscreen pass is cheap
+  if (!m_edgeFilter.apply(frame,
+          m_edgeTexture,
+          m_displaySize.x,
+          m_displaySize.y,
+          m_edgeDisplay))
+    return frame;
+  updateMipmaps(m_edgeTexture);
+  return m_edgeTexture;
+}
+
+GLuint DRRViewport::applyOverlay(GLuint frame)
+{
+  const GLuint reference =
+      m_overlay.mode != OverlaySettings::None && m_overlaySource
+      ? m_overlaySource()
+      : 0;
+  if (!reference)
+    return frame;
+
+  ensureTexture(m_overlayTexture, m_overlayTextureSize, m_textureSize);
+  // redone every UI frame, the reference may change without a new frame
+  if (!m_imageOverlay.apply(frame,
+          reference,
+          m_overlayTexture,
+          m_displaySize.x,
+          m_displaySize.y,
+          m_overlay))
+    return frame;
+  updateMipmaps(m_overlayTexture);
+  return m_overlayTexture;
+}
+
+GLuint DRRViewport::applyReprojection(GLuint frame)
+{
+  // nothing to warp, or the frame shown is of the current view
+  if (!m_reprojection || !m_reprojector.hasOrigins()
+      || currentCamera() == m_shownCamera)
+    return frame;
+
+  ensureTexture(
+      m_reprojectedTexture, m_reprojectedTextureSize, m_textureSize);
+  // the region of the frame shown, at its resolution
+  auto camera = rayCamera();
+  camera.width = size_t(m_displaySize.x);
+  camera.height = size_t(m_displaySize.y);
+  if (!m_reprojector.apply(frame, m_reprojectedTexture, camera))
+    return frame;
+  updateMipmaps(m_reprojectedTexture);
+  return m_reprojectedTexture;
+}
+
+void DRRViewport::updateMipmaps(GLuint texture)
+{
+  glBindTexture(GL_TEXTURE_2D, texture);
+  if (m_mipmapped)
+    glGenerateMipmap(GL_TEXTURE_2D);
+  glTexParameteri(GL_TEXTURE_2D,
+      GL_TEXTURE_MIN_FILTER,
+      m_mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+}
+
+void DRRViewport::filterEdges(FrameView &view)
+{
+  if (view.linear() || m_edgeChannel.mode == EdgeSettings::None)
+    return;
+  const anari::math::int2 size(int(view.width()), int(view.height()));
+  ensureTexture(m_edgeSourceTexture, m_edgeSourceSize, size);
+  glTexSubImage2D(GL_TEXTURE_2D,
+      0,
+      0,
+      0,
+      size.x,
+      size.y,
+      GL_RGBA,
+      GL_UNSIGNED_BYTE,
+      view.color().data());
+  ensureTexture(m_edgeTargetTexture, m_edgeTargetSize, size);
+  if (!m_edgeFilter.apply(m_edgeSourceTexture,
+          m_edgeTargetTexture,
+          size.x,
+          size.y,
+          m_edgeChannel))
+    return;
+  m_edgePixels.resize(size_t(size.x) * size.y * 4);
+  m_edgeFilter.read(m_edgeTargetTexture, size.x, size.y, m_edgePixels.data());
+  view.setEdges(m_edgePixels.data());
+}
+
+// Frame size or camera mode switched: the frames (and the texture) are
+// resized and the view restarts
+void DRRViewport::resolutionChanged()
+{
+  restartFrame();
+  resizeTexture();
+  updateFrame();
+  m_viewChanged = true;
+}
+
+void DRRViewport::adaptResolution(float frameTime)
+{
+  // Pixel count scales with the square of the scale factor; shrink quickly
+  // when over budget and grow back slowly when comfortably under it
+  if (frameTime > 1.1f * m_targetFrameTime)
+    m_resolutionScale *= std::sqrt(m_targetFrameTime / frameTime);
+  else if (frameTime < 0.7f * m_targetFrameTime)
+    m_resolutionScale *= 1.1f;
+
+  m_resolutionScale = std::max(0.25f, std::min(m_resolutionScale, 1.f));
+}
+
+bool DRRViewport::ensureRenderer(size_t index)
+{
+  if (m_renderers[index])
+    return true;
+  TRACE_SCOPE("startup", "create renderer");
+  const char *subtype = m_rendererNames[index].c_str();
+  m_rendererParameters[index] =
+      anari_viewer::ui::parseParameters(m_device, ANARI_RENDERER, subtype);
+  m_renderers[index] = anari::newObject<anari::Renderer>(m_device, subtype);
+  return m_renderers[index] != nullptr;
+}
+
+bool DRRViewport::selectRenderer(size_t index)
+{
+  // the frames keep the renderer selected before
+  if (!ensureRenderer(index)) {
+    fprintf(stderr,
+        "WARNING: could not create renderer '%s'\n",
+        m_rendererNames[index].c_str());
+    return false;
+  }
+  const auto &name = m_rendererNames[index];
+  m_singleShot = name == "DRR" || name == "drr" || name == "default";
+  m_currentRenderer = int(index);
+  findQualityKnobs();
+  return true;
+}
+
+void DRRViewport::instantiateRenderers()
+{
+  for (size_t i = 0; i < m_renderers.size(); ++i)
+    ensureRenderer(i);
+}
+
+void DRRViewport::findQualityKnobs()
+{
+  // Renderer parameters that trade quality for speed, in the order they are
+  // given up when over budget; other devices' names can be added here
+  static const char *knobNames[] = {"pixelSamples", "volumeSamplingRate"};
+
+  m_qualityKnobs.clear();
+  m_frameTimeCount = 0;
+
+  if (size_t(m_currentRenderer) >= m_rendererParameters.size())
+    return;
+
+  auto &parameters = m_rendererParameters[m_currentRenderer];
+  for (const char *name : knobNames) {
+    for (size_t i = 0; i < parameters.size(); ++i) {
+      auto &p = parameters[i];
+      if (p.name != name)
+        continue;
+
+      QualityKnob knob;
+      knob.parameter = i;
+      if (p.type == ANARI_INT32 && p.value.is<int>()) {
+        knob.isInt = true;
+        knob.value = p.value.get<int>();
+        knob.minValue = p.minValue.is<int>() ? p.minValue.get<int>() : 1;
+        knob.maxValue = p.maxValue.is<int>() ? p.maxValue.get<int>() : 64;
+      } else if (p.type == ANARI_FLOAT32 && p.value.is<float>()) {
+        knob.value = p.value.get<float>();
+        knob.minValue =
+            p.minValue.is<float>() ? p.minValue.get<float>() : 0.05f;
+        knob.maxValue =
+            p.maxValue.is<float>() ? p.maxValue.get<float>() : 4.f;
+      } else {
+        continue;
+      }
+      knob.minValue = std::max(knob.minValue, knob.isInt ? 1.f : 1e-3f);
+      m_qualityKnobs.push_back(knob);
+    }
+  }
+}
+
+void DRRViewport::recordFrameTime(float frameTime)
+{
+  m_frameTimes[m_frameTimeCount++ % m_frameTimes.size()] = frameTime;
+  if (m_frameTimeCount < m_frameTimes.size() || m_qualityKnobs.empty())
+    return;
+
+  float mean = 0.f;
+  for (float t : m_frameTimes)
+    mean += t;
+  mean /= m_frameTimes.size();
+
+  // Hysteresis band so a converged knob doesn't restart accumulation
+  const bool tooSlow = mean > 1.15f * m_targetFrameTime;
+  const bool tooFast = mean < 0.75f * m_targetFrameTime;
+  if (!tooSlow && !tooFast)
+    return;
+
+  auto adjust = [&](QualityKnob &knob) -> bool {
+    float value = knob.value;
+    if (knob.isInt)
+      value += tooSlow ? -1.f : 1.f;
+    else
+      value *= tooSlow ? 0.8f : 1.15f;
+    value = std::max(knob.minValue, std::min(value, knob.maxValue));
+    if (value == knob.value)
+      return false;
+    knob.value = value;
+    return true;
+  };
+
+  // Lower the first knob with headroom when slow, raise the last when fast
+  QualityKnob *changed = nullptr;
+  if (tooSlow) {
+    for (auto &knob : m_qualityKnobs)
+      if (adjust(knob)) {
+        changed = &knob;
+        break;
+      }
+  } else {
+    for (auto it = m_qualityKnobs.rbegin(); it != m_qualityKnobs.rend(); ++it)
+      if (adjust(*it)) {
+        changed = &*it;
+        break;
+      }
+  }
+
+  m_frameTimeCount = 0;
+  if (!changed)
+    return;
+
+  auto renderer = m_renderers[m_currentRenderer];
+  auto &p = m_rendererParameters[m_currentRenderer][changed->parameter];
+  if (changed->isInt) {
+    int value = int(changed->value);
+    m_parameters.set(m_device, renderer, p.name.c_str(), value);
+    p.value = value;
+  } else {
+    m_parameters.set(m_device, renderer, p.name.c_str(), changed->value);
+    p.value = changed->value;
+  }
+  m_parameters.commit(m_device, renderer);
+  ++m_rendererVersion;
+}
+
+unsigned DRRViewport::interactiveChannels() const
+{
+  return m_defaultChannels | (m_reprojection ? ChannelOrigin : 0u);
+}
+
+void DRRViewport::setChannels(size_t frameIndex, unsigned channels)
+{
+  if (frameIndex >= m_frameChannels.size()
+      || m_frameChannels[frameIndex] == channels)
+    return;
+
+  setFrameChannels(
+      m_frames[frameIndex], m_frameChannels[frameIndex], channels);
+}
+
+void DRRViewport::setFrameChannels(
+    anari::Frame frame, unsigned &current, unsigned channels)
+{
+  if (current == channels)
+    return;
+
+  const anari::DataType colorType =
+      (channels & ChannelLinear) ? ANARI_FLOAT32 : ANARI_UFIXED8_RGBA_SRGB;
+  m_parameters.set(m_device, frame, "channel.color", colorType);
+  if (channels & ChannelOrigin)
+    m_parameters.set(m_device, frame, "channel.origin", ANARI_FLOAT32_VEC3);
+  else
+    m_parameters.unset(m_device, frame, "channel.origin");
+  m_parameters.commit(m_device, frame);
+  current = channels;
+}
+
+void DRRViewport::setDefaultChannels(unsigned channels)
+{
+  m_defaultChannels = channels | ChannelColor;
+  restartFrame();
+}
+
+void DRRViewport::setLinearOutput(bool linear)
+{
+  if (linear == linearOutput())
+    return;
+  if (linear)
+    setDefaultChannels(m_defaultChannels | ChannelLinear);
+  else
+    setDefaultChannels(m_defaultChannels & ~ChannelLinear);
+  if (!linear)
+    resizeLinearTexture(false);
+}
+
+bool DRRViewport::linearOutput() const
+{
+  return m_defaultChannels & ChannelLinear;
+}
+
+void DRRViewport::setDisplayWindow(const DisplayWindow &window)
+{
+  m_displayWindow = window;
+  m_autoWindow = false;
+  m_windowChanged = true;
+}
+
+void DRRViewport::setAutoWindowPercentiles(float low, float high)
+{
+  m_autoWindowPercentiles[0] = std::clamp(low, 0.f, 100.f);
+  m_autoWindowPercentiles[1] =
+      std::clamp(high, m_autoWindowPercentiles[0], 100.f);
+  m_windowChanged = true;
+}
+
+void DRRViewport::setOverlaySource(std::function<GLuint()> texture)
+{
+  m_overlaySource = std::move(texture);
+}
+
+void DRRViewport::setOverlay(const OverlaySettings &settings)
+{
+  m_overlay = settings;
+}
+
+void DRRViewport::setEdgeEnhancement(const EdgeSettings &settings)
+{
+  m_edgeDisplay = settings;
+}
+
+void DRRViewport::setEdgeChannel(const EdgeSettings &settings)
+{
+  m_edgeChannel = settings;
+}
+
+FrameView DRRViewport::renderFrame(unsigned channels, float scale)
+{
+  // the camera is shared with the interactive frames
+  RenderThread::Pause pause(m_renderThread.get());
+  cancelFrame();
+  for (auto &f : m_frames)
+    anari::wait(m_device, f);
+
+  const auto fullSize = anari::math::int2(
+      std::max(1, int(frameSize().x * scale)),
+      std::max(1, int(frameSize().y * scale)));
+  // an ROI renders at the full frame's pixel density: its pixels snap to
+  // the full grid and the camera's imageRegion is that of whole pixels
+  int offset[2] = {0, 0};
+  int roiSize[2] = {fullSize.x, fullSize.y};
+  if (!m_roi.full())
+    m_roi.pixels(fullSize.x, fullSize.y, offset, roiSize);
+  const auto size = anari::math::int2(roiSize[0], roiSize[1]);
+  m_cameraRegion.lower[0] = offset[0] / float(fullSize.x);
+  m_cameraRegion.lower[1] = offset[1] / float(fullSize.y);
+  m_cameraRegion.upper[0] = (offset[0] + size.x) / float(fullSize.x);
+  m_cameraRegion.upper[1] = (offset[1] + size.y) / float(fullSize.y);
+
+  // a frame of its own: the ring's frames keep their size and channels,
+  // and the view outlives the interactive frames rendered meanwhile
+  auto &frame = m_renderedFrame;
+  if (!frame)
+    frame = anari::newObject<anari::Frame>(m_device);
+  // committed only when something changed, e.g. not between the renders
+  // of a registration
+  m_parameters.set(m_device, frame, "size", anari::math::uint2(size));
+  m_renderedFrameSize = size;
+  m_parameters.set(m_device, frame, "world", m_world);
+  m_parameters.set(m_device, frame, "camera", m_perspCamera);
+  m_parameters.set(
+      m_device, frame, "renderer", m_renderers[m_currentRenderer]);
+  m_parameters.commit(m_device, frame);
+  setFrameChannels(frame,
+      m_renderedFrameChannels,
+      (channels | ChannelColor) & ~ChannelEdges);
+  applyPendingEdits();
+
+  updateCamera(true);
+  // poses revisited (registration loops) are taken from the frame cache
+  const uint64_t cacheKey = m_frameCache
+      ? frameKey(size, (channels | ChannelColor) & ~ChannelEdges)
+      : 0;
+  auto cached = cacheKey ? m_frameCache->frame(cacheKey) : nullptr;
+  if (!cached) {
+    {
+      TRACE_SCOPE("anari", "render");
+      anari_calls::render(m_device, frame);
+    }
+    {
+      TRACE_SCOPE("anari", "wait");
+      anari::wait(m_device, frame);
+    }
+  }
+
+  // the next interactive frame renders the whole image again
+  if (!m_cameraRegion.full()) {
+    m_cameraRegion = ImageRoi();
+    m_viewChanged = true;
+  }
+  FrameView view = cached
+      ? FrameView(cached, channels & ChannelOrigin)
+      : FrameView(m_device, frame, channels & ChannelOrigin);
+  if (!cached)
+    view.setCamera(m_renderCamera);
+  if (cacheKey && !cached && view.valid())
+    m_frameCache->putFrame(cacheKey, view.copy(m_originFormat));
+  if (view.valid()) {
+    view.setRegion(offset[0], offset[1], fullSize.x, fullSize.y);
+    if (channels & ChannelEdges)
+      filterEdges(view);
+  }
+  return view;
+}
+
+bool DRRViewport::queryOrigins(
+    std::span<const float> pixels, std::vector<float> &points, float scale)
+{
+  auto view = renderFrame(ChannelColor | ChannelOrigin, scale);
+  if (!view.valid() || !view.hasOrigins())
+    return false;
+  points.resize(pixels.size() / 2 * 3);
+  view.sampleOrigins(pixels.data(), pixels.size() / 2, points.data());
+  return true;
+}
+
+bool DRRViewport::queryOrigins(std::span<const float> pixels,
+    std::vector<float> &points,
+    const StructuredField &field,
+    const FirstHitSettings &settings,
+    float scale)
+{
+  if (field.empty())
+    return queryOrigins(pixels, points, scale);
+  points.resize(pixels.size() / 2 * 3);
+  marchFirstHits(field,
+      rayCamera(scale),
+      pixels.data(),
+      pixels.size() / 2,
+      points.data(),
+      settings);
+  return true;
+}
+
+void DRRViewport::setRenderScale(float scale)
+{
+  m_renderScale = std::max(0.1f, std::min(scale, 4.f));
+  m_fixedRenderSize = false;
+  resolutionChanged();
+}
+
+void DRRViewport::setFixedRenderSize(anari::math::int2 size)
+{
+  m_fixedRenderSize = size.x > 0 && size.y > 0;
+  if (m_fixedRenderSize)
+    m_renderSizeSetting = size;
+  resolutionChanged();
+}
+
+void DRRViewport::setDetector(const DetectorGeometry &detector)
+{
+  m_detector = detector;
+  m_useDetector = detector.valid();
+  resolutionChanged();
+}
+
+const DetectorGeometry &DRRViewport::detector() const
+{
+  return m_detector;
+}
+
+bool DRRViewport::detectorEnabled() const
+{
+  return m_useDetector;
+}
+
+void DRRViewport::setRoi(const ImageRoi &roi)
+{
+  m_roi = roi;
+}
+
+const ImageRoi &DRRViewport::roi() const
+{
+  return m_roi;
+}
+
+void DRRViewport::setRoiChangedCallback(
+    std::function<void(const ImageRoi &)> callback)
+{
+  m_roiChanged = std::move(callback);
+}
+
+void DRRViewport::updateFrame()
+{
+  RenderThread::Pause pause(m_renderThread.get());
+  const auto size = frameSize();
+  m_frameSizes.assign(m_frames.size(), size);
+  // channels are set lazily per frame; force the first setChannels()
+  m_frameChannels.assign(m_frames.size(), ~0u);
+  m_frameKeys.assign(m_frames.size(), 0);
+  m_frameInputs.assign(m_frames.size(), {});
+  m_frameCameras.assign(m_frames.size(), {});
+
+  for (auto &frame : m_frames) {
+    // channel.color and .origin follow in setChannels(); unchanged
+    // parameters (all of them on a renderer switch but one) are skipped
+    m_parameters.set(m_device, frame, "size", anari::math::uint2(size));
+    m_parameters.set(m_device, frame, "accumulation", true);
+    m_parameters.set(m_device, frame, "world", m_world);
+    m_parameters.set(m_device, frame, "camera", m_perspCamera);
+    m_parameters.set(
+        m_device, frame, "renderer", m_renderers[m_currentRenderer]);
+    m_parameters.commit(m_device, frame);
+  }
+  if (m_renderThread)
+    m_renderThread->setFrames(m_frames);
+}
+
+void DRRViewport::setFramesInFlight(int numFrames)
+{
+  numFrames = std::max(1, std::min(numFrames, 3));
+  if (numFrames == int(m_frames.size()))
+    return;
+
+  RenderThread::Pause pause(m_renderThread.get());
+  cancelFrame();
+  for (auto &f : m_frames)
+    anari::wait(m_device, f);
+
+  while (int(m_frames.size()) > numFrames) {
+    m_parameters.forget(m_frames.back());
+    anari::release(m_device, m_frames.back());
+    m_frames.pop_back();
+  }
+  while (int(m_frames.size()) < numFrames)
+    m_frames.push_back(anari::newObject<anari::Frame>(m_device));
+
+  m_framesInFlight = numFrames;
+  m_frameIndex = 0;
+  m_frame = m_frames[m_frameIndex];
+
+  updateFrame();
+  startNewFrame();
+  updateImage();
+}
+
+void DRRViewport::setRenderThread(bool enabled)
+{
+  if (enabled == renderThreadEnabled())
+    return;
+
+  // the ring's frames change hands with nothing in flight
+  if (enabled) {
+    cancelFrame();
+    for (auto &f : m_frames)
+      anari::wait(m_device, f);
+    m_renderThread =
+        std::make_unique<RenderThread>(
+            m_device, m_perspCamera, m_frames, m_parameters);
+  } else {
+    m_renderThread.reset();
+  }
+  m_currentlyRendering = false;
+  m_frameCancelled = false;
+  m_saveRequested = false;
+
+  // sizes and channels are set again, whoever set them last
+  updateFrame();
+  updateCamera(true);
+  startNewFrame();
+  updateImage();
+}
+
+bool DRRViewport::renderThreadEnabled() const
+{
+  return m_renderThread != nullptr;
+}
+
+void DRRViewport::setReprojection(bool enabled)
+{
+  if (enabled == m_reprojection)
+    return;
+  m_reprojection = enabled;
+  // frames from now on bring their origins, or stop rendering them
+  m_reprojector.setOrigins(nullptr, 0, 0);
+  m_renderDirty = true;
+}
+
+bool DRRViewport::reprojectionEnabled() const
+{
+  return m_reprojection;
 }
 
-void DRRViewport::setView(anari::math::float3 eye, anari::math::float3 center, anari::math::float3 up)
+void DRRViewport::setFrameCache(
+    size_t hostBytes, size_t textureBytes, float quantum)
 {
-  m_camera.look_at({eye.x, eye.y, eye.z}, {center.x, center.y, center.z}, {up.x, up.y, up.z});
+  m_frameCache.reset();
+  if (hostBytes > 0 || textureBytes > 0)
+    m_frameCache =
+        std::make_unique<FrameCache>(hostBytes, textureBytes, quantum);
+  m_frameKeys.assign(m_frames.size(), 0);
+  m_frameInputs.assign(m_frames.size(), {});
+  m_frameCameras.assign(m_frames.size(), {});
+}
 
-  m_viewChanged = true;
-  cancelFrame();
-  updateCamera(true);
-  startNewFrame();
-  updateImage();
+void DRRViewport::setOriginFormat(OriginFormat format)
+{
+  m_originFormat = format;
 }
 
-void DRRViewport::getView(anari::math::float3& eye, anari::math::float3& center, anari::math::float3& up, float& fovy, float& aspect)
+uint64_t DRRViewport::frameKey(
+    anari::math::int2 size, unsigned channels) const
 {
-  auto& e = m_camera.eye();
-  auto& c = m_camera.center();
-  auto& u = m_camera.up();
-  eye    = {e.x, e.y, e.z};
-  center = {c.x, c.y, c.z};
-  up     = {u.x, u.y, u.z};
-  fovy = m_camera.fovy();
-  aspect = m_camera.aspect();
+  FrameParameters parameters;
+  parameters.renderer = m_currentRenderer;
+  parameters.rendererVersion = m_rendererVersion;
+  parameters.worldVersion = m_worldVersion ? m_worldVersion() : 0;
+  parameters.photonEnergy = m_photonEnergy;
+  parameters.size = size;
+  parameters.channels = channels;
+  return m_frameCache->key(m_renderCamera, parameters);
 }
 
-anari::Device DRRViewport::device() const
+bool DRRViewport::showCachedFrame()
 {
-  return m_device;
+  // only when the view changed; screenshots are rendered
+  if (!m_frameCache || !m_renderDirty || m_saveNextFrame)
+    return false;
+  updateCamera();
+  const auto size = targetRenderSize();
+  if (size != frameSize() || (m_defaultChannels & ChannelLinear))
+    return false;
+  int width = 0, height = 0;
+  if (!m_frameCache->presentTexture(frameKey(size, ChannelColor),
+          m_framebufferTexture,
+          width,
+          height))
+    return false;
+
+  if (m_mipmapped) {
+    glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+  }
+  m_displaySize = anari::math::int2(width, height);
+  m_lastFrameLinear = false;
+  m_shownCamera = m_renderCamera;
+  m_reprojector.setOrigins(nullptr, 0, 0); // cached without them
+  m_renderDirty = false;
+  m_frameCancelled = false;
+  // cached frames of accumulating renderers are final ones
+  m_accumulationDone = true;
+  m_idle = true;
+  markShown(m_oldestInput);
+  return true;
 }
 
-void DRRViewport::setPhotonEnergy(float energy)
+void DRRViewport::cacheShownFrame(uint64_t key, int width, int height)
 {
-  anari::setParameter(m_device, m_renderers[m_currentRenderer], "photonEnergy", ANARI_FLOAT32, &energy);
-  anari::commitParameters(m_device, m_renderers[m_currentRenderer]);
-  
-  m_viewChanged = true;
-  cancelFrame();
-  updateCamera(true);
-  startNewFrame();
-  updateImage();
+  if (!m_frameCache || !key || m_lastFrameLinear
+      || !(m_singleShot || m_accumulationDone))
+    return;
+  m_frameCache->putTexture(key, m_framebufferTexture, width, height);
 }
 
-bool DRRViewport::getFrame(std::vector<uint8_t>& color, std::vector<float>& depth3d, size_t& width, size_t& height)
+void DRRViewport::setInputEnabled(bool enabled)
 {
-    auto fb = anari::map<uint32_t>(m_device, m_frame, "channel.color");
-    auto db = anari::map<anari::math::float3>(m_device, m_frame, "channel.origin");
+  m_inputEnabled = enabled;
+}
 
-    if (fb.data && db.data) {
-      width = m_viewportSize.x;
-      height = m_viewportSize.y;
-      const auto fbDataU8 = reinterpret_cast<const uint8_t*>(fb.data);
-      const auto dbDataFloat = reinterpret_cast<const float*>(db.data);
-      color = std::vector<uint8_t>(fbDataU8, fbDataU8 + width * height * 4);
-      depth3d = std::vector<float>(dbDataFloat, dbDataFloat + width * height * 3);
-    } else {
-      printf("mapped bad frame: %p | %i x %i\n", fb.data, fb.width, fb.height);
-      return false;
-    }
+uint64_t DRRViewport::numCompletedFrames() const
+{
+  return m_numCompletedFrames;
+}
 
-    anari::unmap(m_device, m_frame, "channel.color");
-    anari::unmap(m_device, m_frame, "channel.origin");
-    return true;
+FrameStats::Frame DRRViewport::lastFrameStats() const
+{
+  return m_lastFrameStats;
 }
 
-void DRRViewport::reshape(anari::math::int2 newSize)
+void DRRViewport::setWorldVersionCallback(std::function<uint64_t()> version)
 {
-  if (newSize.x <= 0 || newSize.y <= 0)
-    return;
+  m_worldVersion = std::move(version);
+  m_seenWorldVersion = m_worldVersion ? m_worldVersion() : 0;
+}
 
-  m_viewportSize = newSize;
+void DRRViewport::requestRender()
+{
+  m_renderDirty = true;
+}
 
-  glViewport(0, 0, newSize.x, newSize.y);
+void DRRViewport::setFrameStreamer(FrameStreamer *streamer)
+{
+  m_streamer = streamer;
+}
 
-  glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
-  glTexImage2D(GL_TEXTURE_2D,
-      0,
-      GL_RGBA8,
-      newSize.x,
-      newSize.y,
-      0,
-      GL_RGBA,
-      GL_UNSIGNED_BYTE,
-      0);
+void DRRViewport::setGpuCounters(const GpuCounters *counters)
+{
+  m_gpuCounters = counters;
+}
 
-  m_camera.set_viewport(0, 0, newSize.x, newSize.y);
-  float fovy = m_camera.fovy();
-  float aspect = newSize.x / static_cast<float>(newSize.y);
-  float z_near = std::max(m_camera.z_near(), 1.f);
-  float z_far = std::min(m_camera.z_far(), FLT_MAX);
-  m_camera.perspective(fovy, aspect, z_near, z_far);
+void DRRViewport::setTaskScheduler(const TaskScheduler *scheduler)
+{
+  m_tasks = scheduler;
+}
 
-  updateFrame();
-  cancelFrame();
-  updateCamera(true);
-  startNewFrame();
-  updateImage();
+void DRRViewport::setDeviceArbiter(DeviceArbiter *arbiter)
+{
+  m_arbiter = arbiter;
 }
 
-void DRRViewport::startNewFrame()
+void DRRViewport::cameraFrustum(
+    float &fovy, float &aspect, ImageRoi &image) const
 {
-  anari::getProperty(
-      m_device, m_frame, "numSamples", m_frameSamples, ANARI_NO_WAIT);
-  anari::render(m_device, m_frame);
-  m_renderSize = m_viewportSize;
-  m_currentlyRendering = true;
-  m_frameCancelled = false;
+  fovy = m_fov * float(M_PI) / 180.f;
+  const auto size = frameSize();
+  aspect = size.x / float(size.y);
+  // the detector is part of a wider frustum when its principal point is
+  // off center
+  image = ImageRoi();
+  if (m_useDetector) {
+    float box[4];
+    m_detector.perspective(fovy, aspect, box);
+    image = ImageRoi{{box[0], box[1]}, {box[2], box[3]}};
+  }
 }
 
-void DRRViewport::updateFrame()
+RayCamera DRRViewport::rayCamera(float scale) const
 {
-  anari::setParameter(
-      m_device, m_frame, "size", anari::math::uint2(m_viewportSize));
-  anari::setParameter(
-      m_device, m_frame, "channel.color", ANARI_UFIXED8_RGBA_SRGB);
-  anari::setParameter(m_device, m_frame, "accumulation", true);
-  anari::setParameter(m_device, m_frame, "world", m_world);
-  anari::setParameter(m_device, m_frame, "camera", m_perspCamera);
-  anari::setParameter(
-      m_device, m_frame, "renderer", m_renderers[m_currentRenderer]);
+  const auto &eye = m_camera.eye();
+  const auto dir = visionaray::normalize(m_camera.center() - eye);
+  const auto &up = m_camera.up();
+  RayCamera camera{
+      {eye.x, eye.y, eye.z}, {dir.x, dir.y, dir.z}, {up.x, up.y, up.z}};
+  ImageRoi image;
+  cameraFrustum(camera.fovy, camera.aspect, image);
+  camera.region[0] = image.lower[0];
+  camera.region[1] = image.lower[1];
+  camera.region[2] = image.upper[0];
+  camera.region[3] = image.upper[1];
+  camera.width = std::max(1, int(frameSize().x * scale));
+  camera.height = std::max(1, int(frameSize().y * scale));
+  return camera;
+}
 
-  anari::commitParameters(m_device, m_frame);
+bool DRRViewport::idle() const
+{
+  return m_idle && !m_currentlyRendering;
 }
 
-void DRRViewport::updateCamera(bool force)
+bool DRRViewport::presentImage(const uint8_t *rgba, int width, int height)
 {
-  if (!force && !m_viewChanged)
-    return;
+  // frames in progress cover only the ROI, linear ones are windowed
+  if (!rgba || !m_cameraRegion.full() || m_lastFrameLinear || linearOutput()
+      || width > m_textureSize.x || height > m_textureSize.y)
+    return false;
 
+  TRACE_SCOPE("gl", "glTexSubImage2D");
+  glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
+  glTexSubImage2D(
+      GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+  if (m_mipmapped)
+    glGenerateMipmap(GL_TEXTURE_2D);
+  m_displaySize = anari::math::int2(width, height);
+  m_reprojector.setOrigins(nullptr, 0, 0);
+  return true;
+}
+
+RenderCamera DRRViewport::currentCamera() const
+{
   const auto& vEye = m_camera.eye();
   auto vDir = visionaray::normalize(m_camera.center() - vEye);
   const auto& vUp  = m_camera.up();
-  anari::math::float3 eye{vEye.x, vEye.y, vEye.z};
-  anari::math::float3 dir{vDir.x, vDir.y, vDir.z};
-  anari::math::float3 up{vUp.x, vUp.y, vUp.z};
-
-  anari::setParameter(m_device, m_perspCamera, "aspect", m_viewportSize.x / float(m_viewportSize.y));
-  anari::setParameter(m_device, m_perspCamera, "position", eye);
-  anari::setParameter(m_device, m_perspCamera, "direction", dir);
-  anari::setParameter(m_device, m_perspCamera, "up", up);
+  RenderCamera camera;
+  camera.position = anari::math::float3(vEye.x, vEye.y, vEye.z);
+  camera.direction = anari::math::float3(vDir.x, vDir.y, vDir.z);
+  camera.up = anari::math::float3(vUp.x, vUp.y, vUp.z);
+
+  ImageRoi image;
+  cameraFrustum(camera.fovy, camera.aspect, image);
+  // an ROI is part of the detector
+  const auto r = m_cameraRegion.within(image);
+  camera.region[0] = r.lower[0];
+  camera.region[1] = r.lower[1];
+  camera.region[2] = r.upper[0];
+  camera.region[3] = r.upper[1];
+  return camera;
+}
 
-  auto radians = [](float degrees) -> float { return degrees * M_PI / 180.f; };
-  anari::setParameter(m_device, m_perspCamera, "fovy", radians(m_fov));
+void DRRViewport::updateCamera(bool force)
+{
+  if (!force && !m_viewChanged)
+    return;
 
-  anari::commitParameters(m_device, m_perspCamera);
+  m_renderCamera = currentCamera();
+  // a running render thread applies it with the next request
+  if (!m_renderThread || m_renderThread->paused())
+    applyCamera(m_device, m_perspCamera, m_renderCamera, m_parameters);
 
   m_viewChanged = false;
   return;
@@ -327,56 +1810,437 @@ void DRRViewport::updateCamera(bool force)
 
 void DRRViewport::updateImage()
 {
-  if (m_frameCancelled)
-    anari::wait(m_device, m_frame);
-  else if (m_saveNextFrame
+  if (m_renderThread) {
+    updateThreadedImage();
+    return;
+  }
+
+  if (m_frameCancelled) {
+    // discarded frames end on their own; polled instead of waited for, the
+    // next frame starts once the device is done with this one
+    if (!anari::isReady(m_device, m_frame))
+      return;
+    m_currentlyRendering = false;
+  } else if (m_saveNextFrame
       || (m_currentlyRendering && anari::isReady(m_device, m_frame))) {
     m_currentlyRendering = false;
 
+    // With more than one frame in the ring, submit the next frame before
+    // reading this one back so the device renders during map + upload
+    anari::Frame finished = m_frame;
+    const size_t finishedIndex = m_frameIndex;
+    if (m_frames.size() > 1 && !m_saveNextFrame && needsFrame()) {
+      m_frameIndex = (m_frameIndex + 1) % m_frames.size();
+      m_frame = m_frames[m_frameIndex];
+      startNewFrame();
+    }
+
     float duration = 0.f;
-    anari::getProperty(m_device, m_frame, "duration", duration);
+    anari::getProperty(m_device, finished, "duration", duration);
 
-    m_latestFL = duration * 1000;
-    m_minFL = std::min(m_minFL, m_latestFL);
-    m_maxFL = std::max(m_maxFL, m_latestFL);
+    if (m_saveNextFrame || !showGLFrame(finished, finishedIndex, duration))
+      showMappedFrame(finished, finishedIndex, duration);
+  }
 
-    auto fb = anari::map<uint32_t>(m_device, m_frame, "channel.color");
+  if (m_frameCancelled || (!m_currentlyRendering && needsFrame())) {
+    if (!showCachedFrame())
+      startNewFrame();
+  } else if (!m_currentlyRendering) {
+    m_idle = true;
+  }
+}
 
-    if (fb.data) {
-      glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
-      glTexSubImage2D(GL_TEXTURE_2D,
-          0,
-          0,
-          0,
-          fb.width,
-          fb.height,
-          GL_RGBA,
-          GL_UNSIGNED_BYTE,
-          fb.data);
-    } else {
-      printf("mapped bad frame: %p | %i x %i\n", fb.data, fb.width, fb.height);
+void DRRViewport::showMappedFrame(
+    anari::Frame frame, size_t frameIndex, float duration)
+{
+  const auto mapStart = std::chrono::steady_clock::now();
+  auto fb = [&]() {
+    TRACE_SCOPE("anari", "map");
+    return anari_calls::map<uint32_t>(m_device, frame, "channel.color");
+  }();
+  const float mapTime = std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - mapStart)
+                            .count();
+  showFrame(fb.data,
+      int(fb.width),
+      int(fb.height),
+      fb.data && fb.pixelType == ANARI_FLOAT32,
+      duration * 1000,
+      mapTime,
+      m_saveNextFrame);
+  m_saveNextFrame = false;
+  if (fb.data && frameIndex < m_frameKeys.size()) {
+    cacheShownFrame(m_frameKeys[frameIndex], int(fb.width), int(fb.height));
+    markShown(m_frameInputs[frameIndex]);
+    keepOrigins(frame, frameIndex, int(fb.width), int(fb.height));
+  }
+
+  TRACE_SCOPE("anari", "unmap");
+  anari::unmap(m_device, frame, "channel.color");
+}
+
+bool DRRViewport::showGLFrame(
+    anari::Frame frame, size_t frameIndex, float duration)
+{
+  // linear frames are windowed from host values, accumulating ones checked
+  // for convergence and streamed ones encoded on the host
+  const bool linear = frameIndex < m_frameChannels.size()
+      && (m_frameChannels[frameIndex] & ChannelLinear);
+  if (!m_glFramesSupported || !m_glFrames || linear || m_streamer
+      || !(m_singleShot || m_accumulationDone))
+    return false;
+
+  const auto mapStart = std::chrono::steady_clock::now();
+  auto fb = [&]() {
+    TRACE_SCOPE("anari", "map GL");
+    return anari_calls::map<uint32_t>(m_device, frame, "channel.colorGL");
+  }();
+  const float mapTime = std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - mapStart)
+                            .count();
+  const GLuint texture = fb.data ? GLuint(fb.data[0]) : 0;
+  const int width = int(fb.width), height = int(fb.height);
+  const bool shown =
+      texture && width > 0 && height > 0 && glIsTexture(texture);
+  if (shown) {
+    showFrame(nullptr,
+        width,
+        height,
+        false,
+        duration * 1000,
+        mapTime,
+        false,
+        texture);
+    if (frameIndex < m_frameKeys.size()) {
+      cacheShownFrame(m_frameKeys[frameIndex], width, height);
+      markShown(m_frameInputs[frameIndex]);
+      keepOrigins(frame, frameIndex, width, height);
     }
+  } else {
+    m_glFrames = false; // uploaded from host memory from now on
+  }
+  anari::unmap(m_device, frame, "channel.colorGL");
+  return shown;
+}
 
-    if (m_saveNextFrame) {
-      std::string filename =
-          "screenshot" + std::to_string(m_screenshotIndex++) + ".png";
-      stbi_write_png(
-          filename.c_str(), fb.width, fb.height, 4, fb.data, 4 * fb.width);
-      printf("frame saved to '%s'\n", filename.c_str());
+void DRRViewport::keepOrigins(
+    anari::Frame frame, size_t frameIndex, int width, int height)
+{
+  m_shownCamera = m_frameCameras[frameIndex];
+  if (!m_reprojection || !(m_frameChannels[frameIndex] & ChannelOrigin)) {
+    m_reprojector.setOrigins(nullptr, 0, 0);
+    return;
+  }
+  auto db = anari_calls::map<anari::math::float3>(
+      m_device, frame, "channel.origin");
+  const bool fits = int(db.width) == width && int(db.height) == height;
+  m_reprojector.setOrigins(fits ? reinterpret_cast<const float *>(db.data)
+                                : nullptr,
+      width,
+      height);
+  anari::unmap(m_device, frame, "channel.origin");
+}
+
+void DRRViewport::copyGLFrame(GLuint source, int width, int height)
+{
+  TRACE_SCOPE("gl", "copy GL frame");
+  if (!m_glFrameFramebuffer)
+    glGenFramebuffers(1, &m_glFrameFramebuffer);
+
+  GLint framebuffer = 0;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &framebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_glFrameFramebuffer);
+  glFramebufferTexture2D(
+      GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, 0);
+  glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
+  glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+}
+
+void DRRViewport::noteInput()
+{
+  if (m_oldestInput == decltype(m_oldestInput)())
+    m_oldestInput = std::chrono::steady_clock::now();
+}
+
+void DRRViewport::markShown(std::chrono::steady_clock::time_point input)
+{
+  // frames started before the input, or after an earlier frame showed it,
+  // don't count
+  if (input == decltype(input)() || input != m_oldestInput)
+    return;
+  m_shownInput = input;
+  m_oldestInput = {};
+}
+
+void DRRViewport::measureInputLatency()
+{
+  if (m_shownInput == decltype(m_shownInput)())
+    return;
+  m_frameStats.pushInput(std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - m_shownInput)
+                             .count());
+  m_shownInput = {};
+}
+
+void DRRViewport::updateThreadedImage()
+{
+  if (m_renderThread->acquire()) {
+    const auto &frame = m_renderThread->frame();
+    m_frameSamples = frame.samples;
+    const bool save = m_saveNextFrame && frame.keep;
+    showFrame(frame.color.data(),
+        frame.width,
+        frame.height,
+        frame.linear,
+        frame.duration,
+        frame.map,
+        save);
+    if (save) {
       m_saveNextFrame = false;
+      m_saveRequested = false;
     }
+    cacheShownFrame(frame.cacheKey, frame.width, frame.height);
+    markShown(frame.input);
+    m_shownCamera = frame.camera;
+    m_reprojector.setOrigins(m_reprojection && !frame.origin.empty()
+            ? frame.origin.data()
+            : nullptr,
+        frame.width,
+        frame.height);
+  }
 
-    anari::unmap(m_device, m_frame, "channel.color");
+  // requests up to the ring size are in flight at a time; the thread
+  // renders the latest one pushed, and edits discard what it has
+  const size_t outstanding = m_renderThread->outstanding();
+  m_currentlyRendering = outstanding > 0;
+  if (!m_currentlyRendering)
+    m_saveRequested = false; // its frame was lost: request it again
+  if (m_frameCancelled || (m_saveNextFrame && !m_saveRequested)
+      || (needsFrame() && outstanding < m_frames.size())) {
+    if (outstanding > 0 || !showCachedFrame())
+      startNewFrame();
+  } else if (!m_currentlyRendering) {
+    m_idle = true;
+  }
+}
+
+void DRRViewport::showFrame(const void *data,
+    int width,
+    int height,
+    bool linear,
+    float duration,
+    float mapTime,
+    bool save,
+    GLuint texture)
+{
+  auto now = std::chrono::steady_clock::now();
+  float sinceLast =
+      std::chrono::duration<float>(now - m_lastFrameCompleted).count();
+  m_lastFrameCompleted = now;
+  if (sinceLast > 0.f)
+    m_framesPerSecond = 0.9f * m_framesPerSecond + 0.1f / sinceLast;
+
+  m_latestFL = duration;
+  m_minFL = std::min(m_minFL, m_latestFL);
+  m_maxFL = std::max(m_maxFL, m_latestFL);
+
+  if (m_adaptiveResolution && isInteracting())
+    adaptResolution(m_latestFL);
+  else if (m_frameBudget)
+    recordFrameTime(m_latestFL);
+
+  auto ms = [](std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - begin)
+        .count();
+  };
+  FrameStats::Frame stats;
+  stats.duration = m_latestFL;
+  stats.interval = sinceLast * 1000.f;
+  stats.map = mapTime;
+  // linear frames: one float per pixel instead of RGBA8
+  const auto *pixels = static_cast<const uint32_t *>(data);
+  const auto *values = static_cast<const float *>(data);
+  const size_t numPixels = size_t(width) * height;
+  if (linear) {
+    m_displaySize = anari::math::int2(width, height);
+    updateAccumulation(values, width, height);
+  } else if (data) {
+    m_displaySize = anari::math::int2(width, height);
+    updateAccumulation(pixels, width, height);
+    if (m_streamer)
+      m_streamer->submit(pixels, width, height);
+  } else if (texture) {
+    m_displaySize = anari::math::int2(width, height);
+  }
+  m_lastFrameLinear = linear;
+
+  const auto uploadStart = std::chrono::steady_clock::now();
+
+  // linear frames go to their own texture, which the tone mapper windows
+  // into the display texture
+  if (linear)
+    resizeLinearTexture(true);
+  const GLuint target = linear ? m_linearTexture : m_framebufferTexture;
+  const GLenum format = linear ? GL_RED : GL_RGBA;
+  const GLenum type = linear ? GL_FLOAT : GL_UNSIGNED_BYTE;
+  if (texture) {
+    copyGLFrame(texture, width, height);
+  } else if (data && m_usePixelBuffers) {
+    m_uploader.upload(target, width, height, data, format, type);
+  } else if (data) {
+    TRACE_SCOPE("gl", "glTexSubImage2D");
+    glBindTexture(GL_TEXTURE_2D, target);
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, data);
+  } else {
+    printf("mapped bad frame: %p | %i x %i\n", pixels, width, height);
+  }
+  // the frame is histogrammed and windowed where it was uploaded; on the
+  // CPU where the GPU cannot, and for frames leaving the viewport, which
+  // are windowed on the CPU as well
+  GLuint windowTexture = 0;
+  if (linear) {
+    const bool streamed = m_streamer && m_streamer->watched();
+    if (m_histogram.compute(m_linearTexture,
+            width,
+            height,
+            m_autoWindowPercentiles[0],
+            m_autoWindowPercentiles[1])
+        && !save && !streamed) {
+      windowTexture = m_autoWindow ? m_histogram.windowTexture() : 0;
+    } else {
+      takeHistogram(FrameHistogram::of(values,
+          numPixels,
+          m_autoWindowPercentiles[0],
+          m_autoWindowPercentiles[1]));
+    }
+    if (streamed)
+      m_streamer->submit(displayPixels(values, width, height), width, height);
+  }
+  if (linear
+      && !m_toneMapper.apply(m_linearTexture,
+          m_framebufferTexture,
+          width,
+          height,
+          m_displayWindow,
+          windowTexture)) {
+    // no shaders: window on the CPU instead
+    glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
+    glTexSubImage2D(GL_TEXTURE_2D,
+        0,
+        0,
+        0,
+        width,
+        height,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        displayPixels(values, width, height));
+  }
+  if ((data || texture) && m_mipmapped) {
+    TRACE_SCOPE("gl", "glGenerateMipmap");
+    glBindTexture(GL_TEXTURE_2D, m_framebufferTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
   }
+  stats.upload = ms(uploadStart);
+  stats.width = width;
+  stats.height = height;
+  m_frameStats.push(stats);
+  m_lastFrameStats = stats;
+  ++m_numCompletedFrames;
+
+  if (save && data) {
+    // copied out so the frame can be unmapped right away; encoding runs on
+    // the writer's thread. Linear frames keep their values for the float
+    // formats and are windowed as shown for PNG.
+    ExportImage image;
+    image.width = width;
+    image.height = height;
+    const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+    if (linear) {
+      image.values.assign(values, values + numPixels);
+      bytes = reinterpret_cast<const uint8_t *>(
+          displayPixels(values, width, height));
+    }
+    image.rgba.assign(bytes, bytes + numPixels * 4);
+    std::string filename = "screenshot" + std::to_string(m_screenshotIndex++)
+        + imageExtension(m_screenshotFormat);
+    m_imageWriter.write(filename, m_screenshotFormat, std::move(image));
+    printf("saving frame to '%s'\n", filename.c_str());
+  }
+}
+
+bool DRRViewport::needsFrame() const
+{
+  return m_renderDirty || m_continuousRendering
+      || (!m_singleShot && !m_accumulationDone);
+}
+
+void DRRViewport::updateAccumulation(
+    const uint32_t *rgba, int width, int height)
+{
+  if (m_singleShot || m_accumulationDone)
+    return;
+  const bool converged =
+      m_convergence.push(rgba, width, height) && m_checkConvergence;
+  // numSamples where the device reports it, completed frames otherwise
+  const int samples = std::max(m_frameSamples, m_convergence.frames());
+  m_accumulationDone =
+      converged || (m_maxSamples > 0 && samples >= m_maxSamples);
+}
+
+void DRRViewport::updateAccumulation(
+    const float *values, int width, int height)
+{
+  if (m_singleShot || m_accumulationDone)
+    return;
+  // tolerance in 8-bit steps of the display window
+  const float extent =
+      std::max(m_displayWindow.upper - m_displayWindow.lower, 1e-12f);
+  const bool converged =
+      m_convergence.push(values, width, height, 255.f / extent)
+      && m_checkConvergence;
+  const int samples = std::max(m_frameSamples, m_convergence.frames());
+  m_accumulationDone =
+      converged || (m_maxSamples > 0 && samples >= m_maxSamples);
+}
+
+const uint32_t *DRRViewport::displayPixels(
+    const float *values, int width, int height)
+{
+  m_displayPixels.resize(size_t(width) * height);
+  ToneMapper::map(
+      values, m_displayPixels.size(), m_displayWindow, m_displayPixels.data());
+  return m_displayPixels.data();
+}
+
+void DRRViewport::takeHistogram(FrameHistogram::Result histogram)
+{
+  m_frameHistogram = std::move(histogram);
+  m_frameWindow = m_frameHistogram.range;
+  if (m_autoWindow)
+    m_displayWindow = m_frameHistogram.window;
+}
 
-  if (!m_currentlyRendering || m_frameCancelled)
-    startNewFrame();
+// Parameter and camera edits: the frame in flight is discarded without
+// waiting and a new one is started from buildUI(); edits arriving before
+// then share the restart
+void DRRViewport::restartFrame()
+{
+  m_renderDirty = true;
+  if (m_currentlyRendering && !m_frameCancelled)
+    cancelFrame();
 }
 
 void DRRViewport::cancelFrame()
 {
   m_frameCancelled = true;
-  anari::discard(m_device, m_frame);
+  // the render thread discards its frames when the next request says so
+  if (m_renderThread && !m_renderThread->paused())
+    return;
+  for (auto &f : m_frames)
+    anari::discard(m_device, f);
 }
 
 void DRRViewport::handleMouseDownEvent(visionaray::mouse_event const& event)
@@ -397,10 +2261,69 @@ void DRRViewport::handleMouseMoveEvent(visionaray::mouse_event const& event)
     manip->handle_mouse_move(event);
 }
 
+bool DRRViewport::ui_roiInput()
+{
+  ImGuiIO &io = ImGui::GetIO();
+  const ImVec2 extent(m_imageMax.x - m_imageMin.x, m_imageMax.y - m_imageMin.y);
+  if (extent.x <= 0.f || extent.y <= 0.f)
+    return false;
+
+  if (!m_drawingRoi) {
+    if (!io.KeysDown[GLFW_KEY_LEFT_CONTROL]
+        || !ImGui::IsMouseClicked(ImGuiMouseButton_Left)
+        || !ImGui::IsMouseHoveringRect(m_imageMin, m_imageMax))
+      return false;
+    m_drawingRoi = true;
+  }
+
+  // the frame is shown mirrored in x with row 0 at the top
+  const float uv[2] = {
+      std::clamp(1.f - (io.MousePos.x - m_imageMin.x) / extent.x, 0.f, 1.f),
+      std::clamp((io.MousePos.y - m_imageMin.y) / extent.y, 0.f, 1.f)};
+  if (ImGui::IsMouseClicked(ImGuiMouseButton_Left))
+    std::copy_n(uv, 2, m_roiStart);
+  m_roiDraft = ImageRoi::fromCorners(m_roiStart, uv);
+
+  if (!ImGui::IsMouseDown(ImGuiMouseButton_Left)) {
+    // a click without a drag clears the ROI
+    m_drawingRoi = false;
+    const float minExtent = 4.f / std::min(extent.x, extent.y);
+    const auto &d = m_roiDraft;
+    if (d.upper[0] - d.lower[0] < minExtent
+        || d.upper[1] - d.lower[1] < minExtent)
+      m_roi = ImageRoi();
+    else
+      m_roi = d;
+    if (m_roiChanged)
+      m_roiChanged(m_roi);
+  }
+  return true;
+}
+
+void DRRViewport::ui_roi()
+{
+  if (!m_drawingRoi && m_roi.full())
+    return;
+
+  const auto &roi = m_drawingRoi ? m_roiDraft : m_roi;
+  const float w = m_imageMax.x - m_imageMin.x;
+  const float h = m_imageMax.y - m_imageMin.y;
+  const ImVec2 a(m_imageMin.x + (1.f - roi.upper[0]) * w,
+      m_imageMin.y + roi.lower[1] * h);
+  const ImVec2 b(m_imageMin.x + (1.f - roi.lower[0]) * w,
+      m_imageMin.y + roi.upper[1] * h);
+  const ImU32 color =
+      m_drawingRoi ? IM_COL32(255, 255, 0, 255) : IM_COL32(0, 255, 0, 255);
+  ImGui::GetWindowDrawList()->AddRect(a, b, color);
+}
+
 void DRRViewport::ui_handleInput()
 {
   ImGuiIO &io = ImGui::GetIO();
 
+  if (ui_roiInput())
+    return;
+
   const bool dolly = ImGui::IsMouseDown(ImGuiMouseButton_Right)
       || (ImGui::IsMouseDown(ImGuiMouseButton_Left)
           && io.KeysDown[GLFW_KEY_LEFT_SHIFT]);
@@ -420,6 +2343,19 @@ void DRRViewport::ui_handleInput()
       static_cast<int>(m_viewportSize.x - position.x + windowOffset.x),
       static_cast<int>(-position.y + windowOffset.y)};
 
+  // manipulators see at most one move per UI frame, and none while the
+  // mouse rests; they accumulate the deltas until the next frame starts
+  const bool moved =
+      mousePos.x != m_lastMousePos.x || mousePos.y != m_lastMousePos.y;
+  m_lastMousePos = mousePos;
+  auto move = [&]() {
+    if (!moved)
+      return;
+    handleMouseMoveEvent(visionaray::mouse_event(visionaray::mouse::Move, mousePos, m_button, visionaray::keyboard::NoKey));
+    m_viewChanged = true;
+    noteInput();
+  };
+
   // map buttons/keys
   auto button = visionaray::mouse::button::NoButton;
   auto modifier = visionaray::keyboard::key::NoKey;
@@ -453,8 +2389,7 @@ void DRRViewport::ui_handleInput()
   if (dolly) {
     if (m_dolly) {
       //mouse move
-      handleMouseMoveEvent(visionaray::mouse_event(visionaray::mouse::Move, mousePos, m_button, visionaray::keyboard::NoKey));
-      m_viewChanged = true;
+      move();
     } else {
       //onMouseDown
       handleMouseDownEvent(visionaray::mouse_event(visionaray::mouse::ButtonDown, mousePos, button, modifier));
@@ -475,8 +2410,7 @@ void DRRViewport::ui_handleInput()
   if (pan) {
     if (m_pan) {
       //mouse move
-      handleMouseMoveEvent(visionaray::mouse_event(visionaray::mouse::Move, mousePos, m_button, visionaray::keyboard::NoKey));
-      m_viewChanged = true;
+      move();
     } else {
       //onMouseDown
       handleMouseDownEvent(visionaray::mouse_event(visionaray::mouse::ButtonDown, mousePos, button, modifier));
@@ -497,8 +2431,7 @@ void DRRViewport::ui_handleInput()
   if (orbit) {
     if (m_orbit) {
       //mouse move
-      handleMouseMoveEvent(visionaray::mouse_event(visionaray::mouse::Move, mousePos, m_button, visionaray::keyboard::NoKey));
-      m_viewChanged = true;
+      move();
     } else {
       //onMouseDown
       handleMouseDownEvent(visionaray::mouse_event(visionaray::mouse::ButtonDown, mousePos, button, modifier));
@@ -532,15 +2465,10 @@ void DRRViewport::ui_contextMenu()
     ImGui::Text("Renderer:");
     ImGui::Indent(INDENT_AMOUNT);
 
-    if (m_renderers.size() > 1 && ImGui::BeginMenu("subtype")) {
+    if (m_rendererNames.size() > 1 && ImGui::BeginMenu("subtype")) {
       for (int i = 0; i < m_rendererNames.size(); i++) {
         const auto& rendererName = m_rendererNames[i];
-        if (ImGui::MenuItem(rendererName.c_str())) {
-          if ((rendererName == "DRR") || (rendererName == "drr") || (rendererName == "default"))
-            m_singleShot = true;
-          else
-            m_singleShot = false;
-          m_currentRenderer = i;
+        if (ImGui::MenuItem(rendererName.c_str()) && selectRenderer(i)) {
           updateFrame();
           cancelFrame();
           startNewFrame();
@@ -550,11 +2478,17 @@ void DRRViewport::ui_contextMenu()
       ImGui::EndMenu();
     }
 
-    if (!m_rendererParameters.empty() && ImGui::BeginMenu("parameters")) {
+    if (!m_rendererParameters[m_currentRenderer].empty()
+        && ImGui::BeginMenu("parameters")) {
       auto &parameters = m_rendererParameters[m_currentRenderer];
       auto renderer = m_renderers[m_currentRenderer];
-      for (auto &p : parameters)
+      for (auto &p : parameters) {
         anari_viewer::ui::buildUI(m_device, renderer, p);
+        if (ImGui::IsItemEdited()) {
+          ++m_rendererVersion;
+          restartFrame();
+        }
+      }
       ImGui::EndMenu();
     }
 
@@ -564,12 +2498,14 @@ void DRRViewport::ui_contextMenu()
     ImGui::Text("Camera:");
     ImGui::Indent(INDENT_AMOUNT);
 
-    if (ImGui::SliderFloat("fov", &m_fov, 0.1f, 180.f)) {
-      updateCamera(true);
-      cancelFrame();
-      startNewFrame();
-      updateImage();
-    }
+    ImGui::BeginDisabled(!m_detector.valid());
+    if (ImGui::Checkbox("detector camera", &m_useDetector))
+      resolutionChanged();
+    ImGui::EndDisabled();
+
+    ImGui::BeginDisabled(m_useDetector);
+    if (ImGui::SliderFloat("fov", &m_fov, 0.1f, 180.f))
+      setFovy(m_fov * float(M_PI) / 180.f);
 
     ImGui::EndDisabled();
 
@@ -581,6 +2517,14 @@ void DRRViewport::ui_contextMenu()
     if (ImGui::MenuItem("reset view"))
       resetView();
 
+    ImGui::BeginDisabled(m_roi.full());
+    if (ImGui::MenuItem("clear matching ROI")) {
+      m_roi = ImageRoi();
+      if (m_roiChanged)
+        m_roiChanged(m_roi);
+    }
+    ImGui::EndDisabled();
+
     ImGui::Unindent(INDENT_AMOUNT);
     ImGui::Separator();
 
@@ -591,10 +2535,152 @@ void DRRViewport::ui_contextMenu()
     if (ImGui::MenuItem("reset stats")) {
       m_minFL = m_latestFL;
       m_maxFL = m_latestFL;
+      m_frameStats.clear();
+      m_numUiFrames = 0;
+      m_numIdleUiFrames = 0;
+    }
+    if (ImGui::MenuItem("export frame times")) {
+      std::string filename =
+          "frametimes" + std::to_string(m_frameStatsIndex++) + ".csv";
+      if (m_frameStats.writeCsv(filename))
+        printf("frame times saved to '%s'\n", filename.c_str());
+      else
+        printf("could not write '%s'\n", filename.c_str());
     }
 
     if (ImGui::MenuItem("take screenshot"))
       m_saveNextFrame = true;
+    int format = int(m_screenshotFormat);
+    if (ImGui::Combo("screenshot format",
+            &format,
+            "PNG\0TIFF 16-bit\0TIFF float\0EXR\0\0"))
+      m_screenshotFormat = ImageFormat(format);
+
+    bool linear = linearOutput();
+    if (ImGui::Checkbox("linear output (float)", &linear))
+      setLinearOutput(linear);
+    if (linear) {
+      if (ImGui::Checkbox("auto display window", &m_autoWindow)
+          && m_autoWindow) {
+        m_displayWindow = m_frameHistogram.window;
+        m_windowChanged = true;
+      }
+      if (ImGui::DragFloatRange2("auto window percentiles",
+              &m_autoWindowPercentiles[0],
+              &m_autoWindowPercentiles[1],
+              0.1f,
+              0.f,
+              100.f,
+              "%.1f",
+              "%.1f")) {
+        m_windowChanged = true;
+      }
+      ImGui::BeginDisabled(m_autoWindow);
+      if (ImGui::Button("fit display window")) {
+        m_displayWindow = m_frameHistogram.window;
+        m_windowChanged = true;
+      }
+      const float speed = std::max(
+          m_frameWindow.upper - m_frameWindow.lower, 1e-6f) / 1000.f;
+      m_windowChanged |= ImGui::DragFloatRange2("display window",
+          &m_displayWindow.lower,
+          &m_displayWindow.upper,
+          speed,
+          0.f,
+          0.f,
+          "Min: %.5g",
+          "Max: %.5g");
+      ImGui::EndDisabled();
+    }
+
+    ImGui::BeginDisabled(!m_overlaySource);
+    ImGui::Combo("reference overlay",
+        &m_overlay.mode,
+        "none\0blend\0checkerboard\0edges\0difference\0\0");
+    if (m_overlay.mode == OverlaySettings::Blend
+        || m_overlay.mode == OverlaySettings::Edges)
+      ImGui::SliderFloat("overlay opacity", &m_overlay.opacity, 0.f, 1.f);
+    if (m_overlay.mode == OverlaySettings::Checkerboard)
+      ImGui::SliderInt("checker size", &m_overlay.checkerSize, 4, 256);
+    if (m_overlay.mode == OverlaySettings::Edges
+        || m_overlay.mode == OverlaySettings::Difference)
+      ImGui::SliderFloat("overlay gain", &m_overlay.gain, 1.f, 16.f, "%.1f");
+    ImGui::EndDisabled();
+
+    ImGui::Combo("edge enhancement",
+        &m_edgeDisplay.mode,
+        "none\0Sobel\0LoG pyramid\0\0");
+    if (m_edgeDisplay.mode == EdgeSettings::LoG)
+      ImGui::SliderInt("edge level", &m_edgeDisplay.level, 0, 6);
+    if (m_edgeDisplay.mode != EdgeSettings::None)
+      ImGui::SliderFloat("edge gain", &m_edgeDisplay.gain, 1.f, 16.f, "%.1f");
+
+    ImGui::Checkbox("upload via pixel buffers", &m_usePixelBuffers);
+    if (m_glFramesSupported)
+      ImGui::Checkbox("show device GL frames", &m_glFrames);
+    ImGui::Checkbox("render continuously", &m_continuousRendering);
+    if (!m_singleShot) {
+      // accumulating renderers; a new limit or check resumes accumulation
+      bool changed = ImGui::SliderInt("max samples", &m_maxSamples, 0, 4096);
+      changed |= ImGui::Checkbox("stop when converged", &m_checkConvergence);
+      if (m_checkConvergence) {
+        changed |= ImGui::SliderFloat("convergence tolerance",
+            &m_convergence.tolerance,
+            0.05f,
+            4.f,
+            "%.2f");
+      }
+      if (changed)
+        m_accumulationDone = false;
+    }
+
+    // applied when the edit is done, each resize reallocates the frames
+    ImGui::BeginDisabled(m_useDetector);
+    int sizeMode = m_fixedRenderSize ? 1 : 0;
+    if (ImGui::Combo("render size", &sizeMode, "viewport x scale\0fixed\0\0")) {
+      m_fixedRenderSize = sizeMode == 1;
+      resolutionChanged();
+    }
+    // the widgets edit copies: frames and texture are resized together
+    if (m_fixedRenderSize) {
+      int size[2] = {m_renderSizeEdit.x, m_renderSizeEdit.y};
+      if (ImGui::InputInt2("pixels", size)) {
+        m_renderSizeEdit.x = std::max(16, std::min(size[0], 16384));
+        m_renderSizeEdit.y = std::max(16, std::min(size[1], 16384));
+      }
+      if (ImGui::IsItemDeactivatedAfterEdit())
+        setFixedRenderSize(m_renderSizeEdit);
+      else if (!ImGui::IsItemActive())
+        m_renderSizeEdit = m_renderSizeSetting;
+    } else {
+      ImGui::SliderFloat(
+          "render scale", &m_renderScaleEdit, 0.25f, 4.f, "%.2fx");
+      if (ImGui::IsItemDeactivatedAfterEdit())
+        setRenderScale(m_renderScaleEdit);
+      else if (!ImGui::IsItemActive())
+        m_renderScaleEdit = m_renderScale;
+    }
+    ImGui::EndDisabled();
+
+    ImGui::Checkbox("adaptive resolution", &m_adaptiveResolution);
+    ImGui::BeginDisabled(m_qualityKnobs.empty());
+    if (ImGui::Checkbox("frame time budget", &m_frameBudget))
+      m_frameTimeCount = 0;
+    ImGui::EndDisabled();
+    if (m_adaptiveResolution || m_frameBudget) {
+      ImGui::SliderFloat(
+          "target frame time", &m_targetFrameTime, 5.f, 100.f, "%.0fms");
+    }
+
+    int framesInFlight = m_framesInFlight;
+    if (ImGui::SliderInt("frames in flight", &framesInFlight, 1, 3))
+      setFramesInFlight(framesInFlight);
+    bool renderThread = renderThreadEnabled();
+    if (ImGui::Checkbox("render thread", &renderThread))
+      setRenderThread(renderThread);
+    bool reprojection = m_reprojection;
+    if (ImGui::Checkbox("reproject while moving", &reprojection))
+      setReprojection(reprojection);
 
     ImGui::Unindent(INDENT_AMOUNT);
     ImGui::Separator();
@@ -648,7 +2734,54 @@ void DRRViewport::ui_overlay()
   ImGui::Begin(m_overlayWindowName.c_str(), nullptr, window_flags);
 
   ImGui::Text("viewport: %i x %i", m_viewportSize.x, m_viewportSize.y);
+  if (m_useDetector) {
+    ImGui::Text("detector: %i x %i, f (%.1f, %.1f), c (%.1f, %.1f)",
+        m_detector.width,
+        m_detector.height,
+        m_detector.fx,
+        m_detector.fy,
+        m_detector.cx,
+        m_detector.cy);
+  }
+  if (m_displaySize != m_viewportSize)
+    ImGui::Text("  render: %i x %i", m_displaySize.x, m_displaySize.y);
+  if (m_lastFrameLinear) {
+    ImGui::Text("  linear: [%.5g, %.5g] shown as [%.5g, %.5g]",
+        m_frameWindow.lower,
+        m_frameWindow.upper,
+        m_displayWindow.lower,
+        m_displayWindow.upper);
+    if (!m_frameHistogram.bins.empty()) {
+      ImGui::PlotHistogram("##linear histogram",
+          m_frameHistogram.bins.data(),
+          int(m_frameHistogram.bins.size()),
+          0,
+          nullptr,
+          0.f,
+          FLT_MAX,
+          ImVec2(0.f, 40.f));
+    }
+  }
+  if (!m_roi.full()) {
+    int offset[2], size[2];
+    m_roi.pixels(frameSize().x, frameSize().y, offset, size);
+    ImGui::Text("     ROI: %i x %i at (%i, %i)",
+        size[0],
+        size[1],
+        offset[0],
+        offset[1]);
+  }
   ImGui::Text(" samples: %i", m_frameSamples);
+  if (!m_singleShot) {
+    if (!m_accumulationDone)
+      ImGui::Text("  accumulating: %i frames, max tile change %.2f",
+          m_convergence.frames(),
+          m_convergence.maxTileChange());
+    else if (m_checkConvergence && m_convergence.converged())
+      ImGui::Text("  converged after %i frames", m_convergence.frames());
+    else
+      ImGui::Text("  sample limit reached (%i)", m_maxSamples);
+  }
 
   if (m_currentlyRendering)
     ImGui::Text(" latency: %.2fms", m_latestFL);
@@ -657,6 +2790,126 @@ void DRRViewport::ui_overlay()
 
   ImGui::Text("   (min): %.2fms", m_minFL);
   ImGui::Text("   (max): %.2fms", m_maxFL);
+  // queueing, map, upload and vsync included, unlike the latency above
+  if (m_frameStats.numInputs() > 0) {
+    ImGui::Text("   input: %.1f / %.1f / %.1fms to display (p50/95/99)",
+        m_frameStats.inputPercentile(0.5f),
+        m_frameStats.inputPercentile(0.95f),
+        m_frameStats.inputPercentile(0.99f));
+  }
+  ImGui::Text("     fps: %.1f (%i in flight%s)",
+      m_framesPerSecond,
+      m_framesInFlight,
+      m_renderThread ? ", render thread" : "");
+  // busy GPU: GPU-bound; busy PCIe: transfer-bound; neither: the UI thread
+  if (m_gpuCounters && m_gpuCounters->available()) {
+    const auto gpu = m_gpuCounters->latest();
+    if (gpu.utilization >= 0) {
+      ImGui::Text("     gpu: %i%% busy, %.0f / %.0f MiB",
+          gpu.utilization,
+          toMiB(gpu.memoryUsed),
+          toMiB(gpu.memoryTotal));
+    }
+    if (gpu.graphicsClock >= 0) {
+      ImGui::Text("  clocks: %i / %i MHz (core / memory)",
+          gpu.graphicsClock,
+          gpu.memoryClock);
+    }
+    if (gpu.pcieRx >= 0) {
+      ImGui::Text("    pcie: %.1f / %.1f MiB/s (in / out)",
+          gpu.pcieRx / 1024.f,
+          gpu.pcieTx / 1024.f);
+    }
+  }
+  if (m_streamer && m_streamer->watched()) {
+    ImGui::Text("  stream: q%i 1/%i, %.0f kbit/s",
+        m_streamer->quality(),
+        m_streamer->scale(),
+        m_streamer->kbps());
+  }
+  if (m_tasks) {
+    ImGui::Text("   tasks: %zu match, %zu prefetch, %zu thumbnail, "
+                "%zu background queued, %zu/%zu running",
+        m_tasks->queued(TaskPriority::Interactive),
+        m_tasks->queued(TaskPriority::Prefetch),
+        m_tasks->queued(TaskPriority::Thumbnail),
+        m_tasks->queued(TaskPriority::Background),
+        m_tasks->running(),
+        m_tasks->numThreads());
+  }
+  if (m_arbiter && m_arbiter->yields() > 0) {
+    ImGui::Text("   batch: %llu waits for interactive frames",
+        (unsigned long long)m_arbiter->yields());
+  }
+  if (m_numUiFrames > 0) {
+    ImGui::Text("    idle: %.1f%% of UI frames%s",
+        100.0 * m_numIdleUiFrames / m_numUiFrames,
+        m_idle ? " (idle now)" : "");
+  }
+  if (m_frameCache) {
+    ImGui::Text("   cache: %zu hits, %zu frames, %zu textures",
+        m_frameCache->hits(),
+        m_frameCache->numFrames(),
+        m_frameCache->numTextures());
+  }
+
+  const auto calls = anari_calls::totals();
+  if (calls.skipped[anari_calls::Commit] > 0) {
+    ImGui::Text("unchanged: %llu commits, %llu sets skipped",
+        (unsigned long long)calls.skipped[anari_calls::Commit],
+        (unsigned long long)calls.skipped[anari_calls::SetParameter]);
+  }
+  if (anari_calls::enabled()) {
+    const auto last = anari_calls::lastFrame();
+    const auto peak = anari_calls::peak();
+    ImGui::Text("   anari: %llu set, %llu commit, %llu render, %llu map",
+        (unsigned long long)last.calls[anari_calls::SetParameter],
+        (unsigned long long)last.calls[anari_calls::Commit],
+        (unsigned long long)last.calls[anari_calls::Render],
+        (unsigned long long)last.calls[anari_calls::Map]);
+    ImGui::Text("    peak: %llu set, %llu commit in one frame",
+        (unsigned long long)peak.calls[anari_calls::SetParameter],
+        (unsigned long long)peak.calls[anari_calls::Commit]);
+  }
+
+  if (m_frameStats.size() > 1) {
+    using Frame = FrameStats::Frame;
+    ImGui::Text(" p50/95/99: %.2f / %.2f / %.2fms",
+        m_frameStats.percentile(&Frame::duration, 0.5f),
+        m_frameStats.percentile(&Frame::duration, 0.95f),
+        m_frameStats.percentile(&Frame::duration, 0.99f));
+    ImGui::Text("  map/upload p95: %.2f / %.2fms",
+        m_frameStats.percentile(&Frame::map, 0.95f),
+        m_frameStats.percentile(&Frame::upload, 0.95f));
+    ImGui::Text("  achieved: %.1f fps over %zu frames",
+        m_frameStats.fps(),
+        m_frameStats.size());
+    ImGui::PlotLines("##frametimes",
+        m_frameStats.durations(),
+        int(m_frameStats.size()),
+        int(m_frameStats.offset()),
+        nullptr,
+        0.f,
+        FLT_MAX,
+        ImVec2(200.f, 40.f));
+  }
+
+  if (m_frameBudget) {
+    auto &parameters = m_rendererParameters[m_currentRenderer];
+    for (auto &knob : m_qualityKnobs) {
+      const auto &name = parameters[knob.parameter].name;
+      if (knob.isInt)
+        ImGui::Text("  budget: %s = %i", name.c_str(), int(knob.value));
+      else
+        ImGui::Text("  budget: %s = %.3f", name.c_str(), knob.value);
+    }
+  }
+
+  if (m_loadingProgress < 1.f) {
+    ImGui::Separator();
+    ImGui::Text("loading volume: %s", m_loadingStage.c_str());
+    ImGui::ProgressBar(m_loadingProgress, ImVec2(-1.f, 0.f));
+  }
 
   ImGui::Separator();
 
@@ -5,6 +5,27 @@
 
 #include "../Orbit.h"
 #include "../ui_anari.h"
+#include "AnariCalls.h"
+#include "Convergence.h"
+#include "DetectorCamera.h"
+#include "DeviceArbiter.h"
+#include "EdgeFilter.h"
+#include "FirstHit.h"
+#include "FrameCache.h"
+#include "FrameHistogram.h"
+#include "FrameReprojector.h"
+#include "FrameStats.h"
+#include "FrameStreamer.h"
+#include "GpuCounters.h"
+#include "ImageOverlay.h"
+#include "ImageRoi.h"
+#include "ImageWriter.h"
+#include "MemoryReport.h"
+#include "OriginDepth.h"
+#include "PixelUploader.h"
+#include "RenderThread.h"
+#include "TaskScheduler.h"
+#include "ToneMapper.h"
 // glad
 #include "glad/glad.h"
 // glfw
@@ -20,14 +41,116 @@
 #include <visionaray/pinhole_camera.h>
 // std
 #include <array>
+#include <chrono>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <span>
+#include <string>
+#include <vector>
 
 namespace anari_viewer::windows {
 
+// Color (RGBA8, or the linear value for ChannelLinear frames) and origin
+// (float3) channels of a frame, mapped for the lifetime of the view so
+// consumers can read them without copying. The frame must not be
+// re-rendered or discarded while a view is alive. Host frames may keep
+// their origins as depth (OriginDepth.h) instead: origin() is empty then,
+// and copyFull() and sampleOrigins() unproject the pixels they return.
+class FrameView
+{
+ public:
+  FrameView() = default;
+  FrameView(anari::Device device, anari::Frame frame, bool mapOrigin = true);
+  // A frame copied out by the render thread, kept alive by the view
+  FrameView(std::shared_ptr<const RenderedFrame> frame, bool withOrigin = true);
+  ~FrameView();
+
+  FrameView(FrameView &&other) noexcept;
+  FrameView &operator=(FrameView &&other) noexcept;
+  FrameView(const FrameView &) = delete;
+  FrameView &operator=(const FrameView &) = delete;
+
+  bool valid() const;
+  size_t width() const;
+  size_t height() const;
+  // width * height * 4 bytes: RGBA8, or one float32 per pixel if linear()
+  std::span<const uint8_t> color() const;
+  bool linear() const;
+  std::span<const float> values() const; // width * height if linear()
+  std::span<const float> origin() const; // width * height * 3, may be empty
+  bool hasOrigins() const; // as float3 or depth
+  // width * height * 4, gray RGBA8 (ChannelEdges); may be empty
+  std::span<const uint8_t> edges() const;
+  void setEdges(const uint8_t *edges); // owned by the producer
+  // The channels copied to host memory, to outlive the view, the origins
+  // kept as `format`
+  std::shared_ptr<const RenderedFrame> copy(
+      OriginFormat format = OriginFormat::Float3) const;
+  // The camera the frame was rendered with, for depth; host frames carry it
+  void setCamera(const RenderCamera &camera);
+
+  // Frames rendered for an ROI cover part of a larger one: the pixel offset
+  // of their lower left corner and the size of the full frame
+  void setRegion(
+      int offsetX, int offsetY, size_t fullWidth, size_t fullHeight);
+  size_t fullWidth() const;
+  size_t fullHeight() const;
+  // Copies the channels into full frame buffers, cleared outside the
+  // region, depth unprojected; the vectors are reused as with
+  // DRRViewport::getFrame()
+  void copyFull(std::vector<uint8_t> &color, std::vector<float> &origin) const;
+  void copyFull(std::vector<uint8_t> &color) const;
+  void copyFullEdges(std::vector<uint8_t> &edges) const;
+  // Origins at `count` pixel positions (x, y pairs in full frame pixels,
+  // row 0 first in memory), three floats each: the origin of the pixel the
+  // position falls into, NaN outside the region or without an origin
+  // channel. Reads mapped memory only (depth unprojects just these pixels),
+  // so any thread may call it while the view is alive.
+  void sampleOrigins(const float *pixels, size_t count, float *points) const;
+
+ private:
+  void unmap();
+  RayCamera rayCamera() const; // of the frame's own pixels
+
+  anari::Device m_device{nullptr};
+  anari::Frame m_frame{nullptr};
+  std::shared_ptr<const RenderedFrame> m_host;
+  const uint8_t *m_color{nullptr};
+  const float *m_origin{nullptr};
+  const void *m_depth{nullptr}; // of m_host, instead of m_origin
+  OriginFormat m_originFormat{OriginFormat::Float3};
+  RenderCamera m_camera;
+  const uint8_t *m_edges{nullptr};
+  bool m_linear{false};
+  size_t m_width{0};
+  size_t m_height{0};
+  int m_offset[2]{0, 0};
+  size_t m_fullWidth{0};
+  size_t m_fullHeight{0};
+};
+
+// Frame channels in addition to color, which is always rendered
+enum FrameChannel : unsigned
+{
+  ChannelColor = 1u << 0,
+  ChannelOrigin = 1u << 1, // float3 ray origin per pixel, used by matchers
+  // color as one float32 per pixel, the linear integral rather than sRGB
+  ChannelLinear = 1u << 2,
+  // edge image of the RGBA8 color (see EdgeFilter), filtered on the GPU by
+  // renderFrame(); not an ANARI channel
+  ChannelEdges = 1u << 3,
+};
+
 struct DRRViewport : public anari_viewer::windows::Window
 {
-  DRRViewport(anari::Device device, visionaray::pinhole_camera& camera, const char *name = "Viewport");
+  // Renderers are created when first selected: the given subtype (if the
+  // device has it, else the first one) right away, the others when picked
+  // from the context menu; instantiateRenderers() creates all of them
+  DRRViewport(anari::Device device,
+      visionaray::pinhole_camera &camera,
+      const char *name = "Viewport",
+      const char *renderer = nullptr);
   ~DRRViewport();
 
   void buildUI() override;
@@ -40,21 +163,234 @@ struct DRRViewport : public anari_viewer::windows::Window
   void resetView();
   void setView(anari::math::float3 eye, anari::math::float3 center, anari::math::float3 up);
   void getView(anari::math::float3& eye, anari::math::float3& center, anari::math::float3& up, float& fovy, float& aspect);
+  // Vertical field of view in radians, as getView() returns it; the
+  // detector camera keeps its own
+  void setFovy(float fovy);
   void setPhotonEnergy(float energy);
-  bool getFrame(std::vector<uint8_t>& color, std::vector<float>& depth3d, size_t& width, size_t& height);
+  // Maps the most recent frame; see FrameView
+  FrameView mapFrame(bool mapOrigin = true);
+  // Renders the current view with the given channels (FrameChannel bits) to
+  // completion and maps it; `scale` shrinks the frame size (coarse levels
+  // of coarse-to-fine matching). With an ROI set only that part is rendered
+  // (see FrameView::setRegion()). The frame is one of its own, not one of
+  // the interactive ones, so the view stays valid while the viewport keeps
+  // rendering, e.g. for a matcher running on it; it must be destroyed (on
+  // this thread) before the next call.
+  FrameView renderFrame(unsigned channels, float scale = 1.f);
+  // 3D origins at pixel positions of the full frame (see
+  // FrameView::sampleOrigins()), rendered for the current view; for a few
+  // points (picking, keypoints) without keeping a dense copy around
+  bool queryOrigins(std::span<const float> pixels,
+      std::vector<float> &points,
+      float scale = 1.f);
+  // The same without rendering: rays through the positions are marched
+  // through the host field (see marchFirstHits()) to where the integrated
+  // attenuation crosses the threshold. Renders if the field has no voxels.
+  bool queryOrigins(std::span<const float> pixels,
+      std::vector<float> &points,
+      const StructuredField &field,
+      const FirstHitSettings &settings = {},
+      float scale = 1.f);
+  // The camera of frames rendered at `scale`, for marching rays outside
+  // the viewport (e.g. from the matcher's thread)
+  RayCamera rayCamera(float scale = 1.f) const;
+  // No frame rendering nor wanted (background work may run)
+  bool idle() const;
+  // Shows an RGBA8 image of rayCamera()'s geometry rendered elsewhere (a
+  // cached DRR) until the next frame replaces it; false if it doesn't fit
+  // the texture or frames are linear
+  bool presentImage(const uint8_t *rgba, int width, int height);
+  // Render resolution outside the detector camera: the viewport's size
+  // times a scale factor (below 1 for fast matching, above 1 to
+  // supersample), or a fixed size shown scaled to fit. This sets the full
+  // resolution; adaptive resolution still lowers it during interaction.
+  void setRenderScale(float scale);
+  void setFixedRenderSize(anari::math::int2 size); // 0 x 0: scale again
+  // Detector camera: frames cover the detector's pixel grid with its
+  // intrinsics, independent of the viewport size, and are shown scaled to
+  // fit. An invalid geometry leaves the free camera (the fov slider and the
+  // viewport's aspect), which the context menu can also switch back to.
+  void setDetector(const DetectorGeometry &detector);
+  const DetectorGeometry &detector() const;
+  bool detectorEnabled() const;
+  // Region of interest of renderFrame(), drawn with ctrl + left drag; a
+  // ctrl-click clears it. The callback hears about ROIs drawn here, not
+  // about the ones set.
+  void setRoi(const ImageRoi &roi);
+  const ImageRoi &roi() const;
+  void setRoiChangedCallback(std::function<void(const ImageRoi &)> callback);
+  // Channels of interactive frames, color only unless set here
+  void setDefaultChannels(unsigned channels);
+  // Interactive frames with ChannelLinear: the float frame is uploaded as
+  // is and windowed for display on the GPU; screenshots in the float
+  // formats keep the values. The window follows each frame's histogram,
+  // from the low to the high percentile (FrameHistogram), unless one is
+  // set.
+  void setLinearOutput(bool linear);
+  bool linearOutput() const;
+  void setDisplayWindow(const DisplayWindow &window);
+  void setAutoWindowPercentiles(float low, float high);
+  // Reference image shown over the DRR (see ImageOverlay), mixed on the GPU
+  // every UI frame: the callback gives its texture, 0 while there is none,
+  // and the mode is also picked from the context menu
+  void setOverlaySource(std::function<GLuint()> texture);
+  void setOverlay(const OverlaySettings &settings);
+  // Edge enhancement of the frames shown, also picked from the context
+  // menu, and the filter of ChannelEdges (Sobel unless set)
+  void setEdgeEnhancement(const EdgeSettings &settings);
+  void setEdgeChannel(const EdgeSettings &settings);
+  // Copy of the color channel for when it must outlive the mapping; the
+  // vector is reused, so passing the same one again doesn't reallocate.
+  // Origins are queried where needed (queryOrigins()) rather than copied.
+  bool getFrame(std::vector<uint8_t>& color, size_t& width, size_t& height);
+  // Frame channels (on the device) and the display texture and pixel buffers
+  void reportMemory(MemoryReport &report) const;
+  // Shown in the overlay while the volume is loading; progress >= 1 hides it
+  void setLoadingProgress(float progress, const std::string &stage);
+  // Number of ANARI frames rendered round-robin (1-3); with more than one,
+  // the next frame renders while the previous one is mapped and uploaded
+  void setFramesInFlight(int numFrames);
+  // Interactive frames rendered, read back and copied on a thread of their
+  // own (see RenderThread), so the UI keeps the display's rate however
+  // long frames take; also switched from the context menu
+  void setRenderThread(bool enabled);
+  bool renderThreadEnabled() const;
+  // While the camera moves, the last frame warped to the current view (see
+  // FrameReprojector) is shown until the next one is done; interactive
+  // frames then render ChannelOrigin too. Also switched from the context
+  // menu.
+  void setReprojection(bool enabled);
+  bool reprojectionEnabled() const;
+  // Frames kept by pose and parameters (see FrameCache): renderFrame() at a
+  // revisited pose (registration loops) and interactive views switched back
+  // to are not rendered again. Budgets of 0 turn a tier off, both the cache.
+  void setFrameCache(
+      size_t hostBytes, size_t textureBytes, float quantum = 1e-3f);
+  // How the frame cache keeps the origins of the frames rendered for
+  // matching: as depth they take a third (Depth32) or a sixth (Depth16) of
+  // the memory and are unprojected when a matcher reads them
+  void setOriginFormat(OriginFormat format);
+  // Off while a recorded camera path is replayed: mouse input no longer
+  // moves the camera
+  void setInputEnabled(bool enabled);
+  // Frames rendered and shown so far, and the timings of the latest one
+  uint64_t numCompletedFrames() const;
+  FrameStats::Frame lastFrameStats() const;
+  // Frames are only rendered when something changed: the camera, renderer
+  // parameters, the size, or the world, which the viewport learns about
+  // through this counter (e.g. VolumeScene::version()) polled every frame.
+  // Renderers that accumulate keep rendering.
+  void setWorldVersionCallback(std::function<uint64_t()> version);
+  // Creates the renderers not created yet, with their parameter lists
+  void instantiateRenderers();
+  // Renders a new frame on the next UI frame
+  void requestRender();
+  // Frames shown are also handed to the streamer (nullptr: none), which
+  // copies them only while a remote client is watching
+  void setFrameStreamer(FrameStreamer *streamer);
+  // GPU utilization, VRAM, clocks and PCIe throughput shown next to the
+  // latency (nullptr: none)
+  void setGpuCounters(const GpuCounters *counters);
+  // Queue depths of the session's background work shown in the overlay
+  // (nullptr: none)
+  void setTaskScheduler(const TaskScheduler *scheduler);
+  // Told every UI frame whether interactive frames are rendering or queued,
+  // so batch work on the device yields to them (nullptr: none)
+  void setDeviceArbiter(DeviceArbiter *arbiter);
 
   anari::Device device() const;
 
  private:
   void reshape(anari::math::int2 newWindowSize);
 
+  bool isInteracting() const;
+  anari::math::int2 frameSize() const; // full resolution frames
+  // display aspect of frames independent of the viewport, 0 when they
+  // follow it
+  float frameAspect() const;
+  anari::math::int2 targetRenderSize() const;
+  void resizeTexture();
+  void resizeLinearTexture(bool needed);
+  // (Re)allocates an RGBA8 texture of `wanted` size and binds it
+  void ensureTexture(
+      GLuint &texture, anari::math::int2 &size, anari::math::int2 wanted);
+  // the display pipeline after the frame: edges, then the reference over
+  // them; each returns the texture to show
+  GLuint applyEdges(GLuint frame);
+  GLuint applyOverlay(GLuint frame);
+  // the frame shown warped to the current camera, before the edges
+  GLuint applyReprojection(GLuint frame);
+  void updateMipmaps(GLuint texture);
+  // ChannelEdges of renderFrame()'s view, color uploaded and filtered
+  void filterEdges(FrameView &view);
+  void resolutionChanged();
+  void adaptResolution(float frameTime);
+  void findQualityKnobs();
+  // Creates the renderer on first use; false if the device gave none
+  bool ensureRenderer(size_t index);
+  bool selectRenderer(size_t index); // false: the selection is kept
+  void recordFrameTime(float frameTime);
+
+  // m_defaultChannels and those reprojection needs
+  unsigned interactiveChannels() const;
+  void setChannels(size_t frameIndex, unsigned channels);
+  void setFrameChannels(
+      anari::Frame frame, unsigned &current, unsigned channels);
   void startNewFrame();
+  // Shows the cached frame of the current view instead of rendering one;
+  // only with nothing in flight that could be shown after it
+  bool showCachedFrame();
+  void cacheShownFrame(uint64_t key, int width, int height);
+  uint64_t frameKey(anari::math::int2 size, unsigned channels) const;
   void updateFrame();
+  void cameraFrustum(float &fovy, float &aspect, ImageRoi &image) const;
+  // the camera's parameters for the manipulators' view
+  RenderCamera currentCamera() const;
   void updateCamera(bool force = false);
   void updateImage();
+  void updateThreadedImage(); // updateImage() with the render thread
+  // stats, accumulation, streaming, upload and screenshot of a finished
+  // frame in host memory; data is RGBA8, or float32 values if linear. A
+  // frame in a GL texture of the device instead (data null) is copied on
+  // the GPU.
+  void showFrame(const void *data,
+      int width,
+      int height,
+      bool linear,
+      float duration,
+      float mapTime,
+      bool save,
+      GLuint texture = 0);
+  // Maps the finished frame's color to host memory and shows it
+  void showMappedFrame(anari::Frame frame, size_t frameIndex, float duration);
+  // The shown ring frame's camera, and its origins for reprojection
+  void keepOrigins(
+      anari::Frame frame, size_t frameIndex, int width, int height);
+  // Shows a finished frame from the device's GL texture, false if it has
+  // none or the host needs the pixels (see m_glFrames)
+  bool showGLFrame(anari::Frame frame, size_t frameIndex, float duration);
+  void copyGLFrame(GLuint source, int width, int height);
+  // Input-to-display latency: noteInput() stamps manipulator input, frames
+  // started afterwards carry the stamp of the oldest input not yet shown,
+  // and the first of them drawn is measured on the next UI frame, after
+  // the buffer swap (and vsync) that put it on screen
+  void noteInput();
+  void markShown(std::chrono::steady_clock::time_point input);
+  void measureInputLatency();
   void cancelFrame();
+  void restartFrame();
+  void applyPendingEdits();
+  bool needsFrame() const;
+  void updateAccumulation(const uint32_t *rgba, int width, int height);
+  void updateAccumulation(const float *values, int width, int height);
+  // tone maps a linear frame for the consumers that need RGBA8
+  const uint32_t *displayPixels(const float *values, int width, int height);
+  // range, and with auto windowing the display window, of a histogram
+  void takeHistogram(FrameHistogram::Result histogram);
 
   void ui_handleInput();
+  bool ui_roiInput();
+  void ui_roi();
   void ui_contextMenu();
   void ui_overlay();
 
@@ -69,12 +405,38 @@ struct DRRViewport : public anari_viewer::windows::Window
   bool m_frameCancelled{false};
   bool m_saveNextFrame{false};
   int m_screenshotIndex{0};
+  ImageFormat m_screenshotFormat{ImageFormat::Png};
+  ImageWriter m_imageWriter{1, 4};
 
   bool m_dolly{false};
   bool m_pan{false};
   bool m_orbit{false};
   bool m_viewChanged{false};
+  bool m_inputEnabled{true};
+
+  // render scheduling: a frame is started when dirty (or accumulating, or
+  // when continuous rendering is on); idle while nothing changes
+  bool m_renderDirty{true};
+  bool m_idle{false};
+  bool m_continuousRendering{false};
+  std::function<uint64_t()> m_worldVersion;
+  // accumulating renderers stop at m_maxSamples (0: no limit) or once the
+  // image converged; any change starts over
+  int m_maxSamples{1024};
+  bool m_checkConvergence{true};
+  ConvergenceCheck m_convergence;
+  bool m_accumulationDone{false};
+
+  // edits committed when the next frame starts, so a slider drag costs one
+  // commit per frame rather than one per tick
+  bool m_photonEnergyPending{false};
+  float m_photonEnergy{0.f};
+  uint64_t m_seenWorldVersion{0};
+  uint64_t m_numUiFrames{0};
+  uint64_t m_numIdleUiFrames{0}; // without a frame in flight
+  bool m_wasInteracting{false};
   visionaray::mouse::button m_button{visionaray::mouse::button::NoButton};
+  visionaray::mouse::pos m_lastMousePos{0, 0};
   visionaray::keyboard::key m_modifier{visionaray::keyboard::key::NoKey};
   visionaray::pinhole_camera &m_camera;
   std::vector<std::shared_ptr<visionaray::camera_manipulator>> m_manipulators;
@@ -84,31 +446,166 @@ struct DRRViewport : public anari_viewer::windows::Window
   bool m_singleShot{true};
 
   float m_fov{40.f};
+  DetectorGeometry m_detector;
+  bool m_useDetector{false};
+
+  // the ROI and the one being drawn; the camera renders m_cameraRegion,
+  // the full frame except within renderFrame()
+  ImageRoi m_roi;
+  ImageRoi m_roiDraft;
+  bool m_drawingRoi{false};
+  float m_roiStart[2]{0.f, 0.f};
+  std::function<void(const ImageRoi &)> m_roiChanged;
+  ImageRoi m_cameraRegion;
+  ImVec2 m_imageMin{0.f, 0.f}; // screen rectangle of the shown frame
+  ImVec2 m_imageMax{0.f, 0.f};
+
+  float m_loadingProgress{1.f};
+  std::string m_loadingStage;
 
   // ANARI objects //
 
   anari::DataType m_format{ANARI_UFIXED8_RGBA_SRGB};
 
   anari::Device m_device{nullptr};
-  anari::Frame m_frame{nullptr};
+  // the frames', camera's and renderers' parameters as last set, shared
+  // with the render thread
+  anari_calls::ParameterCache m_parameters;
+  std::vector<anari::Frame> m_frames;
+  size_t m_frameIndex{0};
+  int m_framesInFlight{1};
+  std::vector<anari::math::int2> m_frameSizes;
+  std::vector<unsigned> m_frameChannels;
+  unsigned m_defaultChannels{ChannelColor};
+  anari::Frame m_frame{nullptr}; // most recently submitted frame
+  // renderFrame()'s frame, apart from the ring
+  anari::Frame m_renderedFrame{nullptr};
+  anari::math::int2 m_renderedFrameSize{0, 0};
+  unsigned m_renderedFrameChannels{0};
   anari::World m_world{nullptr};
 
   anari::Camera m_perspCamera{nullptr};
+  // the camera's parameters, applied here or by the render thread
+  RenderCamera m_renderCamera;
+
+  // interactive frames on their own thread (nullptr: on the UI thread)
+  std::unique_ptr<RenderThread> m_renderThread;
+  uint64_t m_requestSequence{0};
+  bool m_saveRequested{false}; // a request for the screenshot is out
+
+  std::unique_ptr<FrameCache> m_frameCache; // nullptr: off
+  OriginFormat m_originFormat{OriginFormat::Float3}; // of cached frames
+  std::vector<uint64_t> m_frameKeys; // of the ring's frames, 0: not cached
+  // oldest input not yet on screen when each ring frame started
+  std::vector<std::chrono::steady_clock::time_point> m_frameInputs;
+  std::vector<RenderCamera> m_frameCameras; // each ring frame's
+  std::chrono::steady_clock::time_point m_oldestInput{}; // unset: none
+  std::chrono::steady_clock::time_point m_shownInput{}; // drawn, not swapped
+  uint64_t m_rendererVersion{0}; // renderer parameter edits
 
   std::vector<std::string> m_rendererNames;
   std::vector<anari_viewer::ui::ParameterList> m_rendererParameters;
-  std::vector<anari::Renderer> m_renderers;
+  std::vector<anari::Renderer> m_renderers; // nullptr until created
   int m_currentRenderer{0};
 
   // OpenGL + display
 
   GLuint m_framebufferTexture{0};
+  anari::math::int2 m_textureSize{1920, 1080};
+  // frames larger than shown are minified through mipmaps
+  bool m_mipmapped{false};
+  // linear frames are uploaded here (GL_R32F) and windowed into the
+  // display texture
+  GLuint m_linearTexture{0};
+  anari::math::int2 m_linearTextureSize{0, 0};
+  ToneMapper m_toneMapper;
+  FrameHistogram m_histogram;
+  FrameHistogram::Result m_frameHistogram; // last one on the host
+  DisplayWindow m_displayWindow;
+  DisplayWindow m_frameWindow; // range of the last linear frame
+  bool m_autoWindow{true};
+  float m_autoWindowPercentiles[2]{0.5f, 99.5f};
+  bool m_windowChanged{false}; // re-window the last frame
+  bool m_lastFrameLinear{false};
+  std::vector<uint32_t> m_displayPixels;
+  // the frame with the reference over it, sized like the display texture
+  ImageOverlay m_imageOverlay;
+  OverlaySettings m_overlay;
+  std::function<GLuint()> m_overlaySource;
+  GLuint m_overlayTexture{0};
+  anari::math::int2 m_overlayTextureSize{0, 0};
+  // the frame shown warped to the camera while the next one renders
+  bool m_reprojection{false};
+  FrameReprojector m_reprojector;
+  RenderCamera m_shownCamera; // of the frame in the display texture
+  GLuint m_reprojectedTexture{0};
+  anari::math::int2 m_reprojectedTextureSize{0, 0};
+  // edge-enhanced display frames
+  EdgeFilter m_edgeFilter;
+  EdgeSettings m_edgeDisplay;
+  GLuint m_edgeTexture{0};
+  anari::math::int2 m_edgeTextureSize{0, 0};
+  // ChannelEdges: renderFrame()'s color and its edges, read back into
+  // m_edgePixels for the view
+  EdgeSettings m_edgeChannel{EdgeSettings::Sobel};
+  GLuint m_edgeSourceTexture{0};
+  GLuint m_edgeTargetTexture{0};
+  anari::math::int2 m_edgeSourceSize{0, 0};
+  anari::math::int2 m_edgeTargetSize{0, 0};
+  std::vector<uint8_t> m_edgePixels;
+  PixelUploader m_uploader;
+  bool m_usePixelBuffers{true};
+  // Devices given our GL context (glAPI) may render into a GL texture and
+  // name it through "channel.colorGL", which maps to its GLuint; frames
+  // are then copied texture to texture without a host copy. Only offered
+  // for devices whose frames list that channel, off until enabled from
+  // the context menu, and cleared by the first frame mapping no texture.
+  bool m_glFramesSupported{false};
+  bool m_glFrames{false};
+  GLuint m_glFrameFramebuffer{0};
+  FrameStreamer *m_streamer{nullptr};
+  const GpuCounters *m_gpuCounters{nullptr};
+  const TaskScheduler *m_tasks{nullptr};
+  DeviceArbiter *m_arbiter{nullptr};
   anari::math::int2 m_viewportSize{1920, 1080};
   anari::math::int2 m_renderSize{1920, 1080};
+  anari::math::int2 m_displaySize{1920, 1080}; // size of the shown frame
+  float m_renderScale{1.f};
+  bool m_fixedRenderSize{false};
+  anari::math::int2 m_renderSizeSetting{512, 512};
+  // of the settings widgets, applied when their edit is done
+  float m_renderScaleEdit{1.f};
+  anari::math::int2 m_renderSizeEdit{512, 512};
+
+  // Reduced resolution while a manipulator is active
+  bool m_adaptiveResolution{true};
+  float m_targetFrameTime{33.f}; // ms
+  float m_resolutionScale{1.f};
+
+  // Renderer parameters adjusted to hold m_targetFrameTime, driven by the
+  // mean over a rolling window of frame latencies
+  struct QualityKnob
+  {
+    size_t parameter{0}; // index into m_rendererParameters[m_currentRenderer]
+    bool isInt{false};
+    float value{0.f};
+    float minValue{0.f};
+    float maxValue{0.f};
+  };
+  bool m_frameBudget{false};
+  std::vector<QualityKnob> m_qualityKnobs;
+  std::array<float, 16> m_frameTimes{};
+  size_t m_frameTimeCount{0};
 
   float m_latestFL{1.f};
   float m_minFL{std::numeric_limits<float>::max()};
   float m_maxFL{-std::numeric_limits<float>::max()};
+  float m_framesPerSecond{0.f};
+  std::chrono::steady_clock::time_point m_lastFrameCompleted;
+  FrameStats m_frameStats;
+  FrameStats::Frame m_lastFrameStats;
+  uint64_t m_numCompletedFrames{0};
+  int m_frameStatsIndex{0}; // numbers the exported CSV files
 
   std::string m_overlayWindowName;
   std::string m_contextMenuName;
@@ -0,0 +1,149 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "VolumeManager.h"
+
+// std
+#include <filesystem>
+#include <iostream>
+// ours
+#include "Trace.h"
+
+static void valueRangeOf(const VolumeSource &volume, float valueRange[2])
+{
+  if (!volume.histogram.empty()) {
+    valueRange[0] = volume.histogram.lower;
+    valueRange[1] = volume.histogram.upper;
+  } else {
+    valueRange[0] = volume.sdata.dataRange.x;
+    valueRange[1] = volume.sdata.dataRange.y;
+  }
+}
+
+static size_t fieldBytes(const StructuredField &field)
+{
+  return size_t(field.dimX) * field.dimY * field.dimZ * field.bytesPerCell;
+}
+
+VolumeManager::~VolumeManager()
+{
+  m_fields.clear();
+}
+
+VolumeSource &VolumeManager::add(const std::string &fileName)
+{
+  m_volumes.push_back(std::make_unique<VolumeSource>());
+  m_volumes.back()->fileName = fileName;
+  return *m_volumes.back();
+}
+
+VolumeSource &VolumeManager::replace(std::unique_ptr<VolumeSource> volume)
+{
+  m_fields.clear();
+  m_volumes.clear();
+  m_volumes.push_back(std::move(volume));
+  m_active = 0;
+  return *m_volumes.back();
+}
+
+size_t VolumeManager::size() const
+{
+  return m_volumes.size();
+}
+
+VolumeSource &VolumeManager::volume(size_t index)
+{
+  return *m_volumes[index];
+}
+
+const VolumeSource &VolumeManager::volume(size_t index) const
+{
+  return *m_volumes[index];
+}
+
+std::vector<std::string> VolumeManager::names() const
+{
+  std::vector<std::string> result;
+  for (auto &volume : m_volumes) {
+    auto path = std::filesystem::path(volume->fileName);
+    // DICOM directories may be given with a trailing slash
+    result.push_back(path.has_filename() ? path.filename().string()
+                                         : path.parent_path().filename().string());
+  }
+  return result;
+}
+
+size_t VolumeManager::activeIndex() const
+{
+  return m_active;
+}
+
+VolumeSource &VolumeManager::active()
+{
+  return *m_volumes[m_active];
+}
+
+const VolumeSource &VolumeManager::active() const
+{
+  return *m_volumes[m_active];
+}
+
+void VolumeManager::setDeviceBudget(anari::Device device, size_t bytes)
+{
+  m_device = device;
+  m_fields.setBudget(bytes);
+  m_fields.setEvictCallback([device](const size_t &, DeviceField &entry) {
+    anari::release(device, entry.field);
+  });
+}
+
+void VolumeManager::show(VolumeScene &scene, size_t index, bool zeroIsEmpty)
+{
+  if (index >= m_volumes.size() || (index == m_active && scene.field()))
+    return;
+
+  TRACE_SCOPE("volume", "show volume");
+  // the field shown so far is the likely next one; it replaces a cached
+  // one of an earlier LUT
+  auto current = scene.field();
+  auto *shown = current ? m_fields.get(m_active) : nullptr;
+  if (current && (!shown || shown->field != current)) {
+    DeviceField entry;
+    entry.field = current;
+    valueRangeOf(active(), entry.valueRange);
+    anari::retain(m_device, current);
+    m_fields.put(m_active, entry, fieldBytes(active().sdata));
+  }
+
+  m_active = index;
+  auto &next = active();
+  if (auto *cached = m_fields.get(index)) {
+    scene.setField(cached->field, cached->valueRange, false);
+    return;
+  }
+  if (next.sdata.empty()) {
+    std::cerr << "Volume " << next.fileName << " is not loaded\n";
+    return;
+  }
+
+  DeviceField entry;
+  entry.field = scene.newField(next.sdata, zeroIsEmpty);
+  valueRangeOf(next, entry.valueRange);
+  scene.setField(entry.field, entry.valueRange, false);
+  m_fields.put(index, entry, fieldBytes(next.sdata));
+}
+
+void VolumeManager::dropDeviceFields()
+{
+  m_fields.clear();
+}
+
+size_t VolumeManager::deviceBytes() const
+{
+  return m_fields.bytes();
+}
+
+size_t VolumeManager::numDeviceFields() const
+{
+  return m_fields.size();
+}
@@ -0,0 +1,112 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// anari
+#include <anari/anari_cpp.hpp>
+// std
+#include <memory>
+#include <string>
+#include <vector>
+// ours
+#include "BrickStream.h"
+#include "FieldTypes.h"
+#include "LruCache.h"
+#include "MemoryFit.h"
+#include "readRAW.h"
+#ifdef HAVE_ITK
+#include "readDicom.h"
+#include "readNifti.h"
+#endif
+#include "VolumeScene.h"
+#ifdef HAVE_ITK
+#include "ZarrReader.h"
+#endif
+
+// One volume file of the session: the readers holding its voxels and the
+// host field shown for it
+struct VolumeSource
+{
+  std::string fileName;
+  // RAW layout, from the command line, the sidecar header or the file name
+  int dims[3]{0, 0, 0};
+  unsigned bytesPerCell{0};
+
+  StructuredField sdata;
+#ifdef HAVE_ITK
+  NiftiReader niftiReader;
+  DicomReader dicomReader; // reads into niftiReader
+  ZarrReader zarrReader; // reads into niftiReader
+#endif
+  RAWReader rawReader;
+  BrickStream brickStream; // --out-of-core RAW volumes
+  MemoryFitPlan fit; // --fit-memory
+  bool isNifti{false};
+  size_t lacLut{0}; // LUT sdata was converted with
+  // of sdata, for windowing in the settings editor
+  ValueHistogram histogram;
+
+  bool hasRawDims() const
+  {
+    return dims[0] && dims[1] && dims[2] && bytesPerCell;
+  }
+};
+
+// Volumes of a session on one ANARI device //////////////////////////////////
+//
+// All volumes share the device, the scene's world and the LUTs; the one shown
+// is the scene's field. Device fields of the others are kept in an LRU cache
+// with a byte budget, so switching back and forth (e.g. between a pre-op and
+// a post-op scan) needs no upload; fields beyond the budget are released and
+// uploaded again from the host field when their volume is shown.
+class VolumeManager
+{
+ public:
+  VolumeManager() = default;
+  ~VolumeManager();
+
+  VolumeManager(const VolumeManager &) = delete;
+  VolumeManager &operator=(const VolumeManager &) = delete;
+
+  VolumeSource &add(const std::string &fileName);
+  // The session's volumes become this one, e.g. the next case's read
+  // ahead; the device fields cached for the old ones are released (the
+  // scene keeps the one it shows until it gets another)
+  VolumeSource &replace(std::unique_ptr<VolumeSource> volume);
+  size_t size() const;
+  VolumeSource &volume(size_t index);
+  const VolumeSource &volume(size_t index) const;
+  std::vector<std::string> names() const; // file names without directory
+
+  size_t activeIndex() const;
+  VolumeSource &active();
+  const VolumeSource &active() const;
+
+  // Budget for the device fields of hidden volumes; the device releases them
+  void setDeviceBudget(anari::Device device, size_t bytes);
+
+  // Shows volume `index` in `scene`: its cached device field or a new one
+  // uploaded from its host field. The field shown so far is cached for its
+  // volume.
+  void show(VolumeScene &scene, size_t index, bool zeroIsEmpty);
+
+  // Drops the cached fields (they no longer match the active LUT); the
+  // scene keeps its own reference to the field shown
+  void dropDeviceFields();
+
+  size_t deviceBytes() const;
+  size_t numDeviceFields() const;
+
+ private:
+  struct DeviceField
+  {
+    anari::SpatialField field{nullptr};
+    float valueRange[2]{0.f, 1.f};
+  };
+
+  std::vector<std::unique_ptr<VolumeSource>> m_volumes;
+  size_t m_active{0};
+  anari::Device m_device{nullptr};
+  LruCache<size_t, DeviceField> m_fields;
+};
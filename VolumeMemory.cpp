@@ -0,0 +1,141 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "VolumeMemory.h"
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+// below, the heap's own pages are as good, and a mapping would waste the
+// rest of its last huge page
+constexpr size_t g_mapThreshold = size_t(2) << 20;
+constexpr size_t g_hugePageSize = size_t(2) << 20;
+constexpr size_t g_maskBits = 8 * sizeof(unsigned long);
+
+std::atomic<HugePages> g_hugePages{HugePages::Off};
+std::atomic<NumaPlacement> g_numa{NumaPlacement::FirstTouch};
+std::atomic<bool> g_warnedPool{false};
+std::atomic<bool> g_warnedInterleave{false};
+
+// Nodes with memory, from sysfs ("0-1,4"); empty for a single node, which
+// has nothing to interleave over
+std::vector<unsigned long> interleaveMask()
+{
+  std::ifstream in("/sys/devices/system/node/has_memory");
+  if (!in)
+    in.open("/sys/devices/system/node/online");
+  std::string list;
+  if (!(in >> list))
+    return {};
+  std::vector<unsigned long> mask;
+  size_t nodes = 0;
+  const char *s = list.c_str();
+  while (*s) {
+    char *end = nullptr;
+    const unsigned long first = std::strtoul(s, &end, 10);
+    unsigned long last = first;
+    if (*end == '-')
+      last = std::strtoul(end + 1, &end, 10);
+    if (end == s || last < first || last >= 4096)
+      return {};
+    for (unsigned long n = first; n <= last; ++n, ++nodes) {
+      mask.resize(std::max(mask.size(), n / g_maskBits + 1), 0);
+      mask[n / g_maskBits] |= 1ul << (n % g_maskBits);
+    }
+    s = *end == ',' ? end + 1 : end;
+  }
+  if (nodes < 2)
+    mask.clear();
+  return mask;
+}
+
+// before any page is touched, so all of them follow the policy
+void interleave(void *p, size_t bytes)
+{
+  static const std::vector<unsigned long> mask = interleaveMask();
+  if (mask.empty())
+    return;
+  // maxnode counts one past the last bit, as libnuma passes it
+  if (syscall(SYS_mbind,
+          p,
+          bytes,
+          MPOL_INTERLEAVE,
+          mask.data(),
+          mask.size() * g_maskBits + 1,
+          0)
+          != 0
+      && !g_warnedInterleave.exchange(true)) {
+    std::cerr << "cannot interleave volume memory over NUMA nodes, pages "
+                 "are placed on first touch\n";
+  }
+}
+
+} // namespace
+
+void setVolumeMemoryPolicy(const VolumeMemoryPolicy &policy)
+{
+  g_hugePages = policy.hugePages;
+  g_numa = policy.numa;
+}
+
+VolumeMemoryPolicy volumeMemoryPolicy()
+{
+  VolumeMemoryPolicy policy;
+  policy.hugePages = g_hugePages;
+  policy.numa = g_numa;
+  return policy;
+}
+
+std::shared_ptr<void> allocateVolumeMemory(size_t bytes)
+{
+  if (bytes < g_mapThreshold) {
+    auto *buffer = new uint8_t[bytes]();
+    return std::shared_ptr<void>(
+        buffer, [](void *p) { delete[] static_cast<uint8_t *>(p); });
+  }
+
+  const HugePages huge = g_hugePages;
+  const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  size_t length = bytes;
+  void *p = MAP_FAILED;
+  if (huge == HugePages::Explicit) {
+    // whole pages of the pool
+    length = (bytes + g_hugePageSize - 1) / g_hugePageSize * g_hugePageSize;
+    p = mmap(nullptr,
+        length,
+        PROT_READ | PROT_WRITE,
+        flags | MAP_HUGETLB,
+        -1,
+        0);
+    if (p == MAP_FAILED && !g_warnedPool.exchange(true)) {
+      std::cerr << "no explicit huge pages left for a volume (see "
+                   "vm.nr_hugepages), using transparent ones\n";
+    }
+  }
+  if (p == MAP_FAILED) {
+    length = bytes;
+    p = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED)
+      throw std::bad_alloc();
+    if (huge != HugePages::Off)
+      madvise(p, length, MADV_HUGEPAGE);
+  }
+  if (g_numa == NumaPlacement::Interleave)
+    interleave(p, length);
+  return std::shared_ptr<void>(
+      p, [length](void *q) { munmap(q, length); });
+}
@@ -0,0 +1,52 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <memory>
+
+// Volume buffer memory //////////////////////////////////////////////////////
+//
+// The voxels of StructuredField::allocate(). Small buffers come from the
+// heap; larger ones are anonymous mappings, which read as zeros without any
+// page having been touched. Linux places a page on the NUMA node of the
+// thread that first writes it, so the threads of a parallel fill (the LAC
+// conversion hands out slices to all cores) spread a volume over the
+// sockets rather than zero-filling it all on the allocating thread's node.
+// Ray marching on a CPU device then reads from every node's memory
+// controller. Interleaving places the pages round-robin instead, for
+// buffers a single thread fills (RAW files, decompression).
+//
+// Huge pages (2 MiB on x86-64) cut the TLB misses of marching rays, whose
+// samples spread over many pages at once: transparent ones are asked for
+// with madvise() and come if the kernel has them; explicit ones come from
+// the hugetlbfs pool (vm.nr_hugepages), falling back to transparent ones
+// when the pool runs dry.
+
+enum class HugePages
+{
+  Off,
+  Transparent,
+  Explicit
+};
+
+enum class NumaPlacement
+{
+  FirstTouch,
+  Interleave // over all nodes with memory
+};
+
+struct VolumeMemoryPolicy
+{
+  HugePages hugePages{HugePages::Off};
+  NumaPlacement numa{NumaPlacement::FirstTouch};
+};
+
+// Process-wide, for the buffers allocated from then on
+void setVolumeMemoryPolicy(const VolumeMemoryPolicy &policy);
+VolumeMemoryPolicy volumeMemoryPolicy();
+
+// Zero-filled, page aligned if mapped; throws std::bad_alloc, as new does
+std::shared_ptr<void> allocateVolumeMemory(size_t bytes);
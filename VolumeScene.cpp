@@ -0,0 +1,648 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "VolumeScene.h"
+// anari
+#include <anari/anari_cpp/ext/linalg.h>
+// std
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+// ours
+#include "AnariCalls.h"
+#include "BrickedField.h"
+#include "Crop.h"
+#include "Parallel.h"
+#include "SparseField.h"
+#include "Trace.h"
+
+static void releaseSharedVoxels(const void *userPtr, const void *)
+{
+  delete (const std::shared_ptr<const void> *)userPtr;
+}
+
+static anari::DataType cellType(unsigned bytesPerCell, bool isHalf)
+{
+  if (bytesPerCell == 1)
+    return ANARI_UFIXED8;
+  if (bytesPerCell == 2)
+    return isHalf ? ANARI_FLOAT16 : ANARI_UFIXED16;
+  return ANARI_FLOAT32;
+}
+
+static anari::DataType cellType(const StructuredField &data)
+{
+  return cellType(data.bytesPerCell, data.isHalf);
+}
+
+static size_t dataBytes(const StructuredField &data)
+{
+  return size_t(data.dimX) * data.dimY * data.dimZ * data.bytesPerCell;
+}
+
+static void copyVoxels(void *dst, const StructuredField &data)
+{
+  auto *to = static_cast<uint8_t *>(dst);
+  auto *from = static_cast<const uint8_t *>(data.data());
+  parallelFor(0, dataBytes(data), [&](size_t begin, size_t end) {
+    std::memcpy(to + begin, from + begin, end - begin);
+  });
+}
+
+// Empty-space skipping hints, not part of the ANARI spec: devices that know
+// them skip cells whose max is zero and clip rays to the bounds of the
+// non-empty cells, others ignore them
+static void setMacrocellParameters(anari::Device device,
+    anari::SpatialField field,
+    const StructuredField &data)
+{
+  auto &grid = data.macrocells;
+  if (grid.empty()) {
+    anari::unsetParameter(device, field, "macrocell.range");
+    anari::unsetParameter(device, field, "macrocell.size");
+    anari::unsetParameter(device, field, "macrocell.bounds");
+    return;
+  }
+
+  anari_calls::setAndReleaseParameter(device,
+      field,
+      "macrocell.range",
+      anariNewArray3D(device,
+          grid.minMax.data(),
+          0,
+          0,
+          ANARI_FLOAT32_VEC2,
+          grid.dims[0],
+          grid.dims[1],
+          grid.dims[2]));
+  anari_calls::setParameter(device, field, "macrocell.size", grid.cellSize);
+  float bounds[6];
+  for (int a = 0; a < 3; ++a) {
+    bounds[a] = data.origin[a] + grid.lower[a] * data.spacing[a];
+    bounds[3 + a] = data.origin[a] + grid.upper[a] * data.spacing[a];
+  }
+  anari_calls::setParameter(
+      device, field, "macrocell.bounds", ANARI_FLOAT32_BOX3, bounds);
+}
+
+// The field's voxels are shared with the device instead of copied, the
+// deleter dropping our reference once the array is released, unless the
+// caller wants to rewrite them later: then they are copied into a
+// device-owned array, returned in `ownedData` (with a reference for the
+// caller). File-mapped voxels are always shared. A layout without voxels
+// gets an unwritten array.
+static anari::SpatialField newStructuredField(anari::Device device,
+    const StructuredField &data,
+    anari::Array3D *ownedData)
+{
+  TRACE_SCOPE("anari", "new field");
+  auto field =
+      anari::newObject<anari::SpatialField>(device, "structuredRegular");
+
+  const auto type = cellType(data);
+  anari::Array3D scalar;
+  if (!data.empty() && (data.mapped || !ownedData)) {
+    scalar = anariNewArray3D(device,
+        data.data(),
+        releaseSharedVoxels,
+        new std::shared_ptr<const void>(data.voxels),
+        type,
+        data.dimX,
+        data.dimY,
+        data.dimZ);
+  } else {
+    scalar = anari::newArray3D(device, type, data.dimX, data.dimY, data.dimZ);
+    if (!data.empty()) {
+      copyVoxels(anari::map<void>(device, scalar), data);
+      anari::unmap(device, scalar);
+    }
+    if (ownedData) {
+      anari::retain(device, scalar);
+      *ownedData = scalar;
+    }
+  }
+
+  anari_calls::setAndReleaseParameter(device, field, "data", scalar);
+  anari_calls::setParameter(device, field, "filter", ANARI_STRING, "linear");
+  anari_calls::setParameter(
+      device, field, "origin", ANARI_FLOAT32_VEC3, data.origin);
+  anari_calls::setParameter(
+      device, field, "spacing", ANARI_FLOAT32_VEC3, data.spacing);
+  setMacrocellParameters(device, field, data);
+
+  anari_calls::commitParameters(device, field);
+  return field;
+}
+
+// "nanovdb" field over a copy of the grid's buffer
+static anari::SpatialField newSparseField(
+    anari::Device device, const SparseGrid &grid)
+{
+  TRACE_SCOPE("anari", "new sparse field");
+  auto field = anari::newObject<anari::SpatialField>(device, "nanovdb");
+  const size_t bytes = grid.buffer.size();
+  auto data = anari::newArray1D(device, ANARI_UINT8, bytes);
+  std::memcpy(anari::map<uint8_t>(device, data), grid.buffer.data(), bytes);
+  anari::unmap(device, data);
+  anari_calls::setAndReleaseParameter(device, field, "gridData", data);
+  anari_calls::setParameter(device, field, "filter", ANARI_STRING, "linear");
+  anari_calls::commitParameters(device, field);
+  return field;
+}
+
+static bool hasSubtype(
+    anari::Device device, anari::DataType type, const char *subtype)
+{
+  const char **subtypes = anariGetObjectSubtypes(device, type);
+  for (; subtypes && *subtypes; ++subtypes) {
+    if (std::string(*subtypes) == subtype)
+      return true;
+  }
+  return false;
+}
+
+// Single-level "amr" field with one block per stored brick; blocks hold the
+// brick interiors (AMR interpolates across blocks itself) and empty bricks
+// are left out, which the device samples as zero
+static anari::SpatialField newBrickedField(
+    anari::Device device, const BrickedField &data)
+{
+  TRACE_SCOPE("anari", "new bricked field");
+  auto field = anari::newObject<anari::SpatialField>(device, "amr");
+
+  const auto type = cellType(data.bytesPerCell, data.isHalf);
+
+  const unsigned bpc = data.bytesPerCell;
+  std::vector<int32_t> bounds;
+  std::vector<int32_t> levels;
+  std::vector<anari::Array3D> blocks;
+  for (auto &b : data.bricks) {
+    const auto *src = static_cast<const uint8_t *>(data.brickData(b));
+    if (!src)
+      continue;
+
+    auto block = anari::newArray3D(device, type, b.dims[0], b.dims[1], b.dims[2]);
+    auto *dst = anari::map<uint8_t>(device, block);
+    std::memcpy(dst, src, data.storedCells(b) * bpc);
+    anari::unmap(device, block);
+
+    for (int a = 0; a < 3; ++a)
+      bounds.push_back(b.origin[a]);
+    for (int a = 0; a < 3; ++a)
+      bounds.push_back(b.origin[a] + b.dims[a] - 1);
+    levels.push_back(0);
+    blocks.push_back(block);
+  }
+
+  anari_calls::setParameter(
+      device, field, "gridOrigin", ANARI_FLOAT32_VEC3, data.origin);
+  anari_calls::setParameter(
+      device, field, "gridSpacing", ANARI_FLOAT32_VEC3, data.spacing);
+  const float cellWidth = 1.f;
+  anari_calls::setAndReleaseParameter(
+      device, field, "cellWidth", anari::newArray1D(device, &cellWidth));
+  anari_calls::setAndReleaseParameter(device,
+      field,
+      "block.bounds",
+      anariNewArray1D(
+          device, bounds.data(), 0, 0, ANARI_INT32_BOX3, levels.size()));
+  anari_calls::setAndReleaseParameter(device,
+      field,
+      "block.level",
+      anari::newArray1D(device, levels.data(), levels.size()));
+  anari_calls::setAndReleaseParameter(device,
+      field,
+      "block.data",
+      anari::newArray1D(device, blocks.data(), blocks.size()));
+  for (auto block : blocks)
+    anari::release(device, block);
+
+  anari_calls::commitParameters(device, field);
+  return field;
+}
+
+VolumeScene::VolumeScene(anari::Device device, int brickSize, bool verbose)
+    : m_device(device), m_brickSize(brickSize), m_verbose(verbose)
+{
+  anari::retain(m_device, m_device);
+
+  // transferFunction1D volume with the viewer's default color map; it has
+  // no field until one is set
+  m_volume = anari::newObject<anari::Volume>(m_device, "transferFunction1D");
+
+  std::vector<anari::math::float3> colors;
+  std::vector<float> opacities;
+
+  colors.emplace_back(0.f, 0.f, 1.f);
+  colors.emplace_back(0.f, 1.f, 0.f);
+  colors.emplace_back(1.f, 0.f, 0.f);
+
+  opacities.emplace_back(0.f);
+  opacities.emplace_back(1.f);
+
+  anari_calls::setAndReleaseParameter(m_device,
+      m_volume,
+      "color",
+      anari::newArray1D(m_device, colors.data(), colors.size()));
+  anari_calls::setAndReleaseParameter(m_device,
+      m_volume,
+      "opacity",
+      anari::newArray1D(m_device, opacities.data(), opacities.size()));
+  const float valueRange[2] = {0.f, 1.f};
+  anari_calls::setParameter(
+      m_device, m_volume, "valueRange", ANARI_FLOAT32_BOX1, valueRange);
+  anari_calls::commitParameters(m_device, m_volume);
+
+  m_world = anari::newObject<anari::World>(m_device);
+  anari_calls::setAndReleaseParameter(
+      m_device, m_world, "volume", anari::newArray1D(m_device, &m_volume));
+  anari_calls::commitParameters(m_device, m_world);
+}
+
+VolumeScene::~VolumeScene()
+{
+  releaseBackField();
+  for (auto &b : m_brickData)
+    anari::release(m_device, b.second);
+  anari::release(m_device, m_coarseData);
+  anari::release(m_device, m_data);
+  anari::release(m_device, m_field);
+  anari::release(m_device, m_volume);
+  anari::release(m_device, m_world);
+  anari::release(m_device, m_device);
+}
+
+anari::Device VolumeScene::device() const
+{
+  return m_device;
+}
+
+anari::World VolumeScene::world() const
+{
+  return m_world;
+}
+
+anari::Volume VolumeScene::volume() const
+{
+  return m_volume;
+}
+
+anari::SpatialField VolumeScene::field() const
+{
+  return m_field;
+}
+
+uint64_t VolumeScene::version() const
+{
+  return m_version;
+}
+
+void VolumeScene::markChanged()
+{
+  ++m_version;
+}
+
+void VolumeScene::setField(const StructuredField &input, bool zeroIsEmpty)
+{
+  const StructuredField data = clipped(input);
+  if (data.empty() || updateInPlace(data))
+    return;
+
+  const bool sameBox = m_field && m_dims[0] == data.dimX
+      && m_dims[1] == data.dimY && m_dims[2] == data.dimZ
+      && std::memcmp(m_origin, data.origin, sizeof(m_origin)) == 0
+      && std::memcmp(m_spacing, data.spacing, sizeof(m_spacing)) == 0;
+
+  anari::Array3D array{nullptr};
+  anari::SpatialField field{nullptr};
+  if (sparseFields(zeroIsEmpty)
+      || (m_brickSize > 0
+          && hasSubtype(m_device, ANARI_SPATIAL_FIELD, "amr")))
+    field = newField(data, zeroIsEmpty);
+  else
+    field = newStructuredField(m_device, data, &array);
+  replaceField(field, sameBox);
+  anari::release(m_device, field);
+
+  m_data = array;
+  m_dataType = cellType(data);
+  m_dims[0] = data.dimX;
+  m_dims[1] = data.dimY;
+  m_dims[2] = data.dimZ;
+  std::memcpy(m_origin, data.origin, sizeof(m_origin));
+  std::memcpy(m_spacing, data.spacing, sizeof(m_spacing));
+
+  const float valueRange[2] = {data.dataRange.x, data.dataRange.y};
+  setValueRange(valueRange);
+}
+
+void VolumeScene::setField(
+    anari::SpatialField field, const float valueRange[2], bool sameBox)
+{
+  if (field != m_field)
+    replaceField(field, sameBox && m_field != nullptr);
+  setValueRange(valueRange);
+}
+
+void VolumeScene::setValueRange(const float valueRange[2])
+{
+  anari_calls::setParameter(
+      m_device, m_volume, "valueRange", ANARI_FLOAT32_BOX1, valueRange);
+  anari_calls::commitParameters(m_device, m_volume);
+  ++m_version;
+}
+
+void VolumeScene::setStreamedField(BrickStream &stream)
+{
+  const auto &coarse = stream.coarseField();
+  if (!hasSubtype(m_device, ANARI_SPATIAL_FIELD, "amr")) {
+    static bool warned = false;
+    if (!warned)
+      fprintf(stderr, "Device has no \"amr\" field, showing the coarse level\n");
+    warned = true;
+    if (!m_field)
+      setField(coarse, false);
+    return;
+  }
+
+  TRACE_SCOPE("anari", "update streamed field");
+  const auto type = cellType(coarse);
+  const unsigned bpc = coarse.bytesPerCell;
+  if (!m_coarseData) {
+    m_coarseData = anari::newArray3D(
+        m_device, type, coarse.dimX, coarse.dimY, coarse.dimZ);
+    copyVoxels(anari::map<void>(m_device, m_coarseData), coarse);
+    anari::unmap(m_device, m_coarseData);
+  }
+
+  std::vector<int32_t> bounds = {
+      0, 0, 0, coarse.dimX - 1, coarse.dimY - 1, coarse.dimZ - 1};
+  std::vector<int32_t> levels = {1};
+  std::vector<anari::Array3D> blocks = {m_coarseData};
+
+  std::unordered_map<size_t, anari::Array3D> brickData;
+  for (auto &b : stream.residentBricks()) {
+    anari::Array3D block{nullptr};
+    auto it = m_brickData.find(b.index);
+    if (it != m_brickData.end()) {
+      block = it->second;
+      m_brickData.erase(it);
+    } else {
+      block = anari::newArray3D(m_device, type, b.dims[0], b.dims[1], b.dims[2]);
+      std::memcpy(anari::map<void>(m_device, block), b.data->data(),
+          size_t(b.dims[0]) * b.dims[1] * b.dims[2] * bpc);
+      anari::unmap(m_device, block);
+    }
+    brickData[b.index] = block;
+
+    for (int a = 0; a < 3; ++a)
+      bounds.push_back(b.origin[a]);
+    for (int a = 0; a < 3; ++a)
+      bounds.push_back(b.origin[a] + b.dims[a] - 1);
+    levels.push_back(0);
+    blocks.push_back(block);
+  }
+  // bricks that left the view (or the cache)
+  for (auto &b : m_brickData)
+    anari::release(m_device, b.second);
+  m_brickData = std::move(brickData);
+
+  const bool first = !m_streaming;
+  anari::SpatialField field =
+      first ? anari::newObject<anari::SpatialField>(m_device, "amr") : m_field;
+  const float gridOrigin[3] = {0.f, 0.f, 0.f};
+  const float gridSpacing[3] = {1.f, 1.f, 1.f};
+  anari_calls::setParameter(
+      m_device, field, "gridOrigin", ANARI_FLOAT32_VEC3, gridOrigin);
+  anari_calls::setParameter(
+      m_device, field, "gridSpacing", ANARI_FLOAT32_VEC3, gridSpacing);
+  const float cellWidth[2] = {1.f, float(stream.lodFactor())};
+  anari_calls::setAndReleaseParameter(
+      m_device, field, "cellWidth", anari::newArray1D(m_device, cellWidth, 2));
+  anari_calls::setAndReleaseParameter(m_device,
+      field,
+      "block.bounds",
+      anariNewArray1D(
+          m_device, bounds.data(), 0, 0, ANARI_INT32_BOX3, levels.size()));
+  anari_calls::setAndReleaseParameter(m_device,
+      field,
+      "block.level",
+      anari::newArray1D(m_device, levels.data(), levels.size()));
+  anari_calls::setAndReleaseParameter(m_device,
+      field,
+      "block.data",
+      anari::newArray1D(m_device, blocks.data(), blocks.size()));
+  anari_calls::commitParameters(m_device, field);
+  ++m_version;
+
+  if (first) {
+    replaceField(field, false);
+    anari::release(m_device, field);
+    m_streaming = true;
+    const float valueRange[2] = {coarse.dataRange.x, coarse.dataRange.y};
+    setValueRange(valueRange);
+  }
+}
+
+anari::SpatialField VolumeScene::newField(
+    const StructuredField &input, bool zeroIsEmpty) const
+{
+  const StructuredField data = clipped(input);
+  if (sparseFields(zeroIsEmpty)) {
+    auto grid = makeSparseGrid(data);
+    if (m_verbose && !grid.empty()) {
+      const size_t dense =
+          size_t(data.dimX) * data.dimY * data.dimZ * data.bytesPerCell;
+      printf("Sparse field: %zu voxels in %zu of %zu leaves, %zu of %zu KiB\n",
+          grid.activeVoxels,
+          grid.leaves,
+          grid.totalLeaves,
+          grid.buffer.size() >> 10,
+          dense >> 10);
+    }
+    if (!grid.empty())
+      return newSparseField(m_device, grid);
+  }
+
+  if (m_brickSize <= 0)
+    return newStructuredField(m_device, data, nullptr);
+
+  if (!hasSubtype(m_device, ANARI_SPATIAL_FIELD, "amr")) {
+    static bool warned = false;
+    if (!warned)
+      fprintf(stderr, "Device has no \"amr\" field, using the linear layout\n");
+    warned = true;
+    return newStructuredField(m_device, data, nullptr);
+  }
+
+  auto bricked = zeroIsEmpty ? makeBrickedField(data, m_brickSize, 1, 0.f)
+                             : makeBrickedField(data, m_brickSize, 1);
+  if (m_verbose) {
+    printf("Bricked field: %zu of %zu %d^3 bricks stored\n",
+        bricked.numStoredBricks(),
+        bricked.bricks.size(),
+        m_brickSize);
+  }
+  return newBrickedField(m_device, bricked);
+}
+
+void VolumeScene::setSparse(bool sparse)
+{
+  m_sparse = sparse;
+}
+
+void VolumeScene::setClip(const float lower[3], const float upper[3])
+{
+  m_clip = lower && upper;
+  if (m_clip) {
+    std::memcpy(m_clipLower, lower, sizeof(m_clipLower));
+    std::memcpy(m_clipUpper, upper, sizeof(m_clipUpper));
+  }
+}
+
+StructuredField VolumeScene::clipped(const StructuredField &data) const
+{
+  if (!m_clip || data.empty())
+    return data;
+  const CropBox box = clipBox(data, m_clipLower, m_clipUpper);
+  return box.empty() ? data : boxField(data, box);
+}
+
+bool VolumeScene::sparseFields(bool zeroIsEmpty) const
+{
+  if (!m_sparse || !zeroIsEmpty)
+    return false;
+  static bool warned = false;
+#ifdef HAVE_NANOVDB
+  if (hasSubtype(m_device, ANARI_SPATIAL_FIELD, "nanovdb"))
+    return true;
+  if (!warned)
+    fprintf(stderr, "Device has no \"nanovdb\" field, using dense fields\n");
+#else
+  if (!warned)
+    fprintf(stderr, "Built without NanoVDB, using dense fields\n");
+#endif
+  warned = true;
+  return false;
+}
+
+// Same box and cell type as the field the scene created and owns: only the
+// voxels (and the macrocells derived from them) change, the volume and world
+// keep their objects and the device its acceleration structures
+bool VolumeScene::canUpdateInPlace(const StructuredField &layout) const
+{
+  const int dims[3] = {layout.dimX, layout.dimY, layout.dimZ};
+  if (m_clip && !clipBox(layout, m_clipLower, m_clipUpper).covers(dims))
+    return false; // the field holds the box only
+  return m_data && cellType(layout) == m_dataType && m_dims[0] == layout.dimX
+      && m_dims[1] == layout.dimY && m_dims[2] == layout.dimZ
+      && std::memcmp(m_origin, layout.origin, sizeof(m_origin)) == 0
+      && std::memcmp(m_spacing, layout.spacing, sizeof(m_spacing)) == 0;
+}
+
+bool VolumeScene::updateInPlace(const StructuredField &data)
+{
+  void *dst = mapField(data);
+  if (!dst)
+    return false;
+  copyVoxels(dst, data);
+  unmapField(data);
+  return true;
+}
+
+void *VolumeScene::mapField(const StructuredField &layout)
+{
+  if (!canUpdateInPlace(layout))
+    return nullptr;
+  TRACE_SCOPE("anari", "map field");
+  return anari::map<void>(m_device, m_data);
+}
+
+void VolumeScene::unmapField(const StructuredField &layout)
+{
+  TRACE_SCOPE("anari", "unmap field");
+  anari::unmap(m_device, m_data);
+  setMacrocellParameters(m_device, m_field, layout);
+  anari_calls::commitParameters(m_device, m_field);
+  const float valueRange[2] = {layout.dataRange.x, layout.dataRange.y};
+  setValueRange(valueRange);
+}
+
+void *VolumeScene::mapBackField(const StructuredField &layout)
+{
+  if (m_backMapping)
+    return m_backMapping;
+  if (!canUpdateInPlace(layout))
+    return nullptr;
+  if (!m_backField) {
+    // geometry only, the voxels are written through the mapping
+    StructuredField shape;
+    shape.dimX = layout.dimX;
+    shape.dimY = layout.dimY;
+    shape.dimZ = layout.dimZ;
+    shape.bytesPerCell = layout.bytesPerCell;
+    shape.isHalf = layout.isHalf;
+    std::memcpy(shape.origin, layout.origin, sizeof(shape.origin));
+    std::memcpy(shape.spacing, layout.spacing, sizeof(shape.spacing));
+    m_backField = newStructuredField(m_device, shape, &m_backData);
+    m_backBytes = dataBytes(shape);
+  }
+  TRACE_SCOPE("anari", "map back field");
+  m_backMapping = anari::map<void>(m_device, m_backData);
+  return m_backMapping;
+}
+
+void VolumeScene::presentBackField(const StructuredField &layout)
+{
+  if (!m_backMapping)
+    return;
+  TRACE_SCOPE("anari", "present back field");
+  anari::unmap(m_device, m_backData);
+  m_backMapping = nullptr;
+  setMacrocellParameters(m_device, m_backField, layout);
+  anari_calls::commitParameters(m_device, m_backField);
+
+  std::swap(m_field, m_backField);
+  std::swap(m_data, m_backData);
+  anari_calls::setParameter(m_device, m_volume, "value", m_field);
+  anari_calls::setParameter(m_device, m_volume, "field", m_field);
+  anari_calls::commitParameters(m_device, m_volume);
+  ++m_version;
+}
+
+void VolumeScene::releaseBackField()
+{
+  if (m_backMapping)
+    anari::unmap(m_device, m_backData);
+  m_backMapping = nullptr;
+  anari::release(m_device, m_backData);
+  anari::release(m_device, m_backField);
+  m_backData = nullptr;
+  m_backField = nullptr;
+}
+
+size_t VolumeScene::backFieldBytes() const
+{
+  return m_backField ? m_backBytes : 0;
+}
+
+// The world only needs a commit when the volume's box may have changed
+void VolumeScene::replaceField(anari::SpatialField field, bool sameBox)
+{
+  releaseBackField();
+  anari::retain(m_device, field);
+  anari::release(m_device, m_field);
+  anari::release(m_device, m_data);
+  m_field = field;
+  m_data = nullptr;
+  m_streaming = false;
+
+  anari_calls::setParameter(m_device, m_volume, "value", m_field);
+  anari_calls::setParameter(m_device, m_volume, "field", m_field);
+  anari_calls::commitParameters(m_device, m_volume);
+  if (!sameBox)
+    anari_calls::commitParameters(m_device, m_world);
+  ++m_version;
+}
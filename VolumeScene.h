@@ -0,0 +1,136 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// anari
+#include <anari/anari_cpp.hpp>
+// std
+#include <cstdint>
+#include <unordered_map>
+// ours
+#include "BrickStream.h"
+#include "FieldTypes.h"
+
+// One world holding one transferFunction1D volume and the volume's spatial
+// field; the single place where the viewer, batch, benchmark and worker
+// modes turn a StructuredField into ANARI objects. World and volume live as
+// long as the scene. A new field with the dims and cell type of the current
+// one is written into the current field's data array (map, copy, unmap), so
+// LUT switches neither create objects nor recommit the world.
+class VolumeScene
+{
+ public:
+  // brickSize > 0 uploads "amr" fields of that brick size where the device
+  // has them (see newField())
+  VolumeScene(anari::Device device, int brickSize = 0, bool verbose = false);
+  ~VolumeScene();
+
+  VolumeScene(const VolumeScene &) = delete;
+  VolumeScene &operator=(const VolumeScene &) = delete;
+
+  anari::Device device() const;
+  anari::World world() const;
+  anari::Volume volume() const;
+  anari::SpatialField field() const; // null until a field was set
+  // Incremented by every change to the world's objects, so viewports know
+  // when to render; markChanged() for changes made around the scene (e.g.
+  // the volume's transfer function)
+  uint64_t version() const;
+  void markChanged();
+
+  // Makes `data` the volume's field and its data range the value range;
+  // zeroIsEmpty drops all-zero bricks of bricked fields (attenuation)
+  void setField(const StructuredField &data, bool zeroIsEmpty);
+
+  // Swaps in a field the caller keeps (e.g. one per LUT); pass sameBox =
+  // false for fields of another volume, so the world's bounds are updated.
+  // The scene holds its own reference and never writes into it.
+  void setField(anari::SpatialField field,
+      const float valueRange[2],
+      bool sameBox = true);
+
+  void setValueRange(const float valueRange[2]);
+
+  // In-place update without a host copy: pointer to the current field's
+  // voxels if `layout` (geometry and cell type, no voxels needed) matches
+  // it, null if the field has to be replaced through setField(). Any thread
+  // may fill the mapping; unmapField() then takes the macrocells and data
+  // range from `layout` and commits the field.
+  void *mapField(const StructuredField &layout);
+  void unmapField(const StructuredField &layout);
+
+  // Double buffering for time series: a second field of the current
+  // field's layout (same conditions as mapField()) whose voxels are written
+  // while the current one is shown. mapBackField() creates it on first use
+  // and returns the same mapping until presentBackField() unmaps it, sets
+  // the macrocells from `layout` and swaps the two fields on the volume; the
+  // value range is kept, so phases are shown with the same window. Any call
+  // replacing the field releases the back field: wait for writers first.
+  void *mapBackField(const StructuredField &layout);
+  void presentBackField(const StructuredField &layout);
+  void releaseBackField();
+  size_t backFieldBytes() const;
+
+  // Out-of-core volume as an "amr" field: the coarse level as level 1
+  // (cellWidth lodFactor) under one level-0 block per resident fine brick.
+  // Brick arrays persist across calls, so only newly resident bricks are
+  // uploaded. Devices without "amr" fields get the coarse level only.
+  void setStreamedField(BrickStream &stream);
+
+  // New field for `data` that is not part of the scene: sparse for
+  // attenuation (zeroIsEmpty) when the scene is sparse and the device has
+  // "nanovdb" fields, bricked when the scene has a brick size and the
+  // device "amr" fields, "structuredRegular" otherwise
+  anari::SpatialField newField(
+      const StructuredField &data, bool zeroIsEmpty) const;
+
+  // Attenuation fields as NanoVDB grids of their non-zero voxels (see
+  // SparseField.h), for mostly empty volumes
+  void setSparse(bool sparse);
+
+  // Clips the fields set from now on (setField(data), newField()) to the
+  // voxels inside the object-space box, so rays enter and leave at its
+  // faces and the device samples nothing outside it; null clears the clip.
+  // Boxes holding no voxel clip nothing. Fields already set, fields the
+  // caller keeps and streamed fields are not clipped: set them again.
+  void setClip(const float lower[3], const float upper[3]);
+
+ private:
+  bool sparseFields(bool zeroIsEmpty) const;
+  StructuredField clipped(const StructuredField &data) const;
+  bool canUpdateInPlace(const StructuredField &layout) const;
+  bool updateInPlace(const StructuredField &data);
+  void replaceField(anari::SpatialField field, bool sameBox);
+
+  anari::Device m_device{nullptr};
+  int m_brickSize{0};
+  bool m_sparse{false};
+  bool m_verbose{false};
+  bool m_clip{false};
+  float m_clipLower[3]{0.f, 0.f, 0.f};
+  float m_clipUpper[3]{0.f, 0.f, 0.f};
+  anari::World m_world{nullptr};
+  anari::Volume m_volume{nullptr};
+  anari::SpatialField m_field{nullptr};
+  uint64_t m_version{0};
+
+  // data array of m_field while the scene owns it and its memory is
+  // device-owned, i.e. while it can be rewritten in place
+  anari::Array3D m_data{nullptr};
+  anari::DataType m_dataType{ANARI_UNKNOWN};
+  int m_dims[3]{0, 0, 0};
+  float m_origin[3]{0.f, 0.f, 0.f};
+  float m_spacing[3]{0.f, 0.f, 0.f};
+
+  // the field (and its data array) not shown while double buffering
+  anari::SpatialField m_backField{nullptr};
+  anari::Array3D m_backData{nullptr};
+  void *m_backMapping{nullptr};
+  size_t m_backBytes{0};
+
+  // while m_field is the streamed "amr" field: its level arrays
+  bool m_streaming{false};
+  anari::Array3D m_coarseData{nullptr};
+  std::unordered_map<size_t, anari::Array3D> m_brickData;
+};
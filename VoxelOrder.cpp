@@ -0,0 +1,150 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "VoxelOrder.h"
+// std
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+// ours
+#include "Parallel.h"
+#include "Trace.h"
+#include "VolumeMemory.h"
+
+namespace {
+
+constexpr int BrickSize = 8;
+
+// Offsets of bricked voxels: within the brick, then the brick's
+void brickOffsets(const int dims[3], std::vector<size_t> offset[3])
+{
+  constexpr size_t brickCells = size_t(BrickSize) * BrickSize * BrickSize;
+  size_t brickStride = brickCells, cellStride = 1;
+  for (int a = 0; a < 3; ++a) {
+    const size_t numBricks = size_t(dims[a] + BrickSize - 1) / BrickSize;
+    offset[a].resize(size_t(dims[a]));
+    for (size_t v = 0; v < offset[a].size(); ++v) {
+      offset[a][v] =
+          v / BrickSize * brickStride + v % BrickSize * cellStride;
+    }
+    brickStride *= numBricks;
+    cellStride *= BrickSize;
+  }
+}
+
+// Offsets of Z-ordered voxels: bit b of each axis goes to the next free
+// output bit, axes in x, y, z order, for as long as the axis has bits
+void mortonOffsets(const int dims[3], std::vector<size_t> offset[3])
+{
+  int numBits[3];
+  for (int a = 0; a < 3; ++a) {
+    numBits[a] = 0;
+    while ((size_t(1) << numBits[a]) < size_t(dims[a]))
+      ++numBits[a];
+  }
+  int position[3][64];
+  int next = 0;
+  for (int b = 0; b < 64; ++b) {
+    for (int a = 0; a < 3; ++a) {
+      if (b < numBits[a])
+        position[a][b] = next++;
+    }
+  }
+  for (int a = 0; a < 3; ++a) {
+    offset[a].resize(size_t(dims[a]));
+    for (size_t v = 0; v < offset[a].size(); ++v) {
+      size_t o = 0;
+      for (int b = 0; b < numBits[a]; ++b)
+        o |= ((v >> b) & 1) << position[a][b];
+      offset[a][v] = o;
+    }
+  }
+}
+
+} // namespace
+
+bool parseVoxelOrder(const std::string &name, VoxelOrder &order)
+{
+  if (name == "linear")
+    order = VoxelOrder::Linear;
+  else if (name == "bricked")
+    order = VoxelOrder::Bricked;
+  else if (name == "morton")
+    order = VoxelOrder::Morton;
+  else
+    return false;
+  return true;
+}
+
+const char *voxelOrderName(VoxelOrder order)
+{
+  switch (order) {
+  case VoxelOrder::Bricked:
+    return "bricked";
+  case VoxelOrder::Morton:
+    return "morton";
+  default:
+    return "linear";
+  }
+}
+
+bool ReorderedVoxels::matches(const StructuredField &field) const
+{
+  return voxels && source == field.data() && dims[0] == field.dimX
+      && dims[1] == field.dimY && dims[2] == field.dimZ
+      && bytesPerCell == field.bytesPerCell;
+}
+
+size_t ReorderedVoxels::bytes() const
+{
+  // one past the last voxel's offset
+  if (offset[0].empty() || offset[1].empty() || offset[2].empty())
+    return 0;
+  return (offset[0].back() + offset[1].back() + offset[2].back() + 1)
+      * bytesPerCell;
+}
+
+ReorderedVoxels reorderVoxels(const StructuredField &field, VoxelOrder order)
+{
+  ReorderedVoxels reordered;
+  if (order == VoxelOrder::Linear || !field.data() || field.empty())
+    return reordered;
+
+  TRACE_SCOPE("volume", "reorder voxels");
+  reordered.order = order;
+  reordered.dims[0] = field.dimX;
+  reordered.dims[1] = field.dimY;
+  reordered.dims[2] = field.dimZ;
+  reordered.bytesPerCell = field.bytesPerCell;
+  reordered.source = field.data();
+  if (order == VoxelOrder::Bricked)
+    brickOffsets(reordered.dims, reordered.offset);
+  else
+    mortonOffsets(reordered.dims, reordered.offset);
+
+  // the padding cells stay zero, as allocated
+  auto buffer = allocateVolumeMemory(reordered.bytes());
+  auto *dst = static_cast<uint8_t *>(buffer.get());
+  const auto *src = static_cast<const uint8_t *>(field.data());
+  const size_t cell = field.bytesPerCell;
+  const auto &offset = reordered.offset;
+  parallelFor(
+      0,
+      size_t(field.dimZ),
+      [&](size_t begin, size_t end) {
+        for (size_t z = begin; z < end; ++z) {
+          for (size_t y = 0; y < size_t(field.dimY); ++y) {
+            const uint8_t *row =
+                src + ((z * field.dimY + y) * field.dimX) * cell;
+            const size_t base = offset[1][y] + offset[2][z];
+            for (size_t x = 0; x < size_t(field.dimX); ++x) {
+              std::memcpy(
+                  dst + (base + offset[0][x]) * cell, row + x * cell, cell);
+            }
+          }
+        }
+      },
+      1);
+  reordered.voxels = std::move(buffer);
+  return reordered;
+}
@@ -0,0 +1,63 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+// ours
+#include "FieldTypes.h"
+
+// Voxel orders for the host ray marchers /////////////////////////////////////
+//
+// StructuredField voxels are x fastest, so a ray that is not axis-aligned
+// touches a new cache line (and, across slices, a new page) with nearly
+// every sample, and neighbouring rays rarely share them. A reordered copy
+// keeps voxels that are close in space close in memory:
+//
+//   bricked: 8^3 voxel bricks one after another, bricks x fastest and the
+//            voxels x fastest within each (the dims rounded up to 8)
+//   morton:  Z order, the bits of x, y and z interleaved (each axis padded
+//            to a power of two, up to 8x the voxels for unlucky dims)
+//
+// Every order is separable by axis: voxel (x, y, z) sits at
+// offset[0][x] + offset[1][y] + offset[2][z], three table lookups per
+// voxel. The marchers (FirstHit.h) read the copy instead of the field's
+// buffer when FirstHitSettings::voxels points to one made from it.
+
+enum class VoxelOrder
+{
+  Linear, // the field's own
+  Bricked,
+  Morton,
+};
+
+// "linear", "bricked" or "morton"; false, leaving order untouched, on
+// anything else
+bool parseVoxelOrder(const std::string &name, VoxelOrder &order);
+const char *voxelOrderName(VoxelOrder order);
+
+struct ReorderedVoxels
+{
+  VoxelOrder order{VoxelOrder::Linear};
+  int dims[3]{0, 0, 0};
+  unsigned bytesPerCell{0};
+  std::vector<size_t> offset[3]; // per axis, in cells
+  std::shared_ptr<const void> voxels; // empty for Linear
+  const void *source{nullptr}; // the field's voxels it was made from
+
+  bool empty() const
+  {
+    return !voxels;
+  }
+  // Made from this field's current voxels
+  bool matches(const StructuredField &field) const;
+  size_t bytes() const;
+};
+
+// The field's voxels copied into `order` on all cores; empty for Linear and
+// for fields without voxels
+ReorderedVoxels reorderVoxels(const StructuredField &field, VoxelOrder order);
@@ -0,0 +1,140 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+// ours
+#include "FieldTypes.h"
+#include "Half.h"
+
+// Cell types of a StructuredField as C++ types, so kernels over voxels are
+// instantiated per type rather than branching on bytesPerCell (or on every
+// voxel): dispatchVoxelType() calls a generic lambda with the field's type,
+// whose loops then compile to plain typed code.
+//
+//   value()     the cell in render units: normalized for the integer types,
+//               as ANARI samples UFIXED8/16 fields
+//   count()     the stored number, in integer units for the integer types
+//   fromCount() count() back to a cell, rounded
+
+struct VoxelU8
+{
+  using Storage = uint8_t;
+  static constexpr bool exact = true; // every value has a bin of its own
+  static float value(Storage v)
+  {
+    return v / 255.f;
+  }
+  static float count(Storage v)
+  {
+    return float(v);
+  }
+  static Storage fromCount(float v)
+  {
+    return Storage(v + 0.5f);
+  }
+};
+
+struct VoxelU16
+{
+  using Storage = uint16_t;
+  static constexpr bool exact = true;
+  static float value(Storage v)
+  {
+    return v / 65535.f;
+  }
+  static float count(Storage v)
+  {
+    return float(v);
+  }
+  static Storage fromCount(float v)
+  {
+    return Storage(v + 0.5f);
+  }
+};
+
+// 2-byte cells with StructuredField::isHalf
+struct VoxelHalf
+{
+  using Storage = uint16_t;
+  static constexpr bool exact = false;
+  static float value(Storage v)
+  {
+    return halfToFloat(v);
+  }
+  static float count(Storage v)
+  {
+    return halfToFloat(v);
+  }
+  static Storage fromCount(float v)
+  {
+    return floatToHalf(v);
+  }
+};
+
+struct VoxelF32
+{
+  using Storage = float;
+  static constexpr bool exact = false;
+  static float value(Storage v)
+  {
+    return v;
+  }
+  static float count(Storage v)
+  {
+    return v;
+  }
+  static Storage fromCount(float v)
+  {
+    return v;
+  }
+};
+
+// Calls f(VoxelU8{}), f(VoxelU16{}), f(VoxelHalf{}) or f(VoxelF32{}) for
+// the cell type; false (without calling f) for an unknown one
+template <typename F>
+bool dispatchVoxelType(unsigned bytesPerCell, bool isHalf, F &&f)
+{
+  switch (bytesPerCell) {
+  case 1:
+    f(VoxelU8{});
+    return true;
+  case 2:
+    if (isHalf)
+      f(VoxelHalf{});
+    else
+      f(VoxelU16{});
+    return true;
+  case 4:
+    f(VoxelF32{});
+    return true;
+  default:
+    return false;
+  }
+}
+
+template <typename F>
+bool dispatchVoxelType(const StructuredField &field, F &&f)
+{
+  return dispatchVoxelType(
+      field.bytesPerCell, field.isHalf, std::forward<F>(f));
+}
+
+template <typename Voxel>
+const typename Voxel::Storage *voxelData(const StructuredField &field)
+{
+  return static_cast<const typename Voxel::Storage *>(field.data());
+}
+
+// Room for count cells of the type in a new buffer of the field, see
+// StructuredField::allocate()
+template <typename Voxel>
+typename Voxel::Storage *allocateVoxels(StructuredField &field, size_t count)
+{
+  return static_cast<typename Voxel::Storage *>(field.allocate(count));
+}
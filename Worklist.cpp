@@ -0,0 +1,72 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "Worklist.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// std
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+bool Worklist::load(const std::string &file)
+{
+  std::ifstream in(file);
+  if (!in) {
+    std::cerr << "ERROR: could not open worklist " << file << "\n";
+    return false;
+  }
+  const auto dir = std::filesystem::path(file).parent_path();
+  auto path = [&](const std::string &p) {
+    return p.empty() || std::filesystem::path(p).is_absolute()
+        ? p
+        : (dir / p).string();
+  };
+
+  std::vector<WorklistCase> cases;
+  try {
+    const auto data = nlohmann::json::parse(in);
+    for (const auto &c : data.at("cases")) {
+      WorklistCase entry;
+      entry.volume = path(c.at("volume").get<std::string>());
+      entry.predictions = path(c.value("predictions", std::string()));
+      entry.lutFile = path(c.value("lut", std::string()));
+      if (c.contains("lut_id"))
+        entry.lutId = c["lut_id"].get<size_t>();
+      entry.name = c.value("name",
+          std::filesystem::path(entry.volume).filename().string());
+      cases.push_back(std::move(entry));
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "ERROR: could not parse worklist " << file << ": "
+              << e.what() << "\n";
+    return false;
+  }
+  if (cases.empty()) {
+    std::cerr << "ERROR: worklist " << file << " has no cases\n";
+    return false;
+  }
+  m_file = file;
+  m_cases = std::move(cases);
+  return true;
+}
+
+size_t Worklist::size() const
+{
+  return m_cases.size();
+}
+
+bool Worklist::empty() const
+{
+  return m_cases.empty();
+}
+
+const WorklistCase &Worklist::at(size_t index) const
+{
+  return m_cases[index];
+}
+
+const std::string &Worklist::file() const
+{
+  return m_file;
+}
@@ -0,0 +1,50 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cases of a QA session /////////////////////////////////////////////////////
+//
+// The cases an operator goes through in one viewer session: per case a
+// volume with its predictions (and through them its reference images),
+// optionally with a LUT file and LUT of its own. The file is JSON, with
+// paths relative to its directory:
+//
+//   {"cases": [{"name": "case 12", "volume": "ct/12.nii.gz",
+//               "predictions": "ct/12.json", "lut": "lac.json",
+//               "lut_id": 2}]}
+//
+// The viewer starts with the first case and switches between cases in
+// the session, reading the next case ahead while the current one is
+// worked on.
+
+struct WorklistCase
+{
+  std::string name; // default: the volume's file name
+  std::string volume;
+  std::string predictions; // empty: none
+  std::string lutFile; // empty: the command line's
+  size_t lutId{SIZE_MAX}; // SIZE_MAX: the command line's
+};
+
+class Worklist
+{
+ public:
+  // False, with a message, if the file cannot be read or has no cases
+  bool load(const std::string &file);
+
+  size_t size() const;
+  bool empty() const;
+  const WorklistCase &at(size_t index) const;
+  const std::string &file() const;
+
+ private:
+  std::string m_file;
+  std::vector<WorklistCase> m_cases;
+};
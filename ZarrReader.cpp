@@ -0,0 +1,655 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ZarrReader.h"
+// nlohmann
+#include <nlohmann/json.hpp>
+// posix
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <thread>
+// compression
+#ifdef HAVE_BLOSC
+#include <blosc.h>
+#endif
+// ours
+#include "Decompress.h"
+#include "Trace.h"
+
+namespace {
+
+enum class Fetch
+{
+  Ok,
+  Missing, // no such key: a chunk of fill values
+  Failed
+};
+
+// One HTTP/1.1 connection, kept alive across requests
+class HttpConnection
+{
+ public:
+  HttpConnection(std::string host, int port)
+      : m_host(std::move(host)), m_port(port)
+  {}
+
+  ~HttpConnection()
+  {
+    disconnect();
+  }
+
+  Fetch get(const std::string &path, std::vector<uint8_t> &body)
+  {
+    // a connection the server closed meanwhile fails once, then reconnects
+    for (int attempt = 0; attempt < 2; ++attempt) {
+      if (m_socket < 0 && !connect())
+        return Fetch::Failed;
+      int status = 0;
+      if (request(path, status, body)) {
+        if (status == 200)
+          return Fetch::Ok;
+        if (status == 404)
+          return Fetch::Missing;
+        std::cerr << "HTTP " << status << " for http://" << m_host << ":"
+                  << m_port << path << '\n';
+        return Fetch::Failed;
+      }
+      disconnect();
+    }
+    std::cerr << "Could not fetch http://" << m_host << ":" << m_port << path
+              << '\n';
+    return Fetch::Failed;
+  }
+
+ private:
+  bool connect()
+  {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    const auto service = std::to_string(m_port);
+    if (getaddrinfo(m_host.c_str(), service.c_str(), &hints, &result) != 0) {
+      std::cerr << "Could not resolve " << m_host << '\n';
+      return false;
+    }
+    for (auto *ai = result; ai && m_socket < 0; ai = ai->ai_next) {
+      int s = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (s < 0)
+        continue;
+      if (::connect(s, ai->ai_addr, ai->ai_addrlen) == 0)
+        m_socket = s;
+      else
+        close(s);
+    }
+    freeaddrinfo(result);
+    if (m_socket < 0)
+      return false;
+    timeval timeout{30, 0};
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    m_buffer.clear();
+    return true;
+  }
+
+  void disconnect()
+  {
+    if (m_socket >= 0)
+      close(m_socket);
+    m_socket = -1;
+    m_buffer.clear();
+  }
+
+  // Until the buffer holds n bytes; false if the connection ends first
+  bool fill(size_t n)
+  {
+    char data[64 << 10];
+    while (m_buffer.size() < n) {
+      const ssize_t got = ::recv(m_socket, data, sizeof(data), 0);
+      if (got <= 0)
+        return false;
+      m_buffer.append(data, size_t(got));
+    }
+    return true;
+  }
+
+  bool readLine(std::string &line)
+  {
+    size_t end;
+    while ((end = m_buffer.find("\r\n")) == std::string::npos) {
+      if (!fill(m_buffer.size() + 1))
+        return false;
+    }
+    line = m_buffer.substr(0, end);
+    m_buffer.erase(0, end + 2);
+    return true;
+  }
+
+  bool take(size_t n, std::vector<uint8_t> &body)
+  {
+    if (!fill(n))
+      return false;
+    body.insert(body.end(), m_buffer.begin(), m_buffer.begin() + n);
+    m_buffer.erase(0, n);
+    return true;
+  }
+
+  bool request(
+      const std::string &path, int &status, std::vector<uint8_t> &body)
+  {
+    const std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + m_host
+        + "\r\nConnection: keep-alive\r\n\r\n";
+    if (::send(m_socket, request.data(), request.size(), MSG_NOSIGNAL)
+        != ssize_t(request.size()))
+      return false;
+
+    std::string line;
+    if (!readLine(line)
+        || std::sscanf(line.c_str(), "HTTP/%*s %d", &status) != 1)
+      return false;
+    size_t length = std::numeric_limits<size_t>::max();
+    bool chunked = false, keepAlive = true;
+    while (readLine(line) && !line.empty()) {
+      std::transform(line.begin(), line.end(), line.begin(), ::tolower);
+      if (line.rfind("content-length:", 0) == 0)
+        length = std::strtoull(line.c_str() + 15, nullptr, 10);
+      else if (line.rfind("transfer-encoding:", 0) == 0)
+        chunked = line.find("chunked") != std::string::npos;
+      else if (line.rfind("connection:", 0) == 0)
+        keepAlive = line.find("close") == std::string::npos;
+    }
+    if (!line.empty())
+      return false;
+
+    body.clear();
+    if (chunked) {
+      for (;;) {
+        if (!readLine(line))
+          return false;
+        const size_t size = std::strtoull(line.c_str(), nullptr, 16);
+        if (size == 0)
+          break;
+        if (!take(size, body) || !readLine(line))
+          return false;
+      }
+      while (readLine(line) && !line.empty()) // trailers
+        ;
+    } else if (length != std::numeric_limits<size_t>::max()) {
+      if (!take(length, body))
+        return false;
+    } else {
+      // the body ends with the connection
+      while (fill(m_buffer.size() + 1))
+        ;
+      body.assign(m_buffer.begin(), m_buffer.end());
+      keepAlive = false;
+    }
+    if (!keepAlive)
+      disconnect();
+    return true;
+  }
+
+  std::string m_host;
+  int m_port{80};
+  int m_socket{-1};
+  std::string m_buffer; // received, not consumed yet
+};
+
+// Keys of a store: files in a directory or objects behind an http:// URL;
+// one per thread
+class Store
+{
+ public:
+  explicit Store(const std::string &store) : m_root(store)
+  {
+    const std::string scheme = "http://";
+    if (store.rfind(scheme, 0) != 0)
+      return;
+    const size_t slash = store.find('/', scheme.size());
+    std::string host = store.substr(scheme.size(), slash - scheme.size());
+    m_root = slash == std::string::npos ? "" : store.substr(slash);
+    int port = 80;
+    const size_t colon = host.rfind(':');
+    if (colon != std::string::npos) {
+      port = std::atoi(host.c_str() + colon + 1);
+      host.resize(colon);
+    }
+    m_http = std::make_unique<HttpConnection>(host, port);
+  }
+
+  bool remote() const
+  {
+    return m_http != nullptr;
+  }
+
+  Fetch fetch(const std::string &key, std::vector<uint8_t> &data)
+  {
+    const std::string path = m_root + "/" + key;
+    if (m_http)
+      return m_http->get(path, data);
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+      return std::filesystem::exists(path) ? Fetch::Failed : Fetch::Missing;
+    data.assign(std::istreambuf_iterator<char>(in), {});
+    return in.bad() ? Fetch::Failed : Fetch::Ok;
+  }
+
+ private:
+  std::string m_root;
+  std::unique_ptr<HttpConnection> m_http;
+};
+
+enum class Codec
+{
+  None,
+  Zlib, // zlib or gzip
+  Zstd,
+  Blosc
+};
+
+// .zarray, with the axes reversed to x, y, z
+struct ArrayInfo
+{
+  size_t rank{0};
+  int dims[3]{1, 1, 1};
+  int chunks[3]{1, 1, 1};
+  itk::ImageIOBase::IOComponentType type{
+      itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE};
+  size_t itemSize{0};
+  bool bigEndian{false};
+  Codec codec{Codec::None};
+  double fillValue{0.0};
+  std::string separator{"."};
+};
+
+bool parseArray(
+    const std::vector<uint8_t> &text, const std::string &name, ArrayInfo &info)
+{
+  try {
+    const auto array = nlohmann::json::parse(text);
+    if (array.at("zarr_format").get<int>() != 2) {
+      std::cerr << name << ": only Zarr v2 arrays are supported\n";
+      return false;
+    }
+    const auto shape = array.at("shape").get<std::vector<int64_t>>();
+    const auto chunks = array.at("chunks").get<std::vector<int64_t>>();
+    info.rank = shape.size();
+    if (info.rank == 0 || chunks.size() != info.rank) {
+      std::cerr << name << ": bad shape or chunks\n";
+      return false;
+    }
+    for (size_t a = 0; a < std::min<size_t>(3, info.rank); ++a) {
+      info.dims[a] = int(shape[info.rank - 1 - a]);
+      info.chunks[a] = int(std::max<int64_t>(1, chunks[info.rank - 1 - a]));
+    }
+    if (array.value("order", std::string("C")) != "C") {
+      std::cerr << name << ": only C ordered arrays are supported\n";
+      return false;
+    }
+    if (array.contains("filters") && !array["filters"].is_null()
+        && !array["filters"].empty()) {
+      std::cerr << name << ": Zarr filters are not supported\n";
+      return false;
+    }
+
+    const std::string dtype = array.at("dtype").get<std::string>();
+    info.bigEndian = !dtype.empty() && dtype[0] == '>';
+    const std::string kind = dtype.substr(dtype.empty() ? 0 : 1);
+    static const struct
+    {
+      const char *name;
+      itk::ImageIOBase::IOComponentType type;
+      size_t size;
+    } types[] = {{"u1", itk::IOComponentEnum::UCHAR, 1},
+        {"i1", itk::IOComponentEnum::CHAR, 1},
+        {"u2", itk::IOComponentEnum::USHORT, 2},
+        {"i2", itk::IOComponentEnum::SHORT, 2},
+        {"u4", itk::IOComponentEnum::UINT, 4},
+        {"i4", itk::IOComponentEnum::INT, 4},
+        {"f4", itk::IOComponentEnum::FLOAT, 4},
+        {"f8", itk::IOComponentEnum::DOUBLE, 8}};
+    for (const auto &t : types) {
+      if (kind == t.name) {
+        info.type = t.type;
+        info.itemSize = t.size;
+      }
+    }
+    if (!info.itemSize) {
+      std::cerr << name << ": unsupported dtype " << dtype << '\n';
+      return false;
+    }
+
+    const auto &compressor = array.at("compressor");
+    const std::string id =
+        compressor.is_null() ? "" : compressor.at("id").get<std::string>();
+    if (id.empty())
+      info.codec = Codec::None;
+    else if (id == "zlib" || id == "gzip")
+      info.codec = Codec::Zlib;
+    else if (id == "zstd")
+      info.codec = Codec::Zstd;
+    else if (id == "blosc")
+      info.codec = Codec::Blosc;
+    else {
+      std::cerr << name << ": unsupported compressor " << id << '\n';
+      return false;
+    }
+
+    const auto &fill = array.value("fill_value", nlohmann::json());
+    if (fill.is_number())
+      info.fillValue = fill.get<double>();
+    else if (fill.is_string() && fill.get<std::string>() == "NaN")
+      info.fillValue = std::numeric_limits<double>::quiet_NaN();
+    info.separator = array.value("dimension_separator", std::string("."));
+  } catch (const std::exception &e) {
+    std::cerr << "could not parse " << name << ": " << e.what() << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool canDecode(Codec codec)
+{
+  switch (codec) {
+  case Codec::Zlib:
+    return canDecompress(Compression::Gzip);
+  case Codec::Zstd:
+    return canDecompress(Compression::Zstd);
+  case Codec::Blosc:
+#ifdef HAVE_BLOSC
+    return true;
+#else
+    return false;
+#endif
+  default:
+    return true;
+  }
+}
+
+bool decodeChunk(
+    Codec codec, const std::vector<uint8_t> &src, std::vector<uint8_t> &dst)
+{
+  switch (codec) {
+  case Codec::Zlib:
+    return decompressBuffer(
+        Compression::Gzip, src.data(), src.size(), dst.data(), dst.size());
+  case Codec::Zstd:
+    return decompressBuffer(
+        Compression::Zstd, src.data(), src.size(), dst.data(), dst.size());
+#ifdef HAVE_BLOSC
+  case Codec::Blosc:
+    return blosc_decompress_ctx(src.data(), dst.data(), dst.size(), 1)
+        == int(dst.size());
+#endif
+  case Codec::None:
+    return decompressBuffer(
+        Compression::None, src.data(), src.size(), dst.data(), dst.size());
+  default:
+    return false;
+  }
+}
+
+std::string joinKey(const std::string &path, const std::string &key)
+{
+  return path.empty() ? key : path + "/" + key;
+}
+
+} // namespace
+
+bool ZarrReader::isZarr(const std::string &name)
+{
+  auto endsWith = [&](const std::string &suffix) {
+    return name.size() >= suffix.size()
+        && name.compare(name.size() - suffix.size(), suffix.size(), suffix)
+        == 0;
+  };
+  return name.rfind("http://", 0) == 0 || name.rfind("https://", 0) == 0
+      || endsWith(".zarr") || endsWith(".zarr/");
+}
+
+bool ZarrReader::open(const std::string &store)
+{
+  m_store = store;
+  while (m_store.size() > 1 && m_store.back() == '/')
+    m_store.pop_back();
+  m_levels.clear();
+  if (m_store.rfind("https://", 0) == 0) {
+    std::cerr << "cannot read " << store
+              << ": https is not supported, use the store's http endpoint\n";
+    return false;
+  }
+
+  Store s(m_store);
+  std::vector<uint8_t> text;
+  if (s.fetch(".zarray", text) == Fetch::Ok) {
+    m_levels.emplace_back();
+    return true;
+  }
+  if (s.fetch(".zattrs", text) != Fetch::Ok) {
+    std::cerr << "no Zarr array or OME-Zarr group at " << store << '\n';
+    return false;
+  }
+
+  // OME-Zarr: the first multiscale's datasets, each with its voxel size and
+  // offset (the last three entries of its scale and translation); those of
+  // the multiscale as a whole apply on top
+  auto transform = [](const nlohmann::json &owner,
+                       float spacing[3],
+                       float origin[3]) {
+    if (!owner.contains("coordinateTransformations"))
+      return false;
+    bool scaled = false;
+    for (const auto &t : owner["coordinateTransformations"]) {
+      const std::string type = t.value("type", std::string());
+      if (type != "scale" && type != "translation")
+        continue;
+      const auto v = t.at(type).get<std::vector<float>>();
+      for (size_t a = 0; a < std::min<size_t>(3, v.size()); ++a) {
+        const float x = v[v.size() - 1 - a];
+        if (type == "scale") {
+          spacing[a] *= x;
+          origin[a] *= x;
+        } else {
+          origin[a] += x;
+        }
+      }
+      scaled = scaled || type == "scale";
+    }
+    return scaled;
+  };
+  try {
+    const auto attrs = nlohmann::json::parse(text);
+    const auto &multiscale = attrs.at("multiscales").at(0);
+    bool scaled = true;
+    for (const auto &dataset : multiscale.at("datasets")) {
+      ZarrLevel level;
+      level.path = dataset.at("path").get<std::string>();
+      scaled = transform(dataset, level.spacing, level.origin) && scaled;
+      transform(multiscale, level.spacing, level.origin);
+      m_levels.push_back(level);
+    }
+    if (!scaled && m_levels.size() > 1) {
+      // before OME-Zarr 0.4: levels carry no voxel size, derive it from the
+      // levels' shapes
+      int dims0[3] = {1, 1, 1};
+      for (size_t l = 0; l < m_levels.size(); ++l) {
+        ArrayInfo info;
+        const auto key = joinKey(m_levels[l].path, ".zarray");
+        if (s.fetch(key, text) != Fetch::Ok || !parseArray(text, key, info))
+          return false;
+        for (int a = 0; a < 3; ++a) {
+          if (l == 0)
+            dims0[a] = info.dims[a];
+          m_levels[l].spacing[a] = float(dims0[a]) / float(info.dims[a]);
+        }
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "could not parse OME-Zarr metadata of " << store << ": "
+              << e.what() << '\n';
+    m_levels.clear();
+    return false;
+  }
+  if (m_levels.empty())
+    std::cerr << "no levels in OME-Zarr group " << store << '\n';
+  return !m_levels.empty();
+}
+
+size_t ZarrReader::numLevels() const
+{
+  return m_levels.size();
+}
+
+bool ZarrReader::read(size_t levelIndex, NiftiReader &volume) const
+{
+  if (levelIndex >= m_levels.size())
+    return false;
+  TRACE_SCOPE("volume", "read Zarr");
+  const auto start = std::chrono::steady_clock::now();
+  const ZarrLevel &level = m_levels[levelIndex];
+
+  Store store(m_store);
+  std::vector<uint8_t> text;
+  const std::string arrayKey = joinKey(level.path, ".zarray");
+  ArrayInfo info;
+  if (store.fetch(arrayKey, text) != Fetch::Ok) {
+    std::cerr << "cannot read " << m_store << "/" << arrayKey << '\n';
+    return false;
+  }
+  if (!parseArray(text, arrayKey, info))
+    return false;
+  if (!canDecode(info.codec)) {
+    std::cerr << "cannot read " << m_store
+              << ": its compressor is not supported by this build\n";
+    return false;
+  }
+
+  const CropBox box = volume.regionOf(info.dims);
+  const int boxDims[3] = {box.dim(0), box.dim(1), box.dim(2)};
+  float origin[3];
+  for (int a = 0; a < 3; ++a)
+    origin[a] = level.origin[a] + box.lower[a] * level.spacing[a];
+  volume.setVolume(info.type, boxDims, level.spacing, origin);
+  volume.readRegion = box;
+
+  // the chunks overlapping the box, x fastest
+  std::vector<std::array<int, 3>> chunks;
+  int first[3], last[3];
+  for (int a = 0; a < 3; ++a) {
+    first[a] = box.lower[a] / info.chunks[a];
+    last[a] = box.upper[a] / info.chunks[a];
+  }
+  for (int z = first[2]; z <= last[2]; ++z) {
+    for (int y = first[1]; y <= last[1]; ++y) {
+      for (int x = first[0]; x <= last[0]; ++x)
+        chunks.push_back({x, y, z});
+    }
+  }
+
+  const size_t chunkBytes = size_t(info.chunks[0]) * info.chunks[1]
+      * info.chunks[2] * info.itemSize;
+  std::atomic<size_t> next{0}, fetchedBytes{0};
+  std::atomic<bool> ok{true};
+  auto worker = [&]() {
+    Store local(m_store);
+    std::vector<uint8_t> encoded, decoded(chunkBytes);
+    for (size_t i = next++; i < chunks.size() && ok; i = next++) {
+      const auto &c = chunks[i];
+      // leading axes at index 0, then z, y, x as far as the array has them
+      std::string key;
+      for (size_t a = info.rank; a-- > 0;) {
+        key += a < 3 ? std::to_string(c[a]) : "0";
+        if (a > 0)
+          key += info.separator;
+      }
+      key = joinKey(level.path, key);
+
+      const Fetch fetched = local.fetch(key, encoded);
+      if (fetched == Fetch::Failed) {
+        ok = false;
+        break;
+      }
+      if (fetched == Fetch::Missing) {
+        dispatchComponentType(info.type, [&](auto tag) {
+          using T = decltype(tag);
+          std::fill_n(reinterpret_cast<T *>(decoded.data()),
+              decoded.size() / sizeof(T),
+              T(info.fillValue));
+        });
+      } else {
+        fetchedBytes += encoded.size();
+        if (!decodeChunk(info.codec, encoded, decoded)) {
+          std::cerr << "cannot decode chunk " << key << " of " << m_store
+                    << '\n';
+          ok = false;
+          break;
+        }
+        if (info.bigEndian && info.itemSize > 1) {
+          for (size_t b = 0; b < decoded.size(); b += info.itemSize)
+            std::reverse(&decoded[b], &decoded[b] + info.itemSize);
+        }
+      }
+
+      // the chunk's rows inside the box (edge chunks are stored padded)
+      int c0[3], lo[3], hi[3];
+      for (int a = 0; a < 3; ++a) {
+        c0[a] = c[a] * info.chunks[a];
+        lo[a] = std::max(c0[a], box.lower[a]);
+        hi[a] = std::min(c0[a] + info.chunks[a] - 1, box.upper[a]);
+      }
+      const size_t row = size_t(hi[0] - lo[0] + 1) * info.itemSize;
+      for (int z = lo[2]; z <= hi[2]; ++z) {
+        for (int y = lo[1]; y <= hi[1]; ++y) {
+          const size_t from =
+              (size_t(z - c0[2]) * info.chunks[1] + (y - c0[1]))
+                  * info.chunks[0]
+              + (lo[0] - c0[0]);
+          const size_t to =
+              (size_t(z - box.lower[2]) * boxDims[1] + (y - box.lower[1]))
+                  * boxDims[0]
+              + (lo[0] - box.lower[0]);
+          std::memcpy(volume.voxels.data() + to * info.itemSize,
+              decoded.data() + from * info.itemSize,
+              row);
+        }
+      }
+    }
+  };
+
+  // remote chunks wait on the network: more workers than cores
+  const size_t numThreads = std::min(chunks.size(),
+      store.remote() ? std::max<size_t>(1, connections)
+                     : std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < numThreads; ++t)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &t : threads)
+    t.join();
+  if (!ok)
+    return false;
+
+  const double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start)
+                             .count();
+  std::cout << "Read Zarr level " << levelIndex << " of " << m_store << ": ["
+            << boxDims[0] << ", " << boxDims[1] << ", " << boxDims[2]
+            << "], spacing [" << level.spacing[0] << ", " << level.spacing[1]
+            << ", " << level.spacing[2] << "], " << chunks.size()
+            << " chunks, " << fetchedBytes / (1 << 20) << " MiB in "
+            << seconds << " s\n";
+  return true;
+}
@@ -0,0 +1,53 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+// ours
+#include "readNifti.h"
+
+// Chunked volumes in object storage ////////////////////////////////////////
+//
+// Zarr v2 arrays, or OME-Zarr multiscale groups of them, in a local
+// directory or behind an http:// URL (an object store's endpoint or any web
+// server). Every chunk is an object of its own, so only the chunks wanted
+// are transferred: those overlapping the NiftiReader's selectRegion. They
+// are fetched on a pool of keep-alive connections, decompressed on the same
+// workers and copied straight into the reader's voxel buffer; cropping and
+// the LAC conversion then work as for NIfTI files. Missing chunks hold the
+// array's fill value.
+//
+// Codecs: zlib, gzip and zstd (with the libraries CMake found) and blosc
+// (with c-blosc). Arrays are C ordered with z, y, x as their last three
+// axes; leading axes (time, channel) are read at index 0.
+
+struct ZarrLevel
+{
+  std::string path; // of the array, relative to the store
+  float spacing[3]{1.f, 1.f, 1.f}; // x, y, z
+  float origin[3]{0.f, 0.f, 0.f};
+};
+
+class ZarrReader
+{
+ public:
+  // A .zarr directory or an http(s) URL
+  static bool isZarr(const std::string &name);
+
+  // Reads the store's metadata: one array, or the levels of an OME-Zarr
+  // group, finest first
+  bool open(const std::string &store);
+  size_t numLevels() const;
+
+  // Reads a level (0: full resolution) into volume.voxels
+  bool read(size_t level, NiftiReader &volume) const;
+
+  size_t connections{16}; // chunks in flight
+
+ private:
+  std::string m_store;
+  std::vector<ZarrLevel> m_levels;
+};
@@ -1,128 +1,224 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
 #pragma once
 
+// std
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <vector>
+#include <iterator>
+#include <limits>
+
+// Built-in LAC LUTs /////////////////////////////////////////////////////////
+//
+// The LUTs of the LacLuts.json shipped next to the viewer, compiled in, so
+// a missing LUT file falls back to them without parsing anything. Each is
+// an array of breakpoint densities, ascending, and one of their LACs.
+// denseLacTable() evaluates one at every int16 density; in a constant
+// expression (LacTransform.cpp) the compiler does that, and the tables are
+// read-only data of the binary.
+
+namespace builtin_lac {
+
+// densities of the 13-14 keV LUTs
+inline constexpr float g_density[] = {0,
+    21,
+    282,
+    443,
+    909,
+    911,
+    970,
+    1016,
+    1027,
+    1029,
+    1113,
+    1114,
+    1143,
+    1228,
+    1301,
+    1329,
+    1571,
+    2034,
+    2516};
+
+inline constexpr float g_lac13000eV[] = {0.0f,
+    0.000289f,
+    0.0747f,
+    0.11205f,
+    0.13708f,
+    0.09568f,
+    0.18216f,
+    0.153f,
+    0.230945f,
+    0.159355f,
+    0.17135f,
+    0.29268f,
+    0.1888f,
+    0.3744f,
+    0.5544f,
+    1.06485f,
+    0.90852f,
+    1.6224f,
+    2.484f};
+
+inline constexpr float g_lac13500eV[] = {0.0f,
+    0.00026f,
+    0.0672f,
+    0.1008f,
+    0.1242f,
+    0.087492f,
+    0.16434f,
+    0.13872f,
+    0.207955f,
+    0.14413f,
+    0.1514f,
+    0.26244f,
+    0.1711f,
+    0.33813f,
+    0.4984f,
+    0.958365f,
+    0.8174f,
+    1.45704f,
+    2.244f};
+
+inline constexpr float g_lac14000eV[] = {0.0f,
+    0.000235f,
+    0.0609f,
+    0.09135f,
+    0.11316f,
+    0.080224f,
+    0.14949f,
+    0.12648f,
+    0.1881f,
+    0.130935f,
+    0.1403f,
+    0.2376f,
+    0.15576f,
+    0.30537f,
+    0.45024f,
+    0.864475f,
+    0.73834f,
+    1.31508f,
+    2.02f};
+
+// Hounsfield units, and HU + 1024 for volumes stored shifted
+inline constexpr float g_densityHu[] = {-1024,
+    -800,
+    -69,
+    25,
+    49,
+    100,
+    200,
+    243,
+    261,
+    494,
+    878,
+    1313,
+    3000};
 
-enum tube_potential
+inline constexpr float g_densityHuShifted[] = {0,
+    224,
+    955,
+    1049,
+    1073,
+    1124,
+    1224,
+    1267,
+    1285,
+    1518,
+    1902,
+    2337,
+    4024};
+
+inline constexpr float g_lac120000eV[] = {0.0f,
+    0.2f,
+    0.928f,
+    1.0f,
+    1.047f,
+    1.073f,
+    1.078f,
+    1.086f,
+    1.102f,
+    1.278f,
+    1.47f,
+    1.695f,
+    2.592f};
+
+} // namespace builtin_lac
+
+struct BuiltinLacLut
 {
-    TB13000EV = 0,
-    TB13500EV = 1,
-    TB14000EV = 2,
-    TB120000EV = 3
+  const char *name;
+  size_t eV;
+  const float *density;
+  const float *lac;
+  size_t numPoints;
 };
 
-struct lut_entry { ssize_t density; float lac; };
-
-std::vector<std::vector<lut_entry>> LAC_LUT = {
-    { // 13000 eV
-        {0,    0.0},
-        {21,   0.000289},
-        {282,  0.0747},
-        {443,  0.11205},
-        {909,  0.13708},
-        {911,  0.09568},   
-        {970,  0.18216},
-        {1016, 0.153},
-        {1027, 0.230945},
-        {1029, 0.159355},
-        {1113, 0.17135},
-        {1114, 0.29268},
-        {1143, 0.1888},
-        {1228, 0.3744},
-        {1301, 0.5544},
-        {1329, 1.06485},
-        {1571, 0.90852},
-        {2034, 1.6224},
-        {2516, 2.484}
-    },
-    { // 13500 eV
-        {0,    0.0},
-        {21,   0.00026},
-        {282,  0.0672},
-        {443,  0.1008},
-        {909,  0.1242},
-        {911,  0.087492},
-        {970,  0.16434},
-        {1016, 0.13872},
-        {1027, 0.207955},
-        {1029, 0.14413},
-        {1113, 0.1514},
-        {1114, 0.26244},
-        {1143, 0.1711},
-        {1228, 0.33813},
-        {1301, 0.4984},
-        {1329, 0.958365},
-        {1571, 0.8174},
-        {2034, 1.45704},
-        {2516, 2.244}
-    },
-    { // 14000 eV
-        {0,    0.0},
-        {21,   0.000235},
-        {282,  0.0609},
-        {443,  0.09135},
-        {909,  0.11316},
-        {911,  0.080224},
-        {970,  0.14949},
-        {1016, 0.12648},
-        {1027, 0.1881},
-        {1029, 0.130935},
-        {1113, 0.1403},
-        {1114, 0.2376},
-        {1143, 0.15576},
-        {1228, 0.30537},
-        {1301, 0.45024},
-        {1329, 0.864475},
-        {1571, 0.73834},
-        {2034, 1.31508},
-        {2516, 2.02}
-    },
-    { // 120000 eV
-        {-1024, 0.00},
-        {-800, 0.200},
-        {-69,  0.928},
-        {25,   1.000},
-        {49,   1.047},
-        {100,  1.073},
-        {200,  1.078},
-        {243,  1.086},
-        {261,  1.102},
-        {494,  1.278},
-        {878,  1.470},
-        {1313, 1.695},
-        {3000, 2.592}
-//        {0,    0.0},
-//        {1024-800, 0.200},
-//        {1024-69,  0.928},
-//        {1024+25,   1.000},
-//        {1024+49,   1.047},
-//        {1024+100,  1.073},
-//        {1024+200,  1.078},
-//        {1024+243,  1.086},
-//        {1024+261,  1.102},
-//        {1024+494,  1.278},
-//        {1024+878,  1.470},
-//        {1024+1313, 1.695},
-//        {1024+3000, 2.592}
-    }
-};
+inline constexpr BuiltinLacLut g_builtinLacLuts[] = {
+    {"13000eV",
+        13000,
+        builtin_lac::g_density,
+        builtin_lac::g_lac13000eV,
+        std::size(builtin_lac::g_density)},
+    {"13500eV",
+        13500,
+        builtin_lac::g_density,
+        builtin_lac::g_lac13500eV,
+        std::size(builtin_lac::g_density)},
+    {"14000eV",
+        14000,
+        builtin_lac::g_density,
+        builtin_lac::g_lac14000eV,
+        std::size(builtin_lac::g_density)},
+    {"120000eV",
+        120000,
+        builtin_lac::g_densityHu,
+        builtin_lac::g_lac120000eV,
+        std::size(builtin_lac::g_densityHu)},
+    {"120000eV-shifted",
+        120000,
+        builtin_lac::g_densityHuShifted,
+        builtin_lac::g_lac120000eV,
+        std::size(builtin_lac::g_densityHuShifted)}};
 
+// LAC at a density, linear between the n breakpoints, clamped to their
+// range; NaN clamps to the lowest. The step of the search is selected, not
+// branched on, so it costs log2(n) compares whatever the data.
+// LacReader::interpolate() is this over a LUT's arrays.
+constexpr float interpolateLac(
+    const float *density, const float *lac, size_t n, float x)
+{
+  if (n < 2)
+    return n ? lac[0] : 0.f;
+  x = x > density[0] ? x : density[0];
+  x = x < density[n - 1] ? x : density[n - 1];
 
-float attenuation_lookup(ssize_t density, tube_potential tb/*, size_t& count_below_0, size_t& count_above_2516*/) {
-    if (density < LAC_LUT[tb].front().density)
-    {
-//        ++count_below_0;
-        density = LAC_LUT[tb].front().density;
-    }
-    else if (density > LAC_LUT[tb].back().density)
-    {
-//        ++count_above_2516;
-        density = LAC_LUT[tb].back().density;
-    }
-    const auto pos = find_if(LAC_LUT[tb].begin(), LAC_LUT[tb].end(),
-            [density](lut_entry elem){return elem.density > density;}
-            );
-    const auto previous = pos - 1;
-    return previous->lac + (density - previous->density) / (pos->density - previous->density) * (pos->lac - previous->lac);
+  // last segment starting at or below x
+  size_t first = 0, count = n - 1;
+  while (count > 1) {
+    const size_t half = count / 2;
+    first += density[first + half] <= x ? half : 0;
+    count -= half;
+  }
+  const float width = density[first + 1] - density[first];
+  const float t = width > 0.f ? (x - density[first]) / width : 1.f;
+  return lac[first] + t * (lac[first + 1] - lac[first]);
 }
 
+// LAC for every int16 density, indexed by (density - INT16_MIN), as
+// LacLut::dense
+using DenseLacTable = std::array<float, size_t(1) << 16>;
+
+constexpr DenseLacTable denseLacTable(const BuiltinLacLut &lut)
+{
+  DenseLacTable table{};
+  constexpr int32_t minDensity = std::numeric_limits<int16_t>::min();
+  constexpr int32_t maxDensity = std::numeric_limits<int16_t>::max();
+  for (int32_t d = minDensity; d <= maxDensity; ++d) {
+    table[size_t(d - minDensity)] =
+        interpolateLac(lut.density, lut.lac, lut.numPoints, float(d));
+  }
+  return table;
+}
@@ -1,10 +1,20 @@
 #pragma once
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <exception>
 #include <fstream>
 #include <iostream>
 #include <string>
-//#include <vector>
+#include <vector>
 
 #include <nlohmann/json.hpp>
 
@@ -35,15 +45,36 @@ inline std::ostream& operator<<(std::ostream& os, const prediction& p)
 }
 
 
+// Binary prediction files (*.pred) //////////////////////////////////////////
+//
+// A header, then one record per pose: eye, center and up as 9 floats, the
+// file name's length and the name, padded to 4 bytes. Loading maps the file
+// and copies the records, nothing is parsed. Appends write the records past
+// the last counted one and only then update the count, so a reader (or a
+// crashed writer) never sees a partial record.
+
+struct prediction_file_header
+{
+    char magic[4]{'P', 'R', 'E', 'D'};
+    uint32_t version{1};
+    float fovx{0.f}, fovy{0.f};
+    uint64_t count{0};
+};
+
 struct prediction_container
 {
     std::vector<prediction> predictions;
-    float fovx, fovy;
+    float fovx{0.f}, fovy{0.f};
+    // optional in the sensor block: the detector's pixel grid and its
+    // intrinsics matrix (row-major, principal point from the top left);
+    // zero where not given
+    size_t sensor_width{0}, sensor_height{0};
+    std::array<float, 9> intrinsics{};
 
     prediction_container() {}
-    prediction_container(std::string json_filename)
+    prediction_container(std::string filename)
     {
-        load_json(json_filename);
+        load(filename);
     }
 
     prediction& operator [](size_t idx) { return predictions[idx]; }
@@ -53,6 +84,20 @@ struct prediction_container
     auto end() { return predictions.end(); }
     const auto end() const { return predictions.end(); }
 
+    // Binary prediction file or JSON, by the file's first bytes
+    bool load(std::string filename)
+    {
+        return is_binary(filename) ? load_binary(filename) : load_json(filename);
+    }
+
+    static bool is_binary(const std::string& filename)
+    {
+        char magic[4]{};
+        std::ifstream file(filename, std::ios::binary);
+        return file.read(magic, sizeof(magic))
+            && std::memcmp(magic, prediction_file_header().magic, sizeof(magic)) == 0;
+    }
+
     bool load_json(std::string json_filename)
     {
         std::ifstream json_file(json_filename);
@@ -62,34 +107,174 @@ struct prediction_container
             return false;
         }
         predictions.clear();
-        std::cout << "Loading predictions:\n";
         try
         {
             nlohmann::json data = nlohmann::json::parse(json_file);
 
-            fovx = data["sensor"]["fov_x_rad"];
-            fovy = data["sensor"]["fov_y_rad"];
-            std::cout << "fovx: " << fovx << "\n";
-            std::cout << "fovy: " << fovy << "\n";
-
+            read_sensor(data["sensor"]);
             for (auto& p : data["predictions"])
-            {
-                predictions.push_back(prediction(
-                    p["file"],
-                    p["eye"]["x"], p["eye"]["y"], p["eye"]["z"],
-                    p["center"]["x"], p["center"]["y"], p["center"]["z"],
-                    p["up"]["x"], p["up"]["y"], p["up"]["z"]
-                ));
-                std::cout << predictions.back() << "\n";
-            }
+                predictions.push_back(from_json(p));
         } catch (...)
         {
             std::cerr << "ERROR: Could not parse json file.\n" << std::endl;
             return false;
         }
+        std::cout << "Loaded " << predictions.size() << " predictions (fovx: "
+                  << fovx << ", fovy: " << fovy << ")\n";
         return true;
     }
 
+    // The fov, detector grid and intrinsics of a "sensor" block
+    void read_sensor(const nlohmann::json& sensor)
+    {
+        fovx = sensor.at("fov_x_rad");
+        fovy = sensor.at("fov_y_rad");
+        sensor_width = sensor.value("width", size_t(0));
+        sensor_height = sensor.value("height", size_t(0));
+        intrinsics = {};
+        if (sensor.contains("intrinsics"))
+        {
+            // 3 rows of 3 or 9 values
+            size_t i = 0;
+            for (auto& k : sensor["intrinsics"])
+                for (auto& v : k.is_array() ? k : nlohmann::json::array({k}))
+                    if (i < intrinsics.size())
+                        intrinsics[i++] = v;
+        }
+    }
+
+    // One entry of the "predictions" array; throws if it is incomplete
+    static prediction from_json(const nlohmann::json& p)
+    {
+        return prediction(
+            p.at("file"),
+            p.at("eye").at("x"), p.at("eye").at("y"), p.at("eye").at("z"),
+            p.at("center").at("x"), p.at("center").at("y"), p.at("center").at("z"),
+            p.at("up").at("x"), p.at("up").at("y"), p.at("up").at("z"));
+    }
+
+    bool load_binary(std::string filename)
+    {
+        predictions.clear();
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            std::cerr << "ERROR: Could not open prediction file: " << filename << "\n" << std::strerror(errno) << std::endl;
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        const size_t size = size_t(st.st_size);
+        void* ptr = size >= sizeof(prediction_file_header)
+            ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+            : MAP_FAILED;
+        close(fd);
+        if (ptr == MAP_FAILED)
+        {
+            std::cerr << "ERROR: Could not map prediction file: " << filename << std::endl;
+            return false;
+        }
+
+        const auto* bytes = static_cast<const char*>(ptr);
+        prediction_file_header header;
+        std::memcpy(&header, bytes, sizeof(header));
+        size_t end = sizeof(header);
+        bool ok = header.version == 1 && walk(bytes, size, header.count, end,
+            [&](const float* pose, const std::string& name) {
+                predictions.push_back(prediction(name,
+                    pose[0], pose[1], pose[2], pose[3], pose[4], pose[5],
+                    pose[6], pose[7], pose[8]));
+            });
+        munmap(ptr, size);
+        if (!ok)
+        {
+            std::cerr << "ERROR: Corrupt prediction file: " << filename << std::endl;
+            predictions.clear();
+            return false;
+        }
+        fovx = header.fovx;
+        fovy = header.fovy;
+        sensor_width = sensor_height = 0;
+        intrinsics = {};
+        std::cout << "Loaded " << predictions.size() << " predictions (fovx: "
+                  << fovx << ", fovy: " << fovy << ")\n";
+        return true;
+    }
+
+    // Writes all predictions as a new binary file
+    bool write_binary(std::string filename) const
+    {
+        std::remove(filename.c_str());
+        return append_binary(filename, predictions.begin(), predictions.end(), fovx, fovy);
+    }
+
+    // Appends poses to a binary file, creating it (with the given fov) if
+    // needed; poses of a live pipeline can be appended while viewers load
+    // the file
+    template <typename It>
+    static bool append_binary(std::string filename, It first, It last, float fovx_, float fovy_)
+    {
+        int fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            std::cerr << "ERROR: Could not open prediction file: " << filename << "\n" << std::strerror(errno) << std::endl;
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+
+        prediction_file_header header;
+        header.fovx = fovx_;
+        header.fovy = fovy_;
+        size_t end = sizeof(header);
+        bool ok = true;
+        if (st.st_size == 0)
+            ok = write_at(fd, 0, &header, sizeof(header));
+        else
+        {
+            // skip the counted records; anything after them is an
+            // interrupted append and gets overwritten
+            const size_t size = size_t(st.st_size);
+            void* ptr = size >= sizeof(header)
+                ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+                : MAP_FAILED;
+            ok = ptr != MAP_FAILED;
+            if (ok)
+            {
+                const auto* bytes = static_cast<const char*>(ptr);
+                std::memcpy(&header, bytes, sizeof(header));
+                ok = std::memcmp(header.magic, prediction_file_header().magic, 4) == 0
+                    && header.version == 1
+                    && walk(bytes, size, header.count, end, [](const float*, const std::string&) {});
+                munmap(ptr, size);
+            }
+        }
+
+        std::vector<char> records;
+        uint64_t count = header.count;
+        for (It it = first; ok && it != last; ++it, ++count)
+        {
+            const prediction& p = *it;
+            const float pose[9] = {p.eye.x, p.eye.y, p.eye.z,
+                p.center.x, p.center.y, p.center.z, p.up.x, p.up.y, p.up.z};
+            const uint32_t length = uint32_t(p.filename.size());
+            const size_t offset = records.size();
+            records.resize(offset + sizeof(pose) + sizeof(length) + padded(length), 0);
+            std::memcpy(records.data() + offset, pose, sizeof(pose));
+            std::memcpy(records.data() + offset + sizeof(pose), &length, sizeof(length));
+            std::memcpy(records.data() + offset + sizeof(pose) + sizeof(length), p.filename.data(), length);
+        }
+        ok = ok && write_at(fd, end, records.data(), records.size())
+            && ftruncate(fd, off_t(end + records.size())) == 0
+            && write_at(fd, offsetof(prediction_file_header, count), &count, sizeof(count));
+        close(fd);
+        if (!ok)
+            std::cerr << "ERROR: Could not append to prediction file: " << filename << std::endl;
+        return ok;
+    }
+
     bool load_json(std::string json_filename, float& fovx_, float& fovy_)
     {
         auto retval = load_json(json_filename);
@@ -100,4 +285,44 @@ struct prediction_container
         }
         return retval;
     }
+
+private:
+    static size_t padded(size_t n) { return (n + 3) & ~size_t(3); }
+
+    static bool write_at(int fd, size_t offset, const void* data, size_t size)
+    {
+        const auto* bytes = static_cast<const char*>(data);
+        while (size > 0)
+        {
+            const ssize_t n = pwrite(fd, bytes, size, off_t(offset));
+            if (n <= 0)
+                return false;
+            bytes += n;
+            offset += size_t(n);
+            size -= size_t(n);
+        }
+        return true;
+    }
+
+    // Calls func for `count` records from `offset`, which ends up past the
+    // last one; false if the file ends early
+    template <typename Func>
+    static bool walk(const char* bytes, size_t size, uint64_t count, size_t& offset, Func&& func)
+    {
+        float pose[9];
+        uint32_t length;
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            if (size - offset < sizeof(pose) + sizeof(length))
+                return false;
+            std::memcpy(pose, bytes + offset, sizeof(pose));
+            std::memcpy(&length, bytes + offset + sizeof(pose), sizeof(length));
+            offset += sizeof(pose) + sizeof(length);
+            if (size - offset < padded(length))
+                return false;
+            func(pose, std::string(bytes + offset, length));
+            offset += padded(length);
+        }
+        return true;
+    }
 };
@@ -0,0 +1,247 @@
+# Copyright 2024 Matthias Hellmann
+# SPDX-License-Identifier: Apache-2.0
+
+"""In-process DRR rendering through libanariDRR (see DrrAPI.h).
+
+    scene = anari_drr.Scene("ct.nii.gz", width=512, height=512)
+    scene.set_lut(2)
+    for index, color, origin in scene.render(poses):
+        ...
+
+Images are handed out zero-copy: host images as NumPy arrays over the
+mapped ANARI frame (torch.from_numpy() and DLPack consumers take them
+without a copy), device images as objects with __cuda_array_interface__
+(torch.as_tensor(image, device="cuda"), CuPy). They are valid only until
+the next image is taken; copy what must outlive that. Rows are bottom
+first, as ANARI maps them; image[::-1] flips them without a copy.
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+import numpy as np
+
+DRR_API_VERSION = 1
+DRR_MEMORY_HOST = 0
+DRR_NEXT_DEVICE_POINTERS = 1
+
+
+class _SceneDesc(ctypes.Structure):
+    _fields_ = [
+        ("library", ctypes.c_char_p),
+        ("volume_file", ctypes.c_char_p),
+        ("dims", ctypes.c_int32 * 3),
+        ("bytes_per_cell", ctypes.c_uint32),
+        ("lut_file", ctypes.c_char_p),
+        ("lut", ctypes.c_uint32),
+        ("width", ctypes.c_uint32),
+        ("height", ctypes.c_uint32),
+        ("fovy", ctypes.c_float),
+        ("renderer", ctypes.c_char_p),
+        ("frames_in_flight", ctypes.c_uint32),
+        ("with_origin", ctypes.c_uint32),
+        ("gpu", ctypes.c_int32),
+    ]
+
+
+class _Pose(ctypes.Structure):
+    _fields_ = [
+        ("eye", ctypes.c_float * 3),
+        ("center", ctypes.c_float * 3),
+        ("up", ctypes.c_float * 3),
+        ("fovy", ctypes.c_float),
+    ]
+
+
+class _Image(ctypes.Structure):
+    _fields_ = [
+        ("index", ctypes.c_uint64),
+        ("color", ctypes.c_void_p),
+        ("origin", ctypes.c_void_p),
+        ("width", ctypes.c_uint32),
+        ("height", ctypes.c_uint32),
+        ("color_memory", ctypes.c_uint32),
+        ("origin_memory", ctypes.c_uint32),
+    ]
+
+
+def _load_library():
+    path = os.environ.get("ANARI_DRR_LIBRARY")
+    if not path:
+        here = os.path.dirname(os.path.abspath(__file__))
+        for candidate in (os.path.join(here, "libanariDRR.so"),
+                          os.path.join(here, "..", "libanariDRR.so")):
+            if os.path.exists(candidate):
+                path = candidate
+                break
+    lib = ctypes.CDLL(path or ctypes.util.find_library("anariDRR")
+                      or "libanariDRR.so")
+
+    lib.drr_api_version.restype = ctypes.c_uint32
+    lib.drr_last_error.restype = ctypes.c_char_p
+    lib.drr_default_desc.argtypes = [ctypes.POINTER(_SceneDesc)]
+    lib.drr_create.argtypes = [ctypes.POINTER(_SceneDesc)]
+    lib.drr_create.restype = ctypes.c_void_p
+    lib.drr_destroy.argtypes = [ctypes.c_void_p]
+    lib.drr_num_luts.argtypes = [ctypes.c_void_p]
+    lib.drr_num_luts.restype = ctypes.c_size_t
+    lib.drr_lut_name.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.drr_lut_name.restype = ctypes.c_char_p
+    lib.drr_set_lut.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.drr_set_energy.argtypes = [ctypes.c_void_p, ctypes.c_float]
+    lib.drr_submit.argtypes = [ctypes.c_void_p, ctypes.POINTER(_Pose),
+                               ctypes.c_size_t]
+    lib.drr_next.argtypes = [ctypes.c_void_p, ctypes.POINTER(_Image),
+                             ctypes.c_uint32]
+    lib.drr_release.argtypes = [ctypes.c_void_p]
+
+    if lib.drr_api_version() != DRR_API_VERSION:
+        raise RuntimeError("libanariDRR API version %d, expected %d"
+                           % (lib.drr_api_version(), DRR_API_VERSION))
+    return lib
+
+
+_lib = None
+
+
+def _library():
+    global _lib
+    if _lib is None:
+        _lib = _load_library()
+    return _lib
+
+
+def _error():
+    return RuntimeError(_library().drr_last_error().decode())
+
+
+class DeviceImage:
+    """Mapped device memory, for consumers of __cuda_array_interface__."""
+
+    def __init__(self, pointer, shape, typestr):
+        self.shape = shape
+        self.__cuda_array_interface__ = {
+            "shape": shape,
+            "typestr": typestr,
+            "data": (pointer, True),
+            "version": 3,
+        }
+
+
+def _view(pointer, memory, shape, ctype, typestr):
+    if not pointer:
+        return None
+    if memory != DRR_MEMORY_HOST:
+        return DeviceImage(pointer, shape, typestr)
+    array = np.ctypeslib.as_array(
+        ctypes.cast(pointer, ctypes.POINTER(ctype)), shape=shape)
+    array.flags.writeable = False
+    return array
+
+
+class Scene:
+    """A volume resident on one ANARI device and a renderer over it."""
+
+    def __init__(self, volume_file, width=1024, height=1024, fovy=None,
+                 lut=0, lut_file=None, dims=None, bytes_per_cell=0,
+                 library=None, renderer=None, frames_in_flight=3,
+                 with_origin=True, gpu=-1):
+        lib = _library()
+        desc = _SceneDesc()
+        lib.drr_default_desc(ctypes.byref(desc))
+        desc.volume_file = os.fsencode(volume_file)
+        desc.width, desc.height = width, height
+        if fovy:
+            desc.fovy = fovy
+        desc.lut = lut
+        if lut_file:
+            desc.lut_file = os.fsencode(lut_file)
+        if dims:
+            desc.dims[:] = list(dims)
+        desc.bytes_per_cell = bytes_per_cell
+        if library:
+            desc.library = library.encode()
+        if renderer:
+            desc.renderer = renderer.encode()
+        desc.frames_in_flight = frames_in_flight
+        desc.with_origin = 1 if with_origin else 0
+        desc.gpu = gpu
+        # the strings above stay referenced by desc during the call
+        self._scene = lib.drr_create(ctypes.byref(desc))
+        if not self._scene:
+            raise _error()
+
+    def close(self):
+        if self._scene:
+            _library().drr_destroy(self._scene)
+            self._scene = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def luts(self):
+        lib = _library()
+        return [lib.drr_lut_name(self._scene, i).decode()
+                for i in range(lib.drr_num_luts(self._scene))]
+
+    def set_lut(self, lut):
+        if not _library().drr_set_lut(self._scene, lut):
+            raise _error()
+
+    def set_energy(self, photon_energy):
+        """Photon energy in keV."""
+        if not _library().drr_set_energy(self._scene, photon_energy):
+            raise _error()
+
+    def submit(self, poses):
+        """Queues poses: (N, 9) or (N, 10) arrays of eye, center, up (and
+        fovy in radians), or sequences of such rows."""
+        poses = np.ascontiguousarray(poses, dtype=np.float32)
+        if poses.ndim == 1:
+            poses = poses[None]
+        if poses.shape[1] == 9:
+            poses = np.hstack([poses, np.zeros((len(poses), 1), np.float32)])
+        if poses.shape[1] != 10:
+            raise ValueError("poses must have 9 or 10 values per row")
+        batch = poses.ctypes.data_as(ctypes.POINTER(_Pose))
+        if not _library().drr_submit(self._scene, batch, len(poses)):
+            raise _error()
+
+    def next(self, device=False):
+        """(index, color, origin) of the oldest queued pose, None once the
+        queue is empty. color is (H, W, 4) uint8, origin (H, W, 3) float32
+        or None; both are released by the next call."""
+        image = _Image()
+        flags = DRR_NEXT_DEVICE_POINTERS if device else 0
+        result = _library().drr_next(self._scene, ctypes.byref(image), flags)
+        if result == 0:
+            return None
+        if result < 0:
+            raise _error()
+        h, w = image.height, image.width
+        color = _view(image.color, image.color_memory, (h, w, 4),
+                      ctypes.c_uint8, "|u1")
+        origin = _view(image.origin, image.origin_memory, (h, w, 3),
+                       ctypes.c_float, "<f4")
+        return image.index, color, origin
+
+    def release(self):
+        """Releases the last image early, so its frame renders again."""
+        _library().drr_release(self._scene)
+
+    def render(self, poses, device=False):
+        """Renders a batch, yielding (index, color, origin) per pose in
+        order while the next poses render."""
+        self.submit(poses)
+        while True:
+            image = self.next(device)
+            if image is None:
+                return
+            yield image
@@ -0,0 +1,210 @@
+# Copyright 2024 Matthias Hellmann
+# SPDX-License-Identifier: Apache-2.0
+
+"""External matcher side of the viewer's frame ring (--frame-ring <name>,
+layout in FrameRingLayout.h).
+
+    ring = frame_ring.FrameRing("drr")
+    for frame in ring.frames():
+        pose = estimate(frame.color, frame.origin, ring.reference())
+        if frame.still_valid():
+            ring.reply(frame, pose)  # (eye, center, up) or None
+
+Images are NumPy arrays over the shared memory, without a copy; rows are
+bottom first as rendered. They may be overwritten once the viewer moves
+on, which still_valid() tells after the fact: copy what must be kept.
+"""
+
+import ctypes
+import mmap
+import os
+import time
+
+import numpy as np
+
+FRAME_RING_MAGIC = 0x46525244
+FRAME_RING_VERSION = 1
+FRAME_RING_MAX_SLOTS = 8
+PIXEL_RGBA8 = 0
+PIXEL_FLOAT3 = 1
+
+
+class _Image(ctypes.Structure):
+    _fields_ = [
+        ("offset", ctypes.c_uint64),
+        ("capacity", ctypes.c_uint64),
+        ("width", ctypes.c_uint64),
+        ("height", ctypes.c_uint64),
+        ("row_stride", ctypes.c_uint64),
+        ("pixel_type", ctypes.c_uint32),
+        ("flags", ctypes.c_uint32),
+    ]
+
+
+class _Slot(ctypes.Structure):
+    _fields_ = [
+        ("sequence", ctypes.c_uint64),
+        ("has_origin", ctypes.c_uint32),
+        ("reserved", ctypes.c_uint32),
+        ("fovy", ctypes.c_float),
+        ("aspect", ctypes.c_float),
+        ("eye", ctypes.c_float * 3),
+        ("center", ctypes.c_float * 3),
+        ("up", ctypes.c_float * 3),
+        ("color", _Image),
+        ("origin", _Image),
+    ]
+
+
+class _Header(ctypes.Structure):
+    _fields_ = [
+        ("magic", ctypes.c_uint32),
+        ("version", ctypes.c_uint32),
+        ("num_slots", ctypes.c_uint32),
+        ("retired", ctypes.c_uint32),
+        ("segment_bytes", ctypes.c_uint64),
+        ("viewer_pid", ctypes.c_uint64),
+        ("frame_sequence", ctypes.c_uint64),
+        ("reference_sequence", ctypes.c_uint64),
+        ("reference", _Image),
+        ("slots", _Slot * FRAME_RING_MAX_SLOTS),
+        ("consumer_pid", ctypes.c_uint64),
+        ("reading_frame", ctypes.c_uint64),
+        ("result_frame", ctypes.c_uint64),
+        ("result_valid", ctypes.c_int32),
+        ("reserved", ctypes.c_uint32),
+        ("eye", ctypes.c_float * 3),
+        ("center", ctypes.c_float * 3),
+        ("up", ctypes.c_float * 3),
+    ]
+
+
+class Frame:
+    """One published frame: color (H x W x 4 uint8), origin (H x W x 3
+    float32 or None) and the pose and camera it was rendered with."""
+
+    def __init__(self, ring, slot, sequence):
+        self._ring = ring
+        self._slot = slot
+        self.sequence = sequence
+        self.fovy = slot.fovy
+        self.aspect = slot.aspect
+        self.eye = tuple(slot.eye)
+        self.center = tuple(slot.center)
+        self.up = tuple(slot.up)
+        self.swizzle = bool(slot.color.flags & 1)
+        self.color = ring._array(slot.color)
+        self.origin = ring._array(slot.origin) if slot.has_origin else None
+
+    def still_valid(self):
+        return (not self._ring._header.retired
+                and self._slot.sequence == self.sequence)
+
+
+class FrameRing:
+    def __init__(self, name):
+        self._name = name if name.startswith("/") else "/" + name
+        self._map = None
+        self._reference_sequence = 0
+        self._reference = None
+        self._open()
+
+    def _open(self):
+        self.close()
+        for _ in range(100):  # the viewer may just be replacing it
+            try:
+                fd = os.open("/dev/shm" + self._name, os.O_RDWR)
+                break
+            except FileNotFoundError:
+                time.sleep(0.05)
+        else:
+            raise FileNotFoundError("no frame ring " + self._name)
+        try:
+            self._map = mmap.mmap(fd, os.fstat(fd).st_size)
+        finally:
+            os.close(fd)
+        self._header = _Header.from_buffer(self._map)
+        if (self._header.magic != FRAME_RING_MAGIC
+                or self._header.version != FRAME_RING_VERSION):
+            raise RuntimeError("%s is not a frame ring of version %d"
+                               % (self._name, FRAME_RING_VERSION))
+        self._header.consumer_pid = os.getpid()
+        self._reference_sequence = 0
+
+    def close(self):
+        if self._map is not None:
+            self._header.consumer_pid = 0
+            del self._header
+            try:
+                self._map.close()
+            except BufferError:
+                pass  # arrays of earlier frames still map it
+            self._map = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def _array(self, image):
+        if not image.width:
+            return None
+        if image.pixel_type == PIXEL_FLOAT3:
+            dtype, channels = np.float32, 3
+        else:
+            dtype, channels = np.uint8, 4
+        array = np.frombuffer(self._map, dtype=dtype,
+                              count=image.width * image.height * channels,
+                              offset=image.offset)
+        return array.reshape(image.height, image.width, channels)
+
+    def next(self, after=0, timeout=None):
+        """The newest frame with a sequence above `after`, or None once
+        timeout seconds passed."""
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            if self._header.retired:
+                self._open()
+            sequence = self._header.frame_sequence
+            if sequence > after:
+                self._header.reading_frame = sequence
+                for i in range(self._header.num_slots):
+                    slot = self._header.slots[i]
+                    if slot.sequence == sequence:
+                        return Frame(self, slot, sequence)
+                continue  # replaced meanwhile: take the next one
+            if deadline is not None and time.monotonic() > deadline:
+                return None
+            time.sleep(0.0005)
+
+    def frames(self):
+        sequence = 0
+        while True:
+            frame = self.next(sequence)
+            sequence = frame.sequence
+            yield frame
+
+    def reference(self):
+        """The viewer's reference image (copied once per reference), or
+        None if it has none."""
+        header = self._header
+        sequence = header.reference_sequence
+        if sequence and sequence != self._reference_sequence:
+            reference = self._array(header.reference)
+            reference = None if reference is None else reference.copy()
+            if header.reference_sequence == sequence:
+                self._reference = reference
+                self._reference_sequence = sequence
+        return self._reference
+
+    def reply(self, frame, pose):
+        """pose: (eye, center, up) for the frame, or None if none was
+        estimated."""
+        header = self._header
+        if header.retired:
+            return
+        header.result_valid = 0 if pose is None else 1
+        if pose is not None:
+            header.eye[:], header.center[:], header.up[:] = pose
+        header.result_frame = frame.sequence
@@ -0,0 +1,213 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+// ITK
+#include <itkGDCMImageIO.h>
+#include <itkGDCMSeriesFileNames.h>
+// ours
+#include "Parallel.h"
+#include "readDicom.h"
+#include "ResourceUsage.h"
+#include "Trace.h"
+
+bool DicomReader::isSeries(const std::string &path)
+{
+  std::error_code ec;
+  return std::filesystem::is_directory(path, ec);
+}
+
+bool DicomReader::open(const char *directory, NiftiReader &volume)
+{
+  if (!isSeries(directory))
+    return false;
+
+  TRACE_SCOPE("volume", "read DICOM");
+  std::cout << "Reading DICOM series... ";
+
+  auto names = itk::GDCMSeriesFileNames::New();
+  names->SetUseSeriesDetails(true);
+  names->SetDirectory(directory);
+  const auto &uids = names->GetSeriesUIDs();
+  if (uids.empty()) {
+    std::cerr << "no DICOM series in " << directory << '\n';
+    return false;
+  }
+  if (uids.size() > 1)
+    std::cout << "(" << uids.size() << " series, using the first) ";
+  seriesUID = uids.front();
+  std::vector<std::string> files = names->GetFileNames(seriesUID);
+  numSlices = files.size();
+  if (files.empty())
+    return false;
+
+  // geometry and pixel type from the first slice
+  auto first = itk::GDCMImageIO::New();
+  first->SetFileName(files.front());
+  first->ReadImageInformation();
+  const auto type = first->GetComponentType();
+  if (first->GetNumberOfComponents() != 1
+      || !dispatchComponentType(type, [](auto) {})) {
+    std::cerr << "unsupported DICOM pixel type: "
+              << itk::ImageIOBase::GetComponentTypeAsString(type) << '\n';
+    return false;
+  }
+
+  // Slices go in order of their ImagePositionPatient along the slice
+  // normal, the cross product of the row and column directions; file names
+  // need not follow it
+  double normal[3] = {0.0, 0.0, 1.0};
+  const auto row = first->GetDirection(0);
+  const auto column = first->GetDirection(1);
+  if (row.size() >= 3 && column.size() >= 3) {
+    normal[0] = row[1] * column[2] - row[2] * column[1];
+    normal[1] = row[2] * column[0] - row[0] * column[2];
+    normal[2] = row[0] * column[1] - row[1] * column[0];
+  }
+  struct Slice
+  {
+    std::string file;
+    double position; // along the normal
+    float origin[3];
+  };
+  std::vector<Slice> slices(files.size());
+  parallelFor(
+      0,
+      files.size(),
+      [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          auto io = itk::GDCMImageIO::New();
+          io->SetFileName(files[i]);
+          io->ReadImageInformation();
+          auto &slice = slices[i];
+          slice.file = files[i];
+          slice.position = 0.0;
+          for (unsigned a = 0; a < 3; ++a) {
+            const double o = a < io->GetNumberOfDimensions()
+                ? io->GetOrigin(a)
+                : 0.0;
+            slice.origin[a] = float(o);
+            slice.position += o * normal[a];
+          }
+        }
+      },
+      1);
+  std::stable_sort(slices.begin(),
+      slices.end(),
+      [](const Slice &a, const Slice &b) { return a.position < b.position; });
+  for (size_t i = 0; i < slices.size(); ++i)
+    files[i] = slices[i].file;
+
+  const int dims[3] = {int(first->GetDimensions(0)),
+      int(first->GetDimensions(1)),
+      int(files.size())};
+  float spacing[3] = {float(first->GetSpacing(0)),
+      float(first->GetSpacing(1)),
+      float(first->GetSpacing(2))};
+  const float *origin = slices.front().origin;
+  // slice distance from the positions, SliceThickness may differ from it
+  if (slices.size() > 1) {
+    const double distance = slices[1].position - slices[0].position;
+    if (distance > 0.0)
+      spacing[2] = float(distance);
+  }
+  volume.setVolume(type, dims, spacing, origin);
+
+  // Each slice gets its own IO. GDCM applies the slice's rescale slope and
+  // intercept while decoding, before the voxels reach the buffer.
+  const size_t sliceBytes = volume.voxels.size() / files.size();
+  std::atomic<bool> ok{true};
+  parallelFor(
+      0,
+      files.size(),
+      [&](size_t begin, size_t end) {
+        for (size_t z = begin; z < end && ok; ++z) {
+          auto io = itk::GDCMImageIO::New();
+          io->SetFileName(files[z]);
+          io->ReadImageInformation();
+          if (io->GetComponentType() != type
+              || int(io->GetDimensions(0)) != dims[0]
+              || int(io->GetDimensions(1)) != dims[1]) {
+            std::cerr << "DICOM slice " << files[z]
+                      << " differs in size or pixel type from the series\n";
+            ok = false;
+            return;
+          }
+          itk::ImageIORegion region(io->GetNumberOfDimensions());
+          for (unsigned a = 0; a < io->GetNumberOfDimensions(); ++a) {
+            region.SetIndex(a, 0);
+            region.SetSize(a, a < 2 ? dims[a] : 1);
+          }
+          io->SetIORegion(region);
+          io->Read(volume.voxels.data() + z * sliceBytes);
+        }
+      },
+      1);
+  if (!ok)
+    return false;
+
+  std::cout << "[" << dims[0] << ", " << dims[1] << ", " << dims[2] << "]"
+            << ", spacing [" << spacing[0] << ", " << spacing[1] << ", "
+            << spacing[2] << "], "
+            << itk::ImageIOBase::GetComponentTypeAsString(type) << '\n';
+  std::cout << "\t Peak RSS: " << toMiB(peakResidentSetSize()) << " MiB\n";
+  return true;
+}
+
+bool readDicomImage(const std::string &filename, Image &image)
+{
+  TRACE_SCOPE("images", "read DICOM");
+  auto io = itk::GDCMImageIO::New();
+  if (!io->CanReadFile(filename.c_str()))
+    return false;
+  io->SetFileName(filename);
+  io->ReadImageInformation();
+  const auto type = io->GetComponentType();
+  const bool isSigned = type == itk::IOComponentEnum::SHORT;
+  if (io->GetNumberOfComponents() != 1
+      || (type != itk::IOComponentEnum::USHORT && !isSigned)) {
+    std::cerr << "unsupported DICOM image pixel type in " << filename << ": "
+              << itk::ImageIOBase::GetComponentTypeAsString(type) << '\n';
+    return false;
+  }
+
+  const size_t width = io->GetDimensions(0);
+  const size_t height =
+      io->GetNumberOfDimensions() > 1 ? io->GetDimensions(1) : 1;
+  itk::ImageIORegion region(io->GetNumberOfDimensions());
+  for (unsigned a = 0; a < io->GetNumberOfDimensions(); ++a) {
+    region.SetIndex(a, 0);
+    region.SetSize(a, a == 0 ? width : a == 1 ? height : 1);
+  }
+  io->SetIORegion(region);
+  image.width = width;
+  image.height = height;
+  image.bpp = 2;
+  image.data.resize(width * height * 2);
+  io->Read(image.data.data());
+
+  std::string photometric;
+  io->GetValueFromTag("0028|0004", photometric);
+  const bool invert = photometric.find("MONOCHROME1") != std::string::npos;
+
+  // in place: DICOM rows run top down
+  auto *values = reinterpret_cast<uint16_t *>(image.data.data());
+  for (size_t y = 0; y < height / 2; ++y) {
+    std::swap_ranges(values + y * width,
+        values + (y + 1) * width,
+        values + (height - 1 - y) * width);
+  }
+  if (isSigned || invert) {
+    for (size_t i = 0; i < width * height; ++i) {
+      uint16_t v = values[i];
+      if (isSigned)
+        v = uint16_t(std::max<int16_t>(int16_t(v), 0));
+      values[i] = invert ? uint16_t(65535 - v) : v;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,33 @@
+// Copyright 2024 Matthias Hellmann
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// std
+#include <string>
+// ours
+#include "Image.h"
+#include "readNifti.h"
+
+// DICOM series (a directory of slices) read through ITK's GDCM IO into a
+// NiftiReader's voxel buffer; cropping and the LAC conversion then work as
+// for NIfTI files
+struct DicomReader
+{
+  // Whether path names a directory, which is read as a DICOM series
+  // rather than as a volume file
+  static bool isSeries(const std::string &path);
+
+  // Reads the first series found in `directory`, slices ordered by their
+  // position along the slice normal, decoding them in parallel straight
+  // into volume.voxels
+  bool open(const char *directory, NiftiReader &volume);
+
+  std::string seriesUID;
+  size_t numSlices{0};
+};
+
+// One 2D DICOM file (an X-ray reference) as a GRAY16 image (Image.h),
+// bottom row first; signed pixels are clamped at 0 and MONOCHROME1 is
+// inverted. False, with a message, for other pixel types.
+bool readDicomImage(const std::string &filename, Image &image);
@@ -1,64 +1,1110 @@
 // Copyright 2024 Matthias Hellmann
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 // ITK
-#include <itkImageFileReader.h>
-#include "itkImageRegionIterator.h"
+#include <itkImageIOFactory.h>
 // ours
+#include "Crop.h"
+#include "Decompress.h"
 #include "FieldTypes.h"
+#include "Half.h"
+#ifdef HAVE_CUDA
+#include "LacConvertCuda.h"
+#endif
+#include "Parallel.h"
+#include "RawHeader.h"
 #include "readNifti.h"
+#include "ResourceUsage.h"
+#include "Trace.h"
+
+// Geometry and layout of a NIfTI-1 or NIfTI-2 header, for files read
+// without ITK; origins and directions are converted to ITK's LPS convention
+struct NiftiHeader
+{
+  int dims[3]{1, 1, 1};
+  float spacing[3]{1.f, 1.f, 1.f};
+  float origin[3]{0.f, 0.f, 0.f};
+  // direction[a]: the unit vector of voxel axis a, as ITK's GetDirection(a)
+  double direction[3][3]{{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 1.0}};
+  itk::ImageIOBase::IOComponentType type{
+      itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE};
+  size_t voxOffset{0};
+  double slope{1.0};
+  double intercept{0.0};
+};
+
+static itk::ImageIOBase::IOComponentType niftiComponentType(int datatype)
+{
+  switch (datatype) {
+  case 2:
+    return itk::IOComponentEnum::UCHAR;
+  case 4:
+    return itk::IOComponentEnum::SHORT;
+  case 8:
+    return itk::IOComponentEnum::INT;
+  case 16:
+    return itk::IOComponentEnum::FLOAT;
+  case 64:
+    return itk::IOComponentEnum::DOUBLE;
+  case 256:
+    return itk::IOComponentEnum::CHAR;
+  case 512:
+    return itk::IOComponentEnum::USHORT;
+  case 768:
+    return itk::IOComponentEnum::UINT;
+  default:
+    return itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE;
+  }
+}
+
+template <typename T>
+static T headerValue(const uint8_t *header, size_t offset)
+{
+  T v;
+  std::memcpy(&v, header + offset, sizeof(T));
+  return v;
+}
+
+// Voxel axes in RAS, direction[a] that of axis a: from the qform quaternion
+// (b, c, d; qfac the sign of pixdim[0]) or, without one, the sform rows
+static void headerDirection(int qform,
+    int sform,
+    const double quatern[3],
+    double qfac,
+    const double srow[3][3],
+    double direction[3][3])
+{
+  if (qform > 0) {
+    const double b = quatern[0], c = quatern[1], d = quatern[2];
+    const double a = std::sqrt(std::max(0.0, 1.0 - b * b - c * c - d * d));
+    const double r[3][3] = {
+        {a * a + b * b - c * c - d * d,
+            2 * (b * c - a * d),
+            2 * (b * d + a * c)},
+        {2 * (b * c + a * d),
+            a * a + c * c - b * b - d * d,
+            2 * (c * d - a * b)},
+        {2 * (b * d - a * c),
+            2 * (c * d + a * b),
+            a * a + d * d - c * c - b * b}};
+    for (int axis = 0; axis < 3; ++axis) {
+      for (int row = 0; row < 3; ++row)
+        direction[axis][row] = r[row][axis] * (axis == 2 ? qfac : 1.0);
+    }
+  } else if (sform > 0) {
+    for (int axis = 0; axis < 3; ++axis) {
+      double length = 0.0;
+      for (int row = 0; row < 3; ++row)
+        length += srow[row][axis] * srow[row][axis];
+      length = std::sqrt(length);
+      for (int row = 0; row < 3; ++row) {
+        direction[axis][row] =
+            length > 0.0 ? srow[row][axis] / length : double(axis == row);
+      }
+    }
+  }
+}
+
+// Decompresses only the header; little-endian files only
+static bool readNiftiHeader(const char *fileName, NiftiHeader &hdr)
+{
+  uint8_t header[540];
+  if (!decompressFile(fileName, 0, header, 348))
+    return false;
+
+  const int32_t sizeofHdr = headerValue<int32_t>(header, 0);
+  if (sizeofHdr == 348) {
+    for (int a = 0; a < 3; ++a) {
+      hdr.dims[a] = std::max<int>(1, headerValue<int16_t>(header, 42 + 2 * a));
+      hdr.spacing[a] = headerValue<float>(header, 80 + 4 * a);
+    }
+    hdr.type = niftiComponentType(headerValue<int16_t>(header, 70));
+    hdr.voxOffset = size_t(headerValue<float>(header, 108));
+    hdr.slope = headerValue<float>(header, 112);
+    hdr.intercept = headerValue<float>(header, 116);
+    const int qform = headerValue<int16_t>(header, 252);
+    const int sform = headerValue<int16_t>(header, 254);
+    double quatern[3], srow[3][3];
+    for (int a = 0; a < 3; ++a) {
+      if (qform > 0)
+        hdr.origin[a] = headerValue<float>(header, 268 + 4 * a);
+      else if (sform > 0)
+        hdr.origin[a] = headerValue<float>(header, 280 + 16 * a + 12);
+      quatern[a] = headerValue<float>(header, 256 + 4 * a);
+      for (int b = 0; b < 3; ++b)
+        srow[a][b] = headerValue<float>(header, 280 + 16 * a + 4 * b);
+    }
+    const double qfac = headerValue<float>(header, 76) < 0.f ? -1.0 : 1.0;
+    headerDirection(qform, sform, quatern, qfac, srow, hdr.direction);
+  } else if (sizeofHdr == 540) {
+    if (!decompressFile(fileName, 0, header, 540))
+      return false;
+    for (int a = 0; a < 3; ++a) {
+      hdr.dims[a] = int(std::max<int64_t>(1, headerValue<int64_t>(header, 24 + 8 * a)));
+      hdr.spacing[a] = float(headerValue<double>(header, 112 + 8 * a));
+    }
+    hdr.type = niftiComponentType(headerValue<int16_t>(header, 12));
+    hdr.voxOffset = size_t(headerValue<int64_t>(header, 168));
+    hdr.slope = headerValue<double>(header, 176);
+    hdr.intercept = headerValue<double>(header, 184);
+    const int qform = headerValue<int32_t>(header, 344);
+    const int sform = headerValue<int32_t>(header, 348);
+    double quatern[3], srow[3][3];
+    for (int a = 0; a < 3; ++a) {
+      if (qform > 0)
+        hdr.origin[a] = float(headerValue<double>(header, 376 + 8 * a));
+      else if (sform > 0)
+        hdr.origin[a] = float(headerValue<double>(header, 400 + 32 * a + 24));
+      quatern[a] = headerValue<double>(header, 352 + 8 * a);
+      for (int b = 0; b < 3; ++b)
+        srow[a][b] = headerValue<double>(header, 400 + 32 * a + 8 * b);
+    }
+    const double qfac = headerValue<double>(header, 104) < 0.0 ? -1.0 : 1.0;
+    headerDirection(qform, sform, quatern, qfac, srow, hdr.direction);
+  } else {
+    std::cerr << "not a little-endian NIfTI file: " << fileName << '\n';
+    return false;
+  }
+
+  // RAS (NIfTI) to LPS (ITK)
+  hdr.origin[0] = -hdr.origin[0];
+  hdr.origin[1] = -hdr.origin[1];
+  for (int a = 0; a < 3; ++a) {
+    hdr.direction[a][0] = -hdr.direction[a][0];
+    hdr.direction[a][1] = -hdr.direction[a][1];
+  }
+  if (hdr.slope == 0.0) { // "no scaling"
+    hdr.slope = 1.0;
+    hdr.intercept = 0.0;
+  }
+  return true;
+}
+
+static bool hasSuffix(const char *fileName, const char *suffix)
+{
+  const size_t len = std::strlen(fileName), n = std::strlen(suffix);
+  return len >= n && std::strcmp(fileName + len - n, suffix) == 0;
+}
+
+// Densities of the stored type to float: slope * value + intercept
+static void rescale(const std::vector<uint8_t> &stored,
+    itk::ImageIOBase::IOComponentType type,
+    double slope,
+    double intercept,
+    std::vector<uint8_t> &voxels)
+{
+  float *out = reinterpret_cast<float *>(voxels.data());
+  const size_t numVoxels = voxels.size() / sizeof(float);
+  dispatchComponentType(type, [&](auto tag) {
+    using T = decltype(tag);
+    const T *in = reinterpret_cast<const T *>(stored.data());
+    parallelFor(0, numVoxels, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+        out[i] = float(in[i] * slope + intercept);
+    });
+  });
+}
+
+// Voxel axes that run against LPS in a direction matrix that only flips
+// axes (direction[a]: the unit vector of axis a); false, with no flips, for
+// rotations and permutations, which an axis-aligned field cannot show
+static bool axisFlips(const double direction[3][3], bool flip[3])
+{
+  bool aligned = true;
+  for (int a = 0; a < 3; ++a) {
+    for (int b = 0; b < 3; ++b) {
+      const double expected = a == b ? 1.0 : 0.0;
+      const double length = std::abs(direction[a][b]);
+      aligned = aligned && std::abs(length - expected) < 1e-3;
+    }
+  }
+  for (int a = 0; a < 3; ++a)
+    flip[a] = aligned && direction[a][a] < 0.0;
+  return aligned;
+}
+
+// Origin of a box of a volume once its voxels are mirrored along the
+// flipped axes: the box's corner with the smallest LPS coordinates
+static void boxOrigin(const float origin[3],
+    const float spacing[3],
+    const CropBox &box,
+    const bool flip[3],
+    float result[3])
+{
+  for (int a = 0; a < 3; ++a) {
+    result[a] = flip[a] ? origin[a] - box.upper[a] * spacing[a]
+                        : origin[a] + box.lower[a] * spacing[a];
+  }
+}
+
+// Mirrors the voxels of a volume of the given type and dims along the
+// flipped axes, in place and on all cores
+static void mirrorAxes(std::vector<uint8_t> &voxels,
+    itk::ImageIOBase::IOComponentType type,
+    const int dims[3],
+    const bool flip[3])
+{
+  if (!flip[0] && !flip[1] && !flip[2])
+    return;
+  dispatchComponentType(type, [&](auto tag) {
+    using T = decltype(tag);
+    T *v = reinterpret_cast<T *>(voxels.data());
+    const size_t sx = size_t(dims[0]), sxy = sx * size_t(dims[1]);
+    parallelFor(0, size_t(dims[2]), [&](size_t begin, size_t end) {
+      for (size_t z = begin; z < end; ++z) {
+        T *slice = v + z * sxy;
+        for (int y = 0; flip[0] && y < dims[1]; ++y)
+          std::reverse(slice + y * sx, slice + (y + 1) * sx);
+        for (int y = 0; flip[1] && y < dims[1] / 2; ++y) {
+          std::swap_ranges(slice + y * sx,
+              slice + (y + 1) * sx,
+              slice + (dims[1] - 1 - y) * sx);
+        }
+      }
+    });
+    if (!flip[2])
+      return;
+    parallelFor(0, size_t(dims[2] / 2), [&](size_t begin, size_t end) {
+      for (size_t z = begin; z < end; ++z) {
+        std::swap_ranges(v + z * sxy,
+            v + (z + 1) * sxy,
+            v + (dims[2] - 1 - z) * sxy);
+      }
+    });
+  });
+}
+
+CropBox NiftiReader::regionOf(const int dims[3]) const
+{
+  CropBox box;
+  for (int a = 0; a < 3; ++a) {
+    box.lower[a] = 0;
+    box.upper[a] = dims[a] - 1;
+  }
+  const CropBox selected = selectRegion ? selectRegion(dims) : CropBox();
+  if (selected.empty())
+    return box;
+  for (int a = 0; a < 3; ++a) {
+    box.lower[a] = std::clamp(selected.lower[a], 0, dims[a] - 1);
+    box.upper[a] = std::clamp(selected.upper[a], box.lower[a], dims[a] - 1);
+  }
+  return box;
+}
 
 bool NiftiReader::open(const char *fileName)
 {
-  auto len = std::strlen(fileName);
-  if ((len < 3) || (std::strncmp(fileName + len - 3, "nii", 3) != 0)) {
+  if (hasSuffix(fileName, ".nii.gz") || hasSuffix(fileName, ".nii.zst")) {
+    const auto compression = detectCompression(fileName);
+    if (canDecompress(compression))
+      return openCompressed(fileName);
+    if (compression == Compression::Zstd) {
+      std::cerr << "cannot read " << fileName << ": built without zstd\n";
+      return false;
+    }
+    // gzip without zlib: ITK inflates it, on one thread
+  } else if (!hasSuffix(fileName, "nii") && !hasSuffix(fileName, ".h5")
+      && !hasSuffix(fileName, ".hdf5")) {
     return false;
   }
 
   std::cout << "Reading Nifi file... ";
-  reader = reader_t::New();
-  reader->SetFileName(fileName);
-  reader->Update();
-  img = reader->GetOutput();
-
-  field.dimX = reader->GetImageIO()->GetDimensions(0);
-  field.dimY = reader->GetImageIO()->GetDimensions(1);
-  field.dimZ = reader->GetImageIO()->GetDimensions(2);
-  field.bytesPerCell = sizeof(float);
+  auto io = itk::ImageIOFactory::CreateImageIO(
+      fileName, itk::IOFileModeEnum::ReadMode);
+  if (!io) {
+    std::cerr << "cannot read file: " << fileName << '\n';
+    return false;
+  }
+  io->SetFileName(fileName);
+  io->ReadImageInformation();
+
+  const unsigned numDims = io->GetNumberOfDimensions();
+  if (io->GetNumberOfComponents() != 1 || numDims < 2
+      || !dispatchComponentType(io->GetComponentType(), [](auto) {})) {
+    std::cerr << "unsupported NIfTI pixel type: "
+              << itk::ImageIOBase::GetComponentTypeAsString(
+                     io->GetComponentType())
+              << " x " << io->GetNumberOfComponents() << '\n';
+    return false;
+  }
+
+  const int dims[3] = {int(io->GetDimensions(0)),
+      int(io->GetDimensions(1)),
+      numDims > 2 ? int(io->GetDimensions(2)) : 1};
+
+  // World placement from the header: grid spacing and origin go to the
+  // structuredRegular field as they are, without resampling. ANARI fields
+  // are axis-aligned, so axes the direction matrix flips (ITK's LPS gives
+  // diag(-1, -1, 1) for RAS-stored files) are mirrored into LPS order once
+  // read; rotations are not applied.
+  float spacing[3], origin[3];
+  double direction[3][3]{};
+  for (int a = 0; a < 3; ++a) {
+    spacing[a] = a < int(numDims) ? float(io->GetSpacing(a)) : 1.f;
+    origin[a] = a < int(numDims) ? float(io->GetOrigin(a)) : 0.f;
+    direction[a][a] = 1.0;
+    if (a >= int(numDims))
+      continue;
+    const auto axis = io->GetDirection(a);
+    for (int b = 0; b < 3 && b < int(axis.size()); ++b)
+      direction[a][b] = axis[b];
+  }
+  bool flip[3];
+  if (!axisFlips(direction, flip)) {
+    std::cerr << "Warning: NIfTI direction is a rotation; the volume is "
+                 "placed axis-aligned at its origin\n";
+  }
+  const CropBox box = regionOf(dims);
+  const int boxDims[3] = {box.dim(0), box.dim(1), box.dim(2)};
+  boxOrigin(origin, spacing, box, flip, origin);
+  setVolume(io->GetComponentType(), boxDims, spacing, origin);
+  readRegion = box;
 
-  lacField.dimX = reader->GetImageIO()->GetDimensions(0);
-  lacField.dimY = reader->GetImageIO()->GetDimensions(1);
-  lacField.dimZ = reader->GetImageIO()->GetDimensions(2);
-  lacField.bytesPerCell = sizeof(float);
+  // read straight into our buffer, in the file's component type, the box
+  // a chunk of slices at a time: ITK's NIfTI IO reads the requested region
+  // only, so the volume is never held twice. Files ITK cannot stream
+  // (gzip without zlib) are read in one go, not inflated once per chunk.
+  const size_t sliceBytes =
+      voxels.size() / std::max<size_t>(1, size_t(boxDims[2]));
+  constexpr size_t chunkBytes = size_t(64) << 20;
+  const int chunk = io->CanStreamRead()
+      ? int(std::max<size_t>(1, chunkBytes / std::max<size_t>(1, sliceBytes)))
+      : boxDims[2];
+  for (int z = 0; z < boxDims[2]; z += chunk) {
+    itk::ImageIORegion region(numDims);
+    for (unsigned a = 0; a < numDims; ++a) {
+      region.SetIndex(a, a < 3 ? box.lower[a] : 0);
+      region.SetSize(a, a < 3 ? boxDims[a] : 1);
+    }
+    if (numDims > 2) {
+      region.SetIndex(2, box.lower[2] + z);
+      region.SetSize(2, std::min(chunk, boxDims[2] - z));
+    }
+    io->SetIORegion(region);
+    io->Read(voxels.data() + size_t(z) * sliceBytes);
+  }
+  mirrorAxes(voxels, componentType, boxDims, flip);
 
-  std::cout << "[" << field.dimX << ", " << field.dimY << ", " << field.dimZ << "]\n";
+  std::cout << "[" << field.dimX << ", " << field.dimY << ", " << field.dimZ << "]"
+            << ", spacing [" << field.spacing[0] << ", " << field.spacing[1]
+            << ", " << field.spacing[2] << "]"
+            << ", origin [" << field.origin[0] << ", " << field.origin[1]
+            << ", " << field.origin[2] << "], "
+            << itk::ImageIOBase::GetComponentTypeAsString(componentType)
+            << '\n';
 
   return true;
 }
 
-const StructuredField& NiftiReader::getField(int index, LacReader& lacReader)
+bool NiftiReader::openCompressed(const char *fileName)
+{
+  NiftiHeader hdr;
+  if (!readNiftiHeader(fileName, hdr))
+    return false;
+  if (!dispatchComponentType(hdr.type, [](auto) {})) {
+    std::cerr << "unsupported NIfTI pixel type in " << fileName << '\n';
+    return false;
+  }
+
+  std::cout << "Reading compressed Nifi file... [" << hdr.dims[0] << ", "
+            << hdr.dims[1] << ", " << hdr.dims[2] << "], spacing ["
+            << hdr.spacing[0] << ", " << hdr.spacing[1] << ", "
+            << hdr.spacing[2] << "], "
+            << itk::ImageIOBase::GetComponentTypeAsString(hdr.type) << '\n';
+  bool flip[3];
+  if (!axisFlips(hdr.direction, flip)) {
+    std::cerr << "Warning: NIfTI direction is a rotation; the volume is "
+                 "placed axis-aligned at its origin\n";
+  }
+  const bool flipped = flip[0] || flip[1] || flip[2];
+  const CropBox box = regionOf(hdr.dims);
+  const int boxDims[3] = {box.dim(0), box.dim(1), box.dim(2)};
+  float origin[3];
+  boxOrigin(hdr.origin, hdr.spacing, box, flip, origin);
+  setVolume(hdr.type, boxDims, hdr.spacing, origin);
+  readRegion = box;
+
+  // a region: the streams are decoded from their start anyway, but only up
+  // to the box's last slice and only its slices are kept
+  auto decodeRegion = [&](std::vector<uint8_t> &dst) {
+    const size_t sliceBytes = size_t(hdr.dims[0]) * hdr.dims[1]
+        * (dst.size() / (size_t(boxDims[0]) * boxDims[1] * boxDims[2]));
+    const size_t offset = hdr.voxOffset + box.lower[2] * sliceBytes;
+    if (boxDims[0] == hdr.dims[0] && boxDims[1] == hdr.dims[1])
+      return decompressFile(fileName, offset, dst.data(), dst.size());
+    std::vector<uint8_t> slices(boxDims[2] * sliceBytes);
+    if (!decompressFile(fileName, offset, slices.data(), slices.size()))
+      return false;
+    const int slabDims[3] = {hdr.dims[0], hdr.dims[1], boxDims[2]};
+    CropBox rows = box;
+    rows.lower[2] = 0;
+    rows.upper[2] = boxDims[2] - 1;
+    dispatchComponentType(hdr.type, [&](auto tag) {
+      using T = decltype(tag);
+      copyCropBox(reinterpret_cast<const T *>(slices.data()),
+          slabDims,
+          rows,
+          reinterpret_cast<T *>(dst.data()));
+    });
+    return true;
+  };
+
+  if (hdr.slope != 1.0 || hdr.intercept != 0.0) {
+    // rescaled values are float, as ITK reads them: decode, then convert
+    std::vector<uint8_t> stored = std::move(voxels);
+    if (!decodeRegion(stored))
+      return false;
+    setVolume(itk::IOComponentEnum::FLOAT, boxDims, hdr.spacing, origin);
+    readRegion = box;
+    rescale(stored, hdr.type, hdr.slope, hdr.intercept, voxels);
+    mirrorAxes(voxels, componentType, boxDims, flip);
+    return true;
+  }
+  if (!box.covers(hdr.dims) || flipped) {
+    // mirrored volumes are decoded in one go: slices arrive in file order
+    if (!decodeRegion(voxels))
+      return false;
+    mirrorAxes(voxels, componentType, boxDims, flip);
+    return true;
+  }
+
+  // decode in the background; getField converts slices as they arrive
+  auto progress = std::make_shared<DecodeProgress>();
+  decodeProgress = progress;
+  decodeJob = std::async(std::launch::async,
+      [file = std::string(fileName),
+          offset = hdr.voxOffset,
+          dst = voxels.data(),
+          size = voxels.size(),
+          progress]() {
+        decompressFile(file.c_str(), offset, dst, size, progress.get());
+      });
+  return true;
+}
+
+std::string RawCtFormat::str() const
+{
+  return itk::ImageIOBase::GetComponentTypeAsString(type) + ":"
+      + std::to_string(slope) + ":" + std::to_string(intercept);
+}
+
+bool RawCtFormat::parse(const std::string &text, RawCtFormat &format)
+{
+  const size_t colon = text.find(':');
+  const std::string name = text.substr(0, colon);
+  RawCtFormat result;
+  if (name == "uint8")
+    result.type = itk::IOComponentEnum::UCHAR;
+  else if (name == "uint16")
+    result.type = itk::IOComponentEnum::USHORT;
+  else if (name == "int16")
+    result.type = itk::IOComponentEnum::SHORT;
+  else if (name == "float32")
+    result.type = itk::IOComponentEnum::FLOAT;
+  else
+    return false;
+  if (colon != std::string::npos) {
+    char *end = nullptr;
+    const char *rest = text.c_str() + colon + 1;
+    result.slope = std::strtod(rest, &end);
+    if (end == rest || *end != ':')
+      return false;
+    rest = end + 1;
+    result.intercept = std::strtod(rest, &end);
+    if (end == rest || *end != '\0' || result.slope == 0.0)
+      return false;
+  }
+  format = result;
+  return true;
+}
+
+bool NiftiReader::openRaw(
+    const char *fileName, const int dims[3], const RawCtFormat &format)
+{
+  size_t bytesPerVoxel = 0;
+  if (!dispatchComponentType(
+          format.type, [&](auto tag) { bytesPerVoxel = sizeof(tag); }))
+    return false;
+  const auto compression = detectCompression(fileName);
+  if (!canDecompress(compression)) {
+    std::cerr << "cannot decompress file: " << fileName
+              << " (format not supported by this build)\n";
+    return false;
+  }
+
+  float spacing[3] = {1.f, 1.f, 1.f};
+  const float origin[3] = {0.f, 0.f, 0.f};
+  RawHeader header;
+  if (readRawHeader(fileName, header) && std::equal(dims, dims + 3, header.dims)
+      && header.bytesPerCell == bytesPerVoxel)
+    std::copy_n(header.spacing, 3, spacing);
+
+  std::cout << "Reading RAW CT volume... [" << dims[0] << ", " << dims[1]
+            << ", " << dims[2] << "], spacing [" << spacing[0] << ", "
+            << spacing[1] << ", " << spacing[2] << "], "
+            << itk::ImageIOBase::GetComponentTypeAsString(format.type)
+            << ", HU = " << format.slope << " * value + " << format.intercept
+            << '\n';
+  setVolume(format.type, dims, spacing, origin);
+
+  const bool rescaled = format.slope != 1.0 || format.intercept != 0.0;
+  if (!rescaled && compression != Compression::None) {
+    // as openCompressed(): getField converts slices as they arrive
+    auto progress = std::make_shared<DecodeProgress>();
+    decodeProgress = progress;
+    decodeJob = std::async(std::launch::async,
+        [file = std::string(fileName),
+            dst = voxels.data(),
+            size = voxels.size(),
+            progress]() {
+          decompressFile(file.c_str(), 0, dst, size, progress.get());
+        });
+    return true;
+  }
+
+  std::vector<uint8_t> stored;
+  if (rescaled)
+    stored = std::move(voxels);
+  auto &dst = rescaled ? stored : voxels;
+  bool ok = false;
+  if (compression != Compression::None) {
+    ok = decompressFile(fileName, 0, dst.data(), dst.size());
+  } else if (FILE *file = fopen(fileName, "rb")) {
+    ok = fread(dst.data(), dst.size(), 1, file) == 1;
+    fclose(file);
+  }
+  if (!ok) {
+    std::cerr << "cannot read " << dst.size() << " bytes from " << fileName
+              << '\n';
+    voxels.clear();
+    return false;
+  }
+  if (rescaled) {
+    setVolume(itk::IOComponentEnum::FLOAT, dims, spacing, origin);
+    rescale(stored, format.type, format.slope, format.intercept, voxels);
+  }
+  return true;
+}
+
+bool NiftiReader::waitForVoxels(size_t bytes) const
+{
+  if (!decodeProgress)
+    return true;
+  if (bytes == size_t(-1))
+    return decodeProgress->wait();
+  return decodeProgress->waitFor(bytes);
+}
+
+void NiftiReader::setVolume(itk::ImageIOBase::IOComponentType type,
+    const int dims[3],
+    const float spacing[3],
+    const float origin[3])
+{
+  if (decodeJob.valid())
+    decodeJob.wait();
+  decodeProgress.reset();
+  componentType = type;
+  for (auto *f : {&field, &lacField}) {
+    *f = StructuredField();
+    f->dimX = dims[0];
+    f->dimY = dims[1];
+    f->dimZ = dims[2];
+    f->bytesPerCell = sizeof(float);
+    std::copy_n(spacing, 3, f->spacing);
+    std::copy_n(origin, 3, f->origin);
+  }
+  lacFieldCache.clear();
+  unpackedField = StructuredField();
+  readRegion = CropBox();
+
+  size_t bytesPerVoxel = 0;
+  dispatchComponentType(type, [&](auto tag) { bytesPerVoxel = sizeof(tag); });
+  voxels.clear();
+  voxels.resize(size_t(dims[0]) * dims[1] * dims[2] * bytesPerVoxel);
+}
+
+bool NiftiReader::crop(float threshold)
+{
+  TRACE_SCOPE("volume", "crop");
+  if (!waitForVoxels())
+    return false;
+  const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+  CropBox box;
+  std::vector<uint8_t> cropped;
+  dispatchComponentType(componentType, [&](auto tag) {
+    using T = decltype(tag);
+    const T *data = reinterpret_cast<const T *>(voxels.data());
+    box = findCropBox(data, dims, cropThreshold<T>(threshold));
+    if (box.empty() || box.covers(dims))
+      return;
+    cropped.resize(size_t(box.dim(0)) * box.dim(1) * box.dim(2) * sizeof(T));
+    copyCropBox(data, dims, box, reinterpret_cast<T *>(cropped.data()));
+  });
+  if (box.empty() || box.covers(dims))
+    return false;
+  voxels = std::move(cropped); // drops the full-size volume
+
+  for (auto *f : {&field, &lacField}) {
+    f->dimX = box.dim(0);
+    f->dimY = box.dim(1);
+    f->dimZ = box.dim(2);
+    for (int a = 0; a < 3; ++a)
+      f->origin[a] += box.lower[a] * f->spacing[a];
+  }
+  field.voxels.reset();
+  lacFieldCache.clear();
+  unpackedField = StructuredField();
+
+  std::cout << "Cropped volume to [" << field.dimX << ", " << field.dimY << ", "
+            << field.dimZ << "] at [" << box.lower[0] << ", " << box.lower[1]
+            << ", " << box.lower[2] << "]\n";
+  return true;
+}
+
+// Ranges of one slice's cellSize^2 cells; a voxel on a cell border counts
+// towards both cells. `row` is scratch space for 2 * cellsX floats.
+static void reduceMacrocellSlice(const float *lac,
+    int dimX,
+    int dimY,
+    int cellSize,
+    float *row,
+    float *ranges)
+{
+  const int cellsX = (dimX + cellSize - 1) / cellSize;
+  const int cellsY = (dimY + cellSize - 1) / cellSize;
+  for (int c = 0; c < cellsX * cellsY; ++c) {
+    ranges[2 * c] = std::numeric_limits<float>::max();
+    ranges[2 * c + 1] = -std::numeric_limits<float>::max();
+  }
+
+  for (int y = 0; y < dimY; ++y) {
+    const float *line = lac + size_t(y) * dimX;
+    for (int cx = 0; cx < cellsX; ++cx) {
+      const int x0 = cx * cellSize;
+      const int x1 = std::min(x0 + cellSize, dimX - 1);
+      float lo = line[x0], hi = line[x0];
+      for (int x = x0 + 1; x <= x1; ++x) {
+        lo = std::min(lo, line[x]);
+        hi = std::max(hi, line[x]);
+      }
+      row[2 * cx] = lo;
+      row[2 * cx + 1] = hi;
+    }
+
+    const int cy = std::min(y / cellSize, cellsY - 1);
+    const int cyPrev = (y % cellSize == 0 && y > 0) ? cy - 1 : cy;
+    for (int c = cyPrev; c <= cy; ++c) {
+      float *cell = ranges + size_t(c) * cellsX * 2;
+      for (int cx = 0; cx < cellsX; ++cx) {
+        cell[2 * cx] = std::min(cell[2 * cx], row[2 * cx]);
+        cell[2 * cx + 1] = std::max(cell[2 * cx + 1], row[2 * cx + 1]);
+      }
+    }
+  }
+}
+
+static MacrocellGrid mergeMacrocellSlices(const std::vector<float> &sliceRanges,
+    int dimX,
+    int dimY,
+    int dimZ,
+    int cellSize)
+{
+  MacrocellGrid grid;
+  grid.cellSize = cellSize;
+  const int dims[3] = {dimX, dimY, dimZ};
+  for (int a = 0; a < 3; ++a)
+    grid.dims[a] = (dims[a] + cellSize - 1) / cellSize;
+
+  const size_t cellsPerSlice = size_t(grid.dims[0]) * grid.dims[1];
+  grid.minMax.resize(cellsPerSlice * grid.dims[2] * 2);
+  for (int a = 0; a < 3; ++a) {
+    grid.lower[a] = dims[a];
+    grid.upper[a] = -1;
+  }
+
+  for (int cz = 0; cz < grid.dims[2]; ++cz) {
+    const int z0 = cz * cellSize;
+    const int z1 = std::min(z0 + cellSize, dimZ - 1);
+    float *cells = grid.minMax.data() + cz * cellsPerSlice * 2;
+    std::copy_n(sliceRanges.data() + z0 * cellsPerSlice * 2,
+        cellsPerSlice * 2,
+        cells);
+    for (int z = z0 + 1; z <= z1; ++z) {
+      const float *slice = sliceRanges.data() + z * cellsPerSlice * 2;
+      for (size_t c = 0; c < cellsPerSlice; ++c) {
+        cells[2 * c] = std::min(cells[2 * c], slice[2 * c]);
+        cells[2 * c + 1] = std::max(cells[2 * c + 1], slice[2 * c + 1]);
+      }
+    }
+
+    for (size_t c = 0; c < cellsPerSlice; ++c) {
+      if (cells[2 * c + 1] <= 0.f)
+        continue;
+      const int cell[3] = {int(c % grid.dims[0]), int(c / grid.dims[0]), cz};
+      for (int a = 0; a < 3; ++a) {
+        grid.lower[a] = std::min(grid.lower[a], cell[a] * cellSize);
+        grid.upper[a] =
+            std::max(grid.upper[a], std::min((cell[a] + 1) * cellSize, dims[a] - 1));
+      }
+    }
+  }
+  return grid;
+}
+
+// Histogram of the attenuation from how often each dense table entry was
+// hit: the range is exact, values are rounded to half where stored as half
+static ValueHistogram lacHistogram(
+    const std::vector<uint64_t> &counts, const float *table, bool isHalf)
+{
+  auto value = [&](size_t i) {
+    return isHalf ? halfToFloat(floatToHalf(table[i])) : table[i];
+  };
+
+  ValueHistogram histogram;
+  float lo = std::numeric_limits<float>::max();
+  float hi = std::numeric_limits<float>::lowest();
+  for (size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i] == 0)
+      continue;
+    lo = std::min(lo, value(i));
+    hi = std::max(hi, value(i));
+  }
+  if (lo > hi)
+    return histogram;
+
+  const int numBins = ValueHistogram::defaultBins;
+  const float scale = hi > lo ? numBins / (hi - lo) : 0.f;
+  histogram.lower = lo;
+  histogram.upper = hi;
+  histogram.bins.assign(numBins, 0);
+  for (size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i] == 0)
+      continue;
+    const int bin = std::min(int((value(i) - lo) * scale), numBins - 1);
+    histogram.bins[bin] += counts[i];
+  }
+  return histogram;
+}
+
+StructuredField NiftiReader::getFieldLayout() const
+{
+  StructuredField layout = lacField;
+  if (halfPrecision) {
+    layout.bytesPerCell = 2;
+    layout.isHalf = true;
+  }
+  layout.dataRange = {0.f, 3.f};
+  return layout;
+}
+
+bool NiftiReader::convertField(LacReader &lacReader,
+    void *dst,
+    MacrocellGrid *macrocells,
+    ValueHistogram *histogram)
 {
+  TRACE_SCOPE("volume", "HU to LAC");
+
   std::cout << "Transform density values to linear attenuation coefficients\n";
   std::cout << "\t Using " << lacReader.m_lacLuts[lacReader.m_activeLut].name << "\n";
-  using voxel_value_type = int16_t; //TODO
-  std::vector<voxel_value_type> buffer;
-  itk::ImageRegionConstIterator<img_t> inputIterator(img, img->GetLargestPossibleRegion());
-  while (!inputIterator.IsAtEnd())
-  {
-      buffer.emplace_back(inputIterator.Get());
-      ++inputIterator;
-  }
-  std::vector<float> attenuation_volume((size_t)field.dimX * field.dimY * field.dimZ);
-  for (size_t i=0; i<buffer.size(); ++i) {
-    attenuation_volume[i] = lacReader.lookup(buffer[i]);
-  }
-  size_t size = attenuation_volume.size() * sizeof(attenuation_volume[0]);
-  lacField.dataF32.resize(size);
-  memcpy((char *)lacField.dataF32.data(), attenuation_volume.data(), size);
-
-  lacField.dataRange = {0.f, 3.f}; //TODO
-  return lacField;
+  const size_t numVoxels = (size_t)field.dimX * field.dimY * field.dimZ;
+  const size_t sliceVoxels = size_t(field.dimX) * field.dimY;
+
+  // per-slice 2D cell ranges, merged along z once all slices are converted
+  const int s = macrocells ? macrocellSize : 0;
+  const size_t cellsX = s > 0 ? (field.dimX + s - 1) / s : 0;
+  const size_t cellsY = s > 0 ? (field.dimY + s - 1) / s : 0;
+  const size_t cellsPerSlice = cellsX * cellsY;
+  std::vector<float> sliceRanges(cellsPerSlice * 2 * field.dimZ);
+  // hits per dense table entry, summed over the threads
+  const auto &table = lacReader.m_lacLuts[lacReader.m_activeLut].dense;
+  std::vector<uint64_t> counts(histogram ? table.size() : 0);
+  std::mutex countsMutex;
+
+  auto start = std::chrono::steady_clock::now();
+#ifdef HAVE_CUDA
+  // mapped array of a CUDA device: the GPU converts, chunks are uploaded as
+  // they are decoded; the host cannot write device memory, so no fallback
+  if (isCudaWritable(dst)) {
+    LacCudaJob job;
+    job.density = voxels.data();
+    dispatchComponentType(componentType,
+        [&](auto tag) { job.type = densityTypeOf<decltype(tag)>(); });
+    job.dims[0] = field.dimX;
+    job.dims[1] = field.dimY;
+    job.dims[2] = field.dimZ;
+    job.table = lacReader.m_lacLuts[lacReader.m_activeLut].dense.data();
+    job.halfPrecision = halfPrecision;
+    job.dst = dst;
+    job.macrocellSize = s;
+    job.macrocells = macrocells;
+    job.waitForBytes = [this](size_t bytes) { return waitForVoxels(bytes); };
+    if (!job.table || !convertLacCuda(job))
+      return false;
+    if (histogram) {
+      // counted on the host from the densities after the conversion, as
+      // convertLacCuda() returns once the GPU is done; not overlapped
+      dispatchComponentType(componentType, [&](auto tag) {
+        using T = decltype(tag);
+        const T *buffer = reinterpret_cast<const T *>(voxels.data());
+        parallelFor(0, numVoxels, [&](size_t begin, size_t end) {
+          std::vector<uint64_t> local(counts.size(), 0);
+          for (size_t i = begin; i < end; ++i)
+            ++local[LacReader::denseIndex(buffer[i])];
+          std::lock_guard<std::mutex> lock(countsMutex);
+          for (size_t i = 0; i < local.size(); ++i)
+            counts[i] += local[i];
+        });
+      });
+      *histogram = lacHistogram(counts, table.data(), halfPrecision);
+    }
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start)
+                         .count();
+    std::cout << "\t Converted " << numVoxels << " voxels on the GPU in "
+              << seconds * 1000.0 << " ms\n";
+    return true;
+  }
+#endif
+  // slices are handed out in order, so the conversion can follow a
+  // decompression that is still filling the voxel buffer
+  const size_t sliceBytes = voxels.size() / std::max(field.dimZ, 1);
+  const size_t numThreads =
+      std::max<size_t>(1, std::thread::hardware_concurrency());
+  std::atomic<size_t> nextSlice{0};
+  std::atomic<bool> complete{true};
+  dispatchComponentType(componentType, [&](auto tag) {
+    using T = decltype(tag);
+    const T *buffer = reinterpret_cast<const T *>(voxels.data());
+    parallelFor(
+        0,
+        numThreads,
+        [&](size_t, size_t) {
+          // half: convert through a float staging slice per thread
+          std::vector<float> staging(halfPrecision ? sliceVoxels : 0);
+          std::vector<float> row(cellsX * 2);
+          std::vector<uint64_t> local(counts.size(), 0);
+          for (size_t z = nextSlice++; z < size_t(field.dimZ) && complete;
+               z = nextSlice++) {
+            if (!waitForVoxels((z + 1) * sliceBytes)) {
+              complete = false;
+              break;
+            }
+            const size_t first = z * sliceVoxels;
+            float *lac = halfPrecision ? staging.data()
+                                       : static_cast<float *>(dst) + first;
+            lacReader.lookup(std::span<const T>(buffer + first, sliceVoxels),
+                std::span<float>(lac, sliceVoxels));
+            // the slice is still in cache
+            if (histogram) {
+              for (size_t i = first; i < first + sliceVoxels; ++i)
+                ++local[LacReader::denseIndex(buffer[i])];
+            }
+            if (halfPrecision) {
+              uint16_t *out = static_cast<uint16_t *>(dst) + first;
+              for (size_t i = 0; i < sliceVoxels; ++i)
+                out[i] = floatToHalf(lac[i]);
+            }
+            if (s > 0) {
+              reduceMacrocellSlice(lac,
+                  field.dimX,
+                  field.dimY,
+                  s,
+                  row.data(),
+                  sliceRanges.data() + z * cellsPerSlice * 2);
+            }
+          }
+          std::lock_guard<std::mutex> lock(countsMutex);
+          for (size_t i = 0; i < local.size(); ++i)
+            counts[i] += local[i];
+        },
+        1);
+  });
+  if (!complete) {
+    std::cerr << "\t Volume data incomplete, conversion aborted\n";
+    return false;
+  }
+  if (s > 0) {
+    *macrocells = mergeMacrocellSlices(
+        sliceRanges, field.dimX, field.dimY, field.dimZ, s);
+  }
+  if (histogram)
+    *histogram = lacHistogram(counts, table.data(), halfPrecision);
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << "\t Converted " << numVoxels << " voxels in "
+            << seconds * 1000.0 << " ms ("
+            << (seconds > 0.0 ? numVoxels / seconds / 1e6 : 0.0)
+            << " Mvoxels/s)\n";
+  std::cout << "\t Peak RSS: " << toMiB(peakResidentSetSize()) << " MiB\n";
+  return true;
+}
+
+const StructuredField& NiftiReader::getField(int index, LacReader& lacReader)
+{
+  const size_t numVoxels = (size_t)field.dimX * field.dimY * field.dimZ;
+  if (auto *cached = lacFieldCache.get(lacReader.getActiveLut())) {
+    if (cached->packed.empty())
+      return cached->field;
+    unpackedField = cached->field;
+    dequantizeField(cached->packed,
+        unpackedField.allocate(numVoxels),
+        unpackedField.isHalf);
+    return unpackedField;
+  }
+
+  StructuredField converted = getFieldLayout();
+  if (!convertField(lacReader,
+          converted.allocate(numVoxels),
+          &converted.macrocells,
+          &converted.histogram))
+    return lacField; // empty
+  if (!converted.histogram.empty()) {
+    converted.dataRange = {
+        converted.histogram.lower, converted.histogram.upper};
+  }
+
+  CachedLacField entry;
+  size_t bytes = converted.macrocells.bytes() + converted.histogram.bytes();
+  if (lutCacheBits > 0) {
+    // the macrocells stay conservative: decoded voxels lie in their block's
+    // range, and blocks do not straddle macrocells of multiple-of-4 sizes
+    entry.packed = quantizeField(converted, lutCacheBits);
+    dequantizeField(entry.packed,
+        const_cast<void *>(converted.data()),
+        converted.isHalf);
+    bytes += entry.packed.bytes();
+    unpackedField = converted;
+    converted.voxels.reset();
+  } else {
+    bytes += numVoxels * converted.bytesPerCell;
+  }
+  entry.field = std::move(converted);
+  auto &cached =
+      lacFieldCache.put(lacReader.getActiveLut(), std::move(entry), bytes);
+  return cached.packed.empty() ? cached.field : unpackedField;
+}
+
+const QuantizedVolume *NiftiReader::packedField(size_t lut) const
+{
+  const CachedLacField *cached = lacFieldCache.peek(lut);
+  return cached && !cached->packed.empty() ? &cached->packed : nullptr;
+}
+
+const StructuredField& NiftiReader::getDensityField(int index)
+{
+  if (!field.empty())
+    return field;
+
+  if (!waitForVoxels())
+    return field; // empty
+  const size_t numVoxels = (size_t)field.dimX * field.dimY * field.dimZ;
+  auto *out = static_cast<float *>(field.allocate(numVoxels));
+  dispatchComponentType(componentType, [&](auto tag) {
+    using T = decltype(tag);
+    const T *buffer = reinterpret_cast<const T *>(voxels.data());
+    parallelFor(0, numVoxels, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+        out[i] = static_cast<float>(buffer[i]);
+    });
+
+    // integer files span their type's range, float files the LUTs' int16 one
+    using Limits = std::numeric_limits<
+        std::conditional_t<std::is_integral_v<T>, T, int16_t>>;
+    field.dataRange = {float(Limits::lowest()), float(Limits::max())};
+  });
+  return field;
+}
+
+bool readNiftiPreview(const char *fileName,
+    int stride,
+    const LacReader &lacReader,
+    StructuredField &preview)
+{
+  if (stride < 2
+      || (!hasSuffix(fileName, ".nii") && !hasSuffix(fileName, ".h5")
+          && !hasSuffix(fileName, ".hdf5")))
+    return false;
+  auto io = itk::ImageIOFactory::CreateImageIO(
+      fileName, itk::IOFileModeEnum::ReadMode);
+  if (!io)
+    return false;
+  io->SetFileName(fileName);
+  io->ReadImageInformation();
+  const unsigned numDims = io->GetNumberOfDimensions();
+  if (io->GetNumberOfComponents() != 1 || numDims < 2 || !io->CanStreamRead())
+    return false;
+
+  const int dims[3] = {int(io->GetDimensions(0)),
+      int(io->GetDimensions(1)),
+      numDims > 2 ? int(io->GetDimensions(2)) : 1};
+  StructuredField field;
+  field.dimX = (dims[0] + stride - 1) / stride;
+  field.dimY = (dims[1] + stride - 1) / stride;
+  field.dimZ = (dims[2] + stride - 1) / stride;
+  field.bytesPerCell = sizeof(float);
+  for (int a = 0; a < 3; ++a) {
+    field.spacing[a] =
+        stride * (a < int(numDims) ? float(io->GetSpacing(a)) : 1.f);
+    field.origin[a] = a < int(numDims) ? float(io->GetOrigin(a)) : 0.f;
+  }
+  const size_t sliceCells = size_t(field.dimX) * field.dimY;
+  auto *out = static_cast<float *>(field.allocate(sliceCells * field.dimZ));
+  if (!out)
+    return false;
+
+  // one slice of the file at a time, every stride-th of them
+  const bool supported = dispatchComponentType(
+      io->GetComponentType(), [&](auto tag) {
+        using T = decltype(tag);
+        std::vector<T> slice(size_t(dims[0]) * dims[1]);
+        std::vector<T> density(sliceCells);
+        for (int z = 0; z < field.dimZ; ++z) {
+          itk::ImageIORegion region(numDims);
+          for (unsigned a = 0; a < numDims; ++a) {
+            region.SetIndex(a, 0);
+            region.SetSize(a, a < 2 ? dims[a] : 1);
+          }
+          if (numDims > 2)
+            region.SetIndex(2, z * stride);
+          io->SetIORegion(region);
+          io->Read(slice.data());
+          for (int y = 0; y < field.dimY; ++y) {
+            for (int x = 0; x < field.dimX; ++x) {
+              density[size_t(y) * field.dimX + x] =
+                  slice[size_t(y) * stride * dims[0] + size_t(x) * stride];
+            }
+          }
+          lacReader.lookup(std::span<const T>(density),
+              std::span<float>(out + size_t(z) * sliceCells, sliceCells));
+        }
+      });
+  if (!supported)
+    return false;
+
+  float lower = std::numeric_limits<float>::max();
+  float upper = std::numeric_limits<float>::lowest();
+  for (size_t i = 0; i < sliceCells * field.dimZ; ++i) {
+    if (std::isfinite(out[i])) {
+      lower = std::min(lower, out[i]);
+      upper = std::max(upper, out[i]);
+    }
+  }
+  if (lower <= upper)
+    field.dataRange = {lower, upper};
+  preview = std::move(field);
+  return true;
 }
@@ -4,23 +4,176 @@
 #pragma once
 
 #include <stdio.h>
+// std
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
 // ITK
-#include <itkImageFileReader.h>
+#include <itkImageIOBase.h>
 // ours
+#include "BlockQuantized.h"
+#include "Crop.h"
+#include "Decompress.h"
 #include "FieldTypes.h"
 #include "LacTransform.h"
+#include "LruCache.h"
+
+// Calls func(T{}) with the C++ type of an ITK pixel component; false for
+// types the viewer does not read
+template <typename Func>
+inline bool dispatchComponentType(
+    itk::ImageIOBase::IOComponentType type, Func &&func)
+{
+  switch (type) {
+  case itk::IOComponentEnum::UCHAR:
+    func(uint8_t{});
+    return true;
+  case itk::IOComponentEnum::CHAR:
+    func(int8_t{});
+    return true;
+  case itk::IOComponentEnum::USHORT:
+    func(uint16_t{});
+    return true;
+  case itk::IOComponentEnum::SHORT:
+    func(int16_t{});
+    return true;
+  case itk::IOComponentEnum::UINT:
+    func(uint32_t{});
+    return true;
+  case itk::IOComponentEnum::INT:
+    func(int32_t{});
+    return true;
+  case itk::IOComponentEnum::FLOAT:
+    func(float{});
+    return true;
+  case itk::IOComponentEnum::DOUBLE:
+    func(double{});
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Densities of a headerless RAW CT volume: cell type, and the rescale to
+// HU (slope * value + intercept) a NIfTI header would carry
+struct RawCtFormat
+{
+  itk::ImageIOBase::IOComponentType type{
+      itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE};
+  double slope{1.0};
+  double intercept{0.0};
+
+  bool valid() const
+  {
+    return type != itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE;
+  }
+  // Identifies the format in cache keys
+  std::string str() const;
+
+  // "<type>[:<slope>:<intercept>]" with type uint8, uint16, int16 or
+  // float32; false, leaving the format untouched, on anything else
+  static bool parse(const std::string &text, RawCtFormat &format);
+};
+
+// An entry of NiftiReader::lacFieldCache: the attenuation field, or with
+// lutCacheBits its layout, macrocells and histogram without voxels plus the
+// voxels quantized
+struct CachedLacField
+{
+  StructuredField field;
+  QuantizedVolume packed;
+};
 
 struct NiftiReader
 {
+  // .nii, or .nii.gz/.nii.zst decompressed on all cores (chunked files) in
+  // the background while getField converts the slices already decoded.
+  // Also chunked HDF5 images as ITK writes them (.h5, .hdf5): their IO
+  // reads only the chunks of the region asked for, through its chunk cache.
   bool open(const char *fileName);
   const StructuredField &getField(int index, LacReader& lacReader);
+  // A RAW volume of CT densities (optionally gzip/zstd), spacing from its
+  // sidecar header if that matches; converted like NIfTI data from here on
+  bool openRaw(const char *fileName, const int dims[3], const RawCtFormat &format);
+  // Geometry and cell type of the attenuation fields, without voxels; the
+  // data range is a placeholder until convertField() computed the histogram
+  StructuredField getFieldLayout() const;
+  // Converts with the active LUT straight into dst (getFieldLayout()'s
+  // cells, e.g. a mapped device array), on all cores and without caching;
+  // fills the macrocell grid and the value histogram if given, in the same
+  // pass. False if the volume is incomplete.
+  bool convertField(LacReader &lacReader,
+      void *dst,
+      MacrocellGrid *macrocells = nullptr,
+      ValueHistogram *histogram = nullptr);
+  // Raw densities (HU) as float, for LUTs applied on the device
+  const StructuredField &getDensityField(int index);
+  // Keeps only the bounding box of the voxels above threshold (HU) and
+  // moves the fields' origin to it; call before getField. Returns false if
+  // nothing was cropped.
+  bool crop(float threshold);
+  // Resets the fields to an empty volume of the given geometry and sizes
+  // `voxels` for it; readers then fill the buffer
+  void setVolume(itk::ImageIOBase::IOComponentType type,
+      const int dims[3],
+      const float spacing[3],
+      const float origin[3]);
+  // Blocks until the first `bytes` of `voxels` are decoded (all by
+  // default); false if decompression failed before
+  bool waitForVoxels(size_t bytes = size_t(-1)) const;
 
-  using voxel_value_type = int16_t; //TODO
-  using img_t = itk::Image<voxel_value_type, 3>;
-  using reader_t = itk::ImageFileReader<img_t>;
-
-  typename reader_t::Pointer  reader;
-  typename img_t::Pointer     img;
+  // Densities in the file's own component type (after ITK applied the
+  // header's scl_slope/scl_inter), converted in one pass by getField
+  itk::ImageIOBase::IOComponentType componentType{
+      itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE};
+  std::vector<uint8_t>        voxels;
   StructuredField             field;
   StructuredField             lacField;
+  // converted attenuation volumes, keyed by LUT id
+  LruCache<size_t, CachedLacField> lacFieldCache;
+  // 8 or 4: lacFieldCache keeps the volumes block-quantized
+  // (BlockQuantized.h) and getField decodes them into unpackedField, the
+  // first time too, so a LUT looks the same whether cached or not; 0 keeps
+  // them as they are
+  int lutCacheBits{0};
+  StructuredField unpackedField;
+  // The volume of LUT `lut` as lacFieldCache keeps it block-quantized, for
+  // kernels that decode voxels as they read them (FirstHitSettings); null
+  // without lutCacheBits or if it is not cached
+  const QuantizedVolume *packedField(size_t lut) const;
+  // store attenuation as float16 (2-byte cells, isHalf) instead of float32
+  bool halfPrecision{false};
+  // voxels per macrocell edge of the attenuation fields' min/max grid,
+  // computed during the conversion; 0 disables it
+  int macrocellSize{16};
+  // Picks the voxels open() reads once it knows the volume's dimensions
+  // (e.g. a slab, a region of interest); unset or an empty box reads all.
+  // Uncompressed files are read box only, a chunk of slices at a time
+  // straight into `voxels`; compressed ones decode the box's slices. The
+  // fields' origin moves to the box.
+  std::function<CropBox(const int dims[3])> selectRegion;
+  // The file's voxels open() read; empty for volumes from other readers
+  CropBox readRegion;
+  // selectRegion's box clamped to the volume, all of it without one; for
+  // readers filling `voxels` themselves (ZarrReader)
+  CropBox regionOf(const int dims[3]) const;
+
+ private:
+  bool openCompressed(const char *fileName);
+
+  std::shared_ptr<DecodeProgress> decodeProgress;
+  std::future<void> decodeJob; // declared last: joined before the buffers go
 };
+
+// Every stride-th voxel along each axis of an uncompressed NIfTI or HDF5
+// file, converted with the active LUT into a float attenuation field with
+// the spacing scaled by the stride: a preview to show while NiftiReader
+// reads the whole volume. ITK reads every stride-th slice only; false for
+// files it cannot stream that way (compressed NIfTI) and for other types.
+bool readNiftiPreview(const char *fileName,
+    int stride,
+    const LacReader &lacReader,
+    StructuredField &preview);
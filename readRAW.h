@@ -3,9 +3,23 @@
 
 #pragma once
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// std
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 // ours
+#include "Crop.h"
+#include "Decompress.h"
 #include "FieldTypes.h"
+#include "RawHeader.h"
+#include "VoxelTypes.h"
 
 struct RAWReader
 {
@@ -15,8 +29,12 @@ struct RAWReader
       fclose(file);
   }
 
-  bool open(
-      const char *fileName, int dimX, int dimY, int dimZ, unsigned bytesPerCell)
+  bool open(const char *fileName,
+      int dimX,
+      int dimY,
+      int dimZ,
+      unsigned bytesPerCell,
+      bool useMmap = false)
   {
     file = fopen(fileName, "rb");
     if (!file) {
@@ -24,51 +42,246 @@ struct RAWReader
       return false;
     }
 
+    this->fileName = fileName;
+    this->useMmap = useMmap;
+    compression = detectCompression(fileName);
+    if (!canDecompress(compression)) {
+      std::cerr << "cannot decompress file: " << fileName
+                << " (format not supported by this build)\n";
+      return false;
+    }
+
     field.dimX = dimX;
     field.dimY = dimY;
     field.dimZ = dimZ;
     field.bytesPerCell = bytesPerCell;
 
+    if (!readRawHeader(fileName, header) || header.dims[0] != dimX
+        || header.dims[1] != dimY || header.dims[2] != dimZ
+        || header.bytesPerCell != bytesPerCell)
+      header = RawHeader();
+
     return true;
   }
 
   const StructuredField &getField(int index = 0)
   {
     if (field.empty()) {
-      auto readData =
-          [this](
-              auto &data, int dimX, int dimY, int dimZ, unsigned bytesPerCell) {
-            size_t size = dimX * size_t(dimY) * dimZ * bytesPerCell;
-            data.resize(size);
-            fread((char *)data.data(), size, 1, file);
-          };
-
-      if (field.bytesPerCell == 1) {
-        readData(field.dataUI8,
-            field.dimX,
-            field.dimY,
-            field.dimZ,
-            field.bytesPerCell);
-      } else if (field.bytesPerCell == 2) {
-        readData(field.dataUI16,
-            field.dimX,
-            field.dimY,
-            field.dimZ,
-            field.bytesPerCell);
-      } else if (field.bytesPerCell == 4) {
-        readData(field.dataF32,
-            field.dimX,
-            field.dimY,
-            field.dimZ,
-            field.bytesPerCell);
+      if (compression == Compression::None && useMmap && mapField()) {
+        applyHeader();
+        return field;
+      }
+
+      const size_t numCells = size_t(field.dimX) * field.dimY * field.dimZ;
+      const size_t size = numCells * field.bytesPerCell;
+      if (void *data = field.allocate(numCells)) {
+        if (compression != Compression::None) {
+          if (!decompressFile(fileName.c_str(), 0, data, size))
+            field.voxels.reset();
+        } else {
+          fread(data, size, 1, file);
+        }
       }
 
-      field.dataRange = {0.f, 1.f};
+      applyHeader();
+    }
+
+    return field;
+  }
+
+  // Slices z0..z1 (inclusive) only, for nodes rendering one slab of a
+  // volume larger than they hold: read from their offset in the file
+  // (decoding and dropping the slices before them in gzip/zstd files), with
+  // the origin moved to slice z0. Without a sidecar header the data range is
+  // the slab's own, and no header is written for it.
+  const StructuredField &getSlab(int z0, int z1)
+  {
+    if (!field.empty())
+      return field;
+
+    z0 = std::clamp(z0, 0, field.dimZ - 1);
+    z1 = std::clamp(z1, z0, field.dimZ - 1);
+    const size_t sliceBytes =
+        size_t(field.dimX) * field.dimY * field.bytesPerCell;
+    field.dimZ = z1 - z0 + 1;
+    const size_t numCells = size_t(field.dimX) * field.dimY * field.dimZ;
+    const size_t skip = size_t(z0) * sliceBytes;
+    const size_t size = numCells * field.bytesPerCell;
+    if (void *data = field.allocate(numCells)) {
+      bool ok = false;
+      if (compression != Compression::None)
+        ok = decompressFile(fileName.c_str(), skip, data, size);
+      else
+        ok = fseeko(file, off_t(skip), SEEK_SET) == 0
+            && fread(data, size, 1, file) == 1;
+      if (!ok) {
+        std::cerr << "cannot read slices " << z0 << ".." << z1 << " of "
+                  << fileName << '\n';
+        field.voxels.reset();
+      }
     }
 
+    applyHeader(false);
+    field.origin[2] += z0 * field.spacing[2];
     return field;
   }
 
+  // Every stride-th cell along each axis only, with the spacing scaled by
+  // the stride: a preview shown while the whole volume is read (by a reader
+  // of its own). The rows it needs are pread from uncompressed files;
+  // false for compressed ones. Without a sidecar header the data range is
+  // the preview's own, and no header is written for it.
+  bool getPreview(int stride)
+  {
+    if (!field.empty() || stride < 2 || compression != Compression::None)
+      return false;
+
+    const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+    const size_t cellBytes = field.bytesPerCell;
+    const size_t rowBytes = size_t(dims[0]) * cellBytes;
+    field.dimX = (dims[0] + stride - 1) / stride;
+    field.dimY = (dims[1] + stride - 1) / stride;
+    field.dimZ = (dims[2] + stride - 1) / stride;
+    auto *out = static_cast<uint8_t *>(
+        field.allocate(size_t(field.dimX) * field.dimY * field.dimZ));
+    if (!out)
+      return false;
+
+    const int fd = fileno(file);
+    std::vector<uint8_t> row(rowBytes);
+    for (int z = 0; z < field.dimZ; ++z) {
+      for (int y = 0; y < field.dimY; ++y) {
+        const off_t offset = off_t(
+            (size_t(z) * stride * dims[1] + size_t(y) * stride) * rowBytes);
+        size_t read = 0;
+        while (read < rowBytes) {
+          const ssize_t n =
+              pread(fd, row.data() + read, rowBytes - read, offset + read);
+          if (n <= 0)
+            break;
+          read += size_t(n);
+        }
+        if (read < rowBytes) {
+          std::cerr << "cannot read preview of " << fileName << '\n';
+          field.voxels.reset();
+          return false;
+        }
+        for (int x = 0; x < field.dimX; ++x) {
+          std::copy_n(row.data() + size_t(x) * stride * cellBytes,
+              cellBytes,
+              out);
+          out += cellBytes;
+        }
+      }
+    }
+
+    applyHeader(false);
+    for (int a = 0; a < 3; ++a)
+      field.spacing[a] *= stride;
+    return true;
+  }
+
+  // Cell type, spacing and data range from the sidecar header; on the first
+  // load they are computed from the voxels and the header is written
+  void applyHeader(bool write = true)
+  {
+    if (field.empty())
+      return;
+    if (!header.valid()) {
+      header = computeRawHeader(field);
+      if (write)
+        writeRawHeader(fileName, header);
+    }
+    field.isHalf = header.isHalf;
+    std::copy_n(header.spacing, 3, field.spacing);
+    field.dataRange = {header.dataRange[0], header.dataRange[1]};
+    field.histogram.lower = header.dataRange[0];
+    field.histogram.upper = header.dataRange[1];
+    field.histogram.bins = header.histogram;
+  }
+
+  // Shrinks the loaded field to the bounding box of the cells above
+  // threshold (in cell units: counts for integer types); the field's origin
+  // keeps the box's position in the file's volume. A mapped field turns into
+  // a (smaller) copy.
+  void crop(float threshold)
+  {
+    if (field.empty())
+      return;
+
+    const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+    StructuredField cropped;
+    cropped.bytesPerCell = field.bytesPerCell;
+    cropped.isHalf = field.isHalf;
+    cropped.dataRange = field.dataRange;
+    std::copy_n(field.origin, 3, cropped.origin);
+    std::copy_n(field.spacing, 3, cropped.spacing);
+    CropBox box;
+    dispatchVoxelType(field, [&](auto voxel) {
+      using Voxel = decltype(voxel);
+      using T = typename Voxel::Storage;
+      const T *data = voxelData<Voxel>(field);
+      box = findCropBox(data, dims, cropThreshold<T>(threshold));
+      if (box.empty() || box.covers(dims))
+        return;
+      copyCropBox(data,
+          dims,
+          box,
+          allocateVoxels<Voxel>(
+              cropped, size_t(box.dim(0)) * box.dim(1) * box.dim(2)));
+    });
+
+    if (box.empty() || box.covers(dims))
+      return;
+
+    cropped.dimX = box.dim(0);
+    cropped.dimY = box.dim(1);
+    cropped.dimZ = box.dim(2);
+    for (int a = 0; a < 3; ++a)
+      cropped.origin[a] += box.lower[a] * field.spacing[a];
+    std::cout << "Cropped volume to [" << cropped.dimX << ", " << cropped.dimY
+              << ", " << cropped.dimZ << "] at [" << box.lower[0] << ", "
+              << box.lower[1] << ", " << box.lower[2] << "]\n";
+    field = std::move(cropped);
+  }
+
+  // Map the file read-only and let field.voxels own the mapping; the
+  // mapping stays alive for as long as any copy of the field (or an ANARI
+  // array sharing it) holds a reference. Returns false to fall back to fread.
+  bool mapField()
+  {
+    size_t size = field.dimX * size_t(field.dimY) * field.dimZ
+        * field.bytesPerCell;
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < size) {
+      std::cerr << "cannot mmap file: " << fileName << " (file too small)\n";
+      ::close(fd);
+      return false;
+    }
+
+    void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+      std::cerr << "cannot mmap file: " << fileName << '\n';
+      return false;
+    }
+    madvise(ptr, size, MADV_WILLNEED);
+
+    field.voxels = std::shared_ptr<const void>(
+        ptr, [size](const void *p) { munmap(const_cast<void *>(p), size); });
+    field.mapped = true;
+    return true;
+  }
+
   FILE *file{nullptr};
+  std::string fileName;
+  bool useMmap{false};
+  Compression compression{Compression::None}; // gzip/zstd: decompressed on read
+  RawHeader header; // invalid until read or computed
   StructuredField field;
 };
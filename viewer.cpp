@@ -13,24 +13,89 @@
 #include <common/manip/zoom_manipulator.h>
 // std
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <sstream>
+#include <thread>
 // ours
+#include "AnariCalls.h"
+#include "BatchCheckpoint.h"
+#include "BatchRenderer.h"
+#include "BrickStream.h"
+#include "CameraPath.h"
+#include "ComparisonGrid.h"
+#include "Crop.h"
+#include "DeviceArbiter.h"
+#include "Distributed.h"
+#include "DrrCache.h"
+#include "DrrTuning.h"
+#include "Evaluation.h"
+#include "FieldPyramid.h"
 #include "FieldTypes.h"
+#include "FirstHit.h"
+#include "FrameRing.h"
+#include "FrameStreamer.h"
+#include "GpuCounters.h"
 #include "Image.h"
+#include "ImagePreprocess.h"
+#include "ImageStore.h"
 #include "ImageViewport.h"
+#include "LacCache.h"
 #include "LacTransform.h"
+#include "LruCache.h"
+#include "MaterialRender.h"
 #include "Matcher.h"
+#include "MemoryFit.h"
+#include "MemoryWindow.h"
+#include "MatchRecording.h"
+#include "OriginDepth.h"
+#include "Parallel.h"
+#include "PhasePlayer.h"
+#include "Phantom.h"
+#include "PoseCache.h"
+#include "PoseSampler.h"
 #include "prediction.h"
+#include "PredictionFeed.h"
 #include "PredictionsEditor.h"
+#include "RawHeader.h"
 #include "readRAW.h"
+#include "Registration.h"
+#include "RenderBenchmark.h"
 #ifdef HAVE_ITK
+#include "readDicom.h"
 #include "readNifti.h"
 #endif
+#include "ResourceUsage.h"
+#include "ScratchArena.h"
+#include "ServerMetrics.h"
+#include "Session.h"
 #include "SettingsEditor.h"
+#include "ShardWriter.h"
+#include "SlabRender.h"
+#include "StartupProfile.h"
+#include "TaskScheduler.h"
+#include "TemplateLibrary.h"
+#include "ThumbnailAtlas.h"
+#include "TiledRender.h"
+#include "Trace.h"
+#include "Tracking.h"
 #include "Viewport.h"
+#include "VolumeManager.h"
+#include "VolumeMemory.h"
+#include "VolumeScene.h"
+#include "VoxelOrder.h"
+#include "VoxelTypes.h"
+#include "Worklist.h"
 
 static const bool g_true = true;
 static bool g_verbose = false;
@@ -40,14 +105,158 @@ static std::string g_libraryName = "environment";
 static anari::Library g_debug = nullptr;
 static anari::Device g_device = nullptr;
 static const char *g_traceDir = nullptr;
-static std::string g_filename;
+static std::vector<std::string> g_filenames; // the first one is shown on start
 static int g_dimX = 0, g_dimY = 0, g_dimZ = 0;
 static unsigned g_bytesPerCell = 0;
-static float g_voxelRange[2];
+static bool g_useMmap = false;
 static std::string g_jsonfile;
 static std::string g_laclutfile;
 static size_t g_laclutid{0};
-static std::vector<std::string> g_matcherLibraryNames{};
+static std::string g_worklistFile; // cases of the session, see Worklist.h
+static Worklist g_worklist;
+static size_t g_firstCase = 0; // of the worklist, a restored session's
+static std::string g_sessionFile; // --session, see Session.h
+static Session g_session;
+static bool g_restoreSession = false; // camera etc. once the volume is up
+// reference images decoded with the case read ahead, the first ones
+static constexpr size_t g_caseImagePrefetch = 16;
+// --prediction-feed poses arriving this few at a time get their images
+// decoded ahead
+static constexpr size_t g_feedImagePrefetch = 16;
+static bool g_deviceLut = false;
+static size_t g_lutCacheBytes = 0;
+static int g_lutCacheBits = 0; // block-quantized LUT cache, 8 or 4
+static bool g_lacHalf = false;
+#ifdef HAVE_ITK
+static RawCtFormat g_rawCt; // valid: RAW volumes hold CT densities
+#endif
+static bool g_crop = false;
+static float g_cropThreshold = 0.f;
+static CropBox g_readRegion; // --read-region; empty: NIfTI volumes whole
+static size_t g_zarrConnections = 16; // chunks of Zarr stores in flight
+static std::string g_lacCacheDir; // empty: no on-disk LAC cache
+// the LAC cache in shared memory, shared with the node's other viewers
+static bool g_sharedVolumes = false;
+// huge pages and NUMA placement of volume buffers (CPU devices)
+static VolumeMemoryPolicy g_volumeMemory;
+static std::string g_imageCacheDir; // empty: references are always decoded
+static int g_brickSize = 0; // 0: linear fields
+static bool g_sparse = false; // attenuation as NanoVDB grids, SparseField.h
+static size_t g_lodLevels = 0; // coarse levels, picked by voxel footprint
+static size_t g_outOfCoreBytes = 0; // 0: RAW volumes are read as a whole
+static bool g_fitMemory = false;
+static size_t g_fitMemoryBytes = 0; // --fit-memory budget, 0: query
+static size_t g_volumeBudgetBytes = size_t(2048) << 20; // hidden volumes
+static float g_phaseRate = 0.f; // > 0: the volumes are phases, played back
+static size_t g_textureCacheBytes = size_t(256) << 20;
+static int g_renderWidth = 0, g_renderHeight = 0; // 0: follow the viewport
+static float g_renderScale = 1.f;
+static bool g_linearOutput = false;
+// percentiles of each linear frame the display window spans
+static float g_autoWindow[2] = {0.5f, 99.5f};
+static bool g_renderThread = false;
+static bool g_reproject = false;
+// frames by pose, host and texture tiers; 0 0: off
+static size_t g_frameCacheBytes = 0, g_frameCacheTextureBytes = 0;
+static OriginFormat g_originFormat = OriginFormat::Float3; // of the cache
+static std::string g_batchDir;
+static bool g_resume = false; // --batch, --samples: skip checkpointed work
+static std::string g_evaluateFile; // CSV of the --evaluate run
+static size_t g_registerIterations = 0; // > 0: --evaluate registers
+static float g_registerTolerance = 0.1f;
+static WarmStartOrder g_warmStart = WarmStartOrder::None;
+static bool g_registerGradient = false; // Gauss-Newton on DRR Jacobians
+static float g_registerSamples = 0.f; // of the pixels, coarse steps
+static PixelSampling g_registerSampling = PixelSampling::Stratified;
+static ImageRoi g_registerRoi;
+static PoseSamplerSettings g_multiStart; // count > 1: --register starts
+static std::string g_viewRigFile; // --register: further detectors
+static std::string g_trackSource; // frame pattern or directory, --track
+static std::string g_trackFile; // CSV of the tracked poses
+static float g_trackFollow = 0.f; // > 0: seconds to wait for new frames
+static TrackingSettings g_tracking;
+static int g_batchWidth = 1024, g_batchHeight = 1024;
+static int g_batchTile = 0; // > 0: larger batch images render in tiles
+static ImageFormat g_batchFormat = ImageFormat::Png;
+static DetectorSettings g_batchDetector; // noise models of batch images
+// scatter kernels by energy: of batch images (replacing --batch-detector's
+// scatter) and of the DRRs matched in --evaluate and --track
+static ScatterTable g_scatterTable;
+static size_t g_batchShard = 0; // > 0: batch images packed into tar shards
+static PoseSamplerSettings g_samples; // count > 0: --batch samples poses
+static bool g_buildTemplates = false; // of g_samples poses, see TemplateLibrary
+static std::string g_templateFile; // empty: <volume>.templates
+// linear projector pair (FirstHit.h): line integrals of the volume, or
+// projections back into its grid, as raw float32
+static std::string g_projectFile;
+static std::string g_backprojectFiles[2]; // projections, volume
+static std::string g_rendererName = "default";
+static int g_numDevices = 1;
+// --cpu-devices: batch poses are also rendered on devices of this library
+static std::string g_cpuLibrary;
+static int g_cpuDevices = 0;
+static bool g_slabs = false; // --batch: one z slab of the volume per device
+static std::string g_labelFile; // --batch: per-material DRRs, see --labels
+// --serve: the server reads and renders slab g_slabIndex of g_slabCount only
+static size_t g_slabIndex = 0;
+static size_t g_slabCount = 0;
+static std::vector<std::string> g_slabServers; // --batch: host:port per slab
+static int g_coordinatorPort = 0;
+static std::string g_workerAddress;
+static int g_servePort = 0; // render server, see Distributed.h
+static int g_metricsPort = 0; // --serve: Prometheus metrics
+static size_t g_serveQueue = 16384; // --serve: poses queued across clients
+static int g_streamPort = 0; // MJPEG stream of the viewport
+static size_t g_streamKbps = 20000;
+static std::string g_sweepLuts;
+static std::string g_sweepEnergies;
+static bool g_referenceCache = false;
+static bool g_poseCache = false; // match outcomes in <json>.posecache
+static size_t g_referencePoolBytes = size_t(256) << 20;
+static std::string g_recordMatchesDir;
+static PreprocessPipeline g_preprocess; // of reference images for matching
+// < 0: origins of point-query matchers are rendered instead of ray-marched
+static float g_firstHitThreshold = FirstHitSettings().threshold;
+// of ray-marched first hits and the builtin renderer
+static Projector g_projector = Projector::Sampled;
+static std::string g_drrTuningFile; // --tune-drr, see DrrTuning.h
+// --voxel-order: the builtin renderer's copy of the active volume
+static VoxelOrder g_voxelOrder = VoxelOrder::Linear;
+static ReorderedVoxels g_hostVoxels;
+// --deformation: control grid the builtin renderer warps the volume by
+static std::string g_deformationFile;
+static DeformationGrid g_deformation;
+static std::vector<float> g_deformationCoefficients;
+// --clip: object-space box (lower x, y, z, upper x, y, z) the volume and the
+// rays are clipped to; the settings editor moves it in the viewer
+static bool g_clip = false;
+static float g_clipBox[6]{0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+// edges of match frames for matchers taking them (MATCHER_CAP_QUERY_EDGES)
+static EdgeSettings g_matchEdges;
+static std::string g_benchFile;
+static std::string g_benchSizes;
+static RegressionGateSettings g_gate; // --gate: baseline file
+static bool g_gateUpdate = false; // --gate records a new baseline
+static std::string g_scaleStudyFile;
+static std::string g_scaleSizes = "128,256,512,1024,2048";
+static std::string g_scaleTypes = "float32,float16";
+static std::string g_profileFile;
+static unsigned g_anariCallsEvery = 0; // 0: ANARI calls not counted
+static std::string g_recordCameraFile;
+static std::string g_replayCameraFile;
+static std::string g_appendPredictionsFile; // binary, see prediction.h
+static std::string g_predictionFeed; // JSON lines, see PredictionFeed.h
+static std::string g_spectrumFile; // polychromatic beam, see readLacLuts()
+static std::vector<MatcherLibrary> g_matcherLibraries{};
+static bool g_lazyMatchers = false;
+static unsigned g_matcherThreads = 0; // 0: the task scheduler's
+static std::vector<int> g_matcherCpus; // affinity hint, see MatcherABI.h
+static std::string g_frameRingName; // shared memory, see FrameRingLayout.h
+static bool g_fastStart = false;
+static int g_previewStride = 4; // --preview; 0: none
+static bool g_comparisonGrid = false;
+static size_t g_drrCacheBytes = size_t(256) << 20; // 0: no DRRs ahead
+static StartupProfile g_startup; // printed at the first frame of the volume
 
 static const char *g_defaultLayout =
     R"layout(
@@ -97,19 +306,46 @@ namespace viewer {
 
 struct AppState
 {
+  // parallelFor() and the jobs without a scheduler of their own (image
+  // writes, brick loads) run on the session's
+  AppState()
+  {
+    TaskScheduler::setShared(&tasks);
+  }
+  // its workers are stopped before any member goes (members are destroyed
+  // in reverse order, so the scheduler itself is destroyed last)
+  ~AppState()
+  {
+    TaskScheduler::setShared(nullptr);
+    tasks.stop();
+  }
+
+  // background work of the session; first, so members handed a pointer to
+  // it never see it destroyed
+  TaskScheduler tasks;
   visionaray::pinhole_camera camera;
   anari::Device device{nullptr};
-  anari::World world{nullptr};
-  anari::SpatialField field{nullptr};
-  StructuredField sdata;
+  std::unique_ptr<VolumeScene> scene;
+  // every volume file of the session, active() is the one shown
+  VolumeManager volumes;
 #ifdef HAVE_ITK
   LacReader lacReader;
-  NiftiReader niftiReader;
 #endif
-  RAWReader rawReader;
+  // device fields of the volume shown per LUT id with --lut-cache, with
+  // their value histogram; the cache holds one reference to each field.
+  // Without it LUT switches rewrite the scene's field in place.
+  struct LutField
+  {
+    anari::SpatialField field{nullptr};
+    ValueHistogram histogram;
+  };
+  LruCache<size_t, LutField> fieldCache;
   prediction_container predictions;
-  std::vector<Image> images;
+  ImageStore images;
   MatchersWrapper matchers;
+
+  bool volumeReady{false};
+  size_t pendingLacLut{0};
 };
 
 static void statusFunc(const void *userData,
@@ -157,44 +393,672 @@ static std::vector<std::string> string_split(std::string s, char delim)
   return result;
 }
 
-static void initializeANARI()
+// The --clip box as the ray bounds of the builtin renderer and first hits
+static void applyClip(FirstHitSettings &settings)
+{
+  const float unbounded = FirstHitSettings::Unbounded;
+  for (int a = 0; a < 3; ++a) {
+    settings.clipLower[a] = g_clip ? g_clipBox[a] : -unbounded;
+    settings.clipUpper[a] = g_clip ? g_clipBox[a + 3] : unbounded;
+  }
+}
+
+// `gpu` >= 0 pins the device to that GPU (batch mode with --devices);
+// `libraryName` replaces --library (batch mode with --cpu-devices)
+static anari::Device newDevice(
+    int gpu = -1, const std::string &libraryName = g_libraryName)
 {
-  auto library =
-      anariLoadLibrary(g_libraryName.c_str(), statusFunc, &g_verbose);
+  anari::Library library = nullptr;
+  {
+    StartupProfile::Stage stage(g_startup, "load ANARI library");
+    library = anariLoadLibrary(libraryName.c_str(), statusFunc, &g_verbose);
+  }
   if (!library)
     throw std::runtime_error("Failed to load ANARI library");
 
   if (g_enableDebug)
     g_debug = anariLoadLibrary("debug", statusFunc, &g_true);
 
+  StartupProfile::Stage stage(g_startup, "create device");
   anari::Device dev = anariNewDevice(library, "default");
 
   anari::unloadLibrary(library);
 
+  if (gpu >= 0) {
+    // the name devices commonly use for CUDA device selection; devices that
+    // don't know it ignore it with a warning
+    anari_calls::setParameter(dev, dev, "cudaDevice", gpu);
+  }
+
   if (g_enableDebug)
-    anari::setParameter(dev, dev, "glDebug", true);
+    anari_calls::setParameter(dev, dev, "glDebug", true);
 
 #ifdef USE_GLES2
-  anari::setParameter(dev, dev, "glAPI", "OpenGL_ES");
+  anari_calls::setParameter(dev, dev, "glAPI", "OpenGL_ES");
 #else
-  anari::setParameter(dev, dev, "glAPI", "OpenGL");
+  anari_calls::setParameter(dev, dev, "glAPI", "OpenGL");
 #endif
 
   if (g_enableDebug) {
     anari::Device dbg = anariNewDevice(g_debug, "debug");
-    anari::setParameter(dbg, dbg, "wrappedDevice", dev);
+    anari_calls::setParameter(dbg, dbg, "wrappedDevice", dev);
     if (g_traceDir) {
-      anari::setParameter(dbg, dbg, "traceDir", g_traceDir);
-      anari::setParameter(dbg, dbg, "traceMode", "code");
+      anari_calls::setParameter(dbg, dbg, "traceDir", g_traceDir);
+      anari_calls::setParameter(dbg, dbg, "traceMode", "code");
     }
-    anari::commitParameters(dbg, dbg);
+    anari_calls::commitParameters(dbg, dbg);
     anari::release(dev, dev);
     dev = dbg;
   }
 
-  anari::commitParameters(dev, dev);
+  anari_calls::commitParameters(dev, dev);
+
+  return dev;
+}
+
+static void initializeANARI()
+{
+  g_device = newDevice();
+}
+
+// Match outcomes depend on the volumes and the renderer besides what
+// PoseCache keys hold; with --pose-cache they are kept next to the pose list
+static void openPoseCache(PoseCache &cache, const std::string &extra)
+{
+  std::string context = g_rendererName + "|" + extra;
+  for (auto &file : g_filenames)
+    context += "|" + file;
+  cache.setContext(context);
+  if (g_poseCache && !g_jsonfile.empty()) {
+    cache.open(
+        std::filesystem::path(g_jsonfile).replace_extension(".posecache"));
+  }
+}
+
+// Images preprocessed for matching are kept next to the pose list, like
+// the reference states
+static std::string preprocessCacheDir(const std::string &jsonFile)
+{
+  return jsonFile.empty()
+      ? std::string()
+      : std::filesystem::path(jsonFile).replace_extension(".prep").string();
+}
+
+// --frame-ring: external matchers read the frames to match from shared
+// memory; listed after the other matchers
+static void addFrameRingMatcher(MatchersWrapper &matchers)
+{
+  if (g_frameRingName.empty())
+    return;
+  auto ring = std::make_unique<frame_ring_matcher>();
+  if (!ring->create(g_frameRingName)) {
+    fprintf(
+        stderr, "Could not create frame ring %s\n", g_frameRingName.c_str());
+    return;
+  }
+  const std::string description =
+      "External matcher reading /dev/shm" + ring->name();
+  matchers.addMatcher(std::move(ring), "frame ring", description);
+}
+
+// --matcher-threads and --matcher-cpus for the matchers taking a budget
+static void setMatcherThreadBudget(AppState &state)
+{
+  MatcherThreadBudget budget;
+  budget.threads = g_matcherThreads > 0 ? g_matcherThreads
+                                        : unsigned(state.tasks.numThreads());
+  budget.cpus = g_matcherCpus;
+  budget.scheduler = &state.tasks;
+  state.matchers.setThreadBudget(budget);
+}
+
+// "0-3,8": cores 0 to 3 and 8; false if not such a list
+static bool parseCpuList(const std::string &list, std::vector<int> &cpus)
+{
+  cpus.clear();
+  for (auto &token : string_split(list, ',')) {
+    char *end = nullptr;
+    const long first = std::strtol(token.c_str(), &end, 10);
+    long last = first;
+    if (end == token.c_str())
+      return false;
+    if (*end == '-') {
+      const char *begin = end + 1;
+      last = std::strtol(begin, &end, 10);
+      if (end == begin)
+        return false;
+    }
+    if (*end != '\0' || first < 0 || last < first || last > 4095)
+      return false;
+    for (long cpu = first; cpu <= last; ++cpu)
+      cpus.push_back(int(cpu));
+  }
+  return !cpus.empty();
+}
+
+// The --spectrum's effective LUT, added to the file's; its id, or SIZE_MAX
+// without a spectrum
+static size_t addSpectrumLut(LacReader &lacReader)
+{
+  if (g_spectrumFile.empty())
+    return SIZE_MAX;
+  std::vector<SpectrumBin> bins;
+  if (!readSpectrum(g_spectrumFile, bins) || lacReader.m_lacLuts.empty()) {
+    fprintf(stderr,
+        "WARNING: spectrum %s not applied, using LUT %zu\n",
+        g_spectrumFile.c_str(),
+        lacReader.getActiveLut());
+    return SIZE_MAX;
+  }
+  const std::string name =
+      std::filesystem::path(g_spectrumFile).stem().string() + " (spectrum)";
+  return lacReader.addSpectrumLut(name, bins);
+}
+
+// Reads the LUT file; with --spectrum the spectrum's effective LUT is added
+// and becomes the active one, otherwise lutId (--lut) selects it
+static void readLacLuts(LacReader &lacReader,
+    std::string file = g_laclutfile,
+    size_t lutId = g_laclutid)
+{
+  if (!file.empty())
+    lacReader.setFilename(file);
+  lacReader.read();
+  lacReader.setActiveLut(lutId);
+  const size_t spectrum = addSpectrumLut(lacReader);
+  if (spectrum != SIZE_MAX)
+    lacReader.setActiveLut(spectrum);
+}
+
+// The LUTs of worklist case `index`, the command line's where the case
+// names none (and without a worklist)
+static void readCaseLacLuts(LacReader &lacReader, size_t index)
+{
+  if (index >= g_worklist.size()) {
+    readLacLuts(lacReader);
+    return;
+  }
+  const auto &c = g_worklist.at(index);
+  readLacLuts(lacReader,
+      c.lutFile.empty() ? g_laclutfile : c.lutFile,
+      c.lutId == SIZE_MAX ? g_laclutid : c.lutId);
+}
+
+#ifdef HAVE_ITK
+// Device-side LAC LUT: the field holds raw densities and the active LUT is
+// sampled into the volume's opacity transfer function over the LUT's density
+// range. Switching LUTs then only replaces this small array.
+static void setLacOpacity(anari::Device device,
+    anari::Volume volume,
+    const std::vector<float> &lac,
+    const float valueRange[2])
+{
+  anari_calls::setAndReleaseParameter(device,
+      volume,
+      "opacity",
+      anari::newArray1D(device, lac.data(), lac.size()));
+  anari_calls::setParameter(
+      device, volume, "valueRange", ANARI_FLOAT32_BOX1, valueRange);
+  anari_calls::commitParameters(device, volume);
+}
+
+static constexpr size_t g_lacSamples = 4096;
+
+static void setLacTransferFunction(anari::Device device,
+    anari::Volume volume,
+    const LacReader &lacReader,
+    size_t lacLutId)
+{
+  float valueRange[2];
+  auto lac =
+      lacReader.sample(lacLutId, g_lacSamples, valueRange[0], valueRange[1]);
+  setLacOpacity(device, volume, lac, valueRange);
+}
+
+// Continuous energy sweeps: the LUTs nearest to the photon energy blended
+// into the transfer function, the density field stays as it is
+static void setLacTransferFunctionAtEnergy(anari::Device device,
+    anari::Volume volume,
+    const LacReader &lacReader,
+    float photonEnergy)
+{
+  float valueRange[2];
+  auto lac = lacReader.sampleAtEnergy(
+      photonEnergy, g_lacSamples, valueRange[0], valueRange[1]);
+  if (!lac.empty())
+    setLacOpacity(device, volume, lac, valueRange);
+}
+#endif
+
+// If file type is raw, take dimensions and data type from its sidecar
+// header, or try to guess them from the file name (if not already set)
+static void guessRawDimensions(VolumeSource &volume)
+{
+  volume.dims[0] = g_dimX;
+  volume.dims[1] = g_dimY;
+  volume.dims[2] = g_dimZ;
+  volume.bytesPerCell = g_bytesPerCell;
+
+  const std::string &fileName = volume.fileName;
+  std::string ext = getExt(fileName);
+  if (ext == ".gz" || ext == ".zst") // compressed RAW
+    ext = getExt(fileName.substr(0, fileName.size() - ext.size()));
+  if (ext != ".raw" || g_dimX || g_dimY || g_dimZ || g_bytesPerCell)
+    return;
+
+  RawHeader header;
+  if (readRawHeader(fileName, header)) {
+    std::copy_n(header.dims, 3, volume.dims);
+    volume.bytesPerCell = header.bytesPerCell;
+    std::cout << "Dimensions and data type from " << rawHeaderFile(fileName)
+              << ": [dims x/y/z]: " << volume.dims[0] << " x "
+              << volume.dims[1] << " x " << volume.dims[2] << ", "
+              << volume.bytesPerCell << " byte(s)/cell\n";
+    return;
+  }
+
+  std::vector<std::string> strings;
+  strings = string_split(fileName, '_');
+
+  for (auto str : strings) {
+    int dimx, dimy, dimz;
+    int res = sscanf(str.c_str(), "%ix%ix%i", &dimx, &dimy, &dimz);
+    if (res == 3) {
+      volume.dims[0] = dimx;
+      volume.dims[1] = dimy;
+      volume.dims[2] = dimz;
+    }
+
+    int bits = 0;
+    res = sscanf(str.c_str(), "int%i", &bits);
+    if (res == 1)
+      volume.bytesPerCell = bits / 8;
+
+    res = sscanf(str.c_str(), "uint%i", &bits);
+    if (res == 1)
+      volume.bytesPerCell = bits / 8;
+
+    if (volume.hasRawDims())
+      break;
+  }
+
+  if (!volume.bytesPerCell)
+    volume.bytesPerCell = 4;
+
+  if (volume.hasRawDims()) {
+    std::cout
+        << "Guessing dimensions and data type from file name: [dims x/y/z]: "
+        << volume.dims[0] << " x " << volume.dims[1] << " x "
+        << volume.dims[2] << ", " << volume.bytesPerCell
+        << " byte(s)/cell\n";
+  }
+}
+
+// RAW volumes of CT densities (--raw-ct) are read and converted to LAC
+// like NIfTI volumes, rather than rendered as they are
+static bool isRawCt(const VolumeSource &volume)
+{
+#ifdef HAVE_ITK
+  return g_rawCt.valid() && volume.hasRawDims();
+#else
+  (void)volume;
+  return false;
+#endif
+}
+
+// The reader settings from the command line
+static void initVolume(VolumeSource &volume)
+{
+#ifdef HAVE_ITK
+  volume.niftiReader.lacFieldCache.setBudget(g_lutCacheBytes);
+  volume.niftiReader.lutCacheBits = g_lutCacheBits;
+  volume.niftiReader.halfPrecision = g_lacHalf;
+  volume.zarrReader.connections = g_zarrConnections;
+#endif
+  guessRawDimensions(volume);
+}
+
+// One VolumeSource per volume file on the command line (the first `count`)
+static void addVolumes(AppState &state, size_t count)
+{
+  for (size_t i = 0; i < std::min(count, g_filenames.size()); ++i)
+    initVolume(state.volumes.add(g_filenames[i]));
+}
+
+// --fit-memory: plans the volume's representation (MemoryFit.h) unless
+// that happened, from the dims and cell size given; false without
+// --fit-memory. NIfTI volumes planned as float16 convert to it from then on.
+static bool planVolumeFit(VolumeSource &volume,
+    const int dims[3],
+    unsigned bytesPerCell,
+    bool halfOk,
+    bool streamOk)
+{
+  if (!g_fitMemory)
+    return false;
+  if (volume.fit.planned)
+    return true;
+  const size_t budget =
+      g_fitMemoryBytes ? g_fitMemoryBytes : availableDeviceMemory();
+  volume.fit = planMemoryFit(dims, bytesPerCell, halfOk, streamOk, budget);
+  std::cout << "Memory fit of " << volume.fileName << " (" << dims[0] << "x"
+            << dims[1] << "x" << dims[2] << ", " << bytesPerCell
+            << " bytes per voxel): " << volume.fit.str() << "\n";
+#ifdef HAVE_ITK
+  if (volume.fit.half)
+    volume.niftiReader.halfPrecision = true;
+#endif
+  return true;
+}
+
+// The field as planned for its volume with --fit-memory, as is without
+static StructuredField fitVolume(
+    VolumeSource &volume, const StructuredField &field, bool halfOk)
+{
+  if (field.empty())
+    return field;
+  const int dims[3] = {field.dimX, field.dimY, field.dimZ};
+  if (!planVolumeFit(volume, dims, field.bytesPerCell, halfOk, false))
+    return field;
+  return applyMemoryFit(field, volume.fit);
+}
+
+#ifdef HAVE_ITK
+// NIfTI, HDF5 and Zarr volumes are read box only
+// (NiftiReader::selectRegion): the --read-region box, and of it the --serve
+// slab
+static bool readsRegion(const VolumeSource &volume)
+{
+  const std::string &file = volume.fileName;
+  auto endsWith = [&](const std::string &suffix) {
+    return file.size() >= suffix.size()
+        && file.compare(file.size() - suffix.size(), suffix.size(), suffix)
+        == 0;
+  };
+  return (!g_readRegion.empty() || g_slabCount > 0) && !isRawCt(volume)
+      && (endsWith(".nii") || endsWith(".nii.gz") || endsWith(".nii.zst")
+          || endsWith(".h5") || endsWith(".hdf5")
+          || ZarrReader::isZarr(file));
+}
+
+static CropBox readRegion(const int dims[3])
+{
+  CropBox box = g_readRegion;
+  for (int a = 0; a < 3; ++a) {
+    if (g_readRegion.empty()) {
+      box.lower[a] = 0;
+      box.upper[a] = dims[a] - 1;
+    }
+    box.upper[a] = std::min(box.upper[a], dims[a] - 1);
+  }
+  if (g_slabCount > 0 && !box.empty()) {
+    const auto range = slabRange(box.dim(2), g_slabIndex, g_slabCount);
+    box.upper[2] = box.lower[2] + int(range.z1);
+    box.lower[2] += int(range.z0);
+  }
+  return box;
+}
+
+// Opens the NIfTI file, DICOM series or Zarr store (and crops it) unless
+// that already happened; volumes served from the LAC cache are only opened
+// when a LUT that is not cached yet is selected
+static bool openCtVolume(VolumeSource &volume)
+{
+  auto &nifti = volume.niftiReader;
+  if (!nifti.voxels.empty())
+    return true;
+  PhantomSpec phantom;
+  if (PhantomSpec::parse(volume.fileName, phantom)) {
+    const float spacing[3] = {
+        phantom.spacing(), phantom.spacing(), phantom.spacing()};
+    const float origin[3] = {0.f, 0.f, 0.f};
+    nifti.setVolume(itk::IOComponentEnum::SHORT, phantom.dims, spacing, origin);
+    fillPhantom(phantom, reinterpret_cast<int16_t *>(nifti.voxels.data()));
+  } else if (isRawCt(volume)) {
+    if (!nifti.openRaw(volume.fileName.c_str(), volume.dims, g_rawCt))
+      return false;
+  } else {
+    if (readsRegion(volume))
+      nifti.selectRegion = readRegion;
+    auto &zarr = volume.zarrReader;
+    if (ZarrReader::isZarr(volume.fileName)) {
+      if (!zarr.open(volume.fileName) || !zarr.read(0, nifti))
+        return false;
+    } else if (DicomReader::isSeries(volume.fileName)) {
+      if (!volume.dicomReader.open(volume.fileName.c_str(), nifti))
+        return false;
+    } else if (!nifti.open(volume.fileName.c_str())) {
+      return false;
+    }
+  }
+  if (g_crop)
+    nifti.crop(g_cropThreshold);
+  return true;
+}
+
+static LacCacheKey lacCacheKey(
+    const LacReader &lacReader, const VolumeSource &volume)
+{
+  LacCacheKey key;
+  key.volumeFile = volume.fileName;
+  if (isRawCt(volume))
+    key.densityFormat = g_rawCt.str();
+  if (readsRegion(volume)) {
+    const CropBox &box = g_readRegion;
+    if (!box.empty()) {
+      key.region = std::to_string(box.lower[0]) + ","
+          + std::to_string(box.lower[1]) + "," + std::to_string(box.lower[2])
+          + "," + std::to_string(box.upper[0]) + ","
+          + std::to_string(box.upper[1]) + "," + std::to_string(box.upper[2]);
+    }
+    if (g_slabCount > 0) {
+      key.region += " slab " + std::to_string(g_slabIndex) + "/"
+          + std::to_string(g_slabCount);
+    }
+  }
+  key.lutFile = lacReader.m_filename;
+  key.lutId = lacReader.getActiveLut();
+  if (key.lutId >= lacReader.m_numFileLuts
+      && key.lutId < lacReader.m_lacLuts.size()) {
+    // the spectrum behind it may have changed since the volume was cached
+    const LacLut &lut = lacReader.m_lacLuts[key.lutId];
+    key.lutSamples = lut.density;
+    key.lutSamples.insert(
+        key.lutSamples.end(), lut.lac.begin(), lut.lac.end());
+  }
+  key.halfPrecision = volume.niftiReader.halfPrecision;
+  key.crop = g_crop;
+  key.cropThreshold = g_cropThreshold;
+  key.macrocellSize = volume.niftiReader.macrocellSize;
+  return key;
+}
+
+// Attenuation volume for the active LUT: mapped from --lac-cache (or
+// --shared-volumes) if it was converted before, converted (and added to the
+// cache) otherwise
+static StructuredField lacVolume(LacReader &lacReader, VolumeSource &volume)
+{
+  const LacCacheKey key = lacCacheKey(lacReader, volume);
+  volume.lacLut = key.lutId;
+  StructuredField field;
+  if (!g_lacCacheDir.empty()
+      && readLacCache(g_lacCacheDir, key, field, g_sharedVolumes))
+    return fitVolume(volume, field, true);
+  if (!openCtVolume(volume))
+    return field;
+  field = volume.niftiReader.getField(0, lacReader);
+  if (!g_lacCacheDir.empty() && writeLacCache(g_lacCacheDir, key, field)
+      && g_sharedVolumes) {
+    // the shared copy replaces this process's own
+    StructuredField shared;
+    if (readLacCache(g_lacCacheDir, key, shared, true))
+      field = std::move(shared);
+  }
+  return fitVolume(volume, field, true);
+}
+
+// --lod levels of OME-Zarr volumes: the store's own coarser levels, read
+// and converted like the volume instead of downsampled from it; none for
+// region reads, whose box the levels do not share
+static std::vector<StructuredField> zarrLevels(
+    LacReader &lacReader, const VolumeSource &volume, bool isLac)
+{
+  std::vector<StructuredField> levels;
+  const auto &zarr = volume.zarrReader;
+  if (!ZarrReader::isZarr(volume.fileName) || readsRegion(volume))
+    return levels;
+  for (size_t l = 1; l < zarr.numLevels() && l <= g_lodLevels; ++l) {
+    NiftiReader reader;
+    reader.halfPrecision = volume.niftiReader.halfPrecision;
+    if (!zarr.read(l, reader))
+      break;
+    levels.push_back(isLac ? reader.getField(0, lacReader)
+                           : reader.getDensityField(0));
+  }
+  return levels;
+}
+#endif
+
+// Reads and converts a volume into its sdata with the active LUT; host side
+// only, so this may run on a worker thread. `index`: the volume's among the
+// session's. `status` receives progress in [0, 1]. `interactive`: RAW
+// volumes may be streamed out of core.
+static void readVolume(LacReader &lacReader,
+    VolumeSource &volume,
+    size_t index,
+    const std::function<void(float, const char *)> &status,
+    bool interactive)
+{
+  TRACE_SCOPE("volume", "read volume");
+  status(0.f, "reading volume");
+  const char *fileName = volume.fileName.c_str();
+  PhantomSpec phantom;
+  // phantoms are generated as CT densities, see openCtVolume()
+  const bool isPhantom = PhantomSpec::parse(volume.fileName, phantom);
+  const bool isRaw = volume.hasRawDims() && !isRawCt(volume) && !isPhantom;
+  size_t streamBytes = g_outOfCoreBytes;
+  if (!streamBytes && isRaw
+      && planVolumeFit(volume,
+          volume.dims,
+          volume.bytesPerCell,
+          false,
+          interactive && g_filenames.size() == 1)
+      && volume.fit.outOfCore) {
+    streamBytes = volume.fit.bytes;
+  }
+  if (streamBytes && isRaw) {
+    // the coarse level is read here, fine bricks once the view is known
+    volume.brickStream.open(fileName,
+        volume.dims[0],
+        volume.dims[1],
+        volume.dims[2],
+        volume.bytesPerCell,
+        g_brickSize > 0 ? g_brickSize : 64,
+        streamBytes);
+  } else if (isRaw
+      && volume.rawReader.open(fileName,
+          volume.dims[0],
+          volume.dims[1],
+          volume.dims[2],
+          volume.bytesPerCell,
+          g_useMmap)) {
+    if (g_slabCount > 0) {
+      const auto range = slabRange(volume.dims[2], g_slabIndex, g_slabCount);
+      volume.rawReader.getSlab(range.z0, range.z1);
+    } else {
+      volume.rawReader.getField(0);
+    }
+    if (g_crop)
+      volume.rawReader.crop(g_cropThreshold);
+    volume.sdata = fitVolume(volume, volume.rawReader.field, false);
+  }
+#ifdef HAVE_ITK
+  else if (g_deviceLut) {
+    if (openCtVolume(volume)) {
+      volume.sdata =
+          fitVolume(volume, volume.niftiReader.getDensityField(0), true);
+      volume.isNifti = true;
+    }
+  } else if (g_phaseRate > 0.f && index > 0) {
+    // phases after the first are converted during playback (or when shown)
+    volume.isNifti = openCtVolume(volume);
+    volume.lacLut = SIZE_MAX;
+  } else {
+    status(0.5f, "converting to LAC");
+    volume.sdata = lacVolume(lacReader, volume);
+    volume.isNifti = !volume.sdata.empty();
+  }
+#else
+  else if (isPhantom) {
+    // attenuation right away, without LUTs to convert with
+    volume.sdata = makePhantomField(phantom);
+    volume.isNifti = true;
+  }
+#endif
+  volume.histogram = volume.sdata.histogram;
+  status(1.f, "uploading");
+
+  std::cout << "Peak RSS after volume load: "
+            << toMiB(peakResidentSetSize()) << " MiB\n";
+}
+
+// --preview: every g_previewStride-th voxel of the volume along each axis,
+// read and converted while readVolume() reads all of it; empty where there
+// is no quick strided read (compressed and streamed files, crops, region
+// and slab reads, LUTs applied on the device)
+static StructuredField readPreview(
+    const LacReader &lacReader, const VolumeSource &volume)
+{
+  StructuredField preview;
+  if (g_previewStride < 2 || g_crop || g_slabCount > 0 || g_outOfCoreBytes)
+    return preview;
+  TRACE_SCOPE("volume", "read preview");
+  const char *fileName = volume.fileName.c_str();
+  PhantomSpec phantom;
+  if (PhantomSpec::parse(volume.fileName, phantom))
+    return preview;
+  if (volume.hasRawDims() && !isRawCt(volume)) {
+    RAWReader reader;
+    if (reader.open(fileName,
+            volume.dims[0],
+            volume.dims[1],
+            volume.dims[2],
+            volume.bytesPerCell)
+        && reader.getPreview(g_previewStride))
+      preview = reader.field;
+  }
+#ifdef HAVE_ITK
+  else if (!isRawCt(volume) && !g_deviceLut && !readsRegion(volume))
+    readNiftiPreview(fileName, g_previewStride, lacReader, preview);
+#endif
+  return preview;
+}
 
-  g_device = dev;
+// Detector of the predictions' sensor block: its intrinsics matrix, or the
+// fov with a centered principal point. The pixel grid is the block's, else
+// the given one (the reference's); invalid without a sensor geometry.
+static DetectorGeometry sensorDetector(
+    const prediction_container &predictions, int width, int height)
+{
+  if (predictions.sensor_width > 0 && predictions.sensor_height > 0) {
+    width = int(predictions.sensor_width);
+    height = int(predictions.sensor_height);
+  }
+  const auto &k = predictions.intrinsics;
+  if (k[0] > 0.f && k[4] > 0.f) {
+    DetectorGeometry detector;
+    detector.width = width;
+    detector.height = height;
+    detector.fx = k[0];
+    detector.fy = k[4];
+    detector.cx = k[2];
+    detector.cy = k[5];
+    return detector;
+  }
+  if (predictions.fovx > 0.f && predictions.fovy > 0.f)
+    return DetectorGeometry::fromFov(
+        width, height, predictions.fovx, predictions.fovy);
+  return DetectorGeometry();
 }
 
 // Application definition /////////////////////////////////////////////////////
@@ -209,45 +1073,19 @@ class Application : public anari_viewer::Application
   {
     anari_viewer::ui::init();
 
-    // If file type is raw, try to guess dimensions and data type
-    // (if not already set)
-    if (getExt(g_filename) == ".raw" && !g_dimX && !g_dimY && !g_dimZ
-        && !g_bytesPerCell) {
-      std::vector<std::string> strings;
-      strings = string_split(g_filename, '_');
-
-      for (auto str : strings) {
-        int dimx, dimy, dimz;
-        int res = sscanf(str.c_str(), "%ix%ix%i", &dimx, &dimy, &dimz);
-        if (res == 3) {
-          g_dimX = dimx;
-          g_dimY = dimy;
-          g_dimZ = dimz;
-        }
-
-        int bits = 0;
-        res = sscanf(str.c_str(), "int%i", &bits);
-        if (res == 1)
-          g_bytesPerCell = bits / 8;
-
-        res = sscanf(str.c_str(), "uint%i", &bits);
-        if (res == 1)
-          g_bytesPerCell = bits / 8;
+    addVolumes(m_state, g_filenames.size());
 
-        if (g_dimX && g_dimY && g_dimZ && g_bytesPerCell)
-          break;
-      }
-
-      if (!g_bytesPerCell)
-        g_bytesPerCell = 4;
-
-      if (g_dimX && g_dimY && g_dimZ && g_bytesPerCell) {
-        std::cout
-            << "Guessing dimensions and data type from file name: [dims x/y/z]: "
-            << g_dimX << " x " << g_dimY << " x " << g_dimZ << ", "
-            << g_bytesPerCell << " byte(s)/cell\n";
-      }
+    // Read and convert the volume on a worker thread, while the device comes
+    // up; only the conversion needs the LUTs
+    {
+      StartupProfile::Stage stage(g_startup, "read LUTs");
+      readCaseLacLuts(m_state.lacReader, m_caseIndex);
     }
+    if (g_restoreSession
+        && g_session.lutId < m_state.lacReader.m_numFileLuts)
+      m_state.lacReader.setActiveLut(g_session.lutId);
+    m_state.pendingLacLut = m_state.lacReader.getActiveLut();
+    startVolumeLoad();
 
     // ANARI //
 
@@ -259,172 +1097,64 @@ class Application : public anari_viewer::Application
       std::exit(1);
 
     m_state.device = device;
-    m_state.world = anari::newObject<anari::World>(device);
+    // the world starts out with a field-less volume and the field is swapped
+    // in once the volume has been loaded
+    m_state.scene = std::make_unique<VolumeScene>(device, g_brickSize, g_verbose);
+    m_state.scene->setSparse(g_sparse);
+    if (g_clip)
+      m_state.scene->setClip(g_clipBox, g_clipBox + 3);
+    m_state.volumes.setDeviceBudget(device, g_volumeBudgetBytes);
 
     // Matchers //
-    m_state.matchers.init(g_matcherLibraryNames);
-
-    // Setup scene //
-
-    if (!g_laclutfile.empty())
-      m_state.lacReader.setFilename(g_laclutfile);
-    m_state.lacReader.read();
-    m_state.lacReader.setActiveLut(g_laclutid);
-
-    if (g_dimX && g_dimY && g_dimZ && g_bytesPerCell
-        && m_state.rawReader.open(
-            g_filename.c_str(), g_dimX, g_dimY, g_dimZ, g_bytesPerCell)) {
-      m_state.sdata = m_state.rawReader.getField(0);
-      auto &data = m_state.sdata;
-
-      auto field =
-          anari::newObject<anari::SpatialField>(device, "structuredRegular");
-
-      anari::Array3D scalar;
-      if (data.bytesPerCell == 1) {
-        scalar = anariNewArray3D(device,
-            data.dataUI8.data(),
-            0,
-            0,
-            ANARI_UFIXED8,
-            g_dimX,
-            g_dimY,
-            g_dimZ);
-      } else if (data.bytesPerCell == 2) {
-        scalar = anariNewArray3D(device,
-            data.dataUI16.data(),
-            0,
-            0,
-            ANARI_UFIXED16,
-            g_dimX,
-            g_dimY,
-            g_dimZ);
-      } else if (data.bytesPerCell == 4) {
-        scalar = anariNewArray3D(device,
-            data.dataF32.data(),
-            0,
-            0,
-            ANARI_FLOAT32,
-            g_dimX,
-            g_dimY,
-            g_dimZ);
-      }
-
-      anari::setAndReleaseParameter(device, field, "data", scalar);
-      anari::setParameter(device, field, "filter", ANARI_STRING, "linear");
-
-      anari::commitParameters(device, field);
-      m_state.field = field;
-
-      g_voxelRange[0] = data.dataRange.x;
-      g_voxelRange[1] = data.dataRange.y;
-    }
-#ifdef HAVE_ITK
-    else if (m_state.niftiReader.open(g_filename.c_str())) {
-      m_state.sdata = m_state.niftiReader.getField(0, m_state.lacReader);
-      auto &data = m_state.sdata;
-
-      auto field =
-          anari::newObject<anari::SpatialField>(device, "structuredRegular");
-
-      anari::Array3D scalar;
-      if (data.bytesPerCell == 1) {
-        scalar = anariNewArray3D(device,
-            data.dataUI8.data(),
-            0,
-            0,
-            ANARI_UFIXED8,
-            data.dimX,
-            data.dimY,
-            data.dimZ);
-      } else if (data.bytesPerCell == 2) {
-        scalar = anariNewArray3D(device,
-            data.dataUI16.data(),
-            0,
-            0,
-            ANARI_UFIXED16,
-            data.dimX,
-            data.dimY,
-            data.dimZ);
-      } else if (data.bytesPerCell == 4) {
-        scalar = anariNewArray3D(device,
-            data.dataF32.data(),
-            0,
-            0,
-            ANARI_FLOAT32,
-            data.dimX,
-            data.dimY,
-            data.dimZ);
-      }
-
-      anari::setAndReleaseParameter(device, field, "data", scalar);
-      anari::setParameter(device, field, "filter", ANARI_STRING, "linear");
-
-      anari::commitParameters(device, field);
-      m_state.field = field;
-
-      g_voxelRange[0] = data.dataRange.x;
-      g_voxelRange[1] = data.dataRange.y;
-    }
-#endif
-
-    // Volume //
-
-    auto volume = anari::newObject<anari::Volume>(device, "transferFunction1D");
-    anari::setParameter(device, volume, "value", m_state.field);
-    anari::setParameter(device, volume, "field", m_state.field);
-
     {
-      std::vector<anari::math::float3> colors;
-      std::vector<float> opacities;
-
-      colors.emplace_back(0.f, 0.f, 1.f);
-      colors.emplace_back(0.f, 1.f, 0.f);
-      colors.emplace_back(1.f, 0.f, 0.f);
-
-      opacities.emplace_back(0.f);
-      opacities.emplace_back(1.f);
-
-      anari::setAndReleaseParameter(device,
-          volume,
-          "color",
-          anari::newArray1D(device, colors.data(), colors.size()));
-      anari::setAndReleaseParameter(device,
-          volume,
-          "opacity",
-          anari::newArray1D(device, opacities.data(), opacities.size()));
-      anariSetParameter(
-          device, volume, "valueRange", ANARI_FLOAT32_BOX1, &g_voxelRange);
+      StartupProfile::Stage stage(g_startup, "matchers");
+      m_state.matchers.init(g_matcherLibraries, g_lazyMatchers || g_fastStart);
+      addFrameRingMatcher(m_state.matchers);
+      setMatcherThreadBudget(m_state);
     }
+    m_state.matchers.setDeviceReferenceBudget(g_referencePoolBytes);
+    if (g_referenceCache && !g_jsonfile.empty())
+      m_state.matchers.setReferenceCacheDir(
+          std::filesystem::path(g_jsonfile).replace_extension(".refcache"));
+    openPoseCache(m_poseCache, "interactive");
 
-    anari::commitParameters(device, volume);
-
-#if 1
-    anari::setAndReleaseParameter(
-        device, m_state.world, "volume", anari::newArray1D(device, &volume));
-    anari::release(device, volume);
-#endif
+    // Setup scene //
 
-    anari::commitParameters(device, m_state.world);
+    m_state.fieldCache.setBudget(g_lutCacheBytes);
+    m_state.fieldCache.setEvictCallback(
+        [device](const size_t &, AppState::LutField &entry) {
+          anari::release(device, entry.field);
+        });
 
     // Predictions from JSON //
 
-    if (!g_jsonfile.empty())
-      m_state.predictions = prediction_container(g_jsonfile);
-    // load images
-    if (!m_state.predictions.predictions.empty())
+    if (!g_jsonfile.empty()) {
+      StartupProfile::Stage stage(g_startup, "read predictions");
+      m_state.predictions = prediction_container(g_jsonfile); // JSON or .pred
+    }
+    // reference images are decoded lazily by the image store
+    m_state.images.setScheduler(&m_state.tasks);
+    m_state.images.setDecodedCache(g_imageCacheDir);
     {
-      for (auto it = m_state.predictions.begin(); it != m_state.predictions.end(); ++it)
-      {
-        visionaray::image visionarayImage;
-        visionarayImage.load(it->filename);
-        std::cout << "Loaded " << it->filename << ": ("
-            << visionarayImage.width() << "x" << visionarayImage.height()
-            << ", " << visionarayImage.format() << ")\n";
-        m_state.images.emplace_back(visionarayImage.width(), visionarayImage.height(), 4 /*TODO bpp*/, visionarayImage.data());
-      }
+      std::vector<std::string> filenames;
+      for (auto &p : m_state.predictions)
+        filenames.push_back(p.filename);
+      m_state.images.setFilenames(std::move(filenames));
+    }
+    if (!g_predictionFeed.empty()) {
+      m_feed =
+          std::make_unique<PredictionFeed>(g_predictionFeed, m_state.tasks);
+    }
+    if (!g_preprocess.empty()) {
+      m_state.images.setPreprocessing(
+          g_preprocess, preprocessCacheDir(g_jsonfile));
+      char variant[32];
+      snprintf(variant,
+          sizeof(variant),
+          "p%016llx",
+          (unsigned long long)g_preprocess.hash());
+      m_state.matchers.setReferenceVariant(variant);
     }
-
 
     // ImGui //
 
@@ -436,189 +1166,426 @@ class Application : public anari_viewer::Application
       ImGui::LoadIniSettingsFromMemory(g_defaultLayout);
 
     m_state.camera = visionaray::pinhole_camera();
-    auto *viewport = new anari_viewer::windows::DRRViewport(device, m_state.camera, "Viewport");
-    viewport->setWorld(m_state.world);
+    // --fast-start creates the --renderer subtype only, the others once
+    // picked from the menu
+    anari_viewer::windows::DRRViewport *viewport = nullptr;
+    {
+      StartupProfile::Stage stage(g_startup, "viewport");
+      viewport = new anari_viewer::windows::DRRViewport(device,
+          m_state.camera,
+          "Viewport",
+          g_fastStart ? g_rendererName.c_str() : nullptr);
+      if (!g_fastStart)
+        viewport->instantiateRenderers();
+    }
+    viewport->setWorld(m_state.scene->world());
+    // LUT, window, volume and phase switches change the world, not the view
+    viewport->setWorldVersionCallback(
+        [this]() { return m_state.scene->version(); });
     viewport->addManipulator( std::make_shared<visionaray::arcball_manipulator>(m_state.camera, visionaray::mouse::Left) );
     viewport->addManipulator( std::make_shared<visionaray::pan_manipulator>(m_state.camera, visionaray::mouse::Middle) );
     viewport->addManipulator( std::make_shared<visionaray::pan_manipulator>(m_state.camera, visionaray::mouse::Left, visionaray::keyboard::Alt) );
     viewport->addManipulator( std::make_shared<visionaray::zoom_manipulator>(m_state.camera, visionaray::mouse::Right) );
     viewport->resetView();
+    if (g_streamPort > 0) {
+      m_streamer = std::make_unique<FrameStreamer>(g_streamPort, g_streamKbps);
+      if (m_streamer->listening())
+        viewport->setFrameStreamer(m_streamer.get());
+    }
+    viewport->setTaskScheduler(&m_state.tasks);
+    viewport->setDeviceArbiter(&m_deviceArbiter);
+    m_gpuCounters = std::make_unique<GpuCounters>();
+    viewport->setGpuCounters(m_gpuCounters.get());
+    if (g_renderWidth > 0 && g_renderHeight > 0)
+      viewport->setFixedRenderSize({g_renderWidth, g_renderHeight});
+    else if (g_renderScale != 1.f)
+      viewport->setRenderScale(g_renderScale);
+    viewport->setLinearOutput(g_linearOutput);
+    viewport->setAutoWindowPercentiles(g_autoWindow[0], g_autoWindow[1]);
+    if (g_renderThread)
+      viewport->setRenderThread(true);
+    viewport->setReprojection(g_reproject);
+    viewport->setFrameCache(g_frameCacheBytes, g_frameCacheTextureBytes);
+    viewport->setOriginFormat(g_originFormat);
+    if (g_matchEdges.mode != EdgeSettings::None)
+      viewport->setEdgeChannel(g_matchEdges);
+    m_viewport = viewport;
+    showSensorGrid();
 
     auto *imageViewport = new anari_viewer::windows::ImageViewport(m_state.images);
+    imageViewport->setTextureBudget(g_textureCacheBytes);
+    // one matching ROI, drawn on either the DRR or the reference
+    viewport->setRoiChangedCallback(
+        [imageViewport](const ImageRoi &roi) { imageViewport->setRoi(roi); });
+    imageViewport->setRoiChangedCallback(
+        [viewport](const ImageRoi &roi) { viewport->setRoi(roi); });
+    // the reference shown can be laid over the DRR
+    viewport->setOverlaySource(
+        [imageViewport]() { return imageViewport->texture(); });
 
     auto *seditor = new anari_viewer::windows::SettingsEditor();
     seditor->setLacLutNames(m_state.lacReader.getNames());
     seditor->setActiveLacLut(m_state.lacReader.getActiveLut());
+    {
+      std::vector<float> energies;
+      for (auto &lut : m_state.lacReader.m_lacLuts)
+        energies.push_back(float(lut.eV));
+      seditor->setLacLutEnergies(std::move(energies));
+    }
     seditor->setUpdatePhotonEnergyCallback(
-        [=](const float &photonEnergy) {
+        [=, this](const float &photonEnergy) {
             viewport->setPhotonEnergy(photonEnergy);
+            // batch renderers take keV
+            if (m_comparisonGrid)
+              m_comparisonGrid->setPhotonEnergy(photonEnergy / 1000.f);
+            if (m_drrCache)
+              m_drrCache->setPhotonEnergy(photonEnergy / 1000.f);
+            m_photonEnergy = photonEnergy;
+#ifdef HAVE_ITK
+            if (g_deviceLut && m_state.volumeReady) {
+              setLacTransferFunctionAtEnergy(device,
+                  m_state.scene->volume(),
+                  m_state.lacReader,
+                  photonEnergy);
+              m_state.scene->markChanged();
+            }
+#endif
         });
-    seditor->setUpdateLacLutCallback(
-        [=, this](const size_t &lacLutId) {
-            m_state.lacReader.setActiveLut(lacLutId);
-
-            m_state.sdata = m_state.niftiReader.getField(0, m_state.lacReader);
-            auto &data = m_state.sdata;
-
-            auto field =
-                anari::newObject<anari::SpatialField>(device, "structuredRegular");
-
-            anari::Array3D scalar;
-            if (data.bytesPerCell == 1) {
-              scalar = anariNewArray3D(device,
-                  data.dataUI8.data(),
-                  0,
-                  0,
-                  ANARI_UFIXED8,
-                  data.dimX,
-                  data.dimY,
-                  data.dimZ);
-            } else if (data.bytesPerCell == 2) {
-              scalar = anariNewArray3D(device,
-                  data.dataUI16.data(),
-                  0,
-                  0,
-                  ANARI_UFIXED16,
-                  data.dimX,
-                  data.dimY,
-                  data.dimZ);
-            } else if (data.bytesPerCell == 4) {
-              scalar = anariNewArray3D(device,
-                  data.dataF32.data(),
-                  0,
-                  0,
-                  ANARI_FLOAT32,
-                  data.dimX,
-                  data.dimY,
-                  data.dimZ);
+    m_updateLacLut =
+        [=, this](size_t lacLutId) {
+            if (!m_state.volumeReady) {
+              // applied on this thread by finishVolumeLoad() once the
+              // volume is ready
+              m_state.pendingLacLut = lacLutId;
+              return;
             }
+            waitForMatch(); // point lookups may read the host volume
 
-            anari::setAndReleaseParameter(device, field, "data", scalar);
-            anari::setParameter(device, field, "filter", ANARI_STRING, "linear");
-
-            anari::commitParameters(device, field);
-            m_state.field = field;
-
-            g_voxelRange[0] = data.dataRange.x;
-            g_voxelRange[1] = data.dataRange.y;
-
-            // Volume //
-
-            auto volume =
-                anari::newObject<anari::Volume>(device, "transferFunction1D");
-            anari::setParameter(device, volume, "value", m_state.field);
-            anari::setParameter(device, volume, "field", m_state.field);
+            if (m_player.active() && !g_deviceLut) {
+              // the worker converts with the LUT; the shown phase is
+              // converted again, the window stays as set. A conversion
+              // with the old LUT that has not started is dropped.
+              m_player.cancel();
+              m_state.lacReader.setActiveLut(lacLutId);
+              m_player.refresh();
+              return;
+            }
 
-            {
-              std::vector<anari::math::float3> colors;
-              std::vector<float> opacities;
+            m_state.lacReader.setActiveLut(lacLutId);
+            auto &volume = m_state.volumes.active();
 
-              colors.emplace_back(0.f, 0.f, 1.f);
-              colors.emplace_back(0.f, 1.f, 0.f);
-              colors.emplace_back(1.f, 0.f, 0.f);
+            if (g_deviceLut) {
+              setLacTransferFunction(device,
+                  m_state.scene->volume(),
+                  m_state.lacReader,
+                  m_state.lacReader.getActiveLut());
+              m_state.scene->markChanged();
+              return;
+            }
 
-              opacities.emplace_back(0.f);
-              opacities.emplace_back(1.f);
+            // hidden volumes are converted again when shown
+            m_state.volumes.dropDeviceFields();
 
-              anari::setAndReleaseParameter(device,
-                  volume,
-                  "color",
-                  anari::newArray1D(device, colors.data(), colors.size()));
-              anari::setAndReleaseParameter(device,
-                  volume,
-                  "opacity",
-                  anari::newArray1D(device, opacities.data(), opacities.size()));
-              anariSetParameter(
-                  device, volume, "valueRange", ANARI_FLOAT32_BOX1, &g_voxelRange);
+            if (g_lutCacheBytes == 0) {
+              // nothing to keep: the new LUT's volume is converted straight
+              // into the current field's mapped data array, without a host
+              // copy (the disk cache needs one to write)
+              auto &nifti = volume.niftiReader;
+              // the LOD pyramid is built from the host volume
+              if (g_lacCacheDir.empty() && g_lodLevels == 0
+                  && volume.fit.level == 0 && openCtVolume(volume)) {
+                auto layout = nifti.getFieldLayout();
+                if (void *dst = m_state.scene->mapField(layout)) {
+                  nifti.convertField(m_state.lacReader,
+                      dst,
+                      &layout.macrocells,
+                      &layout.histogram);
+                  if (!layout.histogram.empty()) {
+                    layout.dataRange = {
+                        layout.histogram.lower, layout.histogram.upper};
+                  }
+                  m_state.scene->unmapField(layout);
+                  volume.histogram = layout.histogram;
+                  volume.lacLut = lacLutId;
+                  // host volumes of the previous LUT
+                  nifti.lacFieldCache.clear();
+                  nifti.unpackedField = StructuredField();
+                  volume.sdata = std::move(layout);
+                  return;
+                }
+              }
+              volume.sdata = lacVolume(m_state.lacReader, volume);
+              m_state.scene->setField(volume.sdata, true);
+              volume.histogram = volume.sdata.histogram;
+              buildLod();
+              return;
             }
 
-            anari::commitParameters(device, volume);
+            AppState::LutField entry;
+            if (auto *cached = m_state.fieldCache.get(lacLutId)) {
+              entry = *cached;
+              if (g_lodLevels > 0) // the pyramid's source, from the host cache
+                volume.sdata = lacVolume(m_state.lacReader, volume);
+            } else {
+              volume.sdata = lacVolume(m_state.lacReader, volume);
+              auto &data = volume.sdata;
 
-#if 1
-            anari::setAndReleaseParameter(
-                device, m_state.world, "volume", anari::newArray1D(device, &volume));
-            anari::release(device, volume);
-#endif
-
-            anari::commitParameters(device, m_state.world);
+              entry.field = m_state.scene->newField(data, true);
+              entry.histogram = data.histogram;
+              size_t bytes = size_t(data.dimX) * data.dimY * data.dimZ
+                  * data.bytesPerCell;
+              m_state.fieldCache.put(lacLutId, entry, bytes);
+            }
 
-        });
+            // the cached LUT's own range, sdata may hold another LUT's voxels
+            float valueRange[2] = {
+                volume.sdata.dataRange.x, volume.sdata.dataRange.y};
+            if (!entry.histogram.empty()) {
+              valueRange[0] = entry.histogram.lower;
+              valueRange[1] = entry.histogram.upper;
+            }
+            m_state.scene->setField(entry.field, valueRange);
+            volume.histogram = entry.histogram;
+            buildLod();
+        };
+    seditor->setUpdateLacLutCallback([this](const size_t &lacLutId) {
+      m_updateLacLut(lacLutId);
+      showValueHistogram();
+    });
+    seditor->setUpdateValueRangeCallback([this](const float *valueRange) {
+      if (!m_state.volumeReady)
+        return;
+      m_state.scene->setValueRange(valueRange);
+      std::copy_n(valueRange, 2, m_lodRange);
+    });
+    seditor->setClip(g_clip, g_clipBox);
+    seditor->setUpdateClipCallback(
+        [this](bool clip, const float *box) { setClip(clip, box); });
+    seditor->setVolumeNames(m_state.volumes.names());
+    seditor->setUpdateVolumeCallback(
+        [this](const size_t &index) { showVolume(index); });
+    seditor->setUpdatePlaybackCallback([this](bool playing, float rate) {
+      m_player.setRate(rate);
+      m_player.setPlaying(playing);
+    });
+    seditor->setSeekPhaseCallback(
+        [this](const size_t &phase) { m_player.seek(phase); });
+    m_settingsEditor = seditor;
 
     auto *peditor = new anari_viewer::windows::PredictionsEditor(m_state.predictions, m_state.matchers.m_matcherNames);
     peditor->setUpdateCameraCallback(
-        [=](const anari::math::float3 &eye, 
+        [=, this](const anari::math::float3 &eye, 
             const anari::math::float3 &center,
             const anari::math::float3 &up)
         {
           viewport->setView(eye, center, up);
+          showCachedDrr(eye, center, up);
         });
     peditor->setResetCameraCallback([=](){ viewport->resetView(); });
-    peditor->setShowImageCallback([=](size_t index){ imageViewport->showImage(index); });
-    peditor->setSetActiveMatcherIndexCallback([this](size_t index){ m_state.matchers.setActiveMatcherIndex(index); });
+    peditor->setShowImageCallback([=, this](size_t index){
+        imageViewport->showImage(index);
+        // the next reference is the likely next pick
+        m_state.images.prefetch(index + 1);
+        });
+    peditor->setSetActiveMatcherIndexCallback([this](size_t index) {
+      waitForMatch();
+      m_state.matchers.setActiveMatcherIndex(index);
+      // the newly selected matcher has not seen the reference yet
+      if (m_reference) {
+        auto pyramid = m_referencePyramid;
+        setMatcherReference(m_referenceIndex);
+        m_referencePyramid = pyramid;
+        setMatcherReferencePyramid();
+      }
+    });
     peditor->setLoadReferenceImageCallback([=, this](size_t index){
-        auto& im = m_state.images[index];
-        m_state.matchers.getActiveMatcher()->set_image(im.data.data(),
-                                                       im.width,
-                                                       im.height,
-                                                       feature_matcher::PIXEL_TYPE::RGBA,
-                                                       feature_matcher::IMAGE_TYPE::REFERENCE,
-                                                       true /*swizzle*/);
+        // as preprocessed for matching (--preprocess)
+        auto im = m_state.images.reference(index);
+        if (!im)
+          return;
+        waitForMatch();
+        m_reference = im;
+        m_referenceIndex = index;
+        m_referenceSwizzle = true;
+        setMatcherReference(index);
+        // DRRs at the reference's resolution, where the sensor block does
+        // not fix the pixel grid
+        const auto &detector = viewport->detector();
+        if (viewport->detectorEnabled()
+            && (detector.width != int(im->width)
+                || detector.height != int(im->height))
+            && !m_state.predictions.sensor_width) {
+          viewport->setDetector(sensorDetector(
+              m_state.predictions, int(im->width), int(im->height)));
+        }
         });
     peditor->setLoadFramebufferAsReferenceImageCallback([=, this](){
-        std::vector<uint8_t> fb;
-        std::vector<float> depth3d;
-        size_t width, height;
-        viewport->getFrame(fb, depth3d, width, height);
-        m_state.matchers.getActiveMatcher()->set_image(fb.data(),
-                                                       width,
-                                                       height,
-                                                       feature_matcher::PIXEL_TYPE::RGBA,
-                                                       feature_matcher::IMAGE_TYPE::REFERENCE,
-                                                       false /*swizzle*/);
-        });
-    peditor->setMatchCallback([=, this](){
-        std::vector<uint8_t> fb;
-        std::vector<float> depth3d;
-        size_t width, height;
-        viewport->getFrame(fb, depth3d, width, height);
-        m_state.matchers.getActiveMatcher()->set_image(depth3d.data(),
-                                                       width,
-                                                       height,
-                                                       feature_matcher::PIXEL_TYPE::FLOAT3,
-                                                       feature_matcher::IMAGE_TYPE::DEPTH3D,
-                                                       false /*swizzle*/);
-        m_state.matchers.getActiveMatcher()->set_image(fb.data(),
-                                                       width,
-                                                       height,
-                                                       feature_matcher::PIXEL_TYPE::RGBA,
-                                                       feature_matcher::IMAGE_TYPE::QUERY,
-                                                       false /*swizzle*/);
-        // match
-        anari::math::float3 eye, center, up;
-        float fovy, aspect;
-        viewport->getView(eye, center, up, fovy, aspect);
-        m_state.matchers.getActiveMatcher()->calibrate(width, height, fovy, aspect);
-        m_state.matchers.getActiveMatcher()->match();
-        // update view
-        std::array<float, 3> eyeArr{eye.x, eye.y, eye.z};
-        std::array<float, 3> centerArr{center.x, center.y, center.z};
-        std::array<float, 3> upArr{up.x, up.y, up.z};
-        m_state.matchers.getActiveMatcher()->update_camera(eyeArr, centerArr, upArr);
-        eye = anari::math::float3{eyeArr[0], eyeArr[1], eyeArr[2]};
-        center = anari::math::float3{centerArr[0], centerArr[1], centerArr[2]};
-        up = anari::math::float3{upArr[0], upArr[1], upArr[2]};
-        viewport->setView(eye, center, up);
+        auto frame = viewport->mapFrame(false);
+        if (!frame.valid())
+          return;
+        waitForMatch();
+        // kept (and handed to the matcher) as a copy, since a pyramid may be
+        // built from it after the frame is gone
+        auto im = std::make_shared<const Image>(
+            frame.width(), frame.height(), 4, frame.color().data());
+        m_reference = im;
+        m_referenceIndex = SIZE_MAX;
+        m_referenceSwizzle = false;
+        setMatcherReference(SIZE_MAX);
         });
+    peditor->setMatchCallback([this]() { requestMatch(); });
+    peditor->setMatchAllCallback([this]() { startMatchAll(); });
+    peditor->setRegisterCallback(
+        [this](int maxIterations, float tolerance, int numLevels) {
+      waitForMatch();
+      initializeFromTemplates();
+      if (numLevels > 1 && m_reference) {
+        // pyramids of stored references are cached by the image store
+        m_referencePyramid = m_referenceIndex != SIZE_MAX
+            ? m_state.images.pyramid(m_referenceIndex, numLevels)
+            : ImagePyramid::build(m_reference, numLevels);
+        numLevels = m_referencePyramid ? int(m_referencePyramid->size()) : 1;
+        setMatcherReferencePyramid();
+      } else {
+        numLevels = 1;
+      }
+      m_registration.start(maxIterations, tolerance, numLevels);
+      m_predictionsEditor->setRegistrationStatus(m_registration.status());
+      requestMatch();
+    });
+    peditor->setStopRegistrationCallback([this]() {
+      m_registration.stop();
+      m_predictionsEditor->setRegistrationStatus(m_registration.status());
+    });
+    m_predictionsEditor = peditor;
+    // with --fast-start, reference images are not decoded for thumbnails
+    // before the first frame is up
+    if (!g_fastStart)
+      createThumbnails();
 
     anari_viewer::WindowArray windows;
     windows.emplace_back(viewport);
     windows.emplace_back(seditor);
     windows.emplace_back(peditor);
     windows.emplace_back(imageViewport);
+    m_imageViewport = imageViewport;
+
+    if (g_drrCacheBytes > 0) {
+      m_drrCache = std::make_unique<DrrCache>(device,
+          m_state.scene->world(),
+          m_state.tasks,
+          g_rendererName,
+          g_drrCacheBytes,
+          &m_deviceArbiter);
+    }
+    loadTemplates();
+
+    if (g_comparisonGrid) {
+      BatchRenderSettings settings;
+      settings.renderer = g_rendererName;
+      if (m_state.predictions.fovy > 0.f)
+        settings.fovy = m_state.predictions.fovy;
+      auto *grid = new anari_viewer::windows::ComparisonGrid(device,
+          m_state.scene->world(),
+          settings,
+          m_state.predictions,
+          m_state.images);
+      grid->setWorldVersionCallback(
+          [this]() { return m_state.scene->version(); });
+      grid->setDeviceArbiter(&m_deviceArbiter);
+      // a cell picks its prediction like a row of the predictions editor
+      grid->setSelectCallback([=, this](size_t index) {
+        const auto &p = m_state.predictions[index];
+        viewport->setView(p.eye, p.center, p.up);
+        showCachedDrr(p.eye, p.center, p.up);
+        imageViewport->showImage(index);
+      });
+      grid->setDrrSource([this](size_t index, const RayCamera &camera) {
+        const auto &p = m_state.predictions[index];
+        return m_drrCache ? m_drrCache->get(index,
+                   p.eye,
+                   p.center,
+                   p.up,
+                   camera,
+                   m_state.scene->version())
+                          : nullptr;
+      });
+      windows.emplace_back(grid);
+      m_comparisonGrid = grid;
+    }
+
+    auto *memory = new anari_viewer::windows::MemoryWindow(
+        [this](MemoryReport &report) { reportMemory(report); });
+    windows.emplace_back(memory);
 
     return windows;
   }
 
+  void uiFrameStart() override
+  {
+    if (anari_calls::enabled())
+      anari_calls::endFrame();
+    updateMatchStages();
+    pollMatch();
+    pollMatchAll();
+    if (!g_worklist.empty()) {
+      if (!ImGui::GetIO().WantTextInput) {
+        if (ImGui::IsKeyPressed(ImGuiKey_PageDown, false))
+          openCase(m_caseIndex + 1);
+        if (ImGui::IsKeyPressed(ImGuiKey_PageUp, false) && m_caseIndex > 0)
+          openCase(m_caseIndex - 1);
+      }
+      pollCase();
+    }
+
+    if (m_state.volumeReady && !g_startup.finished()
+        && m_viewport->numCompletedFrames() > m_framesBeforeVolume) {
+      g_startup.finish();
+      finishStartup();
+    }
+
+    if (m_state.volumeReady && m_state.volumes.active().brickStream.isOpen())
+      updateStreamedBricks();
+    if (m_state.volumeReady && !m_lodFields.empty())
+      updateLod();
+    if (m_player.active()) {
+      m_player.update();
+      m_settingsEditor->setPhase(m_player.phase());
+    }
+    if (m_state.volumeReady)
+      pollLacFile();
+    if (m_feed)
+      pollPredictionFeed();
+    if (m_state.volumeReady && !g_recordCameraFile.empty())
+      recordCamera();
+    if (m_state.volumeReady && m_replayNext <= m_replayPath.size())
+      updateReplay();
+    if (m_state.volumeReady && m_drrCache) {
+      m_drrCache->setCamera(m_viewport->rayCamera());
+      m_drrCache->update(m_state.predictions.predictions,
+          m_state.scene->version(),
+          m_viewport->idle());
+    }
+    if (m_state.volumeReady || !m_volumeLoad.valid())
+      return;
+
+    if (m_volumeLoad.wait_for(std::chrono::seconds(0))
+        != std::future_status::ready) {
+      if (m_previewLoad.valid()
+          && m_previewLoad.wait_for(std::chrono::seconds(0))
+              == std::future_status::ready)
+        showPreview();
+      std::lock_guard<std::mutex> lock(m_loadStatus.mutex);
+      m_viewport->setLoadingProgress(
+          m_loadStatus.progress, m_loadStatus.stage);
+      return;
+    }
+
+    m_volumeLoad.get();
+    finishVolumeLoad();
+    m_viewport->setLoadingProgress(1.f, "");
+  }
+
   void buildMainMenuUI()
   {
     if (ImGui::BeginMainMenuBar()) {
@@ -627,47 +1594,3654 @@ class Application : public anari_viewer::Application
           const char *info = ImGui::SaveIniSettingsToMemory();
           printf("%s\n", info);
         }
+        if (ImGui::MenuItem("save session",
+                nullptr,
+                false,
+                !g_sessionFile.empty() && m_state.volumeReady))
+          saveSession();
 
         ImGui::EndMenu();
       }
 
+      if (!g_worklist.empty() && ImGui::BeginMenu("Worklist")) {
+        const size_t n = g_worklist.size();
+        if (ImGui::MenuItem("next case", "PgDn", false, m_caseIndex + 1 < n))
+          openCase(m_caseIndex + 1);
+        if (ImGui::MenuItem("previous case", "PgUp", false, m_caseIndex > 0))
+          openCase(m_caseIndex - 1);
+        ImGui::Separator();
+        for (size_t i = 0; i < n; ++i) {
+          std::string label = std::to_string(i + 1) + ". "
+              + g_worklist.at(i).name;
+          if (i == m_caseJobIndex) {
+            label += m_caseJob.wait_for(std::chrono::seconds(0))
+                    == std::future_status::ready
+                ? " (ready)"
+                : " (reading)";
+          }
+          label += "##case" + std::to_string(i);
+          if (ImGui::MenuItem(label.c_str(), nullptr, i == m_caseIndex))
+            openCase(i);
+        }
+        ImGui::EndMenu();
+      }
+
       ImGui::EndMainMenuBar();
     }
   }
 
   void teardown() override
   {
-    anari::release(m_state.device, m_state.field);
-    anari::release(m_state.device, m_state.world);
+    // queued tasks are dropped and running ones finish, so none of them
+    // runs while the members they use are torn down
+    m_state.tasks.stop();
+    waitForMatch();
+    if (!g_sessionFile.empty() && m_state.volumeReady)
+      saveSession();
+    m_matchFrame = {};
+    if (m_volumeLoad.valid())
+      m_volumeLoad.wait();
+    if (m_previewLoad.valid())
+      m_previewLoad.wait();
+    if (m_caseJob.valid())
+      m_caseJob.wait();
+    if (!g_recordCameraFile.empty()
+        && writeCameraPath(g_recordCameraFile, m_cameraPath)) {
+      std::cout << "Camera path of " << m_cameraPath.size()
+                << " frames written to " << g_recordCameraFile << '\n';
+    }
+    m_player.stop();
+    m_drrCache.reset(); // before the world it renders
+    m_thumbnails.reset(); // its textures go with the GL context
+    m_viewport->setFrameStreamer(nullptr);
+    m_streamer.reset();
+    m_viewport->setGpuCounters(nullptr);
+    m_gpuCounters.reset();
+    releaseLod();
+    m_state.fieldCache.clear();
+    m_state.volumes.dropDeviceFields();
+    m_state.scene.reset();
     anari::release(m_state.device, m_state.device);
     anari_viewer::ui::shutdown();
   }
 
  private:
-  AppState m_state;
-};
+  // Matching ///////////////////////////////////////////////////////////////
 
-} // namespace viewer
+  struct MatchResult
+  {
+    uint64_t request{0};
+    size_t referenceIndex{SIZE_MAX}; // prediction matched against
+    anari::math::float3 eyeBefore, centerBefore;
+    anari::math::float3 eye, center, up;
+    bool updated{false};
+    anari_viewer::windows::MatchStages stages; // render filled in on the UI
+    uint64_t cacheKey{0}; // of m_poseCache, 0: not cached
+    bool cached{false}; // taken from it
+  };
 
-///////////////////////////////////////////////////////////////////////////////
+  // Snapshots the frame and camera on the UI thread and runs the matcher on
+  // a worker; a click while a match runs is queued and supersedes it
+  void requestMatch()
+  {
+    ++m_latestMatchRequest;
+    if (m_matchAllJob.valid())
+      m_matchPending = true; // started once the comparison is done
+    else if (!m_matchJob.valid())
+      startMatch();
+  }
 
-static void printUsage()
-{
-  std::cout << "./anariVolumeViewer [{--help|-h}]\n"
-            << "   [{--verbose|-v}] [{--debug|-g}]\n"
-            << "   [{--library|-l} <ANARI library>]\n"
-            << "   [{--trace|-t} <directory>]\n"
-            << "   [{--json|-j} <directory>]\n"
-            << "   [{--lacfile|--lac} <directory>]\n"
-            << "   [{--lut} <index>]\n"
-            << "   [{--matcher|-m} <directory>]\n"
-            << "   [{--dims|-d} <dimx dimy dimz>]\n"
-            << "   [{--type|-t} [{uint8|uint16|float32}]\n"
-            << "   <volume file>\n";
-}
+  // Hands one snapshot of the current view to every matcher at once; the
+  // results show up side by side in the predictions editor
+  void startMatchAll()
+  {
+    if (m_matchAllJob.valid())
+      return;
+    waitForMatch();
 
-static void parseCommandLine(int argc, char *argv[])
-{
+    auto *viewport = m_viewport;
+    anari::math::float3 eye, center, up;
+    float fovy, aspect;
+    viewport->getView(eye, center, up, fovy, aspect);
+
+    // loads the matchers not used yet; those that fail are left out
+    bool denseOrigin = false;
+    bool edges = false;
+    bool gray = false, bgra = false, gray16 = false;
+    for (size_t i = 0; i < m_state.matchers.size(); ++i) {
+      auto *matcher = m_state.matchers.matcher(i);
+      const uint64_t capabilities = matcher ? matcher_capabilities(matcher) : 0;
+      denseOrigin |= matcher && !(capabilities & MATCHER_CAP_POINT_QUERY);
+      edges |= bool(capabilities & MATCHER_CAP_QUERY_EDGES);
+      gray |= bool(capabilities & MATCHER_CAP_GRAY);
+      bgra |= bool(capabilities & MATCHER_CAP_BGRA);
+      gray16 |= bool(capabilities & MATCHER_CAP_GRAY16);
+    }
+    auto input = std::make_shared<MatchInput>();
+    if (!renderMatchFrame(1.f, denseOrigin, !denseOrigin, edges, gray, *input))
+      return;
+    if (m_reference) {
+      // full resolution; matchers already holding it skip the upload
+      input->reference = referenceView(MATCHER_PIXEL_RGBA8, 0);
+      if (gray)
+        input->referenceGray = referenceView(MATCHER_PIXEL_GRAY8, 0);
+      if (bgra && m_referenceSwizzle)
+        input->referenceBgra = referenceView(MATCHER_PIXEL_BGRA8, 0);
+      if (gray16 && m_reference->gray16())
+        input->referenceGray16 = referenceView(MATCHER_PIXEL_GRAY16, 0);
+      input->referenceIndex = m_referenceIndex;
+      input->referencePath = m_state.images.filename(m_referenceIndex);
+      m_referenceLevel = 0;
+      m_matcherHasPyramid = false;
+    }
+    input->fovy = fovy;
+    input->aspect = aspect;
+    input->eye = {eye.x, eye.y, eye.z};
+    input->center = {center.x, center.y, center.z};
+    input->up = {up.x, up.y, up.z};
+    m_matchAllEye = eye;
+    m_matchAllCenter = center;
+
+    m_matchAllJob =
+        m_state.tasks.submit(TaskPriority::Interactive, [this, input]() {
+          return m_state.matchers.matchAll(*input);
+        });
+  }
+
+  void pollMatchAll()
+  {
+    if (!m_matchAllJob.valid()
+        || m_matchAllJob.wait_for(std::chrono::seconds(0))
+            != std::future_status::ready)
+      return;
+
+    auto outcomes = m_matchAllJob.get();
+    if (!m_matchJob.valid())
+      m_matchFrame = {};
+
+    std::vector<anari_viewer::windows::MatchComparison> comparison;
+    for (auto &o : outcomes) {
+      anari_viewer::windows::MatchComparison c;
+      c.matcher = m_state.matchers.m_matcherNames[o.matcherIndex];
+      c.updated = o.updated;
+      c.setImageMs = o.setImageMs;
+      c.matchMs = o.matchMs;
+      c.updateMs = o.updateMs;
+      c.eye = anari::math::float3{o.eye[0], o.eye[1], o.eye[2]};
+      c.center = anari::math::float3{o.center[0], o.center[1], o.center[2]};
+      c.up = anari::math::float3{o.up[0], o.up[1], o.up[2]};
+      c.poseDelta = RegistrationLoop::poseDelta(
+          m_matchAllEye, m_matchAllCenter, c.eye, c.center);
+      std::cout << "match all: " << c.matcher << " " << c.setImageMs << " + "
+                << c.matchMs << " + " << c.updateMs << " ms, delta "
+                << c.poseDelta << '\n';
+      comparison.push_back(c);
+    }
+    m_predictionsEditor->setMatchComparison(std::move(comparison));
+
+    if (m_matchPending) {
+      m_matchPending = false;
+      startMatch();
+    }
+  }
+
+  void startMatch()
+  {
+    auto *viewport = m_viewport;
+    anari::math::float3 eye, center, up;
+    float fovy, aspect;
+    viewport->getView(eye, center, up, fovy, aspect);
+
+    // coarse-to-fine: render smaller and match against the reference's
+    // pyramid level while registration runs on a coarse level
+    const size_t level = m_registration.running() && m_referencePyramid
+        ? m_registration.level()
+        : 0;
+    const bool swizzle = m_referenceSwizzle;
+
+    auto *matcher = m_state.matchers.getActiveMatcher();
+    if (!matcher || (m_registration.running() && !m_reference)) {
+      // a lazily loaded one that failed, or nothing to register to
+      resetRegistration();
+      return;
+    }
+    // a match run before from this pose against this reference returns at
+    // once; framebuffer references have no name to key them
+    uint64_t cacheKey = 0;
+    if (m_reference && m_referenceIndex != SIZE_MAX
+        && g_recordMatchesDir.empty()) {
+      char params[96];
+      std::snprintf(params,
+          sizeof(params),
+          "|%zu %g %g %g %d",
+          level,
+          fovy,
+          aspect,
+          m_photonEnergy,
+          int(g_matchEdges.mode));
+      cacheKey = m_poseCache.key(m_state.images.filename(m_referenceIndex),
+          {eye.x, eye.y, eye.z},
+          {center.x, center.y, center.z},
+          {up.x, up.y, up.z},
+          m_state.matchers.identity(m_state.matchers.m_activeMatcherIndex)
+              + params);
+      PoseCache::Entry entry;
+      if (m_poseCache.get(cacheKey, entry)) {
+        MatchResult result;
+        result.request = m_latestMatchRequest;
+        result.referenceIndex = m_referenceIndex;
+        result.eyeBefore = eye;
+        result.centerBefore = center;
+        result.eye = {entry.eye[0], entry.eye[1], entry.eye[2]};
+        result.center = {entry.center[0], entry.center[1], entry.center[2]};
+        result.up = {entry.up[0], entry.up[1], entry.up[2]};
+        result.updated = entry.updated;
+        result.cacheKey = cacheKey;
+        result.cached = true;
+        std::promise<MatchResult> promise;
+        promise.set_value(result);
+        m_matchJob = promise.get_future();
+        return;
+      }
+    }
+
+    const uint64_t capabilities = matcher_capabilities(matcher);
+    const bool pointQuery = capabilities & MATCHER_CAP_POINT_QUERY;
+    const bool denseOrigin = !pointQuery || !g_recordMatchesDir.empty();
+    const bool edges = capabilities & MATCHER_CAP_QUERY_EDGES;
+    const bool gray = capabilities & MATCHER_CAP_GRAY;
+    // converted on this thread, once per reference and level
+    matcher_image_view reference{};
+    if (level != m_referenceLevel && m_reference && !m_matcherHasPyramid) {
+      reference = referenceView(
+          reference_pixel_type(capabilities, swizzle, m_reference->gray16()),
+          level);
+      m_referenceLevel = level;
+    }
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::time_point a, clock::time_point b) {
+      return std::chrono::duration<float, std::milli>(b - a).count();
+    };
+    const auto frameStart = clock::now();
+    MatchInput input;
+    if (!renderMatchFrame(1.f / float(1 << level),
+            denseOrigin,
+            !denseOrigin,
+            edges,
+            gray,
+            input)) {
+      resetRegistration();
+      return;
+    }
+    anari_viewer::windows::MatchStages stages;
+    const auto submitted = clock::now();
+    stages.frame = ms(frameStart, submitted);
+    const size_t width = input.query.width;
+    const size_t height = input.query.height;
+
+    const uint64_t request = m_latestMatchRequest;
+    const size_t matcherIndex = m_state.matchers.m_activeMatcherIndex;
+    const size_t referenceIndex = m_referenceIndex;
+    const std::string referencePath = m_state.images.filename(referenceIndex);
+    std::shared_ptr<const Image> recordReference;
+    if (!g_recordMatchesDir.empty())
+      recordReference = level > 0 ? m_referencePyramid->levels[level] : m_reference;
+    const size_t recordIndex = m_numRecordedMatches++;
+    m_matchJob = m_state.tasks.submit(TaskPriority::Interactive, [=, this]() {
+      auto t0 = clock::now();
+      MatchResult result;
+      result.stages = stages;
+      result.stages.queue = ms(submitted, t0);
+      if (recordReference) {
+        MatchRecord record;
+        record.width = width;
+        record.height = height;
+        auto *query = static_cast<const uint8_t *>(input.query.data);
+        auto *depth = static_cast<const float *>(input.depth.data);
+        record.query.assign(query, query + width * height * 4);
+        record.depth.assign(depth, depth + width * height * 3);
+        record.referenceWidth = recordReference->width;
+        record.referenceHeight = recordReference->height;
+        // recordings hold RGBA8 references
+        record.reference = rgbaImage(recordReference)->data;
+        record.referenceSwizzle = swizzle;
+        record.fovy = fovy;
+        record.aspect = aspect;
+        record.eye = {eye.x, eye.y, eye.z};
+        record.center = {center.x, center.y, center.z};
+        record.up = {up.x, up.y, up.z};
+        writeMatchRecord(g_recordMatchesDir, recordIndex, record);
+        t0 = clock::now(); // not a stage of matching
+      }
+      // the matchers are only touched by this job until it is waited for
+      TRACE_SCOPE("matcher", "match job");
+      if (reference.data) {
+        TRACE_SCOPE("matcher", "set_image reference");
+        m_state.matchers.setReference(
+            matcherIndex, referenceIndex, referencePath, reference);
+      }
+      const auto t1 = clock::now();
+      // the matcher's temporaries of this match; the last match's are
+      // given up now
+      m_matchScratch.reset();
+      matcher_scratch_scope lend(matcher, m_matchScratch.scratch());
+      {
+        TRACE_SCOPE("matcher", "set_image");
+        if (!pointQuery || !set_point_query(matcher, input.points))
+          set_image_view(
+              matcher, input.depth, feature_matcher::IMAGE_TYPE::DEPTH3D);
+        if (input.edges.data)
+          set_image_view(
+              matcher, input.edges, feature_matcher::IMAGE_TYPE::QUERY_EDGES);
+        set_image_view(matcher,
+            gray ? input.queryGray : input.query,
+            feature_matcher::IMAGE_TYPE::QUERY);
+      }
+      const auto t2 = clock::now();
+      {
+        TRACE_SCOPE("matcher", "calibrate");
+        matcher->calibrate(width, height, fovy, aspect);
+      }
+      const auto t3 = clock::now();
+      {
+        TRACE_SCOPE("matcher", "match");
+        matcher->match();
+      }
+      const auto t4 = clock::now();
+
+      std::array<float, 3> eyeArr{eye.x, eye.y, eye.z};
+      std::array<float, 3> centerArr{center.x, center.y, center.z};
+      std::array<float, 3> upArr{up.x, up.y, up.z};
+      {
+        TRACE_SCOPE("matcher", "update_camera");
+        result.updated = matcher->update_camera(eyeArr, centerArr, upArr);
+      }
+
+      result.stages.setReference = ms(t0, t1);
+      result.stages.setQuery = ms(t1, t2);
+      result.stages.calibrate = ms(t2, t3);
+      result.stages.match = ms(t3, t4);
+      result.stages.update = ms(t4, clock::now());
+      result.request = request;
+      result.cacheKey = cacheKey;
+      result.referenceIndex = referenceIndex;
+      result.eyeBefore = eye;
+      result.centerBefore = center;
+      result.eye = anari::math::float3{eyeArr[0], eyeArr[1], eyeArr[2]};
+      result.center =
+          anari::math::float3{centerArr[0], centerArr[1], centerArr[2]};
+      result.up = anari::math::float3{upArr[0], upArr[1], upArr[2]};
+      return result;
+    });
+  }
+
+  // Host field point lookups can march rays through: the one shown, unless
+  // phases play (sdata is the first one) or its voxels live on the device
+  // only. Callers changing it wait for a running match first.
+  const StructuredField *firstHitField() const
+  {
+    if (g_firstHitThreshold < 0.f || !m_state.volumeReady || m_player.active())
+      return nullptr;
+    const auto &data = m_state.volumes.active().sdata;
+    return data.empty() ? nullptr : &data;
+  }
+
+  // Renders the frame to match into m_matchFrame, which stays mapped while
+  // the job runs (interactive frames render into others) and is released
+  // once its result is taken. Full frames go to the matchers as mapped; ROI
+  // frames are placed into full ones, the matchers' calibration staying
+  // that of the whole view. Origins are only copied for the dense image;
+  // point lookups read the mapped channel, or with `marchOrigins` and a
+  // host field march the rays of the keypoints, and the frame is rendered
+  // without the channel. With `edges` (and --match-edges) the viewport
+  // filters the frame's edges on the GPU for the matchers taking them; with
+  // `gray` the color is also converted to the GRAY8 query once, here.
+  // A registration whose next step cannot run is not running anymore
+  void resetRegistration()
+  {
+    if (!m_registration.running())
+      return;
+    m_registration.reset();
+    m_predictionsEditor->setRegistrationStatus(m_registration.status());
+  }
+
+  bool renderMatchFrame(float scale,
+      bool denseOrigin,
+      bool marchOrigins,
+      bool edges,
+      bool gray,
+      MatchInput &input)
+  {
+    const StructuredField *field = marchOrigins ? firstHitField() : nullptr;
+    m_matchFrame = {}; // its frame is rendered into again
+    unsigned channels = anari_viewer::windows::ChannelColor;
+    if (!field)
+      channels |= anari_viewer::windows::ChannelOrigin;
+    if (edges && g_matchEdges.mode != EdgeSettings::None)
+      channels |= anari_viewer::windows::ChannelEdges;
+    m_matchFrame = m_viewport->renderFrame(channels, scale);
+    const auto &frame = m_matchFrame;
+    if (!frame.valid() || (!field && !frame.hasOrigins())) {
+      m_matchFrame = {};
+      return false;
+    }
+
+    const size_t width = frame.fullWidth();
+    const size_t height = frame.fullHeight();
+    const bool full = width == frame.width() && height == frame.height();
+    const void *color = frame.color().data();
+    const float *origin = frame.origin().data();
+    if (!full && denseOrigin) {
+      frame.copyFull(m_matchColor, m_matchOrigin);
+      color = m_matchColor.data();
+      origin = m_matchOrigin.data();
+    } else if (!full) {
+      frame.copyFull(m_matchColor);
+      color = m_matchColor.data();
+      origin = nullptr;
+    } else if (denseOrigin && !origin && frame.hasOrigins()) {
+      // cached frames keep their origins as depth: unprojected here
+      frame.copyFull(m_matchColor, m_matchOrigin);
+      origin = m_matchOrigin.data();
+    }
+
+    input.query = make_image_view(
+        color, width, height, feature_matcher::PIXEL_TYPE::RGBA);
+    if (gray) {
+      m_matchGray.resize(width * height);
+      rgbaToGray(static_cast<const uint8_t *>(color),
+          width * height,
+          m_matchGray.data());
+      input.queryGray = make_image_view(m_matchGray.data(),
+          width,
+          height,
+          feature_matcher::PIXEL_TYPE::GRAY8);
+    }
+    if (!frame.edges().empty()) {
+      const void *edgeImage = frame.edges().data();
+      if (!full) {
+        frame.copyFullEdges(m_matchEdges);
+        edgeImage = m_matchEdges.data();
+      }
+      input.edges = make_image_view(
+          edgeImage, width, height, feature_matcher::PIXEL_TYPE::RGBA);
+    }
+    if (origin) {
+      input.depth = make_image_view(
+          origin, width, height, feature_matcher::PIXEL_TYPE::FLOAT3);
+    }
+    if (field) {
+      m_firstHits.field = field;
+      m_firstHits.camera = m_viewport->rayCamera(scale);
+      m_firstHits.settings.threshold = g_firstHitThreshold;
+      m_firstHits.settings.projector = g_projector;
+      applyClip(m_firstHits.settings);
+      input.points.host = &m_firstHits;
+      input.points.lookup = [](void *host,
+                                const float *pixels,
+                                size_t count,
+                                float *points) {
+        const auto &hits = *static_cast<const FirstHitQuery *>(host);
+        marchFirstHits(
+            *hits.field, hits.camera, pixels, count, points, hits.settings);
+        return 0;
+      };
+      return true;
+    }
+    input.points.host = &m_matchFrame;
+    input.points.lookup = [](void *host,
+                              const float *pixels,
+                              size_t count,
+                              float *points) {
+      static_cast<const anari_viewer::windows::FrameView *>(host)
+          ->sampleOrigins(pixels, count, points);
+      return 0;
+    };
+    return true;
+  }
+
+  // The reference (m_reference), or a level of its pyramid, in a pixel type
+  // matchers take. Other types than the reference's own (RGBA8, or GRAY16
+  // for 16-bit references) are converted on first use and kept, like the
+  // reference, until it is replaced, so ABI matchers may hold on to any of
+  // them without a copy.
+  matcher_image_view referenceView(uint32_t pixelType, size_t level)
+  {
+    auto image = level > 0 ? m_referencePyramid->levels[level] : m_reference;
+    const uint32_t ownType =
+        image->gray16() ? MATCHER_PIXEL_GRAY16 : MATCHER_PIXEL_RGBA8;
+    if (pixelType != ownType) {
+      const size_t slot = pixelType == MATCHER_PIXEL_GRAY8 ? 0
+          : pixelType == MATCHER_PIXEL_BGRA8 ? 1
+          : 2;
+      auto &converted = m_convertedReferences[slot];
+      if (converted.source != m_reference)
+        converted = {m_reference, {}};
+      if (converted.levels.size() <= level)
+        converted.levels.resize(level + 1);
+      auto &levelImage = converted.levels[level];
+      if (!levelImage) {
+        if (slot == 0)
+          levelImage = std::make_shared<const Image>(grayImage(*image));
+        else if (slot == 1)
+          levelImage = std::make_shared<const Image>(bgraImage(*image));
+        else
+          levelImage = std::make_shared<const Image>(rgbaImage(*image));
+      }
+      image = levelImage;
+    }
+    auto view = make_image_view(image->data.data(),
+        image->width,
+        image->height,
+        feature_matcher::PIXEL_TYPE(pixelType),
+        pixelType == MATCHER_PIXEL_RGBA8 && m_referenceSwizzle);
+    view.flags |= MATCHER_IMAGE_RETAINED;
+    return view;
+  }
+
+  uint32_t activeReferencePixelType()
+  {
+    return reference_pixel_type(
+        matcher_capabilities(m_state.matchers.getActiveMatcher()),
+        m_referenceSwizzle,
+        m_reference && m_reference->gray16());
+  }
+
+  // Sets m_reference, which has to be the image `index`, on the active
+  // matcher
+  void setMatcherReference(size_t index)
+  {
+    m_referencePyramid.reset();
+    m_referenceLevel = 0;
+    m_matcherHasPyramid = false;
+    m_state.matchers.setReference(m_state.matchers.m_activeMatcherIndex,
+        index,
+        m_state.images.filename(index),
+        referenceView(activeReferencePixelType(), 0));
+  }
+
+  // Matchers that take a whole pyramid pick the level per query themselves
+  void setMatcherReferencePyramid()
+  {
+    auto *matcher =
+        dynamic_cast<abi_matcher *>(m_state.matchers.getActiveMatcher());
+    if (!matcher || !m_referencePyramid
+        || !(matcher->capabilities() & MATCHER_CAP_PYRAMID))
+      return;
+
+    const uint32_t pixelType = activeReferencePixelType();
+    std::vector<matcher_image_view> levels;
+    for (size_t l = 0; l < m_referencePyramid->size(); ++l)
+      levels.push_back(referenceView(pixelType, l));
+    matcher_pyramid_view pyramid{levels.data(), levels.size()};
+    m_matcherHasPyramid = matcher->set_reference_pyramid(pyramid);
+    if (m_matcherHasPyramid)
+      m_state.matchers.invalidateReference(m_state.matchers.m_activeMatcherIndex);
+  }
+
+  void pollMatch()
+  {
+    if (!m_matchJob.valid()
+        || m_matchJob.wait_for(std::chrono::seconds(0))
+            != std::future_status::ready)
+      return;
+
+    auto result = m_matchJob.get();
+    // a comparison started after this job matches on the frame now
+    if (!m_matchAllJob.valid())
+      m_matchFrame = {};
+    if (result.request != m_latestMatchRequest) {
+      // stale: a newer request came in while matching
+      if (m_matchAllJob.valid())
+        m_matchPending = true;
+      else
+        startMatch();
+      return;
+    }
+
+    m_viewport->setView(result.eye, result.center, result.up);
+    // the render stage ends with the next frame shown (updateMatchStages())
+    flushMatchStages();
+    if (!result.cached) {
+      m_matchStages = result.stages;
+      m_matchStagesCompleted = m_viewport->numCompletedFrames();
+      m_matchStagesShown = std::chrono::steady_clock::now();
+      m_matchStagesPending = true;
+    }
+    const float poseDelta = RegistrationLoop::poseDelta(
+        result.eyeBefore, result.centerBefore, result.eye, result.center);
+    if (result.referenceIndex != SIZE_MAX)
+      m_predictionsEditor->setMatchScore(result.referenceIndex, poseDelta);
+    if (result.cacheKey && !result.cached) {
+      PoseCache::Entry entry;
+      entry.updated = result.updated;
+      entry.eye = {result.eye.x, result.eye.y, result.eye.z};
+      entry.center = {result.center.x, result.center.y, result.center.z};
+      entry.up = {result.up.x, result.up.y, result.up.z};
+      entry.poseDelta = poseDelta;
+      entry.iterations = 1;
+      m_poseCache.put(result.cacheKey, entry);
+    }
+
+    // closed loop: render at the updated pose and match again until the
+    // pose settles; frame and match buffers are reused every iteration
+    if (m_registration.running()) {
+      bool more = m_registration.step(
+          result.eyeBefore, result.centerBefore, result.eye, result.center);
+      m_predictionsEditor->setRegistrationStatus(m_registration.status());
+      const auto &step = m_registration.history().back();
+      std::cout << "registration step " << step.iteration
+                << ": delta " << step.poseDelta << ", " << step.seconds
+                << "s (" << m_registration.iterationsPerSecond()
+                << " it/s)\n";
+      if (more)
+        requestMatch();
+    }
+  }
+
+  void updateMatchStages()
+  {
+    if (m_matchStagesPending
+        && m_viewport->numCompletedFrames() != m_matchStagesCompleted) {
+      m_matchStages.render = std::chrono::duration<float, std::milli>(
+          std::chrono::steady_clock::now() - m_matchStagesShown)
+                                 .count();
+      flushMatchStages();
+    }
+  }
+
+  // Hands the last match's stages to the editor; without a frame shown yet
+  // (the next match came first) its render stage stays 0
+  void flushMatchStages()
+  {
+    if (!m_matchStagesPending)
+      return;
+    m_matchStagesPending = false;
+    m_predictionsEditor->addMatchStages(m_matchStages);
+  }
+
+  // The matcher is not thread-safe; callers touching it on the UI thread
+  // wait for a running match first
+  void waitForMatch()
+  {
+    if (m_matchJob.valid())
+      m_matchJob.wait();
+    if (m_matchAllJob.valid())
+      m_matchAllJob.wait();
+  }
+
+  // What the viewer's buffers hold; sizes on the device are those of the
+  // data handed to ANARI, since devices do not report their own usage
+  void reportMemory(MemoryReport &report)
+  {
+    // while loading, the loader thread owns the volume buffers
+    if (m_state.volumeReady || !m_volumeLoad.valid()) {
+      auto &volumes = m_state.volumes;
+      for (size_t i = 0; i < volumes.size(); ++i) {
+        auto &volume = volumes.volume(i);
+        // entries per volume are told apart by their index
+        const std::string prefix =
+            volumes.size() > 1 ? "[" + std::to_string(i) + "] " : "";
+        report.addField(prefix + "volume (state)", volume.sdata);
+        report.addField(prefix + "RAW reader field", volume.rawReader.field);
+        if (volume.brickStream.isOpen()) {
+          auto &stream = volume.brickStream;
+          report.addField(prefix + "streamed coarse level", stream.coarseField());
+          report.add(MemoryReport::Host,
+              prefix + "streamed bricks ("
+                  + std::to_string(stream.numCachedBricks()) + ")",
+              stream.cacheBytes());
+        }
+#ifdef HAVE_ITK
+        auto &nifti = volume.niftiReader;
+        report.add(
+            MemoryReport::Host, prefix + "NIfTI voxels", nifti.voxels.size());
+        report.addField(prefix + "NIfTI density field", nifti.field);
+        report.addField(prefix + "NIfTI LAC field", nifti.lacField);
+        report.addField(
+            prefix + "NIfTI decoded LAC field", nifti.unpackedField);
+        report.add(MemoryReport::Host,
+            prefix + "LAC field cache ("
+                + std::to_string(nifti.lacFieldCache.size()) + " LUTs)",
+            nifti.lacFieldCache.bytes());
+#endif
+      }
+      const auto &active = volumes.active();
+      const auto &data = active.sdata;
+      const size_t fieldBytes =
+          size_t(data.dimX) * data.dimY * data.dimZ * data.bytesPerCell;
+      // NIfTI LAC fields are counted in the field cache, the fields of
+      // multi-volume sessions in the volume manager's
+      const bool cached =
+          (active.isNifti && !g_deviceLut) || volumes.size() > 1;
+      report.add(MemoryReport::Device, "volume field", cached ? 0 : fieldBytes);
+      report.add(MemoryReport::Device,
+          "volume fields (" + std::to_string(volumes.numDeviceFields())
+              + " volumes)",
+          volumes.deviceBytes());
+      report.add(MemoryReport::Device,
+          "next phase field",
+          m_state.scene->backFieldBytes());
+      report.add(MemoryReport::Device, "LOD levels", m_lodBytes);
+      report.add(MemoryReport::Device,
+          "field cache (" + std::to_string(m_state.fieldCache.size())
+              + " LUTs)",
+          m_state.fieldCache.bytes());
+    }
+
+    report.add(MemoryReport::Host,
+        "match buffers",
+        m_matchColor.capacity() + m_matchOrigin.capacity() * sizeof(float));
+    report.add(MemoryReport::Host,
+        "matcher reference states",
+        m_state.matchers.referenceStateBytes());
+    report.add(MemoryReport::Device,
+        "matcher references ("
+            + std::to_string(m_state.matchers.numDeviceReferences())
+            + " images)",
+        m_state.matchers.deviceReferenceBytes());
+    m_state.images.reportMemory(report);
+    if (m_viewport)
+      m_viewport->reportMemory(report);
+    if (m_imageViewport)
+      m_imageViewport->reportMemory(report);
+    if (m_thumbnails)
+      m_thumbnails->reportMemory(report);
+    if (m_comparisonGrid)
+      m_comparisonGrid->reportMemory(report);
+    if (m_drrCache)
+      m_drrCache->reportMemory(report);
+    if (m_templates) {
+      report.add(MemoryReport::Host,
+          "template library (" + std::to_string(m_templates->size())
+              + " poses)",
+          m_templates->bytes());
+    }
+  }
+
+  void setLoadStatus(float progress, const char *stage)
+  {
+    std::lock_guard<std::mutex> lock(m_loadStatus.mutex);
+    m_loadStatus.progress = progress;
+    m_loadStatus.stage = stage;
+  }
+
+  // Runs on the loader thread: only host-side reading and conversion happen
+  // here, ANARI objects are created on the UI thread in finishVolumeLoad()
+  void loadVolume()
+  {
+    auto &volumes = m_state.volumes;
+    for (size_t i = 0; i < volumes.size(); ++i) {
+      StartupProfile::Stage stage(g_startup, "read volume");
+      readVolume(m_state.lacReader,
+          volumes.volume(i),
+          i,
+          [&, this](float progress, const char *stage) {
+            setLoadStatus((i + progress) / volumes.size(), stage);
+          },
+          true);
+    }
+  }
+
+  void startVolumeLoad()
+  {
+    if (g_previewStride > 1) {
+      const auto &volume = m_state.volumes.active();
+      m_previewLoad = std::async(std::launch::async, [this, &volume]() {
+        return readPreview(m_state.lacReader, volume);
+      });
+    }
+    m_volumeLoad = std::async(std::launch::async, [this]() { loadVolume(); });
+  }
+
+  // --preview: shown, and looked around in, until finishVolumeLoad() swaps
+  // the whole volume in
+  void showPreview()
+  {
+    const StructuredField preview = m_previewLoad.get();
+    if (preview.empty())
+      return;
+    const auto &volume = m_state.volumes.active();
+    m_state.scene->setField(preview, !volume.hasRawDims());
+    m_viewport->resetView();
+    m_previewShown = true;
+    std::cout << "Showing a preview of [" << preview.dimX << ", "
+              << preview.dimY << ", " << preview.dimZ
+              << "] while the volume is read\n";
+  }
+
+  void finishVolumeLoad()
+  {
+    auto device = m_state.device;
+    auto &volume = m_state.volumes.active();
+    auto &data = volume.sdata;
+
+    const auto uploadStart = StartupProfile::Clock::now();
+    if (volume.brickStream.isOpen()) {
+      m_state.scene->setStreamedField(volume.brickStream);
+    } else if (!data.empty()) {
+      const bool isLac = volume.isNifti && !g_deviceLut;
+      if (isLac && g_lutCacheBytes > 0) {
+        // fields of previous LUTs are kept, so every LUT gets its own
+        AppState::LutField entry{
+            m_state.scene->newField(data, true), data.histogram};
+        m_state.fieldCache.put(m_state.lacReader.getActiveLut(),
+            entry,
+            size_t(data.dimX) * data.dimY * data.dimZ * data.bytesPerCell);
+        const float valueRange[2] = {data.dataRange.x, data.dataRange.y};
+        m_state.scene->setField(entry.field, valueRange);
+      } else {
+        m_state.scene->setField(data, isLac);
+      }
+#ifdef HAVE_ITK
+      if (g_deviceLut) {
+        // the energy starts out as the active LUT's, maybe moved since
+        setLacTransferFunctionAtEnergy(device,
+            m_state.scene->volume(),
+            m_state.lacReader,
+            m_photonEnergy);
+        m_state.scene->markChanged();
+      }
+#endif
+    }
+
+    g_startup.record(
+        "upload volume", uploadStart, StartupProfile::Clock::now());
+
+    m_state.volumeReady = true;
+    m_framesBeforeVolume = m_viewport->numCompletedFrames();
+    // the camera stays where it was moved to around the preview
+    if (!m_previewShown)
+      m_viewport->resetView();
+    m_previewShown = false;
+    m_previewLoad = {}; // waits for a preview still being read
+    if (!g_fastStart) {
+      StartupProfile::Stage stage(g_startup, "build LOD");
+      buildLod();
+    }
+    startPlayback();
+    startReplay();
+
+    if (g_verbose && !g_fastStart) {
+      MemoryReport report;
+      reportMemory(report);
+      report.print();
+    }
+
+    // apply a LUT selected while the volume was still loading
+    if (m_state.pendingLacLut != m_state.lacReader.getActiveLut())
+      m_updateLacLut(m_state.pendingLacLut);
+    showValueHistogram();
+    // the next case of the worklist is read while this one is worked on
+    prefetchCase(m_caseIndex + 1);
+    if (g_restoreSession) {
+      g_restoreSession = false;
+      applySession();
+    }
+  }
+
+  // The parts of a --session that need the volume and the editors: energy,
+  // camera, matcher and reference. The reference's image and descriptors
+  // come from the image and descriptor caches the session names.
+  void applySession()
+  {
+    const auto &s = g_session;
+    if (s.photonEnergy > 0.f)
+      m_settingsEditor->setPhotonEnergy(s.photonEnergy);
+    if (s.hasCamera) {
+      m_viewport->setView(anari::math::float3(s.eye[0], s.eye[1], s.eye[2]),
+          anari::math::float3(s.center[0], s.center[1], s.center[2]),
+          anari::math::float3(s.up[0], s.up[1], s.up[2]));
+    }
+    if (!s.matcher.empty()) {
+      const auto &names = m_state.matchers.m_matcherNames;
+      const auto it = std::find(names.begin(), names.end(), s.matcher);
+      if (it != names.end())
+        m_predictionsEditor->selectMatcher(size_t(it - names.begin()));
+      else
+        printf("WARNING: session matcher '%s' is not loaded\n",
+            s.matcher.c_str());
+    }
+    if (s.reference != SIZE_MAX)
+      m_predictionsEditor->selectReference(s.reference);
+  }
+
+  // Snapshot of the session to --session, see Session.h
+  bool saveSession()
+  {
+    Session s;
+    for (const auto &file : g_filenames)
+      s.volumes.push_back(SessionVolume::identify(file));
+    s.predictions = g_jsonfile;
+    if (!g_worklist.empty()) {
+      s.worklist = g_worklist.file();
+      s.caseIndex = m_caseIndex;
+    }
+    const auto &lacReader = m_state.lacReader;
+    s.lutFile = lacReader.m_filename;
+    // a --spectrum LUT is added again on start
+    if (lacReader.getActiveLut() < lacReader.m_numFileLuts)
+      s.lutId = lacReader.getActiveLut();
+    s.photonEnergy = m_photonEnergy;
+    anari::math::float3 eye, center, up;
+    float fovy = 0.f, aspect = 0.f;
+    m_viewport->getView(eye, center, up, fovy, aspect);
+    for (int a = 0; a < 3; ++a) {
+      s.eye[a] = eye[a];
+      s.center[a] = center[a];
+      s.up[a] = up[a];
+    }
+    s.hasCamera = true;
+    const auto &matchers = m_state.matchers;
+    if (matchers.m_activeMatcherIndex < matchers.m_matcherNames.size())
+      s.matcher = matchers.m_matcherNames[matchers.m_activeMatcherIndex];
+    s.reference = m_referenceIndex;
+    if (!g_sharedVolumes) // the shared cache is gone with its last process
+      s.lacCacheDir = g_lacCacheDir;
+    s.imageCacheDir = g_imageCacheDir;
+    if (g_referenceCache && !g_jsonfile.empty()) {
+      s.descriptorCacheDir =
+          std::filesystem::path(g_jsonfile).replace_extension(".refcache");
+    }
+    s.lacHalf = g_lacHalf;
+    if (!s.save(g_sessionFile))
+      return false;
+    std::cout << "Session saved to " << g_sessionFile << "\n";
+    return true;
+  }
+
+  // Edits of the LUT file are picked up while the viewer runs: volumes of
+  // the LUTs whose tables changed are converted again, or with --device-lut
+  // only the transfer function is replaced. A file that does not parse
+  // leaves the LUTs as they were.
+  void pollLacFile()
+  {
+    const auto now = std::chrono::steady_clock::now();
+    if (now < m_nextLacPoll)
+      return;
+    m_nextLacPoll = now + std::chrono::milliseconds(500);
+    auto &lacReader = m_state.lacReader;
+    if (!lacReader.fileChanged())
+      return;
+
+    TRACE_SCOPE("volume", "reload LUTs");
+    waitForMatch(); // point lookups may read the host volume
+    // the playback worker converts with the LUTs
+    const bool converting = m_player.active() && !g_deviceLut;
+    if (converting)
+      m_player.cancel();
+    const size_t active = lacReader.getActiveLut();
+    const bool spectrumActive = active >= lacReader.m_numFileLuts;
+    std::vector<size_t> changed;
+    if (!lacReader.reload(changed)) {
+      if (converting)
+        m_player.refresh();
+      return;
+    }
+    size_t next = lacReader.getActiveLut();
+    const size_t spectrum = addSpectrumLut(lacReader);
+    if (spectrum != SIZE_MAX) {
+      if (!changed.empty())
+        changed.push_back(spectrum);
+      if (spectrumActive)
+        next = spectrum;
+    }
+    lacReader.setActiveLut(next);
+
+    // volumes converted with the old tables
+    for (size_t id : changed) {
+      m_state.fieldCache.erase(id);
+      for (size_t i = 0; i < m_state.volumes.size(); ++i) {
+        auto &volume = m_state.volumes.volume(i);
+#ifdef HAVE_ITK
+        volume.niftiReader.lacFieldCache.erase(id);
+#endif
+        if (volume.lacLut == id)
+          volume.lacLut = SIZE_MAX;
+      }
+    }
+    showLacLuts();
+
+    if (next != active
+        || std::find(changed.begin(), changed.end(), next) != changed.end()) {
+      m_updateLacLut(next);
+      showValueHistogram();
+    } else if (converting) {
+      m_player.refresh();
+    }
+  }
+
+  void showLacLuts()
+  {
+    const auto &lacReader = m_state.lacReader;
+    m_settingsEditor->setLacLutNames(lacReader.getNames());
+    std::vector<float> energies;
+    for (auto &lut : lacReader.m_lacLuts)
+      energies.push_back(float(lut.eV));
+    m_settingsEditor->setLacLutEnergies(std::move(energies));
+    m_settingsEditor->setActiveLacLut(lacReader.getActiveLut());
+  }
+
+  // Until a reference is loaded, a grid 1024 pixels high in the sensor's
+  // aspect stands in for the detector's
+  void showSensorGrid()
+  {
+    const auto &p = m_state.predictions;
+    if (p.fovy <= 0.f)
+      return;
+    const float aspect = std::tan(0.5f * p.fovx) / std::tan(0.5f * p.fovy);
+    m_viewport->setDetector(
+        sensorDetector(p, std::max(1, int(1024 * aspect)), 1024));
+  }
+
+  // The first frame of the volume is up: work --fast-start left for later
+  void finishStartup()
+  {
+    if (!g_fastStart)
+      return;
+    {
+      StartupProfile::Stage stage(g_startup, "build LOD");
+      buildLod();
+    }
+    createThumbnails();
+    if (g_verbose) {
+      MemoryReport report;
+      reportMemory(report);
+      report.print();
+    }
+  }
+
+  void createThumbnails()
+  {
+    if (m_state.predictions.predictions.empty() || m_thumbnails)
+      return;
+    m_thumbnails = std::make_unique<ThumbnailAtlas>(m_state.images,
+        std::filesystem::path(g_jsonfile.empty() ? g_predictionFeed
+                                                 : g_jsonfile)
+            .replace_extension(".thumbs"),
+        &m_state.tasks);
+    m_predictionsEditor->setThumbnails(m_thumbnails.get());
+  }
+
+  // --prediction-feed: poses appended to the file join the loaded ones,
+  // read while there is more and every 250 ms once caught up
+  void pollPredictionFeed()
+  {
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= m_nextFeedPoll) {
+      m_nextFeedPoll = now
+          + (m_feed->poll() ? std::chrono::milliseconds(0)
+                            : std::chrono::milliseconds(250));
+    }
+
+    auto &predictions = m_state.predictions;
+    const size_t first = predictions.predictions.size();
+    const float fovy = predictions.fovy;
+    const size_t count = m_feed->take(predictions);
+    if (predictions.fovy != fovy)
+      showSensorGrid();
+    if (count == 0)
+      return;
+
+    std::vector<std::string> filenames;
+    for (size_t i = first; i < first + count; ++i)
+      filenames.push_back(predictions.predictions[i].filename);
+    m_state.images.appendFilenames(std::move(filenames));
+    // images of poses coming in live are decoded ahead, a backlog's when
+    // they are looked at
+    if (count <= g_feedImagePrefetch) {
+      for (size_t i = first; i < first + count; ++i)
+        m_state.images.prefetch(i);
+    }
+    if (!g_fastStart || g_startup.finished())
+      createThumbnails();
+  }
+
+  void showValueHistogram()
+  {
+    if (m_settingsEditor && m_state.volumeReady)
+      m_settingsEditor->setValueHistogram(m_state.volumes.active().histogram);
+    showClipBounds();
+  }
+
+  // The bounds of the volume shown as the clip box's; none (no clip
+  // controls) for volumes the clip does not apply to
+  void showClipBounds()
+  {
+    if (!m_settingsEditor || !m_state.volumeReady)
+      return;
+    const auto &volume = m_state.volumes.active();
+    const auto &data = volume.sdata;
+    float lower[3] = {0.f, 0.f, 0.f}, upper[3] = {0.f, 0.f, 0.f};
+    if (canClip()) {
+      const int dims[3] = {data.dimX, data.dimY, data.dimZ};
+      for (int a = 0; a < 3; ++a) {
+        const float end = data.origin[a] + (dims[a] - 1) * data.spacing[a];
+        lower[a] = std::min(data.origin[a], end);
+        upper[a] = std::max(data.origin[a], end);
+      }
+    }
+    m_settingsEditor->setClipBounds(lower, upper);
+  }
+
+  // Streamed volumes and playing phases keep their fields unclipped
+  bool canClip() const
+  {
+    const auto &volume = m_state.volumes.active();
+    return !volume.sdata.empty() && !volume.brickStream.isOpen()
+        && !m_player.active();
+  }
+
+  // Clips the volume shown and those shown later to the object-space box
+  // (lower xyz, upper xyz): the field is set again from the host volume,
+  // the devices' fields of other volumes and LUTs are dropped
+  void setClip(bool clip, const float *box)
+  {
+    g_clip = clip;
+    std::copy_n(box, 6, g_clipBox);
+    m_state.scene->setClip(clip ? box : nullptr, clip ? box + 3 : nullptr);
+    if (!m_state.volumeReady || !canClip())
+      return;
+
+    TRACE_SCOPE("volume", "clip");
+    waitForMatch(); // its frame renders the field being replaced
+    auto &volume = m_state.volumes.active();
+    const bool isLac = volume.isNifti && !g_deviceLut;
+#ifdef HAVE_ITK
+    // with cached LUT fields the host volume may be of another LUT
+    if (isLac && volume.lacLut != m_state.lacReader.getActiveLut()) {
+      volume.sdata = lacVolume(m_state.lacReader, volume);
+      volume.histogram = volume.sdata.histogram;
+    }
+#endif
+    releaseLod();
+    m_state.fieldCache.clear();
+    m_state.volumes.dropDeviceFields();
+    m_state.scene->setField(volume.sdata, isLac);
+    buildLod();
+  }
+
+  // Makes another volume of the session the one shown; its attenuation is
+  // converted first if it was converted with an earlier LUT
+  void showVolume(size_t index)
+  {
+    auto &volumes = m_state.volumes;
+    if (!m_state.volumeReady || index == volumes.activeIndex()
+        || index >= volumes.size())
+      return;
+
+    TRACE_SCOPE("volume", "switch volume");
+    waitForMatch(); // point lookups may read the host volume
+    auto &next = volumes.volume(index);
+    const bool isLac = next.isNifti && !g_deviceLut;
+#ifdef HAVE_ITK
+    if (isLac && next.lacLut != m_state.lacReader.getActiveLut()) {
+      next.sdata = lacVolume(m_state.lacReader, next);
+      next.histogram = next.sdata.histogram;
+    }
+#endif
+    // the full-resolution field is the one to keep for the volume
+    if (!m_lodFields.empty() && m_lodLevel != 0)
+      m_state.scene->setField(m_lodFields[0], m_lodRange);
+    releaseLod();
+    // the LUT fields belong to the volume shown so far
+    m_state.fieldCache.clear();
+
+    volumes.show(*m_state.scene, index, isLac);
+    buildLod();
+    showValueHistogram();
+  }
+
+  // Worklist ///////////////////////////////////////////////////////////////
+
+  // What switching to a worklist case needs on the host, read on a worker
+  // while another case is worked on
+  struct PreparedCase
+  {
+    size_t index{SIZE_MAX};
+    std::unique_ptr<VolumeSource> volume;
+    LacReader lacReader;
+    prediction_container predictions;
+    std::unique_ptr<ImageStore> images; // the first ones prefetched
+  };
+
+  // Runs on a worker: the case's LUTs, its volume converted with them, its
+  // predictions and its first reference images. ANARI objects are created
+  // on the UI thread in openPreparedCase().
+  std::unique_ptr<PreparedCase> prepareCase(size_t index)
+  {
+    TRACE_SCOPE("worklist", "read case");
+    const auto &c = g_worklist.at(index);
+    auto prepared = std::make_unique<PreparedCase>();
+    prepared->index = index;
+    readCaseLacLuts(prepared->lacReader, index);
+    prepared->volume = std::make_unique<VolumeSource>();
+    prepared->volume->fileName = c.volume;
+    initVolume(*prepared->volume);
+    readVolume(prepared->lacReader,
+        *prepared->volume,
+        0,
+        [](float, const char *) {},
+        true);
+    if (!c.predictions.empty())
+      prepared->predictions = prediction_container(c.predictions);
+
+    std::vector<std::string> filenames;
+    for (auto &p : prepared->predictions)
+      filenames.push_back(p.filename);
+    auto &images = prepared->images;
+    images = std::make_unique<ImageStore>();
+    images->setScheduler(&m_state.tasks);
+    images->setDecodedCache(g_imageCacheDir);
+    images->setFilenames(std::move(filenames));
+    if (!g_preprocess.empty())
+      images->setPreprocessing(g_preprocess, preprocessCacheDir(c.predictions));
+    for (size_t i = 0; i < std::min(g_caseImagePrefetch, images->size()); ++i)
+      images->prefetch(i);
+    return prepared;
+  }
+
+  void startCaseJob(size_t index)
+  {
+    m_caseJobIndex = index;
+    m_caseJob = m_state.tasks.submit(TaskPriority::Background,
+        [this, index]() { return prepareCase(index); });
+  }
+
+  // Reads case `index` ahead unless another case is being read
+  void prefetchCase(size_t index)
+  {
+    if (index >= g_worklist.size() || m_caseJob.valid())
+      return;
+    startCaseJob(index);
+  }
+
+  // Switches to worklist case `index` once it is read: right away for the
+  // case read ahead, otherwise the current case stays up until it is
+  void openCase(size_t index)
+  {
+    if (index >= g_worklist.size() || index == m_caseIndex
+        || !m_state.volumeReady)
+      return;
+    m_openCase = index;
+    if (m_caseJobIndex != index) {
+      // a case being read cannot be stopped midway
+      if (m_caseJob.valid())
+        m_caseJob.wait();
+      startCaseJob(index);
+    }
+    pollCase();
+  }
+
+  void pollCase()
+  {
+    if (m_openCase == SIZE_MAX || !m_caseJob.valid())
+      return;
+    if (m_caseJob.wait_for(std::chrono::seconds(0))
+        != std::future_status::ready) {
+      m_viewport->setLoadingProgress(
+          0.5f, "case " + g_worklist.at(m_openCase).name);
+      return;
+    }
+    auto prepared = m_caseJob.get();
+    m_caseJobIndex = SIZE_MAX;
+    m_openCase = SIZE_MAX;
+    m_viewport->setLoadingProgress(1.f, "");
+    openPreparedCase(*prepared);
+  }
+
+  // The prepared case replaces the current one: its volume is uploaded as
+  // the first one was (finishVolumeLoad()), LUTs, predictions and reference
+  // images are swapped in, and what belonged to the old case is dropped
+  void openPreparedCase(PreparedCase &next)
+  {
+    const auto &c = g_worklist.at(next.index);
+    if (next.volume->sdata.empty() && !next.volume->brickStream.isOpen()) {
+      fprintf(stderr,
+          "ERROR: could not load volume %s of case %s\n",
+          c.volume.c_str(),
+          c.name.c_str());
+      return;
+    }
+    TRACE_SCOPE("worklist", "open case");
+
+    // matches of the old case finish, their results are dropped
+    waitForMatch();
+    if (m_matchJob.valid())
+      m_matchJob.get();
+    if (m_matchAllJob.valid())
+      m_matchAllJob.get();
+    m_matchFrame = {};
+    m_matchPending = false;
+    m_registration.stop();
+    m_predictionsEditor->setRegistrationStatus(m_registration.status());
+    m_player.stop();
+    m_replayNext = SIZE_MAX;
+    releaseLod();
+    m_state.fieldCache.clear();
+
+    // the case's files stand in for the command line's from here on
+    g_filenames = {c.volume};
+    g_jsonfile = c.predictions;
+
+    m_state.volumes.replace(std::move(next.volume));
+    m_settingsEditor->setVolumeNames(m_state.volumes.names());
+    m_state.lacReader = std::move(next.lacReader);
+    m_state.pendingLacLut = m_state.lacReader.getActiveLut();
+    showLacLuts();
+
+    m_state.predictions = std::move(next.predictions);
+    m_state.images.adopt(*next.images);
+    m_predictionsEditor->resetPredictions();
+    m_imageViewport->clear();
+    if (m_comparisonGrid)
+      m_comparisonGrid->resetPredictions();
+    m_reference.reset();
+    m_referencePyramid.reset();
+    m_referenceIndex = SIZE_MAX;
+    // image indices start over with the case's images
+    m_state.matchers.clearReferences();
+    if (g_referenceCache && !g_jsonfile.empty())
+      m_state.matchers.setReferenceCacheDir(
+          std::filesystem::path(g_jsonfile).replace_extension(".refcache"));
+    openPoseCache(m_poseCache, "interactive");
+    m_predictionsEditor->setThumbnails(nullptr);
+    m_thumbnails.reset();
+    createThumbnails();
+    m_templates.reset();
+    loadTemplates();
+    showSensorGrid();
+
+    m_caseIndex = next.index;
+    std::cout << "Case " << m_caseIndex + 1 << "/" << g_worklist.size()
+              << ": " << c.name << "\n";
+    finishVolumeLoad();
+  }
+
+  // Cell layout of a volume's field, without voxels; phases after the first
+  // are not converted before playback, their layout comes from the reader
+  static StructuredField phaseLayout(const VolumeSource &volume)
+  {
+    StructuredField layout;
+#ifdef HAVE_ITK
+    if (volume.sdata.empty() && volume.isNifti && !g_deviceLut)
+      return volume.niftiReader.getFieldLayout();
+#endif
+    const auto &data = volume.sdata;
+    layout.dimX = data.dimX;
+    layout.dimY = data.dimY;
+    layout.dimZ = data.dimZ;
+    layout.bytesPerCell = data.bytesPerCell;
+    layout.isHalf = data.isHalf;
+    layout.dataRange = data.dataRange;
+    std::copy_n(data.origin, 3, layout.origin);
+    std::copy_n(data.spacing, 3, layout.spacing);
+    return layout;
+  }
+
+  // --play: the volumes as phases of one grid, shown in turn in the scene's
+  // field and its back field; phase 0 is the one loaded
+  void startPlayback()
+  {
+    auto &volumes = m_state.volumes;
+    if (g_phaseRate <= 0.f || volumes.size() < 2)
+      return;
+
+    const auto layout = phaseLayout(volumes.volume(0));
+    for (size_t i = 1; i < volumes.size(); ++i) {
+      const auto other = phaseLayout(volumes.volume(i));
+      if (other.dimX != layout.dimX || other.dimY != layout.dimY
+          || other.dimZ != layout.dimZ
+          || other.bytesPerCell != layout.bytesPerCell
+          || other.isHalf != layout.isHalf) {
+        fprintf(stderr,
+            "Phase %zu (%s) has another grid than phase 0, no playback\n",
+            i,
+            volumes.volume(i).fileName.c_str());
+        return;
+      }
+    }
+
+    auto convert = [this](size_t phase, void *dst, StructuredField &layout) {
+      auto &volume = m_state.volumes.volume(phase);
+#ifdef HAVE_ITK
+      if (volume.isNifti && !g_deviceLut) {
+        return openCtVolume(volume)
+            && volume.niftiReader.convertField(
+                m_state.lacReader, dst, &layout.macrocells);
+      }
+#endif
+      const auto &data = volume.sdata;
+      if (data.empty())
+        return false;
+      auto *to = static_cast<uint8_t *>(dst);
+      auto *from = static_cast<const uint8_t *>(data.data());
+      parallelFor(0,
+          size_t(data.dimX) * data.dimY * data.dimZ * data.bytesPerCell,
+          [&](size_t begin, size_t end) {
+            std::memcpy(to + begin, from + begin, end - begin);
+          });
+      layout.macrocells = data.macrocells;
+      return true;
+    };
+    m_player.setScheduler(&m_state.tasks);
+    if (!m_player.start(*m_state.scene, layout, volumes.size(), convert)) {
+      fprintf(stderr,
+          "Playback needs a linear field the scene owns (not with --mmap or "
+          "--lac-cache)\n");
+      return;
+    }
+    m_player.setRate(g_phaseRate);
+    m_player.setPlaying(true);
+    m_settingsEditor->setPhases(volumes.size(), true, g_phaseRate);
+  }
+
+  // --record-camera: one path frame per UI frame the view changed in,
+  // whatever moved it (manipulators, predictions, matchers)
+  void recordCamera()
+  {
+    float view[11];
+    currentView(view);
+    const auto now = std::chrono::steady_clock::now();
+    if (m_cameraPath.empty())
+      m_recordStart = now;
+    else if (std::memcmp(view, m_recordView, sizeof(view)) == 0)
+      return;
+    std::memcpy(m_recordView, view, sizeof(view));
+
+    CameraPathFrame frame;
+    frame.time = std::chrono::duration<float>(now - m_recordStart).count();
+    std::copy_n(view, 3, frame.eye);
+    std::copy_n(view + 3, 3, frame.center);
+    std::copy_n(view + 6, 3, frame.up);
+    frame.fovy = view[9];
+    m_cameraPath.push_back(frame);
+  }
+
+  // --replay-camera: mouse input is ignored and every path frame gets one
+  // rendered frame; the next pose is set once the previous one is shown
+  void startReplay()
+  {
+    if (g_replayCameraFile.empty()
+        || !readCameraPath(g_replayCameraFile, m_replayPath)
+        || m_replayPath.empty())
+      return;
+    std::cout << "Replaying " << m_replayPath.size() << " camera frames from "
+              << g_replayCameraFile << '\n';
+    m_viewport->setInputEnabled(false);
+    m_replayStats = FrameStats(m_replayPath.size());
+    m_replayNext = 0;
+  }
+
+  // The volume's template library, if one was built (--build-templates)
+  // with the current renderer and field of view
+  void loadTemplates()
+  {
+    const std::string file = templateFile();
+    if (file.empty() || !std::filesystem::exists(file))
+      return;
+    auto library = std::make_unique<TemplateLibrary>();
+    std::string context;
+    if (!library->load(file, context))
+      return;
+    if (context != templateContext(m_state.predictions.fovy)) {
+      std::cerr << "Template library " << file
+                << " was built with other settings, rebuild it with "
+                   "--build-templates\n";
+      return;
+    }
+    std::cout << "Template library " << file << ": " << library->size()
+              << " poses\n";
+    m_templates = std::move(library);
+  }
+
+  // Registration starts from the template most similar to the reference
+  // rather than wherever the camera is
+  void initializeFromTemplates()
+  {
+    if (!m_templates || !m_reference)
+      return;
+    const auto start = std::chrono::steady_clock::now();
+    const auto matches = m_templates->query(m_templates->embed(*m_reference));
+    if (matches.empty())
+      return;
+    const auto p = m_templates->pose(matches.front().index);
+    m_viewport->setView(p.eye, p.center, p.up);
+    const auto end = std::chrono::steady_clock::now();
+    std::cout << "Initial pose: template " << matches.front().index
+              << " (NCC " << matches.front().score << ", "
+              << std::chrono::duration<float, std::milli>(end - start).count()
+              << " ms)\n";
+  }
+
+  // A prediction's camera just loaded shows its DRR from the cache at once,
+  // until the viewport's own frame replaces it
+  void showCachedDrr(const anari::math::float3 &eye,
+      const anari::math::float3 &center,
+      const anari::math::float3 &up)
+  {
+    if (!m_drrCache || !m_state.volumeReady)
+      return;
+    const auto &predictions = m_state.predictions.predictions;
+    for (size_t i = 0; i < predictions.size(); ++i) {
+      const auto &p = predictions[i];
+      if (p.eye != eye || p.center != center || p.up != up)
+        continue;
+      auto drr = m_drrCache->get(i,
+          eye,
+          center,
+          up,
+          m_viewport->rayCamera(),
+          m_state.scene->version());
+      if (drr) {
+        m_viewport->presentImage(
+            drr->data.data(), int(drr->width), int(drr->height));
+      }
+      return;
+    }
+  }
+
+  void updateReplay()
+  {
+    const uint64_t completed = m_viewport->numCompletedFrames();
+    if (m_replayNext > 0) {
+      if (completed == m_replayCompleted)
+        return; // the previous pose is still rendering
+      m_replayStats.push(m_viewport->lastFrameStats());
+    }
+    if (m_replayNext == m_replayPath.size()) {
+      finishReplay();
+      return;
+    }
+
+    const auto &frame = m_replayPath[m_replayNext++];
+    m_viewport->setView({frame.eye[0], frame.eye[1], frame.eye[2]},
+        {frame.center[0], frame.center[1], frame.center[2]},
+        {frame.up[0], frame.up[1], frame.up[2]});
+    if (frame.fovy > 0.f)
+      m_viewport->setFovy(frame.fovy);
+    m_replayCompleted = m_viewport->numCompletedFrames();
+  }
+
+  void finishReplay()
+  {
+    using Frame = FrameStats::Frame;
+    const std::string file = g_replayCameraFile + ".timings.csv";
+    printf("Replay done: %zu frames, %.1f fps, duration p50 %.2f / p95 %.2f "
+           "ms\n",
+        m_replayStats.size(),
+        m_replayStats.fps(),
+        m_replayStats.percentile(&Frame::duration, 0.5f),
+        m_replayStats.percentile(&Frame::duration, 0.95f));
+    if (m_replayStats.writeCsv(file))
+      printf("Replay timings written to '%s'\n", file.c_str());
+    m_viewport->setInputEnabled(true);
+    m_replayNext = SIZE_MAX;
+  }
+
+  // Camera as one comparable key: eye, center, up, fovy, aspect
+  void currentView(float view[11]) const
+  {
+    anari::math::float3 eye, center, up;
+    float fovy, aspect;
+    m_viewport->getView(eye, center, up, fovy, aspect);
+    const float key[11] = {eye.x,
+        eye.y,
+        eye.z,
+        center.x,
+        center.y,
+        center.z,
+        up.x,
+        up.y,
+        up.z,
+        fovy,
+        aspect};
+    std::memcpy(view, key, sizeof(key));
+  }
+
+  // Out-of-core volumes: requests the bricks in the view frustum when the
+  // camera moved and rebuilds the field from the resident bricks at most a
+  // few times per second while they stream in
+  void updateStreamedBricks()
+  {
+    auto &stream = m_state.volumes.active().brickStream;
+    float view[11];
+    currentView(view);
+    if (std::memcmp(view, m_streamView, sizeof(view)) != 0) {
+      std::memcpy(m_streamView, view, sizeof(view));
+      stream.request(
+          stream.visibleBricks(view, view + 3, view + 6, view[9], view[10]));
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t version = stream.version();
+    if (version == m_streamVersion
+        || now - m_streamUpdate < std::chrono::milliseconds(250))
+      return;
+    m_streamVersion = version;
+    m_streamUpdate = now;
+    m_state.scene->setStreamedField(stream);
+  }
+
+  // --lod: device fields of the volume's pyramid, level 0 being the scene's
+  // full-resolution field; the coarsest level is shown while the camera
+  // moves, and once the view settles the coarsest whose voxels project to
+  // at most a pixel (footprintLevel()), which renders the same DRR
+  void buildLod()
+  {
+    releaseLod();
+    const auto &volume = m_state.volumes.active();
+    const auto &data = volume.sdata;
+    if (g_lodLevels == 0 || data.empty() || !m_state.scene->field())
+      return;
+
+    TRACE_SCOPE("volume", "build LOD");
+    const bool isLac = volume.isNifti && !g_deviceLut;
+    auto device = m_state.device;
+    auto full = m_state.scene->field();
+    anari::retain(device, full);
+    m_lodFields.push_back(full);
+    m_lodSpacings.assign(1, voxelSize(data));
+    std::vector<StructuredField> levels;
+#ifdef HAVE_ITK
+    levels = zarrLevels(m_state.lacReader, volume, isLac);
+#endif
+    if (levels.empty())
+      levels = buildFieldPyramid(data, g_lodLevels);
+    for (auto &level : levels) {
+      m_lodFields.push_back(m_state.scene->newField(level, isLac));
+      m_lodSpacings.push_back(voxelSize(level));
+      m_lodBytes +=
+          size_t(level.dimX) * level.dimY * level.dimZ * level.bytesPerCell;
+    }
+    m_lodRange[0] = data.dataRange.x;
+    m_lodRange[1] = data.dataRange.y;
+    m_lodLevel = 0;
+    currentView(m_lodView);
+  }
+
+  void releaseLod()
+  {
+    for (auto field : m_lodFields)
+      anari::release(m_state.device, field);
+    m_lodFields.clear();
+    m_lodBytes = 0;
+  }
+
+  void updateLod()
+  {
+    const auto now = std::chrono::steady_clock::now();
+    float view[11];
+    currentView(view);
+    if (std::memcmp(view, m_lodView, sizeof(view)) != 0) {
+      std::memcpy(m_lodView, view, sizeof(view));
+      m_lodMotion = now;
+    }
+
+    // registration moves the camera too, but wants the DRR it matches
+    const bool moving = now - m_lodMotion < std::chrono::milliseconds(200)
+        && !m_registration.running();
+    const size_t level = moving
+        ? m_lodFields.size() - 1
+        : footprintLevel(m_lodSpacings,
+            pixelFootprint(
+                m_state.volumes.active().sdata, m_viewport->rayCamera()));
+    if (level == m_lodLevel)
+      return;
+    m_lodLevel = level;
+    m_state.scene->setField(m_lodFields[level], m_lodRange);
+  }
+
+  AppState m_state;
+  anari_viewer::windows::DRRViewport *m_viewport{nullptr};
+  anari_viewer::windows::ImageViewport *m_imageViewport{nullptr};
+  anari_viewer::windows::ComparisonGrid *m_comparisonGrid{nullptr};
+  // the viewport's frames over the DRR cache's and the grid's renders
+  DeviceArbiter m_deviceArbiter;
+  std::unique_ptr<DrrCache> m_drrCache; // prediction DRRs rendered ahead
+  std::unique_ptr<TemplateLibrary> m_templates; // initial poses, if built
+  std::unique_ptr<ThumbnailAtlas> m_thumbnails;
+  uint64_t m_framesBeforeVolume{0}; // viewport frames before it was shown
+  std::unique_ptr<FrameStreamer> m_streamer;
+  std::unique_ptr<GpuCounters> m_gpuCounters; // of the first GPU
+  anari_viewer::windows::SettingsEditor *m_settingsEditor{nullptr};
+  std::function<void(size_t)> m_updateLacLut;
+  float m_photonEnergy{0.f}; // eV, from the settings editor
+  std::chrono::steady_clock::time_point m_nextLacPoll{};
+  std::unique_ptr<PredictionFeed> m_feed; // --prediction-feed
+  std::chrono::steady_clock::time_point m_nextFeedPoll{};
+
+  std::future<MatchResult> m_matchJob;
+  std::future<std::vector<MatchOutcome>> m_matchAllJob;
+  bool m_matchPending{false};
+  size_t m_numRecordedMatches{0};
+  anari::math::float3 m_matchAllEye, m_matchAllCenter; // pose matched from
+  RegistrationLoop m_registration;
+  ScratchArena m_matchScratch; // lent to the matcher by each match job
+  // current reference image, its pyramid while registering coarse-to-fine
+  // and the level the matcher holds; index SIZE_MAX for framebuffer refs
+  std::shared_ptr<const Image> m_reference;
+  std::shared_ptr<const ImagePyramid> m_referencePyramid;
+  size_t m_referenceIndex{SIZE_MAX};
+  size_t m_referenceLevel{0};
+  bool m_referenceSwizzle{false};
+  bool m_matcherHasPyramid{false};
+  anari_viewer::windows::PredictionsEditor *m_predictionsEditor{nullptr};
+  uint64_t m_latestMatchRequest{0};
+  PoseCache m_poseCache; // outcomes of the matches run (--pose-cache: on disk)
+  // stages of the match shown last, until a frame at its pose completes
+  anari_viewer::windows::MatchStages m_matchStages;
+  bool m_matchStagesPending{false};
+  uint64_t m_matchStagesCompleted{0}; // viewport frames before its setView
+  std::chrono::steady_clock::time_point m_matchStagesShown;
+  anari_viewer::windows::FrameView m_matchFrame; // while a match runs
+  // the match's camera and field for ray-marched point lookups
+  struct FirstHitQuery
+  {
+    const StructuredField *field{nullptr};
+    RayCamera camera;
+    FirstHitSettings settings;
+  } m_firstHits;
+  std::vector<uint8_t> m_matchColor; // ROI frames placed into full ones
+  std::vector<float> m_matchOrigin;
+  std::vector<uint8_t> m_matchEdges;
+  std::vector<uint8_t> m_matchGray; // for MATCHER_CAP_GRAY matchers
+  // m_reference (source) and its pyramid levels converted by
+  // referenceView(), GRAY8, BGRA8 and RGBA8 (of GRAY16 references)
+  struct ConvertedReference
+  {
+    std::shared_ptr<const Image> source;
+    std::vector<std::shared_ptr<const Image>> levels;
+  };
+  std::array<ConvertedReference, 3> m_convertedReferences;
+
+  std::future<void> m_volumeLoad;
+  std::future<StructuredField> m_previewLoad; // --preview
+  bool m_previewShown{false};
+  // --worklist: the case shown, the case being read (ahead or asked for)
+  // and the one to switch to once it is read
+  size_t m_caseIndex{g_firstCase};
+  std::future<std::unique_ptr<PreparedCase>> m_caseJob;
+  size_t m_caseJobIndex{SIZE_MAX};
+  size_t m_openCase{SIZE_MAX};
+  PhasePlayer m_player; // --play
+  std::vector<CameraPathFrame> m_cameraPath; // --record-camera
+  std::chrono::steady_clock::time_point m_recordStart;
+  float m_recordView[11]{};
+  std::vector<CameraPathFrame> m_replayPath; // --replay-camera
+  size_t m_replayNext{SIZE_MAX}; // SIZE_MAX: not replaying
+  uint64_t m_replayCompleted{0}; // viewport frames before the current pose
+  FrameStats m_replayStats;
+  float m_streamView[11]{}; // eye, center, up, fovy, aspect of the last request
+  std::vector<anari::SpatialField> m_lodFields;
+  size_t m_lodLevel{0};
+  std::vector<float> m_lodSpacings; // voxelSize() of each level
+  size_t m_lodBytes{0}; // coarse levels
+  float m_lodRange[2]{0.f, 1.f};
+  float m_lodView[11]{};
+  std::chrono::steady_clock::time_point m_lodMotion;
+  uint64_t m_streamVersion{0};
+  std::chrono::steady_clock::time_point m_streamUpdate;
+  struct
+  {
+    std::mutex mutex;
+    float progress{0.f};
+    std::string stage;
+  } m_loadStatus;
+};
+
+// Headless batch mode /////////////////////////////////////////////////////////
+
+// Per-device copy of the scene for offscreen rendering
+struct DeviceScene
+{
+  anari::Device device{nullptr};
+  std::unique_ptr<VolumeScene> volume;
+  std::unique_ptr<BatchRenderer> renderer;
+  size_t lacLut{0}; // LUT currently in the volume's transfer function
+  const StructuredField *hostField{nullptr}; // for --renderer builtin
+};
+
+// Reads the LUTs and the volume on the host, once for all devices
+static bool loadHostVolume(AppState &state)
+{
+  // one volume per run outside the interactive viewer
+  if (g_filenames.size() > 1)
+    fprintf(stderr, "WARNING: rendering %s only\n", g_filenames[0].c_str());
+  addVolumes(state, 1);
+
+#ifdef HAVE_ITK
+  readCaseLacLuts(state.lacReader, 0);
+#endif
+
+  if (g_outOfCoreBytes) {
+    fprintf(stderr, "ERROR: --out-of-core needs the interactive viewer\n");
+    return false;
+  }
+  auto &volume = state.volumes.active();
+  readVolume(
+      state.lacReader,
+      volume,
+      0,
+      [](float, const char *stage) { std::cout << stage << "...\n"; },
+      false);
+  if (volume.sdata.empty()) {
+    fprintf(
+        stderr, "ERROR: could not load volume %s\n", volume.fileName.c_str());
+    return false;
+  }
+  // RAW files are read slab only (readVolume()), NIfTI files too
+  // (readsRegion()), other formats whole
+  bool slabRead = !volume.rawReader.field.empty();
+#ifdef HAVE_ITK
+  slabRead = slabRead || readsRegion(volume);
+#endif
+  if (g_slabCount > 0 && !slabRead) {
+    volume.sdata = slabField(volume.sdata,
+        slabRange(volume.sdata.dimZ, g_slabIndex, g_slabCount));
+  }
+  if (g_slabCount > 0) {
+    std::cout << "Slab " << g_slabIndex << "/" << g_slabCount << ": "
+              << volume.sdata.dimZ << " slices from z = "
+              << volume.sdata.origin[2] << "\n";
+  }
+  return true;
+}
+
+// --scatter-table's kernel at keV, or with keV 0 at the energy of LUT `lut`
+// (SIZE_MAX: the active one); empty without a table or an energy
+static std::vector<ScatterGaussian> tableScatter(
+    const LacReader &lacReader, float keV = 0.f, size_t lut = SIZE_MAX)
+{
+  if (g_scatterTable.empty())
+    return {};
+  if (lut == SIZE_MAX)
+    lut = lacReader.getActiveLut();
+  if (keV <= 0.f && lut < lacReader.m_lacLuts.size())
+    keV = float(lacReader.m_lacLuts[lut].eV) / 1000.f;
+  if (keV <= 0.f)
+    return {};
+  return g_scatterTable.at(keV);
+}
+
+// --lod outside the interactive viewer: the host volume is replaced by the
+// coarsest pyramid level whose voxels project to at most a pixel of
+// g_batchWidth x g_batchHeight frames in every pose (see footprintLevel()),
+// which renders the full volume's DRRs. Registration moves the poses little
+// enough for the initial ones to decide.
+static void selectHostLod(
+    AppState &state, const std::vector<prediction> &poses, float fovy)
+{
+  auto &volume = state.volumes.active();
+  if (g_lodLevels == 0 || poses.empty() || volume.sdata.empty())
+    return;
+
+  RayCamera camera;
+  camera.fovy = fovy;
+  camera.aspect = g_batchWidth / float(g_batchHeight);
+  camera.width = size_t(g_batchWidth);
+  camera.height = size_t(g_batchHeight);
+  float footprint = std::numeric_limits<float>::max();
+  for (const auto &pose : poses) {
+    const auto dir = anari::math::normalize(pose.center - pose.eye);
+    const float eye[3] = {pose.eye.x, pose.eye.y, pose.eye.z};
+    const float view[3] = {dir.x, dir.y, dir.z};
+    const float up[3] = {pose.up.x, pose.up.y, pose.up.z};
+    std::copy_n(eye, 3, camera.eye);
+    std::copy_n(view, 3, camera.dir);
+    std::copy_n(up, 3, camera.up);
+    footprint = std::min(footprint, pixelFootprint(volume.sdata, camera));
+  }
+
+  // levels are built only as far as the poses allow; each doubles the
+  // spacing (downsampleField())
+  StructuredField field = volume.sdata;
+  size_t level = 0;
+  while (level < g_lodLevels && field.dimX > 1 && field.dimY > 1
+      && field.dimZ > 1 && 2.f * voxelSize(field) <= footprint) {
+    field = downsampleField(field);
+    ++level;
+  }
+  if (level == 0)
+    return;
+  printf("LOD level %zu: %dx%dx%d voxels of %g for pixels of %g at the "
+         "nearest depth\n",
+      level,
+      field.dimX,
+      field.dimY,
+      field.dimZ,
+      voxelSize(field),
+      footprint);
+  volume.sdata = std::move(field);
+}
+
+// The volume, or a z slab of it (see SlabRender.h), and a batch renderer
+// on scene.device
+static void setupDeviceScene(const AppState &state,
+    const BatchRenderSettings &settings,
+    DeviceScene &scene,
+    const SlabRange *slab = nullptr)
+{
+  auto device = scene.device;
+  scene.volume = std::make_unique<VolumeScene>(device, g_brickSize, g_verbose);
+  scene.volume->setSparse(g_sparse);
+  if (g_clip)
+    scene.volume->setClip(g_clipBox, g_clipBox + 3);
+  const auto &volume = state.volumes.active();
+  if (slab) {
+    scene.volume->setField(
+        slabField(volume.sdata, *slab), volume.isNifti && !g_deviceLut);
+  } else {
+    scene.volume->setField(volume.sdata, volume.isNifti && !g_deviceLut);
+  }
+#ifdef HAVE_ITK
+  scene.lacLut = state.lacReader.getActiveLut();
+  if (g_deviceLut) {
+    setLacTransferFunction(
+        device, scene.volume->volume(), state.lacReader, scene.lacLut);
+  }
+#endif
+
+  // the builtin renderer's origins are first hits, as matchers look
+  // them up interactively
+  BatchRenderSettings sceneSettings = settings;
+  if (settings.renderer == "builtin") {
+    scene.hostField = &volume.sdata;
+    if (g_firstHitThreshold >= 0.f)
+      sceneSettings.march.threshold = g_firstHitThreshold;
+    sceneSettings.march.projector = g_projector;
+    if (!g_deformation.empty())
+      sceneSettings.march.deformation = &g_deformation;
+    if (g_voxelOrder != VoxelOrder::Linear) {
+      if (!g_hostVoxels.matches(volume.sdata))
+        g_hostVoxels = reorderVoxels(volume.sdata, g_voxelOrder);
+      sceneSettings.march.voxels = &g_hostVoxels;
+    }
+#ifdef HAVE_ITK
+    // with --lut-cache-bits the rays decode the cached blocks themselves
+    if (volume.isNifti) {
+      sceneSettings.march.quantized =
+          volume.niftiReader.packedField(volume.lacLut);
+    }
+#endif
+  }
+  applyClip(sceneSettings.march);
+  if (settings.renderer == "builtin" && !g_drrTuningFile.empty()) {
+    sceneSettings.march.layout = tuneDrrLayout(volume.sdata,
+        size_t(settings.width),
+        size_t(settings.height),
+        sceneSettings.march,
+        g_drrTuningFile);
+  }
+  scene.renderer = std::make_unique<BatchRenderer>(
+      device, scene.volume->world(), sceneSettings, scene.hostField);
+}
+
+// One device per GPU, each with its own copy of the field uploaded from the
+// shared host volume, or with slabs its own z slab of it (see SlabRender.h)
+static bool createDeviceScenes(const AppState &state,
+    const BatchRenderSettings &settings,
+    std::vector<DeviceScene> &scenes,
+    bool slabs = false)
+{
+  if (settings.renderer == "builtin" && g_deviceLut) {
+    fprintf(stderr,
+        "ERROR: --renderer builtin integrates attenuation on the host, not "
+        "densities through --device-lut\n");
+    return false;
+  }
+  scenes.resize(std::max(g_numDevices, 1));
+
+  for (size_t i = 0; i < scenes.size(); ++i) {
+    auto &scene = scenes[i];
+    auto device = newDevice(scenes.size() > 1 ? int(i) : -1);
+    if (!device)
+      return false;
+    scene.device = device;
+    if (slabs) {
+      const auto range = slabRange(
+          state.volumes.active().sdata.dimZ, i, scenes.size());
+      setupDeviceScene(state, settings, scene, &range);
+    } else {
+      setupDeviceScene(state, settings, scene);
+    }
+  }
+
+  return true;
+}
+
+static void releaseDeviceScenes(std::vector<DeviceScene> &scenes)
+{
+  for (auto &scene : scenes) {
+    if (!scene.device)
+      continue;
+    scene.renderer.reset();
+    scene.volume.reset();
+    anari::release(scene.device, scene.device);
+  }
+  scenes.clear();
+}
+
+// --cpu-devices: devices of the CPU library rendering poses next to the
+// GPUs' scenes. Both run the builtin renderer, whose host kernel integrates
+// the same field with the same settings wherever it runs, so no image
+// depends on the device that rendered it.
+static void addCpuScenes(const AppState &state,
+    const BatchRenderSettings &settings,
+    std::vector<DeviceScene> &scenes)
+{
+  std::vector<DeviceScene> cpuScenes(g_cpuDevices);
+  bool created = true;
+  for (auto &scene : cpuScenes) {
+    try {
+      scene.device = newDevice(-1, g_cpuLibrary);
+    } catch (const std::runtime_error &) {
+      // the library did not load, reported below
+    }
+    created = created && scene.device;
+    if (scene.device)
+      setupDeviceScene(state, settings, scene);
+  }
+  if (!created) {
+    fprintf(stderr,
+        "WARNING: could not create %s devices, rendering on the GPUs only\n",
+        g_cpuLibrary.c_str());
+    releaseDeviceScenes(cpuScenes);
+    return;
+  }
+  for (auto &scene : cpuScenes)
+    scenes.push_back(std::move(scene));
+  std::cout << "Rendering on " << g_cpuDevices << " " << g_cpuLibrary
+            << " device(s) too\n";
+}
+
+// Appends the poses of the --json file (JSON or binary) to a binary
+// prediction file, which viewers then map instead of parsing
+static int runAppendPredictions()
+{
+  prediction_container predictions;
+  if (g_jsonfile.empty() || !predictions.load(g_jsonfile)) {
+    fprintf(stderr, "ERROR: --append-predictions needs a pose list (--json)\n");
+    return 1;
+  }
+  if (!prediction_container::append_binary(g_appendPredictionsFile,
+          predictions.begin(),
+          predictions.end(),
+          predictions.fovx,
+          predictions.fovy))
+    return 1;
+  printf("Appended %zu predictions to %s\n",
+      predictions.predictions.size(),
+      g_appendPredictionsFile.c_str());
+  return 0;
+}
+
+// Renders every prediction, matches the DRR against its reference image (or
+// registers it, with --register) and writes the corrected poses,
+// similarities and timings to g_evaluateFile
+static int runEvaluate()
+{
+  if (g_jsonfile.empty()) {
+    fprintf(stderr, "ERROR: --evaluate needs a pose list (--json)\n");
+    return 1;
+  }
+  // outcomes matched already are taken from the pose cache
+  g_poseCache |= g_resume;
+
+  ViewRig views;
+  if (!g_viewRigFile.empty() && !views.load(g_viewRigFile))
+    return 1;
+
+  AppState state;
+  if (!state.predictions.load(g_jsonfile) || !loadHostVolume(state))
+    return 1;
+  state.matchers.init(g_matcherLibraries, g_lazyMatchers);
+  addFrameRingMatcher(state.matchers);
+  setMatcherThreadBudget(state);
+  state.matchers.setDeviceReferenceBudget(g_referencePoolBytes);
+  if (g_referenceCache)
+    state.matchers.setReferenceCacheDir(
+        std::filesystem::path(g_jsonfile).replace_extension(".refcache"));
+  if (g_numDevices > 1)
+    fprintf(stderr, "WARNING: --evaluate runs on one device\n");
+  PoseCache poseCache;
+  {
+    char size[64];
+    std::snprintf(size,
+        sizeof(size),
+        "%dx%d %g",
+        g_batchWidth,
+        g_batchHeight,
+        state.predictions.fovy);
+    openPoseCache(poseCache, size);
+  }
+
+  selectHostLod(state, state.predictions.predictions, state.predictions.fovy);
+  BatchRenderSettings settings;
+  settings.width = g_batchWidth;
+  settings.height = g_batchHeight;
+  settings.fovy = state.predictions.fovy;
+  settings.renderer = g_rendererName;
+  settings.writeOrigin = true; // the matchers' depth3d input
+  settings.scatter = tableScatter(state.lacReader);
+
+  const int numDevices = g_numDevices;
+  g_numDevices = 1;
+  std::vector<DeviceScene> scenes;
+  bool success = createDeviceScenes(state, settings, scenes);
+  g_numDevices = numDevices;
+  std::vector<PoseEvaluation> results;
+  if (success) {
+    const size_t matcherIndex = state.matchers.size() == 0
+        ? SIZE_MAX
+        : state.matchers.m_activeMatcherIndex;
+    if (g_registerIterations > 0) {
+      RegistrationSettings registration;
+      registration.maxIterations = g_registerIterations;
+      registration.tolerance = g_registerTolerance;
+      registration.warmStart = g_warmStart;
+      if (g_registerGradient)
+        registration.gradientField = &state.volumes.active().sdata;
+      registration.sampleFraction = g_registerSamples;
+      registration.sampling = g_registerSampling;
+      registration.roi = g_registerRoi;
+      registration.starts = g_multiStart;
+      if (!g_viewRigFile.empty())
+        registration.views = &views;
+      success = registerPredictions(*scenes[0].renderer,
+          state.matchers,
+          matcherIndex,
+          state.predictions,
+          registration,
+          results,
+          &poseCache);
+    } else {
+      success = evaluatePredictions(*scenes[0].renderer,
+          state.matchers,
+          matcherIndex,
+          state.predictions,
+          results,
+          &poseCache);
+    }
+  }
+  releaseDeviceScenes(scenes);
+  if (results.empty())
+    return 1;
+
+  size_t numMatched = 0;
+  double delta = 0.0, ncc = 0.0;
+  for (auto &r : results) {
+    if (!r.haveReference)
+      continue;
+    numMatched++;
+    delta += r.poseDelta;
+    ncc += r.ncc;
+  }
+  if (numMatched) {
+    printf("%zu of %zu predictions matched: mean pose delta %.4g, mean NCC "
+           "%.4f\n",
+        numMatched,
+        results.size(),
+        delta / numMatched,
+        ncc / numMatched);
+  }
+  if (!writeEvaluationCsv(g_evaluateFile, state.predictions, results))
+    return 1;
+  printf("Evaluation written to %s\n", g_evaluateFile.c_str());
+  return success ? 0 : 1;
+}
+
+// Tracks the frames of g_trackSource from the first --json pose, each
+// frame's pose starting the next, and streams the poses to g_trackFile
+static int runTrack()
+{
+  if (g_jsonfile.empty()) {
+    fprintf(stderr,
+        "ERROR: --track needs a start pose and field of view (--json)\n");
+    return 1;
+  }
+  AppState state;
+  if (!state.predictions.load(g_jsonfile) || !loadHostVolume(state))
+    return 1;
+  if (state.predictions.predictions.empty()) {
+    fprintf(stderr, "ERROR: %s has no start pose\n", g_jsonfile.c_str());
+    return 1;
+  }
+  state.matchers.init(g_matcherLibraries, g_lazyMatchers);
+  addFrameRingMatcher(state.matchers);
+  setMatcherThreadBudget(state);
+
+  TrackingSettings tracking = g_tracking;
+  if (g_registerIterations > 0) {
+    tracking.maxIterations = g_registerIterations;
+    tracking.tolerance = g_registerTolerance;
+  }
+  tracking.preprocess = g_preprocess;
+  selectHostLod(
+      state, {state.predictions.predictions.front()}, state.predictions.fovy);
+
+  BatchRenderSettings settings;
+  trackingFrameSize(tracking.roi,
+      g_batchWidth,
+      g_batchHeight,
+      0,
+      settings.width,
+      settings.height);
+  settings.fovy = state.predictions.fovy;
+  settings.renderer = g_rendererName;
+  settings.writeOrigin = true; // the matchers' depth3d input
+  settings.framesInFlight = 1;
+  settings.scatter = tableScatter(state.lacReader);
+
+  const int numDevices = g_numDevices;
+  g_numDevices = 1;
+  std::vector<DeviceScene> scenes;
+  const bool created = createDeviceScenes(state, settings, scenes);
+  g_numDevices = numDevices;
+  if (!created) {
+    releaseDeviceScenes(scenes);
+    return 1;
+  }
+
+  // the coarser levels' renderers share the scene's world
+  auto &scene = scenes.front();
+  std::vector<std::unique_ptr<BatchRenderer>> coarse;
+  TrackingRenderers renderers;
+  renderers.fullWidth = size_t(g_batchWidth);
+  renderers.fullHeight = size_t(g_batchHeight);
+  renderers.levels.push_back(scene.renderer.get());
+  for (size_t l = 1; l < tracking.numLevels; ++l) {
+    BatchRenderSettings level = scene.renderer->settings();
+    trackingFrameSize(tracking.roi,
+        g_batchWidth,
+        g_batchHeight,
+        l,
+        level.width,
+        level.height);
+    coarse.push_back(std::make_unique<BatchRenderer>(
+        scene.device, scene.volume->world(), level, scene.hostField));
+    renderers.levels.push_back(coarse.back().get());
+  }
+
+  std::ofstream csv(g_trackFile);
+  if (!csv) {
+    fprintf(stderr, "ERROR: could not write %s\n", g_trackFile.c_str());
+    coarse.clear();
+    releaseDeviceScenes(scenes);
+    return 1;
+  }
+  csv << "frame,file,updated,eye_x,eye_y,eye_z,center_x,center_y,center_z,"
+         "up_x,up_y,up_z,iterations,decode_wait_ms,register_ms\n";
+
+  FrameSequence frames(g_trackSource,
+      g_trackFollow > 0.f,
+      std::chrono::milliseconds(int64_t(g_trackFollow * 1000.f)));
+  size_t numFrames = 0, numUpdated = 0;
+  float registerMs = 0.f;
+  const auto start = std::chrono::steady_clock::now();
+  const bool success = trackSequence(renderers,
+      state.matchers,
+      state.matchers.m_activeMatcherIndex,
+      state.predictions.fovy,
+      state.predictions.predictions.front(),
+      frames,
+      tracking,
+      [&](const TrackedFrame &f) {
+        csv << f.index << "," << f.file << "," << f.updated << ","
+            << f.eye[0] << "," << f.eye[1] << "," << f.eye[2] << ","
+            << f.center[0] << "," << f.center[1] << "," << f.center[2] << ","
+            << f.up[0] << "," << f.up[1] << "," << f.up[2] << ","
+            << f.iterations << "," << f.decodeWaitMs << "," << f.ms << "\n";
+        csv.flush(); // read live by whatever follows the poses
+        numFrames++;
+        numUpdated += f.updated;
+        registerMs += f.ms;
+        return true;
+      });
+  const float seconds = std::chrono::duration<float>(
+      std::chrono::steady_clock::now() - start)
+                            .count();
+  if (numFrames) {
+    printf("Tracked %zu frames (%zu updated) in %.2fs: %.1f Hz, %.1f ms "
+           "registration per frame\n",
+        numFrames,
+        numUpdated,
+        seconds,
+        seconds > 0.f ? numFrames / seconds : 0.f,
+        registerMs / numFrames);
+  }
+  coarse.clear();
+  releaseDeviceScenes(scenes);
+  return success ? 0 : 1;
+}
+
+// Renders every pose of the --json prediction file offscreen into
+// g_batchDir; the volume is uploaded once and shared by all poses
+// What the outputs of a --batch or --samples job depend on, compared by
+// --resume so a checkpoint is only resumed by the job that wrote it
+static std::string batchJob(const std::string &settings)
+{
+  std::error_code ec;
+  const uint64_t poseBytes = std::filesystem::file_size(g_jsonfile, ec);
+  return g_filenames[0] + "|" + g_jsonfile + "|" + std::to_string(poseBytes)
+      + "|" + std::to_string(g_batchWidth) + "x"
+      + std::to_string(g_batchHeight) + "|" + g_rendererName + "|"
+      + settings;
+}
+
+static int runBatch()
+{
+  if (g_jsonfile.empty()) {
+    fprintf(stderr, "ERROR: --batch needs a pose list (--json)\n");
+    return 1;
+  }
+
+  prediction_container predictions;
+  if (!predictions.load(g_jsonfile))
+    return 1;
+
+  AppState state;
+  if (!loadHostVolume(state))
+    return 1;
+
+  BatchRenderSettings settings;
+  settings.width = g_batchWidth;
+  settings.height = g_batchHeight;
+  settings.fovy = predictions.fovy;
+  settings.renderer = g_rendererName;
+  settings.outputDir = g_batchDir;
+  settings.format = g_batchFormat;
+  settings.detector = g_batchDetector;
+  if (!g_scatterTable.empty())
+    settings.detector.scatter = tableScatter(state.lacReader);
+  settings.shardSize = g_batchShard;
+
+  const bool tiled = g_batchTile > 0
+      && (g_batchWidth > g_batchTile || g_batchHeight > g_batchTile);
+  if (!g_labelFile.empty()
+      && (settings.renderer != "builtin" || g_slabs || tiled)) {
+    fprintf(stderr,
+        "ERROR: --labels renders with --renderer builtin, without --slabs or "
+        "--batch-tile\n");
+    return 1;
+  }
+  if (g_slabs) {
+    if (tiled || g_batchShard > 0 || settings.renderer == "builtin") {
+      fprintf(stderr,
+          "ERROR: --slabs does not go with --batch-tile, --batch-shard or "
+          "--renderer builtin\n");
+      return 1;
+    }
+    const int dimZ = state.volumes.active().sdata.dimZ;
+    if (g_numDevices > dimZ - 1) {
+      fprintf(stderr, "WARNING: %d slices make %d slabs\n", dimZ, dimZ - 1);
+      g_numDevices = std::max(dimZ - 1, 1);
+    }
+    settings.linear = true;
+  }
+  if (tiled) {
+    settings.width = std::min(g_batchTile, g_batchWidth);
+    settings.height = std::min(g_batchTile, g_batchHeight);
+    if (g_numDevices > 1)
+      fprintf(stderr, "WARNING: tiled batches render on one device\n");
+    if (g_batchDetector.enabled())
+      fprintf(stderr, "WARNING: tiled batches are written without noise\n");
+    if (g_batchShard > 0)
+      fprintf(stderr, "WARNING: tiled batches are written as single files\n");
+    g_numDevices = 1;
+  }
+
+  const bool plain = !g_slabs && !tiled && g_labelFile.empty();
+  // the detector models run on float intensities, not on the 256 levels
+  // of sRGB8 color
+  if (plain && settings.detector.enabled())
+    settings.linear = true;
+  // ANARI renderers of different libraries need not render the same bytes
+  if (g_cpuDevices > 0 && (!plain || settings.renderer != "builtin")) {
+    fprintf(stderr,
+        "WARNING: --cpu-devices renders plain batches with --renderer "
+        "builtin only, not with ANARI renderers, --slabs, --batch-tile or "
+        "--labels\n");
+    g_cpuDevices = 0;
+  }
+  if (g_resume && !plain) {
+    fprintf(stderr,
+        "WARNING: --resume skips poses of plain batches only, with --slabs, "
+        "--batch-tile or --labels all poses are rendered\n");
+  }
+  BatchCheckpoint checkpoint;
+  if (plain
+      && !checkpoint.open(g_batchDir,
+          batchJob(imageExtension(g_batchFormat) + "|"
+              + std::to_string(g_batchShard)),
+          predictions.predictions.size(),
+          g_resume))
+    return 1;
+  if (plain && g_resume) {
+    std::cout << "Resuming: " << checkpoint.numDone() << "/"
+              << predictions.predictions.size() << " poses done\n";
+  }
+
+  // labels are on the full volume's grid
+  if (g_labelFile.empty())
+    selectHostLod(state, predictions.predictions, predictions.fovy);
+  std::vector<DeviceScene> scenes;
+  bool success = createDeviceScenes(state, settings, scenes, g_slabs);
+  if (success && g_slabs) {
+    std::vector<BatchRenderer *> renderers;
+    for (auto &scene : scenes)
+      renderers.push_back(scene.renderer.get());
+    success = renderAllSlabs(renderers, predictions.predictions);
+  } else if (success && tiled) {
+    success = renderAllTiled(*scenes[0].renderer,
+        predictions.predictions,
+        g_batchWidth,
+        g_batchHeight);
+  } else if (success && !g_labelFile.empty()) {
+    LabelVolume labels;
+    success = loadLabels(state.volumes.active().sdata, labels)
+        && renderAllMaterials(
+            *scenes[0].renderer, predictions.predictions, labels);
+  } else if (success) {
+    if (g_cpuDevices > 0)
+      addCpuScenes(state, settings, scenes);
+    std::vector<BatchRenderer *> renderers;
+    for (auto &scene : scenes)
+      renderers.push_back(scene.renderer.get());
+    success = BatchRenderer::renderAll(
+        renderers, predictions.predictions, &checkpoint);
+  }
+
+  releaseDeviceScenes(scenes);
+  return success ? 0 : 1;
+}
+
+// --labels of the batch's volume: one label per voxel of field's grid, as
+// uint8; false, with a message, if they cannot be read or do not match
+static bool loadLabels(const StructuredField &field, LabelVolume &labels)
+{
+#ifdef HAVE_ITK
+  NiftiReader reader;
+  if (!reader.open(g_labelFile.c_str()) || !reader.waitForVoxels()) {
+    fprintf(stderr, "ERROR: could not read labels %s\n", g_labelFile.c_str());
+    return false;
+  }
+  const auto &grid = reader.field;
+  if (grid.dimX != field.dimX || grid.dimY != field.dimY
+      || grid.dimZ != field.dimZ) {
+    fprintf(stderr,
+        "ERROR: labels of %dx%dx%d voxels do not match the volume's "
+        "%dx%dx%d\n",
+        grid.dimX,
+        grid.dimY,
+        grid.dimZ,
+        field.dimX,
+        field.dimY,
+        field.dimZ);
+    return false;
+  }
+  labels.dims[0] = grid.dimX;
+  labels.dims[1] = grid.dimY;
+  labels.dims[2] = grid.dimZ;
+  labels.labels.resize(grid.numCells());
+  int highest = 0;
+  dispatchComponentType(reader.componentType, [&](auto tag) {
+    using T = decltype(tag);
+    const T *src = reinterpret_cast<const T *>(reader.voxels.data());
+    for (size_t i = 0; i < labels.labels.size(); ++i) {
+      const int label = int(std::clamp<double>(double(src[i]), 0.0, 255.0));
+      labels.labels[i] = uint8_t(label);
+      highest = std::max(highest, label);
+    }
+  });
+  labels.numChannels = highest + 1;
+  if (labels.numChannels > MaxDrrChannels) {
+    fprintf(stderr,
+        "ERROR: labels go up to %d, per-material DRRs take at most %d\n",
+        highest,
+        MaxDrrChannels);
+    return false;
+  }
+  return true;
+#else
+  fprintf(stderr, "ERROR: --labels needs a build with ITK\n");
+  return false;
+#endif
+}
+
+// --batch over render servers holding one slab each (--slab-servers): no
+// volume or device here, the servers' partial integrals are summed
+static int runRemoteSlabs()
+{
+  if (g_jsonfile.empty()) {
+    fprintf(stderr, "ERROR: --batch needs a pose list (--json)\n");
+    return 1;
+  }
+  prediction_container predictions;
+  if (!predictions.load(g_jsonfile))
+    return 1;
+
+  BatchRenderSettings settings;
+  settings.width = g_batchWidth;
+  settings.height = g_batchHeight;
+  settings.fovy = predictions.fovy;
+  settings.outputDir = g_batchDir;
+  settings.format = g_batchFormat;
+  settings.detector = g_batchDetector;
+  return renderAllRemoteSlabs(g_slabServers, settings, predictions.predictions)
+      ? 0
+      : 1;
+}
+
+// Renders g_samples.count poses sampled around the --json poses into
+// shard files in g_batchDir; devices take whole shards, so each switches
+// LUT and energy once per shard
+static int runSamples()
+{
+  if (g_jsonfile.empty()) {
+    fprintf(stderr, "ERROR: --samples needs base poses (--json)\n");
+    return 1;
+  }
+  prediction_container predictions;
+  if (!predictions.load(g_jsonfile) || predictions.predictions.empty())
+    return 1;
+
+#ifdef HAVE_ITK
+  if (!g_samples.luts.empty() && !g_deviceLut) {
+    // switching LUTs per shard is only cheap (and thread-safe) on the device
+    std::cout << "LUT sampling: enabling --device-lut\n";
+    g_deviceLut = true;
+  }
+#else
+  if (!g_samples.luts.empty())
+    fprintf(stderr, "WARNING: sampled LUTs need ITK, using the volume as is\n");
+#endif
+
+  AppState state;
+  if (!loadHostVolume(state))
+    return 1;
+#ifdef HAVE_ITK
+  for (uint32_t lut : g_samples.luts) {
+    if (lut >= state.lacReader.m_lacLuts.size()) {
+      fprintf(stderr, "ERROR: no LUT %u to sample\n", lut);
+      return 1;
+    }
+  }
+#endif
+
+  BatchRenderSettings settings;
+  settings.width = g_batchWidth;
+  settings.height = g_batchHeight;
+  settings.fovy = predictions.fovy;
+  settings.renderer = g_rendererName;
+  settings.outputDir = g_batchDir;
+  settings.writeOrigin = false;
+
+  const PoseSampler sampler(predictions.predictions, g_samples);
+  const uint64_t count = g_samples.count;
+  const uint64_t shardSize = std::max<uint64_t>(g_samples.shardSize, 1);
+
+  std::vector<DeviceScene> scenes;
+  if (!createDeviceScenes(state, settings, scenes)) {
+    releaseDeviceScenes(scenes);
+    return 1;
+  }
+
+  BatchCheckpoint checkpoint;
+  {
+    char job[128];
+    std::snprintf(job,
+        sizeof(job),
+        "samples %llu %llu %llu",
+        (unsigned long long)count,
+        (unsigned long long)g_samples.seed,
+        (unsigned long long)shardSize);
+    if (!checkpoint.open(g_batchDir, batchJob(job), count, g_resume)) {
+      releaseDeviceScenes(scenes);
+      return 1;
+    }
+  }
+  const uint64_t numDone = checkpoint.numDone();
+  if (g_resume)
+    std::cout << "Resuming: " << numDone << "/" << count << " poses done\n";
+
+  // conversion and writes overlap the rendering, like renderAll()'s
+  ShardWriter writer(std::max(2u, std::thread::hardware_concurrency() / 2),
+      2 * scenes.size() * scenes.front().renderer->numSlots());
+  bool success = writer.open(g_batchDir,
+      settings.width,
+      settings.height,
+      settings.fovy,
+      count,
+      shardSize,
+      g_resume);
+  for (uint64_t i = 0; numDone > 0 && i < count; ++i) {
+    if (checkpoint.done(i))
+      writer.skip(i);
+  }
+  writer.setWrittenCallback(
+      [&checkpoint](uint64_t index) { checkpoint.written(index); });
+
+  PoseScheduler scheduler(g_samples.numShards(), scenes.size());
+  std::atomic<uint64_t> numRendered{numDone};
+  std::atomic<bool> failed{!success};
+  std::mutex outputMutex;
+
+  auto work = [&](size_t worker) {
+    auto &scene = scenes[worker];
+    auto &renderer = *scene.renderer;
+    const size_t numSlots = renderer.numSlots();
+    float photonEnergy = settings.photonEnergy;
+    size_t shard = 0;
+    while (!failed && scheduler.next(worker, shard)) {
+      // the shard's poses not written by an earlier run
+      const uint64_t begin = shard * shardSize;
+      const uint64_t end = std::min(begin + shardSize, count);
+      std::vector<uint64_t> todo;
+      for (uint64_t i = begin; i < end; ++i) {
+        if (!checkpoint.done(i))
+          todo.push_back(i);
+      }
+      if (todo.empty())
+        continue;
+
+      uint32_t lut = UINT32_MAX;
+      float energy = 0.f;
+      sampler.shardBeam(shard, lut, energy);
+#ifdef HAVE_ITK
+      if (g_deviceLut && lut != UINT32_MAX && lut != scene.lacLut) {
+        setLacTransferFunction(
+            scene.device, scene.volume->volume(), state.lacReader, lut);
+        scene.lacLut = lut;
+      }
+#endif
+      if (energy > 0.f && energy != photonEnergy) {
+        renderer.setPhotonEnergy(energy);
+        photonEnergy = energy;
+      }
+      // the shard's beam scatters as its energy does
+      DetectorSettings detector = g_batchDetector;
+      if (!g_scatterTable.empty())
+        detector.scatter = tableScatter(
+            state.lacReader, energy, lut != UINT32_MAX ? lut : SIZE_MAX);
+
+      // the shard's poses through all slots; the last ones drain before
+      // the next shard switches LUT or energy
+      const size_t numTodo = todo.size();
+      size_t next = 0;
+      for (size_t k = 0; k < numTodo; ++k) {
+        for (; next < numTodo && next < k + numSlots; ++next)
+          renderer.submit(next % numSlots, sampler.sample(todo[next]).pose);
+        const auto *r = renderer.readback(k % numSlots);
+        if (!r) {
+          for (size_t j = k + 1; j < next; ++j)
+            renderer.readback(j % numSlots);
+          failed = true;
+          return;
+        }
+        const uint64_t i = todo[k];
+        writer.write(i, sampler.sample(i), r->color.data(), detector);
+
+        const uint64_t n = ++numRendered;
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << "\rrendered " << n << "/" << count << std::flush;
+      }
+    }
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t w = 0; w < scenes.size(); ++w)
+    threads.emplace_back(work, w);
+  for (auto &t : threads)
+    t.join();
+  success = writer.wait() && !failed;
+  const auto end = std::chrono::steady_clock::now();
+  std::cout << "\n";
+  // what got written also when the job failed, for the next --resume
+  success = checkpoint.save() && success;
+
+  if (success) {
+    const uint64_t numSampled = count - numDone;
+    const float seconds = std::chrono::duration<float>(end - start).count();
+    std::cout << "Sampled " << numSampled << " poses into "
+              << g_samples.numShards() << " shard(s) on " << scenes.size()
+              << " device(s) in " << seconds << "s ("
+              << (seconds > 0.f ? numSampled / seconds : 0.f)
+              << " poses/s)\n";
+  }
+
+  releaseDeviceScenes(scenes);
+  return success ? 0 : 1;
+}
+
+// The template library of the first volume, next to it unless given
+static std::string templateFile()
+{
+  if (!g_templateFile.empty() || g_filenames.empty())
+    return g_templateFile;
+  return g_filenames[0] + ".templates";
+}
+
+// What templates depend on besides the poses, compared when loading
+static std::string templateContext(float fovy)
+{
+  return g_rendererName + "|" + (g_filenames.empty() ? "" : g_filenames[0])
+      + "|" + std::to_string(fovy);
+}
+
+// Renders g_samples.count poses sampled around the --json poses at
+// embedding resolution and writes them with their ANN index as the
+// volume's template library
+static int runBuildTemplates()
+{
+  if (g_jsonfile.empty() || g_samples.count == 0) {
+    fprintf(stderr,
+        "ERROR: --build-templates needs base poses (--json) and --samples\n");
+    return 1;
+  }
+  prediction_container predictions;
+  if (!predictions.load(g_jsonfile) || predictions.predictions.empty())
+    return 1;
+
+  AppState state;
+  if (!loadHostVolume(state))
+    return 1;
+
+  // embeddings in the sensor's aspect like comparison grid cells, rendered
+  // at four times their size and box filtered down
+  const float aspect = predictions.fovy > 0.f
+      ? std::tan(0.5f * predictions.fovx) / std::tan(0.5f * predictions.fovy)
+      : 1.f;
+  const int size = TemplateLibrary::embeddingSize;
+  TemplateLibrary library(aspect >= 1.f ? size : int(size * aspect),
+      aspect >= 1.f ? int(size / aspect) : size);
+
+  BatchRenderSettings settings;
+  settings.width = library.width() * 4;
+  settings.height = library.height() * 4;
+  settings.fovy = predictions.fovy;
+  settings.renderer = g_rendererName;
+  settings.writeOrigin = false;
+
+  std::vector<DeviceScene> scenes;
+  if (!createDeviceScenes(state, settings, scenes)) {
+    releaseDeviceScenes(scenes);
+    return 1;
+  }
+
+  // LUTs and energies of the sampler are left out: templates are looked up
+  // in the beam the viewer renders with
+  const PoseSampler sampler(predictions.predictions, g_samples);
+  const uint64_t count = g_samples.count;
+  std::vector<std::vector<float>> embeddings(count);
+  PoseScheduler scheduler(count, scenes.size());
+  std::atomic<uint64_t> numRendered{0};
+  std::atomic<bool> failed{false};
+  std::mutex outputMutex;
+
+  const auto start = std::chrono::steady_clock::now();
+  auto work = [&](size_t worker) {
+    auto &renderer = *scenes[worker].renderer;
+    const size_t numSlots = renderer.numSlots();
+    std::vector<size_t> batch;
+    size_t index = 0;
+    while (!failed) {
+      batch.clear();
+      while (batch.size() < numSlots && scheduler.next(worker, index))
+        batch.push_back(index);
+      if (batch.empty())
+        return;
+      for (size_t k = 0; k < batch.size(); ++k)
+        renderer.submit(k, sampler.sample(batch[k]).pose);
+      for (size_t k = 0; k < batch.size(); ++k) {
+        const auto *r = renderer.readback(k);
+        if (!r) {
+          failed = true;
+          continue;
+        }
+        embeddings[batch[k]] =
+            library.embed(r->color.data(), size_t(r->width), size_t(r->height));
+      }
+
+      const uint64_t n = numRendered += batch.size();
+      std::lock_guard<std::mutex> lock(outputMutex);
+      std::cout << "\rrendered " << n << "/" << count << std::flush;
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t w = 0; w < scenes.size(); ++w)
+    threads.emplace_back(work, w);
+  for (auto &t : threads)
+    t.join();
+  std::cout << "\n";
+  releaseDeviceScenes(scenes);
+  if (failed)
+    return 1;
+
+  for (uint64_t i = 0; i < count; ++i)
+    library.add(sampler.sample(i).pose, embeddings[i]);
+  embeddings.clear();
+  library.buildIndex();
+  const auto end = std::chrono::steady_clock::now();
+
+  const std::string file = templateFile();
+  if (!library.save(file, templateContext(settings.fovy)))
+    return 1;
+  std::cout << "Template library " << file << ": " << library.size()
+            << " poses at " << library.width() << " x " << library.height()
+            << ", " << library.numLists() << " lists, built in "
+            << std::chrono::duration<float>(end - start).count() << "s\n";
+  return 0;
+}
+
+// --project, --backproject: A and A^T of the linear projector pair
+// (forwardProject(), backProject()) over the --json poses at --batch-size
+// in the volume's grid, for iterative reconstruction run from outside
+// (SART, OS-EM). Projections are raw float32, view after view, row 0 at the
+// bottom; back-projected volumes raw float32 with a sidecar header, so the
+// viewer opens them.
+static int runProjector()
+{
+  if (!g_projectFile.empty() && !g_backprojectFiles[0].empty()) {
+    fprintf(stderr, "ERROR: give --project or --backproject, not both\n");
+    return 1;
+  }
+  if (g_jsonfile.empty()) {
+    fprintf(stderr,
+        "ERROR: --project and --backproject need the views' poses "
+        "(--json)\n");
+    return 1;
+  }
+  prediction_container predictions;
+  if (!predictions.load(g_jsonfile) || predictions.predictions.empty())
+    return 1;
+
+  AppState state;
+  if (!loadHostVolume(state))
+    return 1;
+  const StructuredField &field = state.volumes.active().sdata;
+  const ProjectionGrid grid = ProjectionGrid::of(field);
+
+  std::vector<RayCamera> cameras;
+  for (const auto &pose : predictions.predictions) {
+    const auto dir = anari::math::normalize(pose.center - pose.eye);
+    RayCamera camera{{pose.eye.x, pose.eye.y, pose.eye.z},
+        {dir.x, dir.y, dir.z},
+        {pose.up.x, pose.up.y, pose.up.z}};
+    camera.fovy = predictions.fovy;
+    camera.aspect = g_batchWidth / float(g_batchHeight);
+    camera.width = size_t(g_batchWidth);
+    camera.height = size_t(g_batchHeight);
+    cameras.push_back(camera);
+  }
+  const size_t numPixels =
+      size_t(g_batchWidth) * size_t(g_batchHeight) * cameras.size();
+  std::vector<float> projections(numPixels);
+  const auto start = std::chrono::steady_clock::now();
+
+  if (!g_projectFile.empty()) {
+    std::vector<float> volume(grid.numCells());
+    dispatchVoxelType(field, [&](auto voxel) {
+      using Voxel = decltype(voxel);
+      const auto *data = voxelData<Voxel>(field);
+      parallelFor(0, volume.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+          volume[i] = Voxel::value(data[i]);
+      });
+    });
+    forwardProject(grid,
+        volume.data(),
+        cameras.data(),
+        cameras.size(),
+        projections.data());
+    std::ofstream out(g_projectFile, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(projections.data()),
+        std::streamsize(numPixels * sizeof(float)));
+    if (!out) {
+      fprintf(stderr, "ERROR: could not write %s\n", g_projectFile.c_str());
+      return 1;
+    }
+    std::cout << "Projected " << cameras.size() << " views of "
+              << g_batchWidth << " x " << g_batchHeight << " to "
+              << g_projectFile;
+  } else {
+    std::ifstream in(g_backprojectFiles[0], std::ios::binary);
+    in.read(reinterpret_cast<char *>(projections.data()),
+        std::streamsize(numPixels * sizeof(float)));
+    if (!in || in.peek() != std::ifstream::traits_type::eof()) {
+      fprintf(stderr,
+          "ERROR: %s is not %zu views of %d x %d float32\n",
+          g_backprojectFiles[0].c_str(),
+          cameras.size(),
+          g_batchWidth,
+          g_batchHeight);
+      return 1;
+    }
+    StructuredField result;
+    result.dimX = grid.dims[0];
+    result.dimY = grid.dims[1];
+    result.dimZ = grid.dims[2];
+    result.bytesPerCell = 4;
+    std::copy_n(grid.origin, 3, result.origin);
+    std::copy_n(grid.spacing, 3, result.spacing);
+    auto *voxels = static_cast<float *>(result.allocate(grid.numCells()));
+    backProject(grid,
+        cameras.data(),
+        cameras.size(),
+        projections.data(),
+        voxels);
+
+    const std::string &file = g_backprojectFiles[1];
+    std::ofstream out(file, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(voxels),
+        std::streamsize(result.voxelBytes()));
+    out.close();
+    if (!out) {
+      fprintf(stderr, "ERROR: could not write %s\n", file.c_str());
+      return 1;
+    }
+    writeRawHeader(file, computeRawHeader(result));
+    std::cout << "Back-projected " << cameras.size() << " views to " << file
+              << " (" << grid.dims[0] << " x " << grid.dims[1] << " x "
+              << grid.dims[2] << " float32)";
+  }
+  std::cout << " in "
+            << std::chrono::duration<float>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << "s\n";
+  return 0;
+}
+
+template <typename T>
+static std::vector<T> parseList(const std::string &list)
+{
+  std::vector<T> result;
+  for (auto &token : string_split(list, ','))
+    result.push_back(T(std::atof(token.c_str())));
+  return result;
+}
+
+// Renders a fixed camera path (orbit, zoom, --json poses) through the same
+// scene as the viewer at every --bench-sizes size and --sweep-energies
+// energy, and writes per-frame timings to g_benchFile
+static int runBench()
+{
+  prediction_container predictions;
+  if (!g_jsonfile.empty() && !predictions.load(g_jsonfile))
+    return 1;
+
+  AppState state;
+  if (!loadHostVolume(state))
+    return 1;
+
+  BatchRenderSettings settings;
+  settings.fovy = g_jsonfile.empty() ? 0.7854f : predictions.fovy;
+  settings.renderer = g_rendererName;
+  settings.writeOrigin = false;
+  settings.framesInFlight = 1;
+
+  RenderBenchmarkSettings bench;
+  bench.output = g_benchFile;
+  // frames take milliseconds: sampled often enough to tell them apart
+  GpuCounters gpuCounters(0, std::chrono::milliseconds(50));
+  if (gpuCounters.available())
+    bench.gpu = &gpuCounters;
+  if (!g_benchSizes.empty()) {
+    bench.sizes.clear();
+    for (int size : parseList<int>(g_benchSizes))
+      bench.sizes.emplace_back(size, size);
+  }
+  if (!g_sweepEnergies.empty())
+    bench.photonEnergies = parseList<float>(g_sweepEnergies);
+
+  // a recorded interaction instead of the fixed orbit and zoom
+  std::vector<RenderBenchmarkPose> path;
+  if (!g_replayCameraFile.empty()) {
+    std::vector<CameraPathFrame> frames;
+    if (!readCameraPath(g_replayCameraFile, frames))
+      return 1;
+    for (auto &f : frames) {
+      path.push_back({"replay",
+          prediction("",
+              f.eye[0],
+              f.eye[1],
+              f.eye[2],
+              f.center[0],
+              f.center[1],
+              f.center[2],
+              f.up[0],
+              f.up[1],
+              f.up[2]),
+          f.fovy});
+    }
+  }
+
+  g_numDevices = 1;
+  std::vector<DeviceScene> scenes;
+  bool success = createDeviceScenes(state, settings, scenes);
+  if (success) {
+    auto &scene = scenes.front();
+    scene.renderer.reset(); // the benchmark sets up one per size
+    if (path.empty()) {
+      path = makeBenchmarkPath(scene.device,
+          scene.volume->world(),
+          settings.fovy,
+          bench,
+          predictions.predictions);
+    }
+
+    std::vector<RenderBenchmarkSample> samples;
+    success = runRenderBenchmark(
+                  scene.device, scene.volume->world(), settings, bench, path, samples)
+        && writeRenderBenchmark(bench.output, samples);
+  }
+
+  releaseDeviceScenes(scenes);
+  return success ? 0 : 1;
+}
+
+// Renders the canonical regression path through the input volume, or a
+// synthetic phantom without one, and checks duration and images against
+// the --gate baseline; records the baseline if there is none yet (or with
+// --gate-update). Non-zero if the run drifted beyond the thresholds.
+static int runGate()
+{
+  RegressionBaseline baseline;
+  const bool compare =
+      !g_gateUpdate && std::filesystem::exists(g_gate.baseline);
+  if (compare && !readRegressionBaseline(g_gate.baseline, baseline))
+    return 1;
+
+  AppState state;
+  if (g_filenames.empty()) {
+    PhantomSpec phantom;
+    phantom.kind = PhantomKind::Body;
+    std::fill_n(phantom.dims, 3, 256);
+    auto &volume = state.volumes.add("phantom:body:256x256x256");
+    volume.sdata = makePhantomField(phantom); // not subject to LUT changes
+    volume.isNifti = true;
+    g_deviceLut = false;
+  } else if (!loadHostVolume(state)) {
+    return 1;
+  }
+
+  BatchRenderSettings settings;
+  settings.width = compare ? baseline.width : g_batchWidth;
+  settings.height = compare ? baseline.height : g_batchHeight;
+  settings.renderer = g_rendererName;
+  settings.writeOrigin = false;
+  settings.framesInFlight = 1;
+
+  g_numDevices = 1;
+  std::vector<DeviceScene> scenes;
+  RegressionBaseline current;
+  current.width = settings.width;
+  current.height = settings.height;
+  current.library = g_libraryName;
+  bool success = createDeviceScenes(state, settings, scenes);
+  if (success) {
+    auto &scene = scenes.front();
+    const auto path = makeRegressionPath(
+        scene.device, scene.volume->world(), settings.fovy);
+    success =
+        renderRegressionFrames(*scene.renderer, path, g_gate, current.frames);
+  }
+  releaseDeviceScenes(scenes);
+  if (!success)
+    return 1;
+
+  if (!compare) {
+    if (!writeRegressionBaseline(g_gate.baseline, current))
+      return 1;
+    printf("Baseline of %zu poses written to %s\n",
+        current.frames.size(),
+        g_gate.baseline.c_str());
+    return 0;
+  }
+  return compareRegression(g_gate, baseline, current) ? 0 : 1;
+}
+
+// Loads, converts, uploads and renders Shepp-Logan phantoms of every
+// --scale-sizes size and --scale-types cell type at every --bench-sizes
+// resolution on one device, and writes the timings and memory to
+// g_scaleStudyFile. Sizes run in increasing order, so the first one that
+// fails (and the peak RSS before it) shows where the viewer stops scaling.
+static int runScaleStudy()
+{
+  using clock = std::chrono::steady_clock;
+  auto ms = [](clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(clock::now() - start)
+        .count();
+  };
+
+  auto sizes = parseList<int>(g_scaleSizes);
+  std::sort(sizes.begin(), sizes.end());
+  std::vector<std::pair<int, int>> resolutions{{512, 512}, {1024, 1024}};
+  if (!g_benchSizes.empty()) {
+    resolutions.clear();
+    for (int size : parseList<int>(g_benchSizes))
+      resolutions.emplace_back(size, size);
+  }
+  const auto types = string_split(g_scaleTypes, ',');
+
+  AppState state;
+#ifdef HAVE_ITK
+  readLacLuts(state.lacReader);
+#endif
+  auto device = newDevice();
+  if (!device)
+    return 1;
+
+  BatchRenderSettings settings;
+  settings.renderer = g_rendererName;
+  settings.writeOrigin = false;
+  settings.framesInFlight = 1;
+
+  std::vector<ScalingSample> samples;
+  bool outOfMemory = false;
+  for (int size : sizes) {
+    for (const auto &type : types) {
+      ScalingSample base;
+      base.volumeSize = size;
+      base.cellType = type;
+      if (outOfMemory || (type != "float32" && type != "float16")) {
+        if (!outOfMemory)
+          fprintf(stderr, "WARNING: unknown cell type %s\n", type.c_str());
+        continue;
+      }
+      std::cout << "Phantom " << size << "^3, " << type << "...\n";
+
+      PhantomSpec phantom;
+      std::fill_n(phantom.dims, 3, size);
+      StructuredField field;
+      try {
+        auto start = clock::now();
+#ifdef HAVE_ITK
+        NiftiReader reader;
+        reader.halfPrecision = type == "float16";
+        const float spacing[3] = {
+            phantom.spacing(), phantom.spacing(), phantom.spacing()};
+        const float origin[3] = {0.f, 0.f, 0.f};
+        reader.setVolume(
+            itk::IOComponentEnum::SHORT, phantom.dims, spacing, origin);
+        fillPhantom(phantom, reinterpret_cast<int16_t *>(reader.voxels.data()));
+        base.load = ms(start);
+        start = clock::now();
+        field = reader.getField(0, state.lacReader);
+        base.convert = ms(start);
+#else
+        if (type == "float16") {
+          fprintf(stderr, "WARNING: float16 fields need the LAC conversion\n");
+          continue;
+        }
+        field = makePhantomField(phantom);
+        base.load = ms(start);
+#endif
+      } catch (const std::bad_alloc &) {
+        fprintf(stderr, "ERROR: out of memory at %d^3\n", size);
+        outOfMemory = true;
+      }
+      if (field.empty()) {
+        for (auto &r : resolutions) {
+          samples.push_back(base);
+          samples.back().width = r.first;
+          samples.back().height = r.second;
+          samples.back().peakRss = peakResidentSetSize();
+        }
+        continue;
+      }
+      base.fieldBytes = field.voxelBytes();
+
+      VolumeScene scene(device, g_brickSize, g_verbose);
+      scene.setSparse(g_sparse);
+      auto start = clock::now();
+      scene.setField(field, true);
+      // querying the bounds waits for the world's commit
+      float bounds[6];
+      anariGetProperty(device,
+          scene.world(),
+          "bounds",
+          ANARI_FLOAT32_BOX3,
+          bounds,
+          sizeof(bounds),
+          ANARI_WAIT);
+      base.commit = ms(start);
+
+      const auto path =
+          makeRegressionPath(device, scene.world(), settings.fovy);
+      for (auto &r : resolutions) {
+        auto sample = base;
+        sample.width = settings.width = r.first;
+        sample.height = settings.height = r.second;
+        BatchRenderer renderer(device, scene.world(), settings);
+
+        start = clock::now();
+        renderer.submit(0, path[0].pose);
+        sample.ok = renderer.readback(0) != nullptr;
+        sample.firstFrame = ms(start);
+        std::vector<float> frames;
+        for (size_t i = 1; sample.ok && i < path.size(); ++i) {
+          start = clock::now();
+          renderer.submit(0, path[i].pose);
+          sample.ok = renderer.readback(0) != nullptr;
+          frames.push_back(ms(start));
+        }
+        if (!frames.empty()) {
+          std::nth_element(
+              frames.begin(), frames.begin() + frames.size() / 2, frames.end());
+          sample.steadyFrame = frames[frames.size() / 2];
+        }
+        sample.peakRss = peakResidentSetSize();
+        samples.push_back(sample);
+      }
+    }
+  }
+
+  anari::release(device, device);
+  return writeScalingStudy(g_scaleStudyFile, samples) ? 0 : 1;
+}
+
+// Distributed sweeps ////////////////////////////////////////////////////////
+
+// Hands out poses x --sweep-luts x --sweep-energies to --worker processes
+// and gathers the images in g_batchDir; needs no volume or device itself
+static int runCoordinator()
+{
+  if (g_jsonfile.empty() || g_batchDir.empty()) {
+    fprintf(stderr, "ERROR: --coordinator needs --json and --batch\n");
+    return 1;
+  }
+
+  prediction_container predictions;
+  if (!predictions.load(g_jsonfile))
+    return 1;
+
+  auto luts = parseList<uint32_t>(g_sweepLuts);
+  auto energies = parseList<float>(g_sweepEnergies);
+  if (luts.empty())
+    luts.push_back(uint32_t(g_laclutid));
+
+  SweepSettings settings;
+  settings.width = g_batchWidth;
+  settings.height = g_batchHeight;
+  settings.fovy = predictions.fovy;
+  settings.numLuts = luts.size();
+  settings.lut = luts.front();
+
+  auto jobs = makeSweepJobs(predictions.predictions, luts, energies);
+  return runSweepCoordinator(g_coordinatorPort,
+             g_batchDir,
+             settings,
+             jobs,
+             predictions.predictions)
+      ? 0
+      : 1;
+}
+
+// Loads the volume once for this node and serves jobs from the coordinator
+// with one connection per local device
+static int runWorker()
+{
+  auto pos = g_workerAddress.rfind(':');
+  if (pos == std::string::npos) {
+    fprintf(stderr, "ERROR: --worker expects <host:port>\n");
+    return 1;
+  }
+  const auto host = g_workerAddress.substr(0, pos);
+  const int port = std::atoi(g_workerAddress.c_str() + pos + 1);
+
+  const int numConnections = std::max(g_numDevices, 1);
+  std::vector<std::unique_ptr<SweepWorkerConnection>> connections;
+  for (int i = 0; i < numConnections; ++i) {
+    connections.push_back(std::make_unique<SweepWorkerConnection>());
+    if (!connections.back()->connect(host, port))
+      return 1;
+  }
+  const auto &sweep = connections.front()->settings();
+
+#ifdef HAVE_ITK
+  // the host converts with this node's --laclut; other LUTs, and switching
+  // them per job (only cheap and thread-safe there), need the device
+  if ((sweep.numLuts > 1 || sweep.lut != g_laclutid) && !g_deviceLut) {
+    std::cout << "LUT sweep: enabling --device-lut\n";
+    g_deviceLut = true;
+  }
+#endif
+
+  AppState state;
+  if (!loadHostVolume(state))
+    return 1;
+
+  BatchRenderSettings settings;
+  settings.width = sweep.width;
+  settings.height = sweep.height;
+  settings.fovy = sweep.fovy;
+  settings.renderer = g_rendererName;
+  settings.writeOrigin = false;
+
+  std::vector<DeviceScene> scenes;
+  if (!createDeviceScenes(state, settings, scenes)) {
+    releaseDeviceScenes(scenes);
+    return 1;
+  }
+
+  std::atomic<bool> failed{false};
+  auto work = [&](size_t i) {
+    auto &scene = scenes[i];
+    auto &connection = *connections[i];
+    std::vector<SweepJob> jobs;
+    std::vector<uint8_t> color;
+    std::vector<float> origin;
+    for (;;) {
+      bool done = false;
+      if (!connection.requestJobs(jobs, done)) {
+        failed = true;
+        return;
+      }
+      if (done)
+        return;
+      if (jobs.empty()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        continue;
+      }
+
+      for (const auto &job : jobs) {
+#ifdef HAVE_ITK
+        if (g_deviceLut && job.lut != scene.lacLut) {
+          setLacTransferFunction(
+              scene.device, scene.volume->volume(), state.lacReader, job.lut);
+          scene.lacLut = job.lut;
+        }
+#endif
+        if (job.photonEnergy > 0.f)
+          scene.renderer->setPhotonEnergy(job.photonEnergy);
+
+        if (!scene.renderer->renderPose(job.toPrediction(), color, origin)
+            || !connection.sendResult(
+                job.index, encodePng(color, sweep.width, sweep.height))) {
+          failed = true;
+          return;
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < scenes.size(); ++i)
+    threads.emplace_back(work, i);
+  for (auto &t : threads)
+    t.join();
+
+  releaseDeviceScenes(scenes);
+  return failed ? 1 : 0;
+}
+
+// Keeps volume, device and renderer resident and renders pose batches of
+// remote clients until one of them sends Shutdown
+static int runServer()
+{
+#ifdef HAVE_ITK
+  // clients switch LUTs per pose, which is only cheap on the device
+  g_deviceLut = true;
+#endif
+  AppState state;
+  if (!loadHostVolume(state))
+    return 1;
+
+  BatchRenderSettings settings;
+  settings.width = g_batchWidth;
+  settings.height = g_batchHeight;
+  if (!g_jsonfile.empty() && state.predictions.load(g_jsonfile))
+    settings.fovy = state.predictions.fovy;
+  settings.renderer = g_rendererName;
+  settings.writeOrigin = true;
+
+  if (g_numDevices > 1)
+    fprintf(stderr, "WARNING: the render server runs on one device\n");
+  g_numDevices = 1;
+  std::vector<DeviceScene> scenes;
+  if (!createDeviceScenes(state, settings, scenes)) {
+    releaseDeviceScenes(scenes);
+    return 1;
+  }
+  auto &scene = scenes[0];
+  float photonEnergy = settings.photonEnergy;
+
+  ServerMetrics metrics;
+  RenderServerOptions options;
+  options.maxQueuedPoses = g_serveQueue;
+  options.metrics = &metrics;
+  options.metricsPort = g_metricsPort;
+  // frames of another size are only created if the device has room for
+  // them, with a quarter of it to spare: frame buffers plus the pinned
+  // readback copies, color and origins, per slot
+  std::atomic<uint64_t> frameSize{
+      uint64_t(settings.width) << 32 | uint32_t(settings.height)};
+  options.admit = [&](const RenderBatchHeader &header) {
+    if ((uint64_t(header.width) << 32 | header.height) == frameSize)
+      return true;
+    const size_t pixels = size_t(header.width) * header.height;
+    const size_t bytesPerPixel =
+        header.flags & g_renderWithOrigin ? 4 + 3 * sizeof(float) : 4;
+    const size_t bytes = std::max(settings.framesInFlight, 1) * pixels
+        * bytesPerPixel * 2;
+    return bytes + bytes / 4 <= availableDeviceMemory();
+  };
+
+  // called from the server's one render thread, with the poses of one or
+  // more client batches
+  auto render = [&](const RenderBatchHeader &header,
+                    const std::vector<RenderPose> &poses,
+                    const RenderEmitFunc &emit) {
+    TRACE_SCOPE("server", "batch");
+    const bool linear = header.flags & g_renderLinear;
+    if (int(header.width) != settings.width
+        || int(header.height) != settings.height
+        || linear != settings.linear) {
+      settings.width = int(header.width);
+      settings.height = int(header.height);
+      settings.linear = linear;
+      settings.march = scene.renderer->settings().march;
+      scene.renderer.reset();
+      scene.renderer = std::make_unique<BatchRenderer>(
+          scene.device, scene.volume->world(), settings, scene.hostField);
+      // the new renderer starts out at the default energy
+      photonEnergy = settings.photonEnergy;
+      frameSize = uint64_t(header.width) << 32 | header.height;
+    }
+    auto &renderer = *scene.renderer;
+    const bool withOrigin = header.flags & g_renderWithOrigin;
+    const size_t numSlots = renderer.numSlots();
+
+    // a pose switching LUT or energy waits for the frames before it
+    auto switches = [&](const RenderPose &p) {
+      return (p.lut >= 0 && size_t(p.lut) != scene.lacLut)
+          || (p.photonEnergy > 0.f && p.photonEnergy != photonEnergy);
+    };
+    auto submit = [&](size_t k) {
+      const auto &p = poses[k];
+#ifdef HAVE_ITK
+      if (p.lut >= 0 && size_t(p.lut) != scene.lacLut
+          && size_t(p.lut) < state.lacReader.m_lacLuts.size()) {
+        setLacTransferFunction(
+            scene.device, scene.volume->volume(), state.lacReader, p.lut);
+        scene.lacLut = size_t(p.lut);
+      }
+#endif
+      if (p.photonEnergy > 0.f && p.photonEnergy != photonEnergy) {
+        renderer.setPhotonEnergy(p.photonEnergy);
+        photonEnergy = p.photonEnergy;
+      }
+      renderer.submit(k % numSlots, p.toPrediction(), p.fovy);
+    };
+
+    size_t next = 0;
+    for (size_t i = 0; i < poses.size(); ++i) {
+      while (next < poses.size() && next < i + numSlots
+          && (next == i || !switches(poses[next])))
+        submit(next++);
+
+      RenderResultHeader result;
+      result.id = poses[i].id;
+      result.width = header.width;
+      result.height = header.height;
+      result.flags = header.flags & g_renderLinear;
+      // sent straight from the renderer's pinned readback buffers
+      FrameTiming timing;
+      const auto *r = renderer.readback(i % numSlots, &timing);
+      result.status = r ? 0 : 1;
+      if (r) {
+        metrics.observe(ServerMetrics::Render, 1e-3 * timing.duration);
+        metrics.observe(ServerMetrics::Readback, 1e-3 * timing.map);
+      }
+      if (!emit(result,
+              r ? r->color.data() : nullptr,
+              r && withOrigin ? r->origin.data() : nullptr)) {
+        // client gone: let the frames in flight finish
+        for (size_t k = i + 1; k < next; ++k)
+          renderer.readback(k % numSlots);
+        return false;
+      }
+    }
+    return true;
+  };
+
+  const bool success = runRenderServer(g_servePort, render, options);
+  releaseDeviceScenes(scenes);
+  return success ? 0 : 1;
+}
+
+} // namespace viewer
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void printUsage()
+{
+  std::cout << "./anariVolumeViewer [{--help|-h}]\n"
+            << "   [{--verbose|-v}] [{--debug|-g}]\n"
+            << "   [{--library|-l} <ANARI library>]\n"
+            << "   [{--trace|-t} <directory>]\n"
+            << "   [{--json|-j} <directory>]\n"
+            << "   [--append-predictions <pred file>]\n"
+            << "   [--prediction-feed <jsonl file>]\n"
+            << "   [{--lacfile|--lac} <directory>]\n"
+            << "   [{--lut} <index>]\n"
+            << "   [--device-lut]\n"
+            << "   [--spectrum <json file>]\n"
+            << "   [--lut-cache <MB>]\n"
+            << "   [--lut-cache-bits {8|4}]\n"
+            << "   [--lac-half]\n"
+            << "   [--raw-ct <type>[:<slope>:<intercept>]]\n"
+            << "   [--bricks <size>]\n"
+            << "   [--sparse]\n"
+            << "   [--lod <levels>]\n"
+            << "   [--out-of-core <MB>]\n"
+            << "   [--fit-memory <MB>]\n"
+            << "   [--crop <threshold>]\n"
+            << "   [--read-region <x0>,<y0>,<z0>,<x1>,<y1>,<z1>]\n"
+            << "   [--zarr-connections <n>]\n"
+            << "   [--lac-cache <directory>]\n"
+            << "   [--shared-volumes]\n"
+            << "   [--huge-pages {transparent|explicit}]\n"
+            << "   [--numa {first-touch|interleave}]\n"
+            << "   [--image-cache <directory>]\n"
+            << "   [--reference-cache]\n"
+            << "   [--pose-cache]\n"
+            << "   [--reference-pool <MB>]\n"
+            << "   [--preprocess <step,step,...>]\n"
+            << "   [--record-matches <directory>]\n"
+            << "   [--first-hit-threshold <attenuation>]\n"
+            << "   [--projector {sampled|siddon}]\n"
+            << "   [--tune-drr <cache file>]\n"
+            << "   [--voxel-order {linear|bricked|morton}]\n"
+            << "   [--deformation <json file>]\n"
+            << "   [--match-edges {sobel|log[:<level>]}]\n"
+            << "   [--bench <csv or json file>]\n"
+            << "   [--bench-sizes <size,size,...>]\n"
+            << "   [--scale-study <csv or json file>]\n"
+            << "   [--scale-sizes <size,size,...>] [--scale-types <type,...>]\n"
+            << "   [--gate <baseline file>] [--gate-update]\n"
+            << "   [--gate-tolerance <fraction>] [--gate-psnr <dB>]\n"
+            << "   [--gate-repeats <n>]\n"
+            << "   [--profile <trace json file>]\n"
+            << "   [--anari-calls <sample every n>]\n"
+            << "   [--record-camera <json file>]\n"
+            << "   [--replay-camera <json file>]\n"
+            << "   [--texture-cache <MB>]\n"
+            << "   [--render-size <width height>]\n"
+            << "   [--render-scale <factor>]\n"
+            << "   [--linear-output]\n"
+            << "   [--auto-window <low> <high percentile>]\n"
+            << "   [--render-thread]\n"
+            << "   [--reproject]\n"
+            << "   [--frame-cache <host MB> <texture MB>]\n"
+            << "   [--origin-format {float3|depth32|depth16}]\n"
+            << "   [{--matcher|-m} <directory>]\n"
+            << "   [--matcher-process <library>]\n"
+            << "   [--lazy-matchers]\n"
+            << "   [--matcher-threads <n>]\n"
+            << "   [--matcher-cpus <list>]\n"
+            << "   [--fast-start]\n"
+            << "   [--preview <stride>]\n"
+            << "   [--comparison-grid]\n"
+            << "   [--drr-cache <MB>]\n"
+            << "   [--frame-ring <name>]\n"
+            << "   [{--dims|-d} <dimx dimy dimz>]\n"
+            << "   [{--type|-t} [{uint8|uint16|float32}]\n"
+            << "   [--mmap]\n"
+            << "   [--evaluate <csv file>]\n"
+            << "   [--register <max iterations> <tolerance>]\n"
+            << "   [--register-gradient]\n"
+            << "   [--register-samples <fraction>[,random|stratified]]\n"
+            << "   [--register-roi <x0>,<y0>,<x1>,<y1>]\n"
+            << "   [--multi-start <key:value,...>]\n"
+            << "   [--views <rig json>]\n"
+            << "   [--worklist <worklist json>]\n"
+            << "   [--session <session json>]\n"
+            << "   [--track <frame pattern|directory> <csv file>]\n"
+            << "   [--track-follow <seconds>]\n"
+            << "   [--track-levels <count>]\n"
+            << "   [--track-roi <x0>,<y0>,<x1>,<y1>]\n"
+            << "   [--warm-start {none|sequence|proximity}]\n"
+            << "   [--batch <output directory>]\n"
+            << "   [--batch-size <width height>]\n"
+            << "   [--batch-tile <size>]\n"
+            << "   [--slabs]\n"
+            << "   [--labels <label volume>]\n"
+            << "   [--clip <x0,y0,z0,x1,y1,z1>]\n"
+            << "   [--slab <index>/<count>]\n"
+            << "   [--slab-servers <host:port,host:port,...>]\n"
+            << "   [--batch-format {png|tiff16|tiff32|exr}]\n"
+            << "   [--batch-detector <model,model,...>]\n"
+            << "   [--scatter-table <file>]\n"
+            << "   [--batch-shard <poses per shard>]\n"
+            << "   [--samples <key:value,...>]\n"
+            << "   [--resume]\n"
+            << "   [--build-templates]\n"
+            << "   [--templates <file>]\n"
+            << "   [--project <projections file>]\n"
+            << "   [--backproject <projections file> <volume file>]\n"
+            << "   [--renderer <subtype>]\n"
+            << "   [--devices <count>]\n"
+            << "   [--cpu-devices <library> <count>]\n"
+            << "   [--coordinator <port>]\n"
+            << "   [--worker <host:port>]\n"
+            << "   [--serve <port>]\n"
+            << "   [--metrics-port <port>]\n"
+            << "   [--serve-queue <poses>]\n"
+            << "   [--stream <port>]\n"
+            << "   [--stream-kbps <kbit/s>]\n"
+            << "   [--sweep-luts <id,id,...>]\n"
+            << "   [--sweep-energies <keV,keV,...>]\n"
+            << "   [--volume-budget <MB>]\n"
+            << "   [--play <phases/s>]\n"
+            << "   <volume file> [<volume file> ...]\n";
+}
+
+static void parseCommandLine(int argc, char *argv[])
+{
   for (int i = 1; i < argc; i++) {
     std::string arg = argv[i];
     if (arg == "-v" || arg == "--verbose")
@@ -699,26 +5273,534 @@ static void parseCommandLine(int argc, char *argv[])
         printUsage();
         std::exit(0);
       }
+    } else if (arg == "--mmap") {
+      g_useMmap = true;
     } else if (arg == "--json" || arg == "-j") {
       g_jsonfile = argv[++i];
+    } else if (arg == "--append-predictions") {
+      g_appendPredictionsFile = argv[++i];
+    } else if (arg == "--prediction-feed") {
+      g_predictionFeed = argv[++i];
     } else if (arg == "--lacfile" || arg == "--lac") {
       g_laclutfile = argv[++i];
     } else if (arg == "--lut") {
       g_laclutid = std::atoi(argv[++i]);
+    } else if (arg == "--device-lut") {
+      g_deviceLut = true;
+    } else if (arg == "--lut-cache") {
+      g_lutCacheBytes = size_t(std::atoi(argv[++i])) << 20;
+    } else if (arg == "--lut-cache-bits") {
+      g_lutCacheBits = std::atoi(argv[++i]);
+      if (g_lutCacheBits != 8 && g_lutCacheBits != 4) {
+        printf("ERROR: --lut-cache-bits is 8 or 4\n");
+        std::exit(1);
+      }
+    } else if (arg == "--lac-half") {
+      g_lacHalf = true;
+#ifdef HAVE_ITK
+    } else if (arg == "--raw-ct") {
+      const std::string format = argv[++i];
+      if (!RawCtFormat::parse(format, g_rawCt)) {
+        printf("ERROR: bad RAW CT format '%s'\n", format.c_str());
+        std::exit(1);
+      }
+#endif
+    } else if (arg == "--bricks") {
+      g_brickSize = std::atoi(argv[++i]);
+    } else if (arg == "--sparse") {
+      g_sparse = true;
+    } else if (arg == "--lod") {
+      g_lodLevels = size_t(std::max(std::atoi(argv[++i]), 0));
+    } else if (arg == "--volume-budget") {
+      g_volumeBudgetBytes = size_t(std::atoi(argv[++i])) << 20;
+    } else if (arg == "--play") {
+      g_phaseRate = std::atof(argv[++i]);
+    } else if (arg == "--out-of-core") {
+      g_outOfCoreBytes = size_t(std::atoi(argv[++i])) << 20;
+    } else if (arg == "--fit-memory") {
+      g_fitMemory = true;
+      g_fitMemoryBytes = size_t(std::max(std::atoi(argv[++i]), 0)) << 20;
+    } else if (arg == "--crop") {
+      g_crop = true;
+      g_cropThreshold = std::atof(argv[++i]);
+    } else if (arg == "--read-region") {
+      const auto corners = parseList<int>(argv[++i]);
+      if (corners.size() != 6) {
+        printf("ERROR: --read-region needs <x0>,<y0>,<z0>,<x1>,<y1>,<z1>\n");
+        std::exit(1);
+      }
+      for (int a = 0; a < 3; ++a) {
+        g_readRegion.lower[a] = std::max(0, corners[a]);
+        g_readRegion.upper[a] = corners[3 + a];
+      }
+      if (g_readRegion.empty()) {
+        printf("ERROR: --read-region box is empty\n");
+        std::exit(1);
+      }
+    } else if (arg == "--zarr-connections") {
+      g_zarrConnections = size_t(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--lac-cache") {
+      g_lacCacheDir = argv[++i];
+    } else if (arg == "--shared-volumes") {
+      g_sharedVolumes = true;
+    } else if (arg == "--huge-pages") {
+      const std::string name = argv[++i];
+      if (name == "transparent")
+        g_volumeMemory.hugePages = HugePages::Transparent;
+      else if (name == "explicit")
+        g_volumeMemory.hugePages = HugePages::Explicit;
+      else {
+        printf("ERROR: unknown huge pages '%s'\n", name.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--numa") {
+      const std::string name = argv[++i];
+      if (name == "first-touch")
+        g_volumeMemory.numa = NumaPlacement::FirstTouch;
+      else if (name == "interleave")
+        g_volumeMemory.numa = NumaPlacement::Interleave;
+      else {
+        printf("ERROR: unknown NUMA placement '%s'\n", name.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--image-cache") {
+      g_imageCacheDir = argv[++i];
+    } else if (arg == "--reference-cache") {
+      g_referenceCache = true;
+    } else if (arg == "--pose-cache") {
+      g_poseCache = true;
+    } else if (arg == "--reference-pool") {
+      g_referencePoolBytes = size_t(std::atoi(argv[++i])) << 20;
+    } else if (arg == "--preprocess") {
+      const std::string steps = argv[++i];
+      if (!PreprocessPipeline::parse(steps, g_preprocess)) {
+        printf("ERROR: bad preprocessing steps '%s'\n", steps.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--record-matches") {
+      g_recordMatchesDir = argv[++i];
+    } else if (arg == "--bench") {
+      g_benchFile = argv[++i];
+    } else if (arg == "--bench-sizes") {
+      g_benchSizes = argv[++i];
+    } else if (arg == "--scale-study") {
+      g_scaleStudyFile = argv[++i];
+    } else if (arg == "--scale-sizes") {
+      g_scaleSizes = argv[++i];
+    } else if (arg == "--scale-types") {
+      g_scaleTypes = argv[++i];
+    } else if (arg == "--gate") {
+      g_gate.baseline = argv[++i];
+    } else if (arg == "--gate-tolerance") {
+      g_gate.timeTolerance = float(std::atof(argv[++i]));
+    } else if (arg == "--gate-psnr") {
+      g_gate.minPsnr = float(std::atof(argv[++i]));
+    } else if (arg == "--gate-repeats") {
+      g_gate.repeats = size_t(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--gate-update") {
+      g_gateUpdate = true;
+    } else if (arg == "--profile") {
+      g_profileFile = argv[++i];
+    } else if (arg == "--anari-calls") {
+      g_anariCallsEvery = unsigned(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--record-camera") {
+      g_recordCameraFile = argv[++i];
+    } else if (arg == "--replay-camera") {
+      g_replayCameraFile = argv[++i];
+    } else if (arg == "--spectrum") {
+      g_spectrumFile = argv[++i];
+    } else if (arg == "--texture-cache") {
+      g_textureCacheBytes = size_t(std::atoi(argv[++i])) << 20;
+    } else if (arg == "--evaluate") {
+      g_evaluateFile = argv[++i];
+    } else if (arg == "--register") {
+      g_registerIterations = std::max(1, std::atoi(argv[++i]));
+      g_registerTolerance = std::atof(argv[++i]);
+    } else if (arg == "--register-gradient") {
+      g_registerGradient = true;
+    } else if (arg == "--register-samples") {
+      const std::string text = argv[++i];
+      const size_t comma = text.find(',');
+      const std::string mode =
+          comma == std::string::npos ? "stratified" : text.substr(comma + 1);
+      if (mode != "random" && mode != "stratified") {
+        printf("ERROR: unknown pixel sampling '%s'\n", mode.c_str());
+        std::exit(1);
+      }
+      g_registerSamples = std::atof(text.substr(0, comma).c_str());
+      g_registerSampling = mode == "random" ? PixelSampling::Random
+                                            : PixelSampling::Stratified;
+    } else if (arg == "--register-roi") {
+      const auto corners = parseList<float>(argv[++i]);
+      if (corners.size() != 4) {
+        printf("ERROR: --register-roi needs <x0>,<y0>,<x1>,<y1>\n");
+        std::exit(1);
+      }
+      const float a[2] = {corners[0], corners[1]};
+      const float b[2] = {corners[2], corners[3]};
+      g_registerRoi = ImageRoi::fromCorners(a, b);
+    } else if (arg == "--worklist") {
+      g_worklistFile = argv[++i];
+    } else if (arg == "--session") {
+      g_sessionFile = argv[++i];
+    } else if (arg == "--track") {
+      g_trackSource = argv[++i];
+      g_trackFile = argv[++i];
+    } else if (arg == "--track-follow") {
+      g_trackFollow = std::max(0.f, float(std::atof(argv[++i])));
+    } else if (arg == "--track-levels") {
+      g_tracking.numLevels = size_t(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--track-roi") {
+      const auto corners = parseList<float>(argv[++i]);
+      if (corners.size() != 4) {
+        printf("ERROR: --track-roi needs <x0>,<y0>,<x1>,<y1>\n");
+        std::exit(1);
+      }
+      const float a[2] = {corners[0], corners[1]};
+      const float b[2] = {corners[2], corners[3]};
+      g_tracking.roi = ImageRoi::fromCorners(a, b);
+    } else if (arg == "--views") {
+      g_viewRigFile = argv[++i];
+    } else if (arg == "--multi-start") {
+      const std::string text = argv[++i];
+      if (!PoseSamplerSettings::parse(text, g_multiStart)) {
+        printf("ERROR: bad multi-start settings '%s'\n", text.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--warm-start") {
+      if (!parseWarmStartOrder(argv[++i], g_warmStart)) {
+        printf("ERROR: unknown warm start order %s\n", argv[i]);
+        std::exit(1);
+      }
+    } else if (arg == "--batch") {
+      g_batchDir = argv[++i];
+    } else if (arg == "--render-size") {
+      g_renderWidth = std::atoi(argv[++i]);
+      g_renderHeight = std::atoi(argv[++i]);
+    } else if (arg == "--first-hit-threshold") {
+      g_firstHitThreshold = std::atof(argv[++i]);
+    } else if (arg == "--tune-drr") {
+      g_drrTuningFile = argv[++i];
+    } else if (arg == "--voxel-order") {
+      const std::string name = argv[++i];
+      if (!parseVoxelOrder(name, g_voxelOrder)) {
+        printf("ERROR: unknown voxel order '%s'\n", name.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--projector") {
+      const std::string name = argv[++i];
+      if (name == "sampled")
+        g_projector = Projector::Sampled;
+      else if (name == "siddon")
+        g_projector = Projector::Siddon;
+      else {
+        printf("ERROR: unknown projector '%s'\n", name.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--deformation") {
+      g_deformationFile = argv[++i];
+    } else if (arg == "--match-edges") {
+      const std::string name = argv[++i];
+      if (!EdgeSettings::parse(name, g_matchEdges)) {
+        printf("ERROR: unknown edge filter '%s'\n", name.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--render-scale") {
+      g_renderScale = std::atof(argv[++i]);
+    } else if (arg == "--linear-output") {
+      g_linearOutput = true;
+    } else if (arg == "--auto-window") {
+      g_autoWindow[0] = std::atof(argv[++i]);
+      g_autoWindow[1] = std::atof(argv[++i]);
+      if (g_autoWindow[0] < 0.f || g_autoWindow[1] > 100.f
+          || g_autoWindow[0] > g_autoWindow[1]) {
+        printf("ERROR: --auto-window takes percentiles, low <= high\n");
+        std::exit(1);
+      }
+    } else if (arg == "--render-thread") {
+      g_renderThread = true;
+    } else if (arg == "--reproject") {
+      g_reproject = true;
+    } else if (arg == "--frame-cache") {
+      g_frameCacheBytes = size_t(std::atoi(argv[++i])) << 20;
+      g_frameCacheTextureBytes = size_t(std::atoi(argv[++i])) << 20;
+    } else if (arg == "--origin-format") {
+      const std::string name = argv[++i];
+      if (!parseOriginFormat(name, g_originFormat)) {
+        printf("ERROR: unknown origin format '%s'\n", name.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--batch-size") {
+      g_batchWidth = std::atoi(argv[++i]);
+      g_batchHeight = std::atoi(argv[++i]);
+    } else if (arg == "--resume") {
+      g_resume = true;
+    } else if (arg == "--batch-tile") {
+      g_batchTile = std::atoi(argv[++i]);
+    } else if (arg == "--slabs") {
+      g_slabs = true;
+    } else if (arg == "--labels") {
+      g_labelFile = argv[++i];
+    } else if (arg == "--clip") {
+      const char *box = argv[++i];
+      float *b = g_clipBox;
+      char rest = 0;
+      if (std::sscanf(box,
+              "%f,%f,%f,%f,%f,%f%c",
+              b,
+              b + 1,
+              b + 2,
+              b + 3,
+              b + 4,
+              b + 5,
+              &rest)
+              != 6
+          || !(b[0] < b[3] && b[1] < b[4] && b[2] < b[5])) {
+        printf("ERROR: bad clip box '%s' (expected x0,y0,z0,x1,y1,z1 with "
+               "x0 < x1, y0 < y1, z0 < z1)\n",
+            box);
+        std::exit(1);
+      }
+      g_clip = true;
+    } else if (arg == "--slab") {
+      const char *slab = argv[++i];
+      char rest = 0;
+      if (std::sscanf(slab, "%zu/%zu%c", &g_slabIndex, &g_slabCount, &rest)
+              != 2
+          || g_slabIndex >= g_slabCount) {
+        printf("ERROR: bad slab '%s' (expected <index>/<count>)\n", slab);
+        std::exit(1);
+      }
+    } else if (arg == "--slab-servers") {
+      g_slabServers = string_split(argv[++i], ',');
+    } else if (arg == "--batch-format") {
+      const std::string name = argv[++i];
+      if (!parseImageFormat(name, g_batchFormat)) {
+        printf("ERROR: unknown image format '%s'\n", name.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--batch-detector") {
+      const std::string models = argv[++i];
+      if (!DetectorSettings::parse(models, g_batchDetector)) {
+        printf("ERROR: bad detector models '%s'\n", models.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--scatter-table") {
+      if (!ScatterTable::read(argv[++i], g_scatterTable))
+        std::exit(1);
+    } else if (arg == "--batch-shard") {
+      g_batchShard = size_t(std::max(0, std::atoi(argv[++i])));
+    } else if (arg == "--samples") {
+      const std::string text = argv[++i];
+      if (!PoseSamplerSettings::parse(text, g_samples)) {
+        printf("ERROR: bad pose sampler settings '%s'\n", text.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--build-templates") {
+      g_buildTemplates = true;
+    } else if (arg == "--templates") {
+      g_templateFile = argv[++i];
+    } else if (arg == "--project") {
+      g_projectFile = argv[++i];
+    } else if (arg == "--backproject") {
+      g_backprojectFiles[0] = argv[++i];
+      g_backprojectFiles[1] = argv[++i];
+    } else if (arg == "--renderer") {
+      g_rendererName = argv[++i];
+    } else if (arg == "--devices") {
+      g_numDevices = std::atoi(argv[++i]);
+    } else if (arg == "--cpu-devices") {
+      g_cpuLibrary = argv[++i];
+      g_cpuDevices = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--coordinator") {
+      g_coordinatorPort = std::atoi(argv[++i]);
+    } else if (arg == "--worker") {
+      g_workerAddress = argv[++i];
+    } else if (arg == "--serve") {
+      g_servePort = std::atoi(argv[++i]);
+    } else if (arg == "--metrics-port") {
+      g_metricsPort = std::atoi(argv[++i]);
+    } else if (arg == "--serve-queue") {
+      g_serveQueue = size_t(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--stream") {
+      g_streamPort = std::atoi(argv[++i]);
+    } else if (arg == "--stream-kbps") {
+      g_streamKbps =
+          std::max<size_t>(100, std::strtoull(argv[++i], nullptr, 10));
+    } else if (arg == "--sweep-luts") {
+      g_sweepLuts = argv[++i];
+    } else if (arg == "--sweep-energies") {
+      g_sweepEnergies = argv[++i];
     } else if (arg == "-m" || arg == "--matcher") {
-      g_matcherLibraryNames.emplace_back(argv[++i]);
+      g_matcherLibraries.push_back({argv[++i], false});
+    } else if (arg == "--matcher-process") {
+      g_matcherLibraries.push_back({argv[++i], true});
+    } else if (arg == "--lazy-matchers") {
+      g_lazyMatchers = true;
+    } else if (arg == "--matcher-threads") {
+      g_matcherThreads = unsigned(std::max(1, std::atoi(argv[++i])));
+    } else if (arg == "--matcher-cpus") {
+      const std::string list = argv[++i];
+      if (!parseCpuList(list, g_matcherCpus)) {
+        printf("ERROR: --matcher-cpus takes cores like 0-3,8, not %s\n",
+            list.c_str());
+        std::exit(1);
+      }
+    } else if (arg == "--fast-start") {
+      g_fastStart = true;
+    } else if (arg == "--preview") {
+      g_previewStride = std::atoi(argv[++i]);
+      if (g_previewStride < 0 || g_previewStride == 1) {
+        printf("ERROR: --preview takes a stride of 2 or more, or 0\n");
+        std::exit(1);
+      }
+    } else if (arg == "--comparison-grid") {
+      g_comparisonGrid = true;
+    } else if (arg == "--drr-cache") {
+      g_drrCacheBytes = size_t(std::atoi(argv[++i])) << 20;
+    } else if (arg == "--frame-ring") {
+      g_frameRingName = argv[++i];
     } else
-      g_filename = std::move(arg);
+      g_filenames.push_back(std::move(arg));
+  }
+}
+
+// --session of a saved session: the volumes or worklist case, the LUT and
+// the caches it names stand in for the command line's, whose cache
+// directories win. The rest is applied once the volume is up.
+static void restoreSession()
+{
+  if (!g_session.load(g_sessionFile))
+    std::exit(1);
+  if (!g_filenames.empty() || !g_worklistFile.empty()) {
+    printf("ERROR: --session names the volumes, give no volume files or "
+           "--worklist\n");
+    std::exit(1);
+  }
+  for (const auto &volume : g_session.volumes) {
+    if (volume.changed()) {
+      printf("WARNING: %s changed since the session was saved, it is "
+             "converted again\n",
+          volume.file.c_str());
+    }
+  }
+  if (g_session.worklist.empty()) {
+    for (const auto &volume : g_session.volumes)
+      g_filenames.push_back(volume.file);
+    g_jsonfile = g_session.predictions;
+  } else {
+    g_worklistFile = g_session.worklist;
+    g_firstCase = g_session.caseIndex;
   }
+  if (g_laclutfile.empty())
+    g_laclutfile = g_session.lutFile;
+  if (g_lacCacheDir.empty() && !g_sharedVolumes)
+    g_lacCacheDir = g_session.lacCacheDir;
+  if (g_imageCacheDir.empty())
+    g_imageCacheDir = g_session.imageCacheDir;
+  g_referenceCache |= !g_session.descriptorCacheDir.empty();
+  g_lacHalf |= g_session.lacHalf;
+  g_restoreSession = true;
 }
 
 int main(int argc, char *argv[])
 {
   parseCommandLine(argc, argv);
-  if (g_filename.empty()) {
+  setVolumeMemoryPolicy(g_volumeMemory);
+  trace::Session traceSession(g_profileFile); // written when main returns
+  anari_calls::Session anariCalls(g_anariCallsEvery); // printed likewise
+  if (g_coordinatorPort > 0)
+    return viewer::runCoordinator();
+  if (!g_appendPredictionsFile.empty())
+    return viewer::runAppendPredictions();
+  if (!g_gate.baseline.empty())
+    return viewer::runGate();
+  if (!g_scaleStudyFile.empty())
+    return viewer::runScaleStudy();
+  if (!g_slabServers.empty() && !g_batchDir.empty())
+    return viewer::runRemoteSlabs();
+  if (g_metricsPort > 0 && g_servePort <= 0) {
+    printf("ERROR: --metrics-port needs --serve\n");
+    std::exit(1);
+  }
+  if (g_slabCount > 0 && g_servePort <= 0) {
+    printf("ERROR: --slab renders slabs for --slab-servers, with --serve\n");
+    std::exit(1);
+  }
+  if (!g_deformationFile.empty()
+      && !readDeformationGrid(
+          g_deformationFile, g_deformation, g_deformationCoefficients))
+    std::exit(1);
+  if (!g_sessionFile.empty() && std::filesystem::exists(g_sessionFile))
+    restoreSession();
+  if (!g_worklistFile.empty()) {
+    if (!g_worklist.load(g_worklistFile))
+      std::exit(1);
+    if (!g_predictionFeed.empty()) {
+      printf("ERROR: --prediction-feed adds to one case's predictions, "
+             "not a worklist's\n");
+      std::exit(1);
+    }
+    if (!g_filenames.empty()) {
+      printf("ERROR: --worklist names the volumes, give no volume files\n");
+      std::exit(1);
+    }
+    // the session starts with the first case, or a restored session's
+    if (g_firstCase >= g_worklist.size())
+      g_firstCase = 0;
+    g_filenames = {g_worklist.at(g_firstCase).volume};
+    g_jsonfile = g_worklist.at(g_firstCase).predictions;
+  }
+  if (g_filenames.empty()) {
     printf("ERROR: no input file provided\n");
     std::exit(1);
   }
+  if (g_sharedVolumes) {
+    if (!g_lacCacheDir.empty()) {
+      printf("ERROR: --shared-volumes is a LAC cache of its own, give either "
+             "it or --lac-cache\n");
+      std::exit(1);
+    }
+    g_lacCacheDir = sharedLacCacheDir();
+    g_sharedVolumes = !g_lacCacheDir.empty();
+    if (!g_sharedVolumes)
+      printf("WARNING: no shared memory, volumes are not shared\n");
+  }
+  if (!g_workerAddress.empty())
+    return viewer::runWorker();
+  if (g_servePort > 0)
+    return viewer::runServer();
+  if (!g_benchFile.empty())
+    return viewer::runBench();
+  if (!g_evaluateFile.empty())
+    return viewer::runEvaluate();
+  if (!g_trackSource.empty())
+    return viewer::runTrack();
+  if (g_buildTemplates)
+    return viewer::runBuildTemplates();
+  if (!g_projectFile.empty() || !g_backprojectFiles[0].empty())
+    return viewer::runProjector();
+  if (!g_batchDir.empty() && g_samples.count > 0)
+    return viewer::runSamples();
+  if (!g_batchDir.empty())
+    return viewer::runBatch();
+  if (g_outOfCoreBytes && g_filenames.size() > 1) {
+    printf("ERROR: --out-of-core streams a single volume\n");
+    std::exit(1);
+  }
+  if (g_rendererName == "builtin") {
+    printf("ERROR: --renderer builtin renders headless modes only (--batch, "
+           "--evaluate, --serve, ...)\n");
+    std::exit(1);
+  }
+  if (g_phaseRate > 0.f
+      && (g_lutCacheBytes || g_lodLevels || g_outOfCoreBytes
+          || g_brickSize > 0 || g_fitMemory || g_clip)) {
+    printf("ERROR: --play rewrites linear fields in place, it does not go "
+           "with --lut-cache, --lod, --bricks, --out-of-core, --fit-memory "
+           "or --clip\n");
+    std::exit(1);
+  }
   viewer::Application app;
   app.run(1920, 1200, "ANARI DRR Viewer");
   return 0;